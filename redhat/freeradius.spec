@@ -751,6 +751,7 @@ fi
 # man-pages
 %doc %{_mandir}/man1/dhcpclient.1.gz
 %doc %{_mandir}/man1/radclient.1.gz
+%doc %{_mandir}/man1/raddetail.1.gz
 %doc %{_mandir}/man1/rad_counter.1.gz
 %doc %{_mandir}/man1/radeapclient.1.gz
 %doc %{_mandir}/man1/radlast.1.gz
@@ -802,6 +803,7 @@ fi
 %defattr(-,root,root)
 %{_libdir}/freeradius/rlm_redis.so
 %{_libdir}/freeradius/rlm_rediswho.so
+%{_libdir}/freeradius/rlm_cache_redis.so
 
 %files rest
 %defattr(-,root,root)
@@ -36,6 +36,8 @@ typedef enum detail_state_t {
 #  endif
 #endif
 
+typedef struct detail_window_t detail_window_t;
+
 typedef struct listen_detail_t {
 	fr_event_t	*ev;	/* has to be first entry (ugh) */
 	char const 	*name;			//!< Identifier used in log messages
@@ -78,6 +80,15 @@ typedef struct listen_detail_t {
 	uint32_t	counter;
 	struct timeval  last_packet;
 	RADCLIENT	detail_client;
+
+	bool		binary;			//!< Whether the work file is a binary detail file.
+	uint32_t	checkpoint;		//!< Sequence number of the last checkpoint.
+	off_t		checkpoint_offset;	//!< Offset saved by the last checkpoint.
+	time_t		checkpointed;		//!< When the last checkpoint was saved.
+
+	uint32_t	window;			//!< Maximum number of entries being processed at once.
+	uint32_t	cwnd;			//!< Current window, adjusted to the latency of the backend.
+	detail_window_t	*win;			//!< Entries being processed.
 } listen_detail_t;
 
 int detail_recv(rad_listen_t *listener);
@@ -88,6 +99,71 @@ int detail_encode(UNUSED rad_listen_t *this, UNUSED REQUEST *request);
 int detail_decode(UNUSED rad_listen_t *this, UNUSED REQUEST *request);
 int detail_parse(CONF_SECTION *cs, rad_listen_t *this);
 
+/*
+ *	Binary detail files.  These start with a file header, followed
+ *	by length prefixed records.  All numbers are in network byte
+ *	order.
+ *
+ *	The file header is:
+ *
+ *		"FRDETAIL"	8 octets
+ *		version		4 octets
+ *		reserved	4 octets
+ *		checkpoint	16 octets, twice
+ *
+ *	The reader saves its progress to the checkpoints, alternating
+ *	between them, so that a torn write leaves the other one valid.
+ *	Each checkpoint is:
+ *
+ *		offset		8 octets, of the first record not done
+ *		sequence	4 octets, the highest valid one is used
+ *		hash		4 octets, of the offset and sequence
+ *
+ *	Each record is:
+ *
+ *		magic		4 octets
+ *		length		2 octets, of the data after the record header
+ *		type		1 octet
+ *		flags		1 octet, set by the reader
+ *		timestamp	4 octets, when the record was written
+ *		hash		4 octets, of the record, except for the flags
+ *
+ *	A packet record contains the packet source and destination,
+ *	then the packet, as encoded by rad_encode():
+ *
+ *		src af		1 octet, 0 if the addresses weren't logged
+ *		dst af		1 octet
+ *		reserved	2 octets
+ *		src port	2 octets
+ *		dst port	2 octets
+ *		src ipaddr	16 octets
+ *		dst ipaddr	16 octets
+ *		packet		the rest of the record
+ */
+#define DETAIL_BINARY_MAGIC		"FRDETAIL"
+#define DETAIL_BINARY_VERSION		(1)
+#define DETAIL_BINARY_HEADER_LEN	(48)
+#define DETAIL_BINARY_RECORD_MAGIC	(0x46524452)
+#define DETAIL_BINARY_RECORD_LEN	(16)
+#define DETAIL_BINARY_ADDRESS_LEN	(40)
+#define DETAIL_BINARY_MAX_LEN		(DETAIL_BINARY_RECORD_LEN + DETAIL_BINARY_ADDRESS_LEN + MAX_PACKET_LEN)
+
+#define DETAIL_BINARY_FLAGS_OFFSET	(7)
+#define DETAIL_BINARY_DONE		(0x01)
+
+typedef enum detail_binary_type_t {
+	DETAIL_BINARY_PACKET = 1
+} detail_binary_type_t;
+
+void detail_binary_header(uint8_t header[DETAIL_BINARY_HEADER_LEN]);
+bool detail_binary_is_header(uint8_t const *data, size_t len);
+off_t detail_binary_checkpoint(uint8_t const header[DETAIL_BINARY_HEADER_LEN], uint32_t *sequence);
+int detail_binary_checkpoint_write(int fd, off_t offset, uint32_t sequence);
+ssize_t detail_binary_encode(TALLOC_CTX *ctx, uint8_t **out, RADIUS_PACKET const *packet, VALUE_PAIR *vps,
+			     bool addresses, time_t timestamp);
+ssize_t detail_binary_check(uint8_t const *data, size_t len);
+RADIUS_PACKET *detail_binary_decode(TALLOC_CTX *ctx, uint8_t const *record, bool *done);
+
 #ifdef __cplusplus
 }
 #endif
@@ -36,7 +36,10 @@ extern "C" {
 typedef struct exfile_t exfile_t;
 
 exfile_t *exfile_init(TALLOC_CTX *ctx, uint32_t entries, uint32_t idle, bool locking);
+int exfile_enable_buffer(exfile_t *lf, size_t size, uint32_t flush_interval, bool sync);
 int exfile_open(exfile_t *lf, char const *filename, mode_t permissions);
+ssize_t exfile_write(exfile_t *lf, int fd, void const *data, size_t len);
+off_t exfile_size(exfile_t *lf, int fd);
 int exfile_close(exfile_t *lf, int fd);
 
 #ifdef __cplusplus
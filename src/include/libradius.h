@@ -293,12 +293,17 @@ typedef enum value_type {
  *
  * They also specify what behaviour should be used when the attribute is merged into a new list/tree.
  */
+typedef struct fr_pair_index fr_pair_index_t;
+
 typedef struct value_pair {
 	DICT_ATTR const		*da;				//!< Dictionary attribute defines the attribute
 								//!< number, vendor and type of the attribute.
 
 	struct value_pair	*next;
 
+	fr_pair_index_t		*index;				//!< Attribute index, only ever set on the
+								//!< first VALUE_PAIR of a list.
+
 	FR_TOKEN		op;				//!< Operator to use when moving or inserting
 								//!< valuepair into a list.
 
@@ -593,6 +598,14 @@ void		fr_pair_list_free(VALUE_PAIR **);
 VALUE_PAIR	*fr_pair_find_by_num(VALUE_PAIR *, unsigned int attr, unsigned int vendor, int8_t tag);
 VALUE_PAIR	*fr_pair_find_by_da(VALUE_PAIR *, DICT_ATTR const *da, int8_t tag);
 
+#define FR_PAIR_INDEX_MIN	16	//!< Shortest list fr_pair_list_index() will index.
+int		fr_pair_list_index(VALUE_PAIR *head);
+void		fr_pair_list_unindex(VALUE_PAIR *head);
+VALUE_PAIR	*fr_pair_index_find(VALUE_PAIR const *head, unsigned int attr, unsigned int vendor);
+void		fr_pair_index_add(VALUE_PAIR *head, VALUE_PAIR *add);
+void		fr_pair_index_remove(VALUE_PAIR *head, VALUE_PAIR *vp);
+void		fr_pair_index_replace(VALUE_PAIR *head, VALUE_PAIR *old, VALUE_PAIR *new);
+
 VALUE_PAIR	*fr_cursor_init(vp_cursor_t *cursor, VALUE_PAIR * const *node);
 void		fr_cursor_copy(vp_cursor_t *out, vp_cursor_t *in);
 VALUE_PAIR	*fr_cursor_first(vp_cursor_t *cursor);
@@ -63,6 +63,16 @@ typedef enum log_dst {
 	L_DST_NUM_DEST
 } log_dst_t;
 
+/** What to do when a thread's queue of asynchronous log messages is full
+ *
+ */
+typedef enum log_async_overflow {
+	L_ASYNC_DROP = 0,	//!< Drop the message.
+	L_ASYNC_COUNT,		//!< Drop the message, and log how many were dropped
+				//!< once there's space again.
+	L_ASYNC_BLOCK		//!< Wait for the writer thread to make space.
+} log_async_overflow_t;
+
 typedef struct fr_log_t {
 	bool		colourise;	//!< Prefix log messages with VT100 escape codes to change text
 					//!< colour.
@@ -70,6 +80,10 @@ typedef struct fr_log_t {
 	log_dst_t	dst;		//!< Log destination.
 	char const	*file;		//!< Path to log file.
 	char const	*debug_file;	//!< Path to debug log file.
+
+	bool		async;		//!< Queue messages, and write them from a separate thread.
+	uint32_t	async_buffer_size;	//!< Size of each thread's queue of messages.
+	log_async_overflow_t async_overflow;	//!< What to do when a thread's queue is full.
 } fr_log_t;
 
 typedef		void (*radlog_func_t)(log_type_t lvl, log_lvl_t priority, REQUEST *, char const *, va_list ap);
@@ -77,10 +91,17 @@ typedef		void (*radlog_func_t)(log_type_t lvl, log_lvl_t priority, REQUEST *, ch
 extern FR_NAME_NUMBER const syslog_facility_table[];
 extern FR_NAME_NUMBER const syslog_severity_table[];
 extern FR_NAME_NUMBER const log_str2dst[];
+extern FR_NAME_NUMBER const log_str2async_overflow[];
 extern fr_log_t default_log;
 
 int	radlog_init(fr_log_t *log, bool daemonize);
 
+int	radlog_async_start(void);
+
+void	radlog_async_stop(void);
+
+void	radlog_async_stats(uint64_t *queued, uint64_t *dropped, uint64_t *writes);
+
 int	vradlog(log_type_t lvl, char const *fmt, va_list ap)
 	CC_HINT(format (printf, 2, 0)) CC_HINT(nonnull);
 int	radlog(log_type_t lvl, char const *fmt, ...)
@@ -78,9 +78,18 @@ USES_APPLE_DEPRECATED_API
 #endif
 
 /* hmac.c */
+typedef struct FR_HMACMD5Context {
+	FR_MD5_CTX inner;			//!< State after absorbing the key XOR ipad.
+	FR_MD5_CTX outer;			//!< State after absorbing the key XOR opad.
+} FR_HMAC_MD5_CTX;
+
 void	fr_hmac_md5(uint8_t digest[MD5_DIGEST_LENGTH], uint8_t const *text, size_t text_len,
 		    uint8_t const *key, size_t key_len)
 	CC_BOUNDED(__minbytes__, 1, MD5_DIGEST_LENGTH);
+void	fr_hmac_md5_init(FR_HMAC_MD5_CTX *ctx, uint8_t const *key, size_t key_len);
+void	fr_hmac_md5_calc(uint8_t digest[MD5_DIGEST_LENGTH], FR_HMAC_MD5_CTX const *ctx,
+			 uint8_t const *text, size_t text_len)
+	CC_BOUNDED(__minbytes__, 1, MD5_DIGEST_LENGTH);
 
 /* md5.c */
 void	fr_md5_calc(uint8_t *out, uint8_t const *in, size_t inlen);
@@ -54,6 +54,10 @@ typedef struct module_instance_t {
 	bool			force;
 	rlm_rcode_t		code;
 	fr_module_hup_t	       	*mh;
+	uint64_t		bootstrap_usec;		//!< Time spent loading and bootstrapping the module.
+	uint64_t		instantiate_usec;	//!< Time spent instantiating the module.
+	uint64_t		jobs_usec;		//!< Time spent in the module's startup jobs.
+	uint32_t		jobs;			//!< Number of startup jobs the module added.
 } module_instance_t;
 
 module_instance_t	*module_instantiate(CONF_SECTION *modules, char const *askedname);
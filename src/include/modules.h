@@ -82,6 +82,10 @@ extern const section_type_value_t section_type_value[];
 						//!< Server will instantiated
 						//!< new instance, and then
 						//!< destroy old instance.
+#define RLM_TYPE_PARALLEL_START	(1 << 3)	//!< Module's connections may be
+						//!< opened by startup jobs, as
+						//!< its drivers need no per-thread
+						//!< library initialisation.
 
 
 /* Stop people using different module/library/server versions together */
@@ -141,9 +145,29 @@ typedef struct module_t {
 	packetmethod		methods[MOD_COUNT];	//!< Pointers to the various section functions.
 } module_t;
 
+/** Module startup job
+ *
+ * Slow work done when a module is instantiated, which doesn't depend on
+ * anything else being instantiated, like opening the initial connections
+ * of a pool, or loading large files.
+ *
+ * May be called from a thread of its own, and in parallel with the jobs
+ * of other modules, so must not modify anything shared with the rest of
+ * the server.
+ *
+ * @param[in] uctx passed to #module_job_add.
+ * @return -1 if the job failed, and the server should not start, else 0.
+ */
+typedef int (*module_job_t)(void *uctx);
+
 int modules_init(CONF_SECTION *);
 int modules_free(void);
 int modules_hup(CONF_SECTION *modules);
+void module_jobs_begin(void);
+int module_jobs_end(void);
+int module_job_add(module_job_t job, void *uctx);
+void module_job_cancel(void *uctx);
+bool module_parallel_start(void);
 rlm_rcode_t process_authorize(int type, REQUEST *request);
 rlm_rcode_t process_authenticate(int type, REQUEST *request);
 rlm_rcode_t module_preacct(REQUEST *request);
@@ -84,6 +84,9 @@ struct fr_cond_t {
 
 	DICT_ATTR const *cast;
 
+	struct regex_prefilter const *prefilter;	//!< Shared by an if / elsif chain of regexes.
+	int		prefilter_literal;		//!< This regex's literal in the prefilter.
+
 	fr_cond_op_t	next_op;
 	fr_cond_t	*next;
 };
@@ -448,6 +448,18 @@ void	regex_sub_to_request(REQUEST *request, regex_t **preg, char const *value,
 
 int	regex_request_to_sub(TALLOC_CTX *ctx, char **out, REQUEST *request, uint32_t num);
 
+ssize_t	regex_cache_compile(regex_t **out, char const *pattern, size_t len, bool ignore_case, bool multiline);
+void	regex_cache_release(regex_t *preg);
+void	regex_cache_free(void);
+
+typedef struct regex_prefilter regex_prefilter_t;
+
+regex_prefilter_t *regex_prefilter_alloc(TALLOC_CTX *ctx);
+int	regex_prefilter_add(regex_prefilter_t *pf, char const *pattern, size_t len);
+int	regex_prefilter_build(regex_prefilter_t *pf);
+bool	regex_prefilter_match(REQUEST *request, regex_prefilter_t const *pf, int literal,
+			      char const *value, size_t len);
+
 /*
  *	Named capture groups only supported by PCRE.
  */
@@ -555,6 +567,7 @@ char const *get_radius_dir(void);
 int main_config_init(void);
 int main_config_free(void);
 void main_config_hup(void);
+int main_config_reload_clients(void);
 void hup_logfile(void);
 
 /* listen.c */
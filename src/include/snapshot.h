@@ -0,0 +1,58 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+/*
+ * $Id$
+ *
+ * @file snapshot.h
+ * @brief Versioned data which can be reloaded while it's being used.
+ *
+ * @copyright 2015 The FreeRADIUS server project
+ */
+RCSIDH(snapshot_h, "$Id$")
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct fr_snapshot_t fr_snapshot_t;
+
+/** Build a new version of the data
+ *
+ * May be called from a thread of its own, so must not modify anything
+ * shared with the rest of the server.
+ *
+ * @param[in] ctx to allocate the data in.
+ * @param[in] uctx passed to #fr_snapshot_init.
+ * @return the data, or NULL on error.
+ */
+typedef void *(*fr_snapshot_build_t)(TALLOC_CTX *ctx, void *uctx);
+
+fr_snapshot_t	*fr_snapshot_init(TALLOC_CTX *ctx, char const *name, fr_snapshot_build_t build, void *uctx,
+				  uint32_t check_interval);
+int		fr_snapshot_watch(fr_snapshot_t *snap, char const *filename);
+int		fr_snapshot_load(fr_snapshot_t *snap);
+int		fr_snapshot_reload(fr_snapshot_t *snap);
+void		*fr_snapshot_acquire(fr_snapshot_t *snap);
+void		fr_snapshot_release(fr_snapshot_t *snap, void *data);
+uint64_t	fr_snapshot_version(fr_snapshot_t *snap);
+int		fr_snapshot_reload_by_name(char const *name);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
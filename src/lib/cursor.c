@@ -157,9 +157,15 @@ VALUE_PAIR *fr_cursor_next_by_num(vp_cursor_t *cursor, unsigned int attr, unsign
 
 	if (!cursor->first) return NULL;
 
-	for (i = !cursor->found ? cursor->current : cursor->found->next;
-	     i != NULL;
-	     i = i->next) {
+	i = !cursor->found ? cursor->current : cursor->found->next;
+
+	/*
+	 *	Starting from the head of an indexed list, skip
+	 *	straight to the first attribute with this number.
+	 */
+	if (i && i->index) i = fr_pair_index_find(i, attr, vendor);
+
+	for (; i != NULL; i = i->next) {
 		VERIFY_VP(i);
 		if ((i->da->attr == attr) && (i->da->vendor == vendor) &&
 		    (!i->da->flags.has_tag || TAG_EQ(tag, i->tag))) {
@@ -192,9 +198,10 @@ VALUE_PAIR *fr_cursor_next_by_da(vp_cursor_t *cursor, DICT_ATTR const *da, int8_
 
 	if (!cursor->first) return NULL;
 
-	for (i = !cursor->found ? cursor->current : cursor->found->next;
-	     i != NULL;
-	     i = i->next) {
+	i = !cursor->found ? cursor->current : cursor->found->next;
+	if (i && i->index) i = fr_pair_index_find(i, da->attr, da->vendor);
+
+	for (; i != NULL; i = i->next) {
 		VERIFY_VP(i);
 		if ((i->da == da) &&
 		    (!i->da->flags.has_tag || TAG_EQ(tag, i->tag))) {
@@ -280,6 +287,7 @@ void fr_cursor_insert(vp_cursor_t *cursor, VALUE_PAIR *vp)
 	 *	Only allow one VP to by inserted at a time
 	 */
 	vp->next = NULL;
+	fr_pair_list_unindex(vp);
 
 	/*
 	 *	Cursor was initialised with a pointer to a NULL value_pair
@@ -323,6 +331,7 @@ void fr_cursor_insert(vp_cursor_t *cursor, VALUE_PAIR *vp)
 	 */
 	cursor->last->next = vp;
 	cursor->last = vp;	/* Wind it forward a little more */
+	fr_pair_index_add(*cursor->first, vp);
 
 	/*
 	 *	If the next pointer was NULL, and the VALUE_PAIR
@@ -385,6 +394,8 @@ VALUE_PAIR *fr_cursor_remove(vp_cursor_t *cursor)
 	vp = cursor->current;
 	if (!vp) return NULL;
 
+	fr_pair_index_remove(*(cursor->first), vp);
+
 	/*
 	 *	Where VP is head of the list
 	 */
@@ -453,6 +464,7 @@ VALUE_PAIR *fr_cursor_replace(vp_cursor_t *cursor, VALUE_PAIR *new)
 
 	fr_cursor_next(cursor);   /* Advance the cursor past the one were about to replace */
 
+	fr_pair_index_replace(*cursor->first, vp, new);
 	*last = new;
 	new->next = vp->next;
 	vp->next = NULL;
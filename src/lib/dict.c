@@ -37,6 +37,9 @@ RCSID("$Id$")
 #include	<sys/stat.h>
 #endif
 
+#include	<fcntl.h>
+#include	<sys/mman.h>
+
 static fr_hash_table_t *vendors_byname = NULL;
 static fr_hash_table_t *vendors_byvalue = NULL;
 
@@ -57,11 +60,25 @@ static DICT_ATTR *dict_base_attrs[256];
 typedef struct dict_stat_t {
 	struct dict_stat_t *next;
 	struct stat stat_buf;
+	char name[1];
 } dict_stat_t;
 
 static dict_stat_t *stat_head = NULL;
 static dict_stat_t *stat_tail = NULL;
 
+/*
+ *	Dictionaries which we tried to read, but didn't exist.  Only
+ *	used to check that the compiled dictionaries are up to date.
+ */
+static dict_stat_t *missing_head = NULL;
+
+/*
+ *	The compiled dictionaries, if they were loaded from the
+ *	cache.  The attributes, values and vendors point into it.
+ */
+static void *dict_cache = NULL;
+static size_t dict_cache_len = 0;
+
 typedef struct value_fixup_t {
 	char		attrstr[DICT_ATTR_MAX_NAME_LEN];
 	DICT_VALUE	*dval;
@@ -337,6 +354,12 @@ static void dict_stat_free(void)
 {
 	dict_stat_t *this, *next;
 
+	for (this = missing_head; this != NULL; this = next) {
+		next = this->next;
+		free(this);
+	}
+	missing_head = NULL;
+
 	if (!stat_head) {
 		stat_tail = NULL;
 		return;
@@ -354,15 +377,17 @@ static void dict_stat_free(void)
 /*
  *	Add an entry to the list of stat buffers.
  */
-static void dict_stat_add(struct stat const *stat_buf)
+static void dict_stat_add(char const *name, struct stat const *stat_buf)
 {
 	dict_stat_t *this;
+	size_t len = strlen(name);
 
-	this = malloc(sizeof(*this));
+	this = malloc(sizeof(*this) + len);
 	if (!this) return;
 	memset(this, 0, sizeof(*this));
 
 	memcpy(&(this->stat_buf), stat_buf, sizeof(this->stat_buf));
+	memcpy(this->name, name, len + 1);
 
 	if (!stat_head) {
 		stat_head = stat_tail = this;
@@ -373,6 +398,24 @@ static void dict_stat_add(struct stat const *stat_buf)
 }
 
 
+/*
+ *	Remember a dictionary which doesn't exist.
+ */
+static void dict_missing_add(char const *name)
+{
+	dict_stat_t *this;
+	size_t len = strlen(name);
+
+	this = malloc(sizeof(*this) + len);
+	if (!this) return;
+	memset(this, 0, sizeof(*this));
+
+	memcpy(this->name, name, len + 1);
+
+	this->next = missing_head;
+	missing_head = this;
+}
+
 /*
  *	See if any dictionaries have changed.  If not, don't
  *	do anything.
@@ -501,6 +544,304 @@ static void fr_pool_free(UNUSED void *ptr)
 	 */
 }
 
+/*
+ *	Frozen index of the attributes and vendors by number.
+ *
+ *	It's built once the dictionaries have been read, and is a
+ *	two level perfect hash (FKS).  The first level hashes the key
+ *	to a bucket, and each bucket has its own seed, chosen so that
+ *	none of its keys collide in its slots.  So a lookup is two
+ *	hashes and one comparison, and never walks a chain.
+ *
+ *	Attributes and vendors added after the index is built
+ *	(e.g. by dict_unknown_add()) update their slot if they have
+ *	one.  If they don't, lookups which miss the index fall back
+ *	to the hash tables.
+ */
+typedef struct dict_index_slot_t {
+	uint64_t		key;
+	void			*data;
+} dict_index_slot_t;
+
+typedef struct dict_index_bucket_t {
+	uint32_t		seed;
+	uint32_t		mask;
+	uint32_t		offset;
+} dict_index_bucket_t;
+
+typedef struct dict_index_t {
+	uint32_t		seed;
+	uint32_t		mask;
+	uint32_t		added;		//!< Keys which were added after the index was built.
+	dict_index_bucket_t	*buckets;
+	dict_index_slot_t	*slots;		//!< Slot 0 is always empty, for empty buckets.
+} dict_index_t;
+
+static dict_index_t attributes_index;
+static dict_index_t vendors_index;
+
+#define DICT_INDEX_EMPTY		(UINT64_MAX)
+#define DICT_INDEX_MAX_SLOTS		(1 << 20)
+#define DICT_ATTR_KEY(_vendor, _attr)	((((uint64_t) (_vendor)) << 32) | (uint32_t) (_attr))
+
+static inline CC_HINT(always_inline) uint64_t dict_index_hash(uint64_t key, uint32_t seed)
+{
+	key += (seed + 1) * 0x9e3779b97f4a7c15ULL;
+	key ^= key >> 30;
+	key *= 0xbf58476d1ce4e5b9ULL;
+	key ^= key >> 27;
+	key *= 0x94d049bb133111ebULL;
+	key ^= key >> 31;
+
+	return key;
+}
+
+static inline CC_HINT(always_inline) dict_index_slot_t *dict_index_slot(dict_index_t const *idx, uint64_t key)
+{
+	dict_index_bucket_t const *bucket;
+
+	bucket = &idx->buckets[dict_index_hash(key, idx->seed) & idx->mask];
+
+	return &idx->slots[bucket->offset + (dict_index_hash(key, bucket->seed) & bucket->mask)];
+}
+
+/*
+ *	Returns true if the index has the answer, which may be NULL.
+ */
+static inline CC_HINT(always_inline) bool dict_index_find(dict_index_t const *idx, uint64_t key, void **out)
+{
+	dict_index_slot_t *slot;
+
+	if (!idx->slots) return false;
+
+	slot = dict_index_slot(idx, key);
+	if (slot->key == key) {
+		*out = slot->data;
+		return true;
+	}
+
+	if (idx->added) return false;
+
+	*out = NULL;
+	return true;
+}
+
+/*
+ *	Update the index after a change to the hash tables.
+ */
+static void dict_index_set(dict_index_t *idx, uint64_t key, void *data)
+{
+	dict_index_slot_t *slot;
+
+	if (!idx->slots) return;
+
+	slot = dict_index_slot(idx, key);
+	if (slot->key == key) {
+		slot->data = data;
+		return;
+	}
+
+	if (data) idx->added++;
+}
+
+static void dict_index_free(dict_index_t *idx)
+{
+	free(idx->buckets);
+	free(idx->slots);
+	memset(idx, 0, sizeof(*idx));
+}
+
+typedef struct dict_index_entry_t {
+	uint64_t		key;
+	void			*data;
+} dict_index_entry_t;
+
+typedef struct dict_index_walk_t {
+	dict_index_entry_t	*entries;
+	uint32_t		num;
+	uint64_t		(*key)(void const *data);
+} dict_index_walk_t;
+
+static int dict_index_walk(void *ctx, void *data)
+{
+	dict_index_walk_t *walk = ctx;
+
+	walk->entries[walk->num].key = walk->key(data);
+	walk->entries[walk->num].data = data;
+	walk->num++;
+
+	return 0;
+}
+
+static uint64_t dict_attr_key(void const *data)
+{
+	DICT_ATTR const *da = data;
+
+	return DICT_ATTR_KEY(da->vendor, da->attr);
+}
+
+static uint64_t dict_vendor_key(void const *data)
+{
+	return ((DICT_VENDOR const *) data)->vendorpec;
+}
+
+/*
+ *	Find a seed for one bucket, which puts each of its keys in a
+ *	different slot.  Returns the number of slots the bucket needs.
+ */
+static uint32_t dict_index_bucket(dict_index_bucket_t *bucket, dict_index_entry_t const *entries, uint32_t num,
+				  uint8_t *used)
+{
+	uint32_t size, i, tries;
+
+	for (size = 1; size < (num * num); size <<= 1);
+
+	while (size <= DICT_INDEX_MAX_SLOTS) {
+		bucket->mask = size - 1;
+
+		for (tries = 0; tries < 64; tries++) {
+			bucket->seed = tries;
+			memset(used, 0, size);
+
+			for (i = 0; i < num; i++) {
+				uint32_t slot = dict_index_hash(entries[i].key, bucket->seed) & bucket->mask;
+
+				if (used[slot]) break;
+				used[slot] = 1;
+			}
+			if (i == num) return size;
+		}
+
+		size <<= 1;
+	}
+
+	return 0;
+}
+
+/*
+ *	Build the index from one of the hash tables.
+ */
+static int dict_index_build(dict_index_t *idx, fr_hash_table_t *ht, uint64_t (*key)(void const *data))
+{
+	dict_index_walk_t	walk;
+	dict_index_entry_t	*sorted = NULL;
+	uint32_t		*start = NULL;
+	uint8_t			*used = NULL;
+	uint32_t		num, nb, i, b, total, tries;
+	uint64_t		squares;
+
+	dict_index_free(idx);
+
+	num = fr_hash_table_num_elements(ht);
+	if (!num) return 0;
+
+	walk.entries = malloc(sizeof(*walk.entries) * num);
+	walk.num = 0;
+	walk.key = key;
+	if (!walk.entries) return -1;
+
+	fr_hash_table_walk(ht, dict_index_walk, &walk);
+	num = walk.num;
+
+	for (nb = 1; nb < num; nb <<= 1);
+	idx->mask = nb - 1;
+
+	idx->buckets = calloc(nb, sizeof(*idx->buckets));
+	start = calloc(nb + 1, sizeof(*start));
+	sorted = malloc(sizeof(*sorted) * num);
+	used = malloc(DICT_INDEX_MAX_SLOTS);
+	if (!idx->buckets || !start || !sorted || !used) goto error;
+
+	for (i = 0; i < num; i++) {
+		if (walk.entries[i].key == DICT_INDEX_EMPTY) goto error;
+	}
+
+	/*
+	 *	Choose a first level seed which spreads the keys out
+	 *	well enough that the buckets don't need too many
+	 *	slots.
+	 */
+	for (tries = 0; tries < 16; tries++) {
+		idx->seed = tries;
+		memset(start, 0, sizeof(*start) * (nb + 1));
+
+		for (i = 0; i < num; i++) start[(dict_index_hash(walk.entries[i].key, idx->seed) & idx->mask) + 1]++;
+
+		for (b = 1, squares = 0; b <= nb; b++) squares += (uint64_t) start[b] * start[b];
+		if (squares <= (3 * (uint64_t) num)) break;
+	}
+
+	/*
+	 *	Group the keys by bucket.
+	 */
+	for (b = 1; b <= nb; b++) start[b] += start[b - 1];
+	for (i = 0; i < num; i++) {
+		b = dict_index_hash(walk.entries[i].key, idx->seed) & idx->mask;
+		sorted[start[b]++] = walk.entries[i];
+	}
+	for (b = nb; b > 0; b--) start[b] = start[b - 1];
+	start[0] = 0;
+
+	total = 1;
+	for (b = 0; b < nb; b++) {
+		uint32_t size;
+
+		if (start[b] == start[b + 1]) continue;
+
+		size = dict_index_bucket(&idx->buckets[b], &sorted[start[b]], start[b + 1] - start[b], used);
+		if (!size) goto error;
+
+		idx->buckets[b].offset = total;
+		total += size;
+	}
+
+	idx->slots = malloc(sizeof(*idx->slots) * total);
+	if (!idx->slots) goto error;
+
+	for (i = 0; i < total; i++) {
+		idx->slots[i].key = DICT_INDEX_EMPTY;
+		idx->slots[i].data = NULL;
+	}
+
+	for (i = 0; i < num; i++) {
+		dict_index_slot_t *slot = dict_index_slot(idx, sorted[i].key);
+
+		slot->key = sorted[i].key;
+		slot->data = sorted[i].data;
+	}
+
+	free(walk.entries);
+	free(sorted);
+	free(start);
+	free(used);
+
+	return 0;
+
+error:
+	free(walk.entries);
+	free(sorted);
+	free(start);
+	free(used);
+	dict_index_free(idx);
+
+	return -1;
+}
+
+/*
+ *	(Re)build the indexes after the dictionaries have been
+ *	read.  Failing just means we use the hash tables.
+ */
+static void dict_index_init(void)
+{
+	if (dict_index_build(&attributes_index, attributes_byvalue, dict_attr_key) < 0) {
+		fr_strerror_printf("dict_init: Failed indexing attributes");
+	}
+
+	if (dict_index_build(&vendors_index, vendors_byvalue, dict_vendor_key) < 0) {
+		fr_strerror_printf("dict_init: Failed indexing vendors");
+	}
+}
+
 /*
  *	Free the dictionary_attributes and dictionary_values lists.
  */
@@ -528,8 +869,17 @@ void dict_free(void)
 
 	memset(dict_base_attrs, 0, sizeof(dict_base_attrs));
 
+	dict_index_free(&attributes_index);
+	dict_index_free(&vendors_index);
+
 	fr_pool_delete(&dict_pool);
 
+	if (dict_cache) {
+		munmap(dict_cache, dict_cache_len);
+		dict_cache = NULL;
+		dict_cache_len = 0;
+	}
+
 	dict_stat_free();
 }
 
@@ -594,6 +944,7 @@ int dict_addvendor(char const *name, unsigned int value)
 			   name);
 		return -1;
 	}
+	dict_index_set(&vendors_index, dict_vendor_key(dv), dv);
 
 	return 0;
 }
@@ -1108,6 +1459,7 @@ int dict_addattr(char const *name, int attr, unsigned int vendor, PW_TYPE type,
 
 
 		fr_hash_table_delete(attributes_byvalue, a);
+		dict_index_set(&attributes_index, dict_attr_key(a), NULL);
 
 		if (!fr_hash_table_replace(attributes_byname, n)) {
 			fr_strerror_printf("dict_addattr: Internal error storing attribute %s", name);
@@ -1129,6 +1481,7 @@ int dict_addattr(char const *name, int attr, unsigned int vendor, PW_TYPE type,
 		fr_strerror_printf("dict_addattr: Failed inserting attribute name %s", name);
 		return -1;
 	}
+	dict_index_set(&attributes_index, dict_attr_key(n), n);
 
 	/*
 	 *	Hacks for combo-IP
@@ -2210,12 +2563,19 @@ static int my_dict_init(char const *parent, char const *filename,
 
 int dict_read(char const *dir, char const *filename)
 {
+	int rcode;
+
 	if (!attributes_byname) {
 		fr_strerror_printf("Must call dict_init() before dict_read()");
 		return -1;
 	}
 
-	return my_dict_init(dir, filename, NULL, 0);
+	rcode = my_dict_init(dir, filename, NULL, 0);
+	if (rcode < 0) return rcode;
+
+	dict_index_init();
+
+	return 0;
 }
 
 
@@ -2306,6 +2666,8 @@ static int my_dict_init(char const *parent, char const *filename,
 	}
 
 	if ((fp = fopen(fn, "r")) == NULL) {
+		if (errno == ENOENT) dict_missing_add(fn);
+
 		if (!src_file) {
 			fr_strerror_printf("dict_init: Couldn't open dictionary \"%s\": %s",
 				   fn, fr_syserror(errno));
@@ -2337,7 +2699,7 @@ static int my_dict_init(char const *parent, char const *filename,
 	}
 #endif
 
-	dict_stat_add(&statbuf);
+	dict_stat_add(fn, &statbuf);
 
 	/*
 	 *	Seed the random pool with data.
@@ -2621,26 +2983,11 @@ static int null_callback(UNUSED void *ctx, UNUSED void *data)
 	return 0;
 }
 
-
 /*
- *	Initialize the directory, then fix the attr member of
- *	all attributes.
+ *	Create the (empty) tables of vendors, attributes and values.
  */
-int dict_init(char const *dir, char const *fn)
+static int dict_tables_init(void)
 {
-	/*
-	 *	Check if we need to change anything.  If not, don't do
-	 *	anything.
-	 */
-	if (dict_stat_check(dir, fn)) {
-		return 0;
-	}
-
-	/*
-	 *	Free the dictionaries, and the stat cache.
-	 */
-	dict_free();
-
 	/*
 	 *	Create the table of vendor by name.   There MAY NOT
 	 *	be multiple vendors of the same name.
@@ -2715,6 +3062,462 @@ int dict_init(char const *dir, char const *fn)
 		return -1;
 	}
 
+	return 0;
+}
+
+/*
+ *	The compiled dictionary cache.
+ *
+ *	Parsing the text dictionaries is most of the start up time of
+ *	the server and the command line tools.  If FR_DICT_CACHE_DIR
+ *	is set in the environment, then once they've been parsed, the
+ *	contents of the tables are written to a file in that
+ *	directory, which later processes mmap() instead.  The
+ *	attributes, values and vendors are used in place, so the pages
+ *	holding them are shared between processes, and only the hash
+ *	tables indexing them are built on load.
+ *
+ *	The file is:
+ *
+ *		dict_cache_header_t
+ *		dict_cache_file_t, followed by the file name, for every
+ *			dictionary which was read, and every optional
+ *			dictionary which didn't exist
+ *		uint32_t offsets of the entries in each table
+ *		the entries
+ *
+ *	It's only used if none of the dictionaries it was built from
+ *	have changed, none of the missing ones have been created, and
+ *	it was written by the same version of the server, as the
+ *	entries are the in-memory structures.
+ */
+typedef enum {
+	DICT_CACHE_VENDORS_BYNAME = 0,
+	DICT_CACHE_VENDORS_BYVALUE,
+	DICT_CACHE_ATTRIBUTES_BYNAME,
+	DICT_CACHE_ATTRIBUTES_BYVALUE,
+	DICT_CACHE_ATTRIBUTES_COMBO,
+	DICT_CACHE_VALUES_BYNAME,
+	DICT_CACHE_VALUES_BYVALUE,
+	DICT_CACHE_MAX
+} dict_cache_table_t;
+
+#define DICT_CACHE_ALIGN(_x) (((_x) + 7) & ~((size_t) 7))
+
+typedef struct dict_cache_header_t {
+	uint64_t	magic;				//!< RADIUSD_MAGIC_NUMBER.
+	uint32_t	sizes[3];			//!< Of DICT_VENDOR, DICT_ATTR and DICT_VALUE.
+	uint32_t	num_files;			//!< Dictionaries the cache was built from.
+	uint32_t	num_entries[DICT_CACHE_MAX];	//!< In each table.
+	uint32_t	pad;
+	uint64_t	length;				//!< Of the whole file.
+} dict_cache_header_t;
+
+typedef struct dict_cache_file_t {
+	int64_t		mtime;
+	int64_t		size;				//!< -1 if the file didn't exist.
+	uint64_t	ino;
+	uint32_t	len;				//!< Of the name, including padding.
+	uint32_t	pad;
+} dict_cache_file_t;
+
+typedef struct dict_cache_entry_t {
+	void const	*ptr;
+	size_t		size;
+	uint32_t	offset;
+} dict_cache_entry_t;
+
+static fr_hash_table_t **dict_cache_tables[DICT_CACHE_MAX] = {
+	[DICT_CACHE_VENDORS_BYNAME]	= &vendors_byname,
+	[DICT_CACHE_VENDORS_BYVALUE]	= &vendors_byvalue,
+	[DICT_CACHE_ATTRIBUTES_BYNAME]	= &attributes_byname,
+	[DICT_CACHE_ATTRIBUTES_BYVALUE]	= &attributes_byvalue,
+	[DICT_CACHE_ATTRIBUTES_COMBO]	= &attributes_combo,
+	[DICT_CACHE_VALUES_BYNAME]	= &values_byname,
+	[DICT_CACHE_VALUES_BYVALUE]	= &values_byvalue
+};
+
+/*
+ *	Size of the fixed part of the entries in a table.
+ */
+static size_t dict_cache_entry_size(dict_cache_table_t table)
+{
+	switch (table) {
+	case DICT_CACHE_VENDORS_BYNAME:
+	case DICT_CACHE_VENDORS_BYVALUE:
+		return sizeof(DICT_VENDOR);
+
+	case DICT_CACHE_VALUES_BYNAME:
+	case DICT_CACHE_VALUES_BYVALUE:
+		return sizeof(DICT_VALUE);
+
+	default:
+		return sizeof(DICT_ATTR);
+	}
+}
+
+static char const *dict_cache_entry_name(dict_cache_table_t table, void const *ptr)
+{
+	switch (table) {
+	case DICT_CACHE_VENDORS_BYNAME:
+	case DICT_CACHE_VENDORS_BYVALUE:
+		return ((DICT_VENDOR const *) ptr)->name;
+
+	case DICT_CACHE_VALUES_BYNAME:
+	case DICT_CACHE_VALUES_BYVALUE:
+		return ((DICT_VALUE const *) ptr)->name;
+
+	default:
+		return ((DICT_ATTR const *) ptr)->name;
+	}
+}
+
+static int dict_cache_ptr_cmp(void const *one, void const *two)
+{
+	dict_cache_entry_t const *a = one;
+	dict_cache_entry_t const *b = two;
+
+	if (a->ptr < b->ptr) return -1;
+	if (a->ptr > b->ptr) return +1;
+	return 0;
+}
+
+typedef struct dict_cache_walk_t {
+	dict_cache_entry_t	*entries;
+	uint32_t		num;
+	dict_cache_table_t	table;
+} dict_cache_walk_t;
+
+/*
+ *	Where the compiled version of "<dir>/<fn>" goes.
+ *
+ *	The name includes a hash of the dictionary directory, so
+ *	that different installations can share a cache directory.
+ */
+static int dict_cache_path(char *out, size_t outlen, char const *dir, char const *fn)
+{
+	char const *cache_dir;
+
+	if (!FR_DIR_IS_RELATIVE(fn)) return -1;
+
+	cache_dir = getenv("FR_DICT_CACHE_DIR");
+	if (!cache_dir || !*cache_dir) return -1;
+
+	if ((size_t) snprintf(out, outlen, "%s/%s.%08x.cache", cache_dir, fn, fr_hash_string(dir)) >= outlen) {
+		return -1;
+	}
+
+	return 0;
+}
+
+static int dict_cache_walk(void *ctx, void *data)
+{
+	dict_cache_walk_t *walk = ctx;
+	dict_cache_entry_t *entry = &walk->entries[walk->num++];
+
+	entry->ptr = data;
+	entry->size = DICT_CACHE_ALIGN(dict_cache_entry_size(walk->table) +
+				       strlen(dict_cache_entry_name(walk->table, data)));
+
+	return 0;
+}
+
+/*
+ *	Write the dictionaries we've just parsed to the cache.
+ *
+ *	Errors are ignored, we'll parse the text files again next
+ *	time.
+ */
+static void dict_cache_write(char const *dir, char const *fn)
+{
+	int			fd = -1;
+	uint32_t		i, j, num = 0, num_unique, num_files = 0, *offsets;
+	size_t			len;
+	uint8_t			*buff = NULL, *p;
+	dict_cache_header_t	*hdr;
+	dict_cache_entry_t	*entries = NULL, *unique, *found;
+	dict_cache_walk_t	walk;
+	dict_stat_t		*this;
+	char			path[2048], tmp[2048 + 8];
+
+	if (dict_cache_path(path, sizeof(path), dir, fn) < 0) return;
+
+	/*
+	 *	Get all of the entries, and give every distinct one
+	 *	an offset.  The same attribute is in more than one
+	 *	table.
+	 */
+	for (i = 0; i < DICT_CACHE_MAX; i++) num += fr_hash_table_num_elements(*dict_cache_tables[i]);
+
+	entries = malloc(sizeof(*entries) * (num ? num : 1) * 2);
+	if (!entries) return;
+
+	walk.entries = entries;
+	walk.num = 0;
+	for (i = 0; i < DICT_CACHE_MAX; i++) {
+		walk.table = i;
+		fr_hash_table_walk(*dict_cache_tables[i], dict_cache_walk, &walk);
+	}
+	if (walk.num != num) goto done;
+
+	unique = entries + num;
+	memcpy(unique, entries, sizeof(*entries) * num);
+	qsort(unique, num, sizeof(*unique), dict_cache_ptr_cmp);
+
+	len = sizeof(*hdr);
+	for (this = stat_head; this != NULL; this = this->next) {
+		len += sizeof(dict_cache_file_t) + DICT_CACHE_ALIGN(strlen(this->name) + 1);
+		num_files++;
+	}
+	for (this = missing_head; this != NULL; this = this->next) {
+		len += sizeof(dict_cache_file_t) + DICT_CACHE_ALIGN(strlen(this->name) + 1);
+		num_files++;
+	}
+	len += DICT_CACHE_ALIGN(sizeof(uint32_t) * num);
+
+	for (i = 0, j = 0; i < num; i++) {
+		if ((j > 0) && (unique[j - 1].ptr == unique[i].ptr)) continue;
+
+		unique[j] = unique[i];
+		unique[j].offset = len;
+		len += unique[j].size;
+		j++;
+	}
+	num_unique = j;
+
+	buff = calloc(1, len);
+	if (!buff) goto done;
+
+	hdr = (dict_cache_header_t *) buff;
+	hdr->magic = RADIUSD_MAGIC_NUMBER;
+	hdr->sizes[0] = sizeof(DICT_VENDOR);
+	hdr->sizes[1] = sizeof(DICT_ATTR);
+	hdr->sizes[2] = sizeof(DICT_VALUE);
+	hdr->num_files = num_files;
+	hdr->length = len;
+	p = buff + sizeof(*hdr);
+
+	for (this = stat_head; this != NULL; this = this->next) {
+		dict_cache_file_t *file = (dict_cache_file_t *) p;
+
+		file->mtime = this->stat_buf.st_mtime;
+		file->size = this->stat_buf.st_size;
+		file->ino = this->stat_buf.st_ino;
+		file->len = DICT_CACHE_ALIGN(strlen(this->name) + 1);
+		p += sizeof(*file);
+
+		strcpy((char *) p, this->name);
+		p += file->len;
+	}
+
+	for (this = missing_head; this != NULL; this = this->next) {
+		dict_cache_file_t *file = (dict_cache_file_t *) p;
+
+		file->mtime = -1;
+		file->size = -1;
+		file->len = DICT_CACHE_ALIGN(strlen(this->name) + 1);
+		p += sizeof(*file);
+
+		strcpy((char *) p, this->name);
+		p += file->len;
+	}
+
+	/*
+	 *	The offsets of the entries, table by table, in the
+	 *	order we walked them.
+	 */
+	offsets = (uint32_t *) p;
+	for (i = 0, walk.num = 0; i < DICT_CACHE_MAX; i++) {
+		uint32_t count = fr_hash_table_num_elements(*dict_cache_tables[i]);
+
+		hdr->num_entries[i] = count;
+		for (j = 0; j < count; j++, walk.num++) {
+			found = bsearch(&entries[walk.num], unique, num_unique, sizeof(*unique), dict_cache_ptr_cmp);
+			offsets[walk.num] = found->offset;
+			if (found->size == 0) continue;
+
+			memcpy(buff + found->offset, found->ptr,
+			       dict_cache_entry_size(i) + strlen(dict_cache_entry_name(i, found->ptr)));
+			found->size = 0;	/* copied */
+		}
+	}
+
+	snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+
+	fd = mkstemp(tmp);
+	if (fd < 0) goto done;
+
+	if ((fchmod(fd, 0644) < 0) || (write(fd, buff, len) != (ssize_t) len) || (rename(tmp, path) < 0)) {
+		unlink(tmp);
+	}
+
+done:
+	if (fd >= 0) close(fd);
+	free(buff);
+	free(entries);
+}
+
+/*
+ *	Load the dictionaries from the cache, if it's up to date.
+ *
+ *	Returns 0 if the dictionaries were loaded, -1 if they need to
+ *	be parsed, in which case the tables are left empty.
+ */
+static int dict_cache_load(char const *dir, char const *fn)
+{
+	int			fd;
+	uint32_t		i, j, num = 0;
+	uint8_t			*p, *end;
+	uint32_t const		*offsets;
+	dict_cache_header_t const *hdr;
+	struct stat		stat_buf;
+	char			path[2048];
+
+	if (dict_cache_path(path, sizeof(path), dir, fn) < 0) return -1;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) return -1;
+
+	/*
+	 *	Same rules as for the dictionaries themselves.
+	 */
+	if ((fstat(fd, &stat_buf) < 0) || !S_ISREG(stat_buf.st_mode) ||
+#ifdef S_IWOTH
+	    ((stat_buf.st_mode & S_IWOTH) != 0) ||
+#endif
+	    (stat_buf.st_size < (off_t) sizeof(*hdr))) {
+		close(fd);
+		return -1;
+	}
+
+	/*
+	 *	Private, so that the occasional change to an attribute
+	 *	at run time doesn't change the file.  The pages are
+	 *	shared until then.
+	 */
+	dict_cache = mmap(NULL, stat_buf.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (dict_cache == MAP_FAILED) {
+		dict_cache = NULL;
+		return -1;
+	}
+	dict_cache_len = stat_buf.st_size;
+
+	hdr = dict_cache;
+	end = (uint8_t *) dict_cache + dict_cache_len;
+
+	if ((hdr->magic != RADIUSD_MAGIC_NUMBER) || (hdr->length != dict_cache_len) ||
+	    (hdr->sizes[0] != sizeof(DICT_VENDOR)) || (hdr->sizes[1] != sizeof(DICT_ATTR)) ||
+	    (hdr->sizes[2] != sizeof(DICT_VALUE))) goto invalid;
+
+	/*
+	 *	Check none of the dictionaries have changed, or been
+	 *	created, and remember them, as if we had read them.
+	 */
+	p = (uint8_t *) dict_cache + sizeof(*hdr);
+	for (i = 0; i < hdr->num_files; i++) {
+		dict_cache_file_t const *file = (dict_cache_file_t const *) p;
+		char const *name;
+
+		if ((size_t) (end - p) < sizeof(*file)) goto invalid;
+		p += sizeof(*file);
+
+		if (((size_t) (end - p) < file->len) || !file->len || p[file->len - 1]) goto invalid;
+		name = (char const *) p;
+		p += file->len;
+
+		if (file->size < 0) {
+			if ((stat(name, &stat_buf) == 0) || (errno != ENOENT)) goto invalid;
+
+			dict_missing_add(name);
+			continue;
+		}
+
+		if ((stat(name, &stat_buf) < 0) || (stat_buf.st_mtime != file->mtime) ||
+		    (stat_buf.st_size != file->size) || (stat_buf.st_ino != file->ino)) goto invalid;
+
+		dict_stat_add(name, &stat_buf);
+		fr_rand_seed(&stat_buf, sizeof(stat_buf));
+	}
+
+	/*
+	 *	Check every entry is inside the file, and its name is
+	 *	terminated, before using any of them.
+	 */
+	for (i = 0; i < DICT_CACHE_MAX; i++) num += hdr->num_entries[i];
+
+	offsets = (uint32_t const *) p;
+	if ((size_t) (end - p) < (sizeof(*offsets) * num)) goto invalid;
+
+	for (i = 0, num = 0; i < DICT_CACHE_MAX; i++) {
+		size_t size = dict_cache_entry_size(i);
+
+		for (j = 0; j < hdr->num_entries[i]; j++, num++) {
+			uint8_t *entry = (uint8_t *) dict_cache + offsets[num];
+
+			if ((offsets[num] & 7) || (offsets[num] >= dict_cache_len) ||
+			    ((size_t) (end - entry) <= size)) goto invalid;
+
+			if (!memchr(dict_cache_entry_name(i, entry), '\0', end - (uint8_t const *) dict_cache_entry_name(i, entry))) {
+				goto invalid;
+			}
+		}
+	}
+
+	for (i = 0, num = 0; i < DICT_CACHE_MAX; i++) {
+		for (j = 0; j < hdr->num_entries[i]; j++, num++) {
+			void *entry = (uint8_t *) dict_cache + offsets[num];
+
+			if (!fr_hash_table_insert(*dict_cache_tables[i], entry)) goto invalid;
+
+			if (i == DICT_CACHE_ATTRIBUTES_BYVALUE) {
+				DICT_ATTR *da = entry;
+
+				if (!da->vendor && (da->attr > 0) && (da->attr < 256)) dict_base_attrs[da->attr] = da;
+			}
+		}
+	}
+
+	return 0;
+
+invalid:
+	dict_free();
+
+	if (dict_tables_init() < 0) return -2;
+
+	return -1;
+}
+
+/*
+ *	Initialize the directory, then fix the attr member of
+ *	all attributes.
+ */
+int dict_init(char const *dir, char const *fn)
+{
+	int rcode;
+
+	/*
+	 *	Check if we need to change anything.  If not, don't do
+	 *	anything.
+	 */
+	if (dict_stat_check(dir, fn)) {
+		return 0;
+	}
+
+	/*
+	 *	Free the dictionaries, and the stat cache.
+	 */
+	dict_free();
+
+	if (dict_tables_init() < 0) return -1;
+
+	/*
+	 *	Use the compiled dictionaries if they're up to date.
+	 */
+	rcode = dict_cache_load(dir, fn);
+	if (rcode == 0) goto done;
+	if (rcode < -1) return -1;
+
 	value_fixup = NULL;	/* just to be safe. */
 
 	if (my_dict_init(dir, fn, NULL, 0) < 0)
@@ -2764,6 +3567,9 @@ int dict_init(char const *dir, char const *fn)
 		}
 	}
 
+	dict_cache_write(dir, fn);
+
+done:
 	/*
 	 *	Walk over all of the hash tables to ensure they're
 	 *	initialized.  We do this because the threads may perform
@@ -2779,6 +3585,8 @@ int dict_init(char const *dir, char const *fn)
 	fr_hash_table_walk(values_byvalue, null_callback, NULL);
 	fr_hash_table_walk(values_byname, null_callback, NULL);
 
+	dict_index_init();
+
 	return 0;
 }
 
@@ -3125,9 +3933,12 @@ int dict_unknown_from_substr(DICT_ATTR *da, char const **name)
 DICT_ATTR const *dict_attrbyvalue(unsigned int attr, unsigned int vendor)
 {
 	DICT_ATTR da;
+	void *found;
 
 	if ((attr > 0) && (attr < 256) && !vendor) return dict_base_attrs[attr];
 
+	if (dict_index_find(&attributes_index, DICT_ATTR_KEY(vendor, attr), &found)) return found;
+
 	da.attr = attr;
 	da.vendor = vendor;
 
@@ -3243,12 +4054,15 @@ DICT_ATTR const *dict_attrbyparent(DICT_ATTR const *parent, unsigned int attr, u
 {
 	unsigned int my_attr, my_vendor;
 	DICT_ATTR da;
+	void *found;
 
 	my_attr = attr;
 	my_vendor = vendor;
 
 	if (!dict_attr_child(parent, &my_attr, &my_vendor)) return NULL;
 
+	if (dict_index_find(&attributes_index, DICT_ATTR_KEY(my_vendor, my_attr), &found)) return found;
+
 	da.attr = my_attr;
 	da.vendor = my_vendor;
 
@@ -3419,6 +4233,9 @@ int dict_vendorbyname(char const *name)
 DICT_VENDOR *dict_vendorbyvalue(int vendorpec)
 {
 	DICT_VENDOR dv;
+	void *found;
+
+	if (dict_index_find(&vendors_index, (unsigned int) vendorpec, &found)) return found;
 
 	dv.vendorpec = vendorpec;
 
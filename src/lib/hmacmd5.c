@@ -134,6 +134,67 @@ void fr_hmac_md5(uint8_t digest[MD5_DIGEST_LENGTH], uint8_t const *text, size_t
 }
 #endif /* HAVE_OPENSSL_EVP_H */
 
+/** Absorb an HMAC key into the inner and outer MD5 states
+ *
+ * The states can then be used with #fr_hmac_md5_calc for any number of
+ * messages, so the key schedule is only done once per key.
+ *
+ * @param ctx to initialise.
+ * @param key Pointer to authentication key.
+ * @param key_len Length of authentication key.
+ */
+void fr_hmac_md5_init(FR_HMAC_MD5_CTX *ctx, uint8_t const *key, size_t key_len)
+{
+	uint8_t k_ipad[64];
+	uint8_t k_opad[64];
+	uint8_t tk[16];
+	int i;
+
+	/* if key is longer than 64 bytes reset it to key=MD5(key) */
+	if (key_len > 64) {
+		fr_md5_calc(tk, key, key_len);
+
+		key = tk;
+		key_len = 16;
+	}
+
+	memset(k_ipad, 0, sizeof(k_ipad));
+	memcpy(k_ipad, key, key_len);
+	memcpy(k_opad, k_ipad, sizeof(k_opad));
+
+	for (i = 0; i < 64; i++) {
+		k_ipad[i] ^= 0x36;
+		k_opad[i] ^= 0x5c;
+	}
+
+	fr_md5_init(&ctx->inner);
+	fr_md5_update(&ctx->inner, k_ipad, sizeof(k_ipad));
+
+	fr_md5_init(&ctx->outer);
+	fr_md5_update(&ctx->outer, k_opad, sizeof(k_opad));
+}
+
+/** Calculate HMAC, continuing from the states left by #fr_hmac_md5_init
+ *
+ * @param digest Caller digest to be filled in.
+ * @param ctx initialised with the authentication key.  Isn't modified.
+ * @param text Pointer to data stream.
+ * @param text_len length of data stream.
+ */
+void fr_hmac_md5_calc(uint8_t digest[MD5_DIGEST_LENGTH], FR_HMAC_MD5_CTX const *ctx,
+		      uint8_t const *text, size_t text_len)
+{
+	FR_MD5_CTX context;
+
+	context = ctx->inner;
+	fr_md5_update(&context, text, text_len);
+	fr_md5_final(digest, &context);
+
+	context = ctx->outer;
+	fr_md5_update(&context, digest, MD5_DIGEST_LENGTH);
+	fr_md5_final(digest, &context);
+}
+
 /*
 Test Vectors (Trailing '\0' of a character string not included in test):
 
@@ -223,6 +223,323 @@ VALUE_PAIR *fr_pair_find_by_num(VALUE_PAIR *vp, unsigned int attr, unsigned int
 	return fr_cursor_next_by_num(&cursor, attr, vendor, tag);
 }
 
+/** An entry in a list's attribute index
+ *
+ */
+typedef struct fr_pair_index_entry {
+	unsigned int		attr;
+	unsigned int		vendor;
+	VALUE_PAIR		*vp;		//!< First VALUE_PAIR in the list with this number,
+						//!< NULL if the slot is free.
+} fr_pair_index_entry_t;
+
+/** Attribute index for a list of VALUE_PAIRs
+ *
+ * Maps attribute numbers to the first VALUE_PAIR in the list with that number,
+ * so that lookups starting from the head of the list don't have to walk it.
+ *
+ * The index is keyed by number rather than by DICT_ATTR, so that attributes which
+ * have been converted to unknown attributes, and attributes referenced by an alias
+ * are still found by both fr_pair_find_by_num() and fr_pair_find_by_da().
+ *
+ * The index is parented by, and only reachable from, the first VALUE_PAIR in the
+ * list.  It's kept up to date by the fr_pair_* and fr_cursor_* functions which
+ * modify lists, and dropped by the ones which reorder them.  Code which links
+ * VALUE_PAIRs in and out of an indexed list by hand, must call
+ * fr_pair_list_unindex() first.
+ */
+struct fr_pair_index {
+	VALUE_PAIR		*head;		//!< VALUE_PAIR the index hangs off.
+	uint32_t		num;		//!< Number of slots in use.
+	uint32_t		mask;		//!< Number of slots - 1.
+	fr_pair_index_entry_t	*slots;		//!< Open addressed, linear probing.
+};
+
+static inline uint32_t fr_pair_index_hash(unsigned int attr, unsigned int vendor)
+{
+	uint32_t hash;
+
+	hash = (attr ^ (vendor * 0x9e3779b1)) * 0x9e3779b1;
+
+	return hash ^ (hash >> 16);
+}
+
+/** Find the slot for an attribute number, or the free slot it would go in
+ *
+ */
+static fr_pair_index_entry_t *fr_pair_index_slot(fr_pair_index_t const *index, unsigned int attr, unsigned int vendor)
+{
+	uint32_t i;
+
+	for (i = fr_pair_index_hash(attr, vendor) & index->mask;
+	     index->slots[i].vp;
+	     i = (i + 1) & index->mask) {
+		if ((index->slots[i].attr == attr) && (index->slots[i].vendor == vendor)) break;
+	}
+
+	return &index->slots[i];
+}
+
+/** Double the size of the index
+ *
+ */
+static int fr_pair_index_grow(fr_pair_index_t *index)
+{
+	fr_pair_index_entry_t *old = index->slots, *slot;
+	uint32_t i, size = index->mask + 1;
+
+	index->slots = talloc_zero_array(index, fr_pair_index_entry_t, size * 2);
+	if (!index->slots) {
+		index->slots = old;
+		return -1;
+	}
+	index->mask = (size * 2) - 1;
+
+	for (i = 0; i < size; i++) {
+		if (!old[i].vp) continue;
+
+		slot = fr_pair_index_slot(index, old[i].attr, old[i].vendor);
+		*slot = old[i];
+	}
+	talloc_free(old);
+
+	return 0;
+}
+
+/** Add a VALUE_PAIR to the index, unless there's already an earlier one with the same number
+ *
+ * @note vp must be after any VALUE_PAIRs already in the index.
+ */
+static int fr_pair_index_insert(fr_pair_index_t *index, VALUE_PAIR *vp)
+{
+	fr_pair_index_entry_t *slot;
+
+	slot = fr_pair_index_slot(index, vp->da->attr, vp->da->vendor);
+	if (slot->vp) return 0;
+
+	/*
+	 *	Keep the table at most half full, so runs stay short.
+	 */
+	if (((index->num + 1) * 2) > (index->mask + 1)) {
+		if (fr_pair_index_grow(index) < 0) return -1;
+		slot = fr_pair_index_slot(index, vp->da->attr, vp->da->vendor);
+	}
+
+	slot->attr = vp->da->attr;
+	slot->vendor = vp->da->vendor;
+	slot->vp = vp;
+	index->num++;
+
+	return 0;
+}
+
+/** Free a slot, shifting back any entries which were displaced past it
+ *
+ */
+static void fr_pair_index_delete(fr_pair_index_t *index, fr_pair_index_entry_t *slot)
+{
+	uint32_t i, j, k;
+
+	i = j = slot - index->slots;
+	for (;;) {
+		j = (j + 1) & index->mask;
+		if (!index->slots[j].vp) break;
+
+		/*
+		 *	Entry j can stay where it is if its home slot
+		 *	is (cyclically) in (i, j].
+		 */
+		k = fr_pair_index_hash(index->slots[j].attr, index->slots[j].vendor) & index->mask;
+		if ((i <= j) ? ((i < k) && (k <= j)) : ((i < k) || (k <= j))) continue;
+
+		index->slots[i] = index->slots[j];
+		i = j;
+	}
+
+	index->slots[i].vp = NULL;
+	index->num--;
+}
+
+/** Index a list of VALUE_PAIRs
+ *
+ * Once indexed, fr_pair_find_by_da(), fr_pair_find_by_num(), and searches with
+ * fr_cursor_next_by_da() and fr_cursor_next_by_num() which start at the head of the
+ * list, jump straight to the first matching VALUE_PAIR.
+ *
+ * Lists shorter than #FR_PAIR_INDEX_MIN are left alone, as walking them is as fast
+ * as hashing.  This counts the list, so callers should only use it when they know
+ * the list is long enough.  fr_pair_add() and rad_decode() call it when the lists
+ * they build reach that length.
+ *
+ * @note Lookups never build an index, as lists such as the ones read from
+ *	the users file are shared between threads.
+ *
+ * @param[in] head of the list to index.
+ * @return 0 on success (or if the list didn't need indexing), -1 on error.
+ */
+int fr_pair_list_index(VALUE_PAIR *head)
+{
+	fr_pair_index_t	*index;
+	VALUE_PAIR	*vp;
+	uint32_t	count = 0, size = FR_PAIR_INDEX_MIN * 2;
+
+	if (!head || head->index) return 0;
+
+	for (vp = head; vp; vp = vp->next) count++;
+	if (count < FR_PAIR_INDEX_MIN) return 0;
+
+	while (size < (count * 2)) size <<= 1;
+
+	index = talloc_zero(head, fr_pair_index_t);
+	if (!index) return -1;
+
+	index->slots = talloc_zero_array(index, fr_pair_index_entry_t, size);
+	if (!index->slots) {
+		talloc_free(index);
+		return -1;
+	}
+	index->mask = size - 1;
+	index->head = head;
+
+	for (vp = head; vp; vp = vp->next) {
+		VERIFY_VP(vp);
+		(void) fr_pair_index_insert(index, vp);	/* Can't grow, as count <= size / 2 */
+	}
+	head->index = index;
+
+	return 0;
+}
+
+/** Drop the index of a list of VALUE_PAIRs
+ *
+ * @param[in] head of the list.
+ */
+void fr_pair_list_unindex(VALUE_PAIR *head)
+{
+	if (!head || !head->index) return;
+
+	talloc_free(head->index);
+	head->index = NULL;
+}
+
+/** Find the first VALUE_PAIR with a given number in an indexed list
+ *
+ * @param[in] head of the list, must have an index.
+ * @param[in] attr number to find.
+ * @param[in] vendor number to find.
+ * @return the first VALUE_PAIR with the given number, or NULL if there are none.
+ */
+VALUE_PAIR *fr_pair_index_find(VALUE_PAIR const *head, unsigned int attr, unsigned int vendor)
+{
+	fr_assert(head->index && (head->index->head == head));
+
+	return fr_pair_index_slot(head->index, attr, vendor)->vp;
+}
+
+/** Update the index of a list after VALUE_PAIRs were appended to it
+ *
+ * @param[in] head of the list.
+ * @param[in] add the VALUE_PAIR(s) which were appended, which must not be the head.
+ */
+void fr_pair_index_add(VALUE_PAIR *head, VALUE_PAIR *add)
+{
+	VALUE_PAIR *vp;
+
+	if (!add) return;
+
+	/*
+	 *	Was the head of another list.
+	 */
+	fr_pair_list_unindex(add);
+
+	if (!head || !head->index) return;
+
+	for (vp = add; vp; vp = vp->next) {
+		if (fr_pair_index_insert(head->index, vp) < 0) {
+			fr_pair_list_unindex(head);
+			return;
+		}
+	}
+}
+
+/** Update the index of a list before a VALUE_PAIR is unlinked from it
+ *
+ * @param[in] head of the list, which may be the VALUE_PAIR being removed.
+ * @param[in] vp which is about to be removed. Its next pointer must still be valid.
+ */
+void fr_pair_index_remove(VALUE_PAIR *head, VALUE_PAIR *vp)
+{
+	fr_pair_index_t		*index;
+	fr_pair_index_entry_t	*slot;
+	VALUE_PAIR		*i;
+
+	if (!head || !head->index) return;
+	index = head->index;
+
+	/*
+	 *	Hand the index over to the new head.
+	 */
+	if (vp == head) {
+		head->index = NULL;
+		if (!vp->next) {
+			talloc_free(index);
+			return;
+		}
+
+		index->head = vp->next;
+		vp->next->index = index;
+		(void) talloc_steal(vp->next, index);
+	}
+
+	slot = fr_pair_index_slot(index, vp->da->attr, vp->da->vendor);
+	if (slot->vp != vp) return;
+
+	for (i = vp->next; i; i = i->next) {
+		if ((i->da->attr == vp->da->attr) && (i->da->vendor == vp->da->vendor)) {
+			slot->vp = i;
+			return;
+		}
+	}
+
+	fr_pair_index_delete(index, slot);
+}
+
+/** Update the index of a list before a VALUE_PAIR is swapped for another in the same position
+ *
+ * @param[in] head of the list, which may be the VALUE_PAIR being replaced.
+ * @param[in] old VALUE_PAIR being replaced.  Its next pointer must still be valid.
+ * @param[in] new VALUE_PAIR to take its place.
+ */
+void fr_pair_index_replace(VALUE_PAIR *head, VALUE_PAIR *old, VALUE_PAIR *new)
+{
+	fr_pair_index_t		*index;
+	fr_pair_index_entry_t	*slot;
+
+	fr_pair_list_unindex(new);
+
+	if (!head || !head->index) return;
+	index = head->index;
+
+	/*
+	 *	Working out whether the new attribute is now the
+	 *	first of its kind isn't worth it.
+	 */
+	if ((old->da->attr != new->da->attr) || (old->da->vendor != new->da->vendor)) {
+		fr_pair_list_unindex(head);
+		return;
+	}
+
+	if (old == head) {
+		head->index = NULL;
+		index->head = new;
+		new->index = index;
+		(void) talloc_steal(new, index);
+	}
+
+	slot = fr_pair_index_slot(index, old->da->attr, old->da->vendor);
+	if (slot->vp == old) slot->vp = new;
+}
+
 /** Delete matching pairs
  *
  * Delete matching pairs from the attribute list.
@@ -244,6 +561,7 @@ void fr_pair_delete_by_num(VALUE_PAIR **first, unsigned int attr, unsigned int v
 		next = i->next;
 		if ((i->da->attr == attr) && (i->da->vendor == vendor) &&
 		    (!i->da->flags.has_tag || TAG_EQ(tag, i->tag))) {
+			fr_pair_index_remove(*first, i);
 			*last = next;
 			talloc_free(i);
 		} else {
@@ -262,6 +580,7 @@ void fr_pair_delete_by_num(VALUE_PAIR **first, unsigned int attr, unsigned int v
 void fr_pair_add(VALUE_PAIR **first, VALUE_PAIR *add)
 {
 	VALUE_PAIR *i;
+	unsigned int count = 1;
 
 	if (!add) return;
 
@@ -281,9 +600,17 @@ void fr_pair_add(VALUE_PAIR **first, VALUE_PAIR *add)
 		 */
 		fr_assert(i != add);
 #endif
+		count++;
 	}
 
 	i->next = add;
+	fr_pair_index_add(*first, add);
+
+	/*
+	 *	We've walked the list anyway, so we know when it's
+	 *	grown long enough to be worth indexing.
+	 */
+	if (!(*first)->index && ((count + 1) >= FR_PAIR_INDEX_MIN)) (void) fr_pair_list_index(*first);
 }
 
 /** Replace all matching VPs
@@ -322,6 +649,7 @@ void fr_pair_replace(VALUE_PAIR **first, VALUE_PAIR *replace)
 		 *	and return.
 		 */
 		if ((i->da == replace->da) && (!i->da->flags.has_tag || TAG_EQ(replace->tag, i->tag))) {
+			fr_pair_index_replace(*first, i, replace);
 			*prev = replace;
 
 			/*
@@ -343,6 +671,7 @@ void fr_pair_replace(VALUE_PAIR **first, VALUE_PAIR *replace)
 	 *	stopped at the last item, which we just append to.
 	 */
 	*prev = replace;
+	fr_pair_index_add(*first, replace);
 }
 
 int8_t fr_pair_cmp_by_da_tag(void const *a, void const *b)
@@ -439,6 +768,8 @@ void fr_pair_list_sort(VALUE_PAIR **vps, fr_cmp_t cmp)
 		return;
 	}
 
+	fr_pair_list_unindex(head);
+
 	fr_pair_list_sort_split(head, &a, &b);	/* Split into sublists */
 	fr_pair_list_sort(&a, cmp);		/* Traverse left */
 	fr_pair_list_sort(&b, cmp);		/* Traverse right */
@@ -659,6 +990,7 @@ VALUE_PAIR *fr_pair_copy(TALLOC_CTX *ctx, VALUE_PAIR const *vp)
 	if (!n) return NULL;
 
 	memcpy(n, vp, sizeof(*n));
+	n->index = NULL;
 
 	/*
 	 *	If the DA is unknown, steal "n" to "ctx".  This does
@@ -862,6 +1194,11 @@ void fr_pair_list_move(TALLOC_CTX *ctx, VALUE_PAIR **to, VALUE_PAIR **from)
 
 	if (!to || !from || !*from) return;
 
+	/*
+	 *	Attributes are unlinked from the "from" list by hand.
+	 */
+	fr_pair_list_unindex(*from);
+
 	/*
 	 *	We're editing the "to" list while we're adding new
 	 *	attributes to it.  We don't want the new attributes to
@@ -878,6 +1215,7 @@ void fr_pair_list_move(TALLOC_CTX *ctx, VALUE_PAIR **to, VALUE_PAIR **from)
 	tail_from = from;
 	while ((i = *tail_from) != NULL) {
 		VALUE_PAIR *j;
+		fr_pair_index_t *index;
 
 		VERIFY_VP(i);
 
@@ -938,8 +1276,10 @@ void fr_pair_list_move(TALLOC_CTX *ctx, VALUE_PAIR **to, VALUE_PAIR **from)
 			switch (found->da->type) {
 			default:
 				j = found->next;
+				index = found->index;
 				memcpy(found, i, sizeof(*found));
 				found->next = j;
+				found->index = index;
 				break;
 
 			case PW_TYPE_OCTETS:
@@ -1039,6 +1379,7 @@ static void fr_pair_list_move_by_num_internal(TALLOC_CTX *ctx, VALUE_PAIR **to,
 	if ((vendor == 0) && (attr == 0)) {
 		if (*to) {
 			to_tail->next = *from;
+			fr_pair_index_add(*to, *from);
 		} else {
 			*to = *from;
 		}
@@ -1094,6 +1435,7 @@ static void fr_pair_list_move_by_num_internal(TALLOC_CTX *ctx, VALUE_PAIR **to,
 		/*
 		 *	Remove the attribute from the "from" list.
 		 */
+		fr_pair_index_remove(*from, i);
 		if (iprev)
 			iprev->next = next;
 		else
@@ -1114,6 +1456,7 @@ static void fr_pair_list_move_by_num_internal(TALLOC_CTX *ctx, VALUE_PAIR **to,
 			*to = this;
 		to_tail = this;
 		this->next = NULL;
+		if (this != *to) fr_pair_index_add(*to, this);
 
 		if (move) {
 			fr_pair_steal(ctx, i);
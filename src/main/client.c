@@ -34,6 +34,12 @@ RCSID("$Id$")
 #include <ctype.h>
 #include <fcntl.h>
 
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/stdatomic.h>
+#endif
+
 #ifdef WITH_DYNAMIC_CLIENTS
 #ifdef HAVE_DIRENT_H
 #include <dirent.h>
@@ -46,6 +52,8 @@ struct radclient_list {
 	 */
 	rbtree_t	*trees[129]; /* for 0..128, inclusive. */
 	uint32_t       	min_prefix;
+	bool		global;		//!< Is, or was, the global list.
+	CONF_SECTION	*cs;		//!< The list was parsed from.
 };
 
 
@@ -53,7 +61,22 @@ struct radclient_list {
 static rbtree_t		*tree_num = NULL;     /* client numbers 0..N */
 static int		tree_num_max = 0;
 #endif
-static RADCLIENT_LIST	*root_clients = NULL;
+
+/*
+ *	The global list is replaced by "reload clients", while other
+ *	threads may be looking up clients in it.
+ */
+typedef _Atomic(RADCLIENT_LIST *) atomic_clients_t;
+static atomic_clients_t	root_clients;
+
+#define ROOT_CLIENTS atomic_load_explicit(&root_clients, memory_order_acquire)
+
+/*
+ *	Listeners keep a pointer to the global list they were
+ *	created with.  When the global clients are reloaded, they
+ *	use the new list instead.
+ */
+#define CLIENT_LIST(_x) ((!(_x) || (_x)->global) ? ROOT_CLIENTS : (_x))
 
 /*
  *	Callback for freeing a client.
@@ -99,6 +122,27 @@ static int client_num_cmp(void const *one, void const *two)
 
 	return (a->number - b->number);
 }
+
+static int client_num_delete(UNUSED void *ctx, void *data)
+{
+	rbtree_deletebydata(tree_num, data);
+
+	return 0;
+}
+
+/*
+ *	Stop the statistics code from finding the clients in a list.
+ */
+static void client_list_unnumber(RADCLIENT_LIST *clients)
+{
+	int i;
+
+	if (!tree_num) return;
+
+	for (i = 0; i <= 128; i++) {
+		if (clients->trees[i]) rbtree_walk(clients->trees[i], RBTREE_IN_ORDER, client_num_delete, NULL);
+	}
+}
 #endif
 
 /*
@@ -108,21 +152,25 @@ void client_list_free(RADCLIENT_LIST *clients)
 {
 	int i;
 
-	if (!clients) clients = root_clients;
+	if (!clients) clients = ROOT_CLIENTS;
 	if (!clients) return;	/* Clients may not have been initialised yet */
 
+#ifdef WITH_STATS
+	if (clients != ROOT_CLIENTS) client_list_unnumber(clients);
+#endif
+
 	for (i = 0; i <= 128; i++) {
 		if (clients->trees[i]) rbtree_free(clients->trees[i]);
 		clients->trees[i] = NULL;
 	}
 
-	if (clients == root_clients) {
+	if (clients == ROOT_CLIENTS) {
 #ifdef WITH_STATS
 		if (tree_num) rbtree_free(tree_num);
 		tree_num = NULL;
 		tree_num_max = 0;
 #endif
-		root_clients = NULL;
+		atomic_store_explicit(&root_clients, NULL, memory_order_release);
 	}
 
 #ifdef WITH_DYNAMIC_CLIENTS
@@ -144,6 +192,7 @@ RADCLIENT_LIST *client_list_init(CONF_SECTION *cs)
 	if (!clients) return NULL;
 
 	clients->min_prefix = 128;
+	clients->cs = cs;
 
 	return clients;
 }
@@ -190,6 +239,8 @@ bool client_add(RADCLIENT_LIST *clients, RADCLIENT *client)
 	 */
 	if (client->defines_coa_server) if (!realm_home_server_add(client->coa_server)) return false;
 
+	if (clients && clients->global) clients = ROOT_CLIENTS;
+
 	/*
 	 *	If "clients" is NULL, it means add to the global list,
 	 *	unless we're trying to add it to a virtual server...
@@ -236,11 +287,13 @@ bool client_add(RADCLIENT_LIST *clients, RADCLIENT *client)
 			/*
 			 *	Initialize the global list, if not done already.
 			 */
-			if (!root_clients) {
-				root_clients = client_list_init(NULL);
-				if (!root_clients) return false;
+			clients = ROOT_CLIENTS;
+			if (!clients) {
+				clients = client_list_init(NULL);
+				if (!clients) return false;
+				clients->global = true;
+				atomic_store_explicit(&root_clients, clients, memory_order_release);
 			}
-			clients = root_clients;
 		}
 	}
 
@@ -301,7 +354,7 @@ bool client_add(RADCLIENT_LIST *clients, RADCLIENT *client)
 
 #ifdef WITH_STATS
 	if (!tree_num) {
-		tree_num = rbtree_create(clients, client_num_cmp, NULL, 0);
+		tree_num = rbtree_create(NULL, client_num_cmp, NULL, 0);
 	}
 
 #ifdef WITH_DYNAMIC_CLIENTS
@@ -346,7 +399,7 @@ void client_delete(RADCLIENT_LIST *clients, RADCLIENT *client)
 {
 	if (!client) return;
 
-	if (!clients) clients = root_clients;
+	clients = CLIENT_LIST(clients);
 
 	if (!client->dynamic) return;
 
@@ -355,6 +408,13 @@ void client_delete(RADCLIENT_LIST *clients, RADCLIENT *client)
 #ifdef WITH_STATS
 	rbtree_deletebydata(tree_num, client);
 #endif
+
+	/*
+	 *	It may have been added to the global list before
+	 *	that was reloaded.
+	 */
+	if (rbtree_finddata(clients->trees[client->ipaddr.prefix], client) != client) return;
+
 	rbtree_deletebydata(clients->trees[client->ipaddr.prefix], client);
 }
 #endif
@@ -366,7 +426,7 @@ void client_delete(RADCLIENT_LIST *clients, RADCLIENT *client)
  */
 RADCLIENT *client_findbynumber(RADCLIENT_LIST const *clients, int number)
 {
-	if (!clients) clients = root_clients;
+	if (!clients) clients = ROOT_CLIENTS;
 
 	if (!clients) return NULL;
 
@@ -398,7 +458,7 @@ RADCLIENT *client_find(RADCLIENT_LIST const *clients, fr_ipaddr_t const *ipaddr,
   int32_t i, max_prefix;
 	RADCLIENT myclient;
 
-	if (!clients) clients = root_clients;
+	clients = CLIENT_LIST(clients);
 
 	if (!clients || !ipaddr) return NULL;
 
@@ -436,7 +496,7 @@ RADCLIENT *client_find(RADCLIENT_LIST const *clients, fr_ipaddr_t const *ipaddr,
  */
 RADCLIENT *client_find_old(fr_ipaddr_t const *ipaddr)
 {
-	return client_find(root_clients, ipaddr, IPPROTO_UDP);
+	return client_find(NULL, ipaddr, IPPROTO_UDP);
 }
 
 static fr_ipaddr_t cl_ipaddr;
@@ -491,6 +551,48 @@ static const CONF_PARSER client_config[] = {
 	CONF_PARSER_TERMINATOR
 };
 
+typedef struct client_carry {
+	RADCLIENT_LIST	*from;
+	RADCLIENT_LIST	*to;
+} client_carry_t;
+
+/*
+ *	Move a client which wasn't read from the configuration files
+ *	(i.e. a dynamic client, or one added by a module or radmin) to
+ *	the list replacing the one it's in.  Clients in the new list
+ *	take precedence.
+ */
+static int client_carry(void *ctx, void *data)
+{
+	client_carry_t	*carry = ctx;
+	RADCLIENT	*client = data;
+	RADCLIENT_LIST	*clients = carry->to;
+
+	if (client->cs && carry->from->cs &&
+	    (cf_top_section(client->cs) == cf_top_section(carry->from->cs))) return 0;
+
+	if (!clients->trees[client->ipaddr.prefix]) {
+		clients->trees[client->ipaddr.prefix] = rbtree_create(clients, client_ipaddr_cmp, NULL, 0);
+		if (!clients->trees[client->ipaddr.prefix]) return 0;
+	}
+
+	if (rbtree_finddata(clients->trees[client->ipaddr.prefix], client)) return 0;
+
+	if (!rbtree_insert(clients->trees[client->ipaddr.prefix], client)) return 0;
+
+#ifdef WITH_STATS
+	if (tree_num) rbtree_insert(tree_num, client);
+#endif
+
+	if (client->ipaddr.prefix < clients->min_prefix) {
+		clients->min_prefix = client->ipaddr.prefix;
+	}
+
+	(void) talloc_steal(clients, client);
+
+	return 0;
+}
+
 /** Create the linked list of clients from the new configuration type
  *
  */
@@ -501,6 +603,7 @@ RADCLIENT_LIST *client_list_parse_section(CONF_SECTION *section, UNUSED bool tls
 #endif
 {
 	bool		global = false, in_server = false;
+	int		i;
 	CONF_SECTION	*cs;
 	RADCLIENT	*c = NULL;
 	RADCLIENT_LIST	*clients = NULL;
@@ -641,10 +744,30 @@ RADCLIENT_LIST *client_list_parse_section(CONF_SECTION *section, UNUSED bool tls
 
 	/*
 	 *	Replace the global list of clients with the new one.
-	 *	The old one is still referenced from the original
-	 *	configuration, and will be freed when that is freed.
+	 *	The old one is still referenced from the configuration
+	 *	it was read from, which is kept until requests can no
+	 *	longer be using its clients.
 	 */
-	if (global) root_clients = clients;
+	if (global) {
+		RADCLIENT_LIST *old = ROOT_CLIENTS;
+
+		if (old) {
+			client_carry_t carry;
+
+			carry.from = old;
+			carry.to = clients;
+
+#ifdef WITH_STATS
+			client_list_unnumber(old);
+#endif
+			for (i = 0; i <= 128; i++) {
+				if (old->trees[i]) rbtree_walk(old->trees[i], RBTREE_IN_ORDER, client_carry, &carry);
+			}
+		}
+
+		clients->global = true;
+		atomic_store_explicit(&root_clients, clients, memory_order_release);
+	}
 
 	return clients;
 }
@@ -27,6 +27,7 @@
 #include <freeradius-devel/modcall.h>
 #include <freeradius-devel/md5.h>
 #include <freeradius-devel/channel.h>
+#include <freeradius-devel/snapshot.h>
 
 #include <libgen.h>
 #ifdef HAVE_INTTYPES_H
@@ -783,6 +784,40 @@ static int command_hup(rad_listen_t *listener, int argc, char *argv[])
 	return CMD_OK;
 }
 
+static int command_reload_clients(rad_listen_t *listener, UNUSED int argc, UNUSED char *argv[])
+{
+	if (main_config_reload_clients() < 0) {
+		cprintf_error(listener, "Failed to reload clients\n");
+		return CMD_FAIL;
+	}
+
+	return CMD_OK;
+}
+
+static int command_reload_module(rad_listen_t *listener, int argc, char *argv[])
+{
+	if (argc == 0) {
+		cprintf_error(listener, "Must specify <module>\n");
+		return CMD_FAIL;
+	}
+
+	/*
+	 *	The data is reloaded in the background.
+	 */
+	switch (fr_snapshot_reload_by_name(argv[0])) {
+	case 0:
+		return CMD_OK;
+
+	case -2:
+		cprintf_error(listener, "Module %s has nothing to reload\n", argv[0]);
+		return CMD_FAIL;
+
+	default:
+		cprintf_error(listener, "Failed to reload module\n");
+		return CMD_FAIL;
+	}
+}
+
 static int command_terminate(UNUSED rad_listen_t *listener,
 			     UNUSED int argc, UNUSED char *argv[])
 {
@@ -2288,6 +2323,19 @@ static int command_stats_queue(rad_listen_t *listener, UNUSED int argc, UNUSED c
 }
 #endif
 
+static int command_stats_log(rad_listen_t *listener, UNUSED int argc, UNUSED char *argv[])
+{
+	uint64_t queued, dropped, writes;
+
+	radlog_async_stats(&queued, &dropped, &writes);
+
+	cprintf(listener, "log_queued\t\t%" PRIu64 "\n", queued);
+	cprintf(listener, "log_dropped\t\t%" PRIu64 "\n", dropped);
+	cprintf(listener, "log_writes\t\t%" PRIu64 "\n", writes);
+
+	return CMD_OK;
+}
+
 #ifndef NDEBUG
 static int command_stats_memory(rad_listen_t *listener, int argc, char *argv[])
 {
@@ -2385,6 +2433,7 @@ static int command_stats_detail(rad_listen_t *listener, int argc, char *argv[])
 	cprintf(listener, "tries\t%d\n", data->tries);
 	cprintf(listener, "offset\t%u\n", (unsigned int) data->offset);
 	cprintf(listener, "size\t%u\n", (unsigned int) buf.st_size);
+	if (data->win) cprintf(listener, "window\t%u\n", data->cwnd);
 
 	return CMD_OK;
 }
@@ -2633,6 +2682,17 @@ static fr_command_table_t command_table_add[] = {
 };
 #endif
 
+static fr_command_table_t command_table_reload[] = {
+	{ "clients", FR_WRITE,
+	  "reload clients - re-read the global clients from the configuration files",
+	  command_reload_clients, NULL },
+	{ "module", FR_WRITE,
+	  "reload module <module> - re-read the files used by a module, without re-instantiating it",
+	  command_reload_module, NULL },
+
+	{ NULL, 0, NULL, NULL, NULL }
+};
+
 #ifdef WITH_PROXY
 static fr_command_table_t command_table_set_home[] = {
 	{ "state", FR_WRITE,
@@ -2689,6 +2749,10 @@ static fr_command_table_t command_table_stats[] = {
 	  command_stats_home_server, NULL },
 #endif
 
+	{ "log", FR_READ,
+	  "stats log - show statistics for asynchronous logging",
+	  command_stats_log, NULL },
+
 #ifdef HAVE_PTHREAD_H
 	{ "queue", FR_READ,
 	  "stats queue - show statistics for packet queues",
@@ -2729,6 +2793,9 @@ static fr_command_table_t command_table[] = {
 	{ "reconnect", FR_READ,
 	  "reconnect - reconnect to a running server",
 	  NULL, NULL },		/* just here for "help" */
+	{ "reload", FR_WRITE,
+	  "reload <command> - reload data without a HUP",
+	  NULL, command_table_reload },
 	{ "terminate", FR_WRITE,
 	  "terminate - terminates the server, and cause it to exit",
 	  command_terminate, NULL },
@@ -937,6 +937,36 @@ static fr_connection_t *fr_connection_reconnect_internal(fr_connection_pool_t *p
 	return new_conn;
 }
 
+/** Open one of the connections a pool starts with
+ *
+ * Run as a module startup job, so may be called in parallel with itself.
+ *
+ * @param[in] uctx the pool.
+ * @return -1 if the pool couldn't open as many connections as it should start with, else 0.
+ */
+static int fr_connection_pool_start(void *uctx)
+{
+	fr_connection_pool_t *pool = talloc_get_type_abort(uctx, fr_connection_pool_t);
+	bool started;
+
+	/*
+	 *	The module may have needed a connection before
+	 *	the jobs were run, and opened one itself.
+	 */
+	pthread_mutex_lock(&pool->mutex);
+	started = ((pool->num + pool->pending) >= pool->start);
+	pthread_mutex_unlock(&pool->mutex);
+	if (started) return 0;
+
+	if (fr_connection_spawn(pool, time(NULL), false)) return 0;
+
+	pthread_mutex_lock(&pool->mutex);
+	started = ((pool->num + pool->pending) >= pool->start);
+	pthread_mutex_unlock(&pool->mutex);
+
+	return started ? 0 : -1;
+}
+
 /** Create a new connection pool
  *
  * Allocates structures used by the connection pool, initialises the various
@@ -968,13 +998,9 @@ fr_connection_pool_t *fr_connection_pool_init(TALLOC_CTX *ctx,
 {
 	uint32_t i;
 	fr_connection_pool_t *pool;
-	fr_connection_t *this;
-	time_t now;
 
 	if (!cs || !opaque || !c) return NULL;
 
-	now = time(NULL);
-
 	/*
 	 *	Pool is allocated in the NULL context as
 	 *	threads are likely to allocate memory
@@ -1095,11 +1121,21 @@ fr_connection_pool_t *fr_connection_pool_init(TALLOC_CTX *ctx,
 
 	/*
 	 *	Create all of the connections, unless the admin says
-	 *	not to.
+	 *	not to.  If the module's drivers allow it, they're
+	 *	opened in parallel, and if the server is starting, in
+	 *	parallel with those of other modules.  Otherwise they're
+	 *	opened here, by the thread which initialised the library.
 	 */
-	for (i = 0; i < pool->start; i++) {
-		this = fr_connection_spawn(pool, now, false);
-		if (!this) {
+	if (!module_parallel_start()) {
+		time_t now = time(NULL);
+
+		for (i = 0; i < pool->start; i++) {
+			if (!fr_connection_spawn(pool, now, false)) goto error;
+		}
+	} else {
+		module_jobs_begin();
+		for (i = 0; i < pool->start; i++) module_job_add(fr_connection_pool_start, pool);
+		if (module_jobs_end() < 0) {
 		error:
 			fr_connection_pool_free(pool);
 			return NULL;
@@ -1278,6 +1314,12 @@ void fr_connection_pool_free(fr_connection_pool_t *pool)
 		return;
 	}
 
+	/*
+	 *	Don't open the connections it starts with if they
+	 *	haven't been already.
+	 */
+	module_job_cancel(pool);
+
 	DEBUG("%s: Removing connection pool", pool->log_prefix);
 
 	pthread_mutex_lock(&pool->mutex);
@@ -39,6 +39,10 @@ RCSID("$Id$")
 
 #include <fcntl.h>
 
+#ifdef WITH_DETAIL_THREAD
+#include <sys/mman.h>
+#endif
+
 #ifdef WITH_DETAIL
 
 #define USEC (1000000)
@@ -56,6 +60,73 @@ static FR_NAME_NUMBER state_names[] = {
 	{ NULL, 0 }
 };
 
+#ifdef WITH_DETAIL_THREAD
+/*
+ *	An entry from the detail file, when more than one entry can
+ *	be processed at a time.
+ */
+typedef struct detail_entry_t {
+	off_t		end;			//!< Offset of the next entry.
+	off_t		timestamp_offset;	//!< Where to mark the entry as done.
+	VALUE_PAIR	*vps;
+	fr_ipaddr_t	client_ip;
+	time_t		timestamp;
+
+	uint32_t	number;			//!< Of the last packet sent for this entry.
+	int		tries;
+	time_t		sent;			//!< When the last packet was sent.
+	time_t		retry;			//!< When to send the entry again.
+	bool		in_flight;		//!< Whether we're waiting for an answer.
+	bool		done;
+} detail_entry_t;
+
+struct detail_window_t {
+	uint8_t		*map;			//!< The work file.
+	size_t		size;			//!< Of the mapping.
+	off_t		next;			//!< Offset of the next entry to read.
+	bool		eof;			//!< No more complete entries in the file.
+
+	detail_entry_t	*entries;		//!< Ring of entries being processed.
+	uint32_t	slots;			//!< Size of the ring.
+	uint32_t	head;			//!< Oldest entry.
+	uint32_t	count;			//!< Entries in the ring.
+	uint32_t	in_flight;		//!< Packets waiting for an answer.
+	uint32_t	acked;			//!< Answers since the window was last adjusted.
+	uint32_t	number;			//!< Of the next packet.
+
+	int		base_rtt;		//!< Lowest SRTT, i.e. when the backend isn't busy.
+	int		period_rtt;		//!< Lowest SRTT in this period.
+	time_t		period;			//!< When this period started.
+	bool		congested;		//!< Whether the backend has been busy.
+};
+
+/*
+ *	Sent by detail_send() to the reader thread.
+ */
+typedef struct detail_ack_t {
+	uint32_t	number;			//!< Of the packet.
+	int		rtt;			//!< In microseconds.  -1 if there was no reply,
+						//!< 0 if the packet wasn't processed.
+} detail_ack_t;
+
+static uint32_t detail_packet_number(RADIUS_PACKET const *packet);
+
+static void detail_ack(listen_detail_t *data, RADIUS_PACKET const *packet, int rtt)
+{
+	detail_ack_t ack;
+
+	ack.number = detail_packet_number(packet);
+	ack.rtt = rtt;
+
+	/*
+	 *	Writes smaller than PIPE_BUF are atomic, so the
+	 *	workers can all write to the same pipe.
+	 */
+	if (write(data->child_pipe[1], &ack, sizeof(ack)) < 0) {
+		ERROR("detail (%s): Failed writing ack to reader thread: %s", data->name, fr_syserror(errno));
+	}
+}
+#endif
 
 /*
  *	If we're limiting outstanding packets, then mark the response
@@ -71,6 +142,36 @@ int detail_send(rad_listen_t *listener, REQUEST *request)
 	rad_assert(request->listener == listener);
 	rad_assert(listener->send == detail_send);
 
+#ifdef WITH_DETAIL_THREAD
+	/*
+	 *	Many entries may be outstanding.  Tell the reader
+	 *	thread which one this was, and how long it took.
+	 */
+	if (data->win) {
+		int rtt;
+		struct timeval now;
+
+		if (request->reply->code == 0) {
+			RDEBUG("detail (%s): No response to request.  Will retry in %d seconds",
+			       data->name, data->retry_interval);
+			detail_ack(data, request->packet, -1);
+			return 0;
+		}
+
+		RDEBUG("detail (%s): Done %s packet.", data->name, fr_packet_codes[request->packet->code]);
+
+		gettimeofday(&now, NULL);
+		rtt = now.tv_sec - request->packet->timestamp.tv_sec;
+		rtt *= USEC;
+		rtt += now.tv_usec;
+		rtt -= request->packet->timestamp.tv_usec;
+		if (rtt <= 0) rtt = 1;
+
+		detail_ack(data, request->packet, rtt);
+		return 0;
+	}
+#endif
+
 	/*
 	 *	This request timed out.  Remember that, and tell the
 	 *	caller it's OK to read more "detail" file stuff.
@@ -293,6 +394,9 @@ static int detail_open(rad_listen_t *this)
 	data->packets = 0;
 	data->tries = 0;
 	data->done_entry = false;
+	data->binary = false;
+	data->checkpoint = 0;
+	data->checkpoint_offset = 0;
 
 	return 1;
 }
@@ -410,11 +514,23 @@ int detail_recv(rad_listen_t *listener)
 		break;
 
 	default:
+		if (data->win) {
+			detail_ack(data, packet, 0);
+			rad_free(&packet);
+			return 0;
+		}
+
 		data->state = STATE_REPLIED;
 		goto signal_thread;
 	}
 
 	if (!request_receive(NULL, listener, packet, &data->detail_client, fun)) {
+		if (data->win) {
+			detail_ack(data, packet, -1);
+			rad_free(&packet);
+			return 0;
+		}
+
 		data->state = STATE_NO_REPLY;	/* try again later */
 
 	signal_thread:
@@ -432,161 +548,590 @@ int detail_recv(rad_listen_t *listener)
 }
 #endif
 
-static RADIUS_PACKET *detail_poll(rad_listen_t *listener)
+/*
+ *	Create the packet for an entry.  The packet number is encoded
+ *	in the ID, ports, and destination IP, which are otherwise
+ *	unused.
+ */
+static RADIUS_PACKET *detail_packet_alloc(listen_detail_t *data, VALUE_PAIR *vps, fr_ipaddr_t const *client_ip,
+					  time_t timestamp, int tries, uint32_t number)
 {
-	int		y;
-	char		key[256], op[8], value[1024];
-	vp_cursor_t	cursor;
 	VALUE_PAIR	*vp;
 	RADIUS_PACKET	*packet;
-	char		buffer[2048];
-	listen_detail_t *data = listener->data;
-
-	switch (data->state) {
-	case STATE_UNOPENED:
-open_file:
-		rad_assert(data->work_fd < 0);
 
-		if (!detail_open(listener)) return NULL;
-
-		rad_assert(data->state == STATE_UNLOCKED);
-		rad_assert(data->work_fd >= 0);
+	/*
+	 *	Allocate the packet.  If we fail, it's a serious
+	 *	problem.
+	 */
+	packet = rad_alloc(NULL, true);
+	if (!packet) {
+		ERROR("detail (%s): FATAL: Failed allocating memory for detail", data->name);
+		fr_exit(1);
+	}
 
-		/* FALL-THROUGH */
+	memset(packet, 0, sizeof(*packet));
+	packet->sockfd = -1;
+	packet->src_ipaddr.af = AF_INET;
+	packet->src_ipaddr.ipaddr.ip4addr.s_addr = htonl(INADDR_NONE);
 
 	/*
-	 *	Try to lock fd.  If we can't, return.
-	 *	If we can, continue.  This means that
-	 *	the server doesn't block while waiting
-	 *	for the lock to open...
+	 *	If everything's OK, this is a waste of memory.
+	 *	Otherwise, it lets us re-send the original packet
+	 *	contents, unmolested.
 	 */
-	case STATE_UNLOCKED:
-		/*
-		 *	Note that we do NOT block waiting for
-		 *	the lock.  We've re-named the file
-		 *	above, so we've already guaranteed
-		 *	that any *new* detail writer will not
-		 *	be opening this file.  The only
-		 *	purpose of the lock is to catch a race
-		 *	condition where the execution
-		 *	"ping-pongs" between radiusd &
-		 *	radrelay.
-		 */
-		if (rad_lockfd_nonblock(data->work_fd, 0) < 0) {
-			/*
-			 *	Close the FD.  The main loop
-			 *	will wake up in a second and
-			 *	try again.
-			 */
-			close(data->work_fd);
-			data->fp = NULL;
-			data->work_fd = -1;
-			data->state = STATE_UNOPENED;
-			return NULL;
-		}
-
-		/*
-		 *	Only open for writing if we're
-		 *	marking requests as completed.
-		 */
-		data->fp = fdopen(data->work_fd, data->track ? "r+" : "r");
-		if (!data->fp) {
-			ERROR("detail (%s): FATAL: Failed to re-open detail file: %s",
-			      data->name, fr_syserror(errno));
-			fr_exit(1);
-		}
+	packet->vps = fr_pair_list_copy(packet, vps);
 
-		/*
-		 *	Look for the header
-		 */
-		data->state = STATE_HEADER;
-		data->delay_time = USEC;
-		data->vps = NULL;
+	packet->code = PW_CODE_ACCOUNTING_REQUEST;
+	vp = fr_pair_find_by_num(packet->vps, PW_PACKET_TYPE, 0, TAG_ANY);
+	if (vp) packet->code = vp->vp_integer;
 
-		/* FALL-THROUGH */
+	gettimeofday(&packet->timestamp, NULL);
 
-	case STATE_HEADER:
-	do_header:
-		data->done_entry = false;
-		data->timestamp_offset = 0;
+	/*
+	 *	Remember where it came from, so that we don't
+	 *	proxy it to the place it came from...
+	 */
+	if (client_ip->af != AF_UNSPEC) {
+		packet->src_ipaddr = *client_ip;
+	}
 
-		data->tries = 0;
-		if (!data->fp) {
-			data->state = STATE_UNOPENED;
-			goto open_file;
+	vp = fr_pair_find_by_num(packet->vps, PW_PACKET_SRC_IP_ADDRESS, 0, TAG_ANY);
+	if (vp) {
+		packet->src_ipaddr.af = AF_INET;
+		packet->src_ipaddr.ipaddr.ip4addr.s_addr = vp->vp_ipaddr;
+		packet->src_ipaddr.prefix = 32;
+	} else {
+		vp = fr_pair_find_by_num(packet->vps, PW_PACKET_SRC_IPV6_ADDRESS, 0, TAG_ANY);
+		if (vp) {
+			packet->src_ipaddr.af = AF_INET6;
+			memcpy(&packet->src_ipaddr.ipaddr.ip6addr,
+			       &vp->vp_ipv6addr, sizeof(vp->vp_ipv6addr));
+			packet->src_ipaddr.prefix = 128;
 		}
+	}
 
-		{
-			struct stat buf;
-
-			if (fstat(data->work_fd, &buf) < 0) {
-				ERROR("detail (%s): Failed to stat detail file: %s",
-				      data->name, fr_syserror(errno));
-
-				goto cleanup;
-			}
-			if (((off_t) ftell(data->fp)) == buf.st_size) {
-				goto cleanup;
-			}
+	vp = fr_pair_find_by_num(packet->vps, PW_PACKET_DST_IP_ADDRESS, 0, TAG_ANY);
+	if (vp) {
+		packet->dst_ipaddr.af = AF_INET;
+		packet->dst_ipaddr.ipaddr.ip4addr.s_addr = vp->vp_ipaddr;
+		packet->dst_ipaddr.prefix = 32;
+	} else {
+		vp = fr_pair_find_by_num(packet->vps, PW_PACKET_DST_IPV6_ADDRESS, 0, TAG_ANY);
+		if (vp) {
+			packet->dst_ipaddr.af = AF_INET6;
+			memcpy(&packet->dst_ipaddr.ipaddr.ip6addr,
+			       &vp->vp_ipv6addr, sizeof(vp->vp_ipv6addr));
+			packet->dst_ipaddr.prefix = 128;
 		}
+	}
 
-		/*
-		 *	End of file.  Delete it, and re-set
-		 *	everything.
-		 */
-		if (feof(data->fp)) {
-		cleanup:
-			DEBUG("detail (%s): Unlinking %s", data->name, data->filename_work);
-			unlink(data->filename_work);
-			if (data->fp) fclose(data->fp);
-			data->fp = NULL;
-			data->work_fd = -1;
-			data->state = STATE_UNOPENED;
-			rad_assert(data->vps == NULL);
-
-			if (data->one_shot) {
-				INFO("detail (%s): Finished reading \"one shot\" detail file - Exiting", data->name);
-				radius_signal_self(RADIUS_SIGNAL_SELF_EXIT);
-			}
+	/*
+	 *	Generate packet ID, ports, IP via a counter.
+	 */
+	packet->id = number & 0xff;
+	packet->src_port = 1024 + ((number >> 8) & 0xff);
+	packet->dst_port = 1024 + ((number >> 16) & 0xff);
 
-			return NULL;
-		}
+	packet->dst_ipaddr.af = AF_INET;
+	packet->dst_ipaddr.ipaddr.ip4addr.s_addr = htonl((INADDR_LOOPBACK & ~0xffffff) | ((number >> 24) & 0xff));
 
+	/*
+	 *	Create / update accounting attributes.
+	 */
+	if (packet->code == PW_CODE_ACCOUNTING_REQUEST) {
 		/*
-		 *	Else go read something.
+		 *	Prefer the Event-Timestamp in the packet, if it
+		 *	exists.  That is when the event occurred, whereas the
+		 *	"Timestamp" field is when we wrote the packet to the
+		 *	detail file, which could have been much later.
 		 */
-		if (!fgets(buffer, sizeof(buffer), data->fp)) {
-			DEBUG("detail (%s): Failed reading header from file - %s",
-			      data->name, data->filename_work);
-			goto cleanup;
+		vp = fr_pair_find_by_num(packet->vps, PW_EVENT_TIMESTAMP, 0, TAG_ANY);
+		if (vp) {
+			timestamp = vp->vp_integer;
 		}
 
 		/*
-		 *	Badly formatted file: delete it.
+		 *	Look for Acct-Delay-Time, and update
+		 *	based on Acct-Delay-Time += (time(NULL) - timestamp)
 		 */
-		if (!strchr(buffer, '\n')) {
-			DEBUG("detail (%s): Invalid line without trailing LF - %s", data->name, buffer);
-			goto cleanup;
+		vp = fr_pair_find_by_num(packet->vps, PW_ACCT_DELAY_TIME, 0, TAG_ANY);
+		if (!vp) {
+			vp = fr_pair_afrom_num(packet, PW_ACCT_DELAY_TIME, 0);
+			rad_assert(vp != NULL);
+			fr_pair_add(&packet->vps, vp);
 		}
-
-		if (!sscanf(buffer, "%*s %*s %*d %*d:%*d:%*d %d", &y)) {
-			DEBUG("detail (%s): Failed reading detail file header in line - %s", data->name, buffer);
-			goto cleanup;
+		if (timestamp != 0) {
+			vp->vp_integer += time(NULL) - timestamp;
 		}
-
-		data->state = STATE_READING;
-		/* FALL-THROUGH */
-
+	}
 
 	/*
-	 *	Read more value-pair's, unless we're
-	 *	at EOF.  In that case, queue whatever
-	 *	we have.
+	 *	Set the transmission count.
 	 */
-	case STATE_READING:
-		rad_assert(data->fp != NULL);
+	vp = fr_pair_find_by_num(packet->vps, PW_PACKET_TRANSMIT_COUNTER, 0, TAG_ANY);
+	if (!vp) {
+		vp = fr_pair_afrom_num(packet, PW_PACKET_TRANSMIT_COUNTER, 0);
+		rad_assert(vp != NULL);
+		fr_pair_add(&packet->vps, vp);
+	}
+	vp->vp_integer = tries;
 
-		fr_cursor_init(&cursor, &data->vps);
+	return packet;
+}
+
+#ifdef WITH_DETAIL_THREAD
+/*
+ *	Get the packet number back from a packet created by
+ *	detail_packet_alloc().
+ */
+static uint32_t detail_packet_number(RADIUS_PACKET const *packet)
+{
+	return packet->id |
+		(((packet->src_port - 1024) & 0xff) << 8) |
+		(((packet->dst_port - 1024) & 0xff) << 16) |
+		((ntohl(packet->dst_ipaddr.ipaddr.ip4addr.s_addr) & 0xff) << 24);
+}
+#endif
+
+/*
+ *	Parse one "attribute = value" line of an entry, adding the VP
+ *	to the entry being read.
+ *
+ *	Returns 0 if the line was parsed or skipped, -1 if the file is
+ *	bad.
+ */
+static int detail_parse_line(listen_detail_t *data, char const *buffer, off_t offset, vp_cursor_t *cursor)
+{
+	char		key[256], op[8], value[1024];
+	VALUE_PAIR	*vp;
+
+	/*
+	 *	We have a full "attribute = value" line.
+	 *	If it doesn't look reasonable, skip it.
+	 *
+	 *	FIXME: print an error for badly formatted attributes?
+	 */
+	if (sscanf(buffer, "%255s %7s %1023s", key, op, value) != 3) {
+		DEBUG("detail (%s): Skipping badly formatted line - %s", data->name, buffer);
+		return 0;
+	}
+
+	/*
+	 *	Should be =, :=, +=, ...
+	 */
+	if (!strchr(op, '=')) {
+		DEBUG("detail (%s): Skipping line without operator - %s", data->name, buffer);
+		return 0;
+	}
+
+	/*
+	 *	Skip non-protocol attributes.
+	 */
+	if (!strcasecmp(key, "Request-Authenticator")) return 0;
+
+	/*
+	 *	Set the original client IP address, based on
+	 *	what's in the detail file.
+	 *
+	 *	Hmm... we don't set the server IP address.
+	 *	or port.  Oh well.
+	 */
+	if (!strcasecmp(key, "Client-IP-Address")) {
+		data->client_ip.af = AF_INET;
+		if (ip_hton(&data->client_ip, AF_INET, value, false) < 0) {
+			DEBUG("detail (%s): Failed parsing Client-IP-Address", data->name);
+			return -1;
+		}
+		return 0;
+	}
+
+	/*
+	 *	The original time at which we received the
+	 *	packet.  We need this to properly calculate
+	 *	Acct-Delay-Time.
+	 */
+	if (!strcasecmp(key, "Timestamp")) {
+		data->timestamp = atoi(value);
+		data->timestamp_offset = offset;
+
+		vp = fr_pair_afrom_num(data, PW_PACKET_ORIGINAL_TIMESTAMP, 0);
+		if (vp) {
+			vp->vp_date = (uint32_t) data->timestamp;
+			vp->type = VT_DATA;
+			fr_cursor_insert(cursor, vp);
+		}
+		return 0;
+	}
+
+	if (!strcasecmp(key, "Donestamp")) {
+		data->timestamp = atoi(value);
+		data->done_entry = true;
+		return 0;
+	}
+
+	DEBUG3("detail (%s): Trying to read VP from line - %s", data->name, buffer);
+
+	/*
+	 *	Read one VP.
+	 *
+	 *	FIXME: do we want to check for non-protocol
+	 *	attributes like radsqlrelay does?
+	 */
+	vp = NULL;
+	if ((fr_pair_list_afrom_str(data, buffer, &vp) <= 0) || !vp) {
+		DEBUG("detail (%s): Failed reading VP from line - %s", data->name, buffer);
+		return -1;
+	}
+	fr_cursor_merge(cursor, vp);
+
+	return 0;
+}
+
+/*
+ *	Read an entry from a record in a binary detail file.  The
+ *	record has been checked by detail_binary_check().
+ *
+ *	Returns 0 if the entry was read, -1 if the record should be
+ *	skipped.
+ */
+static int detail_binary_entry(listen_detail_t *data, uint8_t const *record, off_t offset)
+{
+	bool		done;
+	RADIUS_PACKET	*packet;
+	VALUE_PAIR	*vp;
+	vp_cursor_t	cursor;
+
+	packet = detail_binary_decode(data, record, &done);
+	if (!packet) {
+		WARN("detail (%s): Skipping bad record at offset %" PRIu64 ": %s",
+		     data->name, (uint64_t) offset, fr_strerror());
+		return -1;
+	}
+
+	/*
+	 *	The entry's attributes outlive the packet.
+	 */
+	for (vp = fr_cursor_init(&cursor, &packet->vps);
+	     vp;
+	     vp = fr_cursor_next(&cursor)) {
+		fr_pair_steal(data, vp);
+	}
+	data->vps = packet->vps;
+	packet->vps = NULL;
+
+	data->client_ip = packet->src_ipaddr;
+	data->timestamp = packet->timestamp.tv_sec;
+	data->timestamp_offset = offset + DETAIL_BINARY_FLAGS_OFFSET;
+	data->done_entry = done;
+
+	/*
+	 *	Add the attributes which are in text detail files,
+	 *	but aren't in the packet.
+	 */
+	if (packet->code != PW_CODE_ACCOUNTING_REQUEST) {
+		vp = fr_pair_afrom_num(data, PW_PACKET_TYPE, 0);
+		if (vp) {
+			vp->vp_integer = packet->code;
+			vp->type = VT_DATA;
+			fr_pair_add(&data->vps, vp);
+		}
+	}
+
+	vp = fr_pair_afrom_num(data, PW_PACKET_ORIGINAL_TIMESTAMP, 0);
+	if (vp) {
+		vp->vp_date = (uint32_t) data->timestamp;
+		vp->type = VT_DATA;
+		fr_pair_add(&data->vps, vp);
+	}
+
+	talloc_free(packet);
+
+	return 0;
+}
+
+/*
+ *	Mark an entry in a binary detail file as done.
+ */
+static void detail_binary_done(listen_detail_t *data, off_t flags_offset)
+{
+	uint8_t flags = DETAIL_BINARY_DONE;
+
+	if (pwrite(data->work_fd, &flags, sizeof(flags), flags_offset) < (ssize_t) sizeof(flags)) {
+		DEBUG("detail (%s): Failed marking request as done: %s",
+		      data->name, fr_syserror(errno));
+	}
+}
+
+/*
+ *	Save our progress through a binary detail file, at most once
+ *	a second unless we're stopping.  Everything before
+ *	"data->offset" has been done, so it's always safe to restart
+ *	from there.
+ */
+static void detail_binary_save(listen_detail_t *data, bool force)
+{
+	time_t now;
+
+	if (!data->binary || !data->track) return;
+
+	if (data->offset == data->checkpoint_offset) return;
+
+	now = time(NULL);
+	if (!force && (now == data->checkpointed)) return;
+
+	if (detail_binary_checkpoint_write(data->work_fd, data->offset, data->checkpoint + 1) < 0) {
+		DEBUG("detail (%s): %s", data->name, fr_strerror());
+		return;
+	}
+
+	data->checkpoint++;
+	data->checkpoint_offset = data->offset;
+	data->checkpointed = now;
+}
+
+/*
+ *	Read the file header of a binary detail file, and carry on
+ *	from the last checkpoint.
+ */
+static void detail_binary_start(listen_detail_t *data, uint8_t const *header, size_t len, size_t size)
+{
+	off_t offset;
+
+	data->offset = DETAIL_BINARY_HEADER_LEN;
+
+	if (len >= DETAIL_BINARY_HEADER_LEN) {
+		offset = detail_binary_checkpoint(header, &data->checkpoint);
+		if (offset && ((size_t) offset <= size)) {
+			DEBUG("detail (%s): Continuing from checkpoint at offset %" PRIu64,
+			      data->name, (uint64_t) offset);
+			data->offset = offset;
+		}
+	}
+
+	data->checkpoint_offset = data->offset;
+}
+
+/*
+ *	Read the next entry from a binary detail file, for
+ *	detail_poll().
+ *
+ *	Returns 1 if an entry was read, 0 if there are no more.
+ */
+static int detail_poll_binary(listen_detail_t *data)
+{
+	uint8_t		buffer[DETAIL_BINARY_MAX_LEN];
+	ssize_t		len, rcode, i;
+
+	while (true) {
+		len = pread(data->work_fd, buffer, sizeof(buffer), data->offset);
+		if (len <= 0) return 0;
+
+		rcode = detail_binary_check(buffer, len);
+
+		/*
+		 *	A truncated record is treated as EOF, as in
+		 *	the text format.
+		 */
+		if (rcode == 0) return 0;
+
+		/*
+		 *	Look for the next record after a bad one.
+		 */
+		if (rcode < 0) {
+			for (i = 1; i < len; i++) {
+				if (detail_binary_check(buffer + i, len - i) >= 0) break;
+			}
+
+			WARN("detail (%s): Skipping %zd bytes of bad data at offset %" PRIu64,
+			     data->name, i, (uint64_t) data->offset);
+			data->offset += i;
+			continue;
+		}
+
+		data->last_offset = data->offset;
+		data->offset += rcode;
+
+		if (detail_binary_entry(data, buffer, data->last_offset) == 0) return 1;
+	}
+}
+
+static RADIUS_PACKET *detail_poll(rad_listen_t *listener)
+{
+	int		y;
+	vp_cursor_t	cursor;
+	RADIUS_PACKET	*packet;
+	char		buffer[2048];
+	listen_detail_t *data = listener->data;
+
+	switch (data->state) {
+	case STATE_UNOPENED:
+open_file:
+		rad_assert(data->work_fd < 0);
+
+		if (!detail_open(listener)) return NULL;
+
+		rad_assert(data->state == STATE_UNLOCKED);
+		rad_assert(data->work_fd >= 0);
+
+		/* FALL-THROUGH */
+
+	/*
+	 *	Try to lock fd.  If we can't, return.
+	 *	If we can, continue.  This means that
+	 *	the server doesn't block while waiting
+	 *	for the lock to open...
+	 */
+	case STATE_UNLOCKED:
+		/*
+		 *	Note that we do NOT block waiting for
+		 *	the lock.  We've re-named the file
+		 *	above, so we've already guaranteed
+		 *	that any *new* detail writer will not
+		 *	be opening this file.  The only
+		 *	purpose of the lock is to catch a race
+		 *	condition where the execution
+		 *	"ping-pongs" between radiusd &
+		 *	radrelay.
+		 */
+		if (rad_lockfd_nonblock(data->work_fd, 0) < 0) {
+			/*
+			 *	Close the FD.  The main loop
+			 *	will wake up in a second and
+			 *	try again.
+			 */
+			close(data->work_fd);
+			data->fp = NULL;
+			data->work_fd = -1;
+			data->state = STATE_UNOPENED;
+			return NULL;
+		}
+
+		/*
+		 *	Only open for writing if we're
+		 *	marking requests as completed.
+		 */
+		data->fp = fdopen(data->work_fd, data->track ? "r+" : "r");
+		if (!data->fp) {
+			ERROR("detail (%s): FATAL: Failed to re-open detail file: %s",
+			      data->name, fr_syserror(errno));
+			fr_exit(1);
+		}
+
+		/*
+		 *	Binary files are read with pread(), so the
+		 *	FILE isn't used for anything else.
+		 */
+		{
+			uint8_t		header[DETAIL_BINARY_HEADER_LEN];
+			ssize_t		len;
+			struct stat	st;
+
+			len = pread(data->work_fd, header, sizeof(header), 0);
+			if ((len > 0) && detail_binary_is_header(header, len) && (fstat(data->work_fd, &st) == 0)) {
+				data->binary = true;
+				detail_binary_start(data, header, len, st.st_size);
+			}
+		}
+
+		/*
+		 *	Look for the header
+		 */
+		data->state = STATE_HEADER;
+		data->delay_time = USEC;
+		data->vps = NULL;
+
+		/* FALL-THROUGH */
+
+	case STATE_HEADER:
+	do_header:
+		data->done_entry = false;
+		data->timestamp_offset = 0;
+
+		data->tries = 0;
+		if (!data->fp) {
+			data->state = STATE_UNOPENED;
+			goto open_file;
+		}
+
+		if (data->binary) {
+			if (!detail_poll_binary(data)) goto cleanup;
+
+			data->state = STATE_QUEUED;
+			data->packets++;
+			goto alloc_packet;
+		}
+
+		{
+			struct stat buf;
+
+			if (fstat(data->work_fd, &buf) < 0) {
+				ERROR("detail (%s): Failed to stat detail file: %s",
+				      data->name, fr_syserror(errno));
+
+				goto cleanup;
+			}
+			if (((off_t) ftell(data->fp)) == buf.st_size) {
+				goto cleanup;
+			}
+		}
+
+		/*
+		 *	End of file.  Delete it, and re-set
+		 *	everything.
+		 */
+		if (feof(data->fp)) {
+		cleanup:
+			DEBUG("detail (%s): Unlinking %s", data->name, data->filename_work);
+			unlink(data->filename_work);
+			if (data->fp) fclose(data->fp);
+			data->fp = NULL;
+			data->work_fd = -1;
+			data->state = STATE_UNOPENED;
+			rad_assert(data->vps == NULL);
+
+			if (data->one_shot) {
+				INFO("detail (%s): Finished reading \"one shot\" detail file - Exiting", data->name);
+				radius_signal_self(RADIUS_SIGNAL_SELF_EXIT);
+			}
+
+			return NULL;
+		}
+
+		/*
+		 *	Else go read something.
+		 */
+		if (!fgets(buffer, sizeof(buffer), data->fp)) {
+			DEBUG("detail (%s): Failed reading header from file - %s",
+			      data->name, data->filename_work);
+			goto cleanup;
+		}
+
+		/*
+		 *	Badly formatted file: delete it.
+		 */
+		if (!strchr(buffer, '\n')) {
+			DEBUG("detail (%s): Invalid line without trailing LF - %s", data->name, buffer);
+			goto cleanup;
+		}
+
+		if (!sscanf(buffer, "%*s %*s %*d %*d:%*d:%*d %d", &y)) {
+			DEBUG("detail (%s): Failed reading detail file header in line - %s", data->name, buffer);
+			goto cleanup;
+		}
+
+		data->state = STATE_READING;
+		/* FALL-THROUGH */
+
+
+	/*
+	 *	Read more value-pair's, unless we're
+	 *	at EOF.  In that case, queue whatever
+	 *	we have.
+	 */
+	case STATE_READING:
+		rad_assert(data->fp != NULL);
+
+		fr_cursor_init(&cursor, &data->vps);
 
 		/*
 		 *	Read a header, OR a value-pair.
@@ -616,505 +1161,941 @@ open_file:
 				goto alloc_packet;
 			}
 
-			/*
-			 *	We have a full "attribute = value" line.
-			 *	If it doesn't look reasonable, skip it.
-			 *
-			 *	FIXME: print an error for badly formatted attributes?
-			 */
-			if (sscanf(buffer, "%255s %7s %1023s", key, op, value) != 3) {
-				DEBUG("detail (%s): Skipping badly formatted line - %s", data->name, buffer);
-				continue;
+			if (detail_parse_line(data, buffer, data->last_offset, &cursor) < 0) {
+				fr_pair_list_free(&data->vps);
+				goto cleanup;
+			}
+		}
+
+		/*
+		 *	The writer doesn't check that the
+		 *	record was completely written.  If the
+		 *	disk is full, this can result in a
+		 *	truncated record which has no trailing
+		 *	blank line.  When that happens, it's a
+		 *	bad record, and we ignore it.
+		 */
+		if (feof(data->fp)) {
+			DEBUG("detail (%s): Truncated record: treating it as EOF for detail file %s",
+			      data->name, data->filename_work);
+			fr_pair_list_free(&data->vps);
+			goto cleanup;
+		}
+
+		/*
+		 *	Some kind of non-eof error.
+		 *
+		 *	FIXME: Leave the file in-place, and warn the
+		 *	administrator?
+		 */
+		DEBUG("detail (%s): Unknown error, deleting detail file %s",
+		      data->name, data->filename_work);
+		goto cleanup;
+
+	case STATE_QUEUED:
+		goto alloc_packet;
+
+	/*
+	 *	Periodically check what's going on.
+	 *	If the request is taking too long,
+	 *	retry it.
+	 */
+	case STATE_RUNNING:
+		if (time(NULL) < (data->running + (int)data->retry_interval)) {
+			return NULL;
+		}
+
+		DEBUG("detail (%s): No response to detail request.  Retrying", data->name);
+		/* FALL-THROUGH */
+
+	/*
+	 *	If there's no reply, keep
+	 *	retransmitting the current packet
+	 *	forever.
+	 */
+	case STATE_NO_REPLY:
+		data->state = STATE_QUEUED;
+		goto alloc_packet;
+
+	/*
+	 *	We have a reply.  Clean up the old
+	 *	request, and go read another one.
+	 */
+	case STATE_REPLIED:
+		if (data->track && data->binary) {
+			detail_binary_done(data, data->timestamp_offset);
+			detail_binary_save(data, false);
+
+		} else if (data->track) {
+			rad_assert(data->fp != NULL);
+
+			if (fseek(data->fp, data->timestamp_offset, SEEK_SET) < 0) {
+				DEBUG("detail (%s): Failed seeking to timestamp offset: %s",
+				     data->name, fr_syserror(errno));
+			} else if (fwrite("\tDone", 1, 5, data->fp) < 5) {
+				DEBUG("detail (%s): Failed marking request as done: %s",
+				     data->name, fr_syserror(errno));
+			} else if (fflush(data->fp) != 0) {
+				DEBUG("detail (%s): Failed flushing marked detail file to disk: %s",
+				     data->name, fr_syserror(errno));
+			}
+
+			if (fseek(data->fp, data->offset, SEEK_SET) < 0) {
+				DEBUG("detail (%s): Failed seeking to next detail request: %s",
+				     data->name, fr_syserror(errno));
 			}
+		}
+
+		fr_pair_list_free(&data->vps);
+		data->state = STATE_HEADER;
+		goto do_header;
+	}
+
+	/*
+	 *	Process the packet.
+	 */
+ alloc_packet:
+	if (data->done_entry) {
+		DEBUG2("detail (%s): Skipping record for timestamp %lu", data->name, data->timestamp);
+		fr_pair_list_free(&data->vps);
+		data->state = STATE_HEADER;
+		goto do_header;
+	}
+
+	data->tries++;
+
+	/*
+	 *	We're done reading the file, but we didn't read
+	 *	anything.  Clean up, and don't return anything.
+	 */
+	if (!data->vps) {
+		WARN("detail (%s): Read empty packet from file %s",
+		     data->name, data->filename_work);
+		data->state = STATE_HEADER;
+		return NULL;
+	}
+
+	packet = detail_packet_alloc(data, data->vps, &data->client_ip, data->timestamp,
+				     data->tries, data->counter);
+
+	data->state = STATE_RUNNING;
+	data->running = packet->timestamp.tv_sec;
+
+	return packet;
+}
+
+/*
+ *	Free detail-specific stuff.
+ */
+void detail_free(rad_listen_t *this)
+{
+	listen_detail_t *data = this->data;
+
+#ifdef WITH_DETAIL_THREAD
+	if (!check_config) {
+		ssize_t ret;
+		void *arg = NULL;
+
+		/*
+		 *	Mark the child pipes as unusable
+		 */
+		close(data->child_pipe[0]);
+		close(data->child_pipe[1]);
+		data->child_pipe[0] = -1;
+
+		/*
+		 *	Tell it to stop (interrupting its sleep)
+		 */
+		pthread_kill(data->pthread_id, SIGTERM);
+
+		/*
+		 *	Wait for it to acknowledge that it's stopped.
+		 */
+		ret = read(data->master_pipe[0], &arg, sizeof(arg));
+		if (ret < 0) {
+			ERROR("detail (%s): Reader thread exited without informing the master: %s",
+			      data->name, fr_syserror(errno));
+		} else if (ret != sizeof(arg)) {
+			ERROR("detail (%s): Invalid thread pointer received from reader thread during exit",
+			      data->name);
+			ERROR("detail (%s): Expected %zu bytes, got %zi bytes", data->name, sizeof(arg), ret);
+		}
+
+		close(data->master_pipe[0]);
+		close(data->master_pipe[1]);
+
+		if (arg) pthread_join(data->pthread_id, &arg);
+	}
+#endif
+
+	if (data->fp != NULL) {
+		fclose(data->fp);
+		data->fp = NULL;
+	}
+}
+
+
+int detail_print(rad_listen_t const *this, char *buffer, size_t bufsize)
+{
+	if (!this->server) {
+		return snprintf(buffer, bufsize, "%s",
+				((listen_detail_t *)(this->data))->filename);
+	}
+
+	return snprintf(buffer, bufsize, "detail file %s as server %s",
+			((listen_detail_t *)(this->data))->filename,
+			this->server);
+}
+
+
+/*
+ *	Delay while waiting for a file to be ready
+ */
+static int detail_delay(listen_detail_t *data)
+{
+	int delay = (data->poll_interval - 1) * USEC;
+
+	/*
+	 *	Add +/- 0.25s of jitter
+	 */
+	delay += (USEC * 3) / 4;
+	delay += fr_rand() % (USEC / 2);
+
+	DEBUG2("detail (%s): Detail listener state %s waiting %d.%06d sec",
+	       data->name,
+	       fr_int2str(state_names, data->state, "?"),
+	       (delay / USEC), delay % USEC);
+
+	return delay;
+}
+
+/*
+ *	Overloaded to return delay times.
+ */
+int detail_encode(UNUSED rad_listen_t *this, UNUSED REQUEST *request)
+{
+#ifdef WITH_DETAIL_THREAD
+	return 0;
+#else
+	listen_detail_t *data = this->data;
+
+	/*
+	 *	We haven't sent a packet... delay things a bit.
+	 */
+	if (!data->signal) return detail_delay(data);
+
+	data->signal = 0;
+
+	DEBUG2("detail (%s): Detail listener state %s signalled %d waiting %d.%06d sec",
+	       data->name,
+	       fr_int2str(state_names, data->state, "?"),
+	       data->signal,
+	       data->delay_time / USEC,
+	       data->delay_time % USEC);
+
+	return data->delay_time;
+#endif
+}
+
+/*
+ *	Overloaded to return "should we fix delay times"
+ */
+int detail_decode(rad_listen_t *this, REQUEST *request)
+{
+#ifdef WITH_DETAIL_THREAD
+	listen_detail_t *data = this->data;
+
+	RDEBUG("Received %s from detail file %s",
+	       fr_packet_codes[request->packet->code], data->filename_work);
+
+	rdebug_pair_list(L_DBG_LVL_1, request, request->packet->vps, "\t");
+
+	return 0;
+#else
+	listen_detail_t *data = this->data;
+
+	RDEBUG("Received %s from detail file %s",
+	       fr_packet_codes[request->packet->code], data->filename_work);
 
-			/*
-			 *	Should be =, :=, +=, ...
-			 */
-			if (!strchr(op, '=')) {
-				DEBUG("detail (%s): Skipping line without operator - %s", data->name, buffer);
-				continue;
-			}
+	rdebug_pair_list(L_DBG_LVL_1, request, request->packet->vps, "\t");
 
-			/*
-			 *	Skip non-protocol attributes.
-			 */
-			if (!strcasecmp(key, "Request-Authenticator")) continue;
+	return data->signal;
+#endif
+}
 
-			/*
-			 *	Set the original client IP address, based on
-			 *	what's in the detail file.
-			 *
-			 *	Hmm... we don't set the server IP address.
-			 *	or port.  Oh well.
-			 */
-			if (!strcasecmp(key, "Client-IP-Address")) {
-				data->client_ip.af = AF_INET;
-				if (ip_hton(&data->client_ip, AF_INET, value, false) < 0) {
-					DEBUG("detail (%s): Failed parsing Client-IP-Address", data->name);
-					fr_pair_list_free(&data->vps);
-					goto cleanup;
-				}
-				continue;
-			}
 
-			/*
-			 *	The original time at which we received the
-			 *	packet.  We need this to properly calculate
-			 *	Acct-Delay-Time.
-			 */
-			if (!strcasecmp(key, "Timestamp")) {
-				data->timestamp = atoi(value);
-				data->timestamp_offset = data->last_offset;
-
-				vp = fr_pair_afrom_num(data, PW_PACKET_ORIGINAL_TIMESTAMP, 0);
-				if (vp) {
-					vp->vp_date = (uint32_t) data->timestamp;
-					vp->type = VT_DATA;
-					fr_cursor_insert(&cursor, vp);
-				}
-				continue;
-			}
+#ifdef WITH_DETAIL_THREAD
+static void *detail_handler_thread(void *arg)
+{
+	char c;
+	rad_listen_t *this = arg;
+	listen_detail_t *data = this->data;
 
-			if (!strcasecmp(key, "Donestamp")) {
-				data->timestamp = atoi(value);
-				data->done_entry = true;
-				continue;
-			}
+	while (true) {
+		RADIUS_PACKET *packet;
 
-			DEBUG3("detail (%s): Trying to read VP from line - %s", data->name, buffer);
+		while ((packet = detail_poll(this)) == NULL) {
+			usleep(detail_delay(data));
 
 			/*
-			 *	Read one VP.
-			 *
-			 *	FIXME: do we want to check for non-protocol
-			 *	attributes like radsqlrelay does?
+			 *	If we're supposed to exit then tell
+			 *	the master thread we've exited.
 			 */
-			vp = NULL;
-			if ((fr_pair_list_afrom_str(data, buffer, &vp) > 0) &&
-			    (vp != NULL)) {
-				fr_cursor_merge(&cursor, vp);
-			} else {
-				DEBUG("detail (%s): Failed reading VP from line - %s", data->name, buffer);
-				goto cleanup;
+			if (data->child_pipe[0] < 0) {
+				packet = NULL;
+				if (write(data->master_pipe[1], &packet, sizeof(packet)) < 0) {
+					ERROR("detail (%s): Failed writing exit status to master: %s",
+					      data->name, fr_syserror(errno));
+				}
+				return NULL;
 			}
 		}
 
 		/*
-		 *	The writer doesn't check that the
-		 *	record was completely written.  If the
-		 *	disk is full, this can result in a
-		 *	truncated record which has no trailing
-		 *	blank line.  When that happens, it's a
-		 *	bad record, and we ignore it.
-		 */
-		if (feof(data->fp)) {
-			DEBUG("detail (%s): Truncated record: treating it as EOF for detail file %s",
-			      data->name, data->filename_work);
-			fr_pair_list_free(&data->vps);
-			goto cleanup;
-		}
-
-		/*
-		 *	Some kind of non-eof error.
+		 *	Keep retrying forever.
 		 *
-		 *	FIXME: Leave the file in-place, and warn the
-		 *	administrator?
+		 *	FIXME: cap the retries.
 		 */
-		DEBUG("detail (%s): Unknown error, deleting detail file %s",
-		      data->name, data->filename_work);
-		goto cleanup;
+		do {
+			if (write(data->master_pipe[1], &packet, sizeof(packet)) < 0) {
+				ERROR("detail (%s): Failed passing detail packet pointer to master: %s",
+				      data->name, fr_syserror(errno));
+			}
 
-	case STATE_QUEUED:
-		goto alloc_packet;
+			if (read(data->child_pipe[0], &c, 1) < 0) {
+				ERROR("detail (%s): Failed getting detail packet ack from master: %s",
+				      data->name, fr_syserror(errno));
+				break;
+			}
 
-	/*
-	 *	Periodically check what's going on.
-	 *	If the request is taking too long,
-	 *	retry it.
-	 */
-	case STATE_RUNNING:
-		if (time(NULL) < (data->running + (int)data->retry_interval)) {
-			return NULL;
-		}
+			if (data->delay_time > 0) usleep(data->delay_time);
 
-		DEBUG("detail (%s): No response to detail request.  Retrying", data->name);
-		/* FALL-THROUGH */
+			packet = detail_poll(this);
+			if (!packet) break;
+		} while (data->state != STATE_REPLIED);
+	}
 
-	/*
-	 *	If there's no reply, keep
-	 *	retransmitting the current packet
-	 *	forever.
-	 */
-	case STATE_NO_REPLY:
-		data->state = STATE_QUEUED;
-		goto alloc_packet;
+	return NULL;
+}
 
-	/*
-	 *	We have a reply.  Clean up the old
-	 *	request, and go read another one.
-	 */
-	case STATE_REPLIED:
-		if (data->track) {
-			rad_assert(data->fp != NULL);
+/*
+ *	Stop processing the work file.  If we're done with it, delete
+ *	it.
+ */
+static void detail_window_close(listen_detail_t *data, bool done)
+{
+	uint32_t	i;
+	detail_window_t	*win = data->win;
 
-			if (fseek(data->fp, data->timestamp_offset, SEEK_SET) < 0) {
-				DEBUG("detail (%s): Failed seeking to timestamp offset: %s",
-				     data->name, fr_syserror(errno));
-			} else if (fwrite("\tDone", 1, 5, data->fp) < 5) {
-				DEBUG("detail (%s): Failed marking request as done: %s",
-				     data->name, fr_syserror(errno));
-			} else if (fflush(data->fp) != 0) {
-				DEBUG("detail (%s): Failed flushing marked detail file to disk: %s",
-				     data->name, fr_syserror(errno));
-			}
+	if (!done) detail_binary_save(data, true);
 
-			if (fseek(data->fp, data->offset, SEEK_SET) < 0) {
-				DEBUG("detail (%s): Failed seeking to next detail request: %s",
-				     data->name, fr_syserror(errno));
-			}
-		}
+	if (win->map) munmap(win->map, win->size);
+	win->map = NULL;
+	win->size = 0;
 
-		fr_pair_list_free(&data->vps);
-		data->state = STATE_HEADER;
-		goto do_header;
+	for (i = 0; i < win->slots; i++) {
+		fr_pair_list_free(&win->entries[i].vps);
+		win->entries[i].in_flight = false;
 	}
+	win->head = win->count = win->in_flight = 0;
 
-	/*
-	 *	Process the packet.
-	 */
- alloc_packet:
-	if (data->done_entry) {
-		DEBUG2("detail (%s): Skipping record for timestamp %lu", data->name, data->timestamp);
-		fr_pair_list_free(&data->vps);
-		data->state = STATE_HEADER;
-		goto do_header;
+	if (done) {
+		DEBUG("detail (%s): Unlinking %s", data->name, data->filename_work);
+		unlink(data->filename_work);
 	}
 
-	data->tries++;
+	if (data->work_fd >= 0) close(data->work_fd);
+	data->work_fd = -1;
+	data->state = STATE_UNOPENED;
 
-	/*
-	 *	We're done reading the file, but we didn't read
-	 *	anything.  Clean up, and don't return anything.
-	 */
-	if (!data->vps) {
-		WARN("detail (%s): Read empty packet from file %s",
-		     data->name, data->filename_work);
-		data->state = STATE_HEADER;
-		return NULL;
+	if (done && data->one_shot) {
+		INFO("detail (%s): Finished reading \"one shot\" detail file - Exiting", data->name);
+		radius_signal_self(RADIUS_SIGNAL_SELF_EXIT);
 	}
+}
 
-	/*
-	 *	Allocate the packet.  If we fail, it's a serious
-	 *	problem.
-	 */
-	packet = rad_alloc(NULL, true);
-	if (!packet) {
-		ERROR("detail (%s): FATAL: Failed allocating memory for detail", data->name);
-		fr_exit(1);
+/*
+ *	(Re-)map the work file.  The writer may still be appending to
+ *	it, if it opened the file before we renamed it.
+ *
+ *	Returns 1 if there's more of the file to read, 0 if not, -1 on
+ *	error.
+ */
+static int detail_window_map(listen_detail_t *data)
+{
+	struct stat	st;
+	detail_window_t	*win = data->win;
+
+	if (fstat(data->work_fd, &st) < 0) {
+		ERROR("detail (%s): Failed to stat detail file: %s", data->name, fr_syserror(errno));
+		return -1;
 	}
 
-	memset(packet, 0, sizeof(*packet));
-	packet->sockfd = -1;
-	packet->src_ipaddr.af = AF_INET;
-	packet->src_ipaddr.ipaddr.ip4addr.s_addr = htonl(INADDR_NONE);
+	if ((size_t) st.st_size <= win->size) return 0;
 
-	/*
-	 *	If everything's OK, this is a waste of memory.
-	 *	Otherwise, it lets us re-send the original packet
-	 *	contents, unmolested.
-	 */
-	packet->vps = fr_pair_list_copy(packet, data->vps);
+	if (win->map) munmap(win->map, win->size);
+	win->size = 0;
 
-	packet->code = PW_CODE_ACCOUNTING_REQUEST;
-	vp = fr_pair_find_by_num(packet->vps, PW_PACKET_TYPE, 0, TAG_ANY);
-	if (vp) packet->code = vp->vp_integer;
+	win->map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, data->work_fd, 0);
+	if (win->map == MAP_FAILED) {
+		win->map = NULL;
+		ERROR("detail (%s): Failed mapping detail file: %s", data->name, fr_syserror(errno));
+		return -1;
+	}
+	win->size = st.st_size;
 
-	gettimeofday(&packet->timestamp, NULL);
+	return 1;
+}
+
+/*
+ *	Open the next work file, and map it.
+ */
+static bool detail_window_open(rad_listen_t *this)
+{
+	listen_detail_t	*data = this->data;
+	detail_window_t	*win = data->win;
+
+	if (!detail_open(this)) return false;
 
 	/*
-	 *	Remember where it came from, so that we don't
-	 *	proxy it to the place it came from...
+	 *	See STATE_UNLOCKED in detail_poll() for why we don't
+	 *	block.
 	 */
-	if (data->client_ip.af != AF_UNSPEC) {
-		packet->src_ipaddr = data->client_ip;
+	if (rad_lockfd_nonblock(data->work_fd, 0) < 0) {
+		close(data->work_fd);
+		data->work_fd = -1;
+		data->state = STATE_UNOPENED;
+		return false;
 	}
 
-	vp = fr_pair_find_by_num(packet->vps, PW_PACKET_SRC_IP_ADDRESS, 0, TAG_ANY);
-	if (vp) {
-		packet->src_ipaddr.af = AF_INET;
-		packet->src_ipaddr.ipaddr.ip4addr.s_addr = vp->vp_ipaddr;
-		packet->src_ipaddr.prefix = 32;
-	} else {
-		vp = fr_pair_find_by_num(packet->vps, PW_PACKET_SRC_IPV6_ADDRESS, 0, TAG_ANY);
-		if (vp) {
-			packet->src_ipaddr.af = AF_INET6;
-			memcpy(&packet->src_ipaddr.ipaddr.ip6addr,
-			       &vp->vp_ipv6addr, sizeof(vp->vp_ipv6addr));
-			packet->src_ipaddr.prefix = 128;
-		}
+	win->next = 0;
+	win->eof = false;
+
+	switch (detail_window_map(data)) {
+	case 1:
+		break;
+
+	case 0:
+		detail_window_close(data, true);
+		return false;
+
+	default:
+		detail_window_close(data, false);
+		return false;
 	}
 
-	vp = fr_pair_find_by_num(packet->vps, PW_PACKET_DST_IP_ADDRESS, 0, TAG_ANY);
-	if (vp) {
-		packet->dst_ipaddr.af = AF_INET;
-		packet->dst_ipaddr.ipaddr.ip4addr.s_addr = vp->vp_ipaddr;
-		packet->dst_ipaddr.prefix = 32;
-	} else {
-		vp = fr_pair_find_by_num(packet->vps, PW_PACKET_DST_IPV6_ADDRESS, 0, TAG_ANY);
-		if (vp) {
-			packet->dst_ipaddr.af = AF_INET6;
-			memcpy(&packet->dst_ipaddr.ipaddr.ip6addr,
-			       &vp->vp_ipv6addr, sizeof(vp->vp_ipv6addr));
-			packet->dst_ipaddr.prefix = 128;
-		}
+	if (detail_binary_is_header(win->map, win->size)) {
+		data->binary = true;
+		detail_binary_start(data, win->map, win->size, win->size);
+		win->next = data->offset;
 	}
 
-	/*
-	 *	Generate packet ID, ports, IP via a counter.
-	 */
-	packet->id = data->counter & 0xff;
-	packet->src_port = 1024 + ((data->counter >> 8) & 0xff);
-	packet->dst_port = 1024 + ((data->counter >> 16) & 0xff);
+	data->state = STATE_READING;
 
-	packet->dst_ipaddr.af = AF_INET;
-	packet->dst_ipaddr.ipaddr.ip4addr.s_addr = htonl((INADDR_LOOPBACK & ~0xffffff) | ((data->counter >> 24) & 0xff));
+	return true;
+}
 
-	/*
-	 *	Create / update accounting attributes.
-	 */
-	if (packet->code == PW_CODE_ACCOUNTING_REQUEST) {
-		/*
-		 *	Prefer the Event-Timestamp in the packet, if it
-		 *	exists.  That is when the event occurred, whereas the
-		 *	"Timestamp" field is when we wrote the packet to the
-		 *	detail file, which could have been much later.
-		 */
-		vp = fr_pair_find_by_num(packet->vps, PW_EVENT_TIMESTAMP, 0, TAG_ANY);
-		if (vp) {
-			data->timestamp = vp->vp_integer;
-		}
+/*
+ *	Move the entry which has just been read to the window.
+ */
+static void detail_window_entry(listen_detail_t *data, detail_entry_t *entry, off_t end)
+{
+	entry->end = data->win->next = end;
+	entry->timestamp_offset = data->timestamp_offset;
+	entry->vps = data->vps;
+	data->vps = NULL;
+	entry->client_ip = data->client_ip;
+	entry->timestamp = data->timestamp;
+	entry->tries = 0;
+	entry->retry = 0;
+	entry->in_flight = false;
+	entry->done = data->done_entry;
+}
+
+/*
+ *	Read the next entry from a binary file.  There's nothing to
+ *	parse, and bad records are skipped rather than ending the
+ *	file.
+ *
+ *	Returns 1 if an entry was read, 0 if there are no complete
+ *	entries left.
+ */
+static int detail_window_read_binary(listen_detail_t *data, detail_entry_t *entry)
+{
+	ssize_t		len;
+	off_t		offset, skipped = 0;
+	detail_window_t	*win = data->win;
+
+	for (offset = win->next; (size_t) offset < win->size; offset += len) {
+		len = detail_binary_check(win->map + offset, win->size - offset);
+		if (len == 0) break;
 
 		/*
-		 *	Look for Acct-Delay-Time, and update
-		 *	based on Acct-Delay-Time += (time(NULL) - timestamp)
+		 *	Look for the next record after a bad one.
 		 */
-		vp = fr_pair_find_by_num(packet->vps, PW_ACCT_DELAY_TIME, 0, TAG_ANY);
-		if (!vp) {
-			vp = fr_pair_afrom_num(packet, PW_ACCT_DELAY_TIME, 0);
-			rad_assert(vp != NULL);
-			fr_pair_add(&packet->vps, vp);
+		if (len < 0) {
+			skipped++;
+			len = 1;
+			continue;
 		}
-		if (data->timestamp != 0) {
-			vp->vp_integer += time(NULL) - data->timestamp;
+
+		if (skipped) {
+			WARN("detail (%s): Skipping %" PRIu64 " bytes of bad data at offset %" PRIu64,
+			     data->name, (uint64_t) skipped, (uint64_t) (offset - skipped));
+			skipped = 0;
 		}
+
+		data->done_entry = false;
+		if (detail_binary_entry(data, win->map + offset, offset) < 0) continue;
+
+		detail_window_entry(data, entry, offset + len);
+		return 1;
 	}
 
 	/*
-	 *	Set the transmission count.
+	 *	Don't look at the bad data again.  If the last record
+	 *	was truncated, it may be finished later.
 	 */
-	vp = fr_pair_find_by_num(packet->vps, PW_PACKET_TRANSMIT_COUNTER, 0, TAG_ANY);
-	if (!vp) {
-		vp = fr_pair_afrom_num(packet, PW_PACKET_TRANSMIT_COUNTER, 0);
-		rad_assert(vp != NULL);
-		fr_pair_add(&packet->vps, vp);
-	}
-	vp->vp_integer = data->tries;
-
-	data->state = STATE_RUNNING;
-	data->running = packet->timestamp.tv_sec;
+	win->next = offset;
 
-	return packet;
+	return 0;
 }
 
 /*
- *	Free detail-specific stuff.
+ *	Read the next entry from the map.
+ *
+ *	Returns 1 if an entry was read, 0 if there are no complete
+ *	entries left, -1 if the file is bad.
  */
-void detail_free(rad_listen_t *this)
+static int detail_window_read(listen_detail_t *data, detail_entry_t *entry)
 {
-	listen_detail_t *data = this->data;
+	int		y;
+	off_t		offset;
+	bool		header = true;
+	char		buffer[2048];
+	vp_cursor_t	cursor;
+	detail_window_t	*win = data->win;
 
-#ifdef WITH_DETAIL_THREAD
-	if (!check_config) {
-		ssize_t ret;
-		void *arg = NULL;
+	if (data->binary) return detail_window_read_binary(data, entry);
 
-		/*
-		 *	Mark the child pipes as unusable
-		 */
-		close(data->child_pipe[0]);
-		close(data->child_pipe[1]);
-		data->child_pipe[0] = -1;
+	data->done_entry = false;
+	data->timestamp_offset = 0;
+	fr_cursor_init(&cursor, &data->vps);
+
+	for (offset = win->next; (size_t) offset < win->size; ) {
+		uint8_t const	*p = win->map + offset;
+		uint8_t const	*eol;
+		size_t		len;
+
+		eol = memchr(p, '\n', win->size - offset);
+		if (!eol) break;
 
 		/*
-		 *	Tell it to stop (interrupting its sleep)
+		 *	Lines which fgets() would split are bad, as in
+		 *	detail_poll().
 		 */
-		pthread_kill(data->pthread_id, SIGTERM);
+		len = (eol - p) + 1;
+		if (len >= sizeof(buffer)) {
+			WARN("detail (%s): Skipping line without trailing LF - %.*s",
+			     data->name, (int) (sizeof(buffer) - 1), p);
+			goto error;
+		}
+
+		memcpy(buffer, p, len);
+		buffer[len] = '\0';
+
+		data->last_offset = offset;
+		offset += len;
+
+		if (header) {
+			if (!sscanf(buffer, "%*s %*s %*d %*d:%*d:%*d %d", &y)) {
+				DEBUG("detail (%s): Failed reading detail file header in line - %s", data->name, buffer);
+				goto error;
+			}
+			header = false;
+			continue;
+		}
 
 		/*
-		 *	Wait for it to acknowledge that it's stopped.
+		 *	A blank line is the end of the entry.
 		 */
-		ret = read(data->master_pipe[0], &arg, sizeof(arg));
-		if (ret < 0) {
-			ERROR("detail (%s): Reader thread exited without informing the master: %s",
-			      data->name, fr_syserror(errno));
-		} else if (ret != sizeof(arg)) {
-			ERROR("detail (%s): Invalid thread pointer received from reader thread during exit",
-			      data->name);
-			ERROR("detail (%s): Expected %zu bytes, got %zi bytes", data->name, sizeof(arg), ret);
+		if (buffer[0] == '\n') {
+			detail_window_entry(data, entry, offset);
+			return 1;
 		}
 
-		close(data->master_pipe[0]);
-		close(data->master_pipe[1]);
-
-		if (arg) pthread_join(data->pthread_id, &arg);
+		if (detail_parse_line(data, buffer, data->last_offset, &cursor) < 0) goto error;
 	}
-#endif
 
-	if (data->fp != NULL) {
-		fclose(data->fp);
-		data->fp = NULL;
-	}
-}
+	/*
+	 *	A truncated entry, which we'll read again if the
+	 *	writer finishes it.
+	 */
+	fr_pair_list_free(&data->vps);
+	return 0;
 
+error:
+	fr_pair_list_free(&data->vps);
+	return -1;
+}
 
-int detail_print(rad_listen_t const *this, char *buffer, size_t bufsize)
+/*
+ *	Send the packet for an entry to the main thread.
+ */
+static void detail_window_send(listen_detail_t *data, detail_entry_t *entry, time_t now)
 {
-	if (!this->server) {
-		return snprintf(buffer, bufsize, "%s",
-				((listen_detail_t *)(this->data))->filename);
+	RADIUS_PACKET	*packet;
+	detail_window_t	*win = data->win;
+
+	entry->tries++;
+	entry->number = win->number++;
+	data->tries = entry->tries;
+
+	packet = detail_packet_alloc(data, entry->vps, &entry->client_ip, entry->timestamp,
+				     entry->tries, entry->number);
+
+	if (write(data->master_pipe[1], &packet, sizeof(packet)) < 0) {
+		ERROR("detail (%s): Failed passing detail packet pointer to master: %s",
+		      data->name, fr_syserror(errno));
+		rad_free(&packet);
+		entry->retry = now + data->retry_interval;
+		return;
 	}
 
-	return snprintf(buffer, bufsize, "detail file %s as server %s",
-			((listen_detail_t *)(this->data))->filename,
-			this->server);
+	entry->in_flight = true;
+	entry->sent = now;
+	win->in_flight++;
 }
 
+/*
+ *	Move the start of the window past the entries we're done with.
+ *	The offset only moves past entries which have all been done,
+ *	so it's always safe to restart from it.
+ */
+static void detail_window_advance(listen_detail_t *data)
+{
+	detail_window_t	*win = data->win;
+
+	while (win->count && win->entries[win->head].done) {
+		detail_entry_t *entry = &win->entries[win->head];
+
+		fr_pair_list_free(&entry->vps);
+		data->offset = entry->end;
+
+		win->head = (win->head + 1) % win->slots;
+		win->count--;
+	}
+
+	detail_binary_save(data, false);
+}
 
 /*
- *	Delay while waiting for a file to be ready
+ *	Adjust the window to the latency of the backend.
+ *
+ *	While the RTT stays close to the RTT of an idle backend, the
+ *	backend isn't queueing our packets, so the window opens by one
+ *	packet for every window of answers (or faster, before the
+ *	backend has ever been busy).  When the RTT grows, the
+ *	backend is falling behind, and the window closes by a quarter.
+ *	Timeouts halve it.
  */
-static int detail_delay(listen_detail_t *data)
+static void detail_window_rtt(listen_detail_t *data, int rtt, time_t now)
 {
-	int delay = (data->poll_interval - 1) * USEC;
+	bool		busy;
+	detail_window_t	*win = data->win;
+
+	if (!data->has_rtt) {
+		data->has_rtt = true;
+		data->srtt = rtt;
+		data->rttvar = rtt / 2;
+	} else {
+		data->rttvar -= data->rttvar >> 2;
+		data->rttvar += (data->srtt - rtt);
+		data->srtt -= data->srtt >> 3;
+		data->srtt += rtt >> 3;
+	}
 
 	/*
-	 *	Add +/- 0.25s of jitter
+	 *	Use the smoothed RTT, as single answers can be much
+	 *	faster than usual.  The backend may get slower, so
+	 *	forget the lowest RTT every so often.
 	 */
-	delay += (USEC * 3) / 4;
-	delay += fr_rand() % (USEC / 2);
+	if (!win->period_rtt || (data->srtt < win->period_rtt)) win->period_rtt = data->srtt;
+	if (now >= (win->period + 10)) {
+		win->base_rtt = win->period_rtt;
+		win->period_rtt = 0;
+		win->period = now;
+	}
+	if (!win->base_rtt || (data->srtt < win->base_rtt)) win->base_rtt = data->srtt;
 
-	DEBUG2("detail (%s): Detail listener state %s waiting %d.%06d sec",
-	       data->name,
-	       fr_int2str(state_names, data->state, "?"),
-	       (delay / USEC), delay % USEC);
+	/*
+	 *	Allow a millisecond of jitter, for fast backends.
+	 */
+	busy = (data->srtt > ((2 * win->base_rtt) + (USEC / 1000)));
 
-	return delay;
+	/*
+	 *	Until the backend first gets busy, open the window by
+	 *	one packet for every answer, doubling it every window.
+	 */
+	if (!win->congested && !busy) {
+		if (data->cwnd < data->window) data->cwnd++;
+		return;
+	}
+
+	if (++win->acked < data->cwnd) return;
+	win->acked = 0;
+
+	if (busy) {
+		win->congested = true;
+		data->cwnd -= data->cwnd / 4;
+		if (!data->cwnd) data->cwnd = 1;
+
+	} else if (data->cwnd < data->window) {
+		data->cwnd++;
+	}
 }
 
 /*
- *	Overloaded to return delay times.
+ *	Process an answer from the main thread.
  */
-int detail_encode(UNUSED rad_listen_t *this, UNUSED REQUEST *request)
+static void detail_window_ack(listen_detail_t *data, detail_ack_t const *ack, time_t now)
 {
-#ifdef WITH_DETAIL_THREAD
-	return 0;
-#else
-	listen_detail_t *data = this->data;
+	uint32_t	i;
+	detail_entry_t	*entry = NULL;
+	detail_window_t	*win = data->win;
+
+	for (i = 0; i < win->count; i++) {
+		detail_entry_t *e = &win->entries[(win->head + i) % win->slots];
+
+		if (e->in_flight && (e->number == ack->number)) {
+			entry = e;
+			break;
+		}
+	}
 
 	/*
-	 *	We haven't sent a packet... delay things a bit.
+	 *	An answer for a packet we've since sent again.
 	 */
-	if (!data->signal) return detail_delay(data);
+	if (!entry) return;
 
-	data->signal = 0;
+	entry->in_flight = false;
+	win->in_flight--;
 
-	DEBUG2("detail (%s): Detail listener state %s signalled %d waiting %d.%06d sec",
-	       data->name,
-	       fr_int2str(state_names, data->state, "?"),
-	       data->signal,
-	       data->delay_time / USEC,
-	       data->delay_time % USEC);
+	/*
+	 *	The backend is probably overloaded, and we've just
+	 *	closed the window.  Back off exponentially, so that
+	 *	one failure doesn't stall the whole window for
+	 *	"retry_interval".
+	 */
+	if (ack->rtt < 0) {
+		uint32_t delay = data->poll_interval << ((entry->tries < 6) ? entry->tries - 1 : 5);
 
-	return data->delay_time;
-#endif
+		if (delay > data->retry_interval) delay = data->retry_interval;
+		entry->retry = now + delay;
+
+		data->cwnd /= 2;
+		if (!data->cwnd) data->cwnd = 1;
+		win->acked = 0;
+		win->congested = true;
+		return;
+	}
+
+	if (data->track && data->binary) {
+		detail_binary_done(data, entry->timestamp_offset);
+
+	} else if (data->track) {
+		if (pwrite(data->work_fd, "\tDone", 5, entry->timestamp_offset) < 5) {
+			DEBUG("detail (%s): Failed marking request as done: %s",
+			      data->name, fr_syserror(errno));
+		}
+	}
+
+	entry->done = true;
+	data->counter++;
+
+	if (ack->rtt > 0) detail_window_rtt(data, ack->rtt, now);
+
+	detail_window_advance(data);
 }
 
 /*
- *	Overloaded to return "should we fix delay times"
+ *	Send packets until the window is full.
  */
-int detail_decode(rad_listen_t *this, REQUEST *request)
+static void detail_window_fill(listen_detail_t *data)
 {
-#ifdef WITH_DETAIL_THREAD
-	listen_detail_t *data = this->data;
+	uint32_t	i;
+	time_t		now = time(NULL);
+	detail_window_t	*win = data->win;
 
-	RDEBUG("Received %s from detail file %s",
-	       fr_packet_codes[request->packet->code], data->filename_work);
+	/*
+	 *	Send entries again, if they've had no answer, or
+	 *	took too long.  As in detail_poll(), we retry forever.
+	 */
+	for (i = 0; (i < win->count) && (win->in_flight < data->cwnd); i++) {
+		detail_entry_t *entry = &win->entries[(win->head + i) % win->slots];
 
-	rdebug_pair_list(L_DBG_LVL_1, request, request->packet->vps, "\t");
+		if (entry->done) continue;
 
-	return 0;
-#else
-	listen_detail_t *data = this->data;
+		if (entry->in_flight) {
+			if (now < (entry->sent + (int) data->retry_interval)) continue;
 
-	RDEBUG("Received %s from detail file %s",
-	       fr_packet_codes[request->packet->code], data->filename_work);
+			DEBUG("detail (%s): No response to detail request.  Retrying", data->name);
+			entry->in_flight = false;
+			win->in_flight--;
 
-	rdebug_pair_list(L_DBG_LVL_1, request, request->packet->vps, "\t");
+		} else if (now < entry->retry) {
+			continue;
+		}
 
-	return data->signal;
-#endif
-}
+		detail_window_send(data, entry, now);
+	}
+
+	/*
+	 *	Read new entries.
+	 */
+	while ((win->in_flight < data->cwnd) && (win->count < win->slots)) {
+		detail_entry_t	*entry = &win->entries[(win->head + win->count) % win->slots];
+		int		rcode;
+
+		rcode = detail_window_read(data, entry);
+		if (rcode == 0) {
+			rcode = detail_window_map(data);
+			if (rcode > 0) continue;
+
+			if (rcode < 0) {
+				detail_window_close(data, false);
+				return;
+			}
 
+			win->eof = true;
+			break;
+		}
 
-#ifdef WITH_DETAIL_THREAD
-static void *detail_handler_thread(void *arg)
+		/*
+		 *	Ignore the rest of a bad file.  It's deleted
+		 *	once we're done with the entries we've read.
+		 */
+		if (rcode < 0) {
+			win->next = win->size;
+			win->eof = true;
+			break;
+		}
+
+		win->eof = false;
+		win->count++;
+
+		if (entry->done) {
+			DEBUG2("detail (%s): Skipping record for timestamp %lu", data->name, entry->timestamp);
+			detail_window_advance(data);
+			continue;
+		}
+
+		if (!entry->vps) {
+			WARN("detail (%s): Read empty packet from file %s",
+			     data->name, data->filename_work);
+			entry->done = true;
+			detail_window_advance(data);
+			continue;
+		}
+
+		data->packets++;
+		detail_window_send(data, entry, now);
+	}
+}
+
+/*
+ *	Wait for answers, until it's time to send more packets.
+ */
+static void detail_window_wait(listen_detail_t *data)
 {
-	char c;
-	rad_listen_t *this = arg;
-	listen_detail_t *data = this->data;
+	int		fd = data->child_pipe[0];
+	uint32_t	i;
+	time_t		now = time(NULL), when;
+	struct timeval	wake;
+	fd_set		fds;
+	ssize_t		len;
+	detail_ack_t	acks[64];
+	detail_window_t	*win = data->win;
 
-	while (true) {
-		RADIUS_PACKET *packet;
+	if (fd < 0) return;
 
-		while ((packet = detail_poll(this)) == NULL) {
-			usleep(detail_delay(data));
+	/*
+	 *	Don't wait if we can send more.
+	 */
+	if (!win->eof && (win->in_flight < data->cwnd) && (win->count < win->slots)) {
+		when = now;
+	} else {
+		when = now + data->poll_interval;
 
-			/*
-			 *	If we're supposed to exit then tell
-			 *	the master thread we've exited.
-			 */
-			if (data->child_pipe[0] < 0) {
-				packet = NULL;
-				if (write(data->master_pipe[1], &packet, sizeof(packet)) < 0) {
-					ERROR("detail (%s): Failed writing exit status to master: %s",
-					      data->name, fr_syserror(errno));
+		for (i = 0; i < win->count; i++) {
+			detail_entry_t *entry = &win->entries[(win->head + i) % win->slots];
+
+			if (entry->done) continue;
+
+			if (entry->in_flight) {
+				if ((entry->sent + (int) data->retry_interval) < when) {
+					when = entry->sent + data->retry_interval;
 				}
-				return NULL;
+			} else if (entry->retry < when) {
+				when = entry->retry;
 			}
 		}
+	}
+
+	wake.tv_sec = (when > now) ? when - now : 0;
+	wake.tv_usec = 0;
+
+	FD_ZERO(&fds);
+	FD_SET(fd, &fds);
+	if (select(fd + 1, &fds, NULL, NULL, &wake) <= 0) return;
+
+	len = read(fd, acks, sizeof(acks));
+	if (len <= 0) return;
+
+	now = time(NULL);
+	for (i = 0; i < (len / sizeof(acks[0])); i++) detail_window_ack(data, &acks[i], now);
+}
+
+/*
+ *	Read the detail file with many entries being processed at
+ *	once.  Used when "window" is more than one.
+ */
+static void *detail_window_thread(void *arg)
+{
+	RADIUS_PACKET	*packet;
+	rad_listen_t	*this = arg;
+	listen_detail_t	*data = this->data;
+	detail_window_t	*win = data->win;
+
+	while (data->child_pipe[0] >= 0) {
+		if (!win->map && !detail_window_open(this)) {
+			usleep(detail_delay(data));
+			continue;
+		}
+
+		detail_window_fill(data);
 
 		/*
-		 *	Keep retrying forever.
-		 *
-		 *	FIXME: cap the retries.
+		 *	We've read all of the file, and everything
+		 *	has been done.
 		 */
-		do {
-			if (write(data->master_pipe[1], &packet, sizeof(packet)) < 0) {
-				ERROR("detail (%s): Failed passing detail packet pointer to master: %s",
-				      data->name, fr_syserror(errno));
-			}
+		if (win->eof && !win->count) {
+			detail_window_close(data, true);
+			continue;
+		}
 
-			if (read(data->child_pipe[0], &c, 1) < 0) {
-				ERROR("detail (%s): Failed getting detail packet ack from master: %s",
-				      data->name, fr_syserror(errno));
-				break;
-			}
+		detail_window_wait(data);
+	}
 
-			if (data->delay_time > 0) usleep(data->delay_time);
+	if (win->map) detail_window_close(data, false);
 
-			packet = detail_poll(this);
-			if (!packet) break;
-		} while (data->state != STATE_REPLIED);
+	/*
+	 *	Tell the master thread we've exited.
+	 */
+	packet = NULL;
+	if (write(data->master_pipe[1], &packet, sizeof(packet)) < 0) {
+		ERROR("detail (%s): Failed writing exit status to master: %s",
+		      data->name, fr_syserror(errno));
 	}
 
 	return NULL;
@@ -1130,6 +2111,7 @@ static const CONF_PARSER detail_config[] = {
 	{ "retry_interval", FR_CONF_OFFSET(PW_TYPE_INTEGER, listen_detail_t, retry_interval), STRINGIFY(30) },
 	{ "one_shot", FR_CONF_OFFSET(PW_TYPE_BOOLEAN, listen_detail_t, one_shot), "no" },
 	{ "track", FR_CONF_OFFSET(PW_TYPE_BOOLEAN, listen_detail_t, track), "no" },
+	{ "window", FR_CONF_OFFSET(PW_TYPE_INTEGER, listen_detail_t, window), STRINGIFY(1) },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -1174,6 +2156,16 @@ int detail_parse(CONF_SECTION *cs, rad_listen_t *this)
 	FR_INTEGER_BOUND_CHECK("retry_interval", data->retry_interval, >=, 4);
 	FR_INTEGER_BOUND_CHECK("retry_interval", data->retry_interval, <=, 3600);
 
+	FR_INTEGER_BOUND_CHECK("window", data->window, >=, 1);
+	FR_INTEGER_BOUND_CHECK("window", data->window, <=, 1024);
+
+#ifndef WITH_DETAIL_THREAD
+	if (data->window > 1) {
+		WARN("detail (%s): Ignoring \"window\", as it requires threads", data->name);
+		data->window = 1;
+	}
+#endif
+
 	/*
 	 *	Only checking the config.  Don't start threads or anything else.
 	 */
@@ -1250,7 +2242,22 @@ int detail_parse(CONF_SECTION *cs, rad_listen_t *this)
 		fr_exit(1);
 	}
 
-	pthread_create(&data->pthread_id, NULL, detail_handler_thread, this);
+	/*
+	 *	Process many entries at once.  The window starts
+	 *	small, and grows while the backend keeps up.  There's
+	 *	room for more entries than the window, so that entries
+	 *	waiting to be retried don't stop us reading others.
+	 */
+	if (data->window > 1) {
+		data->win = talloc_zero(data, detail_window_t);
+		data->win->slots = data->window * 4;
+		data->win->entries = talloc_zero_array(data->win, detail_entry_t, data->win->slots);
+		data->cwnd = 1;
+
+		pthread_create(&data->pthread_id, NULL, detail_window_thread, this);
+	} else {
+		pthread_create(&data->pthread_id, NULL, detail_handler_thread, this);
+	}
 
 	this->fd = data->master_pipe[0];
 #endif
@@ -0,0 +1,383 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/*
+ * $Id$
+ *
+ * @file detail_binary.c
+ * @brief Encode and decode records in binary detail files.
+ *
+ * The format is described in detail.h.  It's shared by rlm_detail,
+ * which writes the files, the detail listener, which reads them, and
+ * raddetail, which converts them to and from text.
+ *
+ * @copyright 2015  The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/detail.h>
+
+/*
+ *	The packets are only encoded so that rad_decode() can read
+ *	them back.  Text detail files hold passwords in the clear, so
+ *	there's no point in a real secret.
+ */
+#define DETAIL_BINARY_SECRET "detail"
+
+#define CHECKPOINT_OFFSET	(16)
+#define CHECKPOINT_LEN		(16)
+
+static void put_uint16(uint8_t *p, uint16_t value)
+{
+	p[0] = value >> 8;
+	p[1] = value & 0xff;
+}
+
+static void put_uint32(uint8_t *p, uint32_t value)
+{
+	value = htonl(value);
+	memcpy(p, &value, sizeof(value));
+}
+
+static uint16_t get_uint16(uint8_t const *p)
+{
+	return (p[0] << 8) | p[1];
+}
+
+static uint32_t get_uint32(uint8_t const *p)
+{
+	uint32_t value;
+
+	memcpy(&value, p, sizeof(value));
+	return ntohl(value);
+}
+
+/*
+ *	Hash a record, except for the flags, which the reader changes.
+ */
+static uint32_t detail_binary_hash(uint8_t const *record, size_t len)
+{
+	uint32_t hash;
+
+	hash = fr_hash(record, DETAIL_BINARY_FLAGS_OFFSET);
+	hash = fr_hash_update(record + 8, 4, hash);
+
+	return fr_hash_update(record + DETAIL_BINARY_RECORD_LEN, len, hash);
+}
+
+static void detail_binary_put_ipaddr(uint8_t *af, uint8_t *p, fr_ipaddr_t const *ipaddr)
+{
+	switch (ipaddr->af) {
+	case AF_INET:
+		*af = 4;
+		memcpy(p, &ipaddr->ipaddr.ip4addr, sizeof(ipaddr->ipaddr.ip4addr));
+		break;
+
+	case AF_INET6:
+		*af = 6;
+		memcpy(p, &ipaddr->ipaddr.ip6addr, sizeof(ipaddr->ipaddr.ip6addr));
+		break;
+
+	default:
+		break;
+	}
+}
+
+static void detail_binary_get_ipaddr(fr_ipaddr_t *ipaddr, uint8_t af, uint8_t const *p)
+{
+	memset(ipaddr, 0, sizeof(*ipaddr));
+
+	switch (af) {
+	case 4:
+		ipaddr->af = AF_INET;
+		ipaddr->prefix = 32;
+		memcpy(&ipaddr->ipaddr.ip4addr, p, sizeof(ipaddr->ipaddr.ip4addr));
+		break;
+
+	case 6:
+		ipaddr->af = AF_INET6;
+		ipaddr->prefix = 128;
+		memcpy(&ipaddr->ipaddr.ip6addr, p, sizeof(ipaddr->ipaddr.ip6addr));
+		break;
+
+	default:
+		ipaddr->af = AF_UNSPEC;
+		break;
+	}
+}
+
+/** Create the header for a new binary detail file
+ *
+ * @param[out] header to initialise.
+ */
+void detail_binary_header(uint8_t header[DETAIL_BINARY_HEADER_LEN])
+{
+	memset(header, 0, DETAIL_BINARY_HEADER_LEN);
+	memcpy(header, DETAIL_BINARY_MAGIC, 8);
+	put_uint32(header + 8, DETAIL_BINARY_VERSION);
+}
+
+/** Check whether a file is a binary detail file
+ *
+ * @param[in] data the start of the file.
+ * @param[in] len of the data.
+ * @return true if the data starts with the magic for binary detail files.
+ */
+bool detail_binary_is_header(uint8_t const *data, size_t len)
+{
+	if (len < 8) return false;
+
+	return (memcmp(data, DETAIL_BINARY_MAGIC, 8) == 0);
+}
+
+/** Get the latest valid checkpoint from the file header
+ *
+ * @param[in] header of the file.
+ * @param[out] sequence of the checkpoint.  0 if there are none.
+ * @return the offset of the first record which isn't done, or 0 if there
+ *	are no valid checkpoints.
+ */
+off_t detail_binary_checkpoint(uint8_t const header[DETAIL_BINARY_HEADER_LEN], uint32_t *sequence)
+{
+	int	i;
+	off_t	offset = 0;
+
+	*sequence = 0;
+
+	for (i = 0; i < 2; i++) {
+		uint8_t const	*p = header + CHECKPOINT_OFFSET + (i * CHECKPOINT_LEN);
+		uint32_t	my_sequence;
+		uint64_t	my_offset;
+
+		if (fr_hash(p, 12) != get_uint32(p + 12)) continue;
+
+		my_sequence = get_uint32(p + 8);
+		if (!my_sequence || (my_sequence < *sequence)) continue;
+
+		my_offset = ((uint64_t) get_uint32(p) << 32) | get_uint32(p + 4);
+		if (my_offset < DETAIL_BINARY_HEADER_LEN) continue;
+
+		*sequence = my_sequence;
+		offset = my_offset;
+	}
+
+	return offset;
+}
+
+/** Save the reader's progress through a binary detail file
+ *
+ * The checkpoints are used in turn, depending on the sequence number.
+ * If we crash part way through writing one, the other is still valid.
+ *
+ * @param[in] fd of the file.
+ * @param[in] offset of the first record which isn't done.
+ * @param[in] sequence of the checkpoint.  Must be more than the last one.
+ * @return 0 on success, -1 on error.
+ */
+int detail_binary_checkpoint_write(int fd, off_t offset, uint32_t sequence)
+{
+	uint8_t checkpoint[CHECKPOINT_LEN];
+
+	put_uint32(checkpoint, ((uint64_t) offset) >> 32);
+	put_uint32(checkpoint + 4, ((uint64_t) offset) & 0xffffffff);
+	put_uint32(checkpoint + 8, sequence);
+	put_uint32(checkpoint + 12, fr_hash(checkpoint, 12));
+
+	if (pwrite(fd, checkpoint, sizeof(checkpoint),
+		   CHECKPOINT_OFFSET + ((sequence & 0x01) * CHECKPOINT_LEN)) < (ssize_t) sizeof(checkpoint)) {
+		fr_strerror_printf("Failed writing checkpoint: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Encode a packet as a record for a binary detail file
+ *
+ * Attributes which can't be put into a RADIUS packet (i.e. internal
+ * attributes) aren't written.
+ *
+ * @param[in] ctx to allocate the record in.
+ * @param[out] out the record.
+ * @param[in] packet to take the code, ID, authentication vector, and
+ *	addresses from.
+ * @param[in] vps to encode.
+ * @param[in] addresses whether to write the source and destination of the packet.
+ * @param[in] timestamp when the packet was received.
+ * @return the length of the record, or -1 on error.
+ */
+ssize_t detail_binary_encode(TALLOC_CTX *ctx, uint8_t **out, RADIUS_PACKET const *packet, VALUE_PAIR *vps,
+			     bool addresses, time_t timestamp)
+{
+	RADIUS_PACKET	*encoded;
+	uint8_t		*record, *p;
+	size_t		len;
+
+	if (!packet->code || (packet->code >= FR_MAX_PACKET_CODE)) {
+		fr_strerror_printf("Cannot write packet with code %u", packet->code);
+		return -1;
+	}
+
+	encoded = rad_alloc(ctx, false);
+	if (!encoded) {
+		fr_strerror_printf("Out of memory");
+		return -1;
+	}
+
+	encoded->code = packet->code;
+	encoded->id = packet->id;
+	memcpy(encoded->vector, packet->vector, sizeof(encoded->vector));
+	encoded->vps = vps;
+
+	/*
+	 *	Replies are encoded as if they're the reply to
+	 *	themselves, so that rad_decode() can use the same
+	 *	vector to decrypt attributes.
+	 */
+	if (rad_encode(encoded, encoded, DETAIL_BINARY_SECRET) < 0) {
+		encoded->vps = NULL;
+		talloc_free(encoded);
+		return -1;
+	}
+	encoded->vps = NULL;
+
+	len = DETAIL_BINARY_ADDRESS_LEN + encoded->data_len;
+
+	record = talloc_zero_array(ctx, uint8_t, DETAIL_BINARY_RECORD_LEN + len);
+	if (!record) {
+		talloc_free(encoded);
+		fr_strerror_printf("Out of memory");
+		return -1;
+	}
+
+	put_uint32(record, DETAIL_BINARY_RECORD_MAGIC);
+	put_uint16(record + 4, len);
+	record[6] = DETAIL_BINARY_PACKET;
+	put_uint32(record + 8, timestamp);
+
+	p = record + DETAIL_BINARY_RECORD_LEN;
+	if (addresses) {
+		detail_binary_put_ipaddr(p, p + 8, &packet->src_ipaddr);
+		detail_binary_put_ipaddr(p + 1, p + 24, &packet->dst_ipaddr);
+		put_uint16(p + 4, packet->src_port);
+		put_uint16(p + 6, packet->dst_port);
+	}
+	memcpy(p + DETAIL_BINARY_ADDRESS_LEN, encoded->data, encoded->data_len);
+	talloc_free(encoded);
+
+	put_uint32(record + 12, detail_binary_hash(record, len));
+
+	*out = record;
+	return DETAIL_BINARY_RECORD_LEN + len;
+}
+
+/** Check that there's a valid record at the start of the data
+ *
+ * @param[in] data which may contain a record.
+ * @param[in] len of the data.
+ * @return
+ *	- The length of the record.
+ *	- 0 if there's the start of a record, but not all of it.
+ *	- -1 if the data doesn't start with a record.
+ */
+ssize_t detail_binary_check(uint8_t const *data, size_t len)
+{
+	size_t record_len;
+
+	if (len < 4) return 0;
+
+	if (get_uint32(data) != DETAIL_BINARY_RECORD_MAGIC) return -1;
+
+	if (len < DETAIL_BINARY_RECORD_LEN) return 0;
+
+	record_len = DETAIL_BINARY_RECORD_LEN + get_uint16(data + 4);
+	if (record_len > DETAIL_BINARY_MAX_LEN) return -1;
+
+	if (len < record_len) return 0;
+
+	if (detail_binary_hash(data, record_len - DETAIL_BINARY_RECORD_LEN) != get_uint32(data + 12)) return -1;
+
+	return record_len;
+}
+
+/** Decode a record from a binary detail file
+ *
+ * The record must have been checked with detail_binary_check().
+ *
+ * @param[in] ctx to allocate the packet in.
+ * @param[in] record to decode.
+ * @param[out] done whether the reader has marked the record as done.
+ * @return a packet with the attributes, addresses, and the time the
+ *	record was written, or NULL on error.
+ */
+RADIUS_PACKET *detail_binary_decode(TALLOC_CTX *ctx, uint8_t const *record, bool *done)
+{
+	RADIUS_PACKET	*packet;
+	uint8_t const	*p = record + DETAIL_BINARY_RECORD_LEN;
+	size_t		len = get_uint16(record + 4);
+	decode_fail_t	reason;
+
+	if (record[6] != DETAIL_BINARY_PACKET) {
+		fr_strerror_printf("Unknown record type %u", record[6]);
+		return NULL;
+	}
+
+	if (len < (DETAIL_BINARY_ADDRESS_LEN + 20)) {	/* RADIUS_HDR_LEN */
+		fr_strerror_printf("Record is too short to contain a packet");
+		return NULL;
+	}
+
+	packet = rad_alloc(ctx, false);
+	if (!packet) {
+		fr_strerror_printf("Out of memory");
+		return NULL;
+	}
+
+	*done = ((record[DETAIL_BINARY_FLAGS_OFFSET] & DETAIL_BINARY_DONE) != 0);
+	packet->timestamp.tv_sec = get_uint32(record + 8);
+
+	detail_binary_get_ipaddr(&packet->src_ipaddr, p[0], p + 8);
+	detail_binary_get_ipaddr(&packet->dst_ipaddr, p[1], p + 24);
+	packet->src_port = get_uint16(p + 4);
+	packet->dst_port = get_uint16(p + 6);
+
+	/*
+	 *	Decode the packet where it is.  rad_decode() only
+	 *	reads the data.
+	 */
+	memcpy(&packet->data, &p, sizeof(packet->data));
+	packet->data += DETAIL_BINARY_ADDRESS_LEN;
+	packet->data_len = len - DETAIL_BINARY_ADDRESS_LEN;
+
+	if (!rad_packet_ok(packet, 0, &reason)) goto error;
+
+	packet->code = packet->data[0];
+	packet->id = packet->data[1];
+	memcpy(packet->vector, packet->data + 4, sizeof(packet->vector));
+
+	if (rad_decode(packet, packet, DETAIL_BINARY_SECRET) < 0) {
+	error:
+		packet->data = NULL;
+		talloc_free(packet);
+		return NULL;
+	}
+
+	packet->data = NULL;
+	packet->data_len = 0;
+
+	return packet;
+}
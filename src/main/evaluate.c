@@ -173,13 +173,23 @@ static int cond_do_regex(REQUEST *request, fr_cond_t const *c,
 	switch (map->rhs->type) {
 	case TMPL_TYPE_REGEX_STRUCT: /* pre-compiled to a regex */
 		preg = map->rhs->tmpl_preg;
+
+		/*
+		 *	The prefilter for the if / elsif chain says the
+		 *	pattern can't match.
+		 */
+		if (!regex_prefilter_match(request, c->prefilter, c->prefilter_literal, lhs->strvalue, lhs_len)) {
+			EVAL_DEBUG("PREFILTER NO MATCH");
+			regex_sub_to_request(request, NULL, NULL, 0, NULL, 0);	/* clear out old entries */
+			return 0;
+		}
 		break;
 
 	default:
 		rad_assert(rhs_type == PW_TYPE_STRING);
 		rad_assert(rhs->strvalue);
-		slen = regex_compile(request, &rreg, rhs->strvalue, rhs_len,
-				     map->rhs->tmpl_iflag, map->rhs->tmpl_mflag, true, true);
+		slen = regex_cache_compile(&rreg, rhs->strvalue, rhs_len,
+					   map->rhs->tmpl_iflag, map->rhs->tmpl_mflag);
 		if (slen <= 0) {
 			REMARKER(rhs->strvalue, -slen, fr_strerror());
 			EVAL_DEBUG("FAIL %d", __LINE__);
@@ -211,7 +221,7 @@ static int cond_do_regex(REQUEST *request, fr_cond_t const *c,
 		break;
 	}
 
-	if (preg) talloc_free(rreg);
+	regex_cache_release(rreg);
 
 	return ret;
 }
@@ -829,7 +839,13 @@ void radius_pairmove(REQUEST *request, VALUE_PAIR **to, VALUE_PAIR *from, bool d
 	 *	function was called, and the *all* attributes of that
 	 *	number were deleted.  With this implementation, only
 	 *	the matching attributes are deleted.
+	 *
+	 *	The lists are broken up by hand, so the index of
+	 *	the "from" list has to go.  The "to" list is
+	 *	rebuilt from copies, which aren't indexed.
 	 */
+	fr_pair_list_unindex(from);
+
 	count = 0;
 	for (vp = fr_cursor_init(&cursor, &from); vp; vp = fr_cursor_next(&cursor)) count++;
 	from_list = talloc_array(request, VALUE_PAIR *, count);
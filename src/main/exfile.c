@@ -36,6 +36,17 @@ typedef struct exfile_entry_t {
 	dev_t		st_dev;		//!< device inode
 	ino_t		st_ino;		//!< inode number
 	char		*filename;	//!< Filename.
+	mode_t		permissions;	//!< To use when (re-)opening the file.
+
+	uint32_t	in_use;		//!< Number of threads using, or waiting to use the entry.
+					//!< Protected by the exfile_t mutex.
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_t	mutex;		//!< Held from exfile_open() until exfile_close().
+#endif
+
+	uint8_t		*buffer;	//!< Data waiting to be appended to the file.
+	size_t		used;		//!< How much of the buffer is in use.
+	time_t		buffered;	//!< When the oldest data in the buffer was added.
 } exfile_entry_t;
 
 
@@ -45,15 +56,28 @@ struct exfile_t {
 	time_t		last_cleaned;
 
 #ifdef HAVE_PTHREAD_H
-	pthread_mutex_t mutex;
+	pthread_mutex_t mutex;		//!< Protects the table of entries.  It's not held
+					//!< while files are being written.
 #endif
 	exfile_entry_t *entries;
+	fr_hash_table_t	*ht;		//!< Entries which have a filename, indexed by filename.
 	bool		locking;
+
+	size_t		buffer_size;	//!< Size of the append buffer for each file, 0 for none.
+	uint32_t	flush_interval;	//!< Maximum time data is buffered for.
+	bool		sync;		//!< fsync() files after flushing their buffer.
+
+#ifdef HAVE_PTHREAD_H
+	bool		flushing;	//!< Whether the flush thread is running.
+	pthread_t	flusher;	//!< Writes buffers when the server is idle.
+	pthread_cond_t	cond;		//!< Wakes the flush thread up when we're done.
+#endif
 };
 
 
 #ifdef HAVE_PTHREAD_H
 #define PTHREAD_MUTEX_LOCK pthread_mutex_lock
+#define PTHREAD_MUTEX_TRYLOCK pthread_mutex_trylock
 #define PTHREAD_MUTEX_UNLOCK pthread_mutex_unlock
 
 #else
@@ -61,30 +85,83 @@ struct exfile_t {
  *	This is easier than ifdef's throughout the code.
  */
 #define PTHREAD_MUTEX_LOCK(_x)
+#define PTHREAD_MUTEX_TRYLOCK(_x) (0)
 #define PTHREAD_MUTEX_UNLOCK(_x)
 #endif
 
 #define MAX_TRY_LOCK 4			//!< How many times we attempt to acquire a lock
 					//!< before giving up.
 
+/*
+ *	The entry which this thread last opened, so that exfile_write()
+ *	and exfile_close() don't have to search for it.  It may belong
+ *	to a different exfile_t, which may have been freed.
+ */
+fr_thread_local_setup(exfile_entry_t *, exfile_last)	/* macro */
+
+static void _exfile_last_free(UNUSED void *arg)
+{
+}
+
+static uint32_t exfile_entry_hash(void const *data)
+{
+	exfile_entry_t const *entry = data;
+
+	return entry->hash;
+}
+
+static int exfile_entry_cmp(void const *one, void const *two)
+{
+	exfile_entry_t const *a = one, *b = two;
+
+	if (a->hash < b->hash) return -1;
+	if (a->hash > b->hash) return +1;
+
+	/*
+	 *	We still need to do string comparisons if the hash
+	 *	matches, because 1/2^16 filenames will result in a
+	 *	hash collision.  And that's enough filenames in a
+	 *	long-running server to ensure that it happens.
+	 */
+	return strcmp(a->filename, b->filename);
+}
+
+static void exfile_cleanup_entry(exfile_t *ef, exfile_entry_t *entry, bool force);
+
 static int _exfile_free(exfile_t *ef)
 {
 	uint32_t i;
 
 	PTHREAD_MUTEX_LOCK(&ef->mutex);
 
+#ifdef HAVE_PTHREAD_H
+	if (ef->flushing) {
+		ef->flushing = false;
+		pthread_cond_signal(&ef->cond);
+		PTHREAD_MUTEX_UNLOCK(&ef->mutex);
+
+		pthread_join(ef->flusher, NULL);
+		pthread_cond_destroy(&ef->cond);
+
+		PTHREAD_MUTEX_LOCK(&ef->mutex);
+	}
+#endif
+
 	for (i = 0; i < ef->max_entries; i++) {
 		if (!ef->entries[i].filename) continue;
 
-		close(ef->entries[i].fd);
+		exfile_cleanup_entry(ef, &ef->entries[i], true);
 	}
 
 	PTHREAD_MUTEX_UNLOCK(&ef->mutex);
 
 #ifdef HAVE_PTHREAD_H
+	for (i = 0; i < ef->max_entries; i++) pthread_mutex_destroy(&ef->entries[i].mutex);
 	pthread_mutex_destroy(&ef->mutex);
 #endif
 
+	fr_hash_table_free(ef->ht);
+
 	return 0;
 }
 
@@ -100,6 +177,7 @@ static int _exfile_free(exfile_t *ef)
 exfile_t *exfile_init(TALLOC_CTX *ctx, uint32_t max_entries, uint32_t max_idle, bool locking)
 {
 	exfile_t *ef;
+	uint32_t i;
 
 	ef = talloc_zero(ctx, exfile_t);
 	if (!ef) return NULL;
@@ -108,24 +186,31 @@ exfile_t *exfile_init(TALLOC_CTX *ctx, uint32_t max_entries, uint32_t max_idle,
 	ef->max_idle = max_idle;
 	ef->locking = locking;
 
-	/*
-	 *	If we're not locking the files, just return the
-	 *	handle.  Each call to exfile_open() will just open a
-	 *	new file descriptor.
-	 */
-	if (!locking) return ef;
-
 	ef->entries = talloc_zero_array(ef, exfile_entry_t, max_entries);
 	if (!ef->entries) {
 		talloc_free(ef);
 		return NULL;
 	}
 
+	ef->ht = fr_hash_table_create(exfile_entry_hash, exfile_entry_cmp, NULL);
+	if (!ef->ht) {
+		talloc_free(ef);
+		return NULL;
+	}
+
 #ifdef HAVE_PTHREAD_H
 	if (pthread_mutex_init(&ef->mutex, NULL) != 0) {
+		fr_hash_table_free(ef->ht);
 		talloc_free(ef);
 		return NULL;
 	}
+
+	for (i = 0; i < max_entries; i++) {
+		ef->entries[i].fd = -1;
+		pthread_mutex_init(&ef->entries[i].mutex, NULL);
+	}
+#else
+	for (i = 0; i < max_entries; i++) ef->entries[i].fd = -1;
 #endif
 
 	talloc_set_destructor(ef, _exfile_free);
@@ -133,14 +218,73 @@ exfile_t *exfile_init(TALLOC_CTX *ctx, uint32_t max_entries, uint32_t max_idle,
 	return ef;
 }
 
+static void exfile_flush_stale(exfile_t *ef, time_t now);
+
+#ifdef HAVE_PTHREAD_H
+/*
+ *	Write buffers which have been waiting too long, even if
+ *	nothing is being logged.
+ */
+static void *exfile_flusher(void *arg)
+{
+	exfile_t	*ef = arg;
+	struct timespec	when;
+
+	PTHREAD_MUTEX_LOCK(&ef->mutex);
+
+	while (ef->flushing) {
+		when.tv_sec = time(NULL) + (ef->flush_interval ? ef->flush_interval : 1);
+		when.tv_nsec = 0;
+
+		(void) pthread_cond_timedwait(&ef->cond, &ef->mutex, &when);
+		if (!ef->flushing) break;
+
+		exfile_flush_stale(ef, time(NULL));
+	}
+
+	PTHREAD_MUTEX_UNLOCK(&ef->mutex);
+
+	return NULL;
+}
+#endif
 
-static void exfile_cleanup_entry(exfile_entry_t *entry)
+/** Buffer data written with exfile_write(), instead of writing it immediately
+ *
+ * Each file gets its own buffer.  The buffer is written to the file when
+ * it fills up, or when data has been buffered for more than flush_interval
+ * seconds.  Buffers are also written when the exfile_t is freed.
+ *
+ * @param ef The logfile context returned from exfile_init().
+ * @param size of each file's buffer.  0 disables buffering.
+ * @param flush_interval Maximum time data may be buffered for.  0 means
+ *	the buffer is written every time the file is closed.
+ * @param sync Whether to fsync() the file after writing the buffer.
+ * @return 0 on success, -1 on error.
+ */
+int exfile_enable_buffer(exfile_t *ef, size_t size, uint32_t flush_interval, bool sync)
 {
-	TALLOC_FREE(entry->filename);
+	ef->buffer_size = size;
+	ef->flush_interval = flush_interval;
+	ef->sync = sync;
 
-	if (entry->fd >= 0) close(entry->fd);
-	entry->hash = 0;
-	entry->fd = -1;
+#ifdef HAVE_PTHREAD_H
+	if (!size || ef->flushing) return 0;
+
+	if (pthread_cond_init(&ef->cond, NULL) != 0) {
+		fr_strerror_printf("Failed initializing condition: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	ef->flushing = true;
+	if (pthread_create(&ef->flusher, NULL, exfile_flusher, ef) != 0) {
+		ef->flushing = false;
+		pthread_cond_destroy(&ef->cond);
+		fr_strerror_printf("Failed creating flush thread: %s", fr_syserror(errno));
+		return -1;
+	}
+#endif
+
+	return 0;
 }
 
 
@@ -148,7 +292,7 @@ static void exfile_cleanup_entry(exfile_entry_t *entry)
  *	Try to open the file. If it doesn't exist, try to
  *	create it's parent directories.
  */
-static int exfile_open_mkdir(exfile_t *ef, char const *filename, mode_t permissions)
+static int exfile_open_mkdir(char const *filename, mode_t permissions)
 {
 	int fd;
 
@@ -159,14 +303,16 @@ static int exfile_open_mkdir(exfile_t *ef, char const *filename, mode_t permissi
 
 		/*
 		 *	Maybe the directory doesn't exist.  Try to
-		 *	create it.
+		 *	create it.  Other threads may be allocating
+		 *	from the exfile_t, so don't use it as the
+		 *	talloc context.
 		 */
-		dir = talloc_strdup(ef, filename);
+		dir = strdup(filename);
 		if (!dir) return -1;
 		p = strrchr(dir, FR_DIR_SEP);
 		if (!p) {
 			fr_strerror_printf("No '/' in '%s'", filename);
-			talloc_free(dir);
+			free(dir);
 			return -1;
 		}
 		*p = '\0';
@@ -183,10 +329,10 @@ static int exfile_open_mkdir(exfile_t *ef, char const *filename, mode_t permissi
 		if (rad_mkdir(dir, dirperm, -1, -1) < 0) {
 			fr_strerror_printf("Failed to create directory %s: %s",
 					   dir, strerror(errno));
-			talloc_free(dir);
+			free(dir);
 			return -1;
 		}
-		talloc_free(dir);
+		free(dir);
 
 		fd = open(filename, O_RDWR | O_CREAT, permissions);
 		if (fd < 0) {
@@ -200,171 +346,53 @@ static int exfile_open_mkdir(exfile_t *ef, char const *filename, mode_t permissi
 }
 
 
-/** Open a new log file, or maybe an existing one.
+/** Open and lock the file for an entry
  *
- * When multithreaded, the FD is locked via a mutex.  This way we're
- * sure that no other thread is writing to the file.
+ * The caller must hold the entry's mutex, or be the only thread which
+ * can use the entry.
  *
  * @param ef The logfile context returned from exfile_init().
- * @param filename the file to open.
- * @param permissions to use.
- * @return an FD used to write to the file, or -1 on error.
+ * @param entry to open and lock.
+ * @return 0 on success, -1 on error.
  */
-int exfile_open(exfile_t *ef, char const *filename, mode_t permissions)
+static int exfile_lock_entry(exfile_t *ef, exfile_entry_t *entry)
 {
-	int i, found, tries, unused, oldest;
-	uint32_t hash;
-	time_t now;
+	int tries;
 	struct stat st;
 
-	if (!ef || !filename) return -1;
-
 	/*
-	 *	No locking: just return a new FD.
+	 *	Stat the *filename*, not the file we opened.
+	 *	If that's not the file we opened, or the file has
+	 *	been moved, then re-open the file.
 	 */
-	if (!ef->locking) {
-		found = exfile_open_mkdir(ef, filename, permissions);
-		if (found < 0) return -1;
-
-		(void) lseek(found, 0, SEEK_END);
-		return found;
+	if ((entry->fd >= 0) &&
+	    ((stat(entry->filename, &st) < 0) ||
+	     (st.st_dev != entry->st_dev) ||
+	     (st.st_ino != entry->st_ino))) {
+		close(entry->fd);
+		entry->fd = -1;
 	}
 
-	/*
-	 *	It's faster to do hash comparisons of a string than
-	 *	full string comparisons.
-	 */
-	hash = fr_hash_string(filename);
-	now = time(NULL);
+reopen:
+	if (entry->fd < 0) {
+		entry->fd = exfile_open_mkdir(entry->filename, entry->permissions);
+		if (entry->fd < 0) return -1;
 
-	PTHREAD_MUTEX_LOCK(&ef->mutex);
-
-	/*
-	 *	Clean up idle entries.
-	 */
-	if (now > (ef->last_cleaned + 1)) {
-		ef->last_cleaned = now;
-
-		for (i = 0; i < (int) ef->max_entries; i++) {
-			if (!ef->entries[i].filename) continue;
-
-			if ((ef->entries[i].last_used + ef->max_idle) >= now) continue;
-
-			/*
-			 *	This will block forever if a thread is
-			 *	doing something stupid.
-			 */
-			exfile_cleanup_entry(&ef->entries[i]);
-		}
-	}
-
-	/*
-	 *	Find the matching entry, or an unused one.
-	 *
-	 *	Also track which entry is the oldest, in case there
-	 *	are no unused entries.
-	 */
-	found = oldest = unused = -1;
-	for (i = 0; i < (int) ef->max_entries; i++) {
-		if (!ef->entries[i].filename) {
-			if (unused < 0) unused = i;
-			continue;
-		}
-
-		if ((oldest < 0) ||
-		    (ef->entries[i].last_used < ef->entries[oldest].last_used)) {
-			oldest = i;
-		}
-
-		/*
-		 *	Hash comparisons are fast.  String comparisons are slow.
-		 */
-		if (ef->entries[i].hash != hash) continue;
-
-		/*
-		 *	But we still need to do string comparisons if
-		 *	the hash matches, because 1/2^16 filenames
-		 *	will result in a hash collision.  And that's
-		 *	enough filenames in a long-running server to
-		 *	ensure that it happens.
-		 */
-		if (strcmp(ef->entries[i].filename, filename) != 0) continue;
-
-		found = i;
-		break;
-	}
-
-	/*
-	 *	If it wasn't found, create a new entry.
-	 */
-	if (found < 0) {
-		/*
-		 *	There are no unused entries.  Clean up the
-		 *	oldest one.
-		 */
-		if (unused < 0) {
-			exfile_cleanup_entry(&ef->entries[oldest]);
-			unused = oldest;
-		}
-
-		/*
-		 *	Create a new entry.
-		 */
-		i = unused;
-
-		ef->entries[i].hash = hash;
-		ef->entries[i].filename = talloc_strdup(ef->entries, filename);
-		ef->entries[i].fd = -1;
-
-		/*
-		 *	We've just created the entry.  Open the file
-		 *	and cache the FD.
-		 */
-	reopen:
-		ef->entries[i].fd = exfile_open_mkdir(ef, filename, permissions);
-		if (ef->entries[i].fd < 0) {
-		error:
-			exfile_cleanup_entry(&ef->entries[i]);
-			PTHREAD_MUTEX_UNLOCK(&(ef->mutex));
-			return -1;
+		if (fstat(entry->fd, &st) < 0) {
+			fr_strerror_printf("Failed to stat file %s: %s", entry->filename, strerror(errno));
+			goto error;
 		}
 
-		if (fstat(ef->entries[i].fd, &st) < 0) goto error;
-
 		/*
 		 *	Remember which device and inode this file is
 		 *	for.
 		 */
-		ef->entries[i].st_dev = st.st_dev;
-		ef->entries[i].st_ino = st.st_ino;
-
-	} else {
-		i = found;
-
-		/*
-		 *	Stat the *filename*, not the file we opened.
-		 *	If that's not the file we opened, then go back
-		 *	and re-open the file.
-		 */
-		if (stat(ef->entries[i].filename, &st) == 0) {
-			if ((st.st_dev != ef->entries[i].st_dev) ||
-			    (st.st_ino != ef->entries[i].st_ino)) {
-				/*
-				 *	No longer the same file; reopen.
-				 */
-				close(ef->entries[i].fd);
-				goto reopen;
-			}
-		} else {
-			/*
-			 *	Error calling stat, likely the
-			 *	file has been moved. Reopen it.
-			 */
-			close(ef->entries[i].fd);
-			goto reopen;
-		}
+		entry->st_dev = st.st_dev;
+		entry->st_ino = st.st_ino;
 	}
 
+	if (!ef->locking) goto done;
+
 	/*
 	 *	Try to lock it.  If we can't lock it, it's because
 	 *	some reader has re-named the file to "foo.work" and
@@ -378,8 +406,8 @@ int exfile_open(exfile_t *ef, char const *filename, mode_t permissions)
 	 *	exist, and to be consistent across all threads
 	 *	and processes.
 	 */
-	if (lseek(ef->entries[i].fd, 0, SEEK_SET) < 0) {
-		fr_strerror_printf("Failed to seek in file %s: %s", filename, strerror(errno));
+	if (lseek(entry->fd, 0, SEEK_SET) < 0) {
+		fr_strerror_printf("Failed to seek in file %s: %s", entry->filename, strerror(errno));
 		goto error;
 	}
 
@@ -387,10 +415,10 @@ int exfile_open(exfile_t *ef, char const *filename, mode_t permissions)
 	 *	Busy-loop trying to lock the file.
 	 */
 	for (tries = 0; tries < MAX_TRY_LOCK; tries++) {
-		if (rad_lockfd_nonblock(ef->entries[i].fd, 0) >= 0) break;
+		if (rad_lockfd_nonblock(entry->fd, 0) >= 0) break;
 
 		if (errno != EAGAIN) {
-			fr_strerror_printf("Failed to lock file %s: %s", filename, strerror(errno));
+			fr_strerror_printf("Failed to lock file %s: %s", entry->filename, strerror(errno));
 			goto error;
 		}
 
@@ -399,25 +427,25 @@ int exfile_open(exfile_t *ef, char const *filename, mode_t permissions)
 		 *	have been deleted.  If it was deleted,
 		 *	then the new file should now be unlocked.
 		 */
-		close(ef->entries[i].fd);
-		ef->entries[i].fd = open(filename, O_RDWR | O_CREAT, permissions);
-		if (ef->entries[i].fd < 0) {
+		close(entry->fd);
+		entry->fd = open(entry->filename, O_RDWR | O_CREAT, entry->permissions);
+		if (entry->fd < 0) {
 			fr_strerror_printf("Failed to open file %s: %s",
-					   filename, strerror(errno));
+					   entry->filename, strerror(errno));
 			goto error;
 		}
 	}
 
 	if (tries >= MAX_TRY_LOCK) {
-		fr_strerror_printf("Failed to lock file %s: too many tries", filename);
+		fr_strerror_printf("Failed to lock file %s: too many tries", entry->filename);
 		goto error;
 	}
 
 	/*
 	 *	See which file it really is.
 	 */
-	if (fstat(ef->entries[i].fd, &st) < 0) {
-		fr_strerror_printf("Failed to stat file %s: %s", filename, strerror(errno));
+	if (fstat(entry->fd, &st) < 0) {
+		fr_strerror_printf("Failed to stat file %s: %s", entry->filename, strerror(errno));
 		goto error;
 	}
 
@@ -427,9 +455,10 @@ int exfile_open(exfile_t *ef, char const *filename, mode_t permissions)
 	 *	so, close the file and re-open it from scratch.
 	 */
 	if ((st.st_nlink == 0) ||
-	    (st.st_dev != ef->entries[i].st_dev) ||
-	    (st.st_ino != ef->entries[i].st_ino)) {
-		close(ef->entries[i].fd);
+	    (st.st_dev != entry->st_dev) ||
+	    (st.st_ino != entry->st_ino)) {
+		close(entry->fd);
+		entry->fd = -1;
 		goto reopen;
 	}
 
@@ -437,41 +466,466 @@ int exfile_open(exfile_t *ef, char const *filename, mode_t permissions)
 	 *	Sometimes the file permissions are changed externally.
 	 *	just be sure to update the permission if necessary.
 	 */
-	if ((st.st_mode & ~S_IFMT) != permissions) {
+	if ((st.st_mode & ~S_IFMT) != entry->permissions) {
 		char str_need[10], oct_need[5];
 		char str_have[10], oct_have[5];
 
-		rad_mode_to_oct(oct_need, permissions);
-		rad_mode_to_str(str_need, permissions);
+		rad_mode_to_oct(oct_need, entry->permissions);
+		rad_mode_to_str(str_need, entry->permissions);
 
 		rad_mode_to_oct(oct_have, st.st_mode & ~S_IFMT);
 		rad_mode_to_str(str_have, st.st_mode & ~S_IFMT);
 
-		WARN("File %s permissions are %s (%s) not %s (%s))", filename,
+		WARN("File %s permissions are %s (%s) not %s (%s))", entry->filename,
 		     oct_have, str_have, oct_need, str_need);
 
-		if (((st.st_mode | permissions) != st.st_mode) &&
-		    (fchmod(ef->entries[i].fd, (st.st_mode & ~S_IFMT) | permissions) < 0)) {
-			rad_mode_to_oct(oct_need, (st.st_mode & ~S_IFMT) | permissions);
-			rad_mode_to_str(str_need, (st.st_mode & ~S_IFMT) | permissions);
-			
+		if (((st.st_mode | entry->permissions) != st.st_mode) &&
+		    (fchmod(entry->fd, (st.st_mode & ~S_IFMT) | entry->permissions) < 0)) {
+			rad_mode_to_oct(oct_need, (st.st_mode & ~S_IFMT) | entry->permissions);
+			rad_mode_to_str(str_need, (st.st_mode & ~S_IFMT) | entry->permissions);
+
 			WARN("Failed resetting file %s permissions to %s (%s): %s",
-			     filename, oct_need, str_need, fr_syserror(errno));
+			     entry->filename, oct_need, str_need, fr_syserror(errno));
 		}
 	}
 
+done:
 	/*
 	 *	If we're appending, seek to the end of the file before
 	 *	returning the FD to the caller.
 	 */
-	(void) lseek(ef->entries[i].fd, 0, SEEK_END);
+	(void) lseek(entry->fd, 0, SEEK_END);
+
+	return 0;
+
+error:
+	if (entry->fd >= 0) close(entry->fd);
+	entry->fd = -1;
+
+	return -1;
+}
+
+/*
+ *	Unlock the bytes that we had previously locked.
+ */
+static void exfile_unlock_entry(exfile_t *ef, exfile_entry_t *entry)
+{
+	if (!ef->locking) return;
+
+	(void) lseek(entry->fd, 0, SEEK_SET);
+	(void) rad_unlockfd(entry->fd, 0);
+}
+
+/*
+ *	Write all of the data, even if the kernel takes it in pieces.
+ */
+static ssize_t exfile_write_all(int fd, void const *data, size_t len)
+{
+	uint8_t const	*p = data, *end = p + len;
+	ssize_t		slen;
+
+	while (p < end) {
+		slen = write(fd, p, end - p);
+		if (slen < 0) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		p += slen;
+	}
+
+	return len;
+}
+
+/** Write everything in an entry's buffer to its file
+ *
+ * The caller must hold the entry's mutex (or be the only thread which
+ * can use the entry), and the file lock.  On error the buffered data
+ * is discarded.
+ */
+static int exfile_flush(exfile_t *ef, exfile_entry_t *entry)
+{
+	size_t used = entry->used;
+
+	if (!used) return 0;
+
+	entry->used = 0;
+
+	(void) lseek(entry->fd, 0, SEEK_END);
+	if (exfile_write_all(entry->fd, entry->buffer, used) < 0) {
+		fr_strerror_printf("Failed writing %zu buffered bytes to %s: %s",
+				   used, entry->filename, strerror(errno));
+		return -1;
+	}
+
+	if (ef->sync && (fsync(entry->fd) < 0)) {
+		fr_strerror_printf("Failed syncing %s: %s", entry->filename, strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Write the buffer of an entry which no thread is using
+ *
+ * The file may have been moved away (e.g. by a detail file reader), in
+ * which case the data is written to the file which now has the name.
+ */
+static int exfile_flush_unused(exfile_t *ef, exfile_entry_t *entry)
+{
+	int rcode;
+
+	if (!entry->used) return 0;
+
+	if (exfile_lock_entry(ef, entry) < 0) return -1;
+
+	rcode = exfile_flush(ef, entry);
+	exfile_unlock_entry(ef, entry);
+
+	return rcode;
+}
+
+/** Close the file for an entry, and free the entry
+ *
+ * The caller must hold the exfile_t mutex, and no thread may be using
+ * the entry.
+ *
+ * @param ef The logfile context returned from exfile_init().
+ * @param entry to clean up.
+ * @param force clean up the entry even if its buffer can't be written.
+ */
+static void exfile_cleanup_entry(exfile_t *ef, exfile_entry_t *entry, bool force)
+{
+	if (entry->used && (exfile_flush_unused(ef, entry) < 0)) {
+		if (!force) return;
+
+		ERROR("%s", fr_strerror());
+		entry->used = 0;
+	}
+
+	fr_hash_table_yank(ef->ht, entry);
+	TALLOC_FREE(entry->filename);
+
+	if (entry->fd >= 0) close(entry->fd);
+	entry->hash = 0;
+	entry->fd = -1;
+}
+
+/*
+ *	Write buffers which have been waiting too long, and the
+ *	buffers of idle entries, so that they can be closed.  Entries
+ *	which are in use will have their buffers written when they're
+ *	closed.
+ *
+ *	Called with the exfile_t mutex held.  It's released while each
+ *	buffer is written, so other threads can open files.
+ */
+static void exfile_flush_stale(exfile_t *ef, time_t now)
+{
+	uint32_t i;
+
+	for (i = 0; i < ef->max_entries; i++) {
+		exfile_entry_t *entry = &ef->entries[i];
+
+		if (!entry->used || entry->in_use) continue;
+
+		if (((entry->buffered + ef->flush_interval) > now) &&
+		    ((entry->last_used + ef->max_idle) >= now)) continue;
+
+		/*
+		 *	Stop the entry from being cleaned up while we
+		 *	write it.  If another thread has opened it in
+		 *	the mean time, leave the buffer for that thread
+		 *	to write, as it may be waiting for a file we
+		 *	have open.
+		 */
+		entry->in_use++;
+		PTHREAD_MUTEX_UNLOCK(&ef->mutex);
+
+		if (PTHREAD_MUTEX_TRYLOCK(&entry->mutex) == 0) {
+			if (exfile_flush_unused(ef, entry) < 0) ERROR("%s", fr_strerror());
+			PTHREAD_MUTEX_UNLOCK(&entry->mutex);
+		}
+
+		PTHREAD_MUTEX_LOCK(&ef->mutex);
+		entry->in_use--;
+	}
+}
+
+/*
+ *	Close idle entries.  Called with the exfile_t mutex held.
+ *	Entries with data which couldn't be written are left open,
+ *	and we try again later.
+ */
+static void exfile_cleanup(exfile_t *ef, time_t now)
+{
+	uint32_t i;
+
+	exfile_flush_stale(ef, now);
+
+	for (i = 0; i < ef->max_entries; i++) {
+		exfile_entry_t *entry = &ef->entries[i];
+
+		if (!entry->filename || entry->in_use || entry->used) continue;
+
+		if ((entry->last_used + ef->max_idle) < now) exfile_cleanup_entry(ef, entry, false);
+	}
+}
+
+/*
+ *	Find an unused entry for a file.  Called with the exfile_t
+ *	mutex held.
+ */
+static exfile_entry_t *exfile_entry_alloc(exfile_t *ef, char const *filename, uint32_t hash)
+{
+	uint32_t	i;
+	exfile_entry_t	*entry = NULL, *oldest = NULL;
+
+	/*
+	 *	Find an unused entry, or the least recently used
+	 *	entry which no thread is using.
+	 */
+	for (i = 0; i < ef->max_entries; i++) {
+		if (!ef->entries[i].filename) {
+			entry = &ef->entries[i];
+			break;
+		}
+
+		if (ef->entries[i].in_use) continue;
+
+		if (!oldest || (ef->entries[i].last_used < oldest->last_used)) oldest = &ef->entries[i];
+	}
+
+	if (!entry) {
+		if (!oldest) {
+			fr_strerror_printf("Too many files are being written to at the same time");
+			return NULL;
+		}
+
+		exfile_cleanup_entry(ef, oldest, true);
+		entry = oldest;
+	}
+
+	entry->filename = talloc_strdup(ef->entries, filename);
+	if (!entry->filename) return NULL;
+	entry->hash = hash;
+	entry->fd = -1;
+	entry->used = 0;
+
+	if (!fr_hash_table_insert(ef->ht, entry)) {
+		TALLOC_FREE(entry->filename);
+		fr_strerror_printf("Failed tracking file %s", filename);
+		return NULL;
+	}
+
+	return entry;
+}
+
+/*
+ *	Say that we're done with an entry.
+ */
+static void exfile_release(exfile_t *ef, exfile_entry_t *entry)
+{
+	PTHREAD_MUTEX_LOCK(&ef->mutex);
+	entry->in_use--;
+	PTHREAD_MUTEX_UNLOCK(&ef->mutex);
+}
+
+/*
+ *	Find the entry for a file descriptor returned by exfile_open().
+ *	It's almost always the one this thread opened last.  The
+ *	search is only needed if a thread has more than one file
+ *	open.
+ */
+static exfile_entry_t *exfile_find(exfile_t *ef, int fd)
+{
+	exfile_entry_t	*entry;
+	uint32_t	i;
+
+	/*
+	 *	Only look at the entry if it's one of ours.
+	 */
+	entry = fr_thread_local_init(exfile_last, _exfile_last_free);
+	if (entry && (entry >= ef->entries) && (entry < (ef->entries + ef->max_entries)) &&
+	    (entry->fd == fd)) return entry;
+
+	entry = NULL;
+
+	PTHREAD_MUTEX_LOCK(&ef->mutex);
+	for (i = 0; i < ef->max_entries; i++) {
+		if (ef->entries[i].in_use && (ef->entries[i].fd == fd)) {
+			entry = &ef->entries[i];
+			break;
+		}
+	}
+	PTHREAD_MUTEX_UNLOCK(&ef->mutex);
+
+	if (!entry) fr_strerror_printf("Attempt to use file which is not tracked");
+
+	return entry;
+}
+
+
+/** Open a new log file, or maybe an existing one.
+ *
+ * When multithreaded, the FD is locked via a mutex.  This way we're
+ * sure that no other thread is writing to the file.  Each file has
+ * its own mutex, so threads writing to different files don't wait
+ * for each other.
+ *
+ * @param ef The logfile context returned from exfile_init().
+ * @param filename the file to open.
+ * @param permissions to use.
+ * @return an FD used to write to the file, or -1 on error.
+ */
+int exfile_open(exfile_t *ef, char const *filename, mode_t permissions)
+{
+	exfile_entry_t	*entry, my_entry;
+	time_t		now;
+
+	if (!ef || !filename) return -1;
+
+	/*
+	 *	It's faster to do hash comparisons of a string than
+	 *	full string comparisons.
+	 */
+	my_entry.hash = fr_hash_string(filename);
+	memcpy(&my_entry.filename, &filename, sizeof(my_entry.filename));
+	now = time(NULL);
+
+	PTHREAD_MUTEX_LOCK(&ef->mutex);
+
+	/*
+	 *	Clean up idle entries.
+	 */
+	if (now > (ef->last_cleaned + 1)) {
+		ef->last_cleaned = now;
+		exfile_cleanup(ef, now);
+	}
+
+	/*
+	 *	Find the matching entry, or create a new one.
+	 */
+	entry = fr_hash_table_finddata(ef->ht, &my_entry);
+	if (!entry) {
+		entry = exfile_entry_alloc(ef, filename, my_entry.hash);
+		if (!entry) {
+			PTHREAD_MUTEX_UNLOCK(&ef->mutex);
+			return -1;
+		}
+	}
+
+	/*
+	 *	The buffer is allocated from the entries, so it has
+	 *	to be done while we hold the mutex which protects
+	 *	them.  It's kept when the entry is reused for another
+	 *	file.
+	 */
+	if (ef->buffer_size && !entry->buffer) entry->buffer = talloc_array(ef->entries, uint8_t, ef->buffer_size);
+
+	/*
+	 *	Stop the entry from being cleaned up while we're
+	 *	waiting for it.
+	 */
+	entry->in_use++;
+
+	PTHREAD_MUTEX_UNLOCK(&ef->mutex);
+
+	PTHREAD_MUTEX_LOCK(&entry->mutex);
+
+	entry->permissions = permissions;
+	if (exfile_lock_entry(ef, entry) < 0) {
+		PTHREAD_MUTEX_UNLOCK(&entry->mutex);
+		exfile_release(ef, entry);
+		return -1;
+	}
 
 	/*
 	 *	Return holding the mutex for the entry.
 	 */
-	ef->entries[i].last_used = now;
+	entry->last_used = now;
+
+	(void) fr_thread_local_init(exfile_last, _exfile_last_free);
+	(void) fr_thread_local_set(exfile_last, entry);
+
+	return entry->fd;
+}
+
+/** Write to a file opened with exfile_open()
+ *
+ * If buffering is enabled, the data is copied to the file's buffer,
+ * otherwise it's written immediately.  Data written to a buffer which
+ * later can't be written to the file is lost.
+ *
+ * @param ef The logfile context returned from exfile_init().
+ * @param fd returned by exfile_open().
+ * @param data to write.
+ * @param len of the data.
+ * @return len on success, -1 on error.
+ */
+ssize_t exfile_write(exfile_t *ef, int fd, void const *data, size_t len)
+{
+	exfile_entry_t *entry;
+
+	if (!ef->buffer_size) {
+	write_now:
+		if (exfile_write_all(fd, data, len) < 0) {
+			fr_strerror_printf("%s", strerror(errno));
+			return -1;
+		}
+		return len;
+	}
+
+	entry = exfile_find(ef, fd);
+	if (!entry) return -1;
+
+	/*
+	 *	The buffer couldn't be allocated when the file was
+	 *	opened.
+	 */
+	if (!entry->buffer) goto write_now;
+
+	/*
+	 *	Make room, and write large blocks of data directly.
+	 */
+	if (len > (ef->buffer_size - entry->used)) {
+		if (exfile_flush(ef, entry) < 0) return -1;
+
+		if (len > ef->buffer_size) goto write_now;
+	}
+
+	if (!entry->used) entry->buffered = entry->last_used;
+
+	memcpy(entry->buffer + entry->used, data, len);
+	entry->used += len;
 
-	return ef->entries[i].fd;
+	return len;
+}
+
+/** Get the size of a file opened with exfile_open()
+ *
+ * Includes any data which is buffered, so it's the offset the next
+ * exfile_write() will write to.
+ *
+ * @param ef The logfile context returned from exfile_init().
+ * @param fd returned by exfile_open().
+ * @return the size of the file, or -1 on error.
+ */
+off_t exfile_size(exfile_t *ef, int fd)
+{
+	struct stat	st;
+	exfile_entry_t	*entry;
+
+	if (fstat(fd, &st) < 0) {
+		fr_strerror_printf("Failed to stat file: %s", strerror(errno));
+		return -1;
+	}
+
+	if (!ef->buffer_size) return st.st_size;
+
+	entry = exfile_find(ef, fd);
+	if (!entry) return -1;
+
+	return st.st_size + entry->used;
 }
 
 /** Close the log file.  Really just return it to the pool.
@@ -486,31 +940,26 @@ int exfile_open(exfile_t *ef, char const *filename, mode_t permissions)
  */
 int exfile_close(exfile_t *ef, int fd)
 {
-	uint32_t i;
+	exfile_entry_t	*entry;
+	int		rcode = 0;
+
+	entry = exfile_find(ef, fd);
+	if (!entry) return -1;
 
 	/*
-	 *	No locking: just close the file.
+	 *	Write the buffer if its data has been waiting for
+	 *	long enough.
 	 */
-	if (!ef->locking) {
-		close(fd);
-		return 0;
+	if (entry->used && ((entry->buffered + ef->flush_interval) <= time(NULL))) {
+		rcode = exfile_flush(ef, entry);
 	}
 
-	/*
-	 *	Unlock the bytes that we had previously locked.
-	 */
-	for (i = 0; i < ef->max_entries; i++) {
-		if (ef->entries[i].fd == fd) {
-			(void) lseek(ef->entries[i].fd, 0, SEEK_SET);
-			(void) rad_unlockfd(ef->entries[i].fd, 0);
+	exfile_unlock_entry(ef, entry);
 
-			PTHREAD_MUTEX_UNLOCK(&(ef->mutex));
-			return 0;
-		}
-	}
+	(void) fr_thread_local_set(exfile_last, NULL);
 
-	PTHREAD_MUTEX_UNLOCK(&(ef->mutex));
+	PTHREAD_MUTEX_UNLOCK(&entry->mutex);
+	exfile_release(ef, entry);
 
-	fr_strerror_printf("Attempt to unlock file which is not tracked");
-	return -1;
+	return rcode;
 }
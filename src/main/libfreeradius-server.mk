@@ -4,6 +4,8 @@ SOURCES	:=	conffile.c \
 		evaluate.c \
 		exec.c \
 		exfile.c \
+		detail_binary.c \
+		snapshot.c \
 		log.c \
 		parser.c \
 		map.c \
@@ -46,6 +46,13 @@ RCSID("$Id$")
 #include <pthread.h>
 #endif
 
+#include <sys/uio.h>
+
+#if defined(HAVE_PTHREAD_H) && defined(HAVE_STDATOMIC_H)
+#  include <stdatomic.h>
+#  define WITH_ASYNC_LOG
+#endif
+
 log_lvl_t	rad_debug_lvl = 0;		//!< Global debugging level
 static bool	rate_limit = true;		//!< Whether repeated log entries should be rate limited
 
@@ -211,6 +218,13 @@ const FR_NAME_NUMBER log_str2dst[] = {
 	{ NULL,			L_DST_NUM_DEST	}
 };
 
+const FR_NAME_NUMBER log_str2async_overflow[] = {
+	{ "drop",		L_ASYNC_DROP	},
+	{ "count",		L_ASYNC_COUNT	},
+	{ "block",		L_ASYNC_BLOCK	},
+	{ NULL,			-1		}
+};
+
 bool log_dates_utc = false;
 
 fr_log_t default_log = {
@@ -219,6 +233,7 @@ fr_log_t default_log = {
 	.dst = L_DST_STDOUT,
 	.file = NULL,
 	.debug_file = NULL,
+	.async_buffer_size = 65536,
 };
 
 static int stderr_fd = -1;	//!< The original unmolested stderr file descriptor
@@ -355,6 +370,533 @@ int radlog_init(fr_log_t *log, bool daemonize)
 	return 0;
 }
 
+#ifdef WITH_ASYNC_LOG
+/*
+ *	Asynchronous logging.
+ *
+ *	Each thread which logs gets its own ring buffer of formatted
+ *	messages.  Only that thread moves the head of the ring, and
+ *	only the writer thread moves the tail, so neither of them
+ *	needs a lock.  The writer thread gathers everything queued in
+ *	all of the rings, and writes it with one writev().
+ *
+ *	Messages from one thread are written in the order they were
+ *	logged, but messages from different threads may be written
+ *	slightly out of order.
+ *
+ *	A ring is only freed once the thread which owns it can't use
+ *	it any more.  While the writer thread is running, it frees the
+ *	rings of threads which have exited.  Once it has stopped, each
+ *	thread frees its own ring when it exits.  The rings of threads
+ *	which never exit are left until the server does.
+ */
+#define LOG_ASYNC_BATCH	(32)		//!< Rings written by each writev().
+
+typedef struct log_ring log_ring_t;
+struct log_ring {
+	log_ring_t		*next;		//!< Next ring in the list.
+	char			*data;		//!< Formatted messages.
+	size_t			mask;		//!< Size of data, less one.
+
+	_Atomic(uint64_t)	head;		//!< Where the thread queues the next message.
+	_Atomic(uint64_t)	tail;		//!< Where the writer thread writes from next.
+
+	_Atomic(uint64_t)	queued;		//!< Messages queued.
+	_Atomic(uint64_t)	dropped;	//!< Messages dropped because the ring was full.
+	atomic_bool		exited;		//!< The thread has exited, so free the ring once it's empty.
+
+	uint64_t		lost;		//!< Messages dropped since one was last queued.
+						//!< Only used by the thread which owns the ring.
+};
+
+static struct {
+	pthread_t		thread;
+	pthread_mutex_t		mutex;		//!< Protects the list of rings, and wakes the writer.
+	pthread_cond_t		cond;
+	pthread_cond_t		space;		//!< Signalled when the writer has made space in the rings.
+	int			blocked;	//!< Threads waiting for space.
+	log_ring_t		*rings;
+
+	atomic_bool		running;	//!< Whether messages should be queued.
+	atomic_bool		sleeping;	//!< The writer thread found nothing to write, and may be waiting.
+	bool			started;	//!< Whether the writer thread needs to be joined.
+
+	uint64_t		queued;		//!< Messages queued in rings which have been freed.
+	uint64_t		dropped;	//!< Messages dropped by rings which have been freed.
+	_Atomic(uint64_t)	writes;		//!< Calls to writev().
+} log_async = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+	.space = PTHREAD_COND_INITIALIZER
+};
+
+fr_thread_local_setup(log_ring_t *, log_ring)	/* macro */
+
+/** Wake the writer thread
+ *
+ */
+static void log_async_wake(void)
+{
+	pthread_mutex_lock(&log_async.mutex);
+	pthread_cond_signal(&log_async.cond);
+	pthread_mutex_unlock(&log_async.mutex);
+}
+
+/** Free a thread's ring, or have the writer thread free it, when the thread exits
+ *
+ */
+static void _log_ring_exit(void *arg)
+{
+	log_ring_t *ring = arg, **last;
+
+	if (!ring) return;
+
+	pthread_mutex_lock(&log_async.mutex);
+
+	/*
+	 *	The writer thread may still be writing from the
+	 *	ring, so it frees it once it's empty.
+	 */
+	if (log_async.started) {
+		atomic_store_explicit(&ring->exited, true, memory_order_release);
+		pthread_cond_signal(&log_async.cond);
+		pthread_mutex_unlock(&log_async.mutex);
+		return;
+	}
+
+	for (last = &log_async.rings; *last; last = &(*last)->next) {
+		if (*last != ring) continue;
+
+		*last = ring->next;
+		break;
+	}
+	log_async.queued += atomic_load_explicit(&ring->queued, memory_order_relaxed);
+	log_async.dropped += atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+	pthread_mutex_unlock(&log_async.mutex);
+
+	talloc_free(ring);
+}
+
+/** Allocate a ring for the current thread, and add it to the list
+ *
+ */
+static log_ring_t *log_ring_alloc(void)
+{
+	log_ring_t	*ring;
+	size_t		size;
+
+	/*
+	 *	Round up to a power of 2, so we can mask instead
+	 *	of dividing.
+	 */
+	for (size = 1; size < default_log.async_buffer_size; size <<= 1);
+
+	ring = talloc_zero(NULL, log_ring_t);
+	if (!ring) return NULL;
+
+	ring->data = talloc_array(ring, char, size);
+	if (!ring->data) {
+		talloc_free(ring);
+		return NULL;
+	}
+	ring->mask = size - 1;
+
+	if (fr_thread_local_set(log_ring, ring) != 0) {
+		talloc_free(ring);
+		return NULL;
+	}
+
+	pthread_mutex_lock(&log_async.mutex);
+	ring->next = log_async.rings;
+	log_async.rings = ring;
+	pthread_mutex_unlock(&log_async.mutex);
+
+	return ring;
+}
+
+/** Whether a ring has space for a message
+ *
+ */
+static bool log_ring_fits(log_ring_t *ring, uint64_t head, size_t len)
+{
+	uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+	return (((ring->mask + 1) - (head - tail)) >= len);
+}
+
+/** Copy a message into a ring, which must have space for it
+ *
+ * @return the new head of the ring.
+ */
+static uint64_t log_ring_copy(log_ring_t *ring, uint64_t head, char const *buffer, size_t len)
+{
+	size_t start, first;
+
+	start = head & ring->mask;
+	first = (ring->mask + 1) - start;
+	if (first > len) first = len;
+
+	memcpy(ring->data + start, buffer, first);
+	if (first < len) memcpy(ring->data, buffer + first, len - first);
+
+	return head + len;
+}
+
+/** Wait for the writer thread to make space in a ring
+ *
+ * @return true if there's space, false if the writer thread has stopped.
+ */
+static bool log_async_wait(log_ring_t *ring, uint64_t head, size_t len)
+{
+	bool fits;
+
+	pthread_mutex_lock(&log_async.mutex);
+	log_async.blocked++;
+	pthread_cond_signal(&log_async.cond);
+
+	/*
+	 *	The writer thread moves the tails before it takes
+	 *	the mutex to check for blocked threads, so we either
+	 *	see the new tail, or get woken up.
+	 */
+	while (!(fits = log_ring_fits(ring, head, len)) &&
+	       atomic_load_explicit(&log_async.running, memory_order_relaxed)) {
+		pthread_cond_wait(&log_async.space, &log_async.mutex);
+	}
+
+	log_async.blocked--;
+	pthread_mutex_unlock(&log_async.mutex);
+
+	return fits;
+}
+
+/** Queue a formatted message for the writer thread
+ *
+ * @param buffer containing the message, including the trailing new line.
+ * @param len of the message.
+ * @return the length of the message, or 0 if it was dropped.
+ */
+static int log_async_queue(char const *buffer, size_t len)
+{
+	log_ring_t	*ring;
+	uint64_t	head;
+	char		lost[128];
+	size_t		lost_len = 0;
+
+	ring = fr_thread_local_init(log_ring, _log_ring_exit);
+	if (!ring) {
+		ring = log_ring_alloc();
+		if (!ring) return write(default_log.fd, buffer, len);
+	}
+
+	head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+	/*
+	 *	Say how many messages were dropped, just before the
+	 *	first one which isn't.
+	 */
+	if (ring->lost) {
+		lost_len = snprintf(lost, sizeof(lost), "Warning: %" PRIu64 " log message(s) were dropped, "
+				    "as the log queue was full\n", ring->lost);
+	}
+
+	if (!log_ring_fits(ring, head, lost_len + len) &&
+	    ((default_log.async_overflow != L_ASYNC_BLOCK) || ((lost_len + len) > (ring->mask + 1)) ||
+	     !log_async_wait(ring, head, lost_len + len))) {
+		if (default_log.async_overflow == L_ASYNC_COUNT) ring->lost++;
+		atomic_store_explicit(&ring->dropped,
+				      atomic_load_explicit(&ring->dropped, memory_order_relaxed) + 1,
+				      memory_order_relaxed);
+		return 0;
+	}
+
+	if (lost_len) {
+		head = log_ring_copy(ring, head, lost, lost_len);
+		ring->lost = 0;
+	}
+	head = log_ring_copy(ring, head, buffer, len);
+
+	atomic_store_explicit(&ring->head, head, memory_order_release);
+	atomic_store_explicit(&ring->queued,
+			      atomic_load_explicit(&ring->queued, memory_order_relaxed) + 1,
+			      memory_order_relaxed);
+
+	/*
+	 *	The writer thread may be waiting for messages.  It
+	 *	sets "sleeping" before it looks at the rings for the
+	 *	last time, so either it sees the new head, or we see
+	 *	that it needs waking.
+	 */
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load_explicit(&log_async.sleeping, memory_order_relaxed)) log_async_wake();
+
+	return len;
+}
+
+/** Write all of an iovec array, or as much of it as we can
+ *
+ */
+static void log_async_writev(struct iovec *iov, int iovcnt)
+{
+	ssize_t ret;
+
+	while (iovcnt > 0) {
+		ret = writev(default_log.fd, iov, iovcnt);
+		if (ret < 0) {
+			if (errno == EINTR) continue;
+			return;
+		}
+
+		while ((iovcnt > 0) && ((size_t) ret >= iov->iov_len)) {
+			ret -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+
+		if (iovcnt > 0) {
+			iov->iov_base = (char *) iov->iov_base + ret;
+			iov->iov_len -= ret;
+		}
+	}
+
+	atomic_fetch_add_explicit(&log_async.writes, 1, memory_order_relaxed);
+}
+
+/** Write everything queued in a list of rings
+ *
+ * Called without the mutex held.  Rings are only ever removed
+ * from the list by the writer thread, so the list can be walked
+ * safely.
+ */
+static void log_async_flush(log_ring_t *ring)
+{
+	struct iovec	iov[LOG_ASYNC_BATCH * 2];
+	log_ring_t	*batch[LOG_ASYNC_BATCH];
+	uint64_t	end[LOG_ASYNC_BATCH];
+	int		i, num = 0, iovcnt = 0;
+
+	for (; ring; ring = ring->next) {
+		uint64_t	head, tail;
+		size_t		start, len, first;
+
+		head = atomic_load_explicit(&ring->head, memory_order_acquire);
+		tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+		if (head == tail) continue;
+
+		start = tail & ring->mask;
+		len = head - tail;
+		first = (ring->mask + 1) - start;
+		if (first > len) first = len;
+
+		iov[iovcnt].iov_base = ring->data + start;
+		iov[iovcnt++].iov_len = first;
+		if (first < len) {
+			iov[iovcnt].iov_base = ring->data;
+			iov[iovcnt++].iov_len = len - first;
+		}
+
+		batch[num] = ring;
+		end[num++] = head;
+
+		if (num < LOG_ASYNC_BATCH) continue;
+
+		log_async_writev(iov, iovcnt);
+		for (i = 0; i < num; i++) atomic_store_explicit(&batch[i]->tail, end[i], memory_order_release);
+		num = iovcnt = 0;
+	}
+
+	if (!num) return;
+
+	log_async_writev(iov, iovcnt);
+	for (i = 0; i < num; i++) atomic_store_explicit(&batch[i]->tail, end[i], memory_order_release);
+}
+
+/** Write queued messages until we're told to stop
+ *
+ */
+static void *log_async_writer(UNUSED void *arg)
+{
+	log_ring_t	*ring, **last;
+	bool		pending;
+
+	pthread_mutex_lock(&log_async.mutex);
+	while (true) {
+		/*
+		 *	Free the rings of threads which have exited,
+		 *	and see if there's anything to write.
+		 */
+		pending = false;
+		last = &log_async.rings;
+		while ((ring = *last)) {
+			if (atomic_load_explicit(&ring->head, memory_order_acquire) !=
+			    atomic_load_explicit(&ring->tail, memory_order_relaxed)) {
+				pending = true;
+
+			} else if (atomic_load_explicit(&ring->exited, memory_order_acquire)) {
+				*last = ring->next;
+				log_async.queued += atomic_load_explicit(&ring->queued, memory_order_relaxed);
+				log_async.dropped += atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+				talloc_free(ring);
+				continue;
+			}
+
+			last = &ring->next;
+		}
+
+		if (!pending) {
+			if (!atomic_load_explicit(&log_async.running, memory_order_relaxed)) break;
+
+			/*
+			 *	Say we're about to sleep, and look at
+			 *	the rings again.  A thread which queued
+			 *	a message before it saw the flag will
+			 *	have moved the head before we look.
+			 */
+			if (!atomic_load_explicit(&log_async.sleeping, memory_order_relaxed)) {
+				atomic_store_explicit(&log_async.sleeping, true, memory_order_relaxed);
+				atomic_thread_fence(memory_order_seq_cst);
+				continue;
+			}
+
+			pthread_cond_wait(&log_async.cond, &log_async.mutex);
+			continue;
+		}
+
+		atomic_store_explicit(&log_async.sleeping, false, memory_order_relaxed);
+
+		ring = log_async.rings;
+		pthread_mutex_unlock(&log_async.mutex);
+
+		log_async_flush(ring);
+
+		pthread_mutex_lock(&log_async.mutex);
+		if (log_async.blocked) pthread_cond_broadcast(&log_async.space);
+	}
+	pthread_mutex_unlock(&log_async.mutex);
+
+	return NULL;
+}
+#endif
+
+/** Start writing log messages from a separate thread
+ *
+ * Only messages written to a file descriptor can be queued.  Messages
+ * sent to syslog, or logged in debugging mode are still written as
+ * they're logged.
+ *
+ * @return 0 on success (or if asynchronous logging isn't enabled), -1 on failure.
+ */
+int radlog_async_start(void)
+{
+	if (!default_log.async) return 0;
+
+	if ((default_log.dst != L_DST_FILES) && (default_log.dst != L_DST_STDOUT) &&
+	    (default_log.dst != L_DST_STDERR)) {
+		WARN("Ignoring \"async\", it can only be used with log destinations \"files\", "
+		     "\"stdout\" and \"stderr\"");
+		return 0;
+	}
+
+	/*
+	 *	Debug output should be written in the order it was
+	 *	logged.
+	 */
+	if (rad_debug_lvl) return 0;
+
+#ifdef WITH_ASYNC_LOG
+	{
+		int rcode;
+
+		pthread_mutex_lock(&log_async.mutex);
+		atomic_store(&log_async.running, true);
+
+		rcode = pthread_create(&log_async.thread, NULL, log_async_writer, NULL);
+		if (rcode != 0) {
+			atomic_store(&log_async.running, false);
+			pthread_mutex_unlock(&log_async.mutex);
+			ERROR("Failed creating log writer thread: %s", fr_syserror(rcode));
+			return -1;
+		}
+		log_async.started = true;
+		pthread_mutex_unlock(&log_async.mutex);
+	}
+#else
+	WARN("Ignoring \"async\", it isn't supported on this platform");
+#endif
+
+	return 0;
+}
+
+/** Write any queued log messages, and stop the writer thread
+ *
+ * Other threads may still be using their rings, so they're not freed
+ * here.  Messages logged from now on are written directly.
+ */
+void radlog_async_stop(void)
+{
+#ifdef WITH_ASYNC_LOG
+	log_ring_t *ring, **last;
+
+	if (!log_async.started) return;
+
+	pthread_mutex_lock(&log_async.mutex);
+	atomic_store(&log_async.running, false);
+	pthread_cond_signal(&log_async.cond);
+	pthread_cond_broadcast(&log_async.space);
+	pthread_mutex_unlock(&log_async.mutex);
+
+	pthread_join(log_async.thread, NULL);
+
+	/*
+	 *	From now on, threads free their own rings when
+	 *	they exit.  Free the rings of any which exited
+	 *	after the writer thread last looked.
+	 */
+	pthread_mutex_lock(&log_async.mutex);
+	log_async.started = false;
+
+	last = &log_async.rings;
+	while ((ring = *last)) {
+		if (!atomic_load_explicit(&ring->exited, memory_order_acquire)) {
+			last = &ring->next;
+			continue;
+		}
+
+		*last = ring->next;
+		log_async.queued += atomic_load_explicit(&ring->queued, memory_order_relaxed);
+		log_async.dropped += atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+		talloc_free(ring);
+	}
+	pthread_mutex_unlock(&log_async.mutex);
+#endif
+}
+
+/** Return statistics for asynchronous logging
+ *
+ * @param[out] queued Number of messages queued.
+ * @param[out] dropped Number of messages dropped because a queue was full.
+ * @param[out] writes Number of calls to writev().
+ */
+void radlog_async_stats(uint64_t *queued, uint64_t *dropped, uint64_t *writes)
+{
+#ifdef WITH_ASYNC_LOG
+	log_ring_t *ring;
+
+	pthread_mutex_lock(&log_async.mutex);
+	*queued = log_async.queued;
+	*dropped = log_async.dropped;
+	for (ring = log_async.rings; ring; ring = ring->next) {
+		*queued += atomic_load_explicit(&ring->queued, memory_order_relaxed);
+		*dropped += atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+	}
+	pthread_mutex_unlock(&log_async.mutex);
+
+	*writes = atomic_load_explicit(&log_async.writes, memory_order_relaxed);
+#else
+	*queued = *dropped = *writes = 0;
+#endif
+}
+
 /** Send a server log message to its destination
  *
  * @param type of log message.
@@ -506,6 +1048,11 @@ int vradlog(log_type_t type, char const *msg, va_list ap)
 	case L_DST_FILES:
 	case L_DST_STDOUT:
 	case L_DST_STDERR:
+#ifdef WITH_ASYNC_LOG
+		if (atomic_load_explicit(&log_async.running, memory_order_relaxed)) {
+			return log_async_queue(buffer, strlen(buffer));
+		}
+#endif
 		return write(default_log.fd, buffer, strlen(buffer));
 
 	default:
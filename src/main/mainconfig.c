@@ -56,6 +56,7 @@ typedef struct cached_config_t {
 } cached_config_t;
 
 static cached_config_t	*cs_cache = NULL;
+static cached_config_t	*clients_cache = NULL;	//!< Configurations read by "reload clients".
 
 /*
  *	Temporary local variables for parsing the configuration
@@ -84,6 +85,7 @@ static char const	*sbindir = NULL;
 static char const	*run_dir = NULL;
 static char const	*syslog_facility = NULL;
 static bool		do_colourise = false;
+static char const	*log_async_overflow = NULL;
 
 static char const	*radius_dir = NULL;	//!< Path to raddb directory
 
@@ -148,6 +150,9 @@ static const CONF_PARSER log_config[] = {
 	{ "colourise",FR_CONF_POINTER(PW_TYPE_BOOLEAN, &do_colourise), NULL },
 	{ "use_utc", FR_CONF_POINTER(PW_TYPE_BOOLEAN, &log_dates_utc), NULL },
 	{ "msg_denied", FR_CONF_POINTER(PW_TYPE_STRING, &main_config.denied_msg), "You are already logged in - access denied" },
+	{ "async", FR_CONF_POINTER(PW_TYPE_BOOLEAN, &default_log.async), "no" },
+	{ "async_buffer_size", FR_CONF_POINTER(PW_TYPE_INTEGER, &default_log.async_buffer_size), "65536" },
+	{ "async_overflow", FR_CONF_POINTER(PW_TYPE_STRING, &log_async_overflow), "drop" },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -1119,6 +1124,24 @@ do {\
 	FR_INTEGER_BOUND_CHECK("resources.talloc_pool_size", main_config.talloc_pool_size, >=, 2 * 1024);
 	FR_INTEGER_BOUND_CHECK("resources.talloc_pool_size", main_config.talloc_pool_size, <=, 1024 * 1024);
 
+	/*
+	 *	Each thread's queue has to hold the largest message.
+	 */
+	FR_INTEGER_BOUND_CHECK("log.async_buffer_size", default_log.async_buffer_size, >=, 16 * 1024);
+	FR_INTEGER_BOUND_CHECK("log.async_buffer_size", default_log.async_buffer_size, <=, 16 * 1024 * 1024);
+
+	{
+		int overflow;
+
+		overflow = fr_str2int(log_str2async_overflow, log_async_overflow, -1);
+		if (overflow < 0) {
+			ERROR("Invalid value \"%s\" for log.async_overflow, must be \"drop\", \"count\" "
+			      "or \"block\"", log_async_overflow);
+			return -1;
+		}
+		default_log.async_overflow = overflow;
+	}
+
 	/*
 	 * Set default initial request processing delay to 1/3 of a second.
 	 * Will be updated by the lowest response window across all home servers,
@@ -1200,6 +1223,12 @@ int main_config_free(void)
 	 *	structures.
 	 */
 	client_list_free(NULL);
+	while (clients_cache) {
+		cached_config_t *next = clients_cache->next;
+
+		talloc_free(clients_cache);
+		clients_cache = next;
+	}
 	realms_free();
 	listen_free(&main_config.listen);
 
@@ -1272,6 +1301,73 @@ static int hup_callback(void *ctx, void *data)
 	return 1;
 }
 
+/** Replace the global clients with the ones in the configuration files
+ *
+ * The configuration files are read again, but only the global clients
+ * are taken from them.  Listeners using the global clients switch to
+ * the new ones.  Requests keep the clients they started with, so each
+ * configuration read here is kept until none of its clients can still
+ * be in use.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int main_config_reload_clients(void)
+{
+	cached_config_t *cc, *old;
+	CONF_SECTION *cs;
+	time_t when;
+	char buffer[1024];
+
+	cs = cf_section_alloc(NULL, "main", NULL);
+	if (!cs) return -1;
+
+	/* Read the configuration file */
+	snprintf(buffer, sizeof(buffer), "%.200s/%.50s.conf", radius_dir, main_config.name);
+
+	if (cf_file_read(cs, buffer) < 0) {
+		ERROR("Failed to re-read or parse %s", buffer);
+		talloc_free(cs);
+		return -1;
+	}
+
+	cc = talloc_zero(NULL, cached_config_t);
+	if (!cc) {
+		ERROR("Out of memory");
+		talloc_free(cs);
+		return -1;
+	}
+	cc->cs = talloc_steal(cc, cs);
+
+	if (!client_list_parse_section(cs, false)) {
+		talloc_free(cc);
+		return -1;
+	}
+
+	cc->created = time(NULL);
+	cc->next = clients_cache;
+	clients_cache = cc;
+
+	/*
+	 *	Free the configurations which were replaced long enough
+	 *	ago that nothing can be using their clients.  That's the
+	 *	same time virtual servers are kept for after a HUP, plus
+	 *	the time a deleted dynamic client is kept before it's
+	 *	freed.
+	 */
+	when = cc->created - ((main_config.max_request_time * 4) + 20);
+	for (; cc->next; cc = cc->next) {
+		if (cc->created >= when) continue;
+
+		while ((old = cc->next) != NULL) {
+			cc->next = old->next;
+			talloc_free(old);
+		}
+		break;
+	}
+
+	return 0;
+}
+
 void main_config_hup(void)
 {
 	int rcode;
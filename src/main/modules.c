@@ -69,6 +69,36 @@ struct fr_module_hup_t {
 	fr_module_hup_t		*next;
 };
 
+/*
+ *	Slow work done when modules are instantiated, like opening
+ *	the initial connections of a pool, or loading large files.
+ *
+ *	None of it depends on anything else being instantiated, so
+ *	whilst the modules are being instantiated it's queued, and
+ *	once they all have been, it's run in parallel.
+ */
+typedef struct module_job_entry_t {
+	module_job_t		job;
+	void			*uctx;
+	module_instance_t	*node;		//!< Module instance which added the job.
+	int			rcode;		//!< Returned by the job.
+	uint64_t		usec;		//!< Time the job took.
+	struct module_job_entry_t *next;
+} module_job_entry_t;
+
+#define MODULE_JOBS_MAX_THREADS (32)
+#define USEC (1000000)
+
+static module_job_entry_t *jobs_head = NULL;
+static module_job_entry_t **jobs_tail = &jobs_head;
+static int jobs_depth = 0;		//!< Nesting of module_jobs_begin().
+static module_instance_t *jobs_node = NULL;	//!< Module instance being instantiated.
+
+#ifdef HAVE_PTHREAD_H
+static pthread_mutex_t jobs_mutex = PTHREAD_MUTEX_INITIALIZER;
+static module_job_entry_t *jobs_next = NULL;	//!< Next job for a thread to run.
+#endif
+
 /*
  *	Ordered by component
  */
@@ -605,6 +635,212 @@ static int module_conf_parse(module_instance_t *node, void **handle)
 	return 0;
 }
 
+static uint64_t module_usec_since(struct timeval const *start)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+
+	return ((now.tv_sec - start->tv_sec) * USEC) + (now.tv_usec - start->tv_usec);
+}
+
+static void module_job_run(module_job_entry_t *entry)
+{
+	struct timeval start;
+
+	gettimeofday(&start, NULL);
+	entry->rcode = entry->job(entry->uctx);
+	entry->usec = module_usec_since(&start);
+}
+
+#ifdef HAVE_PTHREAD_H
+static void *module_jobs_thread(UNUSED void *arg)
+{
+	module_job_entry_t *entry;
+
+	for (;;) {
+		pthread_mutex_lock(&jobs_mutex);
+		entry = jobs_next;
+		if (entry) jobs_next = entry->next;
+		pthread_mutex_unlock(&jobs_mutex);
+
+		if (!entry) break;
+
+		module_job_run(entry);
+	}
+
+	return NULL;
+}
+#endif
+
+/** Free the queued jobs, without running them
+ *
+ */
+static void module_jobs_discard(void)
+{
+	module_job_entry_t *entry, *next;
+
+	for (entry = jobs_head; entry; entry = next) {
+		next = entry->next;
+		talloc_free(entry);
+	}
+	jobs_head = NULL;
+	jobs_tail = &jobs_head;
+}
+
+/** Run the queued jobs in parallel, and wait for them to finish
+ *
+ * @return -1 if any of the jobs failed, else 0.
+ */
+static int module_jobs_run(void)
+{
+	int			rcode = 0;
+	uint32_t		num = 0, i;
+	uint64_t		total = 0;
+	struct timeval		start;
+	module_job_entry_t	*entry;
+
+	if (!jobs_head) return 0;
+
+	for (entry = jobs_head; entry; entry = entry->next) num++;
+
+	gettimeofday(&start, NULL);
+
+#ifdef HAVE_PTHREAD_H
+	if (num > 1) {
+		pthread_t	threads[MODULE_JOBS_MAX_THREADS];
+		uint32_t	num_threads = 0;
+
+		jobs_next = jobs_head;
+
+		for (i = 0; (i < num) && (i < MODULE_JOBS_MAX_THREADS); i++) {
+			if (pthread_create(&threads[num_threads], NULL, module_jobs_thread, NULL) != 0) break;
+			num_threads++;
+		}
+
+		/*
+		 *	Whatever the threads couldn't be created for,
+		 *	we do ourselves.
+		 */
+		module_jobs_thread(NULL);
+
+		for (i = 0; i < num_threads; i++) pthread_join(threads[i], NULL);
+	} else
+#endif
+	{
+		for (entry = jobs_head; entry; entry = entry->next) module_job_run(entry);
+	}
+
+	for (entry = jobs_head; entry; entry = entry->next) {
+		if (entry->rcode < 0) rcode = -1;
+		total += entry->usec;
+
+		if (!entry->node) continue;
+
+		entry->node->jobs++;
+		entry->node->jobs_usec += entry->usec;
+	}
+
+	DEBUG2("%s: Ran %u startup jobs in %.3fs (%.3fs if run one at a time)", main_config.name, num,
+	       module_usec_since(&start) / (double)USEC, total / (double)USEC);
+
+	module_jobs_discard();
+
+	return rcode;
+}
+
+/** Start queueing module startup jobs
+ *
+ * Calls nest, the jobs are only run by the outermost #module_jobs_end.
+ */
+void module_jobs_begin(void)
+{
+	jobs_depth++;
+}
+
+/** Stop queueing module startup jobs
+ *
+ * If this is the outermost call, runs the queued jobs in parallel, and
+ * waits for them to finish.
+ *
+ * @return -1 if any of the jobs failed, else 0.
+ */
+int module_jobs_end(void)
+{
+	rad_assert(jobs_depth > 0);
+
+	if (--jobs_depth > 0) return 0;
+
+	return module_jobs_run();
+}
+
+/** Add a startup job
+ *
+ * If jobs are being queued, the job is run later, in parallel with the
+ * others.  Otherwise it's run immediately.
+ *
+ * @param[in] job to run.
+ * @param[in] uctx to pass to the job.
+ * @return -1 if the job was run and failed, else 0.
+ */
+int module_job_add(module_job_t job, void *uctx)
+{
+	module_job_entry_t *entry;
+
+	if (jobs_depth == 0) return job(uctx);
+
+	entry = talloc_zero(NULL, module_job_entry_t);
+	if (!entry) return -1;
+
+	entry->job = job;
+	entry->uctx = uctx;
+	entry->node = jobs_node;
+
+	*jobs_tail = entry;
+	jobs_tail = &entry->next;
+
+	return 0;
+}
+
+/** Remove any queued jobs for uctx
+ *
+ * Must be called when uctx is freed before the jobs have been run.
+ *
+ * @param[in] uctx passed to #module_job_add.
+ */
+void module_job_cancel(void *uctx)
+{
+	module_job_entry_t *entry, **last;
+
+	last = &jobs_head;
+	while ((entry = *last) != NULL) {
+		if (entry->uctx != uctx) {
+			last = &entry->next;
+			continue;
+		}
+
+		*last = entry->next;
+		talloc_free(entry);
+	}
+	jobs_tail = last;
+}
+
+/** Whether the module being instantiated may open connections from startup jobs
+ *
+ * Startup jobs run in threads which are thrown away afterwards, and which
+ * never call the per-thread initialisation some client libraries need.
+ * So only modules which say their drivers don't need it can use them to
+ * open connections.
+ *
+ * @return true if the module has #RLM_TYPE_PARALLEL_START set, else false.
+ */
+bool module_parallel_start(void)
+{
+	if (!jobs_node) return false;
+
+	return ((jobs_node->entry->module->type & RLM_TYPE_PARALLEL_START) != 0);
+}
+
 /** Bootstrap a module.
  *
  *  Load the module shared library, allocate instance memory for it,
@@ -615,6 +851,9 @@ static module_instance_t *module_bootstrap(CONF_SECTION *cs)
 	char const *name1, *name2;
 	module_instance_t *node, myNode;
 	char module_name[256];
+	struct timeval start;
+
+	gettimeofday(&start, NULL);
 
 	/*
 	 *	Figure out which module we want to load.
@@ -684,6 +923,8 @@ static module_instance_t *module_bootstrap(CONF_SECTION *cs)
 		return NULL;
 	}
 
+	node->bootstrap_usec = module_usec_since(&start);
+
 	/*
 	 *	Remember the module for later.
 	 */
@@ -722,7 +963,8 @@ module_instance_t *module_find(CONF_SECTION *modules, char const *askedname)
  */
 module_instance_t *module_instantiate(CONF_SECTION *modules, char const *askedname)
 {
-	module_instance_t *node;
+	module_instance_t *node, *jobs_parent;
+	struct timeval start;
 
 	/*
 	 *	Find the module.  If it's not there, do nothing.
@@ -738,6 +980,8 @@ module_instance_t *module_instantiate(CONF_SECTION *modules, char const *askedna
 	 */
 	if (node->instantiated) return node;
 
+	gettimeofday(&start, NULL);
+
 	/*
 	 *	Now that ALL modules are instantiated, and ALL xlats
 	 *	are defined, go compile the config items marked as XLAT.
@@ -748,6 +992,13 @@ module_instance_t *module_instantiate(CONF_SECTION *modules, char const *askedna
 		return NULL;
 	}
 
+	/*
+	 *	Instantiating this module may instantiate others, so
+	 *	remember whose startup jobs we were adding.
+	 */
+	jobs_parent = jobs_node;
+	jobs_node = node;
+
 	/*
 	 *	Call the instantiate method, if any.
 	 */
@@ -760,10 +1011,12 @@ module_instance_t *module_instantiate(CONF_SECTION *modules, char const *askedna
 		 */
 		if ((node->entry->module->instantiate)(node->cs, node->insthandle) < 0) {
 			cf_log_err_cs(node->cs, "Instantiation failed for module \"%s\"", node->name);
+			jobs_node = jobs_parent;
 
 			return NULL;
 		}
 	}
+	jobs_node = jobs_parent;
 
 #ifdef HAVE_PTHREAD_H
 	/*
@@ -783,6 +1036,7 @@ module_instance_t *module_instantiate(CONF_SECTION *modules, char const *askedna
 
 	node->instantiated = true;
 	node->last_hup = time(NULL); /* don't let us load it, then immediately hup it */
+	node->instantiate_usec = module_usec_since(&start);
 
 	return node;
 }
@@ -1856,7 +2110,7 @@ static bool is_reserved_word(const char *name)
  *	Parse the module config sections, and load
  *	and call each module's init() function.
  */
-int modules_init(CONF_SECTION *config)
+static int modules_load(CONF_SECTION *config)
 {
 	CONF_ITEM	*ci, *next;
 	CONF_SECTION	*cs, *modules;
@@ -2153,6 +2407,42 @@ int modules_init(CONF_SECTION *config)
 	return 0;
 }
 
+static int module_times_cb(UNUSED void *ctx, void *data)
+{
+	module_instance_t *node = talloc_get_type_abort(data, module_instance_t);
+
+	DEBUG2("  %-24s bootstrap %.3fs, instantiate %.3fs, %u startup jobs %.3fs", node->name,
+	       node->bootstrap_usec / (double)USEC, node->instantiate_usec / (double)USEC,
+	       node->jobs, node->jobs_usec / (double)USEC);
+
+	return 0;
+}
+
+/** Load and instantiate all of the modules, and the virtual servers
+ *
+ * The startup jobs added by modules as they're instantiated are run
+ * in parallel once they all have been.
+ */
+int modules_init(CONF_SECTION *config)
+{
+	module_jobs_begin();
+
+	if (modules_load(config) < 0) {
+		jobs_depth = 0;
+		module_jobs_discard();
+		return -1;
+	}
+
+	if (module_jobs_end() < 0) return -1;
+
+	if (rad_debug_lvl >= 2) {
+		DEBUG2("%s: #### Module startup times ####", main_config.name);
+		rbtree_walk(instance_tree, RBTREE_IN_ORDER, module_times_cb, NULL);
+	}
+
+	return 0;
+}
+
 /*
  *	Call all authorization modules until one returns
  *	somethings else than RLM_MODULE_OK
@@ -532,6 +532,10 @@ int paircompare(REQUEST *request, VALUE_PAIR *req_list, VALUE_PAIR *check,
 		first_only = otherattr(check_item->da, &from);
 
 		auth_item = req_list;
+		if (!first_only && from && req_list && req_list->index) {
+			auth_item = fr_pair_index_find(req_list, from->attr, from->vendor);
+		}
+
 	try_again:
 		if (!first_only) {
 			while (auth_item != NULL) {
@@ -0,0 +1,532 @@
+/*
+ * raddetail.c	Convert detail files between the text and binary formats.
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2015  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/detail.h>
+
+#ifdef HAVE_GETOPT_H
+#  include <getopt.h>
+#endif
+
+static char const *progname = "raddetail";
+
+/*
+ *	The rest of this is because libfreeradius-server assumes it's
+ *	running inside of the server.
+ */
+main_config_t main_config;
+
+#include <sys/wait.h>
+#ifdef HAVE_PTHREAD_H
+pid_t rad_fork(void)
+{
+	return fork();
+}
+
+pid_t rad_waitpid(pid_t pid, int *status)
+{
+	return waitpid(pid, status, 0);
+}
+#endif
+
+/*
+ *	An entry, in either format.
+ */
+typedef struct detail_record_t {
+	RADIUS_PACKET	*packet;	//!< Code, addresses, and attributes.
+	time_t		timestamp;	//!< When the entry was written.
+	bool		done;		//!< Whether the reader has processed it.
+} detail_record_t;
+
+typedef struct detail_count_t {
+	uint32_t	entries;
+	uint32_t	skipped;
+} detail_count_t;
+
+static void NEVER_RETURNS usage(int status)
+{
+	FILE *output = status ? stderr : stdout;
+
+	fprintf(output, "Usage: %s [options] [input [output]]\n", progname);
+	fprintf(output, "Convert detail files between the text and binary formats.\n");
+	fprintf(output, "Binary files are converted to text, and text files to binary,\n");
+	fprintf(output, "unless the output format is given.  The default input and\n");
+	fprintf(output, "output are stdin and stdout.\n\n");
+	fprintf(output, "  -b                 Write a binary file.\n");
+	fprintf(output, "  -D <dictdir>       Set main dictionary directory (defaults to " DICTDIR ").\n");
+	fprintf(output, "  -h                 Print this help message.\n");
+	fprintf(output, "  -t                 Write a text file.\n");
+	fprintf(output, "  -x                 Print how many entries were converted.\n");
+
+	exit(status);
+}
+
+/*
+ *	Write an entry to a text file, in the same format as rlm_detail.
+ */
+static int detail_text_write(FILE *fp, detail_record_t const *record)
+{
+	char		buffer[1024];
+	size_t		len;
+	struct tm	tm;
+	VALUE_PAIR	*vp;
+	vp_cursor_t	cursor;
+	RADIUS_PACKET	*packet = record->packet;
+
+	if (!localtime_r(&record->timestamp, &tm)) return -1;
+	strftime(buffer, sizeof(buffer), "%a %b %e %H:%M:%S %Y", &tm);
+	fprintf(fp, "%s\n", buffer);
+
+	if (packet->code != PW_CODE_ACCOUNTING_REQUEST) {
+		if (is_radius_code(packet->code)) {
+			fprintf(fp, "\tPacket-Type = %s\n", fr_packet_codes[packet->code]);
+		} else {
+			fprintf(fp, "\tPacket-Type = %u\n", packet->code);
+		}
+	}
+
+	if (packet->src_ipaddr.af != AF_UNSPEC) {
+		inet_ntop(packet->src_ipaddr.af, &packet->src_ipaddr.ipaddr, buffer, sizeof(buffer));
+		fprintf(fp, "\tPacket-Src-IP%s-Address = %s\n",
+			(packet->src_ipaddr.af == AF_INET6) ? "v6" : "", buffer);
+	}
+	if (packet->dst_ipaddr.af != AF_UNSPEC) {
+		inet_ntop(packet->dst_ipaddr.af, &packet->dst_ipaddr.ipaddr, buffer, sizeof(buffer));
+		fprintf(fp, "\tPacket-Dst-IP%s-Address = %s\n",
+			(packet->dst_ipaddr.af == AF_INET6) ? "v6" : "", buffer);
+	}
+	if ((packet->src_ipaddr.af != AF_UNSPEC) || (packet->dst_ipaddr.af != AF_UNSPEC)) {
+		fprintf(fp, "\tPacket-Src-Port = %u\n", packet->src_port);
+		fprintf(fp, "\tPacket-Dst-Port = %u\n", packet->dst_port);
+	}
+
+	for (vp = fr_cursor_init(&cursor, &packet->vps);
+	     vp;
+	     vp = fr_cursor_next(&cursor)) {
+		len = vp_prints(buffer, sizeof(buffer) - 1, vp);
+		if (!len) continue;
+
+		if (len >= (sizeof(buffer) - 2)) len = sizeof(buffer) - 2;
+		fprintf(fp, "\t%.*s\n", (int) len, buffer);
+	}
+
+	/*
+	 *	The detail file reader marks entries as done by
+	 *	overwriting "Time" with "Done".
+	 */
+	fprintf(fp, "\t%sstamp = %ld\n\n", record->done ? "Done" : "Time", (long) record->timestamp);
+
+	return ferror(fp) ? -1 : 0;
+}
+
+/*
+ *	Write an entry to a binary file.
+ */
+static int detail_binary_write(FILE *fp, detail_record_t const *record)
+{
+	uint8_t		*data;
+	ssize_t		len;
+	RADIUS_PACKET	*packet = record->packet;
+
+	len = detail_binary_encode(packet, &data, packet, packet->vps,
+				   (packet->src_ipaddr.af != AF_UNSPEC) || (packet->dst_ipaddr.af != AF_UNSPEC),
+				   record->timestamp);
+	if (len < 0) return -1;
+
+	if (record->done) data[DETAIL_BINARY_FLAGS_OFFSET] |= DETAIL_BINARY_DONE;
+
+	if (fwrite(data, len, 1, fp) != 1) {
+		fr_strerror_printf("%s", fr_syserror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+typedef int (*detail_write_t)(FILE *fp, detail_record_t const *record);
+
+/*
+ *	Set the packet addresses from the attributes which
+ *	rlm_detail writes with "log_packet_header = yes".
+ */
+static bool detail_text_address(RADIUS_PACKET *packet, VALUE_PAIR const *vp)
+{
+	if (vp->da->vendor) return false;
+
+	switch (vp->da->attr) {
+	case PW_PACKET_SRC_IP_ADDRESS:
+		packet->src_ipaddr.af = AF_INET;
+		packet->src_ipaddr.ipaddr.ip4addr.s_addr = vp->vp_ipaddr;
+		return true;
+
+	case PW_PACKET_DST_IP_ADDRESS:
+		packet->dst_ipaddr.af = AF_INET;
+		packet->dst_ipaddr.ipaddr.ip4addr.s_addr = vp->vp_ipaddr;
+		return true;
+
+	case PW_PACKET_SRC_IPV6_ADDRESS:
+		packet->src_ipaddr.af = AF_INET6;
+		memcpy(&packet->src_ipaddr.ipaddr.ip6addr, &vp->vp_ipv6addr, sizeof(vp->vp_ipv6addr));
+		return true;
+
+	case PW_PACKET_DST_IPV6_ADDRESS:
+		packet->dst_ipaddr.af = AF_INET6;
+		memcpy(&packet->dst_ipaddr.ipaddr.ip6addr, &vp->vp_ipv6addr, sizeof(vp->vp_ipv6addr));
+		return true;
+
+	case PW_PACKET_SRC_PORT:
+		packet->src_port = vp->vp_integer;
+		return true;
+
+	case PW_PACKET_DST_PORT:
+		packet->dst_port = vp->vp_integer;
+		return true;
+
+	case PW_PACKET_TYPE:
+		packet->code = vp->vp_integer;
+		return true;
+
+	default:
+		break;
+	}
+
+	return false;
+}
+
+/*
+ *	Read a text file, in the same way as the detail file reader.
+ */
+static int detail_text_convert(TALLOC_CTX *ctx, char *text, FILE *out, detail_write_t write_record,
+			       detail_count_t *count)
+{
+	char		*line, *next;
+	bool		header = true;
+	fr_ipaddr_t	client_ip;
+	detail_record_t	record;
+	vp_cursor_t	cursor;
+
+	memset(&record, 0, sizeof(record));
+	memset(&client_ip, 0, sizeof(client_ip));
+
+	for (line = text; line && *line; line = next) {
+		char		key[256], op[8], value[1024];
+		VALUE_PAIR	*vp;
+
+		next = strchr(line, '\n');
+		if (!next) break;
+		*(next++) = '\0';
+
+		if (header) {
+			if (!*line) continue;
+
+			record.packet = rad_alloc(ctx, false);
+			if (!record.packet) {
+				fr_strerror_printf("Out of memory");
+				return -1;
+			}
+			record.packet->code = PW_CODE_ACCOUNTING_REQUEST;
+			record.timestamp = 0;
+			record.done = false;
+			client_ip.af = AF_UNSPEC;
+			fr_cursor_init(&cursor, &record.packet->vps);
+			header = false;
+			continue;
+		}
+
+		/*
+		 *	A blank line is the end of the entry.
+		 */
+		if (!*line) {
+			/*
+			 *	The detail file reader uses the client
+			 *	address if the source wasn't logged.
+			 */
+			if ((record.packet->src_ipaddr.af == AF_UNSPEC) && (client_ip.af != AF_UNSPEC)) {
+				record.packet->src_ipaddr = client_ip;
+			}
+
+			if (write_record(out, &record) < 0) {
+				fprintf(stderr, "%s: Skipping entry for timestamp %ld: %s\n",
+					progname, (long) record.timestamp, fr_strerror());
+				count->skipped++;
+			} else {
+				count->entries++;
+			}
+
+			talloc_free(record.packet);
+			record.packet = NULL;
+			header = true;
+			continue;
+		}
+
+		if (sscanf(line, "%255s %7s %1023s", key, op, value) != 3) continue;
+		if (!strchr(op, '=')) continue;
+
+		if (!strcasecmp(key, "Request-Authenticator")) continue;
+
+		if (!strcasecmp(key, "Client-IP-Address")) {
+			client_ip.af = AF_INET;
+			if (ip_hton(&client_ip, AF_INET, value, false) < 0) client_ip.af = AF_UNSPEC;
+			continue;
+		}
+
+		if (!strcasecmp(key, "Timestamp")) {
+			record.timestamp = atol(value);
+			continue;
+		}
+
+		if (!strcasecmp(key, "Donestamp")) {
+			record.timestamp = atol(value);
+			record.done = true;
+			continue;
+		}
+
+		vp = NULL;
+		if ((fr_pair_list_afrom_str(record.packet, line, &vp) <= 0) || !vp) {
+			fprintf(stderr, "%s: Skipping line - %s: %s\n", progname, line, fr_strerror());
+			continue;
+		}
+
+		if (detail_text_address(record.packet, vp)) {
+			fr_pair_list_free(&vp);
+			continue;
+		}
+
+		fr_cursor_merge(&cursor, vp);
+	}
+
+	/*
+	 *	The writer doesn't check that the entry was completely
+	 *	written, so the last one may be truncated.
+	 */
+	if (record.packet) {
+		fprintf(stderr, "%s: Ignoring truncated entry at end of file\n", progname);
+		talloc_free(record.packet);
+	}
+
+	return 0;
+}
+
+/*
+ *	Read a binary file, in the same way as the detail file reader.
+ */
+static int detail_binary_convert(TALLOC_CTX *ctx, uint8_t const *data, size_t size, FILE *out,
+				 detail_write_t write_record, detail_count_t *count)
+{
+	size_t		offset, skipped = 0;
+	ssize_t		len;
+	detail_record_t	record;
+
+	for (offset = DETAIL_BINARY_HEADER_LEN; offset < size; offset += len) {
+		len = detail_binary_check(data + offset, size - offset);
+		if (len == 0) {
+			fprintf(stderr, "%s: Ignoring truncated record at end of file\n", progname);
+			break;
+		}
+
+		if (len < 0) {
+			skipped++;
+			len = 1;
+			continue;
+		}
+
+		if (skipped) {
+			fprintf(stderr, "%s: Skipping %zu bytes of bad data at offset %zu\n",
+				progname, skipped, offset - skipped);
+			skipped = 0;
+		}
+
+		record.packet = detail_binary_decode(ctx, data + offset, &record.done);
+		if (!record.packet) {
+			fprintf(stderr, "%s: Skipping bad record at offset %zu: %s\n", progname, offset, fr_strerror());
+			count->skipped++;
+			continue;
+		}
+		record.timestamp = record.packet->timestamp.tv_sec;
+
+		if (write_record(out, &record) < 0) {
+			fprintf(stderr, "%s: Skipping record at offset %zu: %s\n", progname, offset, fr_strerror());
+			count->skipped++;
+		} else {
+			count->entries++;
+		}
+
+		talloc_free(record.packet);
+	}
+
+	if (skipped) {
+		fprintf(stderr, "%s: Skipping %zu bytes of bad data at offset %zu\n",
+			progname, skipped, offset - skipped);
+	}
+
+	return 0;
+}
+
+/*
+ *	Read all of a file into memory.
+ */
+static uint8_t *detail_read(TALLOC_CTX *ctx, FILE *fp, size_t *size)
+{
+	uint8_t	*data;
+	size_t	len, used = 0, room = 65536;
+
+	data = talloc_array(ctx, uint8_t, room + 1);
+	if (!data) return NULL;
+
+	while ((len = fread(data + used, 1, room - used, fp)) > 0) {
+		used += len;
+		if (used < room) continue;
+
+		room *= 2;
+		data = talloc_realloc(ctx, data, uint8_t, room + 1);
+		if (!data) return NULL;
+	}
+
+	if (ferror(fp)) {
+		talloc_free(data);
+		return NULL;
+	}
+
+	data[used] = '\0';
+	*size = used;
+
+	return data;
+}
+
+int main(int argc, char *argv[])
+{
+	int		c;
+	int		format = 0;
+	bool		binary;
+	char const	*dict_dir = DICTDIR;
+	char const	*in_name = "-", *out_name = "-";
+	FILE		*in = stdin, *out = stdout;
+	uint8_t		*data;
+	size_t		size;
+	detail_count_t	count;
+	TALLOC_CTX	*ctx;
+
+	if ((progname = strrchr(argv[0], FR_DIR_SEP)) == NULL) {
+		progname = argv[0];
+	} else {
+		progname++;
+	}
+
+	fr_debug_lvl = 0;
+	fr_log_fp = stderr;
+
+	while ((c = getopt(argc, argv, "bD:htx")) != EOF) switch (c) {
+		case 'b':
+			format = 'b';
+			break;
+
+		case 'D':
+			dict_dir = optarg;
+			break;
+
+		case 'h':
+			usage(0);
+
+		case 't':
+			format = 't';
+			break;
+
+		case 'x':
+			fr_debug_lvl++;
+			break;
+
+		default:
+			usage(1);
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (argc > 2) usage(1);
+	if (argc > 0) in_name = argv[0];
+	if (argc > 1) out_name = argv[1];
+
+	if (dict_init(dict_dir, RADIUS_DICTIONARY) < 0) {
+		fr_perror("raddetail");
+		exit(1);
+	}
+
+	ctx = talloc_init("raddetail");
+
+	if (strcmp(in_name, "-") != 0) {
+		in = fopen(in_name, "r");
+		if (!in) {
+			fprintf(stderr, "%s: Failed opening %s: %s\n", progname, in_name, fr_syserror(errno));
+			exit(1);
+		}
+	}
+
+	data = detail_read(ctx, in, &size);
+	if (!data) {
+		fprintf(stderr, "%s: Failed reading %s: %s\n", progname, in_name, fr_syserror(errno));
+		exit(1);
+	}
+	if (in != stdin) fclose(in);
+
+	binary = detail_binary_is_header(data, size);
+	if (!format) format = binary ? 't' : 'b';
+
+	if (strcmp(out_name, "-") != 0) {
+		out = fopen(out_name, "w");
+		if (!out) {
+			fprintf(stderr, "%s: Failed opening %s: %s\n", progname, out_name, fr_syserror(errno));
+			exit(1);
+		}
+	}
+
+	if (format == 'b') {
+		uint8_t header[DETAIL_BINARY_HEADER_LEN];
+
+		detail_binary_header(header);
+		fwrite(header, sizeof(header), 1, out);
+	}
+
+	memset(&count, 0, sizeof(count));
+	if (binary) {
+		detail_binary_convert(ctx, data, size, out,
+				      (format == 'b') ? detail_binary_write : detail_text_write, &count);
+	} else {
+		detail_text_convert(ctx, (char *) data, out,
+				    (format == 'b') ? detail_binary_write : detail_text_write, &count);
+	}
+
+	if ((fflush(out) != 0) || ferror(out)) {
+		fprintf(stderr, "%s: Failed writing %s: %s\n", progname, out_name, fr_syserror(errno));
+		exit(1);
+	}
+	if (out != stdout) fclose(out);
+
+	if (fr_debug_lvl || count.skipped) {
+		fprintf(stderr, "%s: Converted %u entries, skipped %u\n", progname, count.entries, count.skipped);
+	}
+
+	talloc_free(ctx);
+	dict_free();
+
+	return count.skipped ? 2 : 0;
+}
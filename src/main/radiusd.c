@@ -527,6 +527,11 @@ int main(int argc, char *argv[])
 		exit(EXIT_FAILURE);
 	}
 
+	/*
+	 *  Write log messages from a separate thread.
+	 */
+	if (radlog_async_start() < 0) exit(EXIT_FAILURE);
+
 	event_loop_started = true;
 
 	/*
@@ -686,9 +691,17 @@ cleanup:
 	modules_free();
 
 	xlat_free();		/* modules may have xlat's */
+#ifdef HAVE_REGEX
+	regex_cache_free();
+#endif
 
 	fr_state_delete(state);
 
+	/*
+	 *  Write any queued log messages.
+	 */
+	radlog_async_stop();
+
 	/*
 	 *  Free the configuration items.
 	 */
@@ -28,6 +28,8 @@ RCSID("$Id$")
 #include <freeradius-devel/radiusd.h>
 #include <freeradius-devel/rad_assert.h>
 
+#include <ctype.h>
+
 #ifdef HAVE_REGEX
 
 #define REQUEST_DATA_REGEX (0xadbeef00)
@@ -39,6 +41,266 @@ typedef struct regcapture {
 	size_t		nmatch;		//!< Number of match vectors.
 } regcapture_t;
 
+/*
+ *	Patterns which are built at run time by expanding an xlat are
+ *	usually the same for many requests, so we keep the most
+ *	recently used ones compiled, and share them between threads.
+ */
+#define REGEX_CACHE_SIZE (256)
+
+typedef struct regex_cache_entry {
+	char const		*pattern;	//!< Pattern text.
+	size_t			len;		//!< Length of the pattern.
+	bool			ignore_case;	//!< Compiled case insensitive.
+	bool			multiline;	//!< Compiled multiline.
+
+	regex_t			*preg;		//!< Compiled pattern.
+	uint32_t		refs;		//!< Users of the entry, +1 whilst it's in the cache.
+
+	struct regex_cache_entry *prev;		//!< More recently used.
+	struct regex_cache_entry *next;		//!< Less recently used.
+} regex_cache_entry_t;
+
+static fr_hash_table_t		*regex_cache;
+static regex_cache_entry_t	*regex_cache_head;
+static regex_cache_entry_t	*regex_cache_tail;
+static uint32_t			regex_cache_num;
+
+#ifdef HAVE_PTHREAD_H
+static pthread_mutex_t		regex_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+#  define PTHREAD_MUTEX_LOCK pthread_mutex_lock
+#  define PTHREAD_MUTEX_UNLOCK pthread_mutex_unlock
+#else
+#  define PTHREAD_MUTEX_LOCK(_x)
+#  define PTHREAD_MUTEX_UNLOCK(_x)
+#endif
+
+static uint32_t regex_cache_hash(void const *data)
+{
+	regex_cache_entry_t const *entry = data;
+	uint32_t hash;
+
+	hash = fr_hash(entry->pattern, entry->len);
+	hash = fr_hash_update(&entry->ignore_case, sizeof(entry->ignore_case), hash);
+
+	return fr_hash_update(&entry->multiline, sizeof(entry->multiline), hash);
+}
+
+static int regex_cache_cmp(void const *one, void const *two)
+{
+	regex_cache_entry_t const *a = one, *b = two;
+
+	if (a->len != b->len) return (a->len < b->len) ? -1 : 1;
+	if (a->ignore_case != b->ignore_case) return a->ignore_case - b->ignore_case;
+	if (a->multiline != b->multiline) return a->multiline - b->multiline;
+
+	return memcmp(a->pattern, b->pattern, a->len);
+}
+
+/*
+ *	Must be called with the mutex held.
+ */
+static void regex_cache_unlink(regex_cache_entry_t *entry)
+{
+	if (entry->prev) {
+		entry->prev->next = entry->next;
+	} else {
+		regex_cache_head = entry->next;
+	}
+
+	if (entry->next) {
+		entry->next->prev = entry->prev;
+	} else {
+		regex_cache_tail = entry->prev;
+	}
+
+	entry->prev = entry->next = NULL;
+}
+
+static void regex_cache_link(regex_cache_entry_t *entry)
+{
+	entry->prev = NULL;
+	entry->next = regex_cache_head;
+	if (regex_cache_head) regex_cache_head->prev = entry;
+	regex_cache_head = entry;
+	if (!regex_cache_tail) regex_cache_tail = entry;
+}
+
+/*
+ *	The entry a pattern came from, or NULL if it didn't come
+ *	from the cache.
+ */
+static regex_cache_entry_t *regex_cache_entry(regex_t *preg)
+{
+	void *parent;
+
+	parent = talloc_parent(preg);
+	if (!parent) return NULL;
+
+	return talloc_get_type(parent, regex_cache_entry_t);
+}
+
+/** Compile a pattern, or get it from the cache of patterns compiled at run time
+ *
+ * @note The pattern must be released with #regex_cache_release, and not freed.
+ *
+ * @param[out] out Where to write the compiled pattern.
+ * @param[in] pattern to compile.
+ * @param[in] len of pattern.
+ * @param[in] ignore_case Whether the match should be case insensitive.
+ * @param[in] multiline If true $ matches newlines.
+ * @return >= 1 on success, <= 0 on error, as for regex_compile.
+ */
+ssize_t regex_cache_compile(regex_t **out, char const *pattern, size_t len, bool ignore_case, bool multiline)
+{
+	regex_cache_entry_t	find, *entry, *old;
+	ssize_t			slen;
+
+	*out = NULL;
+
+	memset(&find, 0, sizeof(find));
+	find.pattern = pattern;
+	find.len = len;
+	find.ignore_case = ignore_case;
+	find.multiline = multiline;
+
+	PTHREAD_MUTEX_LOCK(&regex_cache_mutex);
+	if (!regex_cache) {
+		regex_cache = fr_hash_table_create(regex_cache_hash, regex_cache_cmp, NULL);
+		if (!regex_cache) {
+			PTHREAD_MUTEX_UNLOCK(&regex_cache_mutex);
+			fr_strerror_printf("Failed creating regex cache");
+			return 0;
+		}
+	}
+
+	entry = fr_hash_table_finddata(regex_cache, &find);
+	if (entry) {
+	found:
+		regex_cache_unlink(entry);
+		regex_cache_link(entry);
+		entry->refs++;
+		PTHREAD_MUTEX_UNLOCK(&regex_cache_mutex);
+
+		*out = entry->preg;
+		return len;
+	}
+	PTHREAD_MUTEX_UNLOCK(&regex_cache_mutex);
+
+	/*
+	 *	Compile without the lock held, so other threads can
+	 *	still use the cache.  The pattern will be used again, so
+	 *	it's worth studying it.
+	 */
+	entry = talloc_zero(NULL, regex_cache_entry_t);
+	if (!entry) return 0;
+
+	entry->pattern = talloc_bstrndup(entry, pattern, len);
+	entry->len = len;
+	entry->ignore_case = ignore_case;
+	entry->multiline = multiline;
+
+	slen = regex_compile(entry, &entry->preg, entry->pattern, len, ignore_case, multiline, true, false);
+	if (slen <= 0) {
+		talloc_free(entry);
+		return slen;
+	}
+	entry->refs = 2;
+
+	PTHREAD_MUTEX_LOCK(&regex_cache_mutex);
+
+	/*
+	 *	Another thread compiled the same pattern whilst we
+	 *	were compiling it.  Use theirs.
+	 */
+	old = fr_hash_table_finddata(regex_cache, entry);
+	if (old) {
+		talloc_free(entry);
+		entry = old;
+		goto found;
+	}
+
+	if (!fr_hash_table_insert(regex_cache, entry)) {
+		PTHREAD_MUTEX_UNLOCK(&regex_cache_mutex);
+		talloc_free(entry);
+		fr_strerror_printf("Failed inserting pattern into regex cache");
+		return 0;
+	}
+	regex_cache_link(entry);
+	regex_cache_num++;
+
+	/*
+	 *	Evict the least recently used patterns.  Ones which
+	 *	are still in use are freed by the last user.
+	 */
+	while (regex_cache_num > REGEX_CACHE_SIZE) {
+		old = regex_cache_tail;
+
+		regex_cache_unlink(old);
+		fr_hash_table_delete(regex_cache, old);
+		regex_cache_num--;
+
+		if (--old->refs == 0) talloc_free(old);
+	}
+	PTHREAD_MUTEX_UNLOCK(&regex_cache_mutex);
+
+	*out = entry->preg;
+	return len;
+}
+
+/** Release a pattern returned by #regex_cache_compile
+ *
+ * @param[in] preg to release.
+ */
+void regex_cache_release(regex_t *preg)
+{
+	regex_cache_entry_t	*entry;
+	uint32_t		refs;
+
+	if (!preg) return;
+
+	entry = regex_cache_entry(preg);
+	rad_assert(entry != NULL);
+
+	PTHREAD_MUTEX_LOCK(&regex_cache_mutex);
+	refs = --entry->refs;
+	PTHREAD_MUTEX_UNLOCK(&regex_cache_mutex);
+
+	if (refs == 0) talloc_free(entry);
+}
+
+/** Free the cache of patterns compiled at run time
+ *
+ * Patterns still in use are freed when they're released.
+ */
+void regex_cache_free(void)
+{
+	regex_cache_entry_t *entry;
+
+	PTHREAD_MUTEX_LOCK(&regex_cache_mutex);
+	while ((entry = regex_cache_head) != NULL) {
+		regex_cache_unlink(entry);
+		if (--entry->refs == 0) talloc_free(entry);
+	}
+	regex_cache_num = 0;
+
+	fr_hash_table_free(regex_cache);
+	regex_cache = NULL;
+	PTHREAD_MUTEX_UNLOCK(&regex_cache_mutex);
+}
+
+/*
+ *	Drop the reference the subcapture data holds on a cached
+ *	pattern.
+ */
+static int _regcapture_free(regcapture_t *sc)
+{
+	regex_cache_release(sc->preg);
+
+	return 0;
+}
+
 /** Adds subcapture values to request data
  *
  * Allows use of %{n} expansions.
@@ -56,6 +318,7 @@ void regex_sub_to_request(REQUEST *request, regex_t **preg, char const *value, s
 			  regmatch_t rxmatch[], size_t nmatch)
 {
 	regcapture_t *old_sc, *new_sc;	/* lldb doesn't like new *sigh* */
+	regex_cache_entry_t *entry;
 	char *p;
 
 	/*
@@ -90,6 +353,19 @@ void regex_sub_to_request(REQUEST *request, regex_t **preg, char const *value, s
 	new_sc->value = p;
 	new_sc->nmatch = nmatch;
 
+	/*
+	 *	Patterns from the cache may be evicted whilst we're
+	 *	still using them, so take a reference.
+	 */
+	entry = regex_cache_entry(*preg);
+	if (entry) {
+		PTHREAD_MUTEX_LOCK(&regex_cache_mutex);
+		entry->refs++;
+		PTHREAD_MUTEX_UNLOCK(&regex_cache_mutex);
+
+		new_sc->preg = *preg;
+		talloc_set_destructor(new_sc, _regcapture_free);
+	} else
 #ifdef HAVE_PCRE
 	if (!(*preg)->precompiled) {
 		new_sc->preg = talloc_steal(new_sc, *preg);
@@ -275,4 +551,366 @@ int regex_request_to_sub(TALLOC_CTX *ctx, char **out, REQUEST *request, uint32_t
 	return 0;
 }
 #  endif
+
+/*
+ *	Prefilter for if / elsif chains which match the same
+ *	attribute against many regular expressions.
+ *
+ *	For each pattern we find the longest literal which any match
+ *	must contain, and put all of the literals into one Aho-Corasick
+ *	automaton.  One pass over the value then tells us which
+ *	patterns can't match, so we don't need to run them.
+ */
+typedef struct regex_prefilter_node {
+	uint32_t		child;		//!< First child, or 0.
+	uint32_t		sibling;	//!< Next child of our parent, or 0.
+	uint32_t		fail;		//!< Longest proper suffix which is also in the trie.
+	uint32_t		output;		//!< Nearest node on the fail chain which ends a literal, or 0.
+	int			literal;	//!< Literal which ends at this node, or -1.
+	uint8_t			c;		//!< Byte which leads to this node.
+} regex_prefilter_node_t;
+
+struct regex_prefilter {
+	regex_prefilter_node_t	*nodes;		//!< Node 0 is the root.
+	uint32_t		num_nodes;
+	int			num_literals;
+};
+
+/*
+ *	Which literals the last value we scanned contained.
+ */
+typedef struct regex_prefilter_result {
+	char const		*value;
+	size_t			len;
+	uint8_t			*found;
+} regex_prefilter_result_t;
+
+#define REGEX_LITERAL_MAX (64)
+
+/*
+ *	Find the longest literal which any match of the pattern must
+ *	contain.  This is conservative.  It only looks outside of
+ *	groups, and gives up on alternation.  Literals are folded to
+ *	lower case, as the scan is case insensitive.
+ */
+static size_t regex_literal(char *out, char const *pattern, size_t len)
+{
+	char const	*p = pattern, *end = pattern + len;
+	char		run[REGEX_LITERAL_MAX];
+	size_t		run_len = 0, best = 0;
+	int		depth = 0;
+	bool		literal = false;
+
+#define END_RUN do { \
+	if (run_len > best) { \
+		memcpy(out, run, run_len); \
+		best = run_len; \
+	} \
+	run_len = 0; \
+} while (0)
+
+	while (p < end) {
+		int c = (uint8_t) *p++;
+
+		switch (c) {
+		case '|':
+			return 0;
+
+		case '\\':
+			if (p == end) return 0;
+			c = (uint8_t) *p++;
+
+			/*
+			 *	\d, \w, back references, etc.
+			 */
+			if (isalnum(c)) {
+				END_RUN;
+				literal = false;
+				break;
+			}
+			goto add;
+
+		case '[':
+			END_RUN;
+			literal = false;
+
+			if ((p < end) && (*p == '^')) p++;
+			if ((p < end) && (*p == ']')) p++;
+			while ((p < end) && (*p != ']')) {
+				if ((*p == '\\') && ((p + 1) < end)) p++;
+				p++;
+			}
+			if (p == end) return 0;
+			p++;
+			break;
+
+		case '(':
+			END_RUN;
+			literal = false;
+			depth++;
+
+			/*
+			 *	(?x) makes white space in the pattern
+			 *	insignificant.
+			 */
+			if ((p < end) && (*p == '?')) {
+				char const *q;
+
+				for (q = p + 1; (q < end) && (isalpha((uint8_t) *q) || (*q == '-')); q++) {
+					if (*q == 'x') return 0;
+				}
+			}
+			break;
+
+		case ')':
+			END_RUN;
+			literal = false;
+			depth--;
+			break;
+
+		/*
+		 *	The previous byte is optional.
+		 */
+		case '*':
+		case '?':
+		case '{':
+			if (literal && run_len) run_len--;
+			END_RUN;
+			literal = false;
+
+			if (c == '{') {
+				while ((p < end) && (*p != '}')) p++;
+				if (p == end) return 0;
+				p++;
+			}
+			break;
+
+		/*
+		 *	The previous byte is required, but may repeat.
+		 */
+		case '+':
+			END_RUN;
+			literal = false;
+			break;
+
+		case '.':
+		case '^':
+		case '$':
+			END_RUN;
+			literal = false;
+			break;
+
+		default:
+		add:
+			if (depth > 0) {
+				literal = false;
+				break;
+			}
+
+			if (run_len == sizeof(run)) {
+				END_RUN;
+			}
+			run[run_len++] = tolower(c);
+			literal = true;
+			break;
+		}
+	}
+	END_RUN;
+
+#undef END_RUN
+
+	return best;
+}
+
+/** Allocate a prefilter for a chain of regular expressions
+ *
+ * @param[in] ctx to allocate the prefilter in.
+ * @return a new prefilter, or NULL on error.
+ */
+regex_prefilter_t *regex_prefilter_alloc(TALLOC_CTX *ctx)
+{
+	regex_prefilter_t *pf;
+
+	pf = talloc_zero(ctx, regex_prefilter_t);
+	if (!pf) return NULL;
+
+	pf->nodes = talloc_zero_array(pf, regex_prefilter_node_t, 1);
+	if (!pf->nodes) {
+		talloc_free(pf);
+		return NULL;
+	}
+	pf->nodes[0].literal = -1;
+	pf->num_nodes = 1;
+
+	return pf;
+}
+
+static uint32_t regex_prefilter_child(regex_prefilter_t const *pf, uint32_t node, uint8_t c)
+{
+	uint32_t child;
+
+	for (child = pf->nodes[node].child; child; child = pf->nodes[child].sibling) {
+		if (pf->nodes[child].c == c) return child;
+	}
+
+	return 0;
+}
+
+/** Add a pattern to the prefilter
+ *
+ * Must be called before #regex_prefilter_build.
+ *
+ * @param[in] pf to add the pattern to.
+ * @param[in] pattern to add.
+ * @param[in] len of pattern.
+ * @return the literal to pass to #regex_prefilter_match, or -1 if the pattern
+ *	has no literal, and can't be filtered.
+ */
+int regex_prefilter_add(regex_prefilter_t *pf, char const *pattern, size_t len)
+{
+	char		literal[REGEX_LITERAL_MAX];
+	size_t		literal_len, i;
+	uint32_t	node = 0;
+
+	literal_len = regex_literal(literal, pattern, len);
+	if (!literal_len) return -1;
+
+	for (i = 0; i < literal_len; i++) {
+		uint32_t child;
+
+		child = regex_prefilter_child(pf, node, literal[i]);
+		if (!child) {
+			regex_prefilter_node_t *nodes;
+
+			nodes = talloc_realloc(pf, pf->nodes, regex_prefilter_node_t, pf->num_nodes + 1);
+			if (!nodes) return -1;
+			pf->nodes = nodes;
+
+			child = pf->num_nodes++;
+			memset(&pf->nodes[child], 0, sizeof(pf->nodes[child]));
+			pf->nodes[child].c = literal[i];
+			pf->nodes[child].literal = -1;
+			pf->nodes[child].sibling = pf->nodes[node].child;
+			pf->nodes[node].child = child;
+		}
+		node = child;
+	}
+
+	/*
+	 *	Patterns with the same literal share it.
+	 */
+	if (pf->nodes[node].literal < 0) pf->nodes[node].literal = pf->num_literals++;
+
+	return pf->nodes[node].literal;
+}
+
+/** Build the failure links once all of the patterns have been added
+ *
+ * @param[in] pf to build.
+ * @return 0 on success, -1 on error.
+ */
+int regex_prefilter_build(regex_prefilter_t *pf)
+{
+	uint32_t	*queue, head = 0, tail = 0;
+	uint32_t	child;
+
+	queue = talloc_array(pf, uint32_t, pf->num_nodes);
+	if (!queue) return -1;
+
+	/*
+	 *	Breadth first, so the fail node of each node is
+	 *	finished before we look at its children.
+	 */
+	for (child = pf->nodes[0].child; child; child = pf->nodes[child].sibling) {
+		pf->nodes[child].fail = 0;
+		queue[tail++] = child;
+	}
+
+	while (head < tail) {
+		uint32_t node = queue[head++];
+
+		for (child = pf->nodes[node].child; child; child = pf->nodes[child].sibling) {
+			uint32_t fail = pf->nodes[node].fail;
+			uint32_t next;
+
+			while (fail && !regex_prefilter_child(pf, fail, pf->nodes[child].c)) fail = pf->nodes[fail].fail;
+
+			next = regex_prefilter_child(pf, fail, pf->nodes[child].c);
+			pf->nodes[child].fail = (next != child) ? next : 0;
+
+			fail = pf->nodes[child].fail;
+			pf->nodes[child].output = (pf->nodes[fail].literal >= 0) ? fail : pf->nodes[fail].output;
+
+			queue[tail++] = child;
+		}
+	}
+
+	talloc_free(queue);
+
+	return 0;
+}
+
+/** Check whether a pattern in the chain could match a value
+ *
+ * The value is scanned once for the literals of all the patterns in the
+ * chain, and the result is kept with the request for the next pattern.
+ *
+ * @param[in] request the chain is being evaluated for.
+ * @param[in] pf of the chain.
+ * @param[in] literal returned by #regex_prefilter_add for the pattern.
+ * @param[in] value to be matched.
+ * @param[in] len of value.
+ * @return false if the pattern can't match the value, else true.
+ */
+bool regex_prefilter_match(REQUEST *request, regex_prefilter_t const *pf, int literal,
+			   char const *value, size_t len)
+{
+	regex_prefilter_result_t	*result;
+	void				*unique;
+	char const			*p, *end;
+	uint32_t			node = 0;
+
+	if (!pf || (literal < 0)) return true;
+
+	memcpy(&unique, &pf, sizeof(unique));
+
+	result = request_data_reference(request, unique, 0);
+	if (result && (result->len == len) && (memcmp(result->value, value, len) == 0)) {
+		return result->found[literal];
+	}
+
+	result = talloc_zero(request, regex_prefilter_result_t);
+	if (!result) return true;
+
+	result->value = talloc_memdup(result, value, len);
+	result->len = len;
+	result->found = talloc_zero_array(result, uint8_t, pf->num_literals);
+	if (!result->value || !result->found) {
+		talloc_free(result);
+		return true;
+	}
+
+	for (p = value, end = value + len; p < end; p++) {
+		uint8_t c = tolower((uint8_t) *p);
+		uint32_t out;
+
+		while (node && !regex_prefilter_child(pf, node, c)) node = pf->nodes[node].fail;
+		node = regex_prefilter_child(pf, node, c);
+
+		for (out = (pf->nodes[node].literal >= 0) ? node : pf->nodes[node].output;
+		     out;
+		     out = pf->nodes[out].output) {
+			result->found[pf->nodes[out].literal] = 1;
+		}
+	}
+
+	if (request_data_add(request, unique, 0, result, true) < 0) {
+		bool found = result->found[literal];
+
+		talloc_free(result);
+		return found;
+	}
+
+	return result->found[literal];
+}
 #endif
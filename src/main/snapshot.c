@@ -0,0 +1,526 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/*
+ * $Id$
+ *
+ * @file snapshot.c
+ * @brief Versioned data which can be reloaded while it's being used.
+ *
+ * Each version of the data is built without holding any locks, and
+ * then published by swapping an atomic pointer.  Threads take a
+ * reference to the current version for the duration of a request, so
+ * the version it replaces is only freed once the last reference to it
+ * is dropped.  Taking and dropping a reference doesn't lock anything.
+ *
+ * @copyright 2015 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/snapshot.h>
+#include <freeradius-devel/rad_assert.h>
+
+#include <sys/stat.h>
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/stdatomic.h>
+#endif
+
+#ifdef HAVE_PTHREAD_H
+#  include <sched.h>
+#endif
+
+typedef _Atomic(uint32_t) atomic_refs_t;
+typedef _Atomic(time_t) atomic_time_t;
+
+typedef struct fr_snapshot_version_t {
+	void			*data;		//!< Returned by the build function.
+	uint64_t		number;		//!< Incremented every time the data is loaded.
+	char const		*name;		//!< Of the snapshot, which may be freed first.
+	atomic_refs_t		refs;		//!< One for the snapshot while this is the current
+						//!< version, plus one for each thread using it.
+} fr_snapshot_version_t;
+
+typedef _Atomic(fr_snapshot_version_t *) atomic_version_t;
+
+typedef struct fr_snapshot_file_t {
+	char const		*filename;	//!< File the data was built from.
+	time_t			mtime;		//!< When it was last modified, as of the last load.
+} fr_snapshot_file_t;
+
+struct fr_snapshot_t {
+	char const		*name;		//!< Used to find the snapshot from radmin.
+	fr_snapshot_build_t	build;		//!< Builds a new version of the data.
+	void			*uctx;		//!< Passed to the build function.
+
+	fr_snapshot_file_t	*files;		//!< Files to check for changes.
+	uint32_t		num_files;
+	uint32_t		check_interval;	//!< How often to check the files, 0 to disable.
+	atomic_time_t		last_check;
+
+	uint64_t		loaded;		//!< Number of versions built.
+	atomic_version_t	current;	//!< The version new requests get.
+
+	atomic_refs_t		epoch;		//!< Selects which of the counters below
+						//!< threads taking a reference use.
+	atomic_refs_t		acquiring[2];	//!< Threads which may have read the current
+						//!< pointer, but not yet taken their reference.
+
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_t		mutex;		//!< Serialises loads, and protects everything
+						//!< which isn't atomic.
+	pthread_t		thread;		//!< Building the next version.
+	bool			joinable;	//!< The thread has been started, and not joined.
+	bool			reloading;	//!< The thread is still running.
+	bool			pending;	//!< Reload again when the thread is done.
+#endif
+
+	fr_snapshot_t		*next;		//!< Next registered snapshot.
+};
+
+#ifdef HAVE_PTHREAD_H
+#define PTHREAD_MUTEX_LOCK pthread_mutex_lock
+#define PTHREAD_MUTEX_UNLOCK pthread_mutex_unlock
+
+static pthread_mutex_t snapshots_mutex = PTHREAD_MUTEX_INITIALIZER;
+#else
+/*
+ *	This is easier than ifdef's throughout the code.
+ */
+#define PTHREAD_MUTEX_LOCK(_x)
+#define PTHREAD_MUTEX_UNLOCK(_x)
+#endif
+
+static fr_snapshot_t *snapshots = NULL;
+
+/** Drop a reference to a version, freeing it if it was the last one
+ *
+ */
+static void snapshot_version_unref(fr_snapshot_version_t *v)
+{
+	if (atomic_fetch_sub(&v->refs, 1) > 1) return;
+
+	DEBUG2("Freeing version %" PRIu64 " of %s", v->number, v->name);
+	talloc_free(v);
+}
+
+/** Take a reference to the current version
+ *
+ * The pointer to the current version may be swapped, and the version it
+ * pointed to freed, between us reading it and incrementing its reference
+ * count.  So we announce that we're about to read it first, and
+ * #fr_snapshot_load waits for everyone who may have read the old pointer
+ * to finish taking their reference before it drops its own.
+ *
+ * There are two counters, so that a steady stream of new readers can't
+ * keep the loader waiting.  Only readers which started before the pointer
+ * was swapped use the counter the loader waits on.
+ */
+static fr_snapshot_version_t *snapshot_version_ref(fr_snapshot_t *snap)
+{
+	uint32_t epoch;
+	fr_snapshot_version_t *v;
+
+	epoch = atomic_load(&snap->epoch) & 0x01;
+	atomic_fetch_add(&snap->acquiring[epoch], 1);
+
+	v = atomic_load(&snap->current);
+	if (v) atomic_fetch_add(&v->refs, 1);
+
+	atomic_fetch_sub(&snap->acquiring[epoch], 1);
+
+	return v;
+}
+
+static int _snapshot_free(fr_snapshot_t *snap)
+{
+	fr_snapshot_t **last;
+	fr_snapshot_version_t *v;
+
+	PTHREAD_MUTEX_LOCK(&snapshots_mutex);
+	for (last = &snapshots; *last; last = &(*last)->next) {
+		if (*last != snap) continue;
+
+		*last = snap->next;
+		break;
+	}
+	PTHREAD_MUTEX_UNLOCK(&snapshots_mutex);
+
+#ifdef HAVE_PTHREAD_H
+	/*
+	 *	Wait for any reload to finish, the thread
+	 *	uses the snapshot.
+	 */
+	PTHREAD_MUTEX_LOCK(&snap->mutex);
+	snap->pending = false;
+	PTHREAD_MUTEX_UNLOCK(&snap->mutex);
+
+	if (snap->joinable) pthread_join(snap->thread, NULL);
+	pthread_mutex_destroy(&snap->mutex);
+#endif
+
+	/*
+	 *	Any thread still using the current version
+	 *	frees it when it's done.
+	 */
+	v = atomic_exchange(&snap->current, NULL);
+	if (v) snapshot_version_unref(v);
+
+	return 0;
+}
+
+/** Initialise a snapshot
+ *
+ * The data isn't built until #fr_snapshot_load is called.
+ *
+ * @param ctx to allocate the snapshot in.
+ * @param name used to find the snapshot with #fr_snapshot_reload_by_name.
+ *	Usually the name of the module instance which owns it.
+ * @param build function to build a new version of the data.
+ * @param uctx passed to the build function.
+ * @param check_interval how often (in seconds) #fr_snapshot_acquire checks
+ *	whether any of the watched files have changed, and reloads the data if
+ *	they have.  0 disables the check.
+ * @return the new snapshot, or NULL on error.
+ */
+fr_snapshot_t *fr_snapshot_init(TALLOC_CTX *ctx, char const *name, fr_snapshot_build_t build, void *uctx,
+				uint32_t check_interval)
+{
+	fr_snapshot_t *snap;
+
+	snap = talloc_zero(ctx, fr_snapshot_t);
+	if (!snap) return NULL;
+
+	snap->name = talloc_typed_strdup(snap, name);
+	snap->build = build;
+	snap->uctx = uctx;
+	snap->check_interval = check_interval;
+	atomic_init(&snap->last_check, time(NULL));
+	atomic_init(&snap->current, NULL);
+	atomic_init(&snap->epoch, 0);
+	atomic_init(&snap->acquiring[0], 0);
+	atomic_init(&snap->acquiring[1], 0);
+
+#ifdef HAVE_PTHREAD_H
+	if (pthread_mutex_init(&snap->mutex, NULL) != 0) {
+		talloc_free(snap);
+		return NULL;
+	}
+#endif
+
+	PTHREAD_MUTEX_LOCK(&snapshots_mutex);
+	snap->next = snapshots;
+	snapshots = snap;
+	PTHREAD_MUTEX_UNLOCK(&snapshots_mutex);
+
+	talloc_set_destructor(snap, _snapshot_free);
+
+	return snap;
+}
+
+/** Add a file to check for changes
+ *
+ * @param snap to add the file to.
+ * @param filename the data is built from.
+ * @return 0 on success, -1 on error.
+ */
+int fr_snapshot_watch(fr_snapshot_t *snap, char const *filename)
+{
+	fr_snapshot_file_t *files;
+	struct stat buf;
+
+	files = talloc_realloc(snap, snap->files, fr_snapshot_file_t, snap->num_files + 1);
+	if (!files) return -1;
+
+	files[snap->num_files].filename = talloc_typed_strdup(files, filename);
+	files[snap->num_files].mtime = (stat(filename, &buf) < 0) ? 0 : buf.st_mtime;
+
+	snap->files = files;
+	snap->num_files++;
+
+	return 0;
+}
+
+/** Build a new version of the data, and make it the current version
+ *
+ * Nothing is locked while the data is built, so threads keep using the
+ * current version until the new one is ready.  If the build fails, the
+ * current version is left in place.
+ *
+ * The build function must allocate the data directly in the context it's
+ * passed, as that's how #fr_snapshot_release finds the version the data
+ * belongs to.
+ *
+ * @param snap to load.
+ * @return 0 on success, -1 if the data could not be built.
+ */
+int fr_snapshot_load(fr_snapshot_t *snap)
+{
+	uint32_t i, epoch;
+	fr_snapshot_version_t *v, *old;
+	struct stat buf;
+
+	/*
+	 *	Record the modification times first, so that
+	 *	changes made while we're building cause another
+	 *	reload.
+	 */
+	for (i = 0; i < snap->num_files; i++) {
+		time_t mtime;
+
+		mtime = (stat(snap->files[i].filename, &buf) < 0) ? 0 : buf.st_mtime;
+
+		PTHREAD_MUTEX_LOCK(&snap->mutex);
+		snap->files[i].mtime = mtime;
+		PTHREAD_MUTEX_UNLOCK(&snap->mutex);
+	}
+
+	/*
+	 *	Versions are top level contexts, as they may be
+	 *	freed by any thread.
+	 */
+	v = talloc_zero(NULL, fr_snapshot_version_t);
+	if (!v) return -1;
+	atomic_init(&v->refs, 1);
+	v->name = talloc_typed_strdup(v, snap->name);
+
+	v->data = snap->build(v, snap->uctx);
+	if (!v->data) {
+		ERROR("Failed loading %s, continuing with the previous version", snap->name);
+		talloc_free(v);
+		return -1;
+	}
+	rad_assert(talloc_parent(v->data) == v);
+
+	PTHREAD_MUTEX_LOCK(&snap->mutex);
+	v->number = ++snap->loaded;
+
+	old = atomic_exchange(&snap->current, v);
+	if (old) {
+		/*
+		 *	New readers use the other counter, and can
+		 *	only see the new version.  Wait for the ones
+		 *	which may have seen the old version to take
+		 *	their reference to it.
+		 */
+		epoch = atomic_fetch_add(&snap->epoch, 1) & 0x01;
+		while (atomic_load(&snap->acquiring[epoch]) > 0) {
+#ifdef HAVE_PTHREAD_H
+			sched_yield();
+#endif
+		}
+	}
+	PTHREAD_MUTEX_UNLOCK(&snap->mutex);
+
+	if (old) snapshot_version_unref(old);
+
+	if (v->number > 1) INFO("Loaded version %" PRIu64 " of %s", v->number, snap->name);
+
+	return 0;
+}
+
+#ifdef HAVE_PTHREAD_H
+static void *snapshot_thread(void *arg)
+{
+	fr_snapshot_t *snap = arg;
+	bool again;
+
+	do {
+		(void) fr_snapshot_load(snap);
+
+		PTHREAD_MUTEX_LOCK(&snap->mutex);
+		again = snap->pending;
+		snap->pending = false;
+		if (!again) snap->reloading = false;
+		PTHREAD_MUTEX_UNLOCK(&snap->mutex);
+	} while (again);
+
+	return NULL;
+}
+#endif
+
+/** Reload the data in the background
+ *
+ * The new version is built in a thread of its own, so the caller doesn't
+ * wait for it.  If a reload is already running, another one is started
+ * when it finishes.
+ *
+ * Without thread support, this is the same as #fr_snapshot_load.
+ *
+ * @param snap to reload.
+ * @return 0 if the reload was started, -1 on error.
+ */
+int fr_snapshot_reload(fr_snapshot_t *snap)
+{
+#ifdef HAVE_PTHREAD_H
+	int rcode;
+
+	PTHREAD_MUTEX_LOCK(&snap->mutex);
+	if (snap->reloading) {
+		snap->pending = true;
+		PTHREAD_MUTEX_UNLOCK(&snap->mutex);
+		return 0;
+	}
+
+	/*
+	 *	The previous thread has exited, or is about to.
+	 */
+	if (snap->joinable) {
+		pthread_join(snap->thread, NULL);
+		snap->joinable = false;
+	}
+
+	snap->reloading = true;
+	rcode = pthread_create(&snap->thread, NULL, snapshot_thread, snap);
+	if (rcode != 0) {
+		snap->reloading = false;
+		PTHREAD_MUTEX_UNLOCK(&snap->mutex);
+		ERROR("Failed reloading %s: %s", snap->name, fr_syserror(rcode));
+		return -1;
+	}
+	snap->joinable = true;
+	PTHREAD_MUTEX_UNLOCK(&snap->mutex);
+
+	return 0;
+#else
+	return fr_snapshot_load(snap);
+#endif
+}
+
+/** Reload the data if any of the watched files have changed
+ *
+ */
+static void snapshot_check(fr_snapshot_t *snap)
+{
+	uint32_t i;
+	time_t now = time(NULL), last;
+	struct stat buf;
+
+	last = atomic_load(&snap->last_check);
+	if ((now - last) < (time_t) snap->check_interval) return;
+
+	/*
+	 *	Only one thread checks the files.
+	 */
+	if (!atomic_compare_exchange_strong(&snap->last_check, &last, now)) return;
+
+	for (i = 0; i < snap->num_files; i++) {
+		time_t mtime;
+
+		mtime = (stat(snap->files[i].filename, &buf) < 0) ? 0 : buf.st_mtime;
+
+		PTHREAD_MUTEX_LOCK(&snap->mutex);
+		if (mtime == snap->files[i].mtime) {
+			PTHREAD_MUTEX_UNLOCK(&snap->mutex);
+			continue;
+		}
+		PTHREAD_MUTEX_UNLOCK(&snap->mutex);
+
+		INFO("%s has changed, reloading %s", snap->files[i].filename, snap->name);
+		(void) fr_snapshot_reload(snap);
+		return;
+	}
+}
+
+/** Get the current version of the data
+ *
+ * The version stays valid until it's passed to #fr_snapshot_release,
+ * even if a newer version is published in the mean time.
+ *
+ * @param snap to get the data from.
+ * @return the data, or NULL if it has never been loaded.
+ */
+void *fr_snapshot_acquire(fr_snapshot_t *snap)
+{
+	fr_snapshot_version_t *v;
+
+	if (snap->check_interval && snap->num_files) snapshot_check(snap);
+
+	v = snapshot_version_ref(snap);
+	if (!v) return NULL;
+
+	return v->data;
+}
+
+/** Drop a reference to a version of the data
+ *
+ * Frees the version if it has been replaced, and this was the last
+ * reference to it.  This is safe even if the snapshot itself has been
+ * freed since the data was acquired.
+ *
+ * @param snap the data came from.
+ * @param data returned by #fr_snapshot_acquire.
+ */
+void fr_snapshot_release(UNUSED fr_snapshot_t *snap, void *data)
+{
+	fr_snapshot_version_t *v;
+
+	if (!data) return;
+
+	v = talloc_get_type_abort(talloc_parent(data), fr_snapshot_version_t);
+	rad_assert(atomic_load(&v->refs) > 0);
+
+	snapshot_version_unref(v);
+}
+
+/** Return the number of the current version
+ *
+ */
+uint64_t fr_snapshot_version(fr_snapshot_t *snap)
+{
+	uint64_t number;
+	fr_snapshot_version_t *v;
+
+	v = snapshot_version_ref(snap);
+	if (!v) return 0;
+
+	number = v->number;
+	snapshot_version_unref(v);
+
+	return number;
+}
+
+/** Find a snapshot by name, and reload it in the background
+ *
+ * If the module which owns the snapshot has been HUP'd, there may be more
+ * than one snapshot with the same name.  The most recent one is reloaded.
+ *
+ * The list of snapshots stays locked until the reload has been started,
+ * so the snapshot can't be freed by a HUP while we're using it.
+ *
+ * @param name of the snapshot.
+ * @return 0 if the reload was started, -1 on error, -2 if no snapshot
+ *	was found.
+ */
+int fr_snapshot_reload_by_name(char const *name)
+{
+	int rcode = -2;
+	fr_snapshot_t *snap;
+
+	PTHREAD_MUTEX_LOCK(&snapshots_mutex);
+	for (snap = snapshots; snap; snap = snap->next) {
+		if (strcmp(snap->name, name) != 0) continue;
+
+		rcode = fr_snapshot_reload(snap);
+		break;
+	}
+	PTHREAD_MUTEX_UNLOCK(&snapshots_mutex);
+
+	return rcode;
+}
@@ -1860,6 +1860,7 @@ VALUE_PAIR *tmpl_cursor_init(int *err, vp_cursor_t *cursor, REQUEST *request, vp
 		if (err) *err = -2;
 		return NULL;
 	}
+
 	(void) fr_cursor_init(cursor, vps);
 
 	switch (vpt->type) {
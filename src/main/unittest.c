@@ -518,7 +518,7 @@ static ssize_t xlat_poke(UNUSED void *instance, REQUEST *request,
  */
 static bool do_xlats(char const *filename, FILE *fp)
 {
-	int		lineno = 0;
+	int		i, lineno = 0;
 	ssize_t		len;
 	char		*p;
 	char		input[8192];
@@ -591,6 +591,25 @@ static bool do_xlats(char const *filename, FILE *fp)
 			}
 
 			TALLOC_FREE(fmt); /* also frees 'head' */
+
+			/*
+			 *	radius_xlat() tokenizes the format string
+			 *	through a cache.  The first expansion adds
+			 *	it to the cache, and the second uses the
+			 *	cached copy.  Both must match the above.
+			 */
+			for (i = 0; i < 2; i++) {
+				char cached[8192];
+
+				if ((radius_xlat(cached, sizeof(cached), request, input + 5, NULL, NULL) != len) ||
+				    (strcmp(cached, output) != 0)) {
+					fprintf(stderr, "Cached expansion mismatch at line %d of %s\n"
+						"\tgot      : %s\n\texpected : %s\n",
+						lineno, filename, cached, output);
+					TALLOC_FREE(request);
+					return false;
+				}
+			}
 			continue;
 		}
 
@@ -915,6 +934,9 @@ finish:
 	xlat_unregister("poke", xlat_poke, NULL);
 
 	xlat_free();		/* modules may have xlat's */
+#ifdef HAVE_REGEX
+	regex_cache_free();
+#endif
 
 	fr_state_delete(state);
 
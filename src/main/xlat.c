@@ -70,6 +70,37 @@ struct xlat_exp {
 
 static rbtree_t *xlat_root = NULL;
 
+/** A tokenized format string, shared by all expansions of the same format
+ *
+ */
+typedef struct xlat_cache_entry {
+	char const	*fmt;		//!< Copy of the format string.
+	ssize_t		slen;		//!< What tokenizing the format string returned.
+	xlat_exp_t	*node;		//!< Tokenized format string.
+	uint32_t	refs;		//!< Number of expansions currently using node.
+	bool		retired;	//!< No longer in the cache, free once refs reaches zero.
+} xlat_cache_entry_t;
+
+/*
+ *	Format strings passed to radius_xlat() are nearly always
+ *	configuration items, but some are built at run time, so
+ *	the cache is emptied when it reaches this size.
+ */
+#define XLAT_CACHE_MAX	4096
+
+static fr_hash_table_t *xlat_cache = NULL;
+
+#ifdef HAVE_PTHREAD_H
+static pthread_mutex_t xlat_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+#  define XLAT_CACHE_LOCK pthread_mutex_lock(&xlat_cache_mutex)
+#  define XLAT_CACHE_UNLOCK pthread_mutex_unlock(&xlat_cache_mutex)
+#else
+#  define XLAT_CACHE_LOCK
+#  define XLAT_CACHE_UNLOCK
+#endif
+
+static void xlat_cache_flush(void);
+
 #ifdef WITH_UNLANG
 static char const * const xlat_foreach_names[] = {"Foreach-Variable-0",
 						  "Foreach-Variable-1",
@@ -742,6 +773,11 @@ int xlat_register(char const *name, xlat_func_t func, xlat_escape_t escape, void
 		return -1;
 	}
 
+	/*
+	 *	Cached format strings may parse differently now.
+	 */
+	xlat_cache_flush();
+
 	/*
 	 *	First time around, build up the tree...
 	 *
@@ -869,6 +905,7 @@ void xlat_unregister(char const *name, UNUSED xlat_func_t func, void *instance)
 
 	if (c->instance != instance) return;
 
+	xlat_cache_flush();
 	rbtree_deletebydata(xlat_root, c);
 }
 
@@ -883,6 +920,7 @@ static int xlat_unregister_callback(void *instance, void *data)
 
 void xlat_unregister_module(void *instance)
 {
+	xlat_cache_flush();
 	rbtree_walk(xlat_root, RBTREE_DELETE_ORDER, xlat_unregister_callback, instance);
 }
 
@@ -1121,6 +1159,7 @@ ssize_t xlat_fmt_to_ref(uint8_t const **out, REQUEST *request, char const *fmt)
  */
 void xlat_free(void)
 {
+	xlat_cache_flush();
 	rbtree_free(xlat_root);
 }
 
@@ -1738,11 +1777,12 @@ ssize_t xlat_tokenize(TALLOC_CTX *ctx, char *fmt, xlat_exp_t **head,
 
 /** Tokenize an xlat expansion
  *
- * @param[in] request the input request.  Memory will be attached here.
+ * @param[in] ctx to allocate the xlat tree in.
+ * @param[in] request the input request.  Used for logging errors.
  * @param[in] fmt the format string to expand
  * @param[out] head the head of the xlat list / tree structure.
  */
-static ssize_t xlat_tokenize_request(REQUEST *request, char const *fmt, xlat_exp_t **head)
+static ssize_t xlat_tokenize_request(TALLOC_CTX *ctx, REQUEST *request, char const *fmt, xlat_exp_t **head)
 {
 	ssize_t slen;
 	char *tokens;
@@ -1755,19 +1795,19 @@ static ssize_t xlat_tokenize_request(REQUEST *request, char const *fmt, xlat_exp
 	 *	the later functions can mangle it in-place, which is
 	 *	much faster.
 	 */
-	tokens = talloc_typed_strdup(request, fmt);
+	tokens = talloc_typed_strdup(ctx, fmt);
 	if (!tokens) {
 		error = "Out of memory";
 		return -1;
 	}
 
-	slen = xlat_tokenize_literal(request, tokens, head, false, &error);
+	slen = xlat_tokenize_literal(ctx, tokens, head, false, &error);
 
 	/*
 	 *	Zero length expansion, return a zero length node.
 	 */
 	if (slen == 0) {
-		*head = talloc_zero(request, xlat_exp_t);
+		*head = talloc_zero(ctx, xlat_exp_t);
 	}
 
 	/*
@@ -1801,6 +1841,146 @@ static ssize_t xlat_tokenize_request(REQUEST *request, char const *fmt, xlat_exp
 	return slen;
 }
 
+static uint32_t xlat_cache_hash(void const *data)
+{
+	xlat_cache_entry_t const *entry = data;
+
+	return fr_hash_string(entry->fmt);
+}
+
+static int xlat_cache_cmp(void const *one, void const *two)
+{
+	xlat_cache_entry_t const *a = one, *b = two;
+
+	return strcmp(a->fmt, b->fmt);
+}
+
+static int xlat_cache_retire(UNUSED void *ctx, void *data)
+{
+	xlat_cache_entry_t *entry = data;
+
+	if (!entry->refs) {
+		talloc_free(entry);
+	} else {
+		entry->retired = true;
+	}
+
+	return 0;
+}
+
+/** Empty the cache of tokenized format strings
+ *
+ * Must be called whenever xlats are registered or unregistered, as the tokenized
+ * format strings reference the xlat functions they call.  Entries which are in use
+ * are freed when the expansions using them complete.
+ */
+static void xlat_cache_flush(void)
+{
+	fr_hash_table_t *old;
+
+	XLAT_CACHE_LOCK;
+	old = xlat_cache;
+	xlat_cache = NULL;
+	if (old) {
+		fr_hash_table_walk(old, xlat_cache_retire, NULL);
+		fr_hash_table_free(old);
+	}
+	XLAT_CACHE_UNLOCK;
+}
+
+/** Tokenize a format string, or find the tokenized version of a previous call
+ *
+ * @param[in] request the input request.
+ * @param[in] fmt the format string to expand.
+ * @param[out] head the head of the xlat list / tree structure.
+ * @param[out] out the cache entry, which must be released with #xlat_cache_release.
+ *	NULL if head isn't cached, in which case it must be freed by the caller.
+ * @return the same as #xlat_tokenize_request.
+ */
+static ssize_t xlat_tokenize_cached(REQUEST *request, char const *fmt, xlat_exp_t **head,
+				    xlat_cache_entry_t **out)
+{
+	xlat_cache_entry_t my_entry, *entry, *found;
+
+	*out = NULL;
+
+	my_entry.fmt = fmt;
+
+	XLAT_CACHE_LOCK;
+	if (xlat_cache) {
+		entry = fr_hash_table_finddata(xlat_cache, &my_entry);
+		if (entry) {
+			entry->refs++;
+			XLAT_CACHE_UNLOCK;
+
+			*head = entry->node;
+			*out = entry;
+			return entry->slen;
+		}
+	}
+	XLAT_CACHE_UNLOCK;
+
+	/*
+	 *	Tokenize outside of the lock, the tree doesn't
+	 *	depend on the request, so it can be shared.
+	 */
+	entry = talloc_zero(NULL, xlat_cache_entry_t);
+	if (!entry) return xlat_tokenize_request(request, request, fmt, head);
+
+	entry->fmt = talloc_typed_strdup(entry, fmt);
+	entry->slen = xlat_tokenize_request(entry, request, fmt, &entry->node);
+	if (entry->slen < 0) {
+		ssize_t slen = entry->slen;
+
+		talloc_free(entry);
+		*head = NULL;
+		return slen;
+	}
+	entry->refs = 1;
+
+	XLAT_CACHE_LOCK;
+	if (!xlat_cache) {
+		xlat_cache = fr_hash_table_create(xlat_cache_hash, xlat_cache_cmp, NULL);
+	} else {
+		/*
+		 *	Another thread got there first.
+		 */
+		found = fr_hash_table_finddata(xlat_cache, entry);
+		if (found) {
+			found->refs++;
+			XLAT_CACHE_UNLOCK;
+
+			talloc_free(entry);
+			*head = found->node;
+			*out = found;
+			return found->slen;
+		}
+
+		if (fr_hash_table_num_elements(xlat_cache) >= XLAT_CACHE_MAX) {
+			fr_hash_table_walk(xlat_cache, xlat_cache_retire, NULL);
+			fr_hash_table_free(xlat_cache);
+			xlat_cache = fr_hash_table_create(xlat_cache_hash, xlat_cache_cmp, NULL);
+		}
+	}
+
+	if (!xlat_cache || !fr_hash_table_insert(xlat_cache, entry)) entry->retired = true;
+	XLAT_CACHE_UNLOCK;
+
+	*head = entry->node;
+	*out = entry;
+	return entry->slen;
+}
+
+/** Release a tokenized format string returned by #xlat_tokenize_cached
+ *
+ */
+static void xlat_cache_release(xlat_cache_entry_t *entry)
+{
+	XLAT_CACHE_LOCK;
+	if ((--entry->refs == 0) && entry->retired) talloc_free(entry);
+	XLAT_CACHE_UNLOCK;
+}
+
 
 static char *xlat_getvp(TALLOC_CTX *ctx, REQUEST *request, vp_tmpl_t const *vpt,
 			bool escape, bool return_null)
@@ -2537,12 +2717,19 @@ static ssize_t xlat_expand(char **out, size_t outlen, REQUEST *request, char con
 {
 	ssize_t len;
 	xlat_exp_t *node;
+	xlat_cache_entry_t *entry;
 
 	/*
 	 *	Give better errors than the old code.
 	 */
-	len = xlat_tokenize_request(request, fmt, &node);
+	len = xlat_tokenize_cached(request, fmt, &node, &entry);
 	if (len == 0) {
+		if (entry) {
+			xlat_cache_release(entry);
+		} else {
+			talloc_free(node);
+		}
+
 		if (*out) {
 			*out[0] = '\0';
 		} else {
@@ -2557,7 +2744,11 @@ static ssize_t xlat_expand(char **out, size_t outlen, REQUEST *request, char con
 	}
 
 	len = xlat_expand_struct(out, outlen, request, node, escape, escape_ctx);
-	talloc_free(node);
+	if (entry) {
+		xlat_cache_release(entry);
+	} else {
+		talloc_free(node);
+	}
 
 	RDEBUG2("EXPAND %s", fmt);
 	RDEBUG2("   --> %s", *out);
@@ -189,7 +189,7 @@ static cache_status_t cache_entry_find(rlm_cache_entry_t **out, UNUSED rlm_cache
 		return CACHE_ERROR;
 	}
 	RDEBUG2("Retrieved %zu bytes from memcached", len);
-	RDEBUG2("%s", from_store);
+	if (from_store[0] != CACHE_BINARY_MAGIC) RDEBUG2("%s", from_store);
 
 	c = talloc_zero(NULL,  rlm_cache_entry_t);
 	ret = cache_deserialize(c, from_store, len);
@@ -213,7 +213,7 @@ static cache_status_t cache_entry_find(rlm_cache_entry_t **out, UNUSED rlm_cache
  * @param c entry to insert.
  * @return CACHE_OK on success else CACHE_ERROR on error.
  */
-static cache_status_t cache_entry_insert(UNUSED rlm_cache_t *inst, REQUEST *request, rlm_cache_handle_t **handle,
+static cache_status_t cache_entry_insert(rlm_cache_t *inst, REQUEST *request, rlm_cache_handle_t **handle,
 					 rlm_cache_entry_t *c)
 {
 	rlm_cache_memcached_handle_t *mandle = *handle;
@@ -221,20 +221,21 @@ static cache_status_t cache_entry_insert(UNUSED rlm_cache_t *inst, REQUEST *requ
 	memcached_return_t ret;
 
 	TALLOC_CTX *pool;
-	char *to_store;
+	uint8_t *to_store;
+	ssize_t len;
 
 	pool = talloc_pool(NULL, 1024);
 	if (!pool) return CACHE_ERROR;
 
-	if (cache_serialize(pool, &to_store, c) < 0) {
+	len = cache_serialize_entry(pool, &to_store, inst, c);
+	if (len < 0) {
 		talloc_free(pool);
 
 		return CACHE_ERROR;
 	}
 
 	ret = memcached_set(mandle->handle, c->key, talloc_array_length(c->key) - 1,
-		            to_store ? to_store : "",
-		            to_store ? talloc_array_length(to_store) - 1 : 0, c->expires, 0);
+		            (char const *)to_store, len, c->expires, 0);
 	talloc_free(pool);
 	if (ret != MEMCACHED_SUCCESS) {
 		RERROR("Failed storing entry with key \"%s\": %s: %s", c->key,
@@ -0,0 +1,608 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file rlm_cache_redis.c
+ * @brief Redis based cache, with commands from concurrent requests pipelined
+ *	over a small number of shared connections.
+ *
+ * Entries are stored in the format selected by the rlm_cache "binary_format"
+ * option.
+ *
+ * Each worker thread formats its command, and queues it on one of the
+ * pipelines.  The first thread to find the pipeline idle becomes the "leader",
+ * takes every command queued so far, writes them to redis in one go, then
+ * reads the replies back in order, handing each one to the thread that queued
+ * it.  Commands queued whilst the leader is busy form the next batch.
+ *
+ * This means the per-request cost of a round trip to the redis server is
+ * amortised over all requests which were waiting on the same pipeline.
+ *
+ * @copyright 2015 The FreeRADIUS server project
+ */
+#include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/rad_assert.h>
+
+#include <hiredis/hiredis.h>
+
+#include "../../rlm_cache.h"
+#include "../../serialize.h"
+
+#ifdef HAVE_PTHREAD_H
+#  define PTHREAD_MUTEX_LOCK pthread_mutex_lock
+#  define PTHREAD_MUTEX_UNLOCK pthread_mutex_unlock
+#else
+#  define PTHREAD_MUTEX_LOCK(_x)
+#  define PTHREAD_MUTEX_UNLOCK(_x)
+#endif
+
+typedef struct rlm_cache_redis rlm_cache_redis_t;
+
+/** A single command waiting to be sent, or waiting for its reply
+ *
+ * Lives on the stack of the thread which queued it, and is only valid until
+ * that thread has seen done == true.
+ */
+typedef struct rlm_cache_redis_cmd {
+	char			*cmd;		//!< Command in redis wire format.
+	int			len;		//!< Length of the command.
+
+	redisReply		*reply;		//!< Reply to the command, NULL on error.
+	bool			done;		//!< Leader has finished with this command.
+
+	struct rlm_cache_redis_cmd *next;	//!< Next command in the queue/batch.
+} rlm_cache_redis_cmd_t;
+
+/** A connection shared by many requests
+ *
+ */
+typedef struct rlm_cache_redis_pipeline {
+	rlm_cache_redis_t	*driver;	//!< Driver instance this pipeline belongs to.
+	unsigned int		id;		//!< Pipeline number, used in log messages.
+
+	redisContext		*conn;		//!< Connection, only touched by the leader.
+
+	rlm_cache_redis_cmd_t	*head;		//!< Commands waiting to be sent.
+	rlm_cache_redis_cmd_t	**tail;		//!< Where to add the next command.
+	bool			busy;		//!< Whether a leader is currently doing I/O.
+
+	uint64_t		batches;	//!< Number of round trips.
+	uint64_t		commands;	//!< Number of commands sent.
+
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_t		mutex;		//!< Protects the queue and the busy flag.
+	pthread_cond_t		cond;		//!< Signalled when a batch completes.
+#endif
+} rlm_cache_redis_pipeline_t;
+
+struct rlm_cache_redis {
+	char const		*name;		//!< Name of the parent rlm_cache instance.
+
+	char const		*server;	//!< Redis server to connect to.
+	uint16_t		port;		//!< Port of the redis server.
+	uint32_t		database;	//!< Database number to SELECT.
+	char const		*password;	//!< Password to AUTH with.
+	uint32_t		query_timeout;	//!< Connect and I/O timeout.
+	uint32_t		num_pipelines;	//!< How many connections to share between requests.
+
+	rlm_cache_redis_pipeline_t *pipelines;	//!< Array of pipelines.
+};
+
+static const CONF_PARSER driver_config[] = {
+	{ "server", FR_CONF_OFFSET(PW_TYPE_STRING | PW_TYPE_REQUIRED, rlm_cache_redis_t, server), "localhost" },
+	{ "port", FR_CONF_OFFSET(PW_TYPE_SHORT, rlm_cache_redis_t, port), "6379" },
+	{ "database", FR_CONF_OFFSET(PW_TYPE_INTEGER, rlm_cache_redis_t, database), "0" },
+	{ "password", FR_CONF_OFFSET(PW_TYPE_STRING | PW_TYPE_SECRET, rlm_cache_redis_t, password), NULL },
+	{ "query_timeout", FR_CONF_OFFSET(PW_TYPE_INTEGER, rlm_cache_redis_t, query_timeout), "5" },
+	{ "pipelines", FR_CONF_OFFSET(PW_TYPE_INTEGER, rlm_cache_redis_t, num_pipelines), "2" },
+	CONF_PARSER_TERMINATOR
+};
+
+/** Run a command synchronously on a connection we're setting up
+ *
+ * @param driver instance.
+ * @param conn to run the command on.
+ * @param argc number of arguments.
+ * @param argv arguments.
+ * @return 0 if the server replied with +OK, else -1.
+ */
+static int redis_conn_command(rlm_cache_redis_t *driver, redisContext *conn, int argc, char const **argv)
+{
+	redisReply *reply;
+
+	reply = redisCommandArgv(conn, argc, argv, NULL);
+	if (!reply) {
+		ERROR("rlm_cache_redis (%s): Failed running %s: %s", driver->name, argv[0], conn->errstr);
+		return -1;
+	}
+
+	if ((reply->type != REDIS_REPLY_STATUS) || (strcmp(reply->str, "OK") != 0)) {
+		ERROR("rlm_cache_redis (%s): Unexpected reply to %s: %s", driver->name, argv[0],
+		      (reply->type == REDIS_REPLY_STATUS) || (reply->type == REDIS_REPLY_ERROR) ?
+		      reply->str : "<non-status>");
+		freeReplyObject(reply);
+		return -1;
+	}
+	freeReplyObject(reply);
+
+	return 0;
+}
+
+/** Open a new connection to the redis server
+ *
+ * @param driver instance.
+ * @return a new connection or NULL on error.
+ */
+static redisContext *redis_conn_create(rlm_cache_redis_t *driver)
+{
+	redisContext	*conn;
+	struct timeval	tv;
+
+	tv.tv_sec = driver->query_timeout;
+	tv.tv_usec = 0;
+
+	conn = redisConnectWithTimeout(driver->server, driver->port, tv);
+	if (!conn) {
+		ERROR("rlm_cache_redis (%s): Failed connecting to %s:%u", driver->name, driver->server, driver->port);
+		return NULL;
+	}
+
+	if (conn->err) {
+		ERROR("rlm_cache_redis (%s): Failed connecting to %s:%u: %s", driver->name,
+		      driver->server, driver->port, conn->errstr);
+	error:
+		redisFree(conn);
+		return NULL;
+	}
+
+	if (redisSetTimeout(conn, tv) == REDIS_ERR) {
+		ERROR("rlm_cache_redis (%s): Failed setting timeout on connection to %s:%u", driver->name,
+		      driver->server, driver->port);
+		goto error;
+	}
+
+	if (driver->password) {
+		char const *argv[] = { "AUTH", driver->password };
+
+		if (redis_conn_command(driver, conn, 2, argv) < 0) goto error;
+	}
+
+	if (driver->database) {
+		char buffer[11];
+		char const *argv[] = { "SELECT", buffer };
+
+		snprintf(buffer, sizeof(buffer), "%u", driver->database);
+		if (redis_conn_command(driver, conn, 2, argv) < 0) goto error;
+	}
+
+	DEBUG2("rlm_cache_redis (%s): Connected to %s:%u", driver->name, driver->server, driver->port);
+
+	return conn;
+}
+
+/** Write a batch of commands to redis, and read the replies
+ *
+ * Called by the leader without holding the pipeline mutex.  Only the leader
+ * may touch pipe->conn.
+ *
+ * If the connection fails part way through, it's re-established and the
+ * commands which didn't get a reply are sent again.  This is safe because
+ * GET, SET and DEL are all idempotent.
+ *
+ * @param pipe to send the batch over.
+ * @param batch of commands.
+ */
+static void redis_pipeline_flush(rlm_cache_redis_pipeline_t *pipe, rlm_cache_redis_cmd_t *batch)
+{
+	rlm_cache_redis_cmd_t	*cmd, *unsent = batch;
+	int			tries;
+
+	for (tries = 0; unsent && (tries < 2); tries++) {
+		if (!pipe->conn) {
+			pipe->conn = redis_conn_create(pipe->driver);
+			if (!pipe->conn) return;
+		}
+
+		for (cmd = unsent; cmd; cmd = cmd->next) {
+			if (redisAppendFormattedCommand(pipe->conn, cmd->cmd, cmd->len) != REDIS_OK) goto reconnect;
+		}
+
+		/*
+		 *	The first call to redisGetReply flushes the
+		 *	output buffer, writing all the commands.
+		 */
+		for (cmd = unsent; cmd; cmd = cmd->next) {
+			void *reply;
+
+			if (redisGetReply(pipe->conn, &reply) != REDIS_OK) goto reconnect;
+			cmd->reply = reply;
+			unsent = cmd->next;
+		}
+
+		return;
+
+	reconnect:
+		ERROR("rlm_cache_redis (%s): Pipeline %u connection failed: %s", pipe->driver->name, pipe->id,
+		      pipe->conn->errstr);
+		redisFree(pipe->conn);
+		pipe->conn = NULL;
+	}
+}
+
+/** Send a command over a pipeline, and wait for its reply
+ *
+ * @param pipe to send the command over.
+ * @param request The current request.
+ * @param argc number of arguments.
+ * @param argv arguments, may contain binary data.
+ * @param argvlen lengths of the arguments.
+ * @return the reply (to be freed with freeReplyObject), or NULL on error.
+ */
+static redisReply *redis_pipeline_command(rlm_cache_redis_pipeline_t *pipe, REQUEST *request,
+					  int argc, char const **argv, size_t const *argvlen)
+{
+	rlm_cache_redis_cmd_t	cmd;
+
+	memset(&cmd, 0, sizeof(cmd));
+
+	cmd.len = redisFormatCommandArgv(&cmd.cmd, argc, argv, argvlen);
+	if (cmd.len < 0) {
+		REDEBUG("Failed formatting %s command", argv[0]);
+		return NULL;
+	}
+
+	PTHREAD_MUTEX_LOCK(&pipe->mutex);
+	*pipe->tail = &cmd;
+	pipe->tail = &cmd.next;
+
+	while (!cmd.done) {
+		rlm_cache_redis_cmd_t *batch, *p;
+		unsigned int count = 0;
+
+		/*
+		 *	Someone else is doing I/O on the connection,
+		 *	wait for them to finish, then check whether our
+		 *	command was in their batch.
+		 */
+		if (pipe->busy) {
+#ifdef HAVE_PTHREAD_H
+			pthread_cond_wait(&pipe->cond, &pipe->mutex);
+#endif
+			continue;
+		}
+
+		/*
+		 *	We're the leader.  Take everything queued so far
+		 *	(which includes our command) and send it as one
+		 *	batch.
+		 */
+		batch = pipe->head;
+		pipe->head = NULL;
+		pipe->tail = &pipe->head;
+		pipe->busy = true;
+		PTHREAD_MUTEX_UNLOCK(&pipe->mutex);
+
+		for (p = batch; p; p = p->next) count++;
+		RDEBUG3("Pipelining %u command(s) over connection %u", count, pipe->id);
+
+		redis_pipeline_flush(pipe, batch);
+
+		PTHREAD_MUTEX_LOCK(&pipe->mutex);
+		pipe->batches++;
+		pipe->commands += count;
+
+		/*
+		 *	Get the next pointer before marking the command
+		 *	as done, as the owner may return as soon as it
+		 *	sees the flag.
+		 */
+		for (p = batch; p; p = batch) {
+			batch = p->next;
+			p->done = true;
+		}
+		pipe->busy = false;
+#ifdef HAVE_PTHREAD_H
+		pthread_cond_broadcast(&pipe->cond);
+#endif
+	}
+	PTHREAD_MUTEX_UNLOCK(&pipe->mutex);
+
+	free(cmd.cmd);
+
+	if (!cmd.reply) {
+		REDEBUG("Failed running %s command against %s:%u", argv[0], pipe->driver->server, pipe->driver->port);
+		return NULL;
+	}
+
+	if (cmd.reply->type == REDIS_REPLY_ERROR) {
+		REDEBUG("%s command failed: %s", argv[0], cmd.reply->str);
+		freeReplyObject(cmd.reply);
+		return NULL;
+	}
+
+	return cmd.reply;
+}
+
+/** Cleanup a rlm_cache_redis instance
+ *
+ * @param driver to free.
+ * @return 0
+ */
+static int _mod_detach(rlm_cache_redis_t *driver)
+{
+	uint32_t i;
+
+	if (!driver->pipelines) return 0;
+
+	for (i = 0; i < driver->num_pipelines; i++) {
+		rlm_cache_redis_pipeline_t *pipe = &driver->pipelines[i];
+
+		if (pipe->commands) {
+			DEBUG2("rlm_cache_redis (%s): Pipeline %u sent %" PRIu64 " commands in %" PRIu64
+			       " round trips", driver->name, i, pipe->commands, pipe->batches);
+		}
+
+		if (pipe->conn) redisFree(pipe->conn);
+#ifdef HAVE_PTHREAD_H
+		pthread_mutex_destroy(&pipe->mutex);
+		pthread_cond_destroy(&pipe->cond);
+#endif
+	}
+
+	return 0;
+}
+
+/** Create a new rlm_cache_redis instance
+ *
+ * @param conf redis specific conf section.
+ * @param inst main rlm_cache instance.
+ * @return 0 on success, -1 on failure.
+ */
+static int mod_instantiate(CONF_SECTION *conf, rlm_cache_t *inst)
+{
+	rlm_cache_redis_t	*driver;
+	uint32_t		i;
+
+	static bool		version_done;
+
+	if (!version_done) {
+		version_done = true;
+
+		INFO("rlm_cache_redis: libhiredis version: %i.%i.%i", HIREDIS_MAJOR, HIREDIS_MINOR, HIREDIS_PATCH);
+	}
+
+	driver = talloc_zero(inst, rlm_cache_redis_t);
+	talloc_set_destructor(driver, _mod_detach);
+
+	if (cf_section_parse(conf, driver, driver_config) < 0) return -1;
+
+	driver->name = inst->name;
+
+	FR_INTEGER_BOUND_CHECK("pipelines", driver->num_pipelines, >=, 1);
+	FR_INTEGER_BOUND_CHECK("pipelines", driver->num_pipelines, <=, 64);
+	FR_INTEGER_BOUND_CHECK("query_timeout", driver->query_timeout, >=, 1);
+
+	driver->pipelines = talloc_zero_array(driver, rlm_cache_redis_pipeline_t, driver->num_pipelines);
+	if (!driver->pipelines) return -1;
+
+	for (i = 0; i < driver->num_pipelines; i++) {
+		rlm_cache_redis_pipeline_t *pipe = &driver->pipelines[i];
+
+		pipe->driver = driver;
+		pipe->id = i;
+		pipe->tail = &pipe->head;
+#ifdef HAVE_PTHREAD_H
+		pthread_mutex_init(&pipe->mutex, NULL);
+		pthread_cond_init(&pipe->cond, NULL);
+#endif
+	}
+
+	/*
+	 *	Check we can actually talk to the server, the
+	 *	connection is then used by the first pipeline.
+	 */
+	driver->pipelines[0].conn = redis_conn_create(driver);
+	if (!driver->pipelines[0].conn) return -1;
+
+	inst->driver = driver;
+
+	if (inst->max_entries > 0) WARN("rlm_cache_redis: max_entries is not supported by this driver");
+
+	return 0;
+}
+
+static void cache_entry_free(rlm_cache_entry_t *c)
+{
+	talloc_free(c);
+}
+
+/** Locate a cache entry in redis
+ *
+ * @param out Where to write the pointer to the cache entry.
+ * @param inst main rlm_cache instance.
+ * @param request The current request.
+ * @param handle Pointer to the pipeline.
+ * @param key to search for.
+ * @return CACHE_OK on success CACHE_MISS if no entry found, CACHE_ERROR on error.
+ */
+static cache_status_t cache_entry_find(rlm_cache_entry_t **out, UNUSED rlm_cache_t *inst, REQUEST *request,
+				       rlm_cache_handle_t **handle, char const *key)
+{
+	rlm_cache_redis_pipeline_t	*pipe = *handle;
+	redisReply			*reply;
+	rlm_cache_entry_t		*c;
+	int				ret;
+
+	char const			*argv[] = { "GET", key };
+	size_t				argvlen[] = { 3, strlen(key) };
+
+	reply = redis_pipeline_command(pipe, request, 2, argv, argvlen);
+	if (!reply) return CACHE_ERROR;
+
+	switch (reply->type) {
+	case REDIS_REPLY_NIL:
+		freeReplyObject(reply);
+		return CACHE_MISS;
+
+	case REDIS_REPLY_STRING:
+		break;
+
+	default:
+		REDEBUG("Unexpected reply type %i to GET", reply->type);
+		freeReplyObject(reply);
+		return CACHE_ERROR;
+	}
+
+	RDEBUG2("Retrieved %zu bytes from redis", (size_t) reply->len);
+
+	c = talloc_zero(NULL, rlm_cache_entry_t);
+	ret = cache_deserialize(c, reply->str, reply->len);
+	freeReplyObject(reply);
+	if (ret < 0) {
+		RERROR("%s", fr_strerror());
+		talloc_free(c);
+		return CACHE_ERROR;
+	}
+	c->key = talloc_strdup(c, key);
+	*out = c;
+
+	return CACHE_OK;
+}
+
+/** Insert a new entry into redis
+ *
+ * The entry is written with SET ... EX so redis expires it for us.
+ *
+ * @param inst main rlm_cache instance.
+ * @param request The current request.
+ * @param handle Pointer to the pipeline.
+ * @param c entry to insert.
+ * @return CACHE_OK on success else CACHE_ERROR on error.
+ */
+static cache_status_t cache_entry_insert(rlm_cache_t *inst, REQUEST *request, rlm_cache_handle_t **handle,
+					 rlm_cache_entry_t *c)
+{
+	rlm_cache_redis_pipeline_t	*pipe = *handle;
+	redisReply			*reply;
+
+	TALLOC_CTX			*pool;
+	uint8_t				*to_store;
+	ssize_t				len;
+	char				ttl[21];
+	time_t				expires_in;
+
+	char const			*argv[5];
+	size_t				argvlen[5];
+
+	expires_in = c->expires - request->timestamp;
+	if (expires_in <= 0) expires_in = 1;
+	snprintf(ttl, sizeof(ttl), "%" PRIu64, (uint64_t) expires_in);
+
+	pool = talloc_pool(NULL, 1024);
+	if (!pool) return CACHE_ERROR;
+
+	len = cache_serialize_entry(pool, &to_store, inst, c);
+	if (len < 0) {
+		talloc_free(pool);
+
+		return CACHE_ERROR;
+	}
+
+	argv[0] = "SET";
+	argvlen[0] = 3;
+	argv[1] = c->key;
+	argvlen[1] = talloc_array_length(c->key) - 1;
+	argv[2] = (char const *)to_store;
+	argvlen[2] = len;
+	argv[3] = "EX";
+	argvlen[3] = 2;
+	argv[4] = ttl;
+	argvlen[4] = strlen(ttl);
+
+	reply = redis_pipeline_command(pipe, request, 5, argv, argvlen);
+	talloc_free(pool);
+	if (!reply) return CACHE_ERROR;
+	freeReplyObject(reply);
+
+	return CACHE_OK;
+}
+
+/** Delete the cache entry from redis
+ *
+ * @param inst main rlm_cache instance.
+ * @param request The current request.
+ * @param handle Pointer to the pipeline.
+ * @param c entry to expire.
+ * @return CACHE_OK on success else CACHE_ERROR.
+ */
+static cache_status_t cache_entry_expire(UNUSED rlm_cache_t *inst, REQUEST *request, rlm_cache_handle_t **handle,
+					 rlm_cache_entry_t *c)
+{
+	rlm_cache_redis_pipeline_t	*pipe = *handle;
+	redisReply			*reply;
+
+	char const			*argv[] = { "DEL", c->key };
+	size_t				argvlen[] = { 3, talloc_array_length(c->key) - 1 };
+
+	reply = redis_pipeline_command(pipe, request, 2, argv, argvlen);
+	if (!reply) return CACHE_ERROR;
+	freeReplyObject(reply);
+
+	return CACHE_OK;
+}
+
+/** Pick a pipeline for the request
+ *
+ * Pipelines are shared, so this never blocks.
+ *
+ * @param out Where to write the handle.
+ * @param inst rlm_cache instance.
+ * @param request The current request.
+ */
+static int mod_conn_get(rlm_cache_handle_t **out, rlm_cache_t *inst, REQUEST *request)
+{
+	rlm_cache_redis_t *driver = inst->driver;
+
+	*out = &driver->pipelines[request->number % driver->num_pipelines];
+
+	return 0;
+}
+
+/** Release the pipeline
+ *
+ * @param inst main rlm_cache instance.
+ * @param request The current request.
+ * @param handle Pointer to the handle to release (will be set to NULL).
+ */
+static void mod_conn_release(UNUSED rlm_cache_t *inst, UNUSED REQUEST *request, rlm_cache_handle_t **handle)
+{
+	*handle = NULL;
+}
+
+extern cache_module_t rlm_cache_redis;
+cache_module_t rlm_cache_redis = {
+	.name		= "rlm_cache_redis",
+	.instantiate	= mod_instantiate,
+	.free		= cache_entry_free,
+
+	.find		= cache_entry_find,
+	.insert		= cache_entry_insert,
+	.expire		= cache_entry_expire,
+
+	.acquire	= mod_conn_get,
+	.release	= mod_conn_release
+};
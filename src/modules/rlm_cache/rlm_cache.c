@@ -49,6 +49,7 @@ static const CONF_PARSER module_config[] = {
 	/* Should be a type which matches time_t, @fixme before 2038 */
 	{ "epoch", FR_CONF_OFFSET(PW_TYPE_SIGNED, rlm_cache_t, epoch), "0" },
 	{ "add_stats", FR_CONF_OFFSET(PW_TYPE_BOOLEAN, rlm_cache_t, stats), "no" },
+	{ "binary_format", FR_CONF_OFFSET(PW_TYPE_BOOLEAN, rlm_cache_t, binary), "no" },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -822,6 +823,7 @@ extern module_t rlm_cache;
 module_t rlm_cache = {
 	.magic		= RLM_MODULE_INIT,
 	.name		= "cache",
+	.type		= RLM_TYPE_PARALLEL_START,
 	.inst_size	= sizeof(rlm_cache_t),
 	.config		= module_config,
 	.bootstrap	= mod_bootstrap,
@@ -59,6 +59,8 @@ typedef struct rlm_cache_t {
 	uint32_t		max_entries;		//!< Maximum entries allowed.
 	int32_t			epoch;			//!< Time after which entries are considered valid.
 	bool			stats;			//!< Generate statistics.
+	bool			binary;			//!< Use the binary serialization format in
+							//!< drivers which store entries externally.
 
 	vp_map_t	*maps;			//!< Attribute map applied to users.
 							//!< and profiles.
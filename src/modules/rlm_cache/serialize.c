@@ -124,6 +124,10 @@ finish:
 }
 
 /** Converts a serialized cache entry back into a structure
+ *
+ * Entries in the binary format (see #cache_serialize_binary) are detected
+ * automatically, so entries written by servers using either format can be
+ * read back.
  *
  * @param c Cache entry to populate (should already be allocated)
  * @param in String representation of cache entry.
@@ -138,6 +142,8 @@ int cache_deserialize(rlm_cache_entry_t *c, char *in, ssize_t inlen)
 	TALLOC_CTX *store = NULL;
 	char *p, *q;
 
+	if ((inlen > 0) && (in[0] == CACHE_BINARY_MAGIC)) return cache_deserialize_binary(c, (uint8_t *)in, inlen);
+
 	store = talloc_pool(c, 1024);
 	if (!store) return -1;
 
@@ -190,6 +196,8 @@ int cache_deserialize(rlm_cache_entry_t *c, char *in, ssize_t inlen)
 				      &map->rhs->tmpl_data_value, map->rhs->tmpl_data_length);
 		if (len < 0) goto error;
 		vp->vp_length = len;
+		vp->op = map->op;
+		vp->tag = map->lhs->tmpl_tag;
 
 		/*
 		 *	Pull out the special attributes, and set the
@@ -241,3 +249,412 @@ int cache_deserialize(rlm_cache_entry_t *c, char *in, ssize_t inlen)
 
 	return 0;
 }
+
+/*
+ *	Binary format
+ *
+ *	Header:
+ *
+ *	  0                   1                   2                   3
+ *	  0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+ *	 +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *	 |     Magic     |    Version    |             Flags             |
+ *	 +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *	 |                    Created (64bit, seconds)                   |
+ *	 +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *	 |                    Expires (64bit, seconds)                   |
+ *	 +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *
+ *	Followed by zero or more attributes:
+ *
+ *	 +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *	 |   Info        |   Operator    |  Tag (if T)   | Vendor ...
+ *	 +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *	 | Attribute ... | Length ...    | Value ...
+ *	 +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *
+ *	Info is |0|0|0|P|T|List |, where List is the list the attribute
+ *	belongs to, T indicates a tag is present, and P indicates the
+ *	value is in its printed (escaped string) form, which is used for
+ *	types with no fixed network representation.
+ *
+ *	Vendor, Attribute and Length are unsigned LEB128 varints, so most
+ *	attributes have a 3 byte overhead.  All other values are in network
+ *	byte order, identical to their RADIUS wire encoding.
+ *
+ *	The magic byte is NUL, which can never start a text format entry.
+ */
+#define CACHE_BINARY_VERSION		1
+#define CACHE_BINARY_HDR_LEN		20
+
+#define CACHE_BINARY_LIST_MASK		0x07
+#define CACHE_BINARY_HAS_TAG		0x08
+#define CACHE_BINARY_PRINTED		0x10
+
+typedef enum {
+	CACHE_BINARY_LIST_REQUEST = 0,
+	CACHE_BINARY_LIST_REPLY,
+	CACHE_BINARY_LIST_CONTROL,
+	CACHE_BINARY_LIST_STATE
+} cache_binary_list_t;
+
+/** Buffer we're encoding into
+ *
+ */
+typedef struct cache_binary_buff {
+	uint8_t		*start;		//!< Start of the talloced buffer.
+	size_t		used;		//!< How much of the buffer has been written.
+} cache_binary_buff_t;
+
+/** Make sure there's room for another len bytes in the buffer
+ *
+ * @return pointer to where the bytes should be written, or NULL on error.
+ */
+static uint8_t *cache_binary_reserve(cache_binary_buff_t *buff, size_t len)
+{
+	size_t size = talloc_array_length(buff->start);
+	uint8_t *p;
+
+	if ((buff->used + len) > size) {
+		while ((buff->used + len) > size) size *= 2;
+
+		buff->start = talloc_realloc(talloc_parent(buff->start), buff->start, uint8_t, size);
+		if (!buff->start) return NULL;
+	}
+
+	p = buff->start + buff->used;
+	buff->used += len;
+
+	return p;
+}
+
+static int cache_binary_put_varint(cache_binary_buff_t *buff, uint32_t num)
+{
+	uint8_t *p;
+
+	p = cache_binary_reserve(buff, 5);
+	if (!p) return -1;
+
+	/*
+	 *	Reserved the maximum, now give back what we didn't use.
+	 */
+	buff->used -= 5;
+	do {
+		*p = num & 0x7f;
+		num >>= 7;
+		if (num) *p |= 0x80;
+		p++;
+		buff->used++;
+	} while (num);
+
+	return 0;
+}
+
+static ssize_t cache_binary_get_varint(uint32_t *out, uint8_t const *p, uint8_t const *end)
+{
+	uint8_t const	*q = p;
+	uint32_t	num = 0;
+	int		shift = 0;
+
+	while (q < end) {
+		if (shift > 28) break;
+
+		num |= (uint32_t)(*q & 0x7f) << shift;
+		if (!(*q++ & 0x80)) {
+			*out = num;
+			return q - p;
+		}
+		shift += 7;
+	}
+
+	fr_strerror_printf("Malformed length or attribute number in binary cache entry");
+	return -1;
+}
+
+/** Append a list of attributes to a binary cache entry
+ *
+ */
+static int cache_binary_put_list(TALLOC_CTX *ctx, cache_binary_buff_t *buff, cache_binary_list_t list,
+				 VALUE_PAIR *head)
+{
+	vp_cursor_t	cursor;
+	VALUE_PAIR	*vp;
+
+	for (vp = fr_cursor_init(&cursor, &head);
+	     vp;
+	     vp = fr_cursor_next(&cursor)) {
+		uint8_t const	*value;
+		ssize_t		len;
+		uint8_t		*p, info = list;
+		char		*printed = NULL;
+
+		switch (vp->da->type) {
+		case PW_TYPE_STRING:
+		case PW_TYPE_OCTETS:
+			value = vp->vp_octets;
+			len = vp->vp_length;
+			break;
+
+		case PW_TYPE_BOOLEAN:
+		case PW_TYPE_BYTE:
+		case PW_TYPE_SHORT:
+		case PW_TYPE_INTEGER:
+		case PW_TYPE_INTEGER64:
+		case PW_TYPE_DATE:
+		case PW_TYPE_SIGNED:
+		case PW_TYPE_IPV4_ADDR:
+		case PW_TYPE_IPV4_PREFIX:
+		case PW_TYPE_IPV6_ADDR:
+		case PW_TYPE_IPV6_PREFIX:
+		case PW_TYPE_IFID:
+		case PW_TYPE_ETHERNET:
+		case PW_TYPE_ABINARY:
+			len = rad_vp2data(&value, vp);
+			if (len < 0) return -1;
+			break;
+
+		/*
+		 *	No fixed network representation, use the
+		 *	same format as the text serializer.
+		 */
+		default:
+			printed = vp_aprints_value(ctx, vp, '"');
+			if (!printed) return -1;
+			value = (uint8_t const *)printed;
+			len = talloc_array_length(printed) - 1;
+			info |= CACHE_BINARY_PRINTED;
+			break;
+		}
+
+		if (vp->da->flags.has_tag && (vp->tag != TAG_ANY)) info |= CACHE_BINARY_HAS_TAG;
+
+		p = cache_binary_reserve(buff, (info & CACHE_BINARY_HAS_TAG) ? 3 : 2);
+		if (!p) return -1;
+
+		*p++ = info;
+		*p++ = vp->op;
+		if (info & CACHE_BINARY_HAS_TAG) *p = (uint8_t)vp->tag;
+
+		if ((cache_binary_put_varint(buff, vp->da->vendor) < 0) ||
+		    (cache_binary_put_varint(buff, vp->da->attr) < 0) ||
+		    (cache_binary_put_varint(buff, len) < 0)) return -1;
+
+		if (len > 0) {
+			p = cache_binary_reserve(buff, len);
+			if (!p) return -1;
+			memcpy(p, value, len);
+		}
+		talloc_free(printed);
+	}
+
+	return 0;
+}
+
+/** Serialize a cache entry in a compact binary format
+ *
+ * Decoding this format requires no string parsing, only dictionary lookups
+ * by attribute number.  The result may contain embedded NULs, so drivers
+ * must store it in a binary safe way.
+ *
+ * @param ctx to alloc the buffer in.
+ * @param out Where to write pointer to serialized cache entry.
+ * @param c Cache entry to serialize.
+ * @return length of the serialized entry, or -1 on error.
+ */
+ssize_t cache_serialize_binary(TALLOC_CTX *ctx, uint8_t **out, rlm_cache_entry_t *c)
+{
+	cache_binary_buff_t	buff;
+	uint8_t			*p;
+	uint64_t		num;
+
+	*out = NULL;
+
+	buff.start = talloc_array(ctx, uint8_t, 256);
+	if (!buff.start) return -1;
+	buff.used = 0;
+
+	p = cache_binary_reserve(&buff, CACHE_BINARY_HDR_LEN);
+	p[0] = CACHE_BINARY_MAGIC;
+	p[1] = CACHE_BINARY_VERSION;
+	p[2] = 0;
+	p[3] = 0;
+	num = htonll((uint64_t)c->created);
+	memcpy(p + 4, &num, sizeof(num));
+	num = htonll((uint64_t)c->expires);
+	memcpy(p + 12, &num, sizeof(num));
+
+	if ((cache_binary_put_list(ctx, &buff, CACHE_BINARY_LIST_CONTROL, c->control) < 0) ||
+	    (cache_binary_put_list(ctx, &buff, CACHE_BINARY_LIST_REQUEST, c->packet) < 0) ||
+	    (cache_binary_put_list(ctx, &buff, CACHE_BINARY_LIST_REPLY, c->reply) < 0) ||
+	    (cache_binary_put_list(ctx, &buff, CACHE_BINARY_LIST_STATE, c->state) < 0)) {
+		talloc_free(buff.start);
+		return -1;
+	}
+
+	*out = buff.start;
+
+	return buff.used;
+}
+
+/** Converts a binary serialized cache entry back into a structure
+ *
+ * @param c Cache entry to populate (should already be allocated)
+ * @param in Binary representation of cache entry.
+ * @param inlen Length of the binary data.
+ * @return 0 on success, -1 on error.
+ */
+int cache_deserialize_binary(rlm_cache_entry_t *c, uint8_t const *in, size_t inlen)
+{
+	vp_cursor_t	cursors[4];
+	uint8_t const	*p = in, *end = in + inlen;
+	uint64_t	num;
+
+	if (inlen < CACHE_BINARY_HDR_LEN) {
+		fr_strerror_printf("Binary cache entry too short");
+		return -1;
+	}
+
+	if (p[0] != CACHE_BINARY_MAGIC) {
+		fr_strerror_printf("Binary cache entry has invalid magic");
+		return -1;
+	}
+
+	if (p[1] != CACHE_BINARY_VERSION) {
+		fr_strerror_printf("Binary cache entry has unsupported version %u", p[1]);
+		return -1;
+	}
+
+	memcpy(&num, p + 4, sizeof(num));
+	c->created = ntohll(num);
+	memcpy(&num, p + 12, sizeof(num));
+	c->expires = ntohll(num);
+	p += CACHE_BINARY_HDR_LEN;
+
+	fr_cursor_init(&cursors[CACHE_BINARY_LIST_REQUEST], &c->packet);
+	fr_cursor_init(&cursors[CACHE_BINARY_LIST_REPLY], &c->reply);
+	fr_cursor_init(&cursors[CACHE_BINARY_LIST_CONTROL], &c->control);
+	fr_cursor_init(&cursors[CACHE_BINARY_LIST_STATE], &c->state);
+
+	while (p < end) {
+		DICT_ATTR const	*da;
+		VALUE_PAIR	*vp;
+		uint8_t		info, op;
+		int8_t		tag = TAG_ANY;
+		uint32_t	vendor, attr, len;
+		ssize_t		slen;
+
+		if ((end - p) < 2) {
+		too_short:
+			fr_strerror_printf("Binary cache entry truncated");
+			return -1;
+		}
+
+		info = *p++;
+		op = *p++;
+
+		if ((info & CACHE_BINARY_LIST_MASK) > CACHE_BINARY_LIST_STATE) {
+			fr_strerror_printf("Invalid cache list %u in binary cache entry",
+					   info & CACHE_BINARY_LIST_MASK);
+			return -1;
+		}
+
+		if (info & CACHE_BINARY_HAS_TAG) {
+			if (p >= end) goto too_short;
+			tag = (int8_t)*p++;
+		}
+
+		slen = cache_binary_get_varint(&vendor, p, end);
+		if (slen < 0) return -1;
+		p += slen;
+
+		slen = cache_binary_get_varint(&attr, p, end);
+		if (slen < 0) return -1;
+		p += slen;
+
+		slen = cache_binary_get_varint(&len, p, end);
+		if (slen < 0) return -1;
+		p += slen;
+
+		if (len > (size_t)(end - p)) goto too_short;
+
+		da = dict_attrbyvalue(attr, vendor);
+		if (!da) {
+			da = dict_unknown_afrom_fields(c, attr, vendor);
+			if (!da) return -1;
+		}
+
+		vp = fr_pair_afrom_da(c, da);
+		if (!vp) return -1;
+		vp->op = op;
+		vp->tag = tag;
+
+		if (info & CACHE_BINARY_PRINTED) {
+			if (fr_pair_value_from_str(vp, (char const *)p, len) < 0) {
+			error:
+				talloc_free(vp);
+				return -1;
+			}
+		} else switch (da->type) {
+		case PW_TYPE_STRING:
+			fr_pair_value_bstrncpy(vp, p, len);
+			break;
+
+		case PW_TYPE_OCTETS:
+			fr_pair_value_memcpy(vp, p, len);
+			break;
+
+		case PW_TYPE_BOOLEAN:
+			if (len != 1) {
+				fr_strerror_printf("Invalid length for boolean attribute %s", da->name);
+				goto error;
+			}
+			vp->vp_byte = p[0] & 0x01;
+			vp->vp_length = 1;
+			vp->type = VT_DATA;
+			break;
+
+		default:
+		{
+			value_data_t	src;
+
+			src.octets = p;
+			slen = value_data_cast(vp, &vp->data, da->type, da, PW_TYPE_OCTETS, NULL, &src, len);
+			if (slen < 0) {
+				fr_strerror_printf("Invalid value for attribute %s", da->name);
+				goto error;
+			}
+			vp->vp_length = slen;
+			vp->type = VT_DATA;
+		}
+			break;
+		}
+		p += len;
+
+		fr_cursor_insert(&cursors[info & CACHE_BINARY_LIST_MASK], vp);
+	}
+
+	return 0;
+}
+
+/** Serialize a cache entry in the format configured for the instance
+ *
+ * Used by drivers which store entries outside of the server.
+ *
+ * @param ctx to alloc the buffer in.
+ * @param out Where to write pointer to serialized cache entry.
+ * @param inst rlm_cache instance.
+ * @param c Cache entry to serialize.
+ * @return length of the serialized entry, or -1 on error.
+ */
+ssize_t cache_serialize_entry(TALLOC_CTX *ctx, uint8_t **out, rlm_cache_t const *inst, rlm_cache_entry_t *c)
+{
+	char *to_store;
+
+	if (inst->binary) return cache_serialize_binary(ctx, out, c);
+
+	if (cache_serialize(ctx, &to_store, c) < 0) return -1;
+
+	*out = (uint8_t *)to_store;
+
+	return talloc_array_length(to_store) - 1;
+}
@@ -60,6 +60,13 @@ typedef struct detail_instance {
 	char const	*header;	//!< Header format.
 	bool		locking;	//!< Whether the file should be locked.
 
+	char const	*format;	//!< "text" or "binary".
+	bool		binary;		//!< Write binary detail files.
+
+	uint32_t	buffer_size;	//!< Size of the append buffer for each file.
+	uint32_t	flush_interval;	//!< Maximum time entries are buffered for.
+	bool		sync;		//!< fsync() files after writing the buffer.
+
 	bool		log_srcdst;	//!< Add IP src/dst attributes to entries.
 
 	bool		escape;		//!< do filename escaping, yes / no
@@ -79,6 +86,10 @@ static const CONF_PARSER module_config[] = {
 	{ "permissions", FR_CONF_OFFSET(PW_TYPE_INTEGER, rlm_detail_t, perm), "0600" },
 	{ "group", FR_CONF_OFFSET(PW_TYPE_STRING, rlm_detail_t, group), NULL },
 	{ "locking", FR_CONF_OFFSET(PW_TYPE_BOOLEAN, rlm_detail_t, locking), "no" },
+	{ "format", FR_CONF_OFFSET(PW_TYPE_STRING, rlm_detail_t, format), "text" },
+	{ "buffer_size", FR_CONF_OFFSET(PW_TYPE_INTEGER, rlm_detail_t, buffer_size), "0" },
+	{ "flush_interval", FR_CONF_OFFSET(PW_TYPE_INTEGER, rlm_detail_t, flush_interval), "1" },
+	{ "sync", FR_CONF_OFFSET(PW_TYPE_BOOLEAN, rlm_detail_t, sync), "no" },
 	{ "escape_filenames", FR_CONF_OFFSET(PW_TYPE_BOOLEAN, rlm_detail_t, escape), "no" },
 	{ "log_packet_header", FR_CONF_OFFSET(PW_TYPE_BOOLEAN, rlm_detail_t, log_srcdst), "no" },
 	CONF_PARSER_TERMINATOR
@@ -132,12 +143,31 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 		inst->escape_func = rad_filename_make_safe;
 	}
 
+	if (strcmp(inst->format, "binary") == 0) {
+		inst->binary = true;
+	} else if (strcmp(inst->format, "text") != 0) {
+		cf_log_err_cs(conf, "Invalid value \"%s\" for 'format', must be \"text\" or \"binary\"",
+			      inst->format);
+		return -1;
+	}
+
 	inst->ef = exfile_init(inst, 256, 30, inst->locking);
 	if (!inst->ef) {
 		cf_log_err_cs(conf, "Failed creating log file context");
 		return -1;
 	}
 
+	if (inst->buffer_size) {
+		FR_INTEGER_BOUND_CHECK("buffer_size", inst->buffer_size, >=, 4096);
+		FR_INTEGER_BOUND_CHECK("buffer_size", inst->buffer_size, <=, 16 * 1024 * 1024);
+		FR_INTEGER_BOUND_CHECK("flush_interval", inst->flush_interval, <=, 60);
+
+		if (exfile_enable_buffer(inst->ef, inst->buffer_size, inst->flush_interval, inst->sync) < 0) {
+			cf_log_err_cs(conf, "Failed enabling buffering: %s", fr_strerror());
+			return -1;
+		}
+	}
+
 	/*
 	 *	Suppress certain attributes.
 	 */
@@ -194,32 +224,57 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 	return 0;
 }
 
+/*
+ *	Append an attribute to the entry, in the same format as
+ *	vp_print().
+ */
+static char *detail_vp_append(char *out, VALUE_PAIR const *vp)
+{
+	char	buf[1024];
+	size_t	len;
+
+	len = vp_prints(buf, sizeof(buf) - 1, vp);
+	if (!len) return out;
+
+	/*
+	 *	Deal with truncation gracefully
+	 */
+	if (len >= (sizeof(buf) - 2)) len = sizeof(buf) - 2;
+
+	return talloc_asprintf_append_buffer(out, "\t%.*s\n", (int) len, buf);
+}
+
 /*
  *	Wrapper for VPs allocated on the stack.
  */
-static void detail_vp_print(TALLOC_CTX *ctx, FILE *out, VALUE_PAIR const *stacked)
+static char *detail_vp_print(TALLOC_CTX *ctx, char *out, VALUE_PAIR const *stacked)
 {
 	VALUE_PAIR *vp;
 
 	vp = talloc(ctx, VALUE_PAIR);
-	if (!vp) return;
+	if (!vp) return out;
 
 	memcpy(vp, stacked, sizeof(*vp));
 	vp->op = T_OP_EQ;
-	vp_print(out, vp);
+	out = detail_vp_append(out, vp);
 	talloc_free(vp);
+
+	return out;
 }
 
 
-/** Write a single detail entry to file pointer
+/** Format a single detail entry
  *
- * @param[in] out Where to write entry.
+ * The entry is built in memory, so that it can be written to the file
+ * with one call.
+ *
+ * @param[in,out] out talloced string to append the entry to.
  * @param[in] inst Instance of rlm_detail.
  * @param[in] request The current request.
  * @param[in] packet associated with the request (request, reply, proxy-request, proxy-reply...).
  * @param[in] compat Write out entry in compatibility mode.
  */
-static int detail_write(FILE *out, rlm_detail_t *inst, REQUEST *request, RADIUS_PACKET *packet, bool compat)
+static int detail_write(char **out, rlm_detail_t *inst, REQUEST *request, RADIUS_PACKET *packet, bool compat)
 {
 	VALUE_PAIR *vp;
 	char timestamp[256];
@@ -234,8 +289,9 @@ static int detail_write(FILE *out, rlm_detail_t *inst, REQUEST *request, RADIUS_
 	}
 
 #define WRITE(fmt, ...) do {\
-	if (fprintf(out, fmt, ## __VA_ARGS__) < 0) {\
-		RERROR("Failed writing to detail file: %s", fr_syserror(errno));\
+	*out = talloc_asprintf_append_buffer(*out, fmt, ## __VA_ARGS__);\
+	if (!*out) {\
+		RERROR("Out of memory formatting detail entry");\
 		return -1;\
 	}\
 } while(0)
@@ -285,16 +341,17 @@ static int detail_write(FILE *out, rlm_detail_t *inst, REQUEST *request, RADIUS_
 			break;
 		}
 
-		detail_vp_print(request, out, &src_vp);
-		detail_vp_print(request, out, &dst_vp);
+		*out = detail_vp_print(request, *out, &src_vp);
+		*out = detail_vp_print(request, *out, &dst_vp);
 
 		src_vp.da = dict_attrbyvalue(PW_PACKET_SRC_PORT, 0);
 		src_vp.vp_integer = packet->src_port;
 		dst_vp.da = dict_attrbyvalue(PW_PACKET_DST_PORT, 0);
 		dst_vp.vp_integer = packet->dst_port;
 
-		detail_vp_print(request, out, &src_vp);
-		detail_vp_print(request, out, &dst_vp);
+		*out = detail_vp_print(request, *out, &src_vp);
+		*out = detail_vp_print(request, *out, &dst_vp);
+		if (!*out) return -1;
 	}
 
 	{
@@ -317,8 +374,9 @@ static int detail_write(FILE *out, rlm_detail_t *inst, REQUEST *request, RADIUS_
 			 */
 			op = vp->op;
 			vp->op = T_OP_EQ;
-			vp_print(out, vp);
+			*out = detail_vp_append(*out, vp);
 			vp->op = op;
+			if (!*out) return -1;
 		}
 	}
 
@@ -343,15 +401,105 @@ static int detail_write(FILE *out, rlm_detail_t *inst, REQUEST *request, RADIUS_
 	return 0;
 }
 
+/** Encode a single detail entry for a binary detail file
+ *
+ * @param[out] out talloced record, with the file header if the file is
+ *	empty.  NULL if the packet is skipped.
+ * @param[in] inst Instance of rlm_detail.
+ * @param[in] request The current request.
+ * @param[in] packet associated with the request (request, reply, proxy-request, proxy-reply...).
+ * @param[in] compat Write out entry in compatibility mode.
+ * @param[in] outfd the file is open on.
+ */
+static int detail_write_binary(uint8_t **out, rlm_detail_t *inst, REQUEST *request, RADIUS_PACKET *packet,
+			       bool compat, int outfd)
+{
+	VALUE_PAIR	*vps = packet->vps;
+	uint8_t		*record;
+	ssize_t		len;
+	off_t		size;
+
+	*out = NULL;
+
+	if ((packet->code == PW_CODE_ACCOUNTING_REQUEST) && !packet->vps) {
+		RWDEBUG("Skipping empty packet");
+		return 0;
+	}
+
+	/*
+	 *	Only copy the attributes if we're not writing all of
+	 *	them.
+	 */
+	if (inst->ht || compat) {
+		VALUE_PAIR	*vp;
+		vp_cursor_t	cursor, out_cursor;
+
+		vps = NULL;
+		fr_cursor_init(&out_cursor, &vps);
+		for (vp = fr_cursor_init(&cursor, &packet->vps);
+		     vp;
+		     vp = fr_cursor_next(&cursor)) {
+			VALUE_PAIR *copy;
+
+			if (inst->ht && fr_hash_table_finddata(inst->ht, vp->da)) continue;
+			if (compat && !vp->da->vendor && (vp->da->attr == PW_USER_PASSWORD)) continue;
+
+			copy = fr_pair_copy(request, vp);
+			if (!copy) {
+				fr_pair_list_free(&vps);
+				RERROR("Out of memory formatting detail entry");
+				return -1;
+			}
+			fr_cursor_insert(&out_cursor, copy);
+		}
+	}
+
+	len = detail_binary_encode(request, &record, packet, vps, inst->log_srcdst, request->timestamp);
+	if (vps != packet->vps) fr_pair_list_free(&vps);
+	if (len < 0) {
+		RERROR("Failed encoding detail entry: %s", fr_strerror());
+		return -1;
+	}
+
+	size = exfile_size(inst->ef, outfd);
+	if (size < 0) {
+		talloc_free(record);
+		RERROR("%s", fr_strerror());
+		return -1;
+	}
+
+	/*
+	 *	New files start with the file header.
+	 */
+	if (size == 0) {
+		uint8_t *file;
+
+		file = talloc_array(request, uint8_t, DETAIL_BINARY_HEADER_LEN + len);
+		if (!file) {
+			talloc_free(record);
+			RERROR("Out of memory formatting detail entry");
+			return -1;
+		}
+
+		detail_binary_header(file);
+		memcpy(file + DETAIL_BINARY_HEADER_LEN, record, len);
+		talloc_free(record);
+		record = file;
+	}
+
+	*out = record;
+	return 0;
+}
+
 /*
  *	Do detail, compatible with old accounting
  */
 static rlm_rcode_t CC_HINT(nonnull) detail_do(void *instance, REQUEST *request, RADIUS_PACKET *packet, bool compat)
 {
-	int		outfd, dupfd;
+	int		outfd;
 	char		buffer[DIRLEN];
-
-	FILE		*outfp;
+	uint8_t		*entry = NULL;
+	size_t		len = 0;
 
 #ifdef HAVE_GRP_H
 	gid_t		gid;
@@ -409,31 +557,35 @@ static rlm_rcode_t CC_HINT(nonnull) detail_do(void *instance, REQUEST *request,
 	}
 
 skip_group:
-	/*
-	 *	Open the output fp for buffering.
-	 */
-	outfp = NULL;
-	dupfd = dup(outfd);
-	if (dupfd < 0) {
-		RERROR("Failed to dup() file descriptor for detail file");
-		goto fail;
+	if (inst->binary) {
+		if (detail_write_binary(&entry, inst, request, packet, compat, outfd) < 0) goto fail;
+		if (entry) len = talloc_array_length(entry);
+
+	} else {
+		char *text;
+
+		text = talloc_strdup(request, "");
+		if (!text || (detail_write(&text, inst, request, packet, compat) < 0)) {
+			talloc_free(text);
+			goto fail;
+		}
+		entry = (uint8_t *) text;
+		len = talloc_array_length(text) - 1;
 	}
 
-	if ((outfp = fdopen(dupfd, "a")) == NULL) {
-		RERROR("Couldn't open file %s: %s", buffer, fr_syserror(errno));
+	if (len && (exfile_write(inst->ef, outfd, entry, len) < 0)) {
+		RERROR("Failed writing to detail file %s: %s", buffer, fr_strerror());
 	fail:
-		if (outfp) fclose(outfp);
+		talloc_free(entry);
 		exfile_close(inst->ef, outfd);
 		return RLM_MODULE_FAIL;
 	}
+	talloc_free(entry);
 
-	if (detail_write(outfp, inst, request, packet, compat) < 0) goto fail;
-
-	/*
-	 *	Flush everything
-	 */
-	fclose(outfp);
-	exfile_close(inst->ef, outfd);
+	if (exfile_close(inst->ef, outfd) < 0) {
+		RERROR("%s", fr_strerror());
+		return RLM_MODULE_FAIL;
+	}
 
 	/*
 	 *	And everything is fine.
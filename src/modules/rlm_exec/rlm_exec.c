@@ -28,6 +28,9 @@ RCSID("$Id$")
 #include <freeradius-devel/modules.h>
 #include <freeradius-devel/rad_assert.h>
 
+#include <ctype.h>
+#include <sys/uio.h>
+
 /*
  *	Define a structure for our module configuration.
  */
@@ -44,8 +47,19 @@ typedef struct rlm_exec_t {
 	unsigned int	packet_code;
 	bool		shell_escape;
 	uint32_t	timeout;
+	bool		coprocess;
+	fr_connection_pool_t	*pool;
 } rlm_exec_t;
 
+/*
+ *	A long running copy of the program, for coprocess mode.
+ */
+typedef struct exec_coprocess {
+	pid_t		pid;
+	int		to_child;		//!< The program's stdin.
+	int		from_child;		//!< The program's stdout.
+} exec_coprocess_t;
+
 /*
  *	A mapping of configuration file names to internal variables.
  *
@@ -63,6 +77,7 @@ static const CONF_PARSER module_config[] = {
 	{ "packet_type", FR_CONF_OFFSET(PW_TYPE_STRING, rlm_exec_t, packet_type), NULL },
 	{ "shell_escape", FR_CONF_OFFSET(PW_TYPE_BOOLEAN, rlm_exec_t, shell_escape), "yes" },
 	{ "timeout", FR_CONF_OFFSET(PW_TYPE_INTEGER, rlm_exec_t, timeout), NULL },
+	{ "coprocess", FR_CONF_OFFSET(PW_TYPE_BOOLEAN, rlm_exec_t, coprocess), "no" },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -150,6 +165,254 @@ static rlm_rcode_t rlm_exec_status2rcode(REQUEST *request, char *answer, size_t
 	return status;
 }
 
+/*
+ *	Stop a coprocess.  Closing stdin should be enough, but it
+ *	may be stuck, so it's killed too.
+ */
+static int _mod_conn_free(exec_coprocess_t *child)
+{
+	int status;
+
+	if (child->to_child >= 0) close(child->to_child);
+	if (child->from_child >= 0) close(child->from_child);
+
+	if (child->pid > 0) {
+		kill(child->pid, SIGTERM);
+		rad_waitpid(child->pid, &status);
+	}
+
+	return 0;
+}
+
+/*
+ *	Start a coprocess for the connection pool
+ */
+static void *mod_conn_create(TALLOC_CTX *ctx, void *instance)
+{
+	rlm_exec_t		*inst = instance;
+	exec_coprocess_t	*child;
+
+	child = talloc_zero(ctx, exec_coprocess_t);
+	child->to_child = -1;
+	child->from_child = -1;
+	talloc_set_destructor(child, _mod_conn_free);
+
+	child->pid = radius_start_program(inst->program, NULL, true, &child->to_child, &child->from_child,
+					  NULL, inst->shell_escape);
+	if (child->pid < 0) {
+		ERROR("rlm_exec (%s): Failed starting coprocess", inst->xlat_name);
+		talloc_free(child);
+		return NULL;
+	}
+
+	if ((fr_nonblock(child->to_child) < 0) || (fr_nonblock(child->from_child) < 0)) {
+		ERROR("rlm_exec (%s): Failed setting coprocess pipes non-blocking: %s",
+		      inst->xlat_name, fr_syserror(errno));
+		talloc_free(child);
+		return NULL;
+	}
+
+	DEBUG2("rlm_exec (%s): Started coprocess PID %u", inst->xlat_name, (unsigned int) child->pid);
+
+	return child;
+}
+
+/** Read a reply from a coprocess
+ *
+ * The reply ends with a line containing only the status code.
+ *
+ * @return the status code, or -1 if the coprocess exited, or took longer than
+ *	the timeout.
+ */
+static int coprocess_read(rlm_exec_t const *inst, exec_coprocess_t *child, char *out, size_t outlen)
+{
+	size_t		done = 0;
+	char		*p;
+	int		status;
+	struct timeval	start, now, wake;
+
+	gettimeofday(&start, NULL);
+
+	while (done < (outlen - 1)) {
+		fd_set	fds;
+		ssize_t	len;
+		int	rcode;
+
+		gettimeofday(&now, NULL);
+		wake.tv_sec = start.tv_sec + inst->timeout - now.tv_sec;
+		wake.tv_usec = start.tv_usec - now.tv_usec;
+		if (wake.tv_usec < 0) {
+			wake.tv_usec += 1000000;
+			wake.tv_sec--;
+		}
+		if (wake.tv_sec < 0) {
+			fr_strerror_printf("Timed out after %u seconds", inst->timeout);
+			return -1;
+		}
+
+		FD_ZERO(&fds);
+		FD_SET(child->from_child, &fds);
+
+		rcode = select(child->from_child + 1, &fds, NULL, NULL, &wake);
+		if (rcode < 0) {
+			if (errno == EINTR) continue;
+
+			fr_strerror_printf("Failed waiting for reply: %s", fr_syserror(errno));
+			return -1;
+		}
+		if (rcode == 0) continue;
+
+		len = read(child->from_child, out + done, outlen - 1 - done);
+		if (len == 0) {
+			fr_strerror_printf("Coprocess exited");
+			return -1;
+		}
+		if (len < 0) {
+			if ((errno == EINTR) || (errno == EAGAIN)) continue;
+
+			fr_strerror_printf("Failed reading reply: %s", fr_syserror(errno));
+			return -1;
+		}
+		done += len;
+		out[done] = '\0';
+
+		/*
+		 *	Look for a last line of only digits.  Attributes
+		 *	are "name = value", so can't be mistaken for it.
+		 */
+		if ((done < 2) || (out[done - 1] != '\n')) continue;
+
+		p = out + done - 1;
+		while ((p > out) && isdigit((int) p[-1])) p--;
+		if ((p == out + done - 1) || ((p > out) && (p[-1] != '\n'))) continue;
+
+		status = atoi(p);
+		*p = '\0';
+
+		return status;
+	}
+
+	fr_strerror_printf("Reply too long");
+	return -1;
+}
+
+/** Pass a request to one of the pool of coprocesses
+ *
+ * The input pairs are written one per line, followed by an empty line.  The
+ * coprocess replies with the output pairs one per line, followed by a line
+ * with the status code.  That's the same as the exit code a program run with
+ * "wait = yes" would have returned.
+ *
+ * @param[in] inst Module instance.
+ * @param[in] request Current request.
+ * @param[out] out The output of the coprocess, if output pairs aren't wanted.
+ * @param[in] outlen Size of out.
+ * @param[in] ctx to allocate the output pairs in.
+ * @param[out] output_pairs Where to write the output pairs, may be NULL.
+ * @param[in] input_pairs to send to the coprocess.
+ * @return the status code, or -1 on failure.
+ */
+static int coprocess_exec(rlm_exec_t const *inst, REQUEST *request, char *out, size_t outlen,
+			  TALLOC_CTX *ctx, VALUE_PAIR **output_pairs, VALUE_PAIR *input_pairs)
+{
+	exec_coprocess_t	*child;
+	VALUE_PAIR		*vp;
+	vp_cursor_t		cursor;
+	char			*msg, *line, *next;
+	char			buffer[1024], answer[4096];
+	struct iovec		vector;
+	struct timeval		timeout;
+	int			status, tries;
+	size_t			len;
+
+	*out = '\0';
+
+	msg = talloc_strdup(request, "");
+	for (vp = fr_cursor_init(&cursor, &input_pairs); vp; vp = fr_cursor_next(&cursor)) {
+		/*
+		 *	Always "=", whatever operator the attribute
+		 *	was added with.
+		 */
+		vp_prints_value(buffer, sizeof(buffer), vp, '"');
+		if (vp->da->flags.has_tag && (vp->tag != TAG_ANY)) {
+			msg = talloc_asprintf_append_buffer(msg, "%s:%d = %s\n", vp->da->name, vp->tag, buffer);
+		} else {
+			msg = talloc_asprintf_append_buffer(msg, "%s = %s\n", vp->da->name, buffer);
+		}
+	}
+	msg = talloc_strdup_append_buffer(msg, "\n");
+	len = talloc_array_length(msg) - 1;
+
+	child = fr_connection_get(inst->pool);
+	if (!child) {
+		REDEBUG("No coprocesses available");
+		talloc_free(msg);
+		return -1;
+	}
+
+	/*
+	 *	A coprocess which has exited since it was last used
+	 *	is only noticed when we talk to it.  So if this one
+	 *	has gone away, start another, and try again.
+	 */
+	for (tries = 0; ; tries++) {
+		RDEBUG2("Sending request to coprocess PID %u", (unsigned int) child->pid);
+
+		memcpy(&vector.iov_base, &msg, sizeof(vector.iov_base));
+		vector.iov_len = len;
+		timeout.tv_sec = inst->timeout;
+		timeout.tv_usec = 0;
+
+		if (fr_writev(child->to_child, &vector, 1, &timeout) == (ssize_t) len) {
+			status = coprocess_read(inst, child, answer, sizeof(answer));
+			if (status >= 0) break;
+		} else {
+			fr_strerror_printf("Failed writing request: %s", fr_syserror(errno));
+		}
+
+		REDEBUG("Coprocess PID %u failed: %s", (unsigned int) child->pid, fr_strerror());
+
+		if (tries > 0) {
+			fr_connection_close(inst->pool, child, "coprocess failed");
+			talloc_free(msg);
+			return -1;
+		}
+
+		child = fr_connection_reconnect(inst->pool, child);
+		if (!child) {
+			REDEBUG("Unable to restart coprocess");
+			talloc_free(msg);
+			return -1;
+		}
+	}
+
+	fr_connection_release(inst->pool, child);
+	talloc_free(msg);
+
+	RDEBUG2("Coprocess returned code (%d)", status);
+
+	if (!output_pairs) {
+		strlcpy(out, answer, outlen);
+		return status;
+	}
+
+	for (line = answer; *line; line = next) {
+		next = strchr(line, '\n');
+		if (next) *next++ = '\0';
+		if (!*line) continue;
+
+		if (fr_pair_list_afrom_str(ctx, line, output_pairs) == T_INVALID) {
+			REDEBUG("Failed parsing output from coprocess: %s", fr_strerror());
+			strlcpy(out, line, outlen);
+			return -1;
+		}
+
+		if (!next) break;
+	}
+
+	return status;
+}
+
 /*
  *	Do xlat of strings.
  */
@@ -278,6 +541,42 @@ static int mod_bootstrap(CONF_SECTION *conf, void *instance)
 		return -1;
 	}
 
+	if (inst->coprocess) {
+		if (!inst->program) {
+			cf_log_err_cs(conf, "'coprocess' requires a 'program' to run");
+			return -1;
+		}
+
+		if (!inst->wait) {
+			cf_log_err_cs(conf, "'coprocess' cannot be used with wait = no");
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ *	Start the coprocesses
+ */
+static int mod_instantiate(CONF_SECTION *conf, void *instance)
+{
+	rlm_exec_t	*inst = instance;
+
+	if (!inst->coprocess) return 0;
+
+	inst->pool = fr_connection_pool_module_init(conf, inst, mod_conn_create, NULL, NULL);
+	if (!inst->pool) return -1;
+
+	return 0;
+}
+
+static int mod_detach(void *instance)
+{
+	rlm_exec_t	*inst = instance;
+
+	fr_connection_pool_free(inst->pool);
+
 	return 0;
 }
 
@@ -338,13 +637,18 @@ static rlm_rcode_t CC_HINT(nonnull) mod_exec_dispatch(void *instance, REQUEST *r
 		ctx = radius_list_ctx(request, inst->output_list);
 	}
 
-	/*
-	 *	This function does it's own xlat of the input program
-	 *	to execute.
-	 */
-	status = radius_exec_program(ctx, out, sizeof(out), inst->output ? &answer : NULL, request,
-				     inst->program, inst->input ? *input_pairs : NULL,
-				     inst->wait, inst->shell_escape, inst->timeout);
+	if (inst->coprocess) {
+		status = coprocess_exec(inst, request, out, sizeof(out), ctx, inst->output ? &answer : NULL,
+					inst->input ? *input_pairs : NULL);
+	} else {
+		/*
+		 *	This function does it's own xlat of the input program
+		 *	to execute.
+		 */
+		status = radius_exec_program(ctx, out, sizeof(out), inst->output ? &answer : NULL, request,
+					     inst->program, inst->input ? *input_pairs : NULL,
+					     inst->wait, inst->shell_escape, inst->timeout);
+	}
 	rcode = rlm_exec_status2rcode(request, out, strlen(out), status);
 
 	/*
@@ -467,10 +771,12 @@ extern module_t rlm_exec;
 module_t rlm_exec = {
 	.magic		= RLM_MODULE_INIT,
 	.name		= "exec",
-	.type		= RLM_TYPE_THREAD_SAFE,
+	.type		= RLM_TYPE_THREAD_SAFE | RLM_TYPE_PARALLEL_START,
 	.inst_size	= sizeof(rlm_exec_t),
 	.config		= module_config,
 	.bootstrap	= mod_bootstrap,
+	.instantiate	= mod_instantiate,
+	.detach		= mod_detach,
 	.methods = {
 		[MOD_AUTHENTICATE]	= mod_exec_dispatch,
 		[MOD_AUTHORIZE]		= mod_exec_dispatch,
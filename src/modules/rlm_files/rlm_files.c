@@ -26,44 +26,123 @@ RCSID("$Id$")
 
 #include	<freeradius-devel/radiusd.h>
 #include	<freeradius-devel/modules.h>
+#include	<freeradius-devel/rad_assert.h>
+#include	<freeradius-devel/snapshot.h>
 
 #include	<ctype.h>
 #include	<fcntl.h>
 
+/** A check item compared directly against the request
+ *
+ * Wire attributes with plain comparison operators, which paircompare()
+ * would otherwise find by walking the request, and compare by value.
+ */
+typedef struct files_cmp {
+	VALUE_PAIR		*check;		//!< Check item from the entry.
+#ifdef HAVE_REGEX
+	regex_t			*preg;		//!< Pre-compiled pattern for =~ and !~.
+#endif
+} files_cmp_t;
+
+typedef struct files_entry files_entry_t;
+
+/** An entry from a users file, compiled for matching
+ */
+struct files_entry {
+	PAIR_LIST const		*pl;		//!< Entry as read from the file.
+
+	files_cmp_t		*cmp;		//!< Check items compared directly.
+	uint32_t		num_cmp;	//!< Number of check items in cmp.
+
+	VALUE_PAIR		*check;		//!< Remaining check items, passed to paircompare().
+	VALUE_PAIR		*config;	//!< Check items added to the control list on a match.
+	bool			expand;		//!< check contains xlats, and is copied and expanded
+						//!< for every request.
+	bool			fall_through;	//!< Continue looking for entries after a match.
+
+	files_entry_t		*next;		//!< Next entry with the same name.
+};
+
+/** DEFAULT entries with the same equality check
+ */
+typedef struct files_key {
+	VALUE_PAIR const	*vp;		//!< Attribute and value the entries check for.
+	files_entry_t		**entries;	//!< Entries keyed on vp, in file order.
+	uint32_t		num_entries;
+} files_key_t;
+
+/** Attribute used as a key in the DEFAULT index
+ */
+typedef struct files_key_da {
+	DICT_ATTR const		*da;
+	uint32_t		values;		//!< Number of distinct values checked for.
+	uint32_t		entries;	//!< Number of entries keyed on this attribute.
+} files_key_da_t;
+
+/** A compiled users file
+ */
+typedef struct files_db {
+	rbtree_t		*users;		//!< First entry for each name, other than DEFAULT.
+
+	files_entry_t		**defaults;	//!< All DEFAULT entries, in file order.
+	uint32_t		num_defaults;
+
+	files_entry_t		**unkeyed;	//!< DEFAULT entries not in the index, in file order.
+	uint32_t		num_unkeyed;
+
+	rbtree_t		*index;		//!< DEFAULT entries, by their most selective
+						//!< equality check.
+	files_key_da_t		*keys;		//!< Attributes used as keys in the index.
+	uint32_t		num_keys;
+} files_db_t;
+
+/** Every file the module reads
+ *
+ * Built as one snapshot, so that a reload replaces all of them together.
+ */
+typedef struct rlm_files_data_t {
+	files_db_t *common;
+	files_db_t *users;
+	files_db_t *auth_users;
+	files_db_t *acctusers;
+#ifdef WITH_PROXY
+	files_db_t *preproxy_users;
+	files_db_t *postproxy_users;
+#endif
+	files_db_t *postauth_users;
+} rlm_files_data_t;
+
 typedef struct rlm_files_t {
+	char const *name;		//!< Instance name, used to find the snapshot.
+
 	char const *compat_mode;
 
 	char const *key;
 
+	uint32_t check_interval;	//!< How often to check whether the files have changed.
+	fr_snapshot_t *snapshot;	//!< The current rlm_files_data_t.
+
 	char const *filename;
-	rbtree_t *common;
 
 	/* autz */
 	char const *usersfile;
-	rbtree_t *users;
-
 
 	/* authenticate */
 	char const *auth_usersfile;
-	rbtree_t *auth_users;
 
 	/* preacct */
 	char const *acctusersfile;
-	rbtree_t *acctusers;
 
 #ifdef WITH_PROXY
 	/* pre-proxy */
 	char const *preproxy_usersfile;
-	rbtree_t *preproxy_users;
 
 	/* post-proxy */
 	char const *postproxy_usersfile;
-	rbtree_t *postproxy_users;
 #endif
 
 	/* post-authenticate */
 	char const *postauth_usersfile;
-	rbtree_t *postauth_users;
 } rlm_files_t;
 
 
@@ -90,26 +169,374 @@ static const CONF_PARSER module_config[] = {
 	{ "postauth_usersfile", FR_CONF_OFFSET(PW_TYPE_FILE_INPUT, rlm_files_t, postauth_usersfile), NULL },
 	{ "compat", FR_CONF_OFFSET(PW_TYPE_STRING | PW_TYPE_DEPRECATED, rlm_files_t, compat_mode), NULL },
 	{ "key", FR_CONF_OFFSET(PW_TYPE_STRING | PW_TYPE_XLAT, rlm_files_t, key), NULL },
+	{ "check_interval", FR_CONF_OFFSET(PW_TYPE_INTEGER, rlm_files_t, check_interval), "0" },
 	CONF_PARSER_TERMINATOR
 };
 
 
-static int pairlist_cmp(void const *a, void const *b)
+static int entry_cmp(void const *one, void const *two)
 {
-	return strcmp(((PAIR_LIST const *)a)->name,
-		      ((PAIR_LIST const *)b)->name);
+	files_entry_t const *a = one, *b = two;
+
+	return strcmp(a->pl->name, b->pl->name);
+}
+
+static int entry_order_cmp(void const *one, void const *two)
+{
+	files_entry_t const * const *a = one, * const *b = two;
+
+	return (*a)->pl->order - (*b)->pl->order;
+}
+
+/** Get the bytes a value is indexed by
+ *
+ * @param[in] vp to get the value of.
+ * @param[out] len of the value.
+ * @return the value, or NULL if values of this type can't be indexed.
+ */
+static uint8_t const *key_value(VALUE_PAIR const *vp, size_t *len)
+{
+	switch (vp->da->type) {
+	/*
+	 *	radius_compare_vps() uses strcmp()
+	 */
+	case PW_TYPE_STRING:
+		*len = strlen(vp->vp_strvalue);
+		return (uint8_t const *) vp->vp_strvalue;
+
+	case PW_TYPE_OCTETS:
+		*len = vp->vp_length;
+		return vp->vp_octets;
+
+	case PW_TYPE_BYTE:
+		*len = sizeof(vp->vp_byte);
+		return &vp->vp_byte;
+
+	case PW_TYPE_SHORT:
+		*len = sizeof(vp->vp_short);
+		return (uint8_t const *) &vp->vp_short;
+
+	case PW_TYPE_INTEGER:
+		*len = sizeof(vp->vp_integer);
+		return (uint8_t const *) &vp->vp_integer;
+
+	case PW_TYPE_INTEGER64:
+		*len = sizeof(vp->vp_integer64);
+		return (uint8_t const *) &vp->vp_integer64;
+
+	case PW_TYPE_SIGNED:
+		*len = sizeof(vp->vp_signed);
+		return (uint8_t const *) &vp->vp_signed;
+
+	case PW_TYPE_DATE:
+		*len = sizeof(vp->vp_date);
+		return (uint8_t const *) &vp->vp_date;
+
+	case PW_TYPE_IPV4_ADDR:
+		*len = sizeof(vp->vp_ipaddr);
+		return (uint8_t const *) &vp->vp_ipaddr;
+
+	case PW_TYPE_IPV6_ADDR:
+		*len = sizeof(vp->vp_ipv6addr);
+		return (uint8_t const *) &vp->vp_ipv6addr;
+
+	case PW_TYPE_IFID:
+		*len = sizeof(vp->vp_ifid);
+		return vp->vp_ifid;
+
+	default:
+		return NULL;
+	}
+}
+
+static int key_cmp(void const *one, void const *two)
+{
+	files_key_t const *a = one, *b = two;
+	uint8_t const *a_value, *b_value;
+	size_t a_len, b_len;
+
+	if (a->vp->da != b->vp->da) return (a->vp->da < b->vp->da) ? -1 : +1;
+
+	a_value = key_value(a->vp, &a_len);
+	b_value = key_value(b->vp, &b_len);
+
+	if (a_len != b_len) return (a_len < b_len) ? -1 : +1;
+	if (!a_len) return 0;
+
+	return memcmp(a_value, b_value, a_len);
+}
+
+/** Whether a check item can be compared directly against the request
+ *
+ * Only wire attributes are, as paircompare() skips or special cases many
+ * of the server attributes.  Attributes with registered comparisons are
+ * checked for when the entry is evaluated, as the modules registering them
+ * may be instantiated after us.
+ */
+static bool file_cmp_direct(VALUE_PAIR const *vp)
+{
+	if (vp->type == VT_XLAT) return false;
+
+	if (!vp->da->vendor && ((vp->da->attr >= 0x100) || (vp->da->attr == PW_USER_PASSWORD))) return false;
+
+	switch (vp->op) {
+	case T_OP_CMP_EQ:
+	case T_OP_NE:
+	case T_OP_LT:
+	case T_OP_GT:
+	case T_OP_LE:
+	case T_OP_GE:
+	case T_OP_CMP_TRUE:
+	case T_OP_CMP_FALSE:
+		return true;
+
+#ifdef HAVE_REGEX
+	case T_OP_REG_EQ:
+	case T_OP_REG_NE:
+		return (vp->da->type == PW_TYPE_STRING);
+#endif
+
+	default:
+		return false;
+	}
+}
+
+/** Whether DEFAULT entries can be indexed by a check item
+ */
+static bool file_cmp_key(VALUE_PAIR const *vp)
+{
+	size_t len;
+
+	if (vp->op != T_OP_CMP_EQ) return false;
+
+	if (vp->da->flags.has_tag) return false;
+
+	if (!key_value(vp, &len)) return false;
+
+	/*
+	 *	strcmp() would stop at the embedded '\0'
+	 */
+	if ((vp->da->type == PW_TYPE_STRING) && (len != vp->vp_length)) return false;
+
+	return true;
+}
+
+/** Parse double quoted check items which don't contain any expansions
+ *
+ * Anything double quoted is marked as an xlat, even if there's nothing to
+ * expand, and so would be expanded and parsed for every request.
+ * Values which don't parse are left for radius_xlat_do() to complain about.
+ */
+static void file_literal(VALUE_PAIR *vp)
+{
+	char const *xlat = vp->value.xlat;
+
+	if (vp->type != VT_XLAT) return;
+
+	if (strchr(xlat, '%') || strchr(xlat, '\\')) return;
+
+	vp->type = VT_DATA;
+	vp->value.xlat = NULL;
+
+	if ((vp->op == T_OP_REG_EQ) || (vp->op == T_OP_REG_NE)) {
+		fr_pair_value_strcpy(vp, xlat);
+
+	} else if (fr_pair_value_from_str(vp, xlat, -1) < 0) {
+		vp->type = VT_XLAT;
+		vp->value.xlat = xlat;
+		return;
+	}
+
+	rad_const_free(xlat);
+}
+
+/** Compile an entry from a users file
+ *
+ * Parses literal values, and splits the check items into those which can be
+ * compared directly against
+ * the request, and those which still need paircompare().  Regular expressions
+ * are compiled here, unless another check item in the entry sets subcaptures
+ * at run time, in which case they're all left for paircompare() so that
+ * %{0}..%{n} still come from the last one.
+ *
+ * @param ctx to allocate the entry in.
+ * @param pl to compile.
+ * @return the compiled entry.
+ */
+static files_entry_t *file_compile(TALLOC_CTX *ctx, PAIR_LIST *pl)
+{
+	vp_cursor_t	cursor, check, config;
+	VALUE_PAIR	*vp;
+	files_entry_t	*entry;
+	uint32_t	num = 0;
+	bool		runtime_regex = false;
+
+	entry = talloc_zero(ctx, files_entry_t);
+	entry->pl = pl;
+	entry->fall_through = fall_through(pl->reply);
+
+	for (vp = fr_cursor_init(&cursor, &pl->check); vp; vp = fr_cursor_next(&cursor)) {
+		file_literal(vp);
+
+		if (((vp->op == T_OP_REG_EQ) || (vp->op == T_OP_REG_NE)) && !file_cmp_direct(vp)) {
+			runtime_regex = true;
+		}
+		num++;
+	}
+
+	entry->cmp = talloc_zero_array(entry, files_cmp_t, num);
+	fr_cursor_init(&check, &entry->check);
+	fr_cursor_init(&config, &entry->config);
+
+	for (vp = fr_cursor_init(&cursor, &pl->check); vp; vp = fr_cursor_next(&cursor)) {
+		if (file_cmp_direct(vp)) {
+			files_cmp_t *cmp = &entry->cmp[entry->num_cmp];
+
+#ifdef HAVE_REGEX
+			if ((vp->op == T_OP_REG_EQ) || (vp->op == T_OP_REG_NE)) {
+				if (runtime_regex ||
+				    (regex_compile(entry, &cmp->preg, vp->vp_strvalue, vp->vp_length,
+						   false, false, true, false) <= 0)) goto runtime;
+			}
+#endif
+			cmp->check = vp;
+			entry->num_cmp++;
+			continue;
+		}
+
+#ifdef HAVE_REGEX
+	runtime:
+#endif
+		if (vp->type == VT_XLAT) entry->expand = true;
+
+		fr_cursor_insert(&check, fr_pair_copy(entry, vp));
+
+		switch (vp->op) {
+		case T_OP_EQ:
+		case T_OP_SET:
+		case T_OP_ADD:
+			fr_cursor_insert(&config, fr_pair_copy(entry, vp));
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	return entry;
+}
+
+/** Index the DEFAULT entries by their most selective equality check
+ *
+ * The selectivity of an attribute is the number of distinct values the
+ * DEFAULT entries check for it.  Entries without an equality check we can
+ * index on are evaluated for every request.
+ *
+ * @param db to index.
+ * @return 0 on success, -1 on error.
+ */
+static int file_index(files_db_t *db)
+{
+	uint32_t	i, j, k;
+	files_key_t	*key, my_key;
+	files_entry_t	*entry;
+
+	db->unkeyed = talloc_array(db, files_entry_t *, db->num_defaults);
+	if (!db->unkeyed) return -1;
+
+	db->index = rbtree_create(db, key_cmp, NULL, RBTREE_FLAG_NONE);
+	if (!db->index) return -1;
+
+	for (i = 0; i < db->num_defaults; i++) {
+		entry = db->defaults[i];
+
+		for (j = 0; j < entry->num_cmp; j++) {
+			my_key.vp = entry->cmp[j].check;
+			if (!file_cmp_key(my_key.vp)) continue;
+
+			if (rbtree_finddata(db->index, &my_key)) continue;
+
+			key = talloc_zero(db->index, files_key_t);
+			key->vp = my_key.vp;
+			if (!rbtree_insert(db->index, key)) return -1;
+
+			for (k = 0; k < db->num_keys; k++) {
+				if (db->keys[k].da == key->vp->da) break;
+			}
+
+			if (k == db->num_keys) {
+				db->keys = talloc_realloc(db, db->keys, files_key_da_t, db->num_keys + 1);
+				if (!db->keys) return -1;
+
+				db->keys[k].da = key->vp->da;
+				db->keys[k].values = 0;
+				db->keys[k].entries = 0;
+				db->num_keys++;
+			}
+			db->keys[k].values++;
+		}
+	}
+
+	for (i = 0; i < db->num_defaults; i++) {
+		files_key_da_t	*best = NULL;
+
+		entry = db->defaults[i];
+		my_key.vp = NULL;
+
+		for (j = 0; j < entry->num_cmp; j++) {
+			if (!file_cmp_key(entry->cmp[j].check)) continue;
+
+			for (k = 0; k < db->num_keys; k++) {
+				if (db->keys[k].da == entry->cmp[j].check->da) break;
+			}
+			rad_assert(k < db->num_keys);
+
+			if (!best || (db->keys[k].values > best->values)) {
+				best = &db->keys[k];
+				my_key.vp = entry->cmp[j].check;
+			}
+		}
+
+		if (!best) {
+			db->unkeyed[db->num_unkeyed++] = entry;
+			continue;
+		}
+
+		key = rbtree_finddata(db->index, &my_key);
+		rad_assert(key != NULL);
+
+		key->entries = talloc_realloc(key, key->entries, files_entry_t *, key->num_entries + 1);
+		if (!key->entries) return -1;
+		key->entries[key->num_entries++] = entry;
+		best->entries++;
+	}
+
+	/*
+	 *	Only look up attributes which entries were keyed on.
+	 */
+	for (j = 0, k = 0; k < db->num_keys; k++) {
+		if (db->keys[k].entries) db->keys[j++] = db->keys[k];
+	}
+	db->num_keys = j;
+
+	if (!db->num_keys) {
+		TALLOC_FREE(db->index);
+		TALLOC_FREE(db->keys);
+	}
+
+	return 0;
 }
 
-static int getusersfile(TALLOC_CTX *ctx, char const *filename, rbtree_t **ptree, char const *compat_mode_str)
+static int getusersfile(TALLOC_CTX *ctx, char const *filename, files_db_t **pdb, char const *compat_mode_str)
 {
 	int rcode;
 	PAIR_LIST *users = NULL;
 	PAIR_LIST *entry, *next;
-	PAIR_LIST *user_list, *default_list, **default_tail;
-	rbtree_t *tree;
+	files_entry_t *compiled, *user_list;
+	files_db_t *db;
 
 	if (!filename) {
-		*ptree = NULL;
+		*pdb = NULL;
 		return 0;
 	}
 
@@ -235,14 +662,27 @@ static int getusersfile(TALLOC_CTX *ctx, char const *filename, rbtree_t **ptree,
 		}
 	}
 
-	tree = rbtree_create(ctx, pairlist_cmp, NULL, RBTREE_FLAG_NONE);
-	if (!tree) {
+	db = talloc_zero(ctx, files_db_t);
+	if (!db) {
+		pairlist_free(&users);
+		return -1;
+	}
+
+	db->users = rbtree_create(db, entry_cmp, NULL, RBTREE_FLAG_NONE);
+	if (!db->users) {
+	error:
 		pairlist_free(&users);
+		talloc_free(db);
 		return -1;
 	}
 
-	default_list = NULL;
-	default_tail = &default_list;
+	for (entry = users; entry != NULL; entry = entry->next) {
+		if (strcmp(entry->name, "DEFAULT") == 0) db->num_defaults++;
+	}
+
+	db->defaults = talloc_array(db, files_entry_t *, db->num_defaults);
+	if (!db->defaults) goto error;
+	db->num_defaults = 0;
 
 	/*
 	 *	We've read the entries in linearly, but putting them
@@ -255,47 +695,28 @@ static int getusersfile(TALLOC_CTX *ctx, char const *filename, rbtree_t **ptree,
 		 */
 		next = entry->next;
 		entry->next = NULL;
-		(void) talloc_steal(tree, entry);
+		(void) talloc_steal(db, entry);
+		users = next;
+
+		compiled = file_compile(db, entry);
 
 		/*
 		 *	DEFAULT entries get their own list.
 		 */
 		if (strcmp(entry->name, "DEFAULT") == 0) {
-			if (!default_list) {
-				default_list = entry;
-
-				/*
-				 *	Insert the first DEFAULT into the tree.
-				 */
-				if (!rbtree_insert(tree, entry)) {
-				error:
-					pairlist_free(&entry);
-					pairlist_free(&next);
-					rbtree_free(tree);
-					return -1;
-				}
-
-			} else {
-				/*
-				 *	Tack this entry onto the tail
-				 *	of the DEFAULT list.
-				 */
-				*default_tail = entry;
-			}
-
-			default_tail = &entry->next;
+			db->defaults[db->num_defaults++] = compiled;
 			continue;
 		}
 
 		/*
 		 *	Not DEFAULT, must be a normal user.
 		 */
-		user_list = rbtree_finddata(tree, entry);
+		user_list = rbtree_finddata(db->users, compiled);
 		if (!user_list) {
 			/*
 			 *	Insert the first one.
 			 */
-			if (!rbtree_insert(tree, entry)) goto error;
+			if (!rbtree_insert(db->users, compiled)) goto error;
 		} else {
 			/*
 			 *	Find the tail of this list, and add it
@@ -303,11 +724,18 @@ static int getusersfile(TALLOC_CTX *ctx, char const *filename, rbtree_t **ptree,
 			 */
 			while (user_list->next) user_list = user_list->next;
 
-			user_list->next = entry;
+			user_list->next = compiled;
 		}
 	}
 
-	*ptree = tree;
+	if (file_index(db) < 0) goto error;
+
+	if (db->index) {
+		DEBUG("[%s] Indexed %u of %u DEFAULT entries", filename,
+		      db->num_defaults - db->num_unkeyed, db->num_defaults);
+	}
+
+	*pdb = db;
 
 	return 0;
 }
@@ -315,14 +743,18 @@ static int getusersfile(TALLOC_CTX *ctx, char const *filename, rbtree_t **ptree,
 
 
 /*
- *	(Re-)read the "users" file into memory.
+ *	(Re-)read the "users" files into memory.
  */
-static int mod_instantiate(UNUSED CONF_SECTION *conf, void *instance)
+static void *mod_build(TALLOC_CTX *ctx, void *uctx)
 {
-	rlm_files_t *inst = instance;
+	rlm_files_t *inst = uctx;
+	rlm_files_data_t *data;
+
+	data = talloc_zero(ctx, rlm_files_data_t);
+	if (!data) return NULL;
 
 #undef READFILE
-#define READFILE(_x, _y) do { if (getusersfile(inst, inst->_x, &inst->_y, inst->compat_mode) != 0) { ERROR("Failed reading %s", inst->_x); return -1;} } while (0)
+#define READFILE(_x, _y) do { if (getusersfile(data, inst->_x, &data->_y, inst->compat_mode) != 0) { ERROR("Failed reading %s", inst->_x); talloc_free(data); return NULL;} } while (0)
 
 	READFILE(filename, common);
 	READFILE(usersfile, users);
@@ -336,21 +768,272 @@ static int mod_instantiate(UNUSED CONF_SECTION *conf, void *instance)
 	READFILE(auth_usersfile, auth_users);
 	READFILE(postauth_usersfile, postauth_users);
 
+	return data;
+}
+
+/*
+ *	Loading large files can take a while, so it's done as a
+ *	startup job, in parallel with the startup of other modules.
+ */
+static int mod_load(void *uctx)
+{
+	return fr_snapshot_load(uctx);
+}
+
+static int mod_instantiate(CONF_SECTION *conf, void *instance)
+{
+	rlm_files_t *inst = instance;
+
+	inst->name = cf_section_name2(conf);
+	if (!inst->name) inst->name = cf_section_name1(conf);
+
+	inst->snapshot = fr_snapshot_init(inst, inst->name, mod_build, inst, inst->check_interval);
+	if (!inst->snapshot) return -1;
+
+#undef WATCHFILE
+#define WATCHFILE(_x) do { if (inst->_x && (fr_snapshot_watch(inst->snapshot, inst->_x) < 0)) return -1; } while (0)
+
+	WATCHFILE(filename);
+	WATCHFILE(usersfile);
+	WATCHFILE(acctusersfile);
+
+#ifdef WITH_PROXY
+	WATCHFILE(preproxy_usersfile);
+	WATCHFILE(postproxy_usersfile);
+#endif
+
+	WATCHFILE(auth_usersfile);
+	WATCHFILE(postauth_usersfile);
+
+	return module_job_add(mod_load, inst->snapshot);
+}
+
+/** Copy a list of check items, and expand any xlats
+ *
+ * @return 0 on success, -1 if an expansion failed.
+ */
+static int file_expand(REQUEST *request, VALUE_PAIR **out, VALUE_PAIR *check)
+{
+	vp_cursor_t	cursor;
+	VALUE_PAIR	*vp;
+
+	*out = fr_pair_list_copy(request, check);
+	for (vp = fr_cursor_init(&cursor, out);
+	     vp;
+	     vp = fr_cursor_next(&cursor)) {
+		if (radius_xlat_do(request, vp) < 0) {
+			RWARN("Failed parsing expanded value for check item, skipping entry: %s", fr_strerror());
+			fr_pair_list_free(out);
+			return -1;
+		}
+	}
+
 	return 0;
 }
 
+#ifdef HAVE_REGEX
+/** Match a pre-compiled regular expression against a request attribute
+ *
+ * @return 0 if the check item matched, -1 if it didn't, -2 on error.
+ */
+static int file_regex(REQUEST *request, files_cmp_t const *cmp, VALUE_PAIR *vp)
+{
+	int		ret;
+	regex_t		*preg = cmp->preg;
+	regmatch_t	rxmatch[REQUEST_MAX_REGEX + 1];	/* +1 for %{0} (whole match) capture group */
+	size_t		nmatch = sizeof(rxmatch) / sizeof(regmatch_t);
+
+	ret = regex_exec(preg, vp->vp_strvalue, vp->vp_length, rxmatch, &nmatch);
+	if (ret < 0) {
+		RERROR("%s", fr_strerror());
+		return -2;
+	}
+
+	if (cmp->check->op == T_OP_REG_NE) return (ret != 1) ? 0 : -1;
+
+	/*
+	 *	Add in %{0}. %{1}, etc.
+	 */
+	regex_sub_to_request(request, &preg, vp->vp_strvalue, vp->vp_length, rxmatch, nmatch);
+
+	return (ret == 1) ? 0 : -1;
+}
+#endif
+
+/** Compare a check item against the instances of its attribute in the request
+ *
+ * As paircompare() does for attributes without a registered comparison,
+ * the check item matches if any instance of the attribute satisfies it.
+ *
+ * @return 0 if the check item matched, -1 if it didn't.
+ */
+static int file_cmp(REQUEST *request, VALUE_PAIR *req_list, files_cmp_t const *cmp)
+{
+	vp_cursor_t	cursor;
+	VALUE_PAIR	*vp;
+	VALUE_PAIR	*check = cmp->check;
+	int		compare;
+
+	fr_cursor_init(&cursor, &req_list);
+	while ((vp = fr_cursor_next_by_da(&cursor, check->da, TAG_ANY))) {
+		if (check->op == T_OP_CMP_FALSE) return -1;
+
+#ifdef HAVE_REGEX
+		if (cmp->preg) {
+			if (file_regex(request, cmp, vp) == 0) return 0;
+			continue;
+		}
+#endif
+
+		compare = radius_compare_vps(request, check, vp);
+
+		switch (check->op) {
+		case T_OP_CMP_TRUE:
+		case T_OP_CMP_EQ:
+			if (compare == 0) return 0;
+			break;
+
+		case T_OP_NE:
+			if (compare != 0) return 0;
+			break;
+
+		case T_OP_LT:
+			if (compare < 0) return 0;
+			break;
+
+		case T_OP_GT:
+			if (compare > 0) return 0;
+			break;
+
+		case T_OP_LE:
+			if (compare <= 0) return 0;
+			break;
+
+		case T_OP_GE:
+			if (compare >= 0) return 0;
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	return (check->op == T_OP_CMP_FALSE) ? 0 : -1;
+}
+
+/** See if an entry matches the request
+ *
+ * @param[in] request Current request.
+ * @param[in] entry to match.
+ * @param[in] request_packet to compare the check items with.
+ * @param[in] reply_packet to pass to registered comparisons.
+ * @param[out] config items to add to the control list, allocated in the request.
+ * @return 0 on match, -1 if the entry didn't match.
+ */
+static int file_match(REQUEST *request, files_entry_t const *entry,
+		      RADIUS_PACKET *request_packet, RADIUS_PACKET *reply_packet, VALUE_PAIR **config)
+{
+	uint32_t	i;
+	VALUE_PAIR	*check_tmp = NULL;
+	VALUE_PAIR	*check = entry->check;
+
+	/*
+	 *	Comparisons registered since the file was compiled
+	 *	mean we have to do this the slow way.
+	 */
+	for (i = 0; i < entry->num_cmp; i++) {
+		if (!radius_find_compare(entry->cmp[i].check->da)) continue;
+
+		if (file_expand(request, &check_tmp, entry->pl->check) < 0) return -1;
+
+		if (paircompare(request, request_packet->vps, check_tmp, &reply_packet->vps) != 0) goto fail;
+
+		*config = check_tmp;
+		return 0;
+	}
+
+	if (entry->expand) {
+		if (file_expand(request, &check_tmp, entry->check) < 0) return -1;
+		check = check_tmp;
+	}
+
+	for (i = 0; i < entry->num_cmp; i++) {
+		if (file_cmp(request, request_packet->vps, &entry->cmp[i]) < 0) goto fail;
+	}
+
+	if (check && (paircompare(request, request_packet->vps, check, &reply_packet->vps) != 0)) goto fail;
+
+	*config = entry->expand ? check_tmp : fr_pair_list_copy(request, entry->config);
+	return 0;
+
+fail:
+	fr_pair_list_free(&check_tmp);
+	return -1;
+}
+
+/** Find the DEFAULT entries in the index which may match the request
+ *
+ * @param[in] request Current request.
+ * @param[in] db to search.
+ * @param[in] req_list attributes to look up.
+ * @param[out] hits entries, in file order, allocated in the request.
+ * @return the number of entries found.
+ */
+static uint32_t file_index_find(REQUEST *request, files_db_t const *db, VALUE_PAIR *req_list, files_entry_t ***hits)
+{
+	vp_cursor_t	cursor;
+	VALUE_PAIR	*vp;
+	files_key_t	*key, my_key;
+	files_entry_t	**out = NULL;
+	uint32_t	i, j, num = 0;
+
+	for (i = 0; i < db->num_keys; i++) {
+		fr_cursor_init(&cursor, &req_list);
+		while ((vp = fr_cursor_next_by_da(&cursor, db->keys[i].da, TAG_ANY))) {
+			my_key.vp = vp;
+			key = rbtree_finddata(db->index, &my_key);
+			if (!key) continue;
+
+			out = talloc_realloc(request, out, files_entry_t *, num + key->num_entries);
+			memcpy(out + num, key->entries, sizeof(out[0]) * key->num_entries);
+			num += key->num_entries;
+		}
+	}
+
+	/*
+	 *	Put the entries back in order, and remove the
+	 *	duplicates from attributes which appear more than
+	 *	once with the same value.
+	 */
+	if (num > 1) {
+		qsort(out, num, sizeof(out[0]), entry_order_cmp);
+
+		for (i = 1, j = 1; i < num; i++) {
+			if (out[i] != out[j - 1]) out[j++] = out[i];
+		}
+		num = j;
+	}
+
+	*hits = out;
+
+	return num;
+}
+
 /*
- *	Common code called by everything below.
+ *	Find the entries matching the request in one file.
  */
-static rlm_rcode_t file_common(rlm_files_t *inst, REQUEST *request, char const *filename, rbtree_t *tree,
+static rlm_rcode_t file_search(rlm_files_t *inst, REQUEST *request, char const *filename, files_db_t *db,
 			       RADIUS_PACKET *request_packet, RADIUS_PACKET *reply_packet)
 {
 	char const	*name;
-	VALUE_PAIR	*check_tmp;
+	VALUE_PAIR	*config_tmp;
 	VALUE_PAIR	*reply_tmp;
-	PAIR_LIST const *user_pl, *default_pl;
+	files_entry_t const *user_pl;
+	files_entry_t	**default_pl, **hits = NULL;
+	uint32_t	num_defaults, num_hits = 0, i = 0, j = 0, k;
 	bool		found = false;
 	PAIR_LIST	my_pl;
+	files_entry_t	my_entry;
 	char		buffer[256];
 
 	if (!inst->key) {
@@ -369,70 +1052,78 @@ static rlm_rcode_t file_common(rlm_files_t *inst, REQUEST *request, char const *
 		name = len ? buffer : "NONE";
 	}
 
-	if (!tree) return RLM_MODULE_NOOP;
+	if (!db) return RLM_MODULE_NOOP;
 
 	my_pl.name = name;
-	user_pl = rbtree_finddata(tree, &my_pl);
-	my_pl.name = "DEFAULT";
-	default_pl = rbtree_finddata(tree, &my_pl);
+	my_entry.pl = &my_pl;
+	user_pl = rbtree_finddata(db->users, &my_entry);
+
+	/*
+	 *	Every check item is looked up in the request.
+	 */
+	(void) fr_pair_list_index(request_packet->vps);
+
+	/*
+	 *	Only the DEFAULT entries which aren't indexed, and
+	 *	those indexed under values the request has, can
+	 *	match.  Unless the index attributes have gained
+	 *	registered comparisons since it was built.
+	 */
+	default_pl = db->defaults;
+	num_defaults = db->num_defaults;
+	if (db->index) {
+		for (k = 0; k < db->num_keys; k++) {
+			if (radius_find_compare(db->keys[k].da)) break;
+		}
+
+		if (k == db->num_keys) {
+			default_pl = db->unkeyed;
+			num_defaults = db->num_unkeyed;
+			num_hits = file_index_find(request, db, request_packet->vps, &hits);
+		}
+	}
 
 	/*
 	 *	Find the entry for the user.
 	 */
-	while (user_pl || default_pl) {
-		vp_cursor_t cursor;
-		VALUE_PAIR *vp;
-		PAIR_LIST const *pl;
+	while (user_pl || (i < num_defaults) || (j < num_hits)) {
+		files_entry_t const *pl;
 
 		/*
 		 *	Figure out which entry to match on.
 		 */
-		if (!default_pl && user_pl) {
-			pl = user_pl;
-			user_pl = user_pl->next;
+		pl = user_pl;
+		if ((i < num_defaults) && (!pl || (default_pl[i]->pl->order < pl->pl->order))) pl = default_pl[i];
+		if ((j < num_hits) && (!pl || (hits[j]->pl->order < pl->pl->order))) pl = hits[j];
 
-		} else if (!user_pl && default_pl) {
-			pl = default_pl;
-			default_pl = default_pl->next;
-
-		} else if (user_pl->order < default_pl->order) {
-			pl = user_pl;
+		if (pl == user_pl) {
 			user_pl = user_pl->next;
-
+		} else if ((i < num_defaults) && (pl == default_pl[i])) {
+			i++;
 		} else {
-			pl = default_pl;
-			default_pl = default_pl->next;
+			j++;
 		}
 
-		check_tmp = fr_pair_list_copy(request, pl->check);
-		for (vp = fr_cursor_init(&cursor, &check_tmp);
-		     vp;
-		     vp = fr_cursor_next(&cursor)) {
-			if (radius_xlat_do(request, vp) < 0) {
-				RWARN("Failed parsing expanded value for check item, skipping entry: %s", fr_strerror());
-				fr_pair_list_free(&check_tmp);
-				continue;
-			}
-		}
-
-		if (paircompare(request, request_packet->vps, check_tmp, &reply_packet->vps) == 0) {
-			RDEBUG2("%s: Matched entry %s at line %d", filename, pl->name, pl->lineno);
+		if (file_match(request, pl, request_packet, reply_packet, &config_tmp) == 0) {
+			RDEBUG2("%s: Matched entry %s at line %d", filename, pl->pl->name, pl->pl->lineno);
 			found = true;
 
 			/* ctx may be reply or proxy */
-			reply_tmp = fr_pair_list_copy(reply_packet, pl->reply);
+			reply_tmp = fr_pair_list_copy(reply_packet, pl->pl->reply);
 			radius_pairmove(request, &reply_packet->vps, reply_tmp, true);
-			fr_pair_list_move(request, &request->config, &check_tmp);
-			fr_pair_list_free(&check_tmp);
+			fr_pair_list_move(request, &request->config, &config_tmp);
+			fr_pair_list_free(&config_tmp);
 
 			/*
 			 *	Fallthrough?
 			 */
-			if (!fall_through(pl->reply))
+			if (!pl->fall_through)
 				break;
 		}
 	}
 
+	talloc_free(hits);
+
 	/*
 	 *	Remove server internal parameters.
 	 */
@@ -448,6 +1139,36 @@ static rlm_rcode_t file_common(rlm_files_t *inst, REQUEST *request, char const *
 
 }
 
+/*
+ *	Common code called by everything below.
+ *
+ *	The offset is of the file in rlm_files_data_t, which falls back
+ *	to the common file if it wasn't configured.
+ */
+static rlm_rcode_t file_common(rlm_files_t *inst, REQUEST *request, char const *filename, size_t offset,
+			       RADIUS_PACKET *request_packet, RADIUS_PACKET *reply_packet)
+{
+	rlm_rcode_t	rcode;
+	rlm_files_data_t *data;
+	files_db_t	*db;
+
+	/*
+	 *	The files may be reloaded while we're using them,
+	 *	so hold on to the version we started with.
+	 */
+	data = fr_snapshot_acquire(inst->snapshot);
+	if (!data) return RLM_MODULE_FAIL;
+
+	db = *(files_db_t **)(((uint8_t *) data) + offset);
+	if (!db) db = data->common;
+
+	rcode = file_search(inst, request, filename, db, request_packet, reply_packet);
+
+	fr_snapshot_release(inst->snapshot, data);
+
+	return rcode;
+}
+
 
 /*
  *	Find the named user in the database.  Create the
@@ -460,7 +1181,7 @@ static rlm_rcode_t CC_HINT(nonnull) mod_authorize(void *instance, REQUEST *reque
 	rlm_files_t *inst = instance;
 
 	return file_common(inst, request, "users",
-			   inst->users ? inst->users : inst->common,
+			   offsetof(rlm_files_data_t, users),
 			   request->packet, request->reply);
 }
 
@@ -475,7 +1196,7 @@ static rlm_rcode_t CC_HINT(nonnull) mod_preacct(void *instance, REQUEST *request
 	rlm_files_t *inst = instance;
 
 	return file_common(inst, request, "acct_users",
-			   inst->acctusers ? inst->acctusers : inst->common,
+			   offsetof(rlm_files_data_t, acctusers),
 			   request->packet, request->reply);
 }
 
@@ -485,7 +1206,7 @@ static rlm_rcode_t CC_HINT(nonnull) mod_pre_proxy(void *instance, REQUEST *reque
 	rlm_files_t *inst = instance;
 
 	return file_common(inst, request, "preproxy_users",
-			   inst->preproxy_users ? inst->preproxy_users : inst->common,
+			   offsetof(rlm_files_data_t, preproxy_users),
 			   request->packet, request->proxy);
 }
 
@@ -494,7 +1215,7 @@ static rlm_rcode_t CC_HINT(nonnull) mod_post_proxy(void *instance, REQUEST *requ
 	rlm_files_t *inst = instance;
 
 	return file_common(inst, request, "postproxy_users",
-			   inst->postproxy_users ? inst->postproxy_users : inst->common,
+			   offsetof(rlm_files_data_t, postproxy_users),
 			   request->proxy_reply, request->reply);
 }
 #endif
@@ -504,7 +1225,7 @@ static rlm_rcode_t CC_HINT(nonnull) mod_authenticate(void *instance, REQUEST *re
 	rlm_files_t *inst = instance;
 
 	return file_common(inst, request, "auth_users",
-			   inst->auth_users ? inst->auth_users : inst->common,
+			   offsetof(rlm_files_data_t, auth_users),
 			   request->packet, request->reply);
 }
 
@@ -513,7 +1234,7 @@ static rlm_rcode_t CC_HINT(nonnull) mod_post_auth(void *instance, REQUEST *reque
 	rlm_files_t *inst = instance;
 
 	return file_common(inst, request, "postauth_users",
-			   inst->postauth_users ? inst->postauth_users : inst->common,
+			   offsetof(rlm_files_data_t, postauth_users),
 			   request->packet, request->reply);
 }
 
@@ -0,0 +1,887 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file ippool_mmap.c
+ * @brief Memory mapped IP pool store.
+ *
+ * The pool is a single file, mapped shared, so every change is visible to the
+ * kernel as soon as it's made, and survives the server exiting uncleanly.
+ *
+ * The file contains:
+ *	- A header.
+ *	- One record per address in the pool.
+ *	- A fixed number of session records, each binding a key (the MD5 digest
+ *	  of the 'key' directive) to an address.  Multiple sessions may share
+ *	  an address if they have the same Calling-Station-Id (multilink PPP).
+ *	- A hash table of sessions by key, and a hash table of addresses by
+ *	  Calling-Station-Id.
+ *	- A binary heap of sessions with a limited lifetime, ordered by expiry.
+ *
+ * Free addresses are kept in a doubly linked list, released addresses are
+ * added to the tail, and addresses are allocated from the head, so the least
+ * recently used address is always handed out first.  Allocating, releasing
+ * and finding a session by key are all O(1).  Reclaiming an expired session
+ * is O(log n).
+ *
+ * Only the address records and the session records which are in use are
+ * authoritative.  The free lists, hash tables and the heap are rebuilt from
+ * them whenever the pool is opened for writing, so a pool is always
+ * consistent after a crash.  When a session is created, the record is marked
+ * as in use only after all its other fields have been written, and when it's
+ * released it's marked as unused before anything else is changed.
+ *
+ * Pools are not safe for concurrent use, callers must serialise access.
+ * Opening a pool for writing takes a lock on the file, so only one process
+ * may modify a pool at a time.  Pools may be opened read only while they're
+ * in use.
+ *
+ * @copyright 2015 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ippool_mmap.h"
+
+#define IPPOOL_MMAP_MAGIC	0x4950504d	//!< "IPPM".
+#define IPPOOL_MMAP_VERSION	1
+
+#define NONE			UINT32_MAX	//!< Index used to terminate lists.
+
+typedef struct ippool_mmap_hdr {
+	uint32_t	magic;
+	uint32_t	version;
+
+	uint32_t	num_addrs;		//!< Number of address records.
+	uint32_t	num_sessions;		//!< Number of session records.
+	uint32_t	num_buckets;		//!< Size of each hash table, a power of two.
+
+	uint32_t	free_head;		//!< First free address (least recently released).
+	uint32_t	free_tail;		//!< Last free address (most recently released).
+	uint32_t	free_count;		//!< Number of free addresses.
+
+	uint32_t	session_free;		//!< First unused session record.
+	uint32_t	heap_len;		//!< Number of sessions in the expiry heap.
+
+	uint8_t		pad[24];		//!< Pad to 64 bytes.
+} ippool_mmap_hdr_t;
+
+typedef struct ippool_mmap_addr {
+	uint32_t	ipaddr;			//!< Address in network byte order.
+	uint32_t	sessions;		//!< Number of sessions using the address.
+	uint32_t	session_head;		//!< First session using the address.
+	uint32_t	free_next;		//!< Next address in the free list.
+	uint32_t	free_prev;		//!< Previous address in the free list.
+	uint32_t	cli_next;		//!< Next address in the Calling-Station-Id hash chain.
+} ippool_mmap_addr_t;
+
+typedef struct ippool_mmap_session {
+	uint8_t		key[IPPOOL_MMAP_KEY_LEN];
+	char		cli[IPPOOL_MMAP_CLI_LEN];
+	int64_t		timestamp;
+	int64_t		expires;		//!< 0 if the session never expires.
+
+	uint32_t	addr;			//!< Address the session is using.
+	uint32_t	key_next;		//!< Next session in the key hash chain, or the next
+						//!< unused session.
+	uint32_t	addr_next;		//!< Next session using the same address.
+	uint32_t	heap;			//!< Position in the expiry heap.
+	uint32_t	in_use;
+	uint32_t	pad;
+} ippool_mmap_session_t;
+
+struct ippool_mmap {
+	char const		*filename;
+	int			fd;
+	bool			writable;
+
+	uint8_t			*map;
+	size_t			len;
+
+	ippool_mmap_hdr_t	*hdr;
+	ippool_mmap_addr_t	*addrs;
+	ippool_mmap_session_t	*sessions;
+	uint32_t		*key_buckets;
+	uint32_t		*cli_buckets;
+	uint32_t		*heap;
+};
+
+static size_t pool_len(uint32_t num_addrs, uint32_t num_sessions, uint32_t num_buckets)
+{
+	return sizeof(ippool_mmap_hdr_t) +
+	       ((size_t)num_addrs * sizeof(ippool_mmap_addr_t)) +
+	       ((size_t)num_sessions * sizeof(ippool_mmap_session_t)) +
+	       ((size_t)num_buckets * sizeof(uint32_t) * 2) +
+	       ((size_t)num_sessions * sizeof(uint32_t));
+}
+
+static void pool_layout(ippool_mmap_t *pool)
+{
+	uint8_t *p = pool->map;
+
+	pool->hdr = (ippool_mmap_hdr_t *)p;
+	p += sizeof(ippool_mmap_hdr_t);
+	pool->addrs = (ippool_mmap_addr_t *)p;
+	p += (size_t)pool->hdr->num_addrs * sizeof(ippool_mmap_addr_t);
+	pool->sessions = (ippool_mmap_session_t *)p;
+	p += (size_t)pool->hdr->num_sessions * sizeof(ippool_mmap_session_t);
+	pool->key_buckets = (uint32_t *)p;
+	p += (size_t)pool->hdr->num_buckets * sizeof(uint32_t);
+	pool->cli_buckets = (uint32_t *)p;
+	p += (size_t)pool->hdr->num_buckets * sizeof(uint32_t);
+	pool->heap = (uint32_t *)p;
+}
+
+static uint32_t key_hash(ippool_mmap_t const *pool, uint8_t const *key)
+{
+	uint32_t hash;
+
+	/*
+	 *	Keys are already MD5 digests.
+	 */
+	memcpy(&hash, key, sizeof(hash));
+
+	return hash & (pool->hdr->num_buckets - 1);
+}
+
+static uint32_t cli_hash(ippool_mmap_t const *pool, char const *cli)
+{
+	return fr_hash_string(cli) & (pool->hdr->num_buckets - 1);
+}
+
+/*
+ *	Expiry heap
+ */
+static bool heap_less(ippool_mmap_t *pool, uint32_t i, uint32_t j)
+{
+	return pool->sessions[pool->heap[i]].expires < pool->sessions[pool->heap[j]].expires;
+}
+
+static void heap_swap(ippool_mmap_t *pool, uint32_t i, uint32_t j)
+{
+	uint32_t tmp;
+
+	tmp = pool->heap[i];
+	pool->heap[i] = pool->heap[j];
+	pool->heap[j] = tmp;
+
+	pool->sessions[pool->heap[i]].heap = i;
+	pool->sessions[pool->heap[j]].heap = j;
+}
+
+static void heap_up(ippool_mmap_t *pool, uint32_t i)
+{
+	while (i > 0) {
+		uint32_t parent = (i - 1) / 2;
+
+		if (!heap_less(pool, i, parent)) break;
+
+		heap_swap(pool, i, parent);
+		i = parent;
+	}
+}
+
+static void heap_down(ippool_mmap_t *pool, uint32_t i)
+{
+	uint32_t len = pool->hdr->heap_len;
+
+	for (;;) {
+		uint32_t left = (2 * i) + 1, right = left + 1, min = i;
+
+		if ((left < len) && heap_less(pool, left, min)) min = left;
+		if ((right < len) && heap_less(pool, right, min)) min = right;
+		if (min == i) break;
+
+		heap_swap(pool, i, min);
+		i = min;
+	}
+}
+
+static void heap_insert(ippool_mmap_t *pool, uint32_t s)
+{
+	uint32_t i = pool->hdr->heap_len++;
+
+	pool->heap[i] = s;
+	pool->sessions[s].heap = i;
+	heap_up(pool, i);
+}
+
+static void heap_remove(ippool_mmap_t *pool, uint32_t s)
+{
+	uint32_t i = pool->sessions[s].heap;
+	uint32_t last = --pool->hdr->heap_len;
+
+	pool->sessions[s].heap = NONE;
+	if (i == last) return;
+
+	pool->heap[i] = pool->heap[last];
+	pool->sessions[pool->heap[i]].heap = i;
+
+	if ((i > 0) && heap_less(pool, i, (i - 1) / 2)) {
+		heap_up(pool, i);
+	} else {
+		heap_down(pool, i);
+	}
+}
+
+/*
+ *	Free address list
+ */
+static void free_push(ippool_mmap_t *pool, uint32_t a)
+{
+	ippool_mmap_addr_t *addr = &pool->addrs[a];
+
+	addr->free_next = NONE;
+	addr->free_prev = pool->hdr->free_tail;
+	if (pool->hdr->free_tail != NONE) {
+		pool->addrs[pool->hdr->free_tail].free_next = a;
+	} else {
+		pool->hdr->free_head = a;
+	}
+	pool->hdr->free_tail = a;
+	pool->hdr->free_count++;
+}
+
+static void free_unlink(ippool_mmap_t *pool, uint32_t a)
+{
+	ippool_mmap_addr_t *addr = &pool->addrs[a];
+
+	if (addr->free_prev != NONE) {
+		pool->addrs[addr->free_prev].free_next = addr->free_next;
+	} else {
+		pool->hdr->free_head = addr->free_next;
+	}
+
+	if (addr->free_next != NONE) {
+		pool->addrs[addr->free_next].free_prev = addr->free_prev;
+	} else {
+		pool->hdr->free_tail = addr->free_prev;
+	}
+
+	addr->free_next = addr->free_prev = NONE;
+	pool->hdr->free_count--;
+}
+
+static uint32_t session_find(ippool_mmap_t const *pool, uint8_t const *key)
+{
+	uint32_t s;
+
+	for (s = pool->key_buckets[key_hash(pool, key)]; s != NONE; s = pool->sessions[s].key_next) {
+		if (memcmp(pool->sessions[s].key, key, IPPOOL_MMAP_KEY_LEN) == 0) return s;
+	}
+
+	return NONE;
+}
+
+static uint32_t addr_find_cli(ippool_mmap_t const *pool, char const *cli)
+{
+	uint32_t a;
+
+	for (a = pool->cli_buckets[cli_hash(pool, cli)]; a != NONE; a = pool->addrs[a].cli_next) {
+		if (strcmp(pool->sessions[pool->addrs[a].session_head].cli, cli) == 0) return a;
+	}
+
+	return NONE;
+}
+
+/*
+ *	Addresses are stored in ascending order.
+ */
+static uint32_t addr_find_ip(ippool_mmap_t const *pool, uint32_t ipaddr)
+{
+	uint32_t low = 0, high = pool->hdr->num_addrs;
+	uint32_t want = ntohl(ipaddr);
+
+	while (low < high) {
+		uint32_t mid = low + ((high - low) / 2);
+		uint32_t have = ntohl(pool->addrs[mid].ipaddr);
+
+		if (have == want) return mid;
+		if (have < want) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+
+	return NONE;
+}
+
+/** Add a session to the indexes, and bind it to its address
+ *
+ */
+static void session_link(ippool_mmap_t *pool, uint32_t s)
+{
+	ippool_mmap_session_t	*sess = &pool->sessions[s];
+	ippool_mmap_addr_t	*addr = &pool->addrs[sess->addr];
+	uint32_t		hash;
+
+	hash = key_hash(pool, sess->key);
+	sess->key_next = pool->key_buckets[hash];
+	pool->key_buckets[hash] = s;
+
+	sess->addr_next = addr->session_head;
+	addr->session_head = s;
+
+	if (!addr->sessions && sess->cli[0]) {
+		hash = cli_hash(pool, sess->cli);
+		addr->cli_next = pool->cli_buckets[hash];
+		pool->cli_buckets[hash] = sess->addr;
+	}
+	addr->sessions++;
+
+	sess->heap = NONE;
+	if (sess->expires) heap_insert(pool, s);
+}
+
+/** Remove a session, returning its address to the free list if nothing else is using it
+ *
+ */
+static void session_release(ippool_mmap_t *pool, uint32_t s)
+{
+	ippool_mmap_session_t	*sess = &pool->sessions[s];
+	ippool_mmap_addr_t	*addr = &pool->addrs[sess->addr];
+	uint32_t		*p;
+
+	sess->in_use = 0;
+
+	for (p = &pool->key_buckets[key_hash(pool, sess->key)]; *p != s; p = &pool->sessions[*p].key_next);
+	*p = sess->key_next;
+
+	for (p = &addr->session_head; *p != s; p = &pool->sessions[*p].addr_next);
+	*p = sess->addr_next;
+
+	if (sess->heap != NONE) heap_remove(pool, s);
+
+	if (--addr->sessions == 0) {
+		if (sess->cli[0]) {
+			for (p = &pool->cli_buckets[cli_hash(pool, sess->cli)];
+			     *p != sess->addr;
+			     p = &pool->addrs[*p].cli_next);
+			*p = addr->cli_next;
+			addr->cli_next = NONE;
+		}
+		free_push(pool, sess->addr);
+	}
+
+	sess->key_next = pool->hdr->session_free;
+	pool->hdr->session_free = s;
+}
+
+/** Create a new session for an address
+ *
+ * The address must either be free, or already in use by a session with the same Calling-Station-Id.
+ */
+static uint32_t session_create(ippool_mmap_t *pool, uint32_t a, uint8_t const *key, char const *cli,
+			       time_t now, time_t expires)
+{
+	ippool_mmap_session_t	*sess;
+	uint32_t		s;
+
+	s = pool->hdr->session_free;
+	if (s == NONE) return NONE;
+
+	sess = &pool->sessions[s];
+	pool->hdr->session_free = sess->key_next;
+
+	if (!pool->addrs[a].sessions) free_unlink(pool, a);
+
+	memcpy(sess->key, key, sizeof(sess->key));
+	strlcpy(sess->cli, cli ? cli : "", sizeof(sess->cli));
+	sess->timestamp = now;
+	sess->expires = expires;
+	sess->addr = a;
+
+	session_link(pool, s);
+	sess->in_use = 1;
+
+	return s;
+}
+
+/** Rebuild the free lists, indexes and the expiry heap from the address and session records
+ *
+ */
+static void pool_rebuild(ippool_mmap_t *pool)
+{
+	ippool_mmap_hdr_t	*hdr = pool->hdr;
+	uint32_t		i;
+
+	hdr->free_head = hdr->free_tail = NONE;
+	hdr->free_count = 0;
+	hdr->session_free = NONE;
+	hdr->heap_len = 0;
+
+	memset(pool->key_buckets, 0xff, (size_t)hdr->num_buckets * sizeof(uint32_t));
+	memset(pool->cli_buckets, 0xff, (size_t)hdr->num_buckets * sizeof(uint32_t));
+
+	for (i = 0; i < hdr->num_addrs; i++) {
+		ippool_mmap_addr_t *addr = &pool->addrs[i];
+
+		addr->sessions = 0;
+		addr->session_head = NONE;
+		addr->free_next = addr->free_prev = NONE;
+		addr->cli_next = NONE;
+	}
+
+	/*
+	 *	In reverse, so unused sessions are used in ascending order.
+	 */
+	for (i = hdr->num_sessions; i > 0; i--) {
+		ippool_mmap_session_t *sess = &pool->sessions[i - 1];
+
+		sess->cli[sizeof(sess->cli) - 1] = '\0';
+
+		/*
+		 *	Discard sessions which point to addresses
+		 *	we don't have, or duplicate another session's
+		 *	key.
+		 */
+		if (sess->in_use &&
+		    ((sess->addr >= hdr->num_addrs) || (session_find(pool, sess->key) != NONE))) {
+			sess->in_use = 0;
+		}
+
+		if (!sess->in_use) {
+			sess->heap = NONE;
+			sess->key_next = hdr->session_free;
+			hdr->session_free = i - 1;
+			continue;
+		}
+
+		session_link(pool, i - 1);
+	}
+
+	for (i = 0; i < hdr->num_addrs; i++) {
+		if (!pool->addrs[i].sessions) free_push(pool, i);
+	}
+}
+
+static int _ippool_mmap_free(ippool_mmap_t *pool)
+{
+	if (pool->map) {
+		if (pool->writable) msync(pool->map, pool->len, MS_SYNC);
+		munmap(pool->map, pool->len);
+	}
+	if (pool->fd >= 0) close(pool->fd);
+
+	return 0;
+}
+
+static ippool_mmap_t *pool_alloc(TALLOC_CTX *ctx, char const *filename, int fd, bool writable, size_t len)
+{
+	ippool_mmap_t *pool;
+
+	pool = talloc_zero(ctx, ippool_mmap_t);
+	if (!pool) {
+		close(fd);
+		return NULL;
+	}
+	pool->filename = talloc_typed_strdup(pool, filename);
+	pool->fd = fd;
+	pool->writable = writable;
+	talloc_set_destructor(pool, _ippool_mmap_free);
+
+	pool->map = mmap(NULL, len, writable ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, fd, 0);
+	if (pool->map == MAP_FAILED) {
+		fr_strerror_printf("Failed mapping %s: %s", filename, fr_syserror(errno));
+		pool->map = NULL;
+		talloc_free(pool);
+		return NULL;
+	}
+	pool->len = len;
+
+	return pool;
+}
+
+/** Check whether a file is a memory mapped pool
+ *
+ * @param[in] filename to check.
+ * @return true if the file is a pool, else false.
+ */
+bool ippool_mmap_is_pool(char const *filename)
+{
+	uint32_t	magic;
+	int		fd;
+	ssize_t		len;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) return false;
+
+	len = read(fd, &magic, sizeof(magic));
+	close(fd);
+
+	return (len == sizeof(magic)) && (magic == IPPOOL_MMAP_MAGIC);
+}
+
+/** Create a new pool, replacing any existing file
+ *
+ * @param[in] ctx to allocate the pool handle in.
+ * @param[in] filename of the pool.
+ * @param[in] addrs in the pool, in network byte order, in ascending order.
+ * @param[in] num number of addresses.
+ * @return the new pool (free with talloc_free), or NULL on error.
+ */
+ippool_mmap_t *ippool_mmap_create(TALLOC_CTX *ctx, char const *filename, uint32_t const *addrs, uint32_t num)
+{
+	ippool_mmap_t	*pool;
+	uint32_t	num_sessions, num_buckets, i;
+	size_t		len;
+	int		fd;
+
+	if (!num) {
+		fr_strerror_printf("Pool must contain at least one address");
+		return NULL;
+	}
+
+	/*
+	 *	Leave some room for multilink sessions, which
+	 *	share an address.
+	 */
+	num_sessions = num + (num / 4) + 1;
+	for (num_buckets = 1; num_buckets < num_sessions; num_buckets <<= 1);
+
+	len = pool_len(num, num_sessions, num_buckets);
+
+	fd = open(filename, O_RDWR | O_CREAT, 0600);
+	if (fd < 0) {
+		fr_strerror_printf("Failed creating %s: %s", filename, fr_syserror(errno));
+		return NULL;
+	}
+
+	if (rad_lockfd_nonblock(fd, 0) < 0) {
+		fr_strerror_printf("Failed locking %s, it may be in use by another process: %s",
+				   filename, fr_syserror(errno));
+		close(fd);
+		return NULL;
+	}
+
+	if ((ftruncate(fd, 0) < 0) || (ftruncate(fd, len) < 0)) {
+		fr_strerror_printf("Failed sizing %s: %s", filename, fr_syserror(errno));
+		close(fd);
+		return NULL;
+	}
+
+	pool = pool_alloc(ctx, filename, fd, true, len);
+	if (!pool) return NULL;
+
+	pool->hdr = (ippool_mmap_hdr_t *)pool->map;
+	pool->hdr->version = IPPOOL_MMAP_VERSION;
+	pool->hdr->num_addrs = num;
+	pool->hdr->num_sessions = num_sessions;
+	pool->hdr->num_buckets = num_buckets;
+	pool_layout(pool);
+
+	for (i = 0; i < num; i++) pool->addrs[i].ipaddr = addrs[i];
+
+	pool_rebuild(pool);
+
+	/*
+	 *	Only mark the file as a pool once it's complete.
+	 */
+	if (msync(pool->map, pool->len, MS_SYNC) < 0) {
+		fr_strerror_printf("Failed writing %s: %s", filename, fr_syserror(errno));
+		talloc_free(pool);
+		return NULL;
+	}
+	pool->hdr->magic = IPPOOL_MMAP_MAGIC;
+
+	return pool;
+}
+
+/** Open an existing pool
+ *
+ * @param[in] ctx to allocate the pool handle in.
+ * @param[in] filename of the pool.
+ * @param[in] writable if true the pool is locked and opened for writing, and its indexes
+ *	are rebuilt.
+ * @return the pool (free with talloc_free), or NULL on error.
+ */
+ippool_mmap_t *ippool_mmap_open(TALLOC_CTX *ctx, char const *filename, bool writable)
+{
+	ippool_mmap_t		*pool;
+	ippool_mmap_hdr_t	hdr;
+	struct stat		st;
+	int			fd;
+
+	fd = open(filename, writable ? O_RDWR : O_RDONLY);
+	if (fd < 0) {
+		fr_strerror_printf("Failed opening %s: %s", filename, fr_syserror(errno));
+		return NULL;
+	}
+
+	if (writable && (rad_lockfd_nonblock(fd, 0) < 0)) {
+		fr_strerror_printf("Failed locking %s, it may be in use by another process: %s",
+				   filename, fr_syserror(errno));
+		close(fd);
+		return NULL;
+	}
+
+	if (fstat(fd, &st) < 0) {
+		fr_strerror_printf("Failed reading %s: %s", filename, fr_syserror(errno));
+		close(fd);
+		return NULL;
+	}
+
+	if ((read(fd, &hdr, sizeof(hdr)) != sizeof(hdr)) || (hdr.magic != IPPOOL_MMAP_MAGIC)) {
+		fr_strerror_printf("%s is not an IP pool file", filename);
+		close(fd);
+		return NULL;
+	}
+
+	if (hdr.version != IPPOOL_MMAP_VERSION) {
+		fr_strerror_printf("%s has unsupported version %u", filename, hdr.version);
+		close(fd);
+		return NULL;
+	}
+
+	if (!hdr.num_buckets || (hdr.num_buckets & (hdr.num_buckets - 1)) ||
+	    ((size_t)st.st_size != pool_len(hdr.num_addrs, hdr.num_sessions, hdr.num_buckets))) {
+		fr_strerror_printf("%s is corrupt", filename);
+		close(fd);
+		return NULL;
+	}
+
+	pool = pool_alloc(ctx, filename, fd, writable, st.st_size);
+	if (!pool) return NULL;
+
+	pool_layout(pool);
+	if (writable) pool_rebuild(pool);
+
+	return pool;
+}
+
+/** Return the number of addresses in a pool
+ *
+ */
+uint32_t ippool_mmap_num_addrs(ippool_mmap_t const *pool)
+{
+	return pool->hdr->num_addrs;
+}
+
+/** Release the session with the given key
+ *
+ * @param[in] pool to release the session from.
+ * @param[in] key of the session.
+ * @param[out] ipaddr the session was using.  May be NULL.
+ * @return 1 if the session was released, 0 if there was no session with that key.
+ */
+int ippool_mmap_release(ippool_mmap_t *pool, uint8_t const *key, uint32_t *ipaddr)
+{
+	uint32_t s;
+
+	s = session_find(pool, key);
+	if (s == NONE) return 0;
+
+	if (ipaddr) *ipaddr = pool->addrs[pool->sessions[s].addr].ipaddr;
+	session_release(pool, s);
+
+	return 1;
+}
+
+/** Release all sessions using an address
+ *
+ * @param[in] pool to release the sessions from.
+ * @param[in] ipaddr in network byte order.
+ * @return the number of sessions released, or -1 if the address isn't in the pool.
+ */
+int ippool_mmap_release_addr(ippool_mmap_t *pool, uint32_t ipaddr)
+{
+	uint32_t	a;
+	int		count = 0;
+
+	a = addr_find_ip(pool, ipaddr);
+	if (a == NONE) {
+		fr_strerror_printf("Address is not in the pool");
+		return -1;
+	}
+
+	while (pool->addrs[a].session_head != NONE) {
+		session_release(pool, pool->addrs[a].session_head);
+		count++;
+	}
+
+	return count;
+}
+
+/** Allocate an address to a session
+ *
+ * Any existing session with the same key is released first, and reported in the
+ * lease, even if no address could be allocated.  If another session with
+ * the same Calling-Station-Id is active, its address is shared (for multilink PPP),
+ * otherwise the least recently used free address is allocated.  If there are no free
+ * addresses, sessions which have expired are reclaimed.
+ *
+ * @param[in] pool to allocate from.
+ * @param[out] out information about the allocated address.
+ * @param[in] key of the session.
+ * @param[in] cli Calling-Station-Id of the session.  May be NULL.
+ * @param[in] now the current time.
+ * @param[in] expires when the session may be reclaimed, 0 if never.
+ * @return 1 if an address was allocated, 0 if there are no addresses available.
+ */
+int ippool_mmap_allocate(ippool_mmap_t *pool, ippool_mmap_lease_t *out,
+			 uint8_t const *key, char const *cli, time_t now, time_t expires)
+{
+	ippool_mmap_hdr_t	*hdr = pool->hdr;
+	uint32_t		a = NONE, s;
+
+	memset(out, 0, sizeof(*out));
+
+	s = session_find(pool, key);
+	if (s != NONE) {
+		out->stale = true;
+		out->stale_ipaddr = pool->addrs[pool->sessions[s].addr].ipaddr;
+		session_release(pool, s);
+	}
+
+	/*
+	 *	Reclaim expired sessions, only when we're
+	 *	short of addresses or session records.
+	 */
+	while (((hdr->free_head == NONE) || (hdr->session_free == NONE)) &&
+	       hdr->heap_len && (pool->sessions[pool->heap[0]].expires <= now)) {
+		session_release(pool, pool->heap[0]);
+	}
+
+	if (cli && *cli) a = addr_find_cli(pool, cli);
+	if (a != NONE) {
+		out->mppp = true;
+	} else {
+		a = hdr->free_head;
+		if (a == NONE) return 0;
+	}
+
+	s = session_create(pool, a, key, cli, now, expires);
+	if (s == NONE) return 0;
+
+	out->ipaddr = pool->addrs[a].ipaddr;
+	out->sessions = pool->addrs[a].sessions;
+	out->active = true;
+	memcpy(out->key, key, sizeof(out->key));
+	strlcpy(out->cli, pool->sessions[s].cli, sizeof(out->cli));
+	out->timestamp = now;
+	out->expires = expires;
+
+	return 1;
+}
+
+/** Allocate a specific address to a session
+ *
+ * Any existing session with the same key is released first.  The session never expires.
+ *
+ * @param[in] pool to allocate from.
+ * @param[in] key of the session.
+ * @param[in] cli Calling-Station-Id of the session.  May be NULL.
+ * @param[in] ipaddr to allocate, in network byte order.
+ * @param[in] now the current time.
+ * @return 0 on success, -1 if the address isn't in the pool or is in use.
+ */
+int ippool_mmap_assign(ippool_mmap_t *pool, uint8_t const *key, char const *cli, uint32_t ipaddr, time_t now)
+{
+	uint32_t a, s;
+
+	a = addr_find_ip(pool, ipaddr);
+	if (a == NONE) {
+		fr_strerror_printf("Address is not in the pool");
+		return -1;
+	}
+
+	s = session_find(pool, key);
+	if (s != NONE) session_release(pool, s);
+
+	if (pool->addrs[a].sessions) {
+		fr_strerror_printf("Address is already allocated");
+		return -1;
+	}
+
+	if (session_create(pool, a, key, cli, now, 0) == NONE) {
+		fr_strerror_printf("No free session records");
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Call a function for each active session, then for each free address
+ *
+ * Only uses the authoritative records, so works with pools opened read only, which
+ * may be in use by another process.
+ *
+ * @param[in] pool to walk.
+ * @param[in] callback to call.
+ * @param[in] ctx to pass to the callback.
+ * @return 0 on success, -1 if the callback stopped the walk.
+ */
+int ippool_mmap_walk(ippool_mmap_t const *pool, ippool_mmap_walk_t callback, void *ctx)
+{
+	ippool_mmap_hdr_t const	*hdr = pool->hdr;
+	ippool_mmap_lease_t	lease;
+	uint32_t		*counts;
+	uint32_t		i;
+	int			ret = 0;
+
+	counts = talloc_zero_array(NULL, uint32_t, hdr->num_addrs);
+	if (!counts) return -1;
+
+	for (i = 0; i < hdr->num_sessions; i++) {
+		if (!pool->sessions[i].in_use || (pool->sessions[i].addr >= hdr->num_addrs)) continue;
+		counts[pool->sessions[i].addr]++;
+	}
+
+	for (i = 0; i < hdr->num_sessions; i++) {
+		ippool_mmap_session_t const *sess = &pool->sessions[i];
+
+		if (!sess->in_use || (sess->addr >= hdr->num_addrs)) continue;
+
+		memset(&lease, 0, sizeof(lease));
+		lease.ipaddr = pool->addrs[sess->addr].ipaddr;
+		lease.sessions = counts[sess->addr];
+		lease.active = true;
+		memcpy(lease.key, sess->key, sizeof(lease.key));
+		memcpy(lease.cli, sess->cli, sizeof(lease.cli));
+		lease.cli[sizeof(lease.cli) - 1] = '\0';
+		lease.timestamp = sess->timestamp;
+		lease.expires = sess->expires;
+
+		if (callback(ctx, &lease) < 0) {
+			ret = -1;
+			goto finish;
+		}
+	}
+
+	for (i = 0; i < hdr->num_addrs; i++) {
+		if (counts[i]) continue;
+
+		memset(&lease, 0, sizeof(lease));
+		lease.ipaddr = pool->addrs[i].ipaddr;
+
+		if (callback(ctx, &lease) < 0) {
+			ret = -1;
+			goto finish;
+		}
+	}
+
+finish:
+	talloc_free(counts);
+
+	return ret;
+}
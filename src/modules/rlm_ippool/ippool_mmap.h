@@ -0,0 +1,81 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+#ifndef _IPPOOL_MMAP_H
+#define _IPPOOL_MMAP_H
+/**
+ * $Id$
+ * @file ippool_mmap.h
+ * @brief Memory mapped IP pool store.
+ *
+ * @copyright 2015 The FreeRADIUS server project
+ */
+RCSIDH(ippool_mmap_h, "$Id$")
+
+#include <freeradius-devel/libradius.h>
+
+#define IPPOOL_MMAP_KEY_LEN	16		//!< Length of a session key (an MD5 digest).
+#define IPPOOL_MMAP_CLI_LEN	32		//!< Maximum length of a Calling-Station-Id, including the '\0'.
+
+typedef struct ippool_mmap ippool_mmap_t;
+
+/** Information about an address, and one of the sessions using it
+ *
+ * Returned by #ippool_mmap_allocate and passed to #ippool_mmap_walk_t callbacks.
+ */
+typedef struct ippool_mmap_lease {
+	uint32_t	ipaddr;				//!< Address in network byte order.
+	uint32_t	sessions;			//!< Number of sessions using the address.
+	bool		active;				//!< Whether the fields below are valid.
+	uint8_t		key[IPPOOL_MMAP_KEY_LEN];	//!< Key of the session.
+	char		cli[IPPOOL_MMAP_CLI_LEN];	//!< Calling-Station-Id of the session.
+	time_t		timestamp;			//!< When the address was allocated to the session.
+	time_t		expires;			//!< When the session may be reclaimed, 0 if never.
+	bool		mppp;				//!< Whether the address was already in use by the same
+							//!< caller (allocate only).
+	bool		stale;				//!< Whether a session with the same key was released
+							//!< (allocate only).
+	uint32_t	stale_ipaddr;			//!< Address the released session was using.
+} ippool_mmap_lease_t;
+
+/** Called for each session, and each free address in the pool
+ *
+ * @param[in] ctx passed to #ippool_mmap_walk.
+ * @param[in] lease to process.
+ * @return 0 to continue walking, -1 to stop.
+ */
+typedef int (*ippool_mmap_walk_t)(void *ctx, ippool_mmap_lease_t const *lease);
+
+bool		ippool_mmap_is_pool(char const *filename);
+
+ippool_mmap_t	*ippool_mmap_create(TALLOC_CTX *ctx, char const *filename, uint32_t const *addrs, uint32_t num);
+
+ippool_mmap_t	*ippool_mmap_open(TALLOC_CTX *ctx, char const *filename, bool writable);
+
+uint32_t	ippool_mmap_num_addrs(ippool_mmap_t const *pool);
+
+int		ippool_mmap_release(ippool_mmap_t *pool, uint8_t const *key, uint32_t *ipaddr);
+
+int		ippool_mmap_release_addr(ippool_mmap_t *pool, uint32_t ipaddr);
+
+int		ippool_mmap_allocate(ippool_mmap_t *pool, ippool_mmap_lease_t *out,
+				     uint8_t const *key, char const *cli, time_t now, time_t expires);
+
+int		ippool_mmap_assign(ippool_mmap_t *pool, uint8_t const *key, char const *cli,
+				   uint32_t ipaddr, time_t now);
+
+int		ippool_mmap_walk(ippool_mmap_t const *pool, ippool_mmap_walk_t callback, void *ctx);
+
+#endif /* _IPPOOL_MMAP_H */
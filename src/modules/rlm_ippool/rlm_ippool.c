@@ -17,7 +17,8 @@
 /**
  * $Id$
  * @file rlm_ippool.c
- * @brief Allocates an IPv4 address from a pool stored in a GDBM database.
+ * @brief Allocates an IPv4 address from a pool stored in a GDBM database,
+ *	or in a memory mapped file (see ippool_mmap.c).
  *
  * @copyright 2000,2006  The FreeRADIUS server project
  * @copyright 2002  Kostas Kalevras <kkalev@noc.ntua.gr>
@@ -39,6 +40,8 @@ RCSID("$Id$")
 
 #include <gdbm.h>
 
+#include "ippool_mmap.h"
+
 #ifdef NEEDS_GDBM_SYNC
 #	define GDBM_SYNCOPT GDBM_SYNC
 #else
@@ -51,6 +54,17 @@ RCSID("$Id$")
 #define GDBM_IPPOOL_OPTS (GDBM_SYNCOPT)
 #endif
 
+typedef enum {
+	IPPOOL_BACKEND_GDBM = 0,				//!< Sessions and allocated counts in GDBM databases.
+	IPPOOL_BACKEND_MMAP					//!< Single memory mapped file.
+} ippool_backend_t;
+
+static const FR_NAME_NUMBER ippool_backends[] = {
+	{ "gdbm",	IPPOOL_BACKEND_GDBM	},
+	{ "mmap",	IPPOOL_BACKEND_MMAP	},
+	{  NULL ,	-1			}
+};
+
 /*
  *	Define a structure for our module configuration.
  *
@@ -63,6 +77,8 @@ typedef struct rlm_ippool_t {
 	char const	*ip_index;
 	char const	*name;
 	char const	*key;
+	char const	*backend_name;
+	ippool_backend_t backend;
 
 	fr_ipaddr_t	range_start_addr;
 	fr_ipaddr_t	range_stop_addr;
@@ -76,6 +92,7 @@ typedef struct rlm_ippool_t {
 	bool		override;
 	GDBM_FILE	gdbm;
 	GDBM_FILE	ip;
+	ippool_mmap_t	*pool;
 #ifdef HAVE_PTHREAD_H
 	pthread_mutex_t op_mutex;
 #endif
@@ -105,11 +122,13 @@ typedef struct ippool_key {
 } ippool_key;
 
 static const CONF_PARSER module_config[] = {
+	{ "backend", FR_CONF_OFFSET(PW_TYPE_STRING, rlm_ippool_t, backend_name), "gdbm" },
+
 	{ "session-db", FR_CONF_OFFSET(PW_TYPE_FILE_OUTPUT | PW_TYPE_DEPRECATED, rlm_ippool_t, filename), NULL },
 	{ "filename", FR_CONF_OFFSET(PW_TYPE_FILE_OUTPUT | PW_TYPE_REQUIRED, rlm_ippool_t, filename), NULL },
 
 	{ "ip-index", FR_CONF_OFFSET(PW_TYPE_STRING | PW_TYPE_DEPRECATED, rlm_ippool_t, ip_index), NULL },
-	{ "ip_index", FR_CONF_OFFSET(PW_TYPE_STRING | PW_TYPE_REQUIRED, rlm_ippool_t, ip_index), NULL },
+	{ "ip_index", FR_CONF_OFFSET(PW_TYPE_STRING, rlm_ippool_t, ip_index), NULL },
 
 	{ "key", FR_CONF_OFFSET(PW_TYPE_STRING | PW_TYPE_REQUIRED | PW_TYPE_XLAT, rlm_ippool_t, key), "%{NAS-IP-Address} %{NAS-Port}" },
 
@@ -131,6 +150,54 @@ static const CONF_PARSER module_config[] = {
 	CONF_PARSER_TERMINATOR
 };
 
+/** Open the memory mapped pool, creating it if it doesn't exist
+ *
+ */
+static int mod_instantiate_mmap(CONF_SECTION *conf, rlm_ippool_t *inst)
+{
+	uint32_t	*addrs;
+	uint32_t	i, num = 0;
+	uint32_t	or_result;
+	char		str[32];
+
+	/*
+	 *  Net and Broadcast addresses are excluded, as with
+	 *  the GDBM backend.
+	 */
+	addrs = talloc_array(inst, uint32_t, (inst->range_stop - inst->range_start) + 1);
+	for (i = inst->range_start; i <= inst->range_stop; i++) {
+		or_result = i | inst->netmask;
+		if (~inst->netmask != 0 && (or_result == inst->netmask || (~or_result == 0))) {
+			DEBUG("rlm_ippool: IP %s excluded", ip_ntoa(str, ntohl(i)));
+			continue;
+		}
+		addrs[num++] = ntohl(i);
+	}
+
+	if (access(inst->filename, F_OK) == 0) {
+		inst->pool = ippool_mmap_open(inst, inst->filename, true);
+		if (inst->pool && (ippool_mmap_num_addrs(inst->pool) != num)) {
+			cf_log_err_cs(conf, "Pool range does not match %s, the file must be removed "
+				      "if the range is changed", inst->filename);
+			talloc_free(addrs);
+			return -1;
+		}
+	} else {
+		DEBUG("rlm_ippool: Initializing pool %s with %u addresses", inst->filename, num);
+		inst->pool = ippool_mmap_create(inst, inst->filename, addrs, num);
+	}
+	talloc_free(addrs);
+
+	if (!inst->pool) {
+		cf_log_err_cs(conf, "%s", fr_strerror());
+		return -1;
+	}
+
+	pthread_mutex_init(&inst->op_mutex, NULL);
+
+	return 0;
+}
+
 /*
  *	Do any per-module initialization that is separate to each
  *	configured instance of the module.  e.g. set up connections
@@ -154,6 +221,7 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 	char const	*pool_name = NULL;
 
 	int		rcode;
+	int		backend;
 	uint32_t	i, j;
 	uint32_t	or_result;
 	char		str[32];
@@ -171,7 +239,13 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 	cache_size = inst->cache_size;
 
 	rad_assert(inst->filename && *inst->filename);
-	rad_assert(inst->ip_index && *inst->ip_index);
+
+	backend = fr_str2int(ippool_backends, inst->backend_name, -1);
+	if (backend < 0) {
+		cf_log_err_cs(conf, "Invalid 'backend' value \"%s\", expected 'gdbm' or 'mmap'", inst->backend_name);
+		return -1;
+	}
+	inst->backend = backend;
 
 	inst->range_start = htonl(*((uint32_t *)(&(inst->range_start_addr.ipaddr.ip4addr))));
 	inst->range_stop = htonl(*((uint32_t *)(&(inst->range_stop_addr.ipaddr.ip4addr))));
@@ -182,6 +256,13 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 		return -1;
 	}
 
+	if (inst->backend == IPPOOL_BACKEND_MMAP) return mod_instantiate_mmap(conf, inst);
+
+	if (!inst->ip_index || !*inst->ip_index) {
+		cf_log_err_cs(conf, "'ip_index' is required when using the gdbm backend");
+		return -1;
+	}
+
 	{
 		char *file;
 
@@ -372,6 +453,23 @@ static rlm_rcode_t CC_HINT(nonnull) mod_accounting(void *instance, REQUEST *requ
 		return RLM_MODULE_NOOP;
 	}
 
+	if (inst->backend == IPPOOL_BACKEND_MMAP) {
+		uint32_t ipaddr;
+
+		pthread_mutex_lock(&inst->op_mutex);
+		ret = ippool_mmap_release(inst->pool, key_str, &ipaddr);
+		pthread_mutex_unlock(&inst->op_mutex);
+		if (!ret) {
+			RDEBUG2("Entry not found");
+
+			return RLM_MODULE_NOTFOUND;
+		}
+
+		RDEBUG("Deallocated entry for ip: %s", ip_ntoa(str, ipaddr));
+
+		return RLM_MODULE_OK;
+	}
+
 	RDEBUG2("Searching for an entry for key: '%s'", xlat_str);
 	key_datum.dptr = (char *) &key;
 	key_datum.dsize = sizeof(ippool_key);
@@ -424,6 +522,96 @@ static rlm_rcode_t CC_HINT(nonnull) mod_accounting(void *instance, REQUEST *requ
 	return RLM_MODULE_OK;
 }
 
+/** Allocate an address from the memory mapped pool
+ *
+ * The same as the GDBM backend, except the free address (or the address in use by
+ * the same caller, for multilink PPP) is found without walking the pool.
+ */
+static rlm_rcode_t mod_post_auth_mmap(rlm_ippool_t *inst, REQUEST *request, uint8_t const *key,
+				      char const *hex_str, char const *cli,
+				      int attr_ipaddr, int attr_ipmask, int vendor_ipaddr)
+{
+	ippool_mmap_lease_t	lease;
+	time_t			expires = 0;
+	bool			allocate = true;
+	int			ret;
+	char			str[32];
+	VALUE_PAIR		*vp;
+
+	if (fr_pair_find_by_num(request->reply->vps, attr_ipaddr, vendor_ipaddr, TAG_ANY) != NULL) {
+		RDEBUG("Found IP address attribute in reply attribute list");
+		if (!inst->override) {
+			RDEBUG("override is set to no. Return NOOP");
+			allocate = false;
+		} else {
+			RDEBUG("Override supplied IP address");
+			fr_pair_delete_by_num(&request->reply->vps, attr_ipaddr, vendor_ipaddr, TAG_ANY);
+		}
+	}
+
+	/*
+	 *  The entry may be reclaimed after Session-Timeout
+	 *  or maximum_timeout, whichever is sooner.
+	 */
+	vp = fr_pair_find_by_num(request->reply->vps, PW_SESSION_TIMEOUT, 0, TAG_ANY);
+	if (vp && vp->vp_integer) expires = request->timestamp + vp->vp_integer;
+	if (inst->max_timeout && (!expires || ((request->timestamp + inst->max_timeout) < expires))) {
+		expires = request->timestamp + inst->max_timeout;
+	}
+
+	/*
+	 *  If there is an entry for this key it is stale, and is
+	 *  released even if we're not allocating a new one.
+	 */
+	memset(&lease, 0, sizeof(lease));
+	pthread_mutex_lock(&inst->op_mutex);
+	if (allocate) {
+		ret = ippool_mmap_allocate(inst->pool, &lease, key, cli, request->timestamp, expires);
+	} else {
+		lease.stale = (ippool_mmap_release(inst->pool, key, &lease.stale_ipaddr) > 0);
+		ret = 0;
+	}
+	pthread_mutex_unlock(&inst->op_mutex);
+	if (lease.stale) RDEBUG("Found a stale entry for ip: %s", ip_ntoa(str, lease.stale_ipaddr));
+
+	if (!allocate) return RLM_MODULE_NOOP;
+
+	if (!ret) {
+		RDEBUG("No available ip addresses in pool");
+		return RLM_MODULE_NOTFOUND;
+	}
+
+	if (lease.mppp) RDEBUG("Sharing ip with an active entry for the same caller id (multilink)");
+	RDEBUG("num: %u", lease.sessions);
+	RDEBUG("Allocated ip %s to client key: %s", ip_ntoa(str, lease.ipaddr), hex_str);
+
+	vp = radius_pair_create(request->reply, &request->reply->vps, attr_ipaddr, vendor_ipaddr);
+	vp->vp_ipaddr = lease.ipaddr;
+
+#ifdef WITH_DHCP
+	if ((request->listener->type == RAD_LISTEN_DHCP) &&
+	    (vp = fr_pair_find_by_num(request->reply->vps, PW_SESSION_TIMEOUT, 0, TAG_ANY)) != NULL) {
+		uint32_t timeout = vp->vp_integer;
+
+		vp = radius_pair_create(request->reply, &request->reply->vps,
+					PW_DHCP_IP_ADDRESS_LEASE_TIME, DHCP_MAGIC_VENDOR);
+		vp->vp_integer = timeout;
+		fr_pair_delete_by_num(&request->reply->vps, PW_SESSION_TIMEOUT, 0, TAG_ANY);
+	}
+#endif
+
+	/*
+	 *	If there is no Framed-Netmask attribute in the
+	 *	reply, add one
+	 */
+	if (fr_pair_find_by_num(request->reply->vps, attr_ipmask, vendor_ipaddr, TAG_ANY) == NULL) {
+		vp = radius_pair_create(request->reply, &request->reply->vps, attr_ipmask, vendor_ipaddr);
+		vp->vp_ipaddr = ntohl(inst->netmask);
+	}
+
+	return RLM_MODULE_OK;
+}
+
 static rlm_rcode_t CC_HINT(nonnull) mod_post_auth(void *instance, REQUEST *request)
 {
 	rlm_ippool_t *inst = instance;
@@ -501,6 +689,11 @@ static rlm_rcode_t CC_HINT(nonnull) mod_post_auth(void *instance, REQUEST *reque
 	RDEBUG("MD5 on 'key' directive maps to: %s", hex_str);
 	memcpy(key.key, key_str, 16);
 
+	if (inst->backend == IPPOOL_BACKEND_MMAP) {
+		return mod_post_auth_mmap(inst, request, key_str, hex_str, cli,
+					  attr_ipaddr, attr_ipmask, vendor_ipaddr);
+	}
+
 	RDEBUG("Searching for an entry for key: '%s'", hex_str);
 	key_datum.dptr = (char *) &key;
 	key_datum.dsize = sizeof(ippool_key);
@@ -800,8 +993,12 @@ static int mod_detach(void *instance)
 {
 	rlm_ippool_t *inst = instance;
 
-	gdbm_close(inst->gdbm);
-	gdbm_close(inst->ip);
+	if (inst->backend == IPPOOL_BACKEND_MMAP) {
+		TALLOC_FREE(inst->pool);
+	} else {
+		gdbm_close(inst->gdbm);
+		gdbm_close(inst->ip);
+	}
 	pthread_mutex_destroy(&inst->op_mutex);
 	return 0;
 }
@@ -2,7 +2,7 @@
 # $Id$
 #
 
-SOURCES		:= rlm_ippool.c
+SOURCES		:= rlm_ippool.c ippool_mmap.c
 TARGET		:= rlm_ippool.a
 
 SRC_CFLAGS	:= $(rlm_ippool_CFLAGS) 
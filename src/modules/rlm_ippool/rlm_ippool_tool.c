@@ -60,6 +60,8 @@ RCSID("$Id$")
 #include <gdbm.h>
 #include "../../include/md5.h"
 
+#include "ippool_mmap.h"
+
 static int active = 0;
 
 static int aflag = 0;
@@ -99,6 +101,10 @@ void viewdb(char *sessiondbname, char *indexdbname, char *ipaddress, int old);
 
 void tonewformat(char *sessiondbname, char *newsessiondbname);
 
+void addip_mmap(char *poolname, char *ipaddress, char *NASname, char *NASport);
+
+void viewpool_mmap(char *poolname, char *ipaddress);
+
 void usage(char *argv0);
 
 void addip(char *sessiondbname, char *indexdbname, char *ipaddress,
@@ -572,6 +578,131 @@ void viewdb(char *sessiondbname, char *indexdbname, char *ipaddress, int old) {
 	gdbm_close(sessiondb);
 }
 
+/*
+ *	Memory mapped pools (backend = mmap) are a single file.
+ */
+void addip_mmap(char *poolname, char *ipaddress, char *NASname, char *NASport)
+{
+	ippool_mmap_t	*pool;
+	struct in_addr	ipaddr;
+	uint8_t		key_str[16];
+	char		hex_str[35];
+	char		md5_input_str[MAX_STRING_LEN];
+	FR_MD5_CTX	md5_context;
+
+	if (inet_aton(ipaddress, &ipaddr) == 0) {
+		printf("rlm_ippool_tool: Unable to convert IP address '%s'\n", ipaddress);
+		return;
+	}
+
+	pool = ippool_mmap_open(NULL, poolname, true);
+	if (!pool) {
+		printf("rlm_ippool_tool: %s\n", fr_strerror());
+		return;
+	}
+
+	snprintf(md5_input_str, MAX_STRING_LEN, "%s %s", NASname, NASport);
+
+	fr_md5_init(&md5_context);
+	fr_md5_update(&md5_context, (uint8_t *) md5_input_str, strlen(md5_input_str));
+	fr_md5_final(key_str, &md5_context);
+
+	fr_bin2hex(hex_str, key_str, 16);
+	hex_str[32] = '\0';
+
+	printf("rlm_ippool_tool: Allocating ip to key: '%s'\n", hex_str);
+	if (ippool_mmap_assign(pool, key_str, NULL, ipaddr.s_addr, time(NULL)) < 0) {
+		printf("rlm_ippool_tool: Failed allocating ip %s: %s\n", ipaddress, fr_strerror());
+	} else {
+		printf("rlm_ippool_tool: Allocated ip %s to key  '%s'\n", ipaddress, hex_str);
+	}
+
+	talloc_free(pool);
+}
+
+static int viewlease_mmap(void *ctx, ippool_mmap_lease_t const *lease)
+{
+	char const	*ipaddress = ctx;
+	struct in_addr	ipaddr;
+	char		ip[INET_ADDRSTRLEN];
+	char		hex_str[35];
+
+	memcpy(&ipaddr, &lease->ipaddr, 4);
+	strlcpy(ip, inet_ntoa(ipaddr), sizeof(ip));
+
+	if (lease->active) active++;
+
+	if (!MATCH_IP(ipaddress, ip) || !MATCH_ACTIVE(*lease)) return 0;
+
+	if (!vflag) {
+		if (aflag && lease->active) printf("%s\n", ip);
+		return 0;
+	}
+
+	if (lease->active) {
+		fr_bin2hex(hex_str, lease->key, 16);
+		hex_str[32] = '\0';
+		printf("KEY: '%s' - ", hex_str);
+	}
+
+	printf("ipaddr:%s active:%d cli:%s num:%u", ip, lease->active, lease->active ? lease->cli : "0",
+	       lease->sessions);
+	if (lease->expires) printf(" expires:%" PRId64, (int64_t) lease->expires);
+	printf("\n");
+
+	return 0;
+}
+
+static int collectlease_mmap(void *ctx, ippool_mmap_lease_t const *lease)
+{
+	uint32_t **ips = ctx;
+	size_t len = talloc_array_length(*ips);
+
+	if (!lease->active) return 0;
+
+	*ips = talloc_realloc(NULL, *ips, uint32_t, len + 1);
+	(*ips)[len] = lease->ipaddr;
+
+	return 0;
+}
+
+void viewpool_mmap(char *poolname, char *ipaddress)
+{
+	ippool_mmap_t	*pool;
+	struct in_addr	ipaddr;
+	uint32_t	*ips;
+	size_t		i;
+
+	pool = ippool_mmap_open(NULL, poolname, rflag != 0);
+	if (!pool) {
+		printf("rlm_ippool_tool: %s\n", fr_strerror());
+		return;
+	}
+
+	ippool_mmap_walk(pool, viewlease_mmap, ipaddress);
+
+	/*
+	 *	Release the sessions using the address, or all
+	 *	sessions if no address was given.
+	 */
+	if (rflag) {
+		if (ipaddress) {
+			if (inet_aton(ipaddress, &ipaddr) == 0) {
+				printf("rlm_ippool_tool: Unable to convert IP address '%s'\n", ipaddress);
+			} else if (ippool_mmap_release_addr(pool, ipaddr.s_addr) < 0) {
+				printf("Failed to update %s: %s\n", ipaddress, fr_strerror());
+			}
+		} else {
+			ips = talloc_array(NULL, uint32_t, 0);
+			ippool_mmap_walk(pool, collectlease_mmap, &ips);
+			for (i = 0; i < talloc_array_length(ips); i++) ippool_mmap_release_addr(pool, ips[i]);
+			talloc_free(ips);
+		}
+	}
+
+	talloc_free(pool);
+}
+
 void NEVER_RETURNS usage(char *argv0) {
 	printf("Usage: %s [-a] [-c] [-o] [-v] <filename> <index-db> [ipaddress]\n", argv0);
 	printf("  -a: print all active entries\n");
@@ -585,6 +716,9 @@ void NEVER_RETURNS usage(char *argv0) {
 	printf("  -n: Mark the entry nasIP/nasPort as having ipaddress\n");
 	printf("  Usage: %s -u <filename> <new-filename>\n", argv0);
 	printf("  -u: Update old format database to new.\n");
+	printf("  Pools using the mmap backend have no index-db:\n");
+	printf("  Usage: %s [-a] [-c] [-r] [-v] <filename> [ipaddress]\n", argv0);
+	printf("  Usage: %s -n <filename> <ipaddress> <nasIP> <nasPort>\n", argv0);
 	exit(0);
 }
 
@@ -628,6 +762,19 @@ int main(int argc, char **argv) {
 	argc -= optind;
 	argv += optind;
 
+	if ((argc >= 1) && ippool_mmap_is_pool(argv[0])) {
+		if ((argc == 1 || argc == 2) && !nflag && !uflag && !oflag) {
+			viewpool_mmap(argv[0], argv[1]);
+			if (cflag) printf("%d\n", active);
+		} else if (argc == 4 && nflag && !oflag) {
+			addip_mmap(argv[0], argv[1], argv[2], argv[3]);
+		} else {
+			usage(argv0);
+		}
+
+		return 0;
+	}
+
 	if ((argc == 2 || argc == 3) && !nflag && !uflag) {
 		viewdb(argv[0], argv[1], argv[2], oflag);
 		if (cflag) printf("%d\n", active);
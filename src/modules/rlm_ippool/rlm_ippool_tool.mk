@@ -2,7 +2,7 @@
 # $Id$
 #
 
-SOURCES		:= rlm_ippool_tool.c
+SOURCES		:= rlm_ippool_tool.c ippool_mmap.c
 TARGET		:= rlm_ippool_tool
 TGT_PREREQS	:= libfreeradius-radius.a
 
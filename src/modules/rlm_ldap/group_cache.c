@@ -0,0 +1,501 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file group_cache.c
+ * @brief Cache of group DN to group name mappings, shared by all requests.
+ *
+ * Converting between group DNs and group names normally costs a search per DN.
+ * Mappings retrieved from the directory are kept here for group.name_cache.ttl
+ * seconds, so subsequent conversions don't need to query the directory.
+ *
+ * If group.name_cache.prefetch is enabled, every group object under the group
+ * base_dn is loaded when the module is instantiated.  Groups modified since the
+ * last load are then retrieved every group.name_cache.refresh seconds (using
+ * the modifyTimestamp attribute), and the complete set is re-loaded every
+ * group.name_cache.ttl seconds, which removes any groups that were deleted.
+ *
+ * @copyright 2015 The FreeRADIUS Server Project.
+ */
+#include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/rad_assert.h>
+
+#include "ldap.h"
+
+#ifdef HAVE_PTHREAD_H
+#  define PTHREAD_MUTEX_LOCK pthread_mutex_lock
+#  define PTHREAD_MUTEX_UNLOCK pthread_mutex_unlock
+#else
+#  define PTHREAD_MUTEX_LOCK(_x)
+#  define PTHREAD_MUTEX_UNLOCK(_x)
+#endif
+
+#define LDAP_MAX_TIMESTAMP_LEN	64		//!< Maximum length of a modifyTimestamp value.
+
+/** A mapping between a group's DN and its name
+ *
+ */
+typedef struct ldap_group_cache_entry {
+	char			*dn;		//!< Normalised DN of the group object.
+	char			*name;		//!< Value of the group's name attribute.
+	time_t			expires;	//!< When the mapping should no longer be used.
+} ldap_group_cache_entry_t;
+
+struct ldap_group_cache {
+	rbtree_t		*by_dn;		//!< Entries indexed by DN.  Owns the entries.
+	rbtree_t		*by_name;	//!< Entries indexed by name.
+
+	char			*base_dn;	//!< Where to load groups from, NULL if not prefetching.
+	char const		*filter;	//!< Filter matching all group objects.
+	char			last_modified[LDAP_MAX_TIMESTAMP_LEN];	//!< Latest modifyTimestamp seen.
+
+	time_t			next_refresh;	//!< When to retrieve modified groups.
+	time_t			next_reload;	//!< When to re-load all groups.
+	bool			refreshing;	//!< Whether a worker is currently loading groups.
+
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_t		mutex;		//!< Protects the trees and the refresh state.
+#endif
+};
+
+static int group_cache_dn_cmp(void const *one, void const *two)
+{
+	ldap_group_cache_entry_t const *a = one, *b = two;
+
+	return strcasecmp(a->dn, b->dn);
+}
+
+static int group_cache_name_cmp(void const *one, void const *two)
+{
+	ldap_group_cache_entry_t const *a = one, *b = two;
+
+	return strcmp(a->name, b->name);
+}
+
+static void _group_cache_entry_free(void *data)
+{
+	talloc_free(data);
+}
+
+/** Create the trees which index cache entries
+ *
+ * @param[in] ctx to allocate the trees in.
+ * @param[out] by_dn Where to write the DN index.
+ * @param[out] by_name Where to write the name index.
+ * @return 0 on success, -1 on failure.
+ */
+static int group_cache_trees_alloc(TALLOC_CTX *ctx, rbtree_t **by_dn, rbtree_t **by_name)
+{
+	*by_dn = rbtree_create(ctx, group_cache_dn_cmp, _group_cache_entry_free, 0);
+	if (!*by_dn) return -1;
+
+	*by_name = rbtree_create(ctx, group_cache_name_cmp, NULL, 0);
+	if (!*by_name) {
+		rbtree_free(*by_dn);
+		*by_dn = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Remove an entry from both indexes, freeing it
+ *
+ */
+static void group_cache_remove(rbtree_t *by_dn, rbtree_t *by_name, ldap_group_cache_entry_t *entry)
+{
+	rbtree_deletebydata(by_name, entry);
+	rbtree_deletebydata(by_dn, entry);
+}
+
+/** Add a mapping, replacing any existing mappings for the same DN or name
+ *
+ * @param by_dn index to add the mapping to.
+ * @param by_name index to add the mapping to.
+ * @param dn of the group, must already be normalised.
+ * @param name of the group.
+ * @param name_len length of the name.
+ * @param expires when the mapping should no longer be used.
+ */
+static void group_cache_insert(rbtree_t *by_dn, rbtree_t *by_name,
+			       char const *dn, char const *name, size_t name_len, time_t expires)
+{
+	ldap_group_cache_entry_t *entry, *old;
+
+	entry = talloc_zero(NULL, ldap_group_cache_entry_t);
+	if (!entry) return;
+
+	entry->dn = talloc_typed_strdup(entry, dn);
+	entry->name = talloc_bstrndup(entry, name, name_len);
+	entry->expires = expires;
+
+	old = rbtree_finddata(by_dn, entry);
+	if (old) group_cache_remove(by_dn, by_name, old);
+
+	/*
+	 *	The group was renamed, or another group now has its name.
+	 */
+	old = rbtree_finddata(by_name, entry);
+	if (old) group_cache_remove(by_dn, by_name, old);
+
+	if (!rbtree_insert(by_dn, entry)) {
+		talloc_free(entry);
+		return;
+	}
+
+	if (!rbtree_insert(by_name, entry)) rbtree_deletebydata(by_dn, entry);
+}
+
+/** Retrieve group objects from the directory and add them to the cache
+ *
+ * @param[in] inst rlm_ldap configuration.
+ * @param[in] request Current request, may be NULL.
+ * @param[in,out] pconn to use. May change as this function calls functions which auto re-connect.
+ * @param[in] full if true replace the contents of the cache, else only retrieve groups modified since
+ *	the last load.
+ * @return the number of groups loaded, or -1 on failure.
+ */
+static int group_cache_load(rlm_ldap_t const *inst, REQUEST *request, ldap_handle_t **pconn, bool full)
+{
+	ldap_group_cache_t	*cache = inst->group_cache;
+	ldap_rcode_t		status;
+	LDAPMessage		*result = NULL, *entry;
+
+	char const		*attrs[] = { inst->groupobj_name_attr, "modifyTimestamp", NULL };
+	char			*filter;
+	char			since[LDAP_MAX_TIMESTAMP_LEN];
+	char			last_modified[LDAP_MAX_TIMESTAMP_LEN];
+
+	rbtree_t		*by_dn = NULL, *by_name = NULL;
+	time_t			expires;
+	int			count = 0;
+
+	PTHREAD_MUTEX_LOCK(&cache->mutex);
+	strlcpy(last_modified, cache->last_modified, sizeof(last_modified));
+	PTHREAD_MUTEX_UNLOCK(&cache->mutex);
+
+	if (full || !last_modified[0]) {
+		full = true;
+		filter = talloc_typed_strdup(NULL, cache->filter);
+	} else {
+		rlm_ldap_escape_func(request, since, sizeof(since), last_modified, NULL);
+		filter = talloc_typed_asprintf(NULL, "(&%s(modifyTimestamp>=%s))", cache->filter, since);
+	}
+
+	LDAP_DBG_REQ("%s group name cache", full ? "Loading" : "Refreshing");
+
+	status = rlm_ldap_search(&result, inst, request, pconn, cache->base_dn, inst->groupobj_scope,
+				 filter, attrs, NULL, NULL);
+	talloc_free(filter);
+	switch (status) {
+	case LDAP_PROC_SUCCESS:
+		break;
+
+	case LDAP_PROC_NO_RESULT:
+		if (!full) return 0;
+		break;
+
+	default:
+		return -1;
+	}
+
+	/*
+	 *	Build the new indexes without holding the mutex, so
+	 *	other requests can continue using the existing ones.
+	 */
+	if (full && (group_cache_trees_alloc(cache, &by_dn, &by_name) < 0)) {
+		if (result) ldap_msgfree(result);
+		return -1;
+	}
+
+	expires = time(NULL) + inst->group_cache_ttl;
+
+	if (!full) PTHREAD_MUTEX_LOCK(&cache->mutex);
+	for (entry = result ? ldap_first_entry((*pconn)->handle, result) : NULL;
+	     entry;
+	     entry = ldap_next_entry((*pconn)->handle, entry)) {
+		struct berval	**names, **modified;
+		char		*dn;
+
+		dn = ldap_get_dn((*pconn)->handle, entry);
+		if (!dn) continue;
+		rlm_ldap_normalise_dn(dn, dn);
+
+		names = ldap_get_values_len((*pconn)->handle, entry, inst->groupobj_name_attr);
+		if (!names) {
+			LDAP_DBG_REQ2("Group \"%s\" has no %s attribute, skipping", dn, inst->groupobj_name_attr);
+			ldap_memfree(dn);
+			continue;
+		}
+
+		if (full) {
+			group_cache_insert(by_dn, by_name, dn, names[0]->bv_val, names[0]->bv_len, expires);
+		} else {
+			group_cache_insert(cache->by_dn, cache->by_name, dn, names[0]->bv_val, names[0]->bv_len,
+					   expires);
+		}
+		count++;
+
+		/*
+		 *	Use the server's timestamps so clock skew
+		 *	between us and the directory doesn't matter.
+		 */
+		modified = ldap_get_values_len((*pconn)->handle, entry, "modifyTimestamp");
+		if (modified) {
+			if ((modified[0]->bv_len < sizeof(last_modified)) &&
+			    (strncmp(modified[0]->bv_val, last_modified, modified[0]->bv_len) > 0)) {
+				memcpy(last_modified, modified[0]->bv_val, modified[0]->bv_len);
+				last_modified[modified[0]->bv_len] = '\0';
+			}
+			ldap_value_free_len(modified);
+		}
+
+		ldap_value_free_len(names);
+		ldap_memfree(dn);
+	}
+
+	if (full) {
+		PTHREAD_MUTEX_LOCK(&cache->mutex);
+		rbtree_free(cache->by_name);
+		rbtree_free(cache->by_dn);
+		cache->by_dn = by_dn;
+		cache->by_name = by_name;
+	}
+	strlcpy(cache->last_modified, last_modified, sizeof(cache->last_modified));
+	PTHREAD_MUTEX_UNLOCK(&cache->mutex);
+
+	if (result) ldap_msgfree(result);
+
+	LDAP_DBG_REQ("%s %i group(s)", full ? "Loaded" : "Refreshed", count);
+
+	return count;
+}
+
+/** Retrieve groups which were modified since the last load, if it's time to do so
+ *
+ * Only one worker refreshes the cache at a time, the others continue using the
+ * existing mappings.
+ *
+ * @param[in] inst rlm_ldap configuration.
+ * @param[in] request Current request.
+ * @param[in,out] pconn to use. May change as this function calls functions which auto re-connect.
+ */
+void rlm_ldap_group_cache_refresh(rlm_ldap_t const *inst, REQUEST *request, ldap_handle_t **pconn)
+{
+	ldap_group_cache_t	*cache = inst->group_cache;
+	time_t			now;
+	bool			full;
+
+	if (!cache || !cache->base_dn) return;
+
+	now = time(NULL);
+
+	PTHREAD_MUTEX_LOCK(&cache->mutex);
+	if (cache->refreshing || (now < cache->next_refresh)) {
+		PTHREAD_MUTEX_UNLOCK(&cache->mutex);
+		return;
+	}
+	cache->refreshing = true;
+	full = (now >= cache->next_reload);
+	PTHREAD_MUTEX_UNLOCK(&cache->mutex);
+
+	RINDENT();
+	if (group_cache_load(inst, request, pconn, full) < 0) {
+		RWDEBUG("Failed %s group name cache, using existing mappings", full ? "loading" : "refreshing");
+	}
+	REXDENT();
+
+	PTHREAD_MUTEX_LOCK(&cache->mutex);
+	cache->refreshing = false;
+	cache->next_refresh = now + inst->group_cache_refresh;
+	if (full) cache->next_reload = now + inst->group_cache_ttl;
+	PTHREAD_MUTEX_UNLOCK(&cache->mutex);
+}
+
+/** Find the name of a group from its DN
+ *
+ * @param[in] ctx to allocate the name in.
+ * @param[in] inst rlm_ldap configuration.
+ * @param[in] dn of the group.
+ * @return the name of the group (must be freed with talloc_free), or NULL if it's not in the cache.
+ */
+char *rlm_ldap_group_cache_dn2name(TALLOC_CTX *ctx, rlm_ldap_t const *inst, char const *dn)
+{
+	ldap_group_cache_t		*cache = inst->group_cache;
+	ldap_group_cache_entry_t	my_entry, *found;
+	char				*out = NULL;
+
+	if (!cache) return NULL;
+
+	memset(&my_entry, 0, sizeof(my_entry));
+	my_entry.dn = talloc_array(ctx, char, strlen(dn) + 1);
+	if (!my_entry.dn) return NULL;
+	rlm_ldap_normalise_dn(my_entry.dn, dn);
+
+	PTHREAD_MUTEX_LOCK(&cache->mutex);
+	found = rbtree_finddata(cache->by_dn, &my_entry);
+	if (found) {
+		if (found->expires > time(NULL)) {
+			out = talloc_typed_strdup(ctx, found->name);
+		} else {
+			group_cache_remove(cache->by_dn, cache->by_name, found);
+		}
+	}
+	PTHREAD_MUTEX_UNLOCK(&cache->mutex);
+
+	talloc_free(my_entry.dn);
+
+	return out;
+}
+
+/** Find the DN of a group from its name
+ *
+ * @param[in] ctx to allocate the DN in.
+ * @param[in] inst rlm_ldap configuration.
+ * @param[in] name of the group.
+ * @return the normalised DN of the group (must be freed with talloc_free), or NULL if it's not in the cache.
+ */
+char *rlm_ldap_group_cache_name2dn(TALLOC_CTX *ctx, rlm_ldap_t const *inst, char const *name)
+{
+	ldap_group_cache_t		*cache = inst->group_cache;
+	ldap_group_cache_entry_t	my_entry, *found;
+	char				*out = NULL;
+
+	if (!cache) return NULL;
+
+	memset(&my_entry, 0, sizeof(my_entry));
+	memcpy(&my_entry.name, &name, sizeof(my_entry.name));
+
+	PTHREAD_MUTEX_LOCK(&cache->mutex);
+	found = rbtree_finddata(cache->by_name, &my_entry);
+	if (found) {
+		if (found->expires > time(NULL)) {
+			out = talloc_typed_strdup(ctx, found->dn);
+		} else {
+			group_cache_remove(cache->by_dn, cache->by_name, found);
+		}
+	}
+	PTHREAD_MUTEX_UNLOCK(&cache->mutex);
+
+	return out;
+}
+
+/** Record a mapping retrieved from the directory
+ *
+ * @param[in] inst rlm_ldap configuration.
+ * @param[in] dn of the group.
+ * @param[in] name of the group.
+ */
+void rlm_ldap_group_cache_add(rlm_ldap_t const *inst, char const *dn, char const *name)
+{
+	ldap_group_cache_t	*cache = inst->group_cache;
+	char			*norm;
+
+	if (!cache) return;
+
+	norm = talloc_array(NULL, char, strlen(dn) + 1);
+	if (!norm) return;
+	rlm_ldap_normalise_dn(norm, dn);
+
+	PTHREAD_MUTEX_LOCK(&cache->mutex);
+	group_cache_insert(cache->by_dn, cache->by_name, norm, name, strlen(name),
+			   time(NULL) + inst->group_cache_ttl);
+	PTHREAD_MUTEX_UNLOCK(&cache->mutex);
+
+	talloc_free(norm);
+}
+
+static int _group_cache_free(ldap_group_cache_t *cache)
+{
+	rbtree_free(cache->by_name);
+	rbtree_free(cache->by_dn);
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_destroy(&cache->mutex);
+#endif
+
+	return 0;
+}
+
+/** Create the group name cache, and load all groups if prefetching is enabled
+ *
+ * @param[in] inst rlm_ldap configuration.
+ * @return 0 on success (or if the cache is disabled), -1 on failure.
+ */
+int rlm_ldap_group_cache_init(rlm_ldap_t *inst)
+{
+	ldap_group_cache_t	*cache;
+	ldap_handle_t		*conn;
+	int			count;
+
+	if (!inst->group_cache_ttl) return 0;
+
+	cache = talloc_zero(inst, ldap_group_cache_t);
+	if (!cache) return -1;
+
+	if (group_cache_trees_alloc(cache, &cache->by_dn, &cache->by_name) < 0) {
+		talloc_free(cache);
+		return -1;
+	}
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_init(&cache->mutex, NULL);
+#endif
+	talloc_set_destructor(cache, _group_cache_free);
+
+	inst->group_cache = cache;
+
+	if (!inst->group_cache_prefetch) return 0;
+
+	if (!inst->groupobj_name_attr) {
+		cf_log_err_cs(inst->cs, "Prefetching groups requires 'group.name_attribute'");
+		return -1;
+	}
+
+	/*
+	 *	We need a base_dn which doesn't depend on the request.
+	 */
+	if (inst->groupobj_base_dn->type != TMPL_TYPE_LITERAL) {
+		LDAP_WARN("Not prefetching groups, group.base_dn is expanded at runtime");
+		return 0;
+	}
+
+	cache->base_dn = talloc_typed_strdup(cache, inst->groupobj_base_dn->name);
+	cache->filter = inst->groupobj_filter ? inst->groupobj_filter : "(objectClass=*)";
+
+	/*
+	 *	If the directory isn't available yet, the groups will be
+	 *	loaded by the first request that needs them.
+	 */
+	conn = mod_conn_get(inst, NULL);
+	if (!conn) {
+		LDAP_WARN("Failed prefetching groups, will retry on first use");
+		return 0;
+	}
+
+	count = group_cache_load(inst, NULL, &conn, true);
+	mod_conn_release(inst, conn);
+	if (count < 0) {
+		LDAP_WARN("Failed prefetching groups, will retry on first use");
+		return 0;
+	}
+
+	cache->next_refresh = time(NULL) + inst->group_cache_refresh;
+	cache->next_reload = time(NULL) + inst->group_cache_ttl;
+
+	LDAP_INFO("Loaded %i group(s) into the group name cache", count);
+
+	return 0;
+}
@@ -34,11 +34,15 @@
  * Given an array of group names, builds a filter matching all names, then retrieves all group objects
  * and stores the DN associated with each group object.
  *
+ * Names found in the group name cache aren't included in the filter, and if all names are found
+ * the directory isn't queried at all.
+ *
  * @param[in] inst rlm_ldap configuration.
  * @param[in] request Current request.
  * @param[in,out] pconn to use. May change as this function calls functions which auto re-connect.
  * @param[in] names to covert to DNs (NULL terminated).
- * @param[out] out Where to write the DNs. DNs must be freed with ldap_memfree(). Will be NULL terminated.
+ * @param[out] out Where to write the DNs. DNs are allocated in the context of the request, and must be
+ *	freed with talloc_free(). Will be NULL terminated.
  * @param[in] outlen Size of out.
  * @return One of the RLM_MODULE_* values.
  */
@@ -50,8 +54,9 @@ static rlm_rcode_t rlm_ldap_group_name2dn(rlm_ldap_t const *inst, REQUEST *reque
 	int ldap_errno;
 
 	unsigned int name_cnt = 0;
+	unsigned int cached_cnt = 0;
 	unsigned int entry_cnt;
-	char const *attrs[] = { NULL };
+	char const *attrs[] = { inst->groupobj_name_attr, NULL };
 
 	LDAPMessage *result = NULL, *entry;
 
@@ -61,7 +66,7 @@ static rlm_rcode_t rlm_ldap_group_name2dn(rlm_ldap_t const *inst, REQUEST *reque
 	char base_dn_buff[LDAP_MAX_DN_STR_LEN];
 	char buffer[LDAP_MAX_GROUP_NAME_LEN + 1];
 
-	char *filter;
+	char *filter, *name_filter;
 
 	*dn = NULL;
 
@@ -81,25 +86,43 @@ static rlm_rcode_t rlm_ldap_group_name2dn(rlm_ldap_t const *inst, REQUEST *reque
 	 *	It'll probably only save a few ms in network latency, but it means we can send a query
 	 *	for the entire group list at once.
 	 */
-	filter = talloc_typed_asprintf(request, "%s%s%s",
-				 inst->groupobj_filter ? "(&" : "",
-				 inst->groupobj_filter ? inst->groupobj_filter : "",
-				 names[0] && names[1] ? "(|" : "");
-	while (*name) {
-		rlm_ldap_escape_func(request, buffer, sizeof(buffer), *name++, NULL);
+	filter = talloc_typed_strdup(request, "");
+	for (; *name; name++) {
+		if (cached_cnt < (outlen - 1)) {
+			*dn = rlm_ldap_group_cache_name2dn(request, inst, *name);
+			if (*dn) {
+				RDEBUG("Got group DN \"%s\" (cached)", *dn);
+				dn++;
+				cached_cnt++;
+				continue;
+			}
+		}
+
+		rlm_ldap_escape_func(request, buffer, sizeof(buffer), *name, NULL);
 		filter = talloc_asprintf_append_buffer(filter, "(%s=%s)", inst->groupobj_name_attr, buffer);
 
 		name_cnt++;
 	}
-	filter = talloc_asprintf_append_buffer(filter, "%s%s",
-					       inst->groupobj_filter ? ")" : "",
-					       names[0] && names[1] ? ")" : "");
+	*dn = NULL;
+
+	if (!name_cnt) goto finish;
+
+	name_filter = filter;
+	filter = talloc_typed_asprintf(request, "%s%s%s%s%s%s",
+				       inst->groupobj_filter ? "(&" : "",
+				       inst->groupobj_filter ? inst->groupobj_filter : "",
+				       name_cnt > 1 ? "(|" : "",
+				       name_filter,
+				       name_cnt > 1 ? ")" : "",
+				       inst->groupobj_filter ? ")" : "");
+	talloc_free(name_filter);
 
 	if (tmpl_expand(&base_dn, base_dn_buff, sizeof(base_dn_buff), request,
 			inst->groupobj_base_dn, rlm_ldap_escape_func, NULL) < 0) {
 		REDEBUG("Failed creating base_dn");
 
-		return RLM_MODULE_INVALID;
+		rcode = RLM_MODULE_INVALID;
+		goto finish;
 	}
 
 	status = rlm_ldap_search(&result, inst, request, pconn, base_dn, inst->groupobj_scope,
@@ -125,7 +148,7 @@ static rlm_rcode_t rlm_ldap_group_name2dn(rlm_ldap_t const *inst, REQUEST *reque
 		goto finish;
 	}
 
-	if (entry_cnt > (outlen - 1)) {
+	if ((entry_cnt + cached_cnt) > (outlen - 1)) {
 		REDEBUG("Number of DNs exceeds limit (%zu)", outlen - 1);
 		rcode = RLM_MODULE_INVALID;
 
@@ -147,18 +170,34 @@ static rlm_rcode_t rlm_ldap_group_name2dn(rlm_ldap_t const *inst, REQUEST *reque
 	}
 
 	do {
-		*dn = ldap_get_dn((*pconn)->handle, entry);
-		if (!*dn) {
+		char *entry_dn;
+		struct berval **values;
+
+		entry_dn = ldap_get_dn((*pconn)->handle, entry);
+		if (!entry_dn) {
 			ldap_get_option((*pconn)->handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
 			REDEBUG("Retrieving object DN from entry failed: %s", ldap_err2string(ldap_errno));
 
 			rcode = RLM_MODULE_FAIL;
 			goto finish;
 		}
-		rlm_ldap_normalise_dn(*dn, *dn);
+		rlm_ldap_normalise_dn(entry_dn, entry_dn);
+
+		*dn = talloc_typed_strdup(request, entry_dn);
+		ldap_memfree(entry_dn);
+
+		values = ldap_get_values_len((*pconn)->handle, entry, inst->groupobj_name_attr);
+		if (values) {
+			char *value;
+
+			value = rlm_ldap_berval_to_string(request, values[0]);
+			rlm_ldap_group_cache_add(inst, *dn, value);
+			talloc_free(value);
+			ldap_value_free_len(values);
+		}
 
 		RDEBUG("Got group DN \"%s\"", *dn);
-		dn++;
+		*++dn = NULL;
 	} while((entry = ldap_next_entry((*pconn)->handle, entry)));
 
 	*dn = NULL;
@@ -174,53 +213,73 @@ finish:
 	 */
 	if (rcode != RLM_MODULE_OK) {
 		dn = out;
-		while(*dn) ldap_memfree(*dn++);
-		*dn = NULL;
+		while(*dn) talloc_free(*dn++);
+		*out = NULL;
 	}
 
 	return rcode;
 }
 
-/** Convert a single group name into a DN
+/** Start resolving a group DN to a name
  *
  * Unlike the inverse conversion of a name to a DN, most LDAP directories don't allow filtering by DN,
- * so we need to search for each DN individually.
+ * so we need to search for each DN individually.  If searches are multiplexed, the searches for
+ * multiple DNs may be in progress at the same time.
  *
+ * @param[out] search to initialise.
  * @param[in] inst rlm_ldap configuration.
  * @param[in] request Current request.
  * @param[in,out] pconn to use. May change as this function calls functions which auto re-connect.
- * @param[in] dn to resolve.
+ * @param[in] dn to resolve.  Must remain valid until the result has been retrieved.
+ * @param[in] attrs to retrieve, { inst->groupobj_name_attr, NULL }.  Must remain valid until the result
+ *	has been retrieved.
+ * @return One of the RLM_MODULE_* values.
+ */
+static rlm_rcode_t rlm_ldap_group_dn2name_async(ldap_search_t *search, rlm_ldap_t const *inst, REQUEST *request,
+						ldap_handle_t **pconn, char const *dn, char const * const *attrs)
+{
+	if (!inst->groupobj_name_attr) {
+		REDEBUG("Told to resolve group DN to name but missing 'group.name_attribute' directive");
+
+		return RLM_MODULE_INVALID;
+	}
+
+	RDEBUG("Resolving group DN \"%s\" to group name", dn);
+
+	if (rlm_ldap_search_async(search, inst, request, pconn, dn, LDAP_SCOPE_BASE, NULL, attrs,
+				  NULL, NULL) != LDAP_PROC_SUCCESS) return RLM_MODULE_FAIL;
+
+	return RLM_MODULE_OK;
+}
+
+/** Retrieve the name a group DN resolved to
+ *
+ * @param[in] inst rlm_ldap configuration.
+ * @param[in] request Current request.
+ * @param[in,out] pconn to use. May change as this function calls functions which auto re-connect.
+ * @param[in] search started by #rlm_ldap_group_dn2name_async.
  * @param[out] out Where to write group name (must be freed with talloc_free).
  * @return One of the RLM_MODULE_* values.
  */
-static rlm_rcode_t rlm_ldap_group_dn2name(rlm_ldap_t const *inst, REQUEST *request,
-					  ldap_handle_t **pconn, char const *dn, char **out)
+static rlm_rcode_t rlm_ldap_group_dn2name_result(rlm_ldap_t const *inst, REQUEST *request,
+						 ldap_handle_t **pconn, ldap_search_t *search, char **out)
 {
 	rlm_rcode_t rcode = RLM_MODULE_OK;
 	ldap_rcode_t status;
 	int ldap_errno;
 
 	struct berval **values = NULL;
-	char const *attrs[] = { inst->groupobj_name_attr, NULL };
 	LDAPMessage *result = NULL, *entry;
 
 	*out = NULL;
 
-	if (!inst->groupobj_name_attr) {
-		REDEBUG("Told to resolve group DN to name but missing 'group.name_attribute' directive");
-
-		return RLM_MODULE_INVALID;
-	}
-
-	RDEBUG("Resolving group DN \"%s\" to group name", dn);
-
-	status = rlm_ldap_search(&result, inst, request, pconn, dn, LDAP_SCOPE_BASE, NULL, attrs, NULL, NULL);
+	status = rlm_ldap_search_result(&result, inst, request, pconn, search);
 	switch (status) {
 	case LDAP_PROC_SUCCESS:
 		break;
 
 	case LDAP_PROC_NO_RESULT:
-		REDEBUG("Group DN \"%s\" did not resolve to an object", dn);
+		REDEBUG("Group DN \"%s\" did not resolve to an object", search->dn);
 		return inst->allow_dangling_group_refs ? RLM_MODULE_NOOP : RLM_MODULE_INVALID;
 
 	default:
@@ -246,7 +305,9 @@ static rlm_rcode_t rlm_ldap_group_dn2name(rlm_ldap_t const *inst, REQUEST *reque
 	}
 
 	*out = rlm_ldap_berval_to_string(request, values[0]);
-	RDEBUG("Group DN \"%s\" resolves to name \"%s\"", dn, *out);
+	RDEBUG("Group DN \"%s\" resolves to name \"%s\"", search->dn, *out);
+
+	rlm_ldap_group_cache_add(inst, search->dn, *out);
 
 finish:
 	if (result) ldap_msgfree(result);
@@ -255,6 +316,34 @@ finish:
 	return rcode;
 }
 
+/** Convert a single group DN into a name
+ *
+ * @param[in] inst rlm_ldap configuration.
+ * @param[in] request Current request.
+ * @param[in,out] pconn to use. May change as this function calls functions which auto re-connect.
+ * @param[in] dn to resolve.
+ * @param[out] out Where to write group name (must be freed with talloc_free).
+ * @return One of the RLM_MODULE_* values.
+ */
+static rlm_rcode_t rlm_ldap_group_dn2name(rlm_ldap_t const *inst, REQUEST *request,
+					  ldap_handle_t **pconn, char const *dn, char **out)
+{
+	rlm_rcode_t rcode;
+	ldap_search_t search;
+	char const *attrs[] = { inst->groupobj_name_attr, NULL };
+
+	*out = rlm_ldap_group_cache_dn2name(request, inst, dn);
+	if (*out) {
+		RDEBUG("Group DN \"%s\" resolves to name \"%s\" (cached)", dn, *out);
+		return RLM_MODULE_OK;
+	}
+
+	rcode = rlm_ldap_group_dn2name_async(&search, inst, request, pconn, dn, attrs);
+	if (rcode != RLM_MODULE_OK) return rcode;
+
+	return rlm_ldap_group_dn2name_result(inst, request, pconn, &search, out);
+}
+
 /** Convert group membership information into attributes
  *
  * @param[in] inst rlm_ldap configuration.
@@ -279,15 +368,21 @@ rlm_rcode_t rlm_ldap_cacheable_userobj(rlm_ldap_t const *inst, REQUEST *request,
 
 	char *name;
 
+	ldap_search_t *searches = NULL;
+	char **cached = NULL;
+	char const *attrs[] = { inst->groupobj_name_attr, NULL };
+
 	VALUE_PAIR *vp, **list, *groups = NULL;
 	TALLOC_CTX *list_ctx, *value_ctx;
 	vp_cursor_t list_cursor, groups_cursor;
 
-	int is_dn, i, count;
+	int is_dn, i, j, count;
 
 	rad_assert(entry);
 	rad_assert(attr);
 
+	rlm_ldap_group_cache_refresh(inst, request, pconn);
+
 	/*
 	 *	Parse the membership information we got in the initial user query.
 	 */
@@ -307,6 +402,39 @@ rlm_rcode_t rlm_ldap_cacheable_userobj(rlm_ldap_t const *inst, REQUEST *request,
 	 */
 	value_ctx = talloc_new(request);
 
+	if (count > LDAP_MAX_CACHEABLE) count = LDAP_MAX_CACHEABLE;
+
+	/*
+	 *	We were told to cache names, start resolving any DNs we got to names.
+	 *	Only Active Directory supports filtering on DN, so we have to search
+	 *	for each individual group, but if searches are multiplexed all the
+	 *	searches will be in progress at once.  DNs already in the group
+	 *	name cache don't need a search at all.
+	 */
+	if (inst->cacheable_group_name) {
+		searches = talloc_zero_array(value_ctx, ldap_search_t, count);
+		cached = talloc_zero_array(value_ctx, char *, count);
+
+		for (i = 0; i < count; i++) {
+			char *dn;
+
+			if (!rlm_ldap_is_dn(values[i]->bv_val, values[i]->bv_len)) continue;
+
+			dn = rlm_ldap_berval_to_string(value_ctx, values[i]);
+			cached[i] = rlm_ldap_group_cache_dn2name(value_ctx, inst, dn);
+			if (cached[i]) {
+				RDEBUG("Group DN \"%s\" resolves to name \"%s\" (cached)", dn, cached[i]);
+				continue;
+			}
+
+			rcode = rlm_ldap_group_dn2name_async(&searches[i], inst, request, pconn, dn, attrs);
+			if (rcode != RLM_MODULE_OK) {
+				i = -1;
+				goto error;
+			}
+		}
+	}
+
 	/*
 	 *	Temporary list to hold new group VPs, will be merged
 	 *	once all group info has been gathered/resolved
@@ -314,7 +442,7 @@ rlm_rcode_t rlm_ldap_cacheable_userobj(rlm_ldap_t const *inst, REQUEST *request,
 	 */
 	fr_cursor_init(&groups_cursor, &groups);
 
-	for (i = 0; (i < LDAP_MAX_CACHEABLE) && (i < count); i++) {
+	for (i = 0; i < count; i++) {
 		is_dn = rlm_ldap_is_dn(values[i]->bv_val, values[i]->bv_len);
 
 		if (inst->cacheable_group_dn) {
@@ -343,21 +471,28 @@ rlm_rcode_t rlm_ldap_cacheable_userobj(rlm_ldap_t const *inst, REQUEST *request,
 				fr_pair_value_bstrncpy(vp, values[i]->bv_val, values[i]->bv_len);
 				fr_cursor_insert(&groups_cursor, vp);
 			/*
-			 *	We were told to cache names but we got a DN, we now need to resolve
-			 *	this to a name.
-			 *	Only Active Directory supports filtering on DN, so we have to search
-			 *	for each individual group.
+			 *	We were told to cache names but we got a DN, collect the
+			 *	name it resolved to.
 			 */
 			} else {
-				char *dn;
-
-				dn = rlm_ldap_berval_to_string(value_ctx, values[i]);
-				rcode = rlm_ldap_group_dn2name(inst, request, pconn, dn, &name);
-				talloc_free(dn);
-
+				if (cached[i]) {
+					name = cached[i];
+					rcode = RLM_MODULE_OK;
+				} else {
+					rcode = rlm_ldap_group_dn2name_result(inst, request, pconn, &searches[i], &name);
+				}
 				if (rcode == RLM_MODULE_NOOP) continue;
 
 				if (rcode != RLM_MODULE_OK) {
+				error:
+					/*
+					 *	Don't leave searches we'll never
+					 *	collect the results of outstanding.
+					 */
+					if (searches) for (j = i + 1; j < count; j++) {
+						rlm_ldap_search_abandon(inst, &searches[j]);
+					}
+
 					ldap_value_free_len(values);
 					talloc_free(value_ctx);
 					fr_pair_list_free(&groups);
@@ -401,7 +536,7 @@ rlm_rcode_t rlm_ldap_cacheable_userobj(rlm_ldap_t const *inst, REQUEST *request,
 		fr_cursor_insert(&list_cursor, vp);
 
 		RDEBUG("&control:%s += \"%s\"", inst->cache_da->name, vp->vp_strvalue);
-		ldap_memfree(*dn_p);
+		talloc_free(*dn_p);
 	}
 	REXDENT();
 
@@ -648,6 +783,8 @@ rlm_rcode_t rlm_ldap_check_userobj_dynamic(rlm_ldap_t const *inst, REQUEST *requ
 	char const	*attrs[] = { inst->userobj_membership_attr, NULL };
 	int		i, count, ldap_errno;
 
+	rlm_ldap_group_cache_refresh(inst, request, pconn);
+
 	RDEBUG2("Checking user object's %s attributes", inst->userobj_membership_attr);
 	RINDENT();
 	status = rlm_ldap_search(&result, inst, request, pconn, dn, LDAP_SCOPE_BASE, NULL, attrs, NULL, NULL);
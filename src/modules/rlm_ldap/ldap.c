@@ -433,30 +433,29 @@ char const *rlm_ldap_error_str(ldap_handle_t const *conn)
 	return ldap_err2string(lib_errno);
 }
 
-/** Parse response from LDAP server dealing with any errors
+/** Parse a result retrieved from the LDAP server dealing with any errors
  *
- * Should be called after an LDAP operation. Will check result of operation and if it was successful, then attempt
- * to retrieve and parse the result.
- *
- * Will also produce extended error output including any messages the server sent, and information about partial
- * DN matches.
+ * Checks the status of a result which has already been retrieved, or of the operation which should have
+ * produced it, and produces extended error output including any messages the server sent, and information
+ * about partial DN matches.
  *
  * @param[in] inst of LDAP module.
- * @param[in] conn Current connection.
- * @param[in] msgid returned from last operation. May be -1 if no result processing is required.
+ * @param[in] conn the result was retrieved from. Extended error messages are allocated in its context.
+ * @param[in] lib_errno error retrieving the result, or LDAP_SUCCESS if *result should be parsed.
  * @param[in] dn Last search or bind DN.
- * @param[out] result Where to write result, if NULL result will be freed.
+ * @param[in,out] result to parse.  Will be freed and set to NULL if freeit is true, or on error.
+ * @param[in] freeit Whether the result should be freed after being parsed.
  * @param[out] error Where to write the error string, may be NULL, must not be freed.
  * @param[out] extra Where to write additional error string to, may be NULL (faster) or must be freed
  *	(with talloc_free).
  * @return One of the LDAP_PROC_* (#ldap_rcode_t) values.
  */
-ldap_rcode_t rlm_ldap_result(rlm_ldap_t const *inst, ldap_handle_t const *conn, int msgid, char const *dn,
-			     LDAPMessage **result, char const **error, char **extra)
+ldap_rcode_t rlm_ldap_result_parse(rlm_ldap_t const *inst, ldap_handle_t const *conn, int lib_errno,
+				   char const *dn, LDAPMessage **result, bool freeit,
+				   char const **error, char **extra)
 {
 	ldap_rcode_t status = LDAP_PROC_SUCCESS;
 
-	int lib_errno = LDAP_SUCCESS;	// errno returned by the library.
 	int srv_errno = LDAP_SUCCESS;	// errno in the result message.
 
 	char *part_dn = NULL;		// Partial DN match.
@@ -464,55 +463,16 @@ ldap_rcode_t rlm_ldap_result(rlm_ldap_t const *inst, ldap_handle_t const *conn,
 	char *srv_err = NULL;		// Server's extended error message.
 	char *p, *a;
 
-	bool freeit = false;		// Whether the message should be freed after being processed.
 	int len;
 
-	struct timeval tv;		// Holds timeout values.
-
-	LDAPMessage *tmp_msg = NULL;	// Temporary message pointer storage if we weren't provided with one.
-
 	char const *tmp_err;		// Temporary error pointer storage if we weren't provided with one.
 
 	if (!error) error = &tmp_err;
 	*error = NULL;
 
 	if (extra) *extra = NULL;
-	if (result) *result = NULL;
-
-	/*
-	 *	We always need the result, but our caller may not
-	 */
-	if (!result) {
-		result = &tmp_msg;
-		freeit = true;
-	}
 
-	/*
-	 *	Check if there was an error sending the request
-	 */
-	ldap_get_option(conn->handle, LDAP_OPT_ERROR_NUMBER, &lib_errno);
 	if (lib_errno != LDAP_SUCCESS) goto process_error;
-	if (msgid < 0) return LDAP_SUCCESS;	/* No msgid and no error, return now */
-
-	memset(&tv, 0, sizeof(tv));
-	tv.tv_sec = inst->res_timeout;
-
-	/*
-	 *	Now retrieve the result and check for errors
-	 *	ldap_result returns -1 on failure, and 0 on timeout
-	 */
-	lib_errno = ldap_result(conn->handle, msgid, 1, &tv, result);
-	if (lib_errno == 0) {
-		lib_errno = LDAP_TIMEOUT;
-
-		goto process_error;
-	}
-
-	if (lib_errno == -1) {
-		ldap_get_option(conn->handle, LDAP_OPT_ERROR_NUMBER, &lib_errno);
-
-		goto process_error;
-	}
 
 	/*
 	 *	Parse the result and check for errors sent by the server
@@ -673,6 +633,77 @@ process_error:
 	return status;
 }
 
+/** Parse response from LDAP server dealing with any errors
+ *
+ * Should be called after an LDAP operation. Will check result of operation and if it was successful, then attempt
+ * to retrieve and parse the result.
+ *
+ * Will also produce extended error output including any messages the server sent, and information about partial
+ * DN matches.
+ *
+ * @param[in] inst of LDAP module.
+ * @param[in] conn Current connection.
+ * @param[in] msgid returned from last operation. May be -1 if no result processing is required.
+ * @param[in] dn Last search or bind DN.
+ * @param[out] result Where to write result, if NULL result will be freed.
+ * @param[out] error Where to write the error string, may be NULL, must not be freed.
+ * @param[out] extra Where to write additional error string to, may be NULL (faster) or must be freed
+ *	(with talloc_free).
+ * @return One of the LDAP_PROC_* (#ldap_rcode_t) values.
+ */
+ldap_rcode_t rlm_ldap_result(rlm_ldap_t const *inst, ldap_handle_t const *conn, int msgid, char const *dn,
+			     LDAPMessage **result, char const **error, char **extra)
+{
+	int lib_errno = LDAP_SUCCESS;	// errno returned by the library.
+
+	bool freeit = false;		// Whether the message should be freed after being processed.
+
+	struct timeval tv;		// Holds timeout values.
+
+	LDAPMessage *tmp_msg = NULL;	// Temporary message pointer storage if we weren't provided with one.
+
+	if (result) *result = NULL;
+
+	/*
+	 *	We always need the result, but our caller may not
+	 */
+	if (!result) {
+		result = &tmp_msg;
+		freeit = true;
+	}
+
+	/*
+	 *	Check if there was an error sending the request
+	 */
+	ldap_get_option(conn->handle, LDAP_OPT_ERROR_NUMBER, &lib_errno);
+	if (lib_errno != LDAP_SUCCESS) goto process_error;
+	if (msgid < 0) {			/* No msgid and no error, return now */
+		if (error) *error = NULL;
+		if (extra) *extra = NULL;
+
+		return LDAP_PROC_SUCCESS;
+	}
+
+	memset(&tv, 0, sizeof(tv));
+	tv.tv_sec = inst->res_timeout;
+
+	/*
+	 *	Now retrieve the result and check for errors
+	 *	ldap_result returns -1 on failure, and 0 on timeout
+	 */
+	lib_errno = ldap_result(conn->handle, msgid, 1, &tv, result);
+	if (lib_errno == 0) {
+		lib_errno = LDAP_TIMEOUT;
+	} else if (lib_errno == -1) {
+		ldap_get_option(conn->handle, LDAP_OPT_ERROR_NUMBER, &lib_errno);
+	} else {
+		lib_errno = LDAP_SUCCESS;
+	}
+
+process_error:
+	return rlm_ldap_result_parse(inst, conn, lib_errno, dn, result, freeit, error, extra);
+}
+
 /** Bind to the LDAP directory as a user
  *
  * Performs a simple bind to the LDAP directory, and handles any errors that occur.
@@ -797,52 +828,38 @@ ldap_rcode_t rlm_ldap_bind(rlm_ldap_t const *inst, REQUEST *request, ldap_handle
 	return status; /* caller closes the connection */
 }
 
-/** Search for something in the LDAP directory
+/** Send a search
  *
- * Binds as the administrative user and performs a search, dealing with any errors.
+ * Searches are sent on the caller's pooled connection, unless they're being multiplexed,
+ * in which case they're sent on one of the shared connections.
  *
- * @param[out] result Where to store the result. Must be freed with ldap_msgfree if LDAP_PROC_SUCCESS is returned.
- *	May be NULL in which case result will be automatically freed after use.
  * @param[in] inst rlm_ldap configuration.
  * @param[in] request Current request.
  * @param[in,out] pconn to use. May change as this function calls functions which auto re-connect.
- * @param[in] dn to use as base for the search.
- * @param[in] scope to use (LDAP_SCOPE_BASE, LDAP_SCOPE_ONE, LDAP_SCOPE_SUB).
- * @param[in] filter to use, should be pre-escaped.
- * @param[in] attrs to retrieve.
- * @param[in] serverctrls Search controls to pass to the server.  May be NULL.
- * @param[in] clientctrls Search controls for ldap_search.  May be NULL.
+ * @param[in] search to send.
  * @return One of the LDAP_PROC_* (#ldap_rcode_t) values.
  */
-ldap_rcode_t rlm_ldap_search(LDAPMessage **result, rlm_ldap_t const *inst, REQUEST *request,
-			     ldap_handle_t **pconn,
-			     char const *dn, int scope, char const *filter, char const * const *attrs,
-			     LDAPControl **serverctrls, LDAPControl **clientctrls)
+static ldap_rcode_t rlm_ldap_search_send(rlm_ldap_t const *inst, REQUEST *request, ldap_handle_t **pconn,
+					 ldap_search_t *search)
 {
-	ldap_rcode_t	status = LDAP_PROC_ERROR;
-	LDAPMessage	*our_result = NULL;
-
-	int		msgid;		// Message id returned by
-					// ldap_search_ext.
-
-	int		count = 0;	// Number of results we got.
-
+	ldap_rcode_t	status;
 	struct timeval	tv;		// Holds timeout values.
+	char		**search_attrs;
 
-	char const 	*error = NULL;
-	char		*extra = NULL;
+	/*
+	 *	Shared connections are only ever bound as the admin user,
+	 *	and any errors sending the search are picked up when
+	 *	the result is retrieved.
+	 */
+	if (inst->mux) {
+		rlm_ldap_mux_send(inst, request, search);
+		search->sent = true;
 
-	int 		i;
+		return LDAP_PROC_SUCCESS;
+	}
 
 	rad_assert(*pconn && (*pconn)->handle);
 
-	/*
-	 *	OpenLDAP library doesn't declare attrs array as const, but
-	 *	it really should be *sigh*.
-	 */
-	char **search_attrs;
-	memcpy(&search_attrs, &attrs, sizeof(attrs));
-
 	/*
 	 *	Do all searches as the admin user.
 	 */
@@ -858,13 +875,12 @@ ldap_rcode_t rlm_ldap_search(LDAPMessage **result, rlm_ldap_t const *inst, REQUE
 		(*pconn)->rebound = false;
 	}
 
-	if (filter) {
-		LDAP_DBG_REQ("Performing search in \"%s\" with filter \"%s\", scope \"%s\"", dn, filter,
-			     fr_int2str(ldap_scope, scope, "<INVALID>"));
-	} else {
-		LDAP_DBG_REQ("Performing unfiltered search in \"%s\", scope \"%s\"", dn,
-			     fr_int2str(ldap_scope, scope, "<INVALID>"));
-	}
+	/*
+	 *	OpenLDAP library doesn't declare attrs array as const, but
+	 *	it really should be *sigh*.
+	 */
+	memcpy(&search_attrs, &search->attrs, sizeof(search_attrs));
+
 	/*
 	 *	If LDAP search produced an error it should also be logged
 	 *	to the ld. result should pick it up without us
@@ -873,16 +889,107 @@ ldap_rcode_t rlm_ldap_search(LDAPMessage **result, rlm_ldap_t const *inst, REQUE
 	memset(&tv, 0, sizeof(tv));
 	tv.tv_sec = inst->res_timeout;
 
+	(void) ldap_search_ext((*pconn)->handle, search->dn, search->scope, search->filter, search_attrs,
+			       0, search->serverctrls, search->clientctrls, &tv, 0, &search->msgid);
+	search->sent = true;
+
+	return LDAP_PROC_SUCCESS;
+}
+
+/** Start a search in the LDAP directory
+ *
+ * If searches are multiplexed over shared connections the search is sent immediately, and the caller
+ * may start other searches before collecting the results with #rlm_ldap_search_result.
+ *
+ * Otherwise the search is sent when the result is requested, as a pooled connection can only
+ * have one search outstanding at a time.
+ *
+ * Every search started must either have its result collected, or be abandoned with
+ * #rlm_ldap_search_abandon.
+ *
+ * @param[out] search to initialise.  Must remain valid until the result has been collected.
+ * @param[in] inst rlm_ldap configuration.
+ * @param[in] request Current request.
+ * @param[in,out] pconn to use. May change as this function calls functions which auto re-connect.
+ * @param[in] dn to use as base for the search.
+ * @param[in] scope to use (LDAP_SCOPE_BASE, LDAP_SCOPE_ONE, LDAP_SCOPE_SUB).
+ * @param[in] filter to use, should be pre-escaped.
+ * @param[in] attrs to retrieve.
+ * @param[in] serverctrls Search controls to pass to the server.  May be NULL.
+ * @param[in] clientctrls Search controls for ldap_search.  May be NULL.
+ * @return One of the LDAP_PROC_* (#ldap_rcode_t) values.
+ */
+ldap_rcode_t rlm_ldap_search_async(ldap_search_t *search, rlm_ldap_t const *inst, REQUEST *request,
+				   ldap_handle_t **pconn,
+				   char const *dn, int scope, char const *filter, char const * const *attrs,
+				   LDAPControl **serverctrls, LDAPControl **clientctrls)
+{
+	memset(search, 0, sizeof(*search));
+	search->dn = dn;
+	search->scope = scope;
+	search->filter = filter;
+	search->attrs = attrs;
+	search->serverctrls = serverctrls;
+	search->clientctrls = clientctrls;
+	search->msgid = -1;
+
+	if (filter) {
+		LDAP_DBG_REQ("Performing search in \"%s\" with filter \"%s\", scope \"%s\"", dn, filter,
+			     fr_int2str(ldap_scope, scope, "<INVALID>"));
+	} else {
+		LDAP_DBG_REQ("Performing unfiltered search in \"%s\", scope \"%s\"", dn,
+			     fr_int2str(ldap_scope, scope, "<INVALID>"));
+	}
+
+	if (!inst->mux) return LDAP_PROC_SUCCESS;
+
+	return rlm_ldap_search_send(inst, request, pconn, search);
+}
+
+/** Retrieve the result of a search started with #rlm_ldap_search_async
+ *
+ * Waits for the result, dealing with any errors, and re-sending the search if the
+ * connection it was sent on failed.
+ *
+ * @param[out] result Where to store the result. Must be freed with ldap_msgfree if LDAP_PROC_SUCCESS is returned.
+ *	May be NULL in which case result will be automatically freed after use.
+ * @param[in] inst rlm_ldap configuration.
+ * @param[in] request Current request.
+ * @param[in,out] pconn to use. May change as this function calls functions which auto re-connect.
+ * @param[in] search to retrieve the result of.
+ * @return One of the LDAP_PROC_* (#ldap_rcode_t) values.
+ */
+ldap_rcode_t rlm_ldap_search_result(LDAPMessage **result, rlm_ldap_t const *inst, REQUEST *request,
+				    ldap_handle_t **pconn, ldap_search_t *search)
+{
+	ldap_rcode_t	status = LDAP_PROC_ERROR;
+	LDAPMessage	*our_result = NULL;
+
+	int		count = 0;	// Number of results we got.
+
+	char const 	*error = NULL;
+	char		*extra = NULL;
+
+	int 		i;
+
+	rad_assert(*pconn && (*pconn)->handle);
+
 	/*
 	 *	For sanity, for when no connections are viable,
 	 *	and we can't make a new one.
 	 */
 	for (i = fr_connection_pool_get_num(inst->pool); i >= 0; i--) {
-		(void) ldap_search_ext((*pconn)->handle, dn, scope, filter, search_attrs,
-				       0, serverctrls, clientctrls, &tv, 0, &msgid);
+		if (!search->sent) {
+			status = rlm_ldap_search_send(inst, request, pconn, search);
+			if (status != LDAP_PROC_SUCCESS) goto finish;
+		}
 
 		LDAP_DBG_REQ("Waiting for search result...");
-		status = rlm_ldap_result(inst, *pconn, msgid, dn, &our_result, &error, &extra);
+		if (inst->mux) {
+			status = rlm_ldap_mux_result(inst, search, &our_result, &error, &extra);
+		} else {
+			status = rlm_ldap_result(inst, *pconn, search->msgid, search->dn, &our_result, &error, &extra);
+		}
 		switch (status) {
 		case LDAP_PROC_SUCCESS:
 			break;
@@ -899,13 +1006,25 @@ ldap_rcode_t rlm_ldap_search(LDAPMessage **result, rlm_ldap_t const *inst, REQUE
 			break;
 
 		case LDAP_PROC_RETRY:
-			*pconn = fr_connection_reconnect(inst->pool, *pconn);
-			if (*pconn) {
-				LDAP_DBGW_REQ("Search failed: %s. Got new socket, retrying...", error);
+			if (inst->mux) {
+				if (rlm_ldap_mux_reconnect(inst, search) == 0) {
+					LDAP_DBGW_REQ("Search failed: %s. Got new shared socket, retrying...", error);
 
-				talloc_free(extra); /* don't leak debug info */
+					talloc_free(extra); /* don't leak debug info */
+					search->sent = false;
 
-				continue;
+					continue;
+				}
+			} else {
+				*pconn = fr_connection_reconnect(inst->pool, *pconn);
+				if (*pconn) {
+					LDAP_DBGW_REQ("Search failed: %s. Got new socket, retrying...", error);
+
+					talloc_free(extra); /* don't leak debug info */
+					search->sent = false;
+
+					continue;
+				}
 			}
 
 			status = LDAP_PROC_ERROR;
@@ -960,6 +1079,54 @@ finish:
 	return status;
 }
 
+/** Abandon a search started with #rlm_ldap_search_async
+ *
+ * Must be called for any search whose result won't be collected, so that the
+ * reader of the shared connection no longer references it.
+ *
+ * @param[in] inst rlm_ldap configuration.
+ * @param[in] search to abandon.
+ */
+void rlm_ldap_search_abandon(rlm_ldap_t const *inst, ldap_search_t *search)
+{
+	if (!inst->mux || !search->sent) return;
+
+	rlm_ldap_mux_abandon(inst, search);
+	search->sent = false;
+}
+
+/** Search for something in the LDAP directory
+ *
+ * Binds as the administrative user and performs a search, dealing with any errors.
+ *
+ * @param[out] result Where to store the result. Must be freed with ldap_msgfree if LDAP_PROC_SUCCESS is returned.
+ *	May be NULL in which case result will be automatically freed after use.
+ * @param[in] inst rlm_ldap configuration.
+ * @param[in] request Current request.
+ * @param[in,out] pconn to use. May change as this function calls functions which auto re-connect.
+ * @param[in] dn to use as base for the search.
+ * @param[in] scope to use (LDAP_SCOPE_BASE, LDAP_SCOPE_ONE, LDAP_SCOPE_SUB).
+ * @param[in] filter to use, should be pre-escaped.
+ * @param[in] attrs to retrieve.
+ * @param[in] serverctrls Search controls to pass to the server.  May be NULL.
+ * @param[in] clientctrls Search controls for ldap_search.  May be NULL.
+ * @return One of the LDAP_PROC_* (#ldap_rcode_t) values.
+ */
+ldap_rcode_t rlm_ldap_search(LDAPMessage **result, rlm_ldap_t const *inst, REQUEST *request,
+			     ldap_handle_t **pconn,
+			     char const *dn, int scope, char const *filter, char const * const *attrs,
+			     LDAPControl **serverctrls, LDAPControl **clientctrls)
+{
+	ldap_rcode_t	status;
+	ldap_search_t	search;
+
+	status = rlm_ldap_search_async(&search, inst, request, pconn, dn, scope, filter, attrs,
+				       serverctrls, clientctrls);
+	if (status != LDAP_PROC_SUCCESS) return status;
+
+	return rlm_ldap_search_result(result, inst, request, pconn, &search);
+}
+
 /** Modify something in the LDAP directory
  *
  * Binds as the administrative user and attempts to modify an LDAP object.
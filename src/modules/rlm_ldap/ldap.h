@@ -109,6 +109,10 @@ typedef struct ldap_sasl_dynamic {
 	vp_tmpl_t	*realm;				//!< Kerberos realm.
 } ldap_sasl_dynamic;
 
+typedef struct ldap_mux ldap_mux_t;
+typedef struct ldap_mux_conn ldap_mux_conn_t;
+typedef struct ldap_group_cache ldap_group_cache_t;
+
 typedef struct ldap_instance {
 	CONF_SECTION	*cs;				//!< Main configuration section for this instance.
 	fr_connection_pool_t *pool;			//!< Connection pool instance.
@@ -209,6 +213,12 @@ typedef struct ldap_instance {
 	bool		allow_dangling_group_refs;	//!< Don't error if we fail to resolve a group DN referenced
 							///< from a user object.
 
+	uint32_t	group_cache_ttl;		//!< How long group DN to name mappings are cached for.
+							//!< 0 disables the cache.
+	bool		group_cache_prefetch;		//!< Load all group objects on instantiation.
+	uint32_t	group_cache_refresh;		//!< How often to retrieve modified group objects.
+	ldap_group_cache_t *group_cache;		//!< Group DN to name mappings shared by all requests.
+
 
 	/*
 	 *	Dynamic clients
@@ -274,6 +284,10 @@ typedef struct ldap_instance {
 	uint32_t	srv_timelimit;			//!< How long the server should spent on a single request
 							//!< (also bounded by value on the server).
 
+	uint32_t	mux_connections;		//!< Number of shared connections to multiplex searches
+							//!< over. 0 means searches use pooled connections.
+	ldap_mux_t	*mux;				//!< Shared search connections.
+
 #ifdef WITH_EDIR
 	/*
 	 *	eDir support
@@ -313,6 +327,36 @@ typedef struct ldap_handle {
 	rlm_ldap_t	*inst;				//!< rlm_ldap configuration.
 } ldap_handle_t;
 
+/** A search which may be in progress
+ *
+ * Initialised by rlm_ldap_search_async() and completed by rlm_ldap_search_result().
+ *
+ * When searches are multiplexed the search is sent immediately, so a caller can have several
+ * outstanding at once. Otherwise it's sent when the caller asks for the result, as a pooled
+ * connection only carries one search at a time.
+ */
+typedef struct ldap_search {
+	char const	*dn;				//!< Base DN to search in.
+	int		scope;				//!< Search scope.
+	char const	*filter;			//!< Search filter, may be NULL.
+	char const * const *attrs;			//!< Attributes to retrieve.
+	LDAPControl	**serverctrls;			//!< Server controls.
+	LDAPControl	**clientctrls;			//!< Client controls.
+
+	bool		sent;				//!< Whether the search has been sent.
+	int		msgid;				//!< ID results will be matched by.
+
+	/*
+	 *	Only used when the search is multiplexed.
+	 */
+	ldap_mux_conn_t	*mux_conn;			//!< Shared connection the search was sent on.
+	uint64_t	generation;			//!< Which incarnation of the shared connection.
+	LDAPMessage	*result;			//!< Result chain, written by the reader.
+	int		lib_errno;			//!< Error sending the search or retrieving the result.
+	bool		done;				//!< Whether the result (or an error) has arrived.
+	struct ldap_search *next;			//!< Next search waiting on the shared connection.
+} ldap_search_t;
+
 /** Result of expanding the RHS of a set of maps
  *
  * Used to store the array of attributes we'll be querying for.
@@ -407,6 +451,16 @@ ldap_rcode_t rlm_ldap_search(LDAPMessage **result, rlm_ldap_t const *inst, REQUE
 			     char const *dn, int scope, char const *filter, char const * const *attrs,
 			     LDAPControl **serverctrls, LDAPControl **clientctrls);
 
+ldap_rcode_t rlm_ldap_search_async(ldap_search_t *search, rlm_ldap_t const *inst, REQUEST *request,
+				   ldap_handle_t **pconn,
+				   char const *dn, int scope, char const *filter, char const * const *attrs,
+				   LDAPControl **serverctrls, LDAPControl **clientctrls);
+
+ldap_rcode_t rlm_ldap_search_result(LDAPMessage **result, rlm_ldap_t const *inst, REQUEST *request,
+				    ldap_handle_t **pconn, ldap_search_t *search);
+
+void rlm_ldap_search_abandon(rlm_ldap_t const *inst, ldap_search_t *search);
+
 ldap_rcode_t rlm_ldap_modify(rlm_ldap_t const *inst, REQUEST *request, ldap_handle_t **pconn,
 			     char const *dn, LDAPMod *mods[]);
 
@@ -424,6 +478,10 @@ void rlm_ldap_check_reply(rlm_ldap_t const *inst, REQUEST *request);
 ldap_rcode_t rlm_ldap_result(rlm_ldap_t const *inst, ldap_handle_t const *conn, int msgid, char const *dn,
 			     LDAPMessage **result, char const **error, char **extra);
 
+ldap_rcode_t rlm_ldap_result_parse(rlm_ldap_t const *inst, ldap_handle_t const *conn, int lib_errno,
+				   char const *dn, LDAPMessage **result, bool freeit,
+				   char const **error, char **extra);
+
 char *rlm_ldap_berval_to_string(TALLOC_CTX *ctx, struct berval const *in);
 
 int rlm_ldap_global_init(rlm_ldap_t *inst) CC_HINT(nonnull);
@@ -450,6 +508,19 @@ rlm_rcode_t rlm_ldap_check_userobj_dynamic(rlm_ldap_t const *inst, REQUEST *requ
 
 rlm_rcode_t rlm_ldap_check_cached(rlm_ldap_t const *inst, REQUEST *request, VALUE_PAIR *check);
 
+/*
+ *	group_cache.c - Group DN to name mappings.
+ */
+int rlm_ldap_group_cache_init(rlm_ldap_t *inst);
+
+void rlm_ldap_group_cache_refresh(rlm_ldap_t const *inst, REQUEST *request, ldap_handle_t **pconn);
+
+char *rlm_ldap_group_cache_dn2name(TALLOC_CTX *ctx, rlm_ldap_t const *inst, char const *dn);
+
+char *rlm_ldap_group_cache_name2dn(TALLOC_CTX *ctx, rlm_ldap_t const *inst, char const *name);
+
+void rlm_ldap_group_cache_add(rlm_ldap_t const *inst, char const *dn, char const *name);
+
 /*
  *	attrmap.c - Attribute mapping code.
  */
@@ -474,6 +545,20 @@ int nmasldap_get_password(LDAP *ld, char const *dn, char *password, size_t *len)
 
 char const *edir_errstr(int code);
 
+/*
+ *	mux.c - Searches multiplexed over shared connections
+ */
+int rlm_ldap_mux_init(rlm_ldap_t *inst);
+
+void rlm_ldap_mux_send(rlm_ldap_t const *inst, REQUEST *request, ldap_search_t *search);
+
+ldap_rcode_t rlm_ldap_mux_result(rlm_ldap_t const *inst, ldap_search_t *search, LDAPMessage **result,
+				 char const **error, char **extra);
+
+int rlm_ldap_mux_reconnect(rlm_ldap_t const *inst, ldap_search_t *search);
+
+void rlm_ldap_mux_abandon(rlm_ldap_t const *inst, ldap_search_t *search);
+
 /*
  *	sasl.s - SASL bind functions
  */
@@ -0,0 +1,520 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file mux.c
+ * @brief Multiplex searches from many requests over a few shared LDAP connections.
+ *
+ * Searches are written to a shared connection as soon as they're started, and
+ * results are matched back to the search that requested them by msgid, so any
+ * number of searches may be outstanding on a connection at once.
+ *
+ * libldap handles aren't safe for concurrent use, so every libldap call on a
+ * shared handle is made with the connection's mutex held.  The mutex is only
+ * released whilst waiting for the socket to become readable.
+ *
+ * There's no dedicated reader thread.  The first worker to find nobody reading
+ * a connection becomes the reader.  It retrieves all the results which are
+ * available, hands each one to the search it belongs to, and wakes the other
+ * workers.  Once its own result has arrived it stops reading, and one of the
+ * workers still waiting takes over.
+ *
+ * @copyright 2015 The FreeRADIUS Server Project.
+ */
+#include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/rad_assert.h>
+
+#include "ldap.h"
+
+#include <poll.h>
+
+#ifdef HAVE_PTHREAD_H
+#  define PTHREAD_MUTEX_LOCK pthread_mutex_lock
+#  define PTHREAD_MUTEX_UNLOCK pthread_mutex_unlock
+#else
+#  define PTHREAD_MUTEX_LOCK(_x)
+#  define PTHREAD_MUTEX_UNLOCK(_x)
+#endif
+
+/*
+ *	Upper bound on how long the reader waits for the socket before checking
+ *	libldap for results.  libldap may have results buffered internally, or
+ *	on connections it opened itself whilst chasing referrals, neither of
+ *	which would wake poll().
+ */
+#define LDAP_MUX_READ_INTERVAL	100	//!< In milliseconds.
+
+struct ldap_mux_conn {
+	ldap_mux_t		*mux;		//!< Multiplexer this connection belongs to.
+	unsigned int		id;		//!< Connection number, used in log messages.
+
+	ldap_handle_t		*conn;		//!< Shared libldap handle, bound as the admin user.
+	int			fd;		//!< Socket the reader waits on.
+	uint64_t		generation;	//!< Incremented every time the handle is replaced.
+
+	bool			reading;	//!< Whether a worker is currently waiting on the socket.
+	ldap_search_t		*pending;	//!< Searches waiting for results.
+
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_t		mutex;		//!< Protects the handle and the pending list.
+	pthread_cond_t		cond;		//!< Signalled when results have been dispatched.
+#endif
+};
+
+struct ldap_mux {
+	rlm_ldap_t		*inst;		//!< rlm_ldap configuration.
+	ldap_mux_conn_t		*conns;		//!< Array of shared connections.
+	uint32_t		num;		//!< Number of shared connections.
+};
+
+/** (Re)connect a shared connection
+ *
+ * The old handle is only replaced if a new one could be established, so the
+ * shared connection always has a handle, even if it's a broken one.
+ *
+ * @note Must be called with the connection's mutex held.
+ *
+ * @param mc to connect.
+ * @return 0 on success, -1 on failure.
+ */
+static int mux_conn_connect(ldap_mux_conn_t *mc)
+{
+	rlm_ldap_t	*inst = mc->mux->inst;
+	ldap_handle_t	*conn;
+	int		fd = -1;
+
+	conn = mod_conn_create(mc->mux, inst);
+	if (!conn) {
+		LDAP_ERR("Failed connecting shared connection %u", mc->id);
+		return -1;
+	}
+
+	if ((ldap_get_option(conn->handle, LDAP_OPT_DESC, &fd) != LDAP_OPT_SUCCESS) || (fd < 0)) {
+		LDAP_ERR("Failed retrieving socket for shared connection %u", mc->id);
+		talloc_free(conn);
+		return -1;
+	}
+
+	talloc_free(mc->conn);
+	mc->conn = conn;
+	mc->fd = fd;
+	mc->generation++;
+
+	LDAP_DBG2("Shared connection %u established", mc->id);
+
+	return 0;
+}
+
+/** Complete every search waiting on a shared connection with an error
+ *
+ * @note Must be called with the connection's mutex held.
+ *
+ * @param mc the searches were sent on.
+ * @param lib_errno to complete the searches with.
+ */
+static void mux_conn_fail(ldap_mux_conn_t *mc, int lib_errno)
+{
+	ldap_search_t *search, *next;
+
+	for (search = mc->pending; search; search = next) {
+		next = search->next;
+
+		search->lib_errno = lib_errno;
+		search->done = true;
+		search->next = NULL;
+	}
+	mc->pending = NULL;
+}
+
+/** Hand a result to the search which is waiting for it
+ *
+ * @note Must be called with the connection's mutex held.
+ *
+ * @param mc the result was read from.
+ * @param msg to dispatch.
+ */
+static void mux_conn_dispatch(ldap_mux_conn_t *mc, LDAPMessage *msg)
+{
+	ldap_search_t	**last, *search;
+	int		msgid = ldap_msgid(msg);
+
+	for (last = &mc->pending; *last; last = &(*last)->next) {
+		search = *last;
+		if (search->msgid != msgid) continue;
+
+		*last = search->next;
+		search->next = NULL;
+		search->result = msg;
+		search->lib_errno = LDAP_SUCCESS;
+		search->done = true;
+
+		return;
+	}
+
+	/*
+	 *	Result for a search which was abandoned.
+	 */
+	ldap_msgfree(msg);
+}
+
+/** Remove a search from the list of pending searches
+ *
+ * @note Must be called with the connection's mutex held.
+ *
+ * @param mc the search was sent on.
+ * @param search to remove.
+ * @return true if the search was pending, else false.
+ */
+static bool mux_conn_unlink(ldap_mux_conn_t *mc, ldap_search_t *search)
+{
+	ldap_search_t **last;
+
+	for (last = &mc->pending; *last; last = &(*last)->next) {
+		if (*last != search) continue;
+
+		*last = search->next;
+		search->next = NULL;
+
+		return true;
+	}
+
+	return false;
+}
+
+/** Wait for the socket to become readable, then dispatch any results
+ *
+ * @note Must be called with the connection's mutex held, which will be
+ *	released whilst waiting.
+ *
+ * @param mc to read from.
+ * @param deadline for the search being processed by the caller.
+ */
+static void mux_conn_read(ldap_mux_conn_t *mc, struct timeval const *deadline)
+{
+	struct timeval	now, tv;
+	struct pollfd	pfd;
+	uint64_t	generation = mc->generation;
+	int		timeout, ret;
+	LDAPMessage	*msg;
+
+	mc->reading = true;
+
+	gettimeofday(&now, NULL);
+	timeout = ((deadline->tv_sec - now.tv_sec) * 1000) + ((deadline->tv_usec - now.tv_usec) / 1000);
+	if (timeout > LDAP_MUX_READ_INTERVAL) timeout = LDAP_MUX_READ_INTERVAL;
+	if (timeout < 0) timeout = 0;
+
+	/*
+	 *	Not select(), as the descriptor may be larger than
+	 *	FD_SETSIZE in a busy server.
+	 */
+	pfd.fd = mc->fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+
+	PTHREAD_MUTEX_UNLOCK(&mc->mutex);
+	ret = poll(&pfd, 1, timeout);
+	PTHREAD_MUTEX_LOCK(&mc->mutex);
+
+	mc->reading = false;
+
+	/*
+	 *	Someone replaced the handle whilst we were waiting.
+	 */
+	if (mc->generation != generation) goto finish;
+
+	if ((ret < 0) && (errno != EINTR)) {
+		mux_conn_fail(mc, LDAP_SERVER_DOWN);
+		goto finish;
+	}
+
+	/*
+	 *	Retrieve all the complete results libldap has available,
+	 *	not just the ones which caused the socket to be readable.
+	 */
+	while (mc->pending) {
+		memset(&tv, 0, sizeof(tv));
+
+		ret = ldap_result(mc->conn->handle, LDAP_RES_ANY, LDAP_MSG_ALL, &tv, &msg);
+		if (ret == 0) break;
+
+		if (ret < 0) {
+			int lib_errno = LDAP_SUCCESS;
+
+			ldap_get_option(mc->conn->handle, LDAP_OPT_ERROR_NUMBER, &lib_errno);
+			mux_conn_fail(mc, (lib_errno != LDAP_SUCCESS) ? lib_errno : LDAP_SERVER_DOWN);
+			break;
+		}
+
+		mux_conn_dispatch(mc, msg);
+	}
+
+finish:
+#ifdef HAVE_PTHREAD_H
+	pthread_cond_broadcast(&mc->cond);
+#endif
+	return;
+}
+
+/** Send a search on one of the shared connections
+ *
+ * Errors are recorded in the search, and reported when the result is retrieved.
+ *
+ * @param inst rlm_ldap configuration.
+ * @param request Current request, used to pick a connection. May be NULL.
+ * @param search to send.
+ */
+void rlm_ldap_mux_send(rlm_ldap_t const *inst, REQUEST *request, ldap_search_t *search)
+{
+	ldap_mux_conn_t	*mc;
+	struct timeval	tv;
+	char		**search_attrs;
+	int		ret;
+
+	rad_assert(inst->mux);
+
+	mc = &inst->mux->conns[request ? (request->number % inst->mux->num) : 0];
+
+	search->mux_conn = mc;
+	search->msgid = -1;
+	search->result = NULL;
+	search->lib_errno = LDAP_SUCCESS;
+	search->done = false;
+	search->next = NULL;
+
+	/*
+	 *	OpenLDAP library doesn't declare attrs array as const, but
+	 *	it really should be *sigh*.
+	 */
+	memcpy(&search_attrs, &search->attrs, sizeof(search_attrs));
+
+	memset(&tv, 0, sizeof(tv));
+	tv.tv_sec = inst->res_timeout;
+
+	PTHREAD_MUTEX_LOCK(&mc->mutex);
+	search->generation = mc->generation;
+
+	ret = ldap_search_ext(mc->conn->handle, search->dn, search->scope, search->filter, search_attrs,
+			      0, search->serverctrls, search->clientctrls, &tv, 0, &search->msgid);
+	if (ret != LDAP_SUCCESS) {
+		search->lib_errno = ret;
+		search->done = true;
+	} else {
+		search->next = mc->pending;
+		mc->pending = search;
+	}
+	PTHREAD_MUTEX_UNLOCK(&mc->mutex);
+}
+
+/** Wait for the result of a multiplexed search
+ *
+ * @param[in] inst rlm_ldap configuration.
+ * @param[in] search to retrieve the result for.
+ * @param[out] result Where to write the result.
+ * @param[out] error Where to write the error string, may be NULL, must not be freed.
+ * @param[out] extra Where to write additional error string to, may be NULL (faster) or must be freed
+ *	(with talloc_free).
+ * @return One of the LDAP_PROC_* (#ldap_rcode_t) values.
+ */
+ldap_rcode_t rlm_ldap_mux_result(rlm_ldap_t const *inst, ldap_search_t *search, LDAPMessage **result,
+				 char const **error, char **extra)
+{
+	ldap_mux_conn_t	*mc = search->mux_conn;
+	ldap_rcode_t	status;
+	struct timeval	deadline, now;
+#ifdef HAVE_PTHREAD_H
+	struct timespec	ts;
+#endif
+
+	*result = NULL;
+
+	gettimeofday(&deadline, NULL);
+	deadline.tv_sec += inst->res_timeout;
+
+#ifdef HAVE_PTHREAD_H
+	ts.tv_sec = deadline.tv_sec;
+	ts.tv_nsec = deadline.tv_usec * 1000;
+#endif
+
+	PTHREAD_MUTEX_LOCK(&mc->mutex);
+	while (!search->done) {
+		if (!mc->reading) {
+			mux_conn_read(mc, &deadline);
+		}
+#ifdef HAVE_PTHREAD_H
+		else {
+			pthread_cond_timedwait(&mc->cond, &mc->mutex, &ts);
+		}
+#endif
+		if (search->done) break;
+
+		gettimeofday(&now, NULL);
+		if (timercmp(&now, &deadline, <)) continue;
+
+		/*
+		 *	Tell the server we're no longer interested.
+		 */
+		if (mux_conn_unlink(mc, search) && (search->generation == mc->generation)) {
+			ldap_abandon_ext(mc->conn->handle, search->msgid, NULL, NULL);
+		}
+		search->lib_errno = LDAP_TIMEOUT;
+		search->done = true;
+	}
+
+	*result = search->result;
+	search->result = NULL;
+
+	status = rlm_ldap_result_parse(inst, mc->conn, search->lib_errno, search->dn, result, false, error, extra);
+
+	/*
+	 *	Extended error messages are allocated in the context of the
+	 *	shared handle, which may be freed by another thread.
+	 */
+	if (extra && *extra) talloc_steal(NULL, *extra);
+	PTHREAD_MUTEX_UNLOCK(&mc->mutex);
+
+	return status;
+}
+
+/** Replace the shared connection a search failed on
+ *
+ * If another thread has already replaced the connection since the search was sent,
+ * the new connection is used as is.
+ *
+ * @param inst rlm_ldap configuration.
+ * @param search which failed.
+ * @return 0 if the search can be re-sent, -1 if the connection couldn't be replaced.
+ */
+int rlm_ldap_mux_reconnect(rlm_ldap_t const *inst, ldap_search_t *search)
+{
+	ldap_mux_conn_t	*mc = search->mux_conn;
+	int		ret = 0;
+
+	rad_assert(inst->mux);
+
+	PTHREAD_MUTEX_LOCK(&mc->mutex);
+	if (search->generation == mc->generation) {
+		/*
+		 *	Anything else sent on the old handle will
+		 *	never get a result. Get the senders to retry.
+		 */
+		mux_conn_fail(mc, LDAP_SERVER_DOWN);
+
+		ret = mux_conn_connect(mc);
+#ifdef HAVE_PTHREAD_H
+		pthread_cond_broadcast(&mc->cond);
+#endif
+	}
+	PTHREAD_MUTEX_UNLOCK(&mc->mutex);
+
+	return ret;
+}
+
+/** Abandon a multiplexed search
+ *
+ * @param inst rlm_ldap configuration.
+ * @param search to abandon.
+ */
+void rlm_ldap_mux_abandon(rlm_ldap_t const *inst, ldap_search_t *search)
+{
+	ldap_mux_conn_t *mc = search->mux_conn;
+
+	rad_assert(inst->mux);
+
+	PTHREAD_MUTEX_LOCK(&mc->mutex);
+	if (mux_conn_unlink(mc, search) && (search->generation == mc->generation)) {
+		ldap_abandon_ext(mc->conn->handle, search->msgid, NULL, NULL);
+	}
+
+	if (search->result) {
+		ldap_msgfree(search->result);
+		search->result = NULL;
+	}
+	search->done = true;
+	PTHREAD_MUTEX_UNLOCK(&mc->mutex);
+}
+
+/** Free the shared connections
+ *
+ * @param mux to free.
+ * @return 0
+ */
+static int _mod_mux_free(ldap_mux_t *mux)
+{
+	uint32_t i;
+
+	for (i = 0; i < mux->num; i++) {
+		ldap_mux_conn_t *mc = &mux->conns[i];
+
+		rad_assert(!mc->pending);
+
+		TALLOC_FREE(mc->conn);
+#ifdef HAVE_PTHREAD_H
+		pthread_mutex_destroy(&mc->mutex);
+		pthread_cond_destroy(&mc->cond);
+#endif
+	}
+
+	return 0;
+}
+
+/** Establish the shared connections searches are multiplexed over
+ *
+ * @param inst rlm_ldap configuration.
+ * @return 0 on success (or if multiplexing is disabled), -1 on failure.
+ */
+int rlm_ldap_mux_init(rlm_ldap_t *inst)
+{
+	ldap_mux_t	*mux;
+	uint32_t	i;
+
+	if (!inst->mux_connections) return 0;
+
+	mux = talloc_zero(inst, ldap_mux_t);
+	if (!mux) return -1;
+
+	mux->inst = inst;
+	mux->conns = talloc_zero_array(mux, ldap_mux_conn_t, inst->mux_connections);
+	if (!mux->conns) {
+	error:
+		talloc_free(mux);
+		return -1;
+	}
+	talloc_set_destructor(mux, _mod_mux_free);
+
+	for (i = 0; i < inst->mux_connections; i++) {
+		ldap_mux_conn_t *mc = &mux->conns[i];
+
+		mc->mux = mux;
+		mc->id = i;
+		mc->fd = -1;
+
+#ifdef HAVE_PTHREAD_H
+		pthread_mutex_init(&mc->mutex, NULL);
+		pthread_cond_init(&mc->cond, NULL);
+#endif
+		mux->num++;
+
+		if (mux_conn_connect(mc) < 0) goto error;
+	}
+
+	LDAP_INFO("Multiplexing searches over %u shared connection(s)", mux->num);
+
+	inst->mux = mux;
+
+	return 0;
+}
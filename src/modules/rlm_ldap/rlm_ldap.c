@@ -139,6 +139,16 @@ static CONF_PARSER user_config[] = {
 	CONF_PARSER_TERMINATOR
 };
 
+/*
+ *	Group name cache configuration
+ */
+static CONF_PARSER group_name_cache_config[] = {
+	{ "ttl", FR_CONF_OFFSET(PW_TYPE_INTEGER, rlm_ldap_t, group_cache_ttl), "0" },
+	{ "prefetch", FR_CONF_OFFSET(PW_TYPE_BOOLEAN, rlm_ldap_t, group_cache_prefetch), "no" },
+	{ "refresh", FR_CONF_OFFSET(PW_TYPE_INTEGER, rlm_ldap_t, group_cache_refresh), "60" },
+	CONF_PARSER_TERMINATOR
+};
+
 /*
  *	Group configuration
  */
@@ -154,6 +164,8 @@ static CONF_PARSER group_config[] = {
 	{ "cacheable_dn", FR_CONF_OFFSET(PW_TYPE_BOOLEAN, rlm_ldap_t, cacheable_group_dn), "no" },
 	{ "cache_attribute", FR_CONF_OFFSET(PW_TYPE_STRING, rlm_ldap_t, cache_attribute), NULL },
 	{ "allow_dangling_group_ref", FR_CONF_OFFSET(PW_TYPE_BOOLEAN, rlm_ldap_t, allow_dangling_group_refs), "no" },
+
+	{ "name_cache", FR_CONF_POINTER(PW_TYPE_SUBSECTION, NULL), (void const *) group_name_cache_config },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -202,6 +214,9 @@ static CONF_PARSER option_config[] = {
 	/* allow server unlimited time for search (server-side limit) */
 	{ "srv_timelimit", FR_CONF_OFFSET(PW_TYPE_INTEGER, rlm_ldap_t, srv_timelimit), "20" },
 
+	/* shared connections to multiplex searches over */
+	{ "multiplex", FR_CONF_OFFSET(PW_TYPE_INTEGER, rlm_ldap_t, mux_connections), "0" },
+
 #ifdef LDAP_OPT_X_KEEPALIVE_IDLE
 	{ "idle", FR_CONF_OFFSET(PW_TYPE_INTEGER, rlm_ldap_t, keepalive_idle), "60" },
 #endif
@@ -488,6 +503,7 @@ static int mod_detach(void *instance)
 {
 	rlm_ldap_t *inst = instance;
 
+	TALLOC_FREE(inst->mux);
 	fr_connection_pool_free(inst->pool);
 
 	if (inst->user_map) {
@@ -1209,6 +1225,19 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 	inst->pool = fr_connection_pool_module_init(inst->cs, inst, mod_conn_create, NULL, NULL);
 	if (!inst->pool) goto error;
 
+	/*
+	 *	Initialize the shared search connections.
+	 */
+	FR_INTEGER_BOUND_CHECK("multiplex", inst->mux_connections, <=, 64);
+	if (rlm_ldap_mux_init(inst) < 0) goto error;
+
+	/*
+	 *	Initialize the group name cache, loading all the
+	 *	groups if we were told to.
+	 */
+	FR_INTEGER_BOUND_CHECK("name_cache.refresh", inst->group_cache_refresh, >=, 1);
+	if (rlm_ldap_group_cache_init(inst) < 0) goto error;
+
 	/*
 	 *	Bulk load dynamic clients.
 	 */
@@ -1935,6 +1964,7 @@ extern module_t rlm_ldap;
 module_t rlm_ldap = {
 	.magic		= RLM_MODULE_INIT,
 	.name		= "ldap",
+	.type		= RLM_TYPE_PARALLEL_START,
 	.inst_size	= sizeof(rlm_ldap_t),
 	.config		= module_config,
 	.bootstrap	= mod_bootstrap,
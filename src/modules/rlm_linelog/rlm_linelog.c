@@ -67,6 +67,10 @@ typedef struct rlm_linelog_t {
 	char const	*group;
 	char const	*line;
 	char const	*reference;
+
+	uint32_t	buffer_size;		//!< Size of the append buffer for each file.
+	uint32_t	flush_interval;		//!< Maximum time lines are buffered for.
+	bool		sync;			//!< fsync() files after writing the buffer.
 	exfile_t	*ef;
 } rlm_linelog_t;
 
@@ -88,6 +92,9 @@ static const CONF_PARSER module_config[] = {
 	{ "group", FR_CONF_OFFSET(PW_TYPE_STRING, rlm_linelog_t, group), NULL },
 	{ "format", FR_CONF_OFFSET(PW_TYPE_STRING | PW_TYPE_XLAT, rlm_linelog_t, line), NULL },
 	{ "reference", FR_CONF_OFFSET(PW_TYPE_STRING | PW_TYPE_XLAT, rlm_linelog_t, reference), NULL },
+	{ "buffer_size", FR_CONF_OFFSET(PW_TYPE_INTEGER, rlm_linelog_t, buffer_size), "0" },
+	{ "flush_interval", FR_CONF_OFFSET(PW_TYPE_INTEGER, rlm_linelog_t, flush_interval), "1" },
+	{ "sync", FR_CONF_OFFSET(PW_TYPE_BOOLEAN, rlm_linelog_t, sync), "no" },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -156,6 +163,17 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 		return -1;
 	}
 
+	if (inst->buffer_size) {
+		FR_INTEGER_BOUND_CHECK("buffer_size", inst->buffer_size, >=, 4096);
+		FR_INTEGER_BOUND_CHECK("buffer_size", inst->buffer_size, <=, 16 * 1024 * 1024);
+		FR_INTEGER_BOUND_CHECK("flush_interval", inst->flush_interval, <=, 60);
+
+		if (exfile_enable_buffer(inst->ef, inst->buffer_size, inst->flush_interval, inst->sync) < 0) {
+			cf_log_err_cs(conf, "Failed enabling buffering: %s", fr_strerror());
+			return -1;
+		}
+	}
+
 	inst->cs = conf;
 	return 0;
 }
@@ -277,13 +295,17 @@ static rlm_rcode_t CC_HINT(nonnull) mod_do_linelog(void *instance, REQUEST *requ
  skip_group:
 	strcat(line, "\n");
 
-	if (write(fd, line, strlen(line)) < 0) {
+	if (exfile_write(inst->ef, fd, line, strlen(line)) < 0) {
 		exfile_close(inst->ef, fd);
-		ERROR("rlm_linelog: Failed writing: %s", fr_syserror(errno));
+		ERROR("rlm_linelog: Failed writing: %s", fr_strerror());
+		return RLM_MODULE_FAIL;
+	}
+
+	if (exfile_close(inst->ef, fd) < 0) {
+		ERROR("rlm_linelog: %s", fr_strerror());
 		return RLM_MODULE_FAIL;
 	}
 
-	exfile_close(inst->ef, fd);
 	return RLM_MODULE_OK;
 }
 
@@ -0,0 +1,400 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file auth_helper.c
+ * @brief NTLM authentication using long running ntlm_auth helpers
+ *
+ * Instead of running ntlm_auth for every request, a pool of
+ * "ntlm_auth --helper-protocol=ntlm-server-1" processes is kept running.
+ * Each request is written to the stdin of a helper as "key: value"
+ * lines, ending with a line containing ".", and the reply is read back
+ * from its stdout in the same format.
+ *
+ * Helpers which exit, time out, or send something we don't understand are
+ * closed, and the connection pool starts new ones.
+ *
+ * @copyright 2015 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/rad_assert.h>
+#include <freeradius-devel/base64.h>
+
+#include "rlm_mschap.h"
+#include "mschap.h"
+#include "auth_helper.h"
+
+#include <sys/uio.h>
+
+#define NT_LENGTH 24
+
+typedef struct mschap_helper {
+	pid_t		pid;			//!< Of the helper.
+	int		to_child;		//!< The helper's stdin.
+	int		from_child;		//!< The helper's stdout.
+} mschap_helper_t;
+
+/*
+ *	Stop the helper.  Closing stdin should be enough, but it
+ *	may be stuck, so it's killed too.
+ */
+static int _mschap_helper_free(mschap_helper_t *helper)
+{
+	int status;
+
+	if (helper->to_child >= 0) close(helper->to_child);
+	if (helper->from_child >= 0) close(helper->from_child);
+
+	if (helper->pid > 0) {
+		kill(helper->pid, SIGTERM);
+		rad_waitpid(helper->pid, &status);
+	}
+
+	return 0;
+}
+
+/*
+ *	Start a helper for the connection pool
+ */
+void *mschap_helper_create(TALLOC_CTX *ctx, void *instance)
+{
+	rlm_mschap_t	*inst = instance;
+	mschap_helper_t	*helper;
+
+	helper = talloc_zero(ctx, mschap_helper_t);
+	helper->to_child = -1;
+	helper->from_child = -1;
+	talloc_set_destructor(helper, _mschap_helper_free);
+
+	helper->pid = radius_start_program(inst->ntlm_auth_helper, NULL, true,
+					   &helper->to_child, &helper->from_child, NULL, false);
+	if (helper->pid < 0) {
+		ERROR("rlm_mschap (%s): Failed starting ntlm_auth helper", inst->xlat_name);
+		talloc_free(helper);
+		return NULL;
+	}
+
+	if ((fr_nonblock(helper->to_child) < 0) || (fr_nonblock(helper->from_child) < 0)) {
+		ERROR("rlm_mschap (%s): Failed setting ntlm_auth helper pipes non-blocking: %s",
+		      inst->xlat_name, fr_syserror(errno));
+		talloc_free(helper);
+		return NULL;
+	}
+
+	DEBUG2("rlm_mschap (%s): Started ntlm_auth helper PID %u", inst->xlat_name, (unsigned int) helper->pid);
+
+	return helper;
+}
+
+/*
+ *	Add a "key: value" line to the request.  Values which aren't
+ *	printable ASCII are sent as "key:: base64", as ntlm_auth expects.
+ */
+static char *mschap_helper_line(char *p, char const *end, char const *key, char const *value)
+{
+	char const	*q;
+	size_t		len = strlen(value);
+	bool		encode = false;
+
+	for (q = value; *q; q++) {
+		if ((*q < 0x20) || (*q > 0x7e)) {
+			encode = true;
+			break;
+		}
+	}
+	if ((value[0] == ' ') || (value[0] == ':')) encode = true;
+
+	if (encode) {
+		if ((p + strlen(key) + 4 + FR_BASE64_ENC_LENGTH(len) + 1) >= end) return NULL;
+
+		p += sprintf(p, "%s:: ", key);
+		p += fr_base64_encode(p, end - p, (uint8_t const *) value, len);
+	} else {
+		if ((p + strlen(key) + 3 + len + 1) >= end) return NULL;
+
+		p += sprintf(p, "%s: %s", key, value);
+	}
+	*p++ = '\n';
+	*p = '\0';
+
+	return p;
+}
+
+/*
+ *	Add a "key: hex" line to the request.
+ */
+static char *mschap_helper_hex(char *p, char const *end, char const *key, uint8_t const *value, size_t len)
+{
+	if ((p + strlen(key) + 3 + (len * 2) + 1) >= end) return NULL;
+
+	p += sprintf(p, "%s: ", key);
+	p += fr_bin2hex(p, value, len);
+	*p++ = '\n';
+	*p = '\0';
+
+	return p;
+}
+
+/** Send a request to the helper
+ *
+ * @return 0 on success, -1 if the helper has gone away.
+ */
+static int mschap_helper_write(rlm_mschap_t const *inst, mschap_helper_t *helper, char const *buffer, size_t len)
+{
+	struct iovec	vector;
+	struct timeval	timeout;
+
+	memcpy(&vector.iov_base, &buffer, sizeof(vector.iov_base));
+	vector.iov_len = len;
+
+	timeout.tv_sec = inst->ntlm_auth_timeout;
+	timeout.tv_usec = 0;
+
+	if (fr_writev(helper->to_child, &vector, 1, &timeout) != (ssize_t) len) return -1;
+
+	return 0;
+}
+
+/** Read the reply to a request, up to the "." line which ends it
+ *
+ * @return the length of the reply, without the "." line, or -1 if the helper
+ *	exited, or took longer than ntlm_auth_timeout.
+ */
+static ssize_t mschap_helper_read(rlm_mschap_t const *inst, mschap_helper_t *helper, char *out, size_t outlen)
+{
+	size_t		done = 0;
+	struct timeval	start, now, wake;
+
+	gettimeofday(&start, NULL);
+
+	while (done < (outlen - 1)) {
+		fd_set	fds;
+		ssize_t	len;
+		int	rcode;
+
+		gettimeofday(&now, NULL);
+		wake.tv_sec = start.tv_sec + inst->ntlm_auth_timeout - now.tv_sec;
+		wake.tv_usec = start.tv_usec - now.tv_usec;
+		if (wake.tv_usec < 0) {
+			wake.tv_usec += 1000000;
+			wake.tv_sec--;
+		}
+		if (wake.tv_sec < 0) {
+			fr_strerror_printf("Timed out after %u seconds", inst->ntlm_auth_timeout);
+			return -1;
+		}
+
+		FD_ZERO(&fds);
+		FD_SET(helper->from_child, &fds);
+
+		rcode = select(helper->from_child + 1, &fds, NULL, NULL, &wake);
+		if (rcode < 0) {
+			if (errno == EINTR) continue;
+
+			fr_strerror_printf("Failed waiting for reply: %s", fr_syserror(errno));
+			return -1;
+		}
+		if (rcode == 0) continue;
+
+		len = read(helper->from_child, out + done, outlen - 1 - done);
+		if (len == 0) {
+			fr_strerror_printf("Helper exited");
+			return -1;
+		}
+		if (len < 0) {
+			if ((errno == EINTR) || (errno == EAGAIN)) continue;
+
+			fr_strerror_printf("Failed reading reply: %s", fr_syserror(errno));
+			return -1;
+		}
+		done += len;
+		out[done] = '\0';
+
+		/*
+		 *	The reply ends with a line containing only "."
+		 */
+		if ((done >= 2) && (out[done - 2] == '.') && (out[done - 1] == '\n') &&
+		    ((done == 2) || (out[done - 3] == '\n'))) {
+			done -= 2;
+			out[done] = '\0';
+			return done;
+		}
+	}
+
+	fr_strerror_printf("Reply too long");
+	return -1;
+}
+
+/** Authenticate a user with one of the pool of ntlm_auth helpers
+ *
+ * @param[in] inst Module instance.
+ * @param[in] request Current request.
+ * @param[in] challenge MS-CHAP challenge.
+ * @param[in] response MS-CHAP NT-Response.
+ * @param[out] nthashhash the user session key ntlm_auth returns.
+ * @return 0 on success, -1 if the user was rejected, -2 if ntlm_auth
+ *	couldn't be used, or one of the -6xx MS-CHAP errors.
+ */
+int do_auth_helper(rlm_mschap_t *inst, REQUEST *request,
+		   uint8_t const *challenge, uint8_t const *response,
+		   uint8_t nthashhash[NT_DIGEST_LENGTH])
+{
+	mschap_helper_t	*helper;
+	char		user_name_buf[500];
+	char		domain_name_buf[500];
+	char const	*user_name, *domain_name;
+	char		buffer[2048], reply[1024];
+	char		*p, *end, *line, *next;
+	char const	*error = NULL;
+	ssize_t		len;
+	int		tries;
+	bool		authenticated = false, have_key = false;
+
+	rad_assert(inst->helper_username);
+
+	len = tmpl_expand(&user_name, user_name_buf, sizeof(user_name_buf), request, inst->helper_username, NULL, NULL);
+	if (len < 0) {
+		REDEBUG2("Unable to expand ntlm_auth_helper_username");
+		return -1;
+	}
+
+	/*
+	 *	Build the request
+	 */
+	end = buffer + sizeof(buffer);
+	p = mschap_helper_line(buffer, end, "Username", user_name);
+	if (!p) {
+	too_long:
+		REDEBUG("Request for ntlm_auth helper is too long");
+		return -1;
+	}
+
+	if (inst->helper_domain) {
+		len = tmpl_expand(&domain_name, domain_name_buf, sizeof(domain_name_buf),
+				  request, inst->helper_domain, NULL, NULL);
+		if (len < 0) {
+			REDEBUG2("Unable to expand ntlm_auth_helper_domain");
+			return -1;
+		}
+
+		p = mschap_helper_line(p, end, "NT-Domain", domain_name);
+		if (!p) goto too_long;
+	} else {
+		RWDEBUG2("No domain specified; authentication may fail because of this");
+	}
+
+	p = mschap_helper_hex(p, end, "LANMAN-Challenge", challenge, 8);
+	if (!p) goto too_long;
+	p = mschap_helper_hex(p, end, "NT-Response", response, NT_LENGTH);
+	if (!p) goto too_long;
+	p = mschap_helper_line(p, end, "Request-User-Session-Key", "Yes");
+	if (!p) goto too_long;
+	if ((p + 3) > end) goto too_long;
+	strcpy(p, ".\n");
+	p += 2;
+
+	helper = fr_connection_get(inst->helper_pool);
+	if (!helper) {
+		RERROR("Unable to get ntlm_auth helper from pool");
+		return -2;
+	}
+
+	RDEBUG2("Sending authentication request user='%s' to ntlm_auth helper PID %u",
+		user_name, (unsigned int) helper->pid);
+
+	/*
+	 *	A helper which has exited since it was last used is
+	 *	only noticed when we talk to it.  So if this one has
+	 *	gone away, start another, and try again.  A helper
+	 *	which takes too long is given up on straight away.
+	 */
+	for (tries = 0; ; tries++) {
+		if (mschap_helper_write(inst, helper, buffer, p - buffer) == 0) {
+			len = mschap_helper_read(inst, helper, reply, sizeof(reply));
+			if (len >= 0) break;
+		} else {
+			fr_strerror_printf("Failed writing request: %s", fr_syserror(errno));
+			len = -1;
+		}
+
+		REDEBUG("ntlm_auth helper PID %u failed: %s", (unsigned int) helper->pid, fr_strerror());
+
+		if (tries > 0) {
+			fr_connection_close(inst->helper_pool, helper, "ntlm_auth helper failed");
+			return -2;
+		}
+
+		helper = fr_connection_reconnect(inst->helper_pool, helper);
+		if (!helper) {
+			RERROR("Unable to restart ntlm_auth helper");
+			return -2;
+		}
+	}
+
+	fr_connection_release(inst->helper_pool, helper);
+
+	/*
+	 *	Parse the reply, which is lines of "key: value".
+	 */
+	for (line = reply; line && *line; line = next) {
+		next = strchr(line, '\n');
+		if (next) *next++ = '\0';
+
+		RDEBUG3("ntlm_auth helper said: %s", line);
+
+		if (strcmp(line, "Authenticated: Yes") == 0) {
+			authenticated = true;
+
+		} else if (strncmp(line, "User-Session-Key: ", 18) == 0) {
+			if (fr_hex2bin(nthashhash, NT_DIGEST_LENGTH, line + 18, strlen(line + 18)) != NT_DIGEST_LENGTH) {
+				REDEBUG("Invalid output from ntlm_auth helper: User-Session-Key has non-hex values");
+				return -1;
+			}
+			have_key = true;
+
+		} else if ((strncmp(line, "Authentication-Error: ", 22) == 0) ||
+			   (strncmp(line, "Error: ", 7) == 0)) {
+			error = strchr(line, ' ') + 1;
+		}
+	}
+
+	if (!authenticated) {
+		int rcode;
+
+		if (!error) {
+			REDEBUG("ntlm_auth helper rejected the user");
+			return -1;
+		}
+
+		rcode = mschap_ntlm_auth_error(request, error);
+		if (rcode != 0) return rcode;
+
+		REDEBUG("ntlm_auth helper says: %s", error);
+		return -1;
+	}
+
+	if (!have_key) {
+		REDEBUG("Invalid output from ntlm_auth helper: expecting User-Session-Key");
+		return -1;
+	}
+
+	RDEBUG2("Authenticated successfully");
+
+	return 0;
+}
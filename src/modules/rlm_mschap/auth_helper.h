@@ -0,0 +1,14 @@
+/* Copyright 2015 The FreeRADIUS server project */
+
+#ifndef _AUTH_HELPER_H
+#define _AUTH_HELPER_H
+
+RCSIDH(auth_helper_h, "$Id$")
+
+void *mschap_helper_create(TALLOC_CTX *ctx, void *instance);
+
+int do_auth_helper(rlm_mschap_t *inst, REQUEST *request,
+		   uint8_t const *challenge, uint8_t const *response,
+		   uint8_t nthashhash[NT_DIGEST_LENGTH]);
+
+#endif /*_AUTH_HELPER_H*/
@@ -20,6 +20,7 @@ void mschap_auth_response(char const *username,
 			  char *response);
 void mschap_add_reply(REQUEST *request, unsigned char ident,
 		      char const *name, char const *value, size_t len);
+int mschap_ntlm_auth_error(REQUEST *request, char const *buffer);
 
 
 #endif /*_MSCHAP_H*/
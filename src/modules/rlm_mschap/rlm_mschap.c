@@ -41,6 +41,8 @@ RCSID("$Id$")
 #include "auth_wbclient.h"
 #endif
 
+#include "auth_helper.h"
+
 #ifdef HAVE_OPENSSL_CRYPTO_H
 USES_APPLE_DEPRECATED_API	/* OpenSSL API has been deprecated by Apple */
 #  include	<openssl/rc4.h>
@@ -555,6 +557,9 @@ static const CONF_PARSER module_config[] = {
 	{ "with_ntdomain_hack", FR_CONF_OFFSET(PW_TYPE_BOOLEAN, rlm_mschap_t, with_ntdomain_hack), "yes" },
 	{ "ntlm_auth", FR_CONF_OFFSET(PW_TYPE_STRING | PW_TYPE_XLAT, rlm_mschap_t, ntlm_auth), NULL },
 	{ "ntlm_auth_timeout", FR_CONF_OFFSET(PW_TYPE_INTEGER, rlm_mschap_t, ntlm_auth_timeout), NULL },
+	{ "ntlm_auth_helper", FR_CONF_OFFSET(PW_TYPE_STRING, rlm_mschap_t, ntlm_auth_helper), NULL },
+	{ "ntlm_auth_helper_username", FR_CONF_OFFSET(PW_TYPE_STRING | PW_TYPE_TMPL, rlm_mschap_t, helper_username), NULL },
+	{ "ntlm_auth_helper_domain", FR_CONF_OFFSET(PW_TYPE_STRING | PW_TYPE_TMPL, rlm_mschap_t, helper_domain), NULL },
 	{ "passchange", FR_CONF_POINTER(PW_TYPE_SUBSECTION, NULL), (void const *) passchange_config },
 	{ "allow_retry", FR_CONF_OFFSET(PW_TYPE_BOOLEAN, rlm_mschap_t, allow_retry), "yes" },
 	{ "retry_msg", FR_CONF_OFFSET(PW_TYPE_STRING, rlm_mschap_t, retry_msg), NULL },
@@ -609,18 +614,20 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 	if (inst->wb_username) {
 #ifdef WITH_AUTH_WINBIND
 		inst->method = AUTH_WBCLIENT;
-
-		inst->wb_pool = fr_connection_pool_module_init(conf, inst, mod_conn_create, NULL, NULL);
-		if (!inst->wb_pool) {
-			cf_log_err_cs(conf, "Unable to initialise winbind connection pool");
-			return -1;
-		}
 #else
 		cf_log_err_cs(conf, "'winbind' auth not enabled at compiled time");
 		return -1;
 #endif
 	}
 
+	if (inst->ntlm_auth_helper) {
+		if (!inst->helper_username) {
+			cf_log_err_cs(conf, "'ntlm_auth_helper' requires 'ntlm_auth_helper_username' to be set");
+			return -1;
+		}
+		inst->method = AUTH_NTLMAUTH_HELPER;
+	}
+
 	/* preserve existing behaviour: this option overrides all */
 	if (inst->ntlm_auth) {
 		inst->method = AUTH_NTLMAUTH_EXEC;
@@ -633,6 +640,9 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 	case AUTH_NTLMAUTH_EXEC:
 		DEBUG("rlm_mschap (%s): authenticating by calling 'ntlm_auth'", inst->xlat_name);
 		break;
+	case AUTH_NTLMAUTH_HELPER:
+		DEBUG("rlm_mschap (%s): authenticating with a pool of 'ntlm_auth' helpers", inst->xlat_name);
+		break;
 #ifdef WITH_AUTH_WINBIND
 	case AUTH_WBCLIENT:
 		DEBUG("rlm_mschap (%s): authenticating directly to winbind", inst->xlat_name);
@@ -657,19 +667,134 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 		return -1;
 	}
 
+	/*
+	 *	Only the method we're using gets a connection pool,
+	 *	as they would both be configured by the "pool" section.
+	 */
+	switch (inst->method) {
+#ifdef WITH_AUTH_WINBIND
+	case AUTH_WBCLIENT:
+		inst->wb_pool = fr_connection_pool_module_init(conf, inst, mod_conn_create, NULL, NULL);
+		if (!inst->wb_pool) {
+			cf_log_err_cs(conf, "Unable to initialise winbind connection pool");
+			return -1;
+		}
+		break;
+#endif
+
+	case AUTH_NTLMAUTH_HELPER:
+		inst->helper_pool = fr_connection_pool_module_init(conf, inst, mschap_helper_create, NULL, NULL);
+		if (!inst->helper_pool) {
+			cf_log_err_cs(conf, "Unable to initialise ntlm_auth helper pool");
+			return -1;
+		}
+		break;
+
+	default:
+		break;
+	}
+
 	return 0;
 }
 
 /*
  *	Tidy up instance
  */
-static int mod_detach(UNUSED void *instance)
+static int mod_detach(void *instance)
 {
-#ifdef WITH_AUTH_WINBIND
 	rlm_mschap_t *inst = instance;
 
+#ifdef WITH_AUTH_WINBIND
 	fr_connection_pool_free(inst->wb_pool);
 #endif
+	fr_connection_pool_free(inst->helper_pool);
+
+	return 0;
+}
+
+/** Map the errors ntlm_auth gives to MS-CHAP error codes
+ *
+ * @param request Current request.
+ * @param buffer the output of ntlm_auth, or the Authentication-Error
+ *	an ntlm_auth helper sent.
+ * @return the MS-CHAP error, or 0 if the error isn't one we know about.
+ */
+int mschap_ntlm_auth_error(REQUEST *request, char const *buffer)
+{
+	char const *p;
+
+	/*
+	 *	Do checks for numbers, which are
+	 *	language neutral.  They're also
+	 *	faster.
+	 */
+	p = strcasestr(buffer, "0xC0000");
+	if (p) {
+		int rcode = 0;
+
+		p += 7;
+		if (strcmp(p, "224") == 0) {
+			rcode = -648;
+
+		} else if (strcmp(p, "234") == 0) {
+			rcode = -647;
+
+		} else if (strcmp(p, "072") == 0) {
+			rcode = -691;
+
+		} else if (strcasecmp(p, "05E") == 0) {
+			rcode = -2;
+		}
+
+		if (rcode != 0) {
+			REDEBUG2("%s", buffer);
+			return rcode;
+		}
+
+		/*
+		 *	Else fall through to more ridiculous checks.
+		 */
+	}
+
+	/*
+	 *	Look for variants of expire password.
+	 */
+	if (strcasestr(buffer, "0xC0000224") ||
+	    strcasestr(buffer, "NT_STATUS_PASSWORD_EXPIRED") ||
+	    strcasestr(buffer, "NT_STATUS_PASSWORD_MUST_CHANGE") ||
+	    strcasestr(buffer, "Password expired") ||
+	    strcasestr(buffer, "Password has expired") ||
+	    strcasestr(buffer, "Password must be changed") ||
+	    strcasestr(buffer, "Must change password")) {
+		return -648;
+	}
+
+	if (strcasestr(buffer, "0xC0000234") ||
+	    strcasestr(buffer, "NT_STATUS_ACCOUNT_LOCKED_OUT") ||
+	    strcasestr(buffer, "Account locked out")) {
+		REDEBUG2("%s", buffer);
+		return -647;
+	}
+
+	if (strcasestr(buffer, "0xC0000072") ||
+	    strcasestr(buffer, "NT_STATUS_ACCOUNT_DISABLED") ||
+	    strcasestr(buffer, "Account disabled")) {
+		REDEBUG2("%s", buffer);
+		return -691;
+	}
+
+	if (strcasestr(buffer, "0xC000005E") ||
+	    strcasestr(buffer, "NT_STATUS_NO_LOGON_SERVERS") ||
+	    strcasestr(buffer, "No logon servers")) {
+		REDEBUG2("%s", buffer);
+		return -2;
+	}
+
+	if (strcasestr(buffer, "could not obtain winbind separator") ||
+	    strcasestr(buffer, "Reading winbind reply failed")) {
+		REDEBUG2("%s", buffer);
+		return -2;
+	}
 
 	return 0;
 }
@@ -1155,73 +1280,8 @@ static int CC_HINT(nonnull (1, 2, 4, 5 ,6)) do_mschap(rlm_mschap_t *inst, REQUES
 		if (result != 0) {
 			char *p;
 
-			/*
-			 *	Do checks for numbers, which are
-			 *	language neutral.  They're also
-			 *	faster.
-			 */
-			p = strcasestr(buffer, "0xC0000");
-			if (p) {
-				int rcode = 0;
-
-				p += 7;
-				if (strcmp(p, "224") == 0) {
-					rcode = -648;
-
-				} else if (strcmp(p, "234") == 0) {
-					rcode = -647;
-
-				} else if (strcmp(p, "072") == 0) {
-					rcode = -691;
-
-				} else if (strcasecmp(p, "05E") == 0) {
-					rcode = -2;
-				}
-
-				if (rcode != 0) {
-					REDEBUG2("%s", buffer);
-					return rcode;
-				}
-
-				/*
-				 *	Else fall through to more ridiculous checks.
-				 */
-			}
-
-			/*
-			 *	Look for variants of expire password.
-			 */
-			if (strcasestr(buffer, "0xC0000224") ||
-			    strcasestr(buffer, "Password expired") ||
-			    strcasestr(buffer, "Password has expired") ||
-			    strcasestr(buffer, "Password must be changed") ||
-			    strcasestr(buffer, "Must change password")) {
-				return -648;
-			}
-
-			if (strcasestr(buffer, "0xC0000234") ||
-			    strcasestr(buffer, "Account locked out")) {
-				REDEBUG2("%s", buffer);
-				return -647;
-			}
-
-			if (strcasestr(buffer, "0xC0000072") ||
-			    strcasestr(buffer, "Account disabled")) {
-				REDEBUG2("%s", buffer);
-				return -691;
-			}
-
-			if (strcasestr(buffer, "0xC000005E") ||
-			    strcasestr(buffer, "No logon servers")) {
-				REDEBUG2("%s", buffer);
-				return -2;
-			}
-
-			if (strcasestr(buffer, "could not obtain winbind separator") ||
-			    strcasestr(buffer, "Reading winbind reply failed")) {
-				REDEBUG2("%s", buffer);
-				return -2;
-			}
+			result = mschap_ntlm_auth_error(request, buffer);
+			if (result != 0) return result;
 
 			RDEBUG2("External script failed");
 			p = strchr(buffer, '\n');
@@ -1263,6 +1323,12 @@ static int CC_HINT(nonnull (1, 2, 4, 5 ,6)) do_mschap(rlm_mschap_t *inst, REQUES
 		break;
 	}
 
+		/*
+		 *	Pass the request to an ntlm_auth helper
+		 */
+	case AUTH_NTLMAUTH_HELPER:
+		return do_auth_helper(inst, request, challenge, response, nthashhash);
+
 #ifdef WITH_AUTH_WINBIND
 		/*
 		 *	Process auth via the wbclient library
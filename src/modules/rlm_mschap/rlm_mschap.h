@@ -18,6 +18,7 @@ typedef enum {
 #ifdef WITH_AUTH_WINBIND
 	,AUTH_WBCLIENT       	= 2
 #endif
+	,AUTH_NTLMAUTH_HELPER	= 3
 } MSCHAP_AUTH_METHOD;
 
 typedef struct rlm_mschap_t {
@@ -28,6 +29,10 @@ typedef struct rlm_mschap_t {
 	char const		*xlat_name;
 	char const		*ntlm_auth;
 	uint32_t		ntlm_auth_timeout;
+	char const		*ntlm_auth_helper;
+	vp_tmpl_t		*helper_username;
+	vp_tmpl_t		*helper_domain;
+	fr_connection_pool_t	*helper_pool;
 	char const		*ntlm_cpw;
 	char const		*ntlm_cpw_username;
 	char const		*ntlm_cpw_domain;
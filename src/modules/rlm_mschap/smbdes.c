@@ -26,8 +26,11 @@
 
 /* NOTES:
 
-   This code makes no attempt to be fast! In fact, it is a very
-   slow implementation
+   The original code made no attempt to be fast, working on arrays
+   of one bit per byte.  It is still here, and can be used by
+   defining WITH_SMBDES_BITWISE.  By default, a table driven
+   implementation is used instead, as MS-CHAP needs three DES
+   operations, each with a new key, for every authentication.
 
    This code is NOT a complete DES implementation. It implements only
    the minimum necessary for SMB authentication, as used by all SMB
@@ -64,6 +67,7 @@ static const uchar perm1[56] = {57, 49, 41, 33, 25, 17,  9,
 			14,  6, 61, 53, 45, 37, 29,
 			21, 13,  5, 28, 20, 12,  4};
 
+#ifdef WITH_SMBDES_BITWISE
 static const uchar perm2[48] = {14, 17, 11, 24,  1,  5,
 			 3, 28, 15,  6, 21, 10,
 			23, 19, 12,  4, 26,  8,
@@ -109,10 +113,11 @@ static const uchar perm6[64] ={ 40,  8, 48, 16, 56, 24, 64, 32,
 			35,  3, 43, 11, 51, 19, 59, 27,
 			34,  2, 42, 10, 50, 18, 58, 26,
 			33,  1, 41,  9, 49, 17, 57, 25};
-
+#endif
 
 static const uchar sc[16] = {1, 1, 2, 2, 2, 2, 2, 2, 1, 2, 2, 2, 2, 2, 2, 1};
 
+#ifdef WITH_SMBDES_BITWISE
 static const uchar sbox[8][4][16] = {
 	{{14,  4, 13,  1,  2, 15, 11,  8,  3, 10,  6, 12,  5,  9,  0,  7},
 	 {0, 15,  7,  4, 14,  2, 13,  1, 10,  6, 12, 11,  9,  5,  3,  8},
@@ -310,6 +315,539 @@ void smbhash(unsigned char *out, unsigned char const *in, unsigned char *key)
 			out[i/8] |= (1<<(7-(i%8)));
 	}
 }
+#else
+/*
+ *	The S-boxes combined with the P permutation, so each round
+ *	is 8 lookups.  des_sp[j][b] is the output of S-box j for the
+ *	6 bits b, in the position P moves it to.
+ *
+ *	des_kc and des_kd are PC2 for 7 bits at a time of the C and
+ *	D halves of the key, giving the 6 bit groups of the subkey
+ *	for S-boxes 1-4 and 5-8, one group per byte.
+ */
+static const uint32_t des_sp[8][64] = {
+	{
+		0x00808200, 0x00000000, 0x00008000, 0x00808202,
+		0x00808002, 0x00008202, 0x00000002, 0x00008000,
+		0x00000200, 0x00808200, 0x00808202, 0x00000200,
+		0x00800202, 0x00808002, 0x00800000, 0x00000002,
+		0x00000202, 0x00800200, 0x00800200, 0x00008200,
+		0x00008200, 0x00808000, 0x00808000, 0x00800202,
+		0x00008002, 0x00800002, 0x00800002, 0x00008002,
+		0x00000000, 0x00000202, 0x00008202, 0x00800000,
+		0x00008000, 0x00808202, 0x00000002, 0x00808000,
+		0x00808200, 0x00800000, 0x00800000, 0x00000200,
+		0x00808002, 0x00008000, 0x00008200, 0x00800002,
+		0x00000200, 0x00000002, 0x00800202, 0x00008202,
+		0x00808202, 0x00008002, 0x00808000, 0x00800202,
+		0x00800002, 0x00000202, 0x00008202, 0x00808200,
+		0x00000202, 0x00800200, 0x00800200, 0x00000000,
+		0x00008002, 0x00008200, 0x00000000, 0x00808002
+	},
+	{
+		0x40084010, 0x40004000, 0x00004000, 0x00084010,
+		0x00080000, 0x00000010, 0x40080010, 0x40004010,
+		0x40000010, 0x40084010, 0x40084000, 0x40000000,
+		0x40004000, 0x00080000, 0x00000010, 0x40080010,
+		0x00084000, 0x00080010, 0x40004010, 0x00000000,
+		0x40000000, 0x00004000, 0x00084010, 0x40080000,
+		0x00080010, 0x40000010, 0x00000000, 0x00084000,
+		0x00004010, 0x40084000, 0x40080000, 0x00004010,
+		0x00000000, 0x00084010, 0x40080010, 0x00080000,
+		0x40004010, 0x40080000, 0x40084000, 0x00004000,
+		0x40080000, 0x40004000, 0x00000010, 0x40084010,
+		0x00084010, 0x00000010, 0x00004000, 0x40000000,
+		0x00004010, 0x40084000, 0x00080000, 0x40000010,
+		0x00080010, 0x40004010, 0x40000010, 0x00080010,
+		0x00084000, 0x00000000, 0x40004000, 0x00004010,
+		0x40000000, 0x40080010, 0x40084010, 0x00084000
+	},
+	{
+		0x00000104, 0x04010100, 0x00000000, 0x04010004,
+		0x04000100, 0x00000000, 0x00010104, 0x04000100,
+		0x00010004, 0x04000004, 0x04000004, 0x00010000,
+		0x04010104, 0x00010004, 0x04010000, 0x00000104,
+		0x04000000, 0x00000004, 0x04010100, 0x00000100,
+		0x00010100, 0x04010000, 0x04010004, 0x00010104,
+		0x04000104, 0x00010100, 0x00010000, 0x04000104,
+		0x00000004, 0x04010104, 0x00000100, 0x04000000,
+		0x04010100, 0x04000000, 0x00010004, 0x00000104,
+		0x00010000, 0x04010100, 0x04000100, 0x00000000,
+		0x00000100, 0x00010004, 0x04010104, 0x04000100,
+		0x04000004, 0x00000100, 0x00000000, 0x04010004,
+		0x04000104, 0x00010000, 0x04000000, 0x04010104,
+		0x00000004, 0x00010104, 0x00010100, 0x04000004,
+		0x04010000, 0x04000104, 0x00000104, 0x04010000,
+		0x00010104, 0x00000004, 0x04010004, 0x00010100
+	},
+	{
+		0x80401000, 0x80001040, 0x80001040, 0x00000040,
+		0x00401040, 0x80400040, 0x80400000, 0x80001000,
+		0x00000000, 0x00401000, 0x00401000, 0x80401040,
+		0x80000040, 0x00000000, 0x00400040, 0x80400000,
+		0x80000000, 0x00001000, 0x00400000, 0x80401000,
+		0x00000040, 0x00400000, 0x80001000, 0x00001040,
+		0x80400040, 0x80000000, 0x00001040, 0x00400040,
+		0x00001000, 0x00401040, 0x80401040, 0x80000040,
+		0x00400040, 0x80400000, 0x00401000, 0x80401040,
+		0x80000040, 0x00000000, 0x00000000, 0x00401000,
+		0x00001040, 0x00400040, 0x80400040, 0x80000000,
+		0x80401000, 0x80001040, 0x80001040, 0x00000040,
+		0x80401040, 0x80000040, 0x80000000, 0x00001000,
+		0x80400000, 0x80001000, 0x00401040, 0x80400040,
+		0x80001000, 0x00001040, 0x00400000, 0x80401000,
+		0x00000040, 0x00400000, 0x00001000, 0x00401040
+	},
+	{
+		0x00000080, 0x01040080, 0x01040000, 0x21000080,
+		0x00040000, 0x00000080, 0x20000000, 0x01040000,
+		0x20040080, 0x00040000, 0x01000080, 0x20040080,
+		0x21000080, 0x21040000, 0x00040080, 0x20000000,
+		0x01000000, 0x20040000, 0x20040000, 0x00000000,
+		0x20000080, 0x21040080, 0x21040080, 0x01000080,
+		0x21040000, 0x20000080, 0x00000000, 0x21000000,
+		0x01040080, 0x01000000, 0x21000000, 0x00040080,
+		0x00040000, 0x21000080, 0x00000080, 0x01000000,
+		0x20000000, 0x01040000, 0x21000080, 0x20040080,
+		0x01000080, 0x20000000, 0x21040000, 0x01040080,
+		0x20040080, 0x00000080, 0x01000000, 0x21040000,
+		0x21040080, 0x00040080, 0x21000000, 0x21040080,
+		0x01040000, 0x00000000, 0x20040000, 0x21000000,
+		0x00040080, 0x01000080, 0x20000080, 0x00040000,
+		0x00000000, 0x20040000, 0x01040080, 0x20000080
+	},
+	{
+		0x10000008, 0x10200000, 0x00002000, 0x10202008,
+		0x10200000, 0x00000008, 0x10202008, 0x00200000,
+		0x10002000, 0x00202008, 0x00200000, 0x10000008,
+		0x00200008, 0x10002000, 0x10000000, 0x00002008,
+		0x00000000, 0x00200008, 0x10002008, 0x00002000,
+		0x00202000, 0x10002008, 0x00000008, 0x10200008,
+		0x10200008, 0x00000000, 0x00202008, 0x10202000,
+		0x00002008, 0x00202000, 0x10202000, 0x10000000,
+		0x10002000, 0x00000008, 0x10200008, 0x00202000,
+		0x10202008, 0x00200000, 0x00002008, 0x10000008,
+		0x00200000, 0x10002000, 0x10000000, 0x00002008,
+		0x10000008, 0x10202008, 0x00202000, 0x10200000,
+		0x00202008, 0x10202000, 0x00000000, 0x10200008,
+		0x00000008, 0x00002000, 0x10200000, 0x00202008,
+		0x00002000, 0x00200008, 0x10002008, 0x00000000,
+		0x10202000, 0x10000000, 0x00200008, 0x10002008
+	},
+	{
+		0x00100000, 0x02100001, 0x02000401, 0x00000000,
+		0x00000400, 0x02000401, 0x00100401, 0x02100400,
+		0x02100401, 0x00100000, 0x00000000, 0x02000001,
+		0x00000001, 0x02000000, 0x02100001, 0x00000401,
+		0x02000400, 0x00100401, 0x00100001, 0x02000400,
+		0x02000001, 0x02100000, 0x02100400, 0x00100001,
+		0x02100000, 0x00000400, 0x00000401, 0x02100401,
+		0x00100400, 0x00000001, 0x02000000, 0x00100400,
+		0x02000000, 0x00100400, 0x00100000, 0x02000401,
+		0x02000401, 0x02100001, 0x02100001, 0x00000001,
+		0x00100001, 0x02000000, 0x02000400, 0x00100000,
+		0x02100400, 0x00000401, 0x00100401, 0x02100400,
+		0x00000401, 0x02000001, 0x02100401, 0x02100000,
+		0x00100400, 0x00000000, 0x00000001, 0x02100401,
+		0x00000000, 0x00100401, 0x02100000, 0x00000400,
+		0x02000001, 0x02000400, 0x00000400, 0x00100001
+	},
+	{
+		0x08000820, 0x00000800, 0x00020000, 0x08020820,
+		0x08000000, 0x08000820, 0x00000020, 0x08000000,
+		0x00020020, 0x08020000, 0x08020820, 0x00020800,
+		0x08020800, 0x00020820, 0x00000800, 0x00000020,
+		0x08020000, 0x08000020, 0x08000800, 0x00000820,
+		0x00020800, 0x00020020, 0x08020020, 0x08020800,
+		0x00000820, 0x00000000, 0x00000000, 0x08020020,
+		0x08000020, 0x08000800, 0x00020820, 0x00020000,
+		0x00020820, 0x00020000, 0x08020800, 0x00000800,
+		0x00000020, 0x08020020, 0x00000800, 0x00020820,
+		0x08000800, 0x00000020, 0x08000020, 0x08020000,
+		0x08020020, 0x08000000, 0x00020000, 0x08000820,
+		0x00000000, 0x08020820, 0x00020020, 0x08000020,
+		0x08020000, 0x08000800, 0x08000820, 0x00000000,
+		0x08020820, 0x00020800, 0x00020800, 0x00000820,
+		0x00000820, 0x00020020, 0x08000000, 0x08020800
+	}
+};
+
+static const uint32_t des_kc[4][128] = {
+	{
+		0x00000000, 0x00000010, 0x00040000, 0x00040010,
+		0x01000000, 0x01000010, 0x01040000, 0x01040010,
+		0x00000400, 0x00000410, 0x00040400, 0x00040410,
+		0x01000400, 0x01000410, 0x01040400, 0x01040410,
+		0x00200000, 0x00200010, 0x00240000, 0x00240010,
+		0x01200000, 0x01200010, 0x01240000, 0x01240010,
+		0x00200400, 0x00200410, 0x00240400, 0x00240410,
+		0x01200400, 0x01200410, 0x01240400, 0x01240410,
+		0x00000001, 0x00000011, 0x00040001, 0x00040011,
+		0x01000001, 0x01000011, 0x01040001, 0x01040011,
+		0x00000401, 0x00000411, 0x00040401, 0x00040411,
+		0x01000401, 0x01000411, 0x01040401, 0x01040411,
+		0x00200001, 0x00200011, 0x00240001, 0x00240011,
+		0x01200001, 0x01200011, 0x01240001, 0x01240011,
+		0x00200401, 0x00200411, 0x00240401, 0x00240411,
+		0x01200401, 0x01200411, 0x01240401, 0x01240411,
+		0x02000000, 0x02000010, 0x02040000, 0x02040010,
+		0x03000000, 0x03000010, 0x03040000, 0x03040010,
+		0x02000400, 0x02000410, 0x02040400, 0x02040410,
+		0x03000400, 0x03000410, 0x03040400, 0x03040410,
+		0x02200000, 0x02200010, 0x02240000, 0x02240010,
+		0x03200000, 0x03200010, 0x03240000, 0x03240010,
+		0x02200400, 0x02200410, 0x02240400, 0x02240410,
+		0x03200400, 0x03200410, 0x03240400, 0x03240410,
+		0x02000001, 0x02000011, 0x02040001, 0x02040011,
+		0x03000001, 0x03000011, 0x03040001, 0x03040011,
+		0x02000401, 0x02000411, 0x02040401, 0x02040411,
+		0x03000401, 0x03000411, 0x03040401, 0x03040411,
+		0x02200001, 0x02200011, 0x02240001, 0x02240011,
+		0x03200001, 0x03200011, 0x03240001, 0x03240011,
+		0x02200401, 0x02200411, 0x02240401, 0x02240411,
+		0x03200401, 0x03200411, 0x03240401, 0x03240411
+	},
+	{
+		0x00000000, 0x20000000, 0x00000002, 0x20000002,
+		0x00000800, 0x20000800, 0x00000802, 0x20000802,
+		0x08000000, 0x28000000, 0x08000002, 0x28000002,
+		0x08000800, 0x28000800, 0x08000802, 0x28000802,
+		0x00010000, 0x20010000, 0x00010002, 0x20010002,
+		0x00010800, 0x20010800, 0x00010802, 0x20010802,
+		0x08010000, 0x28010000, 0x08010002, 0x28010002,
+		0x08010800, 0x28010800, 0x08010802, 0x28010802,
+		0x00000000, 0x20000000, 0x00000002, 0x20000002,
+		0x00000800, 0x20000800, 0x00000802, 0x20000802,
+		0x08000000, 0x28000000, 0x08000002, 0x28000002,
+		0x08000800, 0x28000800, 0x08000802, 0x28000802,
+		0x00010000, 0x20010000, 0x00010002, 0x20010002,
+		0x00010800, 0x20010800, 0x00010802, 0x20010802,
+		0x08010000, 0x28010000, 0x08010002, 0x28010002,
+		0x08010800, 0x28010800, 0x08010802, 0x28010802,
+		0x00000100, 0x20000100, 0x00000102, 0x20000102,
+		0x00000900, 0x20000900, 0x00000902, 0x20000902,
+		0x08000100, 0x28000100, 0x08000102, 0x28000102,
+		0x08000900, 0x28000900, 0x08000902, 0x28000902,
+		0x00010100, 0x20010100, 0x00010102, 0x20010102,
+		0x00010900, 0x20010900, 0x00010902, 0x20010902,
+		0x08010100, 0x28010100, 0x08010102, 0x28010102,
+		0x08010900, 0x28010900, 0x08010902, 0x28010902,
+		0x00000100, 0x20000100, 0x00000102, 0x20000102,
+		0x00000900, 0x20000900, 0x00000902, 0x20000902,
+		0x08000100, 0x28000100, 0x08000102, 0x28000102,
+		0x08000900, 0x28000900, 0x08000902, 0x28000902,
+		0x00010100, 0x20010100, 0x00010102, 0x20010102,
+		0x00010900, 0x20010900, 0x00010902, 0x20010902,
+		0x08010100, 0x28010100, 0x08010102, 0x28010102,
+		0x08010900, 0x28010900, 0x08010902, 0x28010902
+	},
+	{
+		0x00000000, 0x00020000, 0x00000004, 0x00020004,
+		0x00001000, 0x00021000, 0x00001004, 0x00021004,
+		0x00000000, 0x00020000, 0x00000004, 0x00020004,
+		0x00001000, 0x00021000, 0x00001004, 0x00021004,
+		0x10000000, 0x10020000, 0x10000004, 0x10020004,
+		0x10001000, 0x10021000, 0x10001004, 0x10021004,
+		0x10000000, 0x10020000, 0x10000004, 0x10020004,
+		0x10001000, 0x10021000, 0x10001004, 0x10021004,
+		0x00000020, 0x00020020, 0x00000024, 0x00020024,
+		0x00001020, 0x00021020, 0x00001024, 0x00021024,
+		0x00000020, 0x00020020, 0x00000024, 0x00020024,
+		0x00001020, 0x00021020, 0x00001024, 0x00021024,
+		0x10000020, 0x10020020, 0x10000024, 0x10020024,
+		0x10001020, 0x10021020, 0x10001024, 0x10021024,
+		0x10000020, 0x10020020, 0x10000024, 0x10020024,
+		0x10001020, 0x10021020, 0x10001024, 0x10021024,
+		0x00080000, 0x000a0000, 0x00080004, 0x000a0004,
+		0x00081000, 0x000a1000, 0x00081004, 0x000a1004,
+		0x00080000, 0x000a0000, 0x00080004, 0x000a0004,
+		0x00081000, 0x000a1000, 0x00081004, 0x000a1004,
+		0x10080000, 0x100a0000, 0x10080004, 0x100a0004,
+		0x10081000, 0x100a1000, 0x10081004, 0x100a1004,
+		0x10080000, 0x100a0000, 0x10080004, 0x100a0004,
+		0x10081000, 0x100a1000, 0x10081004, 0x100a1004,
+		0x00080020, 0x000a0020, 0x00080024, 0x000a0024,
+		0x00081020, 0x000a1020, 0x00081024, 0x000a1024,
+		0x00080020, 0x000a0020, 0x00080024, 0x000a0024,
+		0x00081020, 0x000a1020, 0x00081024, 0x000a1024,
+		0x10080020, 0x100a0020, 0x10080024, 0x100a0024,
+		0x10081020, 0x100a1020, 0x10081024, 0x100a1024,
+		0x10080020, 0x100a0020, 0x10080024, 0x100a0024,
+		0x10081020, 0x100a1020, 0x10081024, 0x100a1024
+	},
+	{
+		0x00000000, 0x00100000, 0x00000008, 0x00100008,
+		0x00000200, 0x00100200, 0x00000208, 0x00100208,
+		0x00000000, 0x00100000, 0x00000008, 0x00100008,
+		0x00000200, 0x00100200, 0x00000208, 0x00100208,
+		0x04000000, 0x04100000, 0x04000008, 0x04100008,
+		0x04000200, 0x04100200, 0x04000208, 0x04100208,
+		0x04000000, 0x04100000, 0x04000008, 0x04100008,
+		0x04000200, 0x04100200, 0x04000208, 0x04100208,
+		0x00002000, 0x00102000, 0x00002008, 0x00102008,
+		0x00002200, 0x00102200, 0x00002208, 0x00102208,
+		0x00002000, 0x00102000, 0x00002008, 0x00102008,
+		0x00002200, 0x00102200, 0x00002208, 0x00102208,
+		0x04002000, 0x04102000, 0x04002008, 0x04102008,
+		0x04002200, 0x04102200, 0x04002208, 0x04102208,
+		0x04002000, 0x04102000, 0x04002008, 0x04102008,
+		0x04002200, 0x04102200, 0x04002208, 0x04102208,
+		0x00000000, 0x00100000, 0x00000008, 0x00100008,
+		0x00000200, 0x00100200, 0x00000208, 0x00100208,
+		0x00000000, 0x00100000, 0x00000008, 0x00100008,
+		0x00000200, 0x00100200, 0x00000208, 0x00100208,
+		0x04000000, 0x04100000, 0x04000008, 0x04100008,
+		0x04000200, 0x04100200, 0x04000208, 0x04100208,
+		0x04000000, 0x04100000, 0x04000008, 0x04100008,
+		0x04000200, 0x04100200, 0x04000208, 0x04100208,
+		0x00002000, 0x00102000, 0x00002008, 0x00102008,
+		0x00002200, 0x00102200, 0x00002208, 0x00102208,
+		0x00002000, 0x00102000, 0x00002008, 0x00102008,
+		0x00002200, 0x00102200, 0x00002208, 0x00102208,
+		0x04002000, 0x04102000, 0x04002008, 0x04102008,
+		0x04002200, 0x04102200, 0x04002208, 0x04102208,
+		0x04002000, 0x04102000, 0x04002008, 0x04102008,
+		0x04002200, 0x04102200, 0x04002208, 0x04102208
+	}
+};
+
+static const uint32_t des_kd[4][128] = {
+	{
+		0x00000000, 0x00000000, 0x00000200, 0x00000200,
+		0x00020000, 0x00020000, 0x00020200, 0x00020200,
+		0x00000001, 0x00000001, 0x00000201, 0x00000201,
+		0x00020001, 0x00020001, 0x00020201, 0x00020201,
+		0x08000000, 0x08000000, 0x08000200, 0x08000200,
+		0x08020000, 0x08020000, 0x08020200, 0x08020200,
+		0x08000001, 0x08000001, 0x08000201, 0x08000201,
+		0x08020001, 0x08020001, 0x08020201, 0x08020201,
+		0x00200000, 0x00200000, 0x00200200, 0x00200200,
+		0x00220000, 0x00220000, 0x00220200, 0x00220200,
+		0x00200001, 0x00200001, 0x00200201, 0x00200201,
+		0x00220001, 0x00220001, 0x00220201, 0x00220201,
+		0x08200000, 0x08200000, 0x08200200, 0x08200200,
+		0x08220000, 0x08220000, 0x08220200, 0x08220200,
+		0x08200001, 0x08200001, 0x08200201, 0x08200201,
+		0x08220001, 0x08220001, 0x08220201, 0x08220201,
+		0x00000002, 0x00000002, 0x00000202, 0x00000202,
+		0x00020002, 0x00020002, 0x00020202, 0x00020202,
+		0x00000003, 0x00000003, 0x00000203, 0x00000203,
+		0x00020003, 0x00020003, 0x00020203, 0x00020203,
+		0x08000002, 0x08000002, 0x08000202, 0x08000202,
+		0x08020002, 0x08020002, 0x08020202, 0x08020202,
+		0x08000003, 0x08000003, 0x08000203, 0x08000203,
+		0x08020003, 0x08020003, 0x08020203, 0x08020203,
+		0x00200002, 0x00200002, 0x00200202, 0x00200202,
+		0x00220002, 0x00220002, 0x00220202, 0x00220202,
+		0x00200003, 0x00200003, 0x00200203, 0x00200203,
+		0x00220003, 0x00220003, 0x00220203, 0x00220203,
+		0x08200002, 0x08200002, 0x08200202, 0x08200202,
+		0x08220002, 0x08220002, 0x08220202, 0x08220202,
+		0x08200003, 0x08200003, 0x08200203, 0x08200203,
+		0x08220003, 0x08220003, 0x08220203, 0x08220203
+	},
+	{
+		0x00000000, 0x00000010, 0x20000000, 0x20000010,
+		0x00100000, 0x00100010, 0x20100000, 0x20100010,
+		0x00000800, 0x00000810, 0x20000800, 0x20000810,
+		0x00100800, 0x00100810, 0x20100800, 0x20100810,
+		0x00000000, 0x00000010, 0x20000000, 0x20000010,
+		0x00100000, 0x00100010, 0x20100000, 0x20100010,
+		0x00000800, 0x00000810, 0x20000800, 0x20000810,
+		0x00100800, 0x00100810, 0x20100800, 0x20100810,
+		0x04000000, 0x04000010, 0x24000000, 0x24000010,
+		0x04100000, 0x04100010, 0x24100000, 0x24100010,
+		0x04000800, 0x04000810, 0x24000800, 0x24000810,
+		0x04100800, 0x04100810, 0x24100800, 0x24100810,
+		0x04000000, 0x04000010, 0x24000000, 0x24000010,
+		0x04100000, 0x04100010, 0x24100000, 0x24100010,
+		0x04000800, 0x04000810, 0x24000800, 0x24000810,
+		0x04100800, 0x04100810, 0x24100800, 0x24100810,
+		0x00000004, 0x00000014, 0x20000004, 0x20000014,
+		0x00100004, 0x00100014, 0x20100004, 0x20100014,
+		0x00000804, 0x00000814, 0x20000804, 0x20000814,
+		0x00100804, 0x00100814, 0x20100804, 0x20100814,
+		0x00000004, 0x00000014, 0x20000004, 0x20000014,
+		0x00100004, 0x00100014, 0x20100004, 0x20100014,
+		0x00000804, 0x00000814, 0x20000804, 0x20000814,
+		0x00100804, 0x00100814, 0x20100804, 0x20100814,
+		0x04000004, 0x04000014, 0x24000004, 0x24000014,
+		0x04100004, 0x04100014, 0x24100004, 0x24100014,
+		0x04000804, 0x04000814, 0x24000804, 0x24000814,
+		0x04100804, 0x04100814, 0x24100804, 0x24100814,
+		0x04000004, 0x04000014, 0x24000004, 0x24000014,
+		0x04100004, 0x04100014, 0x24100004, 0x24100014,
+		0x04000804, 0x04000814, 0x24000804, 0x24000814,
+		0x04100804, 0x04100814, 0x24100804, 0x24100814
+	},
+	{
+		0x00000000, 0x00001000, 0x00010000, 0x00011000,
+		0x02000000, 0x02001000, 0x02010000, 0x02011000,
+		0x00000020, 0x00001020, 0x00010020, 0x00011020,
+		0x02000020, 0x02001020, 0x02010020, 0x02011020,
+		0x00040000, 0x00041000, 0x00050000, 0x00051000,
+		0x02040000, 0x02041000, 0x02050000, 0x02051000,
+		0x00040020, 0x00041020, 0x00050020, 0x00051020,
+		0x02040020, 0x02041020, 0x02050020, 0x02051020,
+		0x00002000, 0x00003000, 0x00012000, 0x00013000,
+		0x02002000, 0x02003000, 0x02012000, 0x02013000,
+		0x00002020, 0x00003020, 0x00012020, 0x00013020,
+		0x02002020, 0x02003020, 0x02012020, 0x02013020,
+		0x00042000, 0x00043000, 0x00052000, 0x00053000,
+		0x02042000, 0x02043000, 0x02052000, 0x02053000,
+		0x00042020, 0x00043020, 0x00052020, 0x00053020,
+		0x02042020, 0x02043020, 0x02052020, 0x02053020,
+		0x00000000, 0x00001000, 0x00010000, 0x00011000,
+		0x02000000, 0x02001000, 0x02010000, 0x02011000,
+		0x00000020, 0x00001020, 0x00010020, 0x00011020,
+		0x02000020, 0x02001020, 0x02010020, 0x02011020,
+		0x00040000, 0x00041000, 0x00050000, 0x00051000,
+		0x02040000, 0x02041000, 0x02050000, 0x02051000,
+		0x00040020, 0x00041020, 0x00050020, 0x00051020,
+		0x02040020, 0x02041020, 0x02050020, 0x02051020,
+		0x00002000, 0x00003000, 0x00012000, 0x00013000,
+		0x02002000, 0x02003000, 0x02012000, 0x02013000,
+		0x00002020, 0x00003020, 0x00012020, 0x00013020,
+		0x02002020, 0x02003020, 0x02012020, 0x02013020,
+		0x00042000, 0x00043000, 0x00052000, 0x00053000,
+		0x02042000, 0x02043000, 0x02052000, 0x02053000,
+		0x00042020, 0x00043020, 0x00052020, 0x00053020,
+		0x02042020, 0x02043020, 0x02052020, 0x02053020
+	},
+	{
+		0x00000000, 0x00000400, 0x01000000, 0x01000400,
+		0x00000000, 0x00000400, 0x01000000, 0x01000400,
+		0x00000100, 0x00000500, 0x01000100, 0x01000500,
+		0x00000100, 0x00000500, 0x01000100, 0x01000500,
+		0x10000000, 0x10000400, 0x11000000, 0x11000400,
+		0x10000000, 0x10000400, 0x11000000, 0x11000400,
+		0x10000100, 0x10000500, 0x11000100, 0x11000500,
+		0x10000100, 0x10000500, 0x11000100, 0x11000500,
+		0x00080000, 0x00080400, 0x01080000, 0x01080400,
+		0x00080000, 0x00080400, 0x01080000, 0x01080400,
+		0x00080100, 0x00080500, 0x01080100, 0x01080500,
+		0x00080100, 0x00080500, 0x01080100, 0x01080500,
+		0x10080000, 0x10080400, 0x11080000, 0x11080400,
+		0x10080000, 0x10080400, 0x11080000, 0x11080400,
+		0x10080100, 0x10080500, 0x11080100, 0x11080500,
+		0x10080100, 0x10080500, 0x11080100, 0x11080500,
+		0x00000008, 0x00000408, 0x01000008, 0x01000408,
+		0x00000008, 0x00000408, 0x01000008, 0x01000408,
+		0x00000108, 0x00000508, 0x01000108, 0x01000508,
+		0x00000108, 0x00000508, 0x01000108, 0x01000508,
+		0x10000008, 0x10000408, 0x11000008, 0x11000408,
+		0x10000008, 0x10000408, 0x11000008, 0x11000408,
+		0x10000108, 0x10000508, 0x11000108, 0x11000508,
+		0x10000108, 0x10000508, 0x11000108, 0x11000508,
+		0x00080008, 0x00080408, 0x01080008, 0x01080408,
+		0x00080008, 0x00080408, 0x01080008, 0x01080408,
+		0x00080108, 0x00080508, 0x01080108, 0x01080508,
+		0x00080108, 0x00080508, 0x01080108, 0x01080508,
+		0x10080008, 0x10080408, 0x11080008, 0x11080408,
+		0x10080008, 0x10080408, 0x11080008, 0x11080408,
+		0x10080108, 0x10080508, 0x11080108, 0x11080508,
+		0x10080108, 0x10080508, 0x11080108, 0x11080508
+	}
+};
+
+#define DES_ROTR(_x, _n) (((_x) >> (_n)) | ((_x) << (32 - (_n))))
+
+/*
+ *	Swap the bits of a selected by m, with those of b n bits to
+ *	the right.  IP and FP are both a sequence of these.
+ */
+#define DES_PERM_OP(_a, _b, _n, _m) do { \
+	uint32_t _t = (((_a) >> (_n)) ^ (_b)) & (_m); \
+	(_b) ^= _t; \
+	(_a) ^= _t << (_n); \
+} while (0)
+
+/*
+ *	Encrypt one block.  The 56 bits of the key are taken straight
+ *	from the 7 bytes, without spreading them over 8 bytes with
+ *	parity bits.  The subkeys are made as they're needed, as each
+ *	key is only used once.
+ */
+static void des_encrypt(uint8_t out[8], uint8_t const in[8], uint8_t const key[7])
+{
+	uint32_t	c = 0, d = 0, k0, k1, l, r, f;
+	int		i;
+
+	for (i = 0; i < 56; i++) {
+		int		b = (((perm1[i] - 1) >> 3) * 7) + ((perm1[i] - 1) & 0x07);
+		uint32_t	bit = (key[b >> 3] >> (7 - (b & 0x07))) & 0x01;
+
+		if (i < 28) {
+			c = (c << 1) | bit;
+		} else {
+			d = (d << 1) | bit;
+		}
+	}
+
+	l = ((uint32_t) in[0] << 24) | ((uint32_t) in[1] << 16) | ((uint32_t) in[2] << 8) | in[3];
+	r = ((uint32_t) in[4] << 24) | ((uint32_t) in[5] << 16) | ((uint32_t) in[6] << 8) | in[7];
+
+	DES_PERM_OP(l, r, 4, 0x0f0f0f0f);
+	DES_PERM_OP(l, r, 16, 0x0000ffff);
+	DES_PERM_OP(r, l, 2, 0x33333333);
+	DES_PERM_OP(r, l, 8, 0x00ff00ff);
+	DES_PERM_OP(l, r, 1, 0x55555555);
+
+	for (i = 0; i < 16; i++) {
+		c = ((c << sc[i]) | (c >> (28 - sc[i]))) & 0x0fffffff;
+		d = ((d << sc[i]) | (d >> (28 - sc[i]))) & 0x0fffffff;
+
+		k0 = des_kc[0][c >> 21] | des_kc[1][(c >> 14) & 0x7f] |
+		     des_kc[2][(c >> 7) & 0x7f] | des_kc[3][c & 0x7f];
+		k1 = des_kd[0][d >> 21] | des_kd[1][(d >> 14) & 0x7f] |
+		     des_kd[2][(d >> 7) & 0x7f] | des_kd[3][d & 0x7f];
+
+		/*
+		 *	E selects overlapping groups of 6 bits from r,
+		 *	the first and last of which wrap around.
+		 */
+		f = des_sp[0][(DES_ROTR(r, 27) ^ (k0 >> 24)) & 0x3f] |
+		    des_sp[1][((r >> 23) ^ (k0 >> 16)) & 0x3f] |
+		    des_sp[2][((r >> 19) ^ (k0 >> 8)) & 0x3f] |
+		    des_sp[3][((r >> 15) ^ k0) & 0x3f] |
+		    des_sp[4][((r >> 11) ^ (k1 >> 24)) & 0x3f] |
+		    des_sp[5][((r >> 7) ^ (k1 >> 16)) & 0x3f] |
+		    des_sp[6][((r >> 3) ^ (k1 >> 8)) & 0x3f] |
+		    des_sp[7][(DES_ROTR(r, 31) ^ k1) & 0x3f];
+
+		f ^= l;
+		l = r;
+		r = f;
+	}
+
+	/*
+	 *	The last round doesn't swap the halves.
+	 */
+	f = l;
+	l = r;
+	r = f;
+
+	DES_PERM_OP(l, r, 1, 0x55555555);
+	DES_PERM_OP(r, l, 8, 0x00ff00ff);
+	DES_PERM_OP(r, l, 2, 0x33333333);
+	DES_PERM_OP(l, r, 16, 0x0000ffff);
+	DES_PERM_OP(l, r, 4, 0x0f0f0f0f);
+
+	out[0] = l >> 24;
+	out[1] = l >> 16;
+	out[2] = l >> 8;
+	out[3] = l;
+	out[4] = r >> 24;
+	out[5] = r >> 16;
+	out[6] = r >> 8;
+	out[7] = r;
+}
+
+void smbhash(unsigned char *out, unsigned char const *in, unsigned char *key)
+{
+	des_encrypt(out, in, key);
+}
+#endif
 
 /*
  *	Converts the password to uppercase, and creates the LM
@@ -26,6 +26,7 @@ RCSID("$Id$")
 #include <freeradius-devel/radiusd.h>
 #include <freeradius-devel/modules.h>
 #include <freeradius-devel/rad_assert.h>
+#include <freeradius-devel/snapshot.h>
 
 struct mypasswd {
 	struct mypasswd *next;
@@ -372,8 +373,17 @@ int main(void){
 }
 
 #else  /* TEST */
-typedef struct rlm_passwd_t {
+/** One version of the passwd file
+ *
+ */
+typedef struct rlm_passwd_table_t {
 	struct hashtable	*ht;
+} rlm_passwd_table_t;
+
+typedef struct rlm_passwd_t {
+	char const		*name;
+	fr_snapshot_t		*snapshot;	//!< The current rlm_passwd_table_t.
+	uint32_t		check_interval;
 	struct mypasswd		*pwdfmt;
 	char const		*filename;
 	char const		*format;
@@ -404,9 +414,48 @@ static const CONF_PARSER module_config[] = {
 
 	{ "hashsize", FR_CONF_OFFSET(PW_TYPE_INTEGER | PW_TYPE_DEPRECATED, rlm_passwd_t, hash_size), NULL },
 	{ "hash_size", FR_CONF_OFFSET(PW_TYPE_INTEGER, rlm_passwd_t, hash_size), "100" },
+	{ "check_interval", FR_CONF_OFFSET(PW_TYPE_INTEGER, rlm_passwd_t, check_interval), "0" },
 	CONF_PARSER_TERMINATOR
 };
 
+static int _passwd_table_free(rlm_passwd_table_t *table)
+{
+	release_ht(table->ht);
+	return 0;
+}
+
+/*
+ *	(Re-)read the passwd file into memory.
+ */
+static void *mod_build(TALLOC_CTX *ctx, void *uctx)
+{
+	rlm_passwd_t *inst = uctx;
+	rlm_passwd_table_t *table;
+
+	table = talloc_zero(ctx, rlm_passwd_table_t);
+	if (!table) return NULL;
+
+	table->ht = build_hash_table(inst->filename, inst->nfields, inst->keyfield, inst->listable,
+				     inst->hash_size, inst->ignore_nislike, *inst->delimiter);
+	if (!table->ht) {
+		ERROR("rlm_passwd: failed reading file.");
+		talloc_free(table);
+		return NULL;
+	}
+	talloc_set_destructor(table, _passwd_table_free);
+
+	return table;
+}
+
+/*
+ *	Loading large files can take a while, so it's done as a
+ *	startup job, in parallel with the startup of other modules.
+ */
+static int mod_load(void *uctx)
+{
+	return fr_snapshot_load(uctx);
+}
+
 static int mod_instantiate(CONF_SECTION *conf, void *instance)
 {
 	int nfields=0, keyfield=-1, listable=0;
@@ -459,20 +508,12 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 			      inst->format);
 		return -1;
 	}
-	if (! (inst->ht = build_hash_table (inst->filename, nfields, keyfield, listable, inst->hash_size, inst->ignore_nislike, *inst->delimiter)) ){
-		ERROR("rlm_passwd: failed reading file.");
-		return -1;
-	}
 	if (! (inst->pwdfmt = mypasswd_malloc(inst->format, nfields, &len)) ){
 		ERROR("rlm_passwd: memory allocation failed");
-		release_ht(inst->ht);
-		inst->ht = NULL;
 		return -1;
 	}
 	if (!string_to_entry(inst->format, nfields, ':', inst->pwdfmt , len)) {
 		ERROR("rlm_passwd: unable to convert format entry");
-		release_ht(inst->ht);
-		inst->ht = NULL;
 		return -1;
 	}
 
@@ -487,14 +528,10 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 	}
 	if (!*inst->pwdfmt->field[keyfield]) {
 		cf_log_err_cs(conf, "key field is empty");
-		release_ht(inst->ht);
-		inst->ht = NULL;
 		return -1;
 	}
 	if (! (da = dict_attrbyname (inst->pwdfmt->field[keyfield])) ) {
 		ERROR("rlm_passwd: unable to resolve attribute: %s", inst->pwdfmt->field[keyfield]);
-		release_ht(inst->ht);
-		inst->ht = NULL;
 		return -1;
 	}
 	inst->keyattr = da;
@@ -502,17 +539,20 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 	inst->keyfield = keyfield;
 	inst->listable = listable;
 	DEBUG2("rlm_passwd: nfields: %d keyfield %d(%s) listable: %s", nfields, keyfield, inst->pwdfmt->field[keyfield], listable?"yes":"no");
-	return 0;
+
+	inst->name = cf_section_name2(conf);
+	if (!inst->name) inst->name = cf_section_name1(conf);
+
+	inst->snapshot = fr_snapshot_init(inst, inst->name, mod_build, inst, inst->check_interval);
+	if (!inst->snapshot || (fr_snapshot_watch(inst->snapshot, inst->filename) < 0)) return -1;
+
+	return module_job_add(mod_load, inst->snapshot);
 
 #undef inst
 }
 
 static int mod_detach (void *instance) {
 #define inst ((rlm_passwd_t *)instance)
-	if(inst->ht) {
-		release_ht(inst->ht);
-		inst->ht = NULL;
-	}
 	free(inst->pwdfmt);
 	return 0;
 #undef inst
@@ -545,12 +585,19 @@ static rlm_rcode_t CC_HINT(nonnull) mod_passwd_map(void *instance, REQUEST *requ
 	struct mypasswd * pw, *last_found;
 	vp_cursor_t cursor;
 	int found = 0;
+	rlm_passwd_table_t *table;
 
 	key = fr_pair_find_by_da(request->packet->vps, inst->keyattr, TAG_ANY);
 	if (!key) {
 		return RLM_MODULE_NOTFOUND;
 	}
 
+	/*
+	 *	The file may be reloaded while we're using it.
+	 */
+	table = fr_snapshot_acquire(inst->snapshot);
+	if (!table) return RLM_MODULE_FAIL;
+
 	for (i = fr_cursor_init(&cursor, &key);
 	     i;
 	     i = fr_cursor_next_by_num(&cursor, inst->keyattr->attr, inst->keyattr->vendor, TAG_ANY)) {
@@ -558,14 +605,14 @@ static rlm_rcode_t CC_HINT(nonnull) mod_passwd_map(void *instance, REQUEST *requ
 		 *	Ensure we have the string form of the attribute
 		 */
 		vp_prints_value(buffer, sizeof(buffer), i, 0);
-		if (!(pw = get_pw_nam(buffer, inst->ht, &last_found)) ) {
+		if (!(pw = get_pw_nam(buffer, table->ht, &last_found)) ) {
 			continue;
 		}
 		do {
 			addresult(request, inst, request, &request->config, pw, 0, "config");
 			addresult(request->reply, inst, request, &request->reply->vps, pw, 1, "reply_items");
 			addresult(request->packet, inst, request, &request->packet->vps, pw, 2, "request_items");
-		} while ((pw = get_next(buffer, inst->ht, &last_found)));
+		} while ((pw = get_next(buffer, table->ht, &last_found)));
 
 		found++;
 
@@ -574,6 +621,8 @@ static rlm_rcode_t CC_HINT(nonnull) mod_passwd_map(void *instance, REQUEST *requ
 		}
 	}
 
+	fr_snapshot_release(inst->snapshot, table);
+
 	if (!found) return RLM_MODULE_NOTFOUND;
 
 	return RLM_MODULE_OK;
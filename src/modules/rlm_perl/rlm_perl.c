@@ -79,11 +79,27 @@ typedef struct rlm_perl_t {
 
 #ifdef USE_ITHREADS
 	pthread_mutex_t	clone_mutex;
+	fr_connection_pool_t	*pool;		//!< Of interpreters shared by all threads.
+	uint32_t	num_interps;		//!< Number of interpreters cloned for the pool.
 #endif
 
 	HV		*rad_perlconf_hv;	//!< holds "config" items (perl %RAD_PERLCONF hash).
 
 } rlm_perl_t;
+
+#ifdef USE_ITHREADS
+/*
+ *	An interpreter in the pool, and how much it's been used.
+ */
+typedef struct rlm_perl_interp {
+	PerlInterpreter	*perl;
+	rlm_perl_t	*inst;
+	uint32_t	id;
+	uint64_t	calls;			//!< Number of functions called.
+	uint64_t	failed;			//!< Number of calls which returned fail.
+	uint64_t	usec;			//!< Total time spent in calls.
+} rlm_perl_interp_t;
+#endif
 /*
  *	A mapping of configuration file names to internal variables.
  */
@@ -234,18 +250,16 @@ static void rlm_perl_make_key(pthread_key_t *key)
 	pthread_key_create(key, (void (*)(void *))rlm_destroy_perl);
 }
 
-static PerlInterpreter *rlm_perl_clone(PerlInterpreter *perl, pthread_key_t *key)
+/*
+ *	Clone the parsed interpreter.  Must be called with the clone_mutex held.
+ */
+static PerlInterpreter *rlm_perl_clone_interp(PerlInterpreter *perl)
 {
-	int ret;
-
 	PerlInterpreter *interp;
 	UV clone_flags = 0;
 
 	PERL_SET_CONTEXT(perl);
 
-	interp = pthread_getspecific(*key);
-	if (interp) return interp;
-
 	interp = perl_clone(perl, clone_flags);
 	{
 		dTHXa(interp);
@@ -259,6 +273,22 @@ static PerlInterpreter *rlm_perl_clone(PerlInterpreter *perl, pthread_key_t *key
 	PERL_SET_CONTEXT(aTHX);
 	rlm_perl_clear_handles(aTHX);
 
+	return interp;
+}
+
+static PerlInterpreter *rlm_perl_clone(PerlInterpreter *perl, pthread_key_t *key)
+{
+	int ret;
+
+	PerlInterpreter *interp;
+
+	PERL_SET_CONTEXT(perl);
+
+	interp = pthread_getspecific(*key);
+	if (interp) return interp;
+
+	interp = rlm_perl_clone_interp(perl);
+
 	ret = pthread_setspecific(*key, interp);
 	if (ret != 0) {
 		DEBUG("rlm_perl: Failed associating interpretor with thread %s", fr_syserror(ret));
@@ -269,6 +299,91 @@ static PerlInterpreter *rlm_perl_clone(PerlInterpreter *perl, pthread_key_t *key
 
 	return interp;
 }
+
+/*
+ *	Destroy a pooled interpreter, saying how much it was used.
+ */
+static int _mod_conn_free(rlm_perl_interp_t *interp)
+{
+	DEBUG2("rlm_perl (%s): Interpreter %u made %" PRIu64 " calls (%" PRIu64 " failed), "
+	       "average %" PRIu64 "us per call", interp->inst->xlat_name, interp->id, interp->calls, interp->failed,
+	       interp->calls ? (interp->usec / interp->calls) : 0);
+
+	rlm_destroy_perl(interp->perl);
+
+	return 0;
+}
+
+/*
+ *	Clone an interpreter for the pool
+ */
+static void *mod_conn_create(TALLOC_CTX *ctx, void *instance)
+{
+	rlm_perl_t		*inst = instance;
+	rlm_perl_interp_t	*interp;
+
+	interp = talloc_zero(ctx, rlm_perl_interp_t);
+	interp->inst = inst;
+
+	pthread_mutex_lock(&inst->clone_mutex);
+	interp->perl = rlm_perl_clone_interp(inst->perl);
+	interp->id = inst->num_interps++;
+	pthread_mutex_unlock(&inst->clone_mutex);
+
+	talloc_set_destructor(interp, _mod_conn_free);
+
+	DEBUG2("rlm_perl (%s): Cloned interpreter %u", inst->xlat_name, interp->id);
+
+	return interp;
+}
+
+/*
+ *	Get an interpreter to use, either from the pool, or the
+ *	one cloned for this thread.
+ */
+static PerlInterpreter *rlm_perl_get(rlm_perl_t *inst, REQUEST *request, rlm_perl_interp_t **pooled,
+				     struct timeval *start)
+{
+	PerlInterpreter *interp;
+
+	*pooled = NULL;
+
+	if (inst->pool) {
+		*pooled = fr_connection_get(inst->pool);
+		if (!*pooled) {
+			REDEBUG("No Perl interpreters available");
+			return NULL;
+		}
+
+		RDEBUG3("Using interpreter %u", (*pooled)->id);
+		gettimeofday(start, NULL);
+
+		return (*pooled)->perl;
+	}
+
+	pthread_mutex_lock(&inst->clone_mutex);
+	interp = rlm_perl_clone(inst->perl, inst->thread_key);
+	pthread_mutex_unlock(&inst->clone_mutex);
+
+	return interp;
+}
+
+/*
+ *	Return a pooled interpreter, and update its statistics.
+ */
+static void rlm_perl_release(rlm_perl_t *inst, rlm_perl_interp_t *pooled, struct timeval const *start, bool failed)
+{
+	struct timeval now;
+
+	if (!pooled) return;
+
+	gettimeofday(&now, NULL);
+	pooled->calls++;
+	if (failed) pooled->failed++;
+	pooled->usec += ((now.tv_sec - start->tv_sec) * 1000000) + (now.tv_usec - start->tv_usec);
+
+	fr_connection_release(inst->pool, pooled);
+}
 #endif
 
 /*
@@ -360,15 +475,16 @@ static ssize_t perl_xlat(void *instance, REQUEST *request, char const *fmt, char
 	STRLEN		n_a;
 
 #ifdef USE_ITHREADS
-	PerlInterpreter *interp;
+	PerlInterpreter		*interp;
+	rlm_perl_interp_t	*pooled;
+	struct timeval		start;
 
-	pthread_mutex_lock(&inst->clone_mutex);
-	interp = rlm_perl_clone(inst->perl, inst->thread_key);
+	interp = rlm_perl_get(inst, request, &pooled, &start);
+	if (!interp) return -1;
 	{
 		dTHXa(interp);
 		PERL_SET_CONTEXT(interp);
 	}
-	pthread_mutex_unlock(&inst->clone_mutex);
 #else
 	PERL_SET_CONTEXT(inst->perl);
 #endif
@@ -426,6 +542,10 @@ static ssize_t perl_xlat(void *instance, REQUEST *request, char const *fmt, char
 
 	}
 
+#ifdef USE_ITHREADS
+	rlm_perl_release(inst, pooled, &start, false);
+#endif
+
 	return ret;
 }
 
@@ -498,12 +618,10 @@ static int mod_bootstrap(CONF_SECTION *conf, void *instance)
 {
 	rlm_perl_t	*inst = instance;
 
-	char const	*xlat_name;
-
-	xlat_name = cf_section_name2(conf);
-	if (!xlat_name) xlat_name = cf_section_name1(conf);
+	inst->xlat_name = cf_section_name2(conf);
+	if (!inst->xlat_name) inst->xlat_name = cf_section_name1(conf);
 
-	xlat_register(xlat_name, perl_xlat, NULL, inst);
+	xlat_register(inst->xlat_name, perl_xlat, NULL, inst);
 
 	return 0;
 }
@@ -617,6 +735,19 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 
 	PL_endav = end_AV;
 
+	/*
+	 *	Share a pool of interpreters between the threads,
+	 *	instead of cloning one for each thread.
+	 */
+	if (cf_section_sub_find(conf, "pool")) {
+#ifdef USE_ITHREADS
+		inst->pool = fr_connection_pool_module_init(conf, inst, mod_conn_create, NULL, NULL);
+		if (!inst->pool) return -1;
+#else
+		WARN("rlm_perl (%s): Perl was built without ithreads, ignoring \"pool\"", inst->xlat_name);
+#endif
+	}
+
 	return 0;
 }
 
@@ -848,17 +979,16 @@ static int do_perl(void *instance, REQUEST *request, char const *function_name)
 	if (!function_name) return RLM_MODULE_FAIL;
 
 #ifdef USE_ITHREADS
-	pthread_mutex_lock(&inst->clone_mutex);
-
-	PerlInterpreter *interp;
+	PerlInterpreter		*interp;
+	rlm_perl_interp_t	*pooled;
+	struct timeval		start;
 
-	interp = rlm_perl_clone(inst->perl,inst->thread_key);
+	interp = rlm_perl_get(inst, request, &pooled, &start);
+	if (!interp) return RLM_MODULE_FAIL;
 	{
 		dTHXa(interp);
 		PERL_SET_CONTEXT(interp);
 	}
-
-	pthread_mutex_unlock(&inst->clone_mutex);
 #else
 	PERL_SET_CONTEXT(inst->perl);
 #endif
@@ -1003,6 +1133,11 @@ static int do_perl(void *instance, REQUEST *request, char const *function_name)
 #endif
 
 	}
+
+#ifdef USE_ITHREADS
+	rlm_perl_release(inst, pooled, &start, (exitstatus == RLM_MODULE_FAIL));
+#endif
+
 	return exitstatus;
 }
 
@@ -1080,6 +1215,13 @@ static int mod_detach(void *instance)
 	rlm_perl_t	*inst = (rlm_perl_t *) instance;
 	int 		exitstatus = 0, count = 0;
 
+#ifdef USE_ITHREADS
+	/*
+	 *	The pooled interpreters are clones of the main one,
+	 *	so have to be destroyed first.
+	 */
+	fr_connection_pool_free(inst->pool);
+#endif
 
 	if (inst->perl_parsed) {
 		dTHXa(inst->perl);
@@ -169,6 +169,11 @@ static void alvarion_vsa_hack(VALUE_PAIR *vp)
 	int number = 1;
 	vp_cursor_t cursor;
 
+	/*
+	 *	Renumbering attributes invalidates the index.
+	 */
+	fr_pair_list_unindex(vp);
+
 	for (vp = fr_cursor_init(&cursor, &vp);
 	     vp;
 	     vp = fr_cursor_next(&cursor)) {
@@ -103,6 +103,11 @@ typedef struct rlm_python_t {
  *
  * Multiple instances of python create multiple interpreters and each
  * thread must have a PyThreadState per interpreter, to track execution.
+ *
+ * @note Unlike rlm_perl, there's no pool of these shared between threads.
+ *	A PyThreadState may only be used by the thread which created it,
+ *	and every call holds the GIL, so a pool couldn't run more calls at
+ *	once, only bound how many thread states exist.
  */
 typedef struct python_thread_state {
 	PyThreadState		*state;		//!< Module instance/thread specific state.
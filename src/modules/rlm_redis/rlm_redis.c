@@ -327,7 +327,7 @@ extern module_t rlm_redis;
 module_t rlm_redis = {
 	.magic		= RLM_MODULE_INIT,
 	.name		= "redis",
-	.type		= RLM_TYPE_THREAD_SAFE,
+	.type		= RLM_TYPE_THREAD_SAFE | RLM_TYPE_PARALLEL_START,
 	.inst_size	= sizeof(REDIS_INST),
 	.config		= module_config,
 	.bootstrap	= mod_bootstrap,
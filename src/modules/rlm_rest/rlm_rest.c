@@ -970,7 +970,7 @@ extern module_t rlm_rest;
 module_t rlm_rest = {
 	.magic		= RLM_MODULE_INIT,
 	.name		= "rest",
-	.type		= RLM_TYPE_THREAD_SAFE,
+	.type		= RLM_TYPE_THREAD_SAFE | RLM_TYPE_PARALLEL_START,
 	.inst_size	= sizeof(rlm_rest_t),
 	.config		= module_config,
 	.bootstrap	= mod_bootstrap,
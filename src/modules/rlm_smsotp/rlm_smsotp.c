@@ -329,7 +329,7 @@ extern module_t rlm_smsotp;
 module_t rlm_smsotp = {
 	.magic		= RLM_MODULE_INIT,
 	.name		= "smsotp",
-	.type		= RLM_TYPE_THREAD_SAFE,
+	.type		= RLM_TYPE_THREAD_SAFE | RLM_TYPE_PARALLEL_START,
 	.inst_size	= sizeof(rlm_smsotp_t),
 	.config		= module_config,
 	.instantiate	= mod_instantiate,
@@ -440,7 +440,7 @@ extern module_t rlm_yubikey;
 module_t rlm_yubikey = {
 	.magic		= RLM_MODULE_INIT,
 	.name		= "yubikey",
-	.type		= RLM_TYPE_THREAD_SAFE,
+	.type		= RLM_TYPE_THREAD_SAFE | RLM_TYPE_PARALLEL_START,
 	.inst_size	= sizeof(rlm_yubikey_t),
 	.config		= module_config,
 	.bootstrap	= mod_bootstrap,
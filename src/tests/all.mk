@@ -1,4 +1,4 @@
-SUBMAKEFILES := rbmonkey.mk unit/all.mk map/all.mk xlat/all.mk keywords/all.mk auth/all.mk modules/all.mk
+SUBMAKEFILES := rbmonkey.mk cache_serialize.mk dict_cache.mk dict_index.mk pair_index.mk rad_verify.mk mschap_des.mk log_async.mk snapshot_reload.mk exfile_buffer.mk detail_window.mk ippool_mmap.mk xlat_expand.mk unit/all.mk map/all.mk xlat/all.mk raddetail/all.mk keywords/all.mk auth/all.mk modules/all.mk
 
 #
 #  Include all of the autoconf definitions into the Make variable space
@@ -10,3 +10,45 @@ SUBMAKEFILES := rbmonkey.mk unit/all.mk map/all.mk xlat/all.mk keywords/all.mk a
 #
 $(BUILD_DIR)/tests/keywords/autoconf.h.mk: src/include/autoconf.h
 	@grep '^#define' $^ | sed 's/#define /AC_/;s/ / := /' > $@
+
+#
+#  Programs which check one piece of functionality, and exit with
+#  a non-zero status if a check fails.
+#
+TESTS.PROGS := cache_serialize dict_cache dict_index pair_index rad_verify mschap_des log_async snapshot_reload exfile_buffer detail_window ippool_mmap xlat_expand
+
+#
+#  Only built along with the module, as they need its headers.
+#
+ifneq "$(findstring rlm_ldap.la,$(ALL_TGTS))" ""
+SUBMAKEFILES += ldap_mux.mk ldap_group_cache.mk
+TESTS.PROGS += ldap_mux ldap_group_cache
+endif
+
+.PHONY: $(BUILD_DIR)/tests/progs
+$(BUILD_DIR)/tests/progs:
+	@mkdir -p $@
+
+$(BUILD_DIR)/tests/progs/%: $(TESTBINDIR)/% | $(BUILD_DIR)/tests/progs
+	@echo PROG-TEST $(notdir $@)
+	@if ! $(TESTBIN)/$(notdir $@) -D share > $@.log 2>&1; then \
+		cat $@.log; \
+		echo "$(TESTBIN)/$(notdir $@) -D share"; \
+		exit 1; \
+	fi
+	@touch $@
+
+tests.progs: $(addprefix $(BUILD_DIR)/tests/progs/,$(TESTS.PROGS))
+
+#
+#  The same programs time what they check when given "-b".  The
+#  results depend on the machine, so "make test" doesn't run them.
+#
+TESTS.BENCH := cache_serialize dict_index pair_index rad_verify mschap_des xlat_expand
+
+.PHONY: tests.bench
+tests.bench: $(addprefix $(TESTBINDIR)/,$(TESTS.BENCH))
+	@for x in $(TESTS.BENCH); do \
+		echo BENCH $$x; \
+		$(TESTBIN)/$$x -D share -b || exit 1; \
+	done
@@ -0,0 +1,322 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file cache_serialize.c
+ * @brief Check the rlm_cache text and binary serialization formats.
+ *
+ * Round trips a representative cache entry through both formats, checking the
+ * decoded attributes match the originals, and that truncated binary entries
+ * are rejected.  With -b, also reports the size of each encoding and how
+ * many entries per second can be encoded and decoded.
+ *
+ * @copyright 2015 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/radiusd.h>
+
+#include "../modules/rlm_cache/rlm_cache.h"
+#include "../modules/rlm_cache/serialize.h"
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+#include <sys/wait.h>
+#ifdef HAVE_PTHREAD_H
+pid_t rad_fork(void)
+{
+	return fork();
+}
+
+pid_t rad_waitpid(pid_t pid, int *status)
+{
+	return waitpid(pid, status, 0);
+}
+#endif
+
+/*
+ *	Roughly what a cache of an LDAP/SQL user profile looks like.
+ */
+static char const *entry_control = "Cleartext-Password := 'hello', Simultaneous-Use := 1, "
+				   "Auth-Type := Accept";
+
+static char const *entry_request = "Called-Station-Id = '00-11-22-33-44-55:corp', "
+				   "NAS-IP-Address = 192.0.2.1";
+
+static char const *entry_reply = "Framed-IP-Address = 10.0.0.1, Framed-IP-Netmask = 255.255.255.0, "
+				 "Session-Timeout = 86400, Idle-Timeout = 600, Acct-Interim-Interval = 300, "
+				 "Class = 0x466f6f426172426177, Reply-Message = 'Welcome to the network', "
+				 "Framed-Route = '192.0.2.0/24 10.0.0.254 1', "
+				 "Tunnel-Type:1 = VLAN, Tunnel-Medium-Type:1 = IEEE-802, "
+				 "Tunnel-Private-Group-Id:1 = '100', "
+				 "Cisco-AVPair = 'ip:addr-pool=corp', Cisco-AVPair = 'ip:dns-servers=192.0.2.53', "
+				 "WISPr-Bandwidth-Max-Up = 1000000, WISPr-Bandwidth-Max-Down = 8000000, "
+				 "Framed-IPv6-Prefix = 2001:db8::/64";
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: cache_serialize [OPTS]\n");
+	fprintf(stderr, "  -b                     Time encoding and decoding each format.\n");
+	fprintf(stderr, "  -D <dictdir>           Set main dictionary directory (defaults to " DICTDIR ").\n");
+	fprintf(stderr, "  -n <iterations>        Number of times to encode and decode each format with -b.\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(1);
+}
+
+static rlm_cache_entry_t *entry_alloc(TALLOC_CTX *ctx)
+{
+	rlm_cache_entry_t *c;
+
+	c = talloc_zero(ctx, rlm_cache_entry_t);
+	c->key = talloc_typed_strdup(c, "bob");
+	c->created = 1420070400;
+	c->expires = c->created + 3600;
+
+	if ((fr_pair_list_afrom_str(c, entry_control, &c->control) == T_INVALID) ||
+	    (fr_pair_list_afrom_str(c, entry_request, &c->packet) == T_INVALID) ||
+	    (fr_pair_list_afrom_str(c, entry_reply, &c->reply) == T_INVALID)) {
+		fr_perror("cache_serialize");
+		exit(1);
+	}
+
+	return c;
+}
+
+static unsigned int entry_count(rlm_cache_entry_t *c)
+{
+	VALUE_PAIR	*lists[] = { c->control, c->packet, c->reply, c->state };
+	vp_cursor_t	cursor;
+	unsigned int	i, count = 0;
+
+	for (i = 0; i < sizeof(lists) / sizeof(*lists); i++) {
+		VALUE_PAIR *vp;
+
+		for (vp = fr_cursor_init(&cursor, &lists[i]); vp; vp = fr_cursor_next(&cursor)) count++;
+	}
+
+	return count;
+}
+
+static int entry_cmp(char const *name, rlm_cache_entry_t *a, rlm_cache_entry_t *b)
+{
+	if ((a->created != b->created) || (a->expires != b->expires) ||
+	    (fr_pair_list_cmp(a->control, b->control) != 0) ||
+	    (fr_pair_list_cmp(a->packet, b->packet) != 0) ||
+	    (fr_pair_list_cmp(a->reply, b->reply) != 0) ||
+	    (fr_pair_list_cmp(a->state, b->state) != 0)) {
+		fprintf(stderr, "%s: decoded entry does not match the original\n", name);
+		return -1;
+	}
+
+	return 0;
+}
+
+static double elapsed(struct timeval *start)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+
+	return (now.tv_sec - start->tv_sec) + ((now.tv_usec - start->tv_usec) / 1000000.0);
+}
+
+static void report(char const *name, size_t len, int iterations, double encode, double decode)
+{
+	printf("%-8s %6zu bytes  %10.0f encodes/s  %10.0f decodes/s\n", name, len,
+	       iterations / encode, iterations / decode);
+}
+
+/** Time encoding and decoding an entry in both formats
+ *
+ */
+static int bench(TALLOC_CTX *ctx, rlm_cache_entry_t *entry, char const *text, size_t text_len,
+		 uint8_t const *binary, size_t binary_len, int iterations)
+{
+	int			i;
+	struct timeval		start;
+	double			encode, decode;
+	rlm_cache_entry_t	*decoded;
+
+	/*
+	 *	Text format
+	 */
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++) {
+		char *out;
+
+		if (cache_serialize(ctx, &out, entry) < 0) return -1;
+		talloc_free(out);
+	}
+	encode = elapsed(&start);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++) {
+		char *copy;
+
+		/*
+		 *	The text deserializer modifies its input.
+		 */
+		copy = talloc_memdup(ctx, text, text_len + 1);
+		decoded = talloc_zero(ctx, rlm_cache_entry_t);
+		if (cache_deserialize(decoded, copy, text_len) < 0) return -1;
+		talloc_free(decoded);
+		talloc_free(copy);
+	}
+	decode = elapsed(&start);
+
+	report("text", text_len, iterations, encode, decode);
+
+	/*
+	 *	Binary format
+	 */
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++) {
+		uint8_t *out;
+
+		if (cache_serialize_binary(ctx, &out, entry) < 0) return -1;
+		talloc_free(out);
+	}
+	encode = elapsed(&start);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++) {
+		decoded = talloc_zero(ctx, rlm_cache_entry_t);
+		if (cache_deserialize_binary(decoded, binary, binary_len) < 0) return -1;
+		talloc_free(decoded);
+	}
+	decode = elapsed(&start);
+
+	report("binary", binary_len, iterations, encode, decode);
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int			c, iterations = 100000;
+	bool			do_bench = false;
+	size_t			i;
+	char const		*dict_dir = DICTDIR;
+
+	TALLOC_CTX		*ctx;
+	rlm_cache_entry_t	*entry, *decoded;
+
+	char			*text, *copy;
+	uint8_t			*binary;
+	ssize_t			binary_len;
+	size_t			text_len;
+
+	while ((c = getopt(argc, argv, "bD:n:xh")) != EOF) switch (c) {
+		case 'b':
+			do_bench = true;
+			break;
+		case 'D':
+			dict_dir = optarg;
+			break;
+		case 'n':
+			iterations = atoi(optarg);
+			if (iterations <= 0) usage();
+			break;
+		case 'x':
+			fr_debug_lvl++;
+			rad_debug_lvl = fr_debug_lvl;
+			break;
+		case 'h':
+		default:
+			usage();
+	}
+
+	if (fr_check_lib_magic(RADIUSD_MAGIC_NUMBER) < 0) {
+		fr_perror("cache_serialize");
+		return 1;
+	}
+
+	if (dict_init(dict_dir, RADIUS_DICTIONARY) < 0) {
+		fr_perror("cache_serialize");
+		return 1;
+	}
+
+	ctx = talloc_init("cache_serialize");
+	entry = entry_alloc(ctx);
+
+	/*
+	 *	Text format.  The deserializer modifies its input.
+	 */
+	if (cache_serialize(ctx, &text, entry) < 0) {
+		fr_perror("cache_serialize");
+		return 1;
+	}
+	text_len = talloc_array_length(text) - 1;
+
+	decoded = talloc_zero(ctx, rlm_cache_entry_t);
+	copy = talloc_memdup(ctx, text, text_len + 1);
+	if ((cache_deserialize(decoded, copy, text_len) < 0) || (entry_cmp("text", entry, decoded) < 0)) {
+		fr_perror("cache_serialize");
+		return 1;
+	}
+	talloc_free(decoded);
+	talloc_free(copy);
+
+	/*
+	 *	Binary format, which cache_deserialize() recognises by
+	 *	its first byte.
+	 */
+	binary_len = cache_serialize_binary(ctx, &binary, entry);
+	if (binary_len < 0) {
+		fr_perror("cache_serialize");
+		return 1;
+	}
+
+	decoded = talloc_zero(ctx, rlm_cache_entry_t);
+	if ((cache_deserialize(decoded, (char *)binary, binary_len) < 0) ||
+	    (entry_cmp("binary", entry, decoded) < 0)) {
+		fr_perror("cache_serialize");
+		return 1;
+	}
+	talloc_free(decoded);
+
+	/*
+	 *	Entries which have been cut short must never be read
+	 *	past their end.  There's no count of attributes, so
+	 *	ones cut between attributes decode to fewer of them.
+	 */
+	for (i = 0; i < (size_t) binary_len; i++) {
+		uint8_t *truncated;
+
+		decoded = talloc_zero(ctx, rlm_cache_entry_t);
+		truncated = talloc_memdup(decoded, binary, i);
+		if ((cache_deserialize_binary(decoded, truncated, i) == 0) &&
+		    (entry_count(decoded) >= entry_count(entry))) {
+			fprintf(stderr, "binary: entry truncated to %zu bytes decoded all attributes\n", i);
+			return 1;
+		}
+		talloc_free(decoded);
+	}
+
+	if (do_bench && (bench(ctx, entry, text, text_len, binary, binary_len, iterations) < 0)) {
+		fr_perror("cache_serialize");
+		return 1;
+	}
+
+	talloc_free(ctx);
+	dict_free();
+
+	return 0;
+}
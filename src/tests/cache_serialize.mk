@@ -0,0 +1,6 @@
+TARGET		:= cache_serialize
+SOURCES		:= cache_serialize.c ../modules/rlm_cache/serialize.c
+
+TGT_PREREQS	:= libfreeradius-server.a libfreeradius-radius.a
+TGT_LDLIBS	:= $(LIBS)
+TGT_INSTALLDIR	:=
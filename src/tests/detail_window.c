@@ -0,0 +1,402 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file detail_window.c
+ * @brief Check that the detail reader replays a file exactly once with a window.
+ *
+ * Includes src/main/detail.c, and plays the part of the main thread: it reads
+ * the packets the reader thread sends, and answers them in batches, newest
+ * first, so entries are done out of order.  Every entry in the file must be
+ * sent exactly once, more than one must be in flight at a time, and the work
+ * file must be removed when it's done.  This is done with and without
+ * "track", and for a binary file, where reading must start from the
+ * checkpoint, and skip a corrupted record, and one which is already done.
+ *
+ * @copyright 2015 The FreeRADIUS server project
+ */
+#include "../main/detail.c"
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#define MAX_BATCH	(64)
+
+/*
+ *	Entries in the binary file.
+ */
+#define CHECKPOINT_ENTRY	(10)	//!< The first entry after the checkpoint.
+#define CORRUPT_ENTRY		(20)	//!< Fails its hash.
+#define DONE_ENTRY		(30)	//!< Marked as done by the reader.
+
+#ifdef HAVE_PTHREAD_H
+pid_t rad_fork(void)
+{
+	return fork();
+}
+
+pid_t rad_waitpid(pid_t pid, int *status)
+{
+	return waitpid(pid, status, 0);
+}
+#endif
+
+/*
+ *	The packets are never passed to the rest of the server.
+ */
+int rad_accounting(UNUSED REQUEST *request)
+{
+	rad_assert(0 == 1);
+	return 0;
+}
+
+int rad_coa_recv(UNUSED REQUEST *request)
+{
+	rad_assert(0 == 1);
+	return 0;
+}
+
+int request_receive(UNUSED TALLOC_CTX *ctx, UNUSED rad_listen_t *listener, UNUSED RADIUS_PACKET *packet,
+		    UNUSED RADCLIENT *client, UNUSED RAD_REQUEST_FUNP fun)
+{
+	rad_assert(0 == 1);
+	return 0;
+}
+
+void radius_signal_self(UNUSED int flag)
+{
+	rad_assert(0 == 1);
+}
+
+#define CHECK(_x) do { \
+	if (!(_x)) { \
+		fprintf(stderr, "detail_window: %s[%u]: Check \"%s\" failed\n", __FILE__, __LINE__, #_x); \
+		exit(1); \
+	} \
+} while (0)
+
+static char	dir[] = "/tmp/detail_window.XXXXXX";
+static int	entries = 1000;
+
+#ifdef WITH_DETAIL_THREAD
+/*
+ *	detail_free() interrupts the reader thread with SIGTERM.
+ */
+static void sig_ignore(UNUSED int sig)
+{
+}
+
+static void write_detail(char const *filename)
+{
+	FILE	*fp;
+	int	i;
+
+	fp = fopen(filename, "w");
+	CHECK(fp != NULL);
+
+	for (i = 0; i < entries; i++) {
+		fprintf(fp, "Sun Oct 18 12:00:00 2015\n"
+			"\tAcct-Session-Id = \"%d\"\n"
+			"\tAcct-Status-Type = Start\n"
+			"\tUser-Name = \"bob\"\n"
+			"\tTimestamp = %d\n"
+			"\n", i, 1445169600 + i);
+	}
+
+	CHECK(fclose(fp) == 0);
+}
+
+/** Write a binary detail file, as rlm_detail does, then damage it
+ *
+ * @param[in] filename to write.
+ * @param[out] expect which entries should be sent.
+ * @return the number of entries which should be sent.
+ */
+static int write_binary(char const *filename, uint8_t *expect)
+{
+	uint8_t		header[DETAIL_BINARY_HEADER_LEN], *record;
+	char		number[16];
+	ssize_t		len;
+	off_t		offset = DETAIL_BINARY_HEADER_LEN, checkpoint = 0;
+	RADIUS_PACKET	*packet;
+	int		fd, i, expected = 0;
+
+	fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	CHECK(fd >= 0);
+
+	detail_binary_header(header);
+	CHECK(write(fd, header, sizeof(header)) == sizeof(header));
+
+	for (i = 0; i < entries; i++) {
+		packet = rad_alloc(NULL, false);
+		CHECK(packet != NULL);
+		packet->code = PW_CODE_ACCOUNTING_REQUEST;
+
+		snprintf(number, sizeof(number), "%d", i);
+		CHECK(fr_pair_make(packet, &packet->vps, "Acct-Session-Id", number, T_OP_EQ) != NULL);
+		CHECK(fr_pair_make(packet, &packet->vps, "Acct-Status-Type", "Start", T_OP_EQ) != NULL);
+
+		len = detail_binary_encode(packet, &record, packet, packet->vps, false, 1445169600 + i);
+		CHECK(len > 0);
+
+		if (i == CHECKPOINT_ENTRY) checkpoint = offset;
+		if (i == CORRUPT_ENTRY) record[len - 1] ^= 0xff;
+		if (i == DONE_ENTRY) record[DETAIL_BINARY_FLAGS_OFFSET] |= DETAIL_BINARY_DONE;
+
+		CHECK(write(fd, record, len) == len);
+		offset += len;
+
+		expect[i] = (i >= CHECKPOINT_ENTRY) && (i != CORRUPT_ENTRY) && (i != DONE_ENTRY);
+		if (expect[i]) expected++;
+
+		talloc_free(packet);
+	}
+
+	CHECK(checkpoint != 0);
+	CHECK(detail_binary_checkpoint_write(fd, checkpoint, 1) == 0);
+	CHECK(close(fd) == 0);
+
+	return expected;
+}
+
+/** Answer a packet, as the main thread does once a request is done
+ *
+ */
+static void answer(rad_listen_t *listener, RADIUS_PACKET *packet)
+{
+	REQUEST *request;
+
+	request = request_alloc(NULL);
+	CHECK(request != NULL);
+
+	request->listener = listener;
+	request->packet = talloc_steal(request, packet);
+	request->reply = rad_alloc(request, false);
+	CHECK(request->reply != NULL);
+	request->reply->code = PW_CODE_ACCOUNTING_RESPONSE;
+
+	CHECK(detail_send(listener, request) == 0);
+
+	talloc_free(request);
+}
+
+/** Wait for a packet from the reader thread
+ *
+ * @return the packet, or NULL if none was sent within timeout milliseconds.
+ */
+static RADIUS_PACKET *next_packet(listen_detail_t *data, int timeout)
+{
+	struct pollfd	pfd;
+	RADIUS_PACKET	*packet;
+
+	pfd.fd = data->master_pipe[0];
+	pfd.events = POLLIN;
+
+	if (poll(&pfd, 1, timeout) <= 0) return NULL;
+
+	CHECK(read(data->master_pipe[0], &packet, sizeof(packet)) == sizeof(packet));
+	CHECK(packet != NULL);
+
+	return packet;
+}
+
+/** Replay the detail file, checking that only the expected entries are sent
+ *
+ */
+static void replay(char const *filename, bool track, uint8_t const *expect, int expected)
+{
+	CONF_SECTION	*cs;
+	rad_listen_t	*listener;
+	listen_detail_t	*data;
+	char		work[PATH_MAX];
+	RADIUS_PACKET	*batch[MAX_BATCH], *held = NULL;
+	VALUE_PAIR	*vp;
+	uint8_t		*sent;
+	int		i, num, number, answered = 0, max_batch = 0;
+	time_t		start;
+	struct stat	st;
+
+	snprintf(work, sizeof(work), "%s/detail.work", dir);
+
+	cs = cf_section_alloc(NULL, "listen", NULL);
+	CHECK(cs != NULL);
+	cf_pair_add(cs, cf_pair_alloc(cs, "filename", filename, T_OP_EQ, T_BARE_WORD, T_SINGLE_QUOTED_STRING));
+	cf_pair_add(cs, cf_pair_alloc(cs, "window", "32", T_OP_EQ, T_BARE_WORD, T_BARE_WORD));
+	cf_pair_add(cs, cf_pair_alloc(cs, "track", track ? "yes" : "no", T_OP_EQ, T_BARE_WORD, T_BARE_WORD));
+
+	listener = talloc_zero(NULL, rad_listen_t);
+	CHECK(listener != NULL);
+	listener->send = detail_send;
+	listener->data = data = talloc_zero(listener, listen_detail_t);
+	CHECK(data != NULL);
+
+	sent = talloc_zero_array(NULL, uint8_t, entries);
+	CHECK(sent != NULL);
+
+	CHECK(detail_parse(cs, listener) == 0);
+	CHECK(data->win != NULL);
+
+	/*
+	 *	Take everything which is sent in one go, then answer
+	 *	it newest first.  The oldest packet is held until the
+	 *	next batch has been answered, so the start of the
+	 *	window waits for it while later entries are done.
+	 */
+	start = time(NULL);
+	while (answered < expected) {
+		CHECK(time(NULL) < (start + 60));
+
+		num = 0;
+		while (num < MAX_BATCH) {
+			batch[num] = next_packet(data, num ? 20 : 1000);
+			if (!batch[num]) break;
+			num++;
+		}
+		if (num > max_batch) max_batch = num;
+
+		for (i = num - 1; i >= 0; i--) {
+			vp = fr_pair_find_by_num(batch[i]->vps, PW_ACCT_SESSION_ID, 0, TAG_ANY);
+			CHECK(vp != NULL);
+			number = atoi(vp->vp_strvalue);
+			CHECK((number >= 0) && (number < entries));
+
+			CHECK(expect[number] && !sent[number]);
+			sent[number] = 1;
+
+			vp = fr_pair_find_by_num(batch[i]->vps, PW_PACKET_TRANSMIT_COUNTER, 0, TAG_ANY);
+			CHECK(vp && (vp->vp_integer == 1));
+
+			if (i > 0) {
+				answer(listener, batch[i]);
+				answered++;
+			}
+		}
+
+		if (held) {
+			answer(listener, held);
+			answered++;
+			held = NULL;
+		}
+		if (num) held = batch[0];
+	}
+
+	CHECK(max_batch > 1);
+
+	/*
+	 *	The work file is removed once every entry is done,
+	 *	and nothing is sent again.
+	 */
+	for (i = 0; (i < 100) && (stat(work, &st) == 0); i++) usleep(100000);
+	CHECK(stat(work, &st) < 0);
+	CHECK(stat(filename, &st) < 0);
+	CHECK(next_packet(data, 500) == NULL);
+
+	for (i = 0; i < entries; i++) CHECK(sent[i] == expect[i]);
+	CHECK(data->counter == (uint32_t) expected);
+
+	detail_free(listener);
+
+	talloc_free(sent);
+	talloc_free(listener);
+	talloc_free(cs);
+}
+
+static void test_text(bool track)
+{
+	char	filename[PATH_MAX];
+	uint8_t	*expect;
+
+	expect = talloc_array(NULL, uint8_t, entries);
+	CHECK(expect != NULL);
+	memset(expect, 1, entries);
+
+	snprintf(filename, sizeof(filename), "%s/detail", dir);
+	write_detail(filename);
+	replay(filename, track, expect, entries);
+
+	talloc_free(expect);
+}
+
+static void test_binary(void)
+{
+	char	filename[PATH_MAX];
+	uint8_t	*expect;
+	int	expected;
+
+	expect = talloc_array(NULL, uint8_t, entries);
+	CHECK(expect != NULL);
+
+	snprintf(filename, sizeof(filename), "%s/detail", dir);
+	expected = write_binary(filename, expect);
+	replay(filename, true, expect, expected);
+
+	talloc_free(expect);
+}
+#endif
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: detail_window [OPTS]\n");
+	fprintf(stderr, "  -D <dictdir>           Set main dictionary directory (defaults to " DICTDIR ").\n");
+	fprintf(stderr, "  -n <entries>           Number of entries in the detail file.\n");
+
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int		c;
+	char const	*dict_dir = DICTDIR;
+
+	while ((c = getopt(argc, argv, "D:n:h")) != EOF) switch (c) {
+		case 'D':
+			dict_dir = optarg;
+			break;
+		case 'n':
+			entries = atoi(optarg);
+			if (entries <= DONE_ENTRY) usage();
+			break;
+		case 'h':
+		default:
+			usage();
+	}
+
+#ifdef WITH_DETAIL_THREAD
+	default_log.dst = L_DST_NULL;
+	signal(SIGTERM, sig_ignore);
+
+	if (dict_init(dict_dir, RADIUS_DICTIONARY) < 0) {
+		fr_perror("detail_window");
+		return 1;
+	}
+
+	CHECK(mkdtemp(dir) != NULL);
+
+	test_text(false);
+	test_text(true);
+	test_binary();
+
+	CHECK(rmdir(dir) == 0);
+#endif
+
+	return 0;
+}
@@ -0,0 +1,6 @@
+TARGET		:= detail_window
+SOURCES		:= detail_window.c
+
+TGT_PREREQS	:= libfreeradius-server.a libfreeradius-radius.a
+TGT_LDLIBS	:= $(LIBS)
+TGT_INSTALLDIR	:=
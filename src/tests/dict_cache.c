@@ -0,0 +1,215 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file dict_cache.c
+ * @brief Check that the compiled dictionaries are rebuilt when they're out of date.
+ *
+ * Reads a dictionary from a temporary directory with FR_DICT_CACHE_DIR set,
+ * and checks the compiled copy is used while nothing changes, and rebuilt
+ * when a dictionary changes, or an optional dictionary is created.  Also
+ * checks that a corrupt copy is ignored, and that nothing is written
+ * anywhere if FR_DICT_CACHE_DIR isn't set.
+ *
+ * @copyright 2015 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+#include <sys/stat.h>
+#include <dirent.h>
+#include <utime.h>
+
+#define CHECK(_x) do { \
+	if (!(_x)) { \
+		fprintf(stderr, "dict_cache: %s[%u]: Check \"%s\" failed\n", __FILE__, __LINE__, #_x); \
+		exit(1); \
+	} \
+} while (0)
+
+static char dict_dir[] = "/tmp/dict_cache.dict.XXXXXX";
+static char cache_dir[] = "/tmp/dict_cache.cache.XXXXXX";
+
+/** Write a dictionary, making sure its mtime changes
+ *
+ */
+static void write_dict(char const *name, char const *contents)
+{
+	char		path[PATH_MAX];
+	FILE		*fp;
+	struct utimbuf	times;
+	static time_t	mtime;
+
+	snprintf(path, sizeof(path), "%s/%s", dict_dir, name);
+	fp = fopen(path, "w");
+	CHECK(fp != NULL);
+	fputs(contents, fp);
+	fclose(fp);
+
+	if (!mtime) mtime = time(NULL);
+	times.actime = times.modtime = ++mtime;
+	CHECK(utime(path, &times) == 0);
+}
+
+/** Find the compiled dictionary, and return its inode, or 0 if there isn't one
+ *
+ */
+static ino_t cache_ino(char const *dir, char *path, size_t pathlen)
+{
+	DIR		*dp;
+	struct dirent	*de;
+	struct stat	stat_buf;
+	ino_t		ino = 0;
+	size_t		len;
+
+	dp = opendir(dir);
+	CHECK(dp != NULL);
+
+	while ((de = readdir(dp)) != NULL) {
+		len = strlen(de->d_name);
+		if ((len < 6) || (strcmp(de->d_name + len - 6, ".cache") != 0)) continue;
+
+		CHECK(ino == 0);
+		snprintf(path, pathlen, "%s/%s", dir, de->d_name);
+		CHECK(stat(path, &stat_buf) == 0);
+		ino = stat_buf.st_ino;
+	}
+	closedir(dp);
+
+	return ino;
+}
+
+static void load(void)
+{
+	dict_free();
+	if (dict_init(dict_dir, "dictionary") < 0) {
+		fprintf(stderr, "dict_cache: %s\n", fr_strerror());
+		exit(1);
+	}
+}
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: dict_cache [OPTS]\n");
+	fprintf(stderr, "  -D <dictdir>           Ignored.\n");
+
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int		c;
+	ino_t		ino, last;
+	char		path[PATH_MAX];
+
+	while ((c = getopt(argc, argv, "D:h")) != EOF) switch (c) {
+		case 'D':
+			break;
+		case 'h':
+		default:
+			usage();
+	}
+
+	CHECK(mkdtemp(dict_dir) != NULL);
+	CHECK(mkdtemp(cache_dir) != NULL);
+	CHECK(setenv("FR_DICT_CACHE_DIR", cache_dir, 1) == 0);
+
+	write_dict("dictionary",
+		   "ATTRIBUTE	Test-One	1	string\n"
+		   "$INCLUDE-	dictionary.local\n");
+
+	/*
+	 *	Parsed, and written to the cache.
+	 */
+	load();
+	CHECK(dict_attrbyname("Test-One") != NULL);
+	last = cache_ino(cache_dir, path, sizeof(path));
+	CHECK(last != 0);
+
+	/*
+	 *	Nothing has changed, so the cache is used,
+	 *	and isn't written again.
+	 */
+	load();
+	CHECK(dict_attrbyname("Test-One") != NULL);
+	CHECK(dict_attrbyname("Test-Two") == NULL);
+	CHECK(cache_ino(cache_dir, path, sizeof(path)) == last);
+
+	/*
+	 *	A dictionary has changed.
+	 */
+	write_dict("dictionary",
+		   "ATTRIBUTE	Test-One	1	string\n"
+		   "ATTRIBUTE	Test-Two	2	integer\n"
+		   "$INCLUDE-	dictionary.local\n");
+	load();
+	CHECK(dict_attrbyname("Test-Two") != NULL);
+	ino = cache_ino(cache_dir, path, sizeof(path));
+	CHECK(ino && (ino != last));
+	last = ino;
+
+	/*
+	 *	An optional dictionary which didn't
+	 *	exist has been created.
+	 */
+	write_dict("dictionary.local", "ATTRIBUTE	Test-Three	3	ipaddr\n");
+	load();
+	CHECK(dict_attrbyname("Test-Three") != NULL);
+	ino = cache_ino(cache_dir, path, sizeof(path));
+	CHECK(ino && (ino != last));
+	last = ino;
+
+	load();
+	CHECK(dict_attrbyname("Test-Three") != NULL);
+	CHECK(cache_ino(cache_dir, path, sizeof(path)) == last);
+
+	/*
+	 *	A corrupt cache is ignored, and rewritten.
+	 */
+	CHECK(truncate(path, 64) == 0);
+	load();
+	CHECK(dict_attrbyname("Test-One") != NULL);
+	CHECK(dict_attrbyname("Test-Three") != NULL);
+	ino = cache_ino(cache_dir, path, sizeof(path));
+	CHECK(ino && (ino != last));
+
+	/*
+	 *	Without a cache directory, nothing is written.
+	 */
+	CHECK(unlink(path) == 0);
+	CHECK(unsetenv("FR_DICT_CACHE_DIR") == 0);
+	load();
+	CHECK(dict_attrbyname("Test-Three") != NULL);
+	CHECK(cache_ino(cache_dir, path, sizeof(path)) == 0);
+	CHECK(cache_ino(dict_dir, path, sizeof(path)) == 0);
+
+	dict_free();
+
+	snprintf(path, sizeof(path), "%s/dictionary", dict_dir);
+	unlink(path);
+	snprintf(path, sizeof(path), "%s/dictionary.local", dict_dir);
+	unlink(path);
+	rmdir(dict_dir);
+	rmdir(cache_dir);
+
+	return 0;
+}
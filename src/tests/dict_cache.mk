@@ -0,0 +1,6 @@
+TARGET		:= dict_cache
+SOURCES		:= dict_cache.c
+
+TGT_PREREQS	:= libfreeradius-radius.a
+TGT_LDLIBS	:= $(LIBS)
+TGT_INSTALLDIR	:=
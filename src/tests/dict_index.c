@@ -0,0 +1,298 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file dict_index.c
+ * @brief Check the attribute and vendor indexes against the hash tables.
+ *
+ * Includes src/lib/dict.c, so that lookups through the perfect hash index
+ * can be compared with lookups in the hash tables it's built from, which is
+ * how they were done before the index existed.  Every attribute and vendor
+ * in the dictionaries is looked up, along with numbers which aren't in them,
+ * the children of every parent attribute, and attributes and vendors added
+ * after the index was built.  With -b, also times both kinds of lookup.
+ *
+ * @copyright 2015 The FreeRADIUS server project
+ */
+#include "../lib/dict.c"
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+#define CHECK(_x) do { \
+	if (!(_x)) { \
+		fprintf(stderr, "dict_index: %s[%u]: Check \"%s\" failed\n", __FILE__, __LINE__, #_x); \
+		exit(1); \
+	} \
+} while (0)
+
+/*
+ *	The lookups as they were before the index.
+ */
+static DICT_ATTR const *linear_attrbyvalue(unsigned int attr, unsigned int vendor)
+{
+	DICT_ATTR da;
+
+	if ((attr > 0) && (attr < 256) && !vendor) return dict_base_attrs[attr];
+
+	da.attr = attr;
+	da.vendor = vendor;
+
+	return fr_hash_table_finddata(attributes_byvalue, &da);
+}
+
+static DICT_ATTR const *linear_attrbyparent(DICT_ATTR const *parent, unsigned int attr, unsigned int vendor)
+{
+	DICT_ATTR da;
+
+	if (!dict_attr_child(parent, &attr, &vendor)) return NULL;
+
+	da.attr = attr;
+	da.vendor = vendor;
+
+	return fr_hash_table_finddata(attributes_byvalue, &da);
+}
+
+static DICT_VENDOR *linear_vendorbyvalue(int vendorpec)
+{
+	DICT_VENDOR dv;
+
+	dv.vendorpec = vendorpec;
+
+	return fr_hash_table_finddata(vendors_byvalue, &dv);
+}
+
+static void check_attr(unsigned int attr, unsigned int vendor)
+{
+	CHECK(dict_attrbyvalue(attr, vendor) == linear_attrbyvalue(attr, vendor));
+}
+
+/*
+ *	The attribute, and numbers either side of it, in its own
+ *	vendor space and its neighbours.
+ */
+static int check_attr_walk(UNUSED void *ctx, void *data)
+{
+	DICT_ATTR const *da = data;
+
+	CHECK(dict_attrbyvalue(da->attr, da->vendor) != NULL);
+
+	check_attr(da->attr, da->vendor);
+	check_attr(da->attr + 1, da->vendor);
+	check_attr(da->attr - 1, da->vendor);
+	check_attr(da->attr, da->vendor + 1);
+	check_attr(da->attr, da->vendor - 1);
+	check_attr(da->attr ^ 0xff00, da->vendor);
+
+	return 0;
+}
+
+/*
+ *	Every child number of every attribute which can have children.
+ */
+static int check_parent_walk(UNUSED void *ctx, void *data)
+{
+	DICT_ATTR const *parent = data;
+	unsigned int attr;
+
+	switch (parent->type) {
+	case PW_TYPE_TLV:
+	case PW_TYPE_VSA:
+	case PW_TYPE_EVS:
+	case PW_TYPE_EXTENDED:
+	case PW_TYPE_LONG_EXTENDED:
+		break;
+
+	default:
+		return 0;
+	}
+
+	for (attr = 0; attr < 256; attr++) {
+		CHECK(dict_attrbyparent(parent, attr, parent->vendor) ==
+		      linear_attrbyparent(parent, attr, parent->vendor));
+		}
+
+	return 0;
+}
+
+static int check_vendor_walk(UNUSED void *ctx, void *data)
+{
+	DICT_VENDOR const *dv = data;
+	unsigned int attr;
+
+	CHECK(dict_vendorbyvalue(dv->vendorpec) == dv);
+
+	/*
+	 *	The common attribute numbers of every vendor.
+	 */
+	for (attr = 0; attr < 256; attr++) check_attr(attr, dv->vendorpec);
+
+	return 0;
+}
+
+static void check_all(void)
+{
+	int vendorpec;
+	uint32_t i, seed = 0x5eed;
+
+	fr_hash_table_walk(attributes_byvalue, check_attr_walk, NULL);
+	fr_hash_table_walk(attributes_byvalue, check_parent_walk, NULL);
+	fr_hash_table_walk(vendors_byvalue, check_vendor_walk, NULL);
+
+	for (vendorpec = -1; vendorpec < 70000; vendorpec++) {
+		CHECK(dict_vendorbyvalue(vendorpec) == linear_vendorbyvalue(vendorpec));
+		}
+
+	/*
+	 *	And some which are mostly misses.
+	 */
+	for (i = 0; i < 100000; i++) {
+		seed = (seed * 1103515245) + 12345;
+		check_attr((seed >> 8) & 0xffff, (seed & 0x01) ? 0 : ((seed >> 1) & 0x7f) * 311);
+	}
+}
+
+/** Time looking up every attribute, with and without the index
+ *
+ */
+typedef struct bench_keys_t {
+	unsigned int	*attrs;
+	unsigned int	*vendors;
+	int		num;
+} bench_keys_t;
+
+static int bench_walk(void *ctx, void *data)
+{
+	bench_keys_t *keys = ctx;
+	DICT_ATTR const *da = data;
+
+	keys->attrs[keys->num] = da->attr;
+	keys->vendors[keys->num] = da->vendor;
+	keys->num++;
+
+	return 0;
+}
+
+static double bench_lookups(DICT_ATTR const *(*lookup)(unsigned int, unsigned int), bench_keys_t *keys, int iterations)
+{
+	struct timeval	start, now;
+	int		i, j;
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++) {
+		for (j = 0; j < keys->num; j++) (void) lookup(keys->attrs[j], keys->vendors[j]);
+	}
+	gettimeofday(&now, NULL);
+
+	return (now.tv_sec - start.tv_sec) + ((now.tv_usec - start.tv_usec) / 1000000.0);
+}
+
+static void bench(int iterations)
+{
+	bench_keys_t	keys;
+	int		num;
+	double		linear, indexed;
+
+	num = fr_hash_table_num_elements(attributes_byvalue);
+	keys.attrs = malloc(sizeof(keys.attrs[0]) * num);
+	keys.vendors = malloc(sizeof(keys.vendors[0]) * num);
+	keys.num = 0;
+	CHECK(keys.attrs && keys.vendors);
+
+	fr_hash_table_walk(attributes_byvalue, bench_walk, &keys);
+
+	linear = bench_lookups(linear_attrbyvalue, &keys, iterations);
+	indexed = bench_lookups(dict_attrbyvalue, &keys, iterations);
+
+	printf("hashed   %10.0f lookups/s\n", (keys.num * (double) iterations) / linear);
+	printf("indexed  %10.0f lookups/s\n", (keys.num * (double) iterations) / indexed);
+
+	free(keys.attrs);
+	free(keys.vendors);
+}
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: dict_index [OPTS]\n");
+	fprintf(stderr, "  -b                     Time lookups with and without the index.\n");
+	fprintf(stderr, "  -D <dictdir>           Set main dictionary directory (defaults to " DICTDIR ").\n");
+	fprintf(stderr, "  -n <iterations>        Number of times to look up each attribute with -b.\n");
+
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int		c, iterations = 200;
+	bool		do_bench = false;
+	char const	*dict_dir = DICTDIR;
+	DICT_ATTR const	*da;
+	ATTR_FLAGS	flags;
+
+	while ((c = getopt(argc, argv, "bD:n:h")) != EOF) switch (c) {
+		case 'b':
+			do_bench = true;
+			break;
+		case 'D':
+			dict_dir = optarg;
+			break;
+		case 'n':
+			iterations = atoi(optarg);
+			if (iterations <= 0) usage();
+			break;
+		case 'h':
+		default:
+			usage();
+	}
+
+	if (dict_init(dict_dir, "dictionary") < 0) {
+		fr_perror("dict_index");
+		return 1;
+	}
+	CHECK(attributes_index.slots != NULL);
+	CHECK(vendors_index.slots != NULL);
+
+	check_all();
+
+	/*
+	 *	Added after the index was built, as modules and
+	 *	"dictionary" files in raddb do.  One is a new
+	 *	number, one replaces an attribute which is indexed.
+	 */
+	CHECK(dict_addvendor("Dict-Index-Test", 65123) == 0);
+
+	memset(&flags, 0, sizeof(flags));
+	CHECK(dict_addattr("Dict-Index-Test-One", 1, 65123, PW_TYPE_STRING, flags) == 0);
+	CHECK(dict_addattr("Dict-Index-Test-Two", 2, 65123, PW_TYPE_INTEGER, flags) == 0);
+
+	da = dict_attrbyname("Cisco-AVPair");
+	CHECK(da != NULL);
+	CHECK(dict_addattr("Dict-Index-Test-AVPair", da->attr, da->vendor, da->type, da->flags) == 0);
+
+	da = dict_attrbyvalue(1, 65123);
+	CHECK(da && (strcmp(da->name, "Dict-Index-Test-One") == 0));
+	CHECK(dict_vendorbyvalue(65123) != NULL);
+
+	check_all();
+
+	if (do_bench) bench(iterations);
+
+	dict_free();
+
+	return 0;
+}
@@ -0,0 +1,11 @@
+TARGET		:= dict_index
+SOURCES		:= dict_index.c
+
+#
+#  Includes src/lib/dict.c, so it's built the same way.
+#
+SRC_CFLAGS	:= -D_LIBRADIUS -I$(top_builddir)/src
+
+TGT_PREREQS	:= libfreeradius-radius.a
+TGT_LDLIBS	:= $(LIBS)
+TGT_INSTALLDIR	:=
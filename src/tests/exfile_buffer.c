@@ -0,0 +1,291 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file exfile_buffer.c
+ * @brief Check that buffered writes to exfiles all end up in the right file.
+ *
+ * Threads write records to more files than there are entries, so entries
+ * are reused and their buffers written while other threads are opening
+ * files.  Every record must be in the file it was written to exactly once,
+ * in the order it was written.  Then checks that the flush thread writes
+ * data which has been buffered for too long, when nothing else is written.
+ * Both tests write to directories which don't exist yet.
+ *
+ * @copyright 2015 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/exfile.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define NUM_THREADS	(8)
+#define NUM_FILES	(NUM_THREADS * 3)
+#define BUFFER_SIZE	(512)
+
+#ifdef HAVE_PTHREAD_H
+pid_t rad_fork(void)
+{
+	return fork();
+}
+
+pid_t rad_waitpid(pid_t pid, int *status)
+{
+	return waitpid(pid, status, 0);
+}
+#endif
+
+#define CHECK(_x) do { \
+	if (!(_x)) { \
+		fprintf(stderr, "exfile_buffer: %s[%u]: Check \"%s\" failed\n", __FILE__, __LINE__, #_x); \
+		exit(1); \
+	} \
+} while (0)
+
+static char	dir[] = "/tmp/exfile_buffer.XXXXXX";
+static int	records = 2000;
+
+/*
+ *	Some records are larger than the buffer, so they're written
+ *	directly.
+ */
+static int record_padding(int i)
+{
+	if ((i % 97) == 0) return BUFFER_SIZE + 100;
+
+	return i % 40;
+}
+
+static void file_name(char *buffer, size_t len, int file)
+{
+	snprintf(buffer, len, "%s/threads/file.%d", dir, file);
+}
+
+typedef struct writer_t {
+	exfile_t	*ef;
+	int		number;
+#ifdef HAVE_PTHREAD_H
+	pthread_t	thread;
+#endif
+} writer_t;
+
+/** Write records to files in turn, opening and closing the file for each one
+ *
+ */
+static void *writer_thread(void *arg)
+{
+	writer_t	*writer = arg;
+	char		filename[PATH_MAX], line[BUFFER_SIZE * 2];
+	int		i, fd, len;
+
+	for (i = 0; i < records; i++) {
+		file_name(filename, sizeof(filename), (writer->number + i) % NUM_FILES);
+
+		len = snprintf(line, sizeof(line), "%d %d ", writer->number, i);
+		memset(line + len, 'x', record_padding(i));
+		len += record_padding(i);
+		line[len++] = '\n';
+
+		fd = exfile_open(writer->ef, filename, 0600);
+		CHECK(fd >= 0);
+		CHECK(exfile_write(writer->ef, fd, line, len) == len);
+		CHECK(exfile_close(writer->ef, fd) == 0);
+	}
+
+	return NULL;
+}
+
+/** Check that every record is in the right file, once, and in order
+ *
+ */
+static void check_files(void)
+{
+	char		filename[PATH_MAX], line[BUFFER_SIZE * 2];
+	int		file, number, i, len, padding, last[NUM_THREADS];
+	uint8_t		*seen;
+	FILE		*fp;
+
+	seen = calloc(NUM_THREADS * records, sizeof(seen[0]));
+	CHECK(seen != NULL);
+
+	for (file = 0; file < NUM_FILES; file++) {
+		for (number = 0; number < NUM_THREADS; number++) last[number] = -1;
+
+		file_name(filename, sizeof(filename), file);
+		fp = fopen(filename, "r");
+		CHECK(fp != NULL);
+
+		while (fgets(line, sizeof(line), fp)) {
+			CHECK(sscanf(line, "%d %d%n", &number, &i, &len) == 2);
+			CHECK(line[len++] == ' ');
+			CHECK((number >= 0) && (number < NUM_THREADS));
+			CHECK((i >= 0) && (i < records));
+
+			CHECK(((number + i) % NUM_FILES) == file);
+			CHECK(i > last[number]);
+			last[number] = i;
+
+			CHECK(!seen[(number * records) + i]);
+			seen[(number * records) + i] = 1;
+
+			/*
+			 *	Nothing else was written in the middle
+			 *	of the record.
+			 */
+			for (padding = 0; line[len] == 'x'; len++) padding++;
+			CHECK(padding == record_padding(i));
+			CHECK((line[len] == '\n') && (line[len + 1] == '\0'));
+		}
+		fclose(fp);
+
+		CHECK(unlink(filename) == 0);
+	}
+
+	for (i = 0; i < (NUM_THREADS * records); i++) CHECK(seen[i]);
+	free(seen);
+
+	snprintf(filename, sizeof(filename), "%s/threads", dir);
+	CHECK(rmdir(filename) == 0);
+}
+
+/** Threads write to more files than there are entries
+ *
+ * The buffers are only written when they fill up, when their entry is
+ * reused, and when the exfile_t is freed.
+ */
+static void test_threads(void)
+{
+	exfile_t	*ef;
+	writer_t	writers[NUM_THREADS];
+	int		i;
+
+	ef = exfile_init(NULL, NUM_THREADS, 30, true);
+	CHECK(ef != NULL);
+	CHECK(exfile_enable_buffer(ef, BUFFER_SIZE, 3600, false) == 0);
+
+	for (i = 0; i < NUM_THREADS; i++) {
+		writers[i].ef = ef;
+		writers[i].number = i;
+	}
+
+#ifdef HAVE_PTHREAD_H
+	for (i = 0; i < NUM_THREADS; i++) {
+		CHECK(pthread_create(&writers[i].thread, NULL, writer_thread, &writers[i]) == 0);
+	}
+	for (i = 0; i < NUM_THREADS; i++) pthread_join(writers[i].thread, NULL);
+#else
+	for (i = 0; i < NUM_THREADS; i++) writer_thread(&writers[i]);
+#endif
+
+	talloc_free(ef);
+
+	check_files();
+}
+
+#ifdef HAVE_PTHREAD_H
+/** Buffered data is written by the flush thread, without the file being used again
+ *
+ */
+static void test_flusher(void)
+{
+	exfile_t	*ef;
+	char		filename[PATH_MAX];
+	char const	*data = "flushed\n";
+	struct stat	st;
+	time_t		start;
+	int		fd, i;
+
+	snprintf(filename, sizeof(filename), "%s/flusher/file", dir);
+
+	ef = exfile_init(NULL, 4, 30, true);
+	CHECK(ef != NULL);
+	CHECK(exfile_enable_buffer(ef, BUFFER_SIZE, 2, false) == 0);
+
+	start = time(NULL);
+	fd = exfile_open(ef, filename, 0600);
+	CHECK(fd >= 0);
+	CHECK(exfile_write(ef, fd, data, strlen(data)) == (ssize_t) strlen(data));
+	CHECK(exfile_size(ef, fd) == (off_t) strlen(data));
+	CHECK(exfile_close(ef, fd) == 0);
+
+	/*
+	 *	Unless we were very slow, the data hasn't been
+	 *	buffered for long enough to be written.
+	 */
+	CHECK(stat(filename, &st) == 0);
+	if (time(NULL) < (start + 2)) CHECK(st.st_size == 0);
+
+	for (i = 0; (i < 100) && (st.st_size == 0); i++) {
+		usleep(100000);
+		CHECK(stat(filename, &st) == 0);
+	}
+	CHECK(st.st_size == (off_t) strlen(data));
+
+	talloc_free(ef);
+
+	CHECK(stat(filename, &st) == 0);
+	CHECK(st.st_size == (off_t) strlen(data));
+
+	CHECK(unlink(filename) == 0);
+	snprintf(filename, sizeof(filename), "%s/flusher", dir);
+	CHECK(rmdir(filename) == 0);
+}
+#endif
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: exfile_buffer [OPTS]\n");
+	fprintf(stderr, "  -D <dictdir>           Ignored.\n");
+	fprintf(stderr, "  -n <records>           Number of records each thread writes.\n");
+
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int c;
+
+	while ((c = getopt(argc, argv, "D:n:h")) != EOF) switch (c) {
+		case 'D':
+			break;
+		case 'n':
+			records = atoi(optarg);
+			if (records <= 0) usage();
+			break;
+		case 'h':
+		default:
+			usage();
+	}
+
+	CHECK(mkdtemp(dir) != NULL);
+
+	test_threads();
+#ifdef HAVE_PTHREAD_H
+	test_flusher();
+#endif
+
+	CHECK(rmdir(dir) == 0);
+
+	return 0;
+}
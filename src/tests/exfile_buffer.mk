@@ -0,0 +1,6 @@
+TARGET		:= exfile_buffer
+SOURCES		:= exfile_buffer.c
+
+TGT_PREREQS	:= libfreeradius-server.a libfreeradius-radius.a
+TGT_LDLIBS	:= $(LIBS)
+TGT_INSTALLDIR	:=
@@ -0,0 +1,436 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file ippool_mmap.c
+ * @brief Check the memory mapped IP pool store used by rlm_ippool.
+ *
+ * Checks allocating, releasing and reclaiming expired addresses, and that
+ * a pool which was being modified by a process that died is consistent
+ * when it's opened again.
+ *
+ * @copyright 2015 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "../modules/rlm_ippool/ippool_mmap.h"
+
+#define NUM_ADDRS	(16)
+#define NUM_CRASHES	(50)
+
+#define CHECK(_x) do { \
+	if (!(_x)) { \
+		fprintf(stderr, "ippool_mmap: %s[%u]: Check \"%s\" failed: %s\n", \
+			__FILE__, __LINE__, #_x, fr_strerror()); \
+		exit(1); \
+	} \
+} while (0)
+
+static char const *filename;
+
+static uint8_t const *key(uint32_t id)
+{
+	static uint8_t out[IPPOOL_MMAP_KEY_LEN];
+
+	memset(out, 0, sizeof(out));
+	memcpy(out, &id, sizeof(id));
+
+	return out;
+}
+
+static uint32_t addr(uint32_t i)
+{
+	return htonl(0x0a000001 + i);
+}
+
+static ippool_mmap_t *pool_create(uint32_t num)
+{
+	uint32_t	addrs[NUM_ADDRS];
+	uint32_t	i;
+
+	for (i = 0; i < num; i++) addrs[i] = addr(i);
+
+	return ippool_mmap_create(NULL, filename, addrs, num);
+}
+
+/** Addresses are handed out least recently used first, and can be released
+ *
+ */
+static void test_allocate(void)
+{
+	ippool_mmap_t		*pool;
+	ippool_mmap_lease_t	lease;
+	uint32_t		i, ipaddr;
+
+	pool = pool_create(4);
+	CHECK(pool != NULL);
+	CHECK(ippool_mmap_num_addrs(pool) == 4);
+
+	for (i = 0; i < 4; i++) {
+		CHECK(ippool_mmap_allocate(pool, &lease, key(i), NULL, 1000, 0) == 1);
+		CHECK(lease.ipaddr == addr(i));
+		CHECK(lease.sessions == 1);
+		CHECK(!lease.mppp && !lease.stale);
+	}
+	CHECK(ippool_mmap_allocate(pool, &lease, key(4), NULL, 1000, 0) == 0);
+
+	CHECK(ippool_mmap_release(pool, key(2), &ipaddr) == 1);
+	CHECK(ipaddr == addr(2));
+	CHECK(ippool_mmap_release(pool, key(2), &ipaddr) == 0);
+
+	CHECK(ippool_mmap_allocate(pool, &lease, key(4), NULL, 1000, 0) == 1);
+	CHECK(lease.ipaddr == addr(2));
+
+	/*
+	 *	The same key again.  Its old session is stale, and
+	 *	its address is the only one available.
+	 */
+	CHECK(ippool_mmap_allocate(pool, &lease, key(4), NULL, 1001, 0) == 1);
+	CHECK(lease.stale);
+	CHECK(lease.stale_ipaddr == addr(2));
+	CHECK(lease.ipaddr == addr(2));
+
+	/*
+	 *	Released addresses are reused in the order they
+	 *	were released.
+	 */
+	CHECK(ippool_mmap_release(pool, key(0), NULL) == 1);
+	CHECK(ippool_mmap_release(pool, key(1), NULL) == 1);
+	CHECK(ippool_mmap_allocate(pool, &lease, key(5), NULL, 1000, 0) == 1);
+	CHECK(lease.ipaddr == addr(0));
+	CHECK(ippool_mmap_allocate(pool, &lease, key(6), NULL, 1000, 0) == 1);
+	CHECK(lease.ipaddr == addr(1));
+
+	CHECK(ippool_mmap_release_addr(pool, addr(3)) == 1);
+	CHECK(ippool_mmap_release(pool, key(3), NULL) == 0);
+	CHECK(ippool_mmap_release_addr(pool, htonl(0x0b000001)) < 0);
+
+	talloc_free(pool);
+}
+
+/** Callers with the same Calling-Station-Id share an address
+ *
+ */
+static void test_mppp(void)
+{
+	ippool_mmap_t		*pool;
+	ippool_mmap_lease_t	lease;
+
+	pool = pool_create(4);
+	CHECK(pool != NULL);
+
+	CHECK(ippool_mmap_allocate(pool, &lease, key(0), "00-11-22-33-44-55", 1000, 0) == 1);
+	CHECK(lease.ipaddr == addr(0));
+	CHECK(ippool_mmap_allocate(pool, &lease, key(1), "00-11-22-33-44-66", 1000, 0) == 1);
+	CHECK(lease.ipaddr == addr(1));
+
+	CHECK(ippool_mmap_allocate(pool, &lease, key(2), "00-11-22-33-44-55", 1000, 0) == 1);
+	CHECK(lease.mppp);
+	CHECK(lease.ipaddr == addr(0));
+	CHECK(lease.sessions == 2);
+
+	/*
+	 *	The address is only free once both have gone.
+	 */
+	CHECK(ippool_mmap_release(pool, key(0), NULL) == 1);
+	CHECK(ippool_mmap_allocate(pool, &lease, key(3), NULL, 1000, 0) == 1);
+	CHECK(lease.ipaddr == addr(2));
+	CHECK(ippool_mmap_release(pool, key(2), NULL) == 1);
+	CHECK(ippool_mmap_allocate(pool, &lease, key(4), NULL, 1000, 0) == 1);
+	CHECK(lease.ipaddr == addr(3));
+	CHECK(ippool_mmap_allocate(pool, &lease, key(5), NULL, 1000, 0) == 1);
+	CHECK(lease.ipaddr == addr(0));
+
+	talloc_free(pool);
+}
+
+/** Expired sessions are reclaimed when there's nothing free, soonest first
+ *
+ */
+static void test_expiry(void)
+{
+	ippool_mmap_t		*pool;
+	ippool_mmap_lease_t	lease;
+
+	pool = pool_create(3);
+	CHECK(pool != NULL);
+
+	CHECK(ippool_mmap_allocate(pool, &lease, key(0), NULL, 1000, 1020) == 1);
+	CHECK(ippool_mmap_allocate(pool, &lease, key(1), NULL, 1000, 0) == 1);
+	CHECK(ippool_mmap_allocate(pool, &lease, key(2), NULL, 1000, 1010) == 1);
+
+	CHECK(ippool_mmap_allocate(pool, &lease, key(3), NULL, 1009, 0) == 0);
+
+	CHECK(ippool_mmap_allocate(pool, &lease, key(3), NULL, 1010, 0) == 1);
+	CHECK(lease.ipaddr == addr(2));
+	CHECK(ippool_mmap_release(pool, key(2), NULL) == 0);
+
+	CHECK(ippool_mmap_allocate(pool, &lease, key(4), NULL, 1019, 0) == 0);
+	CHECK(ippool_mmap_allocate(pool, &lease, key(4), NULL, 5000, 0) == 1);
+	CHECK(lease.ipaddr == addr(0));
+
+	/*
+	 *	Nothing else expires.
+	 */
+	CHECK(ippool_mmap_allocate(pool, &lease, key(5), NULL, 100000, 0) == 0);
+	CHECK(ippool_mmap_release(pool, key(1), NULL) == 1);
+
+	talloc_free(pool);
+}
+
+typedef struct pool_state {
+	uint32_t	num_free;
+	uint32_t	num_sessions;
+	uint32_t	keys[NUM_ADDRS * 2];
+	uint32_t	used[NUM_ADDRS];		//!< Sessions using each address.
+} pool_state_t;
+
+static int pool_state_add(void *ctx, ippool_mmap_lease_t const *lease)
+{
+	pool_state_t	*state = ctx;
+	uint32_t	i = ntohl(lease->ipaddr) - 0x0a000001;
+	uint32_t	id;
+
+	CHECK(i < NUM_ADDRS);
+
+	if (!lease->active) {
+		state->num_free++;
+		return 0;
+	}
+
+	memcpy(&id, lease->key, sizeof(id));
+	state->keys[state->num_sessions++] = id;
+	state->used[i]++;
+
+	return 0;
+}
+
+/** Check a pool is consistent, and that every address can be allocated once its sessions are released
+ *
+ */
+static void pool_check(ippool_mmap_t *pool)
+{
+	pool_state_t		state;
+	ippool_mmap_lease_t	lease;
+	uint32_t		i, j, in_use = 0;
+	uint32_t		allocated[NUM_ADDRS];
+
+	memset(&state, 0, sizeof(state));
+	CHECK(ippool_mmap_walk(pool, pool_state_add, &state) == 0);
+
+	for (i = 0; i < NUM_ADDRS; i++) if (state.used[i]) in_use++;
+	CHECK((in_use + state.num_free) == NUM_ADDRS);
+
+	for (i = 0; i < state.num_sessions; i++) {
+		for (j = i + 1; j < state.num_sessions; j++) CHECK(state.keys[i] != state.keys[j]);
+		CHECK(ippool_mmap_release(pool, key(state.keys[i]), NULL) == 1);
+	}
+
+	memset(&state, 0, sizeof(state));
+	CHECK(ippool_mmap_walk(pool, pool_state_add, &state) == 0);
+	CHECK(state.num_sessions == 0);
+	CHECK(state.num_free == NUM_ADDRS);
+
+	/*
+	 *	The free list must contain every address, once.
+	 */
+	for (i = 0; i < NUM_ADDRS; i++) {
+		CHECK(ippool_mmap_allocate(pool, &lease, key(0x10000 + i), NULL, 0, 0) == 1);
+		for (j = 0; j < i; j++) CHECK(allocated[j] != lease.ipaddr);
+		allocated[i] = lease.ipaddr;
+	}
+	CHECK(ippool_mmap_allocate(pool, &lease, key(0x20000), NULL, 0, 0) == 0);
+
+	for (i = 0; i < NUM_ADDRS; i++) CHECK(ippool_mmap_release(pool, key(0x10000 + i), NULL) == 1);
+}
+
+/** Change the pool until we're killed
+ *
+ */
+static void NEVER_RETURNS pool_churn(unsigned int seed)
+{
+	ippool_mmap_t		*pool;
+	ippool_mmap_lease_t	lease;
+	char			cli[IPPOOL_MMAP_CLI_LEN];
+
+	pool = ippool_mmap_open(NULL, filename, true);
+	if (!pool) _exit(1);
+
+	srandom(seed);
+	for (;;) {
+		uint32_t id = random() % (NUM_ADDRS * 2);
+
+		switch (random() % 3) {
+		case 0:
+			snprintf(cli, sizeof(cli), "cli-%u", (unsigned int) (random() % 4));
+			ippool_mmap_allocate(pool, &lease, key(id), cli, 1000, 1000 + (random() % 100));
+			break;
+
+		case 1:
+			ippool_mmap_allocate(pool, &lease, key(id), NULL, 1000 + (random() % 200), 0);
+			break;
+
+		default:
+			ippool_mmap_release(pool, key(id), NULL);
+			break;
+		}
+	}
+}
+
+/** Kill processes while they're changing the pool, and check the pool after each one
+ *
+ * The pool is mapped shared, so everything written before the process died is in the
+ * file, which is what would be left by a crash part way through an update.
+ */
+static void test_crash(void)
+{
+	ippool_mmap_t	*pool;
+	int		i, status;
+	pid_t		pid;
+
+	pool = pool_create(NUM_ADDRS);
+	CHECK(pool != NULL);
+	talloc_free(pool);
+
+	for (i = 0; i < NUM_CRASHES; i++) {
+		pid = fork();
+		CHECK(pid >= 0);
+		if (pid == 0) pool_churn(i);
+
+		usleep(1000 + (random() % 20000));
+		kill(pid, SIGKILL);
+		CHECK(waitpid(pid, &status, 0) == pid);
+		CHECK(WIFSIGNALED(status));
+
+		/*
+		 *	Readers only use the authoritative records, so
+		 *	must see a consistent pool without a rebuild.
+		 */
+		pool = ippool_mmap_open(NULL, filename, false);
+		CHECK(pool != NULL);
+		{
+			pool_state_t state;
+
+			memset(&state, 0, sizeof(state));
+			CHECK(ippool_mmap_walk(pool, pool_state_add, &state) == 0);
+		}
+		talloc_free(pool);
+
+		pool = ippool_mmap_open(NULL, filename, true);
+		CHECK(pool != NULL);
+		pool_check(pool);
+		talloc_free(pool);
+	}
+}
+
+/** Files which aren't complete pools are rejected
+ *
+ */
+static void test_corrupt(void)
+{
+	ippool_mmap_t	*pool;
+	struct stat	st;
+	FILE		*fp;
+
+	pool = pool_create(NUM_ADDRS);
+	CHECK(pool != NULL);
+	talloc_free(pool);
+	CHECK(ippool_mmap_is_pool(filename));
+
+	/*
+	 *	Truncated.
+	 */
+	CHECK(stat(filename, &st) == 0);
+	CHECK(truncate(filename, st.st_size - 1) == 0);
+	CHECK(ippool_mmap_open(NULL, filename, true) == NULL);
+
+	/*
+	 *	Not a pool at all.
+	 */
+	fp = fopen(filename, "w");
+	CHECK(fp != NULL);
+	fputs("192.0.2.1\n", fp);
+	fclose(fp);
+	CHECK(!ippool_mmap_is_pool(filename));
+	CHECK(ippool_mmap_open(NULL, filename, true) == NULL);
+
+	/*
+	 *	Creating a pool replaces whatever was there.
+	 */
+	pool = pool_create(NUM_ADDRS);
+	CHECK(pool != NULL);
+	pool_check(pool);
+	talloc_free(pool);
+}
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: ippool_mmap [OPTS]\n");
+	fprintf(stderr, "  -D <dictdir>           Ignored.\n");
+	fprintf(stderr, "  -f <file>              Pool file to create (default is a temporary file).\n");
+
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int	c;
+	char	buffer[] = "/tmp/ippool_mmap.XXXXXX";
+
+	while ((c = getopt(argc, argv, "D:f:h")) != EOF) switch (c) {
+		case 'D':
+			break;
+		case 'f':
+			filename = optarg;
+			break;
+		case 'h':
+		default:
+			usage();
+	}
+
+	if (!filename) {
+		int fd;
+
+		fd = mkstemp(buffer);
+		if (fd < 0) {
+			fprintf(stderr, "ippool_mmap: Failed creating temporary file: %s\n", fr_syserror(errno));
+			return 1;
+		}
+		close(fd);
+		filename = buffer;
+	}
+
+	test_allocate();
+	test_mppp();
+	test_expiry();
+	test_crash();
+	test_corrupt();
+
+	unlink(filename);
+
+	return 0;
+}
@@ -0,0 +1,6 @@
+TARGET		:= ippool_mmap
+SOURCES		:= ippool_mmap.c ../modules/rlm_ippool/ippool_mmap.c
+
+TGT_PREREQS	:= libfreeradius-radius.a
+TGT_LDLIBS	:= $(LIBS)
+TGT_INSTALLDIR	:=
@@ -0,0 +1,372 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file ldap_group_cache.c
+ * @brief Check the rlm_ldap group name cache.
+ *
+ * Searches made by src/modules/rlm_ldap/group_cache.c are answered from a fake
+ * directory.  Checks that prefetched groups are found without searching, that
+ * groups renamed in the directory are picked up by the next refresh, that
+ * deleted groups drop out at the next reload, and that mappings expire.
+ *
+ * @copyright 2015 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include "../modules/rlm_ldap/ldap.h"
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+#include <sys/wait.h>
+
+#ifdef HAVE_PTHREAD_H
+pid_t rad_fork(void)
+{
+	return fork();
+}
+
+pid_t rad_waitpid(pid_t pid, int *status)
+{
+	return waitpid(pid, status, 0);
+}
+#endif
+
+#define FOO_DN		"cn=foo,ou=groups,dc=example,dc=com"
+#define BAR_DN		"cn=bar,ou=groups,dc=example,dc=com"
+#define GROUP_FILTER	"(objectClass=groupOfNames)"
+
+/*
+ *	The fake directory.
+ */
+typedef struct fake_group {
+	char const	*dn;
+	char const	*name;
+	char const	*modified;	//!< modifyTimestamp.
+	bool		deleted;
+} fake_group_t;
+
+static fake_group_t groups[] = {
+	{ FOO_DN, "foo", "20150101000000Z", false },
+	{ BAR_DN, "bar", "20150101000000Z", false },
+};
+
+static int	searches;		//!< Calls to rlm_ldap_search().
+static char	last_filter[256];	//!< Filter used by the last search.
+static int	messages;		//!< Results which haven't been freed.
+
+/*
+ *	A result is a list of entries, each one a copy of a group.
+ */
+struct ldapmsg {
+	fake_group_t	group;
+	struct ldapmsg	*next;
+};
+
+LDAPMessage *ldap_first_entry(UNUSED LDAP *ld, LDAPMessage *result)
+{
+	return result;
+}
+
+LDAPMessage *ldap_next_entry(UNUSED LDAP *ld, LDAPMessage *entry)
+{
+	return entry->next;
+}
+
+char *ldap_get_dn(UNUSED LDAP *ld, LDAPMessage *entry)
+{
+	return strdup(entry->group.dn);
+}
+
+void ldap_memfree(void *p)
+{
+	free(p);
+}
+
+struct berval **ldap_get_values_len(UNUSED LDAP *ld, LDAPMessage *entry, char const *attr)
+{
+	struct berval	**values;
+	char const	*value;
+
+	if (strcmp(attr, "cn") == 0) {
+		value = entry->group.name;
+	} else if (strcmp(attr, "modifyTimestamp") == 0) {
+		value = entry->group.modified;
+	} else {
+		return NULL;
+	}
+
+	values = calloc(2, sizeof(values[0]));
+	values[0] = calloc(1, sizeof(*values[0]));
+	values[0]->bv_val = strdup(value);
+	values[0]->bv_len = strlen(value);
+
+	return values;
+}
+
+void ldap_value_free_len(struct berval **values)
+{
+	free(values[0]->bv_val);
+	free(values[0]);
+	free(values);
+}
+
+int ldap_msgfree(LDAPMessage *result)
+{
+	LDAPMessage *next;
+
+	for (; result; result = next) {
+		next = result->next;
+		free(result);
+	}
+	messages--;
+
+	return 0;
+}
+
+/*
+ *	Replace the real ones in ldap.c.
+ */
+size_t rlm_ldap_escape_func(UNUSED REQUEST *request, char *out, size_t outlen, char const *in, UNUSED void *arg)
+{
+	return strlcpy(out, in, outlen);
+}
+
+size_t rlm_ldap_normalise_dn(char *out, char const *in)
+{
+	size_t len = strlen(in);
+
+	memmove(out, in, len + 1);
+
+	return len;
+}
+
+ldap_handle_t *mod_conn_get(rlm_ldap_t const *inst, UNUSED REQUEST *request)
+{
+	ldap_handle_t *conn;
+
+	conn = talloc_zero(NULL, ldap_handle_t);
+	memcpy(&conn->inst, &inst, sizeof(conn->inst));
+
+	return conn;
+}
+
+void mod_conn_release(UNUSED rlm_ldap_t const *inst, ldap_handle_t *conn)
+{
+	talloc_free(conn);
+}
+
+ldap_rcode_t rlm_ldap_search(LDAPMessage **result, UNUSED rlm_ldap_t const *inst, UNUSED REQUEST *request,
+			     UNUSED ldap_handle_t **pconn, UNUSED char const *dn, UNUSED int scope, char const *filter,
+			     UNUSED char const * const *attrs, UNUSED LDAPControl **serverctrls,
+			     UNUSED LDAPControl **clientctrls)
+{
+	char const	*since;
+	LDAPMessage	**last = result;
+	size_t		i;
+
+	searches++;
+	strlcpy(last_filter, filter, sizeof(last_filter));
+
+	since = strstr(filter, "(modifyTimestamp>=");
+	if (since) since += sizeof("(modifyTimestamp>=") - 1;
+
+	*result = NULL;
+	for (i = 0; i < sizeof(groups) / sizeof(groups[0]); i++) {
+		if (groups[i].deleted) continue;
+		if (since && (strncmp(groups[i].modified, since, strlen(groups[i].modified)) < 0)) continue;
+
+		*last = calloc(1, sizeof(**last));
+		(*last)->group = groups[i];
+		last = &(*last)->next;
+	}
+
+	if (!*result) return LDAP_PROC_NO_RESULT;
+	messages++;
+
+	return LDAP_PROC_SUCCESS;
+}
+
+#define CHECK(_x) do { \
+	if (!(_x)) { \
+		fprintf(stderr, "ldap_group_cache: %s[%u]: Check \"%s\" failed\n", __FILE__, __LINE__, #_x); \
+		exit(1); \
+	} \
+} while (0)
+
+/** Check the cache maps a DN to a name and back, or doesn't know either
+ *
+ */
+static void check_mapping(rlm_ldap_t const *inst, char const *dn, char const *name, bool found)
+{
+	char *out;
+
+	out = rlm_ldap_group_cache_dn2name(NULL, inst, dn);
+	if (found) {
+		CHECK(out && (strcmp(out, name) == 0));
+	} else {
+		CHECK(!out || (strcmp(out, name) != 0));
+	}
+	talloc_free(out);
+
+	out = rlm_ldap_group_cache_name2dn(NULL, inst, name);
+	if (found) {
+		CHECK(out && (strcmp(out, dn) == 0));
+	} else {
+		CHECK(!out);
+	}
+	talloc_free(out);
+}
+
+static rlm_ldap_t *inst_alloc(uint32_t ttl, bool prefetch)
+{
+	rlm_ldap_t *inst;
+
+	inst = talloc_zero(NULL, rlm_ldap_t);
+	inst->name = "ldap_group_cache";
+	inst->groupobj_name_attr = "cn";
+	inst->groupobj_filter = GROUP_FILTER;
+	inst->groupobj_scope = LDAP_SCOPE_SUB;
+	inst->groupobj_base_dn = tmpl_alloc(inst, TMPL_TYPE_LITERAL, "ou=groups,dc=example,dc=com", -1);
+	inst->group_cache_ttl = ttl;
+	inst->group_cache_prefetch = prefetch;
+	inst->group_cache_refresh = 2;
+
+	CHECK(rlm_ldap_group_cache_init(inst) == 0);
+	CHECK(inst->group_cache != NULL);
+
+	return inst;
+}
+
+/** Prefetched groups are found without searching, and kept up to date
+ *
+ */
+static void test_prefetch(void)
+{
+	rlm_ldap_t	*inst;
+	REQUEST		*request;
+	ldap_handle_t	*conn;
+
+	inst = inst_alloc(6, true);
+	CHECK(searches == 1);
+	CHECK(strcmp(last_filter, GROUP_FILTER) == 0);
+
+	check_mapping(inst, FOO_DN, "foo", true);
+	check_mapping(inst, BAR_DN, "bar", true);
+	check_mapping(inst, "cn=baz,ou=groups,dc=example,dc=com", "baz", false);
+
+	/*
+	 *	Not time to refresh yet.
+	 */
+	request = request_alloc(inst);
+	conn = mod_conn_get(inst, request);
+	rlm_ldap_group_cache_refresh(inst, request, &conn);
+	CHECK(searches == 1);
+
+	/*
+	 *	Rename foo.  Only foo should be retrieved by the
+	 *	refresh, and its old name should be forgotten.
+	 */
+	groups[0].name = "baz";
+	groups[0].modified = "20150102000000Z";
+
+	sleep(2);
+	rlm_ldap_group_cache_refresh(inst, request, &conn);
+	CHECK(searches == 2);
+	CHECK(strstr(last_filter, "(modifyTimestamp>=20150101000000Z)") != NULL);
+
+	check_mapping(inst, FOO_DN, "baz", true);
+	check_mapping(inst, FOO_DN, "foo", false);
+	check_mapping(inst, BAR_DN, "bar", true);
+
+	/*
+	 *	Deleting a group doesn't change any timestamps,
+	 *	so it's only noticed by the next full reload.
+	 */
+	groups[1].deleted = true;
+
+	sleep(2);
+	rlm_ldap_group_cache_refresh(inst, request, &conn);
+	CHECK(searches == 3);
+	CHECK(strstr(last_filter, "(modifyTimestamp>=20150102000000Z)") != NULL);
+	check_mapping(inst, BAR_DN, "bar", true);
+
+	sleep(2);
+	rlm_ldap_group_cache_refresh(inst, request, &conn);
+	CHECK(searches == 4);
+	CHECK(strcmp(last_filter, GROUP_FILTER) == 0);
+
+	check_mapping(inst, FOO_DN, "baz", true);
+	check_mapping(inst, BAR_DN, "bar", false);
+
+	mod_conn_release(inst, conn);
+	talloc_free(inst);
+}
+
+/** Mappings found by individual searches are cached until they expire
+ *
+ */
+static void test_expiry(void)
+{
+	rlm_ldap_t	*inst;
+
+	inst = inst_alloc(1, false);
+
+	rlm_ldap_group_cache_add(inst, "cn=qux,ou=groups,dc=example,dc=com", "qux");
+	check_mapping(inst, "cn=qux,ou=groups,dc=example,dc=com", "qux", true);
+
+	sleep(2);
+	check_mapping(inst, "cn=qux,ou=groups,dc=example,dc=com", "qux", false);
+
+	talloc_free(inst);
+}
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: ldap_group_cache [OPTS]\n");
+	fprintf(stderr, "  -D <dictdir>           Ignored.\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int c;
+
+	while ((c = getopt(argc, argv, "D:xh")) != EOF) switch (c) {
+		case 'D':
+			break;
+		case 'x':
+			fr_debug_lvl++;
+			rad_debug_lvl = fr_debug_lvl;
+			break;
+		case 'h':
+		default:
+			usage();
+	}
+
+	test_prefetch();
+	test_expiry();
+
+	CHECK(searches == 4);
+	CHECK(messages == 0);
+
+	return 0;
+}
@@ -0,0 +1,7 @@
+TARGET		:= ldap_group_cache
+SOURCES		:= ldap_group_cache.c ../modules/rlm_ldap/group_cache.c
+
+SRC_CFLAGS	:= $(RLM_LDAP_CFLAGS)
+TGT_PREREQS	:= libfreeradius-server.a libfreeradius-radius.a
+TGT_LDLIBS	:= $(LIBS)
+TGT_INSTALLDIR	:=
@@ -0,0 +1,511 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file ldap_mux.c
+ * @brief Check multiplexing rlm_ldap searches over shared connections.
+ *
+ * The libldap calls made by src/modules/rlm_ldap/mux.c are replaced with a
+ * fake server, which answers each search after the delay given in its filter.
+ * Checks that results find the search they belong to when many searches are
+ * outstanding on one connection, that searches which time out are abandoned,
+ * and that a failed connection is replaced once, however many searches were
+ * using it.
+ *
+ * @copyright 2015 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include "../modules/rlm_ldap/ldap.h"
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#ifdef HAVE_PTHREAD_H
+pid_t rad_fork(void)
+{
+	return fork();
+}
+
+pid_t rad_waitpid(pid_t pid, int *status)
+{
+	return waitpid(pid, status, 0);
+}
+#endif
+
+#define NUM_SEARCHES	(8)
+
+/*
+ *	A fake server.  Each search is answered after the number of
+ *	milliseconds in its filter, e.g. "(delay=100)".  "(never)" is
+ *	never answered.
+ */
+struct ldapmsg {
+	int		msgid;
+	char		filter[64];		//!< Of the search this is the result of.
+	struct timeval	due;			//!< When the result can be retrieved.
+	struct ldapmsg	*next;
+};
+
+struct ldap {
+	int		fd[2];			//!< Readable when a result is ready.
+	bool		down;			//!< Fail every call, as if the server had gone away.
+	int		next_msgid;
+	struct ldapmsg	*queued;		//!< Results which haven't been retrieved, oldest first.
+
+	int		outstanding;		//!< Searches which haven't been answered or abandoned.
+	int		max_outstanding;
+	int		abandoned[NUM_SEARCHES];	//!< msgids of abandoned searches.
+	int		num_abandoned;
+};
+
+static int	connects;		//!< Calls to mod_conn_create().
+static int	messages;		//!< Results which haven't been freed.
+static LDAP	*last_ld;		//!< Handle made by the last call to mod_conn_create().
+
+static void fake_signal(LDAP *ld)
+{
+	if (write(ld->fd[1], "x", 1) < 0) {
+		fprintf(stderr, "ldap_mux: Failed writing to pipe: %s\n", fr_syserror(errno));
+		exit(1);
+	}
+}
+
+static bool fake_abandoned(LDAP *ld, int msgid)
+{
+	int i;
+
+	for (i = 0; i < ld->num_abandoned; i++) if (ld->abandoned[i] == msgid) return true;
+
+	return false;
+}
+
+int ldap_get_option(LDAP *ld, int option, void *outvalue)
+{
+	switch (option) {
+	case LDAP_OPT_DESC:
+		*((int *) outvalue) = ld->fd[0];
+		return LDAP_OPT_SUCCESS;
+
+	case LDAP_OPT_ERROR_NUMBER:
+		*((int *) outvalue) = ld->down ? LDAP_SERVER_DOWN : LDAP_SUCCESS;
+		return LDAP_OPT_SUCCESS;
+
+	default:
+		return LDAP_OPT_ERROR;
+	}
+}
+
+int ldap_search_ext(LDAP *ld, UNUSED LDAP_CONST char *base, UNUSED int scope, LDAP_CONST char *filter,
+		    UNUSED char **attrs, UNUSED int attrsonly, UNUSED LDAPControl **serverctrls,
+		    UNUSED LDAPControl **clientctrls, UNUSED struct timeval *timeout, UNUSED int sizelimit,
+		    int *msgidp)
+{
+	struct ldapmsg	*msg, **last;
+	int		delay;
+
+	if (ld->down) return LDAP_SERVER_DOWN;
+
+	*msgidp = ++ld->next_msgid;
+	if (++ld->outstanding > ld->max_outstanding) ld->max_outstanding = ld->outstanding;
+
+	if (sscanf(filter, "(delay=%d)", &delay) != 1) return LDAP_SUCCESS;
+
+	msg = calloc(1, sizeof(*msg));
+	if (!msg) return LDAP_NO_MEMORY;
+	messages++;
+
+	msg->msgid = *msgidp;
+	strlcpy(msg->filter, filter, sizeof(msg->filter));
+	gettimeofday(&msg->due, NULL);
+	msg->due.tv_sec += delay / 1000;
+	msg->due.tv_usec += (delay % 1000) * 1000;
+	if (msg->due.tv_usec >= 1000000) {
+		msg->due.tv_sec++;
+		msg->due.tv_usec -= 1000000;
+	}
+	for (last = &ld->queued; *last; last = &(*last)->next);
+	*last = msg;
+
+	/*
+	 *	Later results are found when the reader's poll()
+	 *	times out.
+	 */
+	if (!delay) fake_signal(ld);
+
+	return LDAP_SUCCESS;
+}
+
+int ldap_result(LDAP *ld, UNUSED int msgid, UNUSED int all, UNUSED struct timeval *timeout, LDAPMessage **result)
+{
+	struct ldapmsg	**last, *msg;
+	struct timeval	now;
+	char		buffer[64];
+
+	if (ld->down) return -1;
+
+	while (read(ld->fd[0], buffer, sizeof(buffer)) > 0);
+
+	gettimeofday(&now, NULL);
+	for (last = &ld->queued; *last; last = &(*last)->next) {
+		msg = *last;
+		if (timercmp(&now, &msg->due, <)) continue;
+
+		*last = msg->next;
+		msg->next = NULL;
+		if (!fake_abandoned(ld, msg->msgid)) ld->outstanding--;
+
+		*result = msg;
+		return LDAP_RES_SEARCH_RESULT;
+	}
+
+	return 0;
+}
+
+int ldap_msgid(LDAPMessage *msg)
+{
+	return msg->msgid;
+}
+
+int ldap_msgfree(LDAPMessage *msg)
+{
+	free(msg);
+	messages--;
+
+	return LDAP_RES_SEARCH_RESULT;
+}
+
+int ldap_abandon_ext(LDAP *ld, int msgid, UNUSED LDAPControl **sctrls, UNUSED LDAPControl **cctrls)
+{
+	if (ld->num_abandoned < NUM_SEARCHES) ld->abandoned[ld->num_abandoned++] = msgid;
+	ld->outstanding--;
+
+	return LDAP_SUCCESS;
+}
+
+static int _fake_conn_free(ldap_handle_t *conn)
+{
+	LDAP		*ld = conn->handle;
+	struct ldapmsg	*msg, *next;
+
+	for (msg = ld->queued; msg; msg = next) {
+		next = msg->next;
+		ldap_msgfree(msg);
+	}
+	close(ld->fd[0]);
+	close(ld->fd[1]);
+
+	return 0;
+}
+
+/*
+ *	Replaces the real one in ldap.c.
+ */
+void *mod_conn_create(TALLOC_CTX *ctx, void *instance)
+{
+	ldap_handle_t	*conn;
+	LDAP		*ld;
+	int		fd;
+
+	conn = talloc_zero(ctx, ldap_handle_t);
+	ld = talloc_zero(conn, LDAP);
+	conn->handle = ld;
+	conn->inst = instance;
+
+	if (pipe(ld->fd) < 0) {
+		fprintf(stderr, "ldap_mux: Failed creating pipe: %s\n", fr_syserror(errno));
+		exit(1);
+	}
+
+	/*
+	 *	A busy server has many descriptors open.  Make sure
+	 *	ones too large for select() work.
+	 */
+	fd = fcntl(ld->fd[0], F_DUPFD, FD_SETSIZE);
+	if (fd >= 0) {
+		close(ld->fd[0]);
+		ld->fd[0] = fd;
+	}
+	fcntl(ld->fd[0], F_SETFL, O_NONBLOCK);
+
+	talloc_set_destructor(conn, _fake_conn_free);
+
+	connects++;
+	last_ld = ld;
+
+	return conn;
+}
+
+/*
+ *	Replaces the real one in ldap.c.
+ */
+ldap_rcode_t rlm_ldap_result_parse(UNUSED rlm_ldap_t const *inst, UNUSED ldap_handle_t const *conn, int lib_errno,
+				   UNUSED char const *dn, LDAPMessage **result, UNUSED bool freeit,
+				   char const **error, UNUSED char **extra)
+{
+	if (error) *error = NULL;
+
+	switch (lib_errno) {
+	case LDAP_SUCCESS:
+		return *result ? LDAP_PROC_SUCCESS : LDAP_PROC_ERROR;
+
+	case LDAP_TIMEOUT:
+	case LDAP_SERVER_DOWN:
+		return LDAP_PROC_RETRY;
+
+	default:
+		return LDAP_PROC_ERROR;
+	}
+}
+
+typedef struct mux_test {
+	rlm_ldap_t	*inst;
+	ldap_search_t	search;
+	char		filter[64];
+	ldap_rcode_t	status;
+	LDAPMessage	*result;
+} mux_test_t;
+
+static void search_send(rlm_ldap_t *inst, mux_test_t *t, char const *filter)
+{
+	memset(t, 0, sizeof(*t));
+	t->inst = inst;
+	strlcpy(t->filter, filter, sizeof(t->filter));
+
+	t->search.dn = "dc=example,dc=com";
+	t->search.scope = LDAP_SCOPE_SUB;
+	t->search.filter = t->filter;
+
+	rlm_ldap_mux_send(inst, NULL, &t->search);
+}
+
+static void *search_wait(void *arg)
+{
+	mux_test_t *t = arg;
+
+	t->status = rlm_ldap_mux_result(t->inst, &t->search, &t->result, NULL, NULL);
+
+	return NULL;
+}
+
+#define CHECK(_x) do { \
+	if (!(_x)) { \
+		fprintf(stderr, "ldap_mux: %s[%u]: Check \"%s\" failed\n", __FILE__, __LINE__, #_x); \
+		exit(1); \
+	} \
+} while (0)
+
+/** Many searches outstanding on one connection, answered out of order
+ *
+ */
+static void test_multiplex(rlm_ldap_t *inst)
+{
+	mux_test_t	tests[NUM_SEARCHES];
+	pthread_t	threads[NUM_SEARCHES];
+	int		i;
+
+	for (i = 0; i < NUM_SEARCHES; i++) {
+		char filter[64];
+
+		snprintf(filter, sizeof(filter), "(delay=%d)", (NUM_SEARCHES - i - 1) * 50);
+		search_send(inst, &tests[i], filter);
+		CHECK(tests[i].search.msgid > 0);
+	}
+	CHECK(last_ld->max_outstanding == NUM_SEARCHES);
+
+	for (i = 0; i < NUM_SEARCHES; i++) CHECK(pthread_create(&threads[i], NULL, search_wait, &tests[i]) == 0);
+	for (i = 0; i < NUM_SEARCHES; i++) pthread_join(threads[i], NULL);
+
+	for (i = 0; i < NUM_SEARCHES; i++) {
+		CHECK(tests[i].status == LDAP_PROC_SUCCESS);
+		CHECK(tests[i].result != NULL);
+		CHECK(ldap_msgid(tests[i].result) == tests[i].search.msgid);
+		CHECK(strcmp(tests[i].result->filter, tests[i].filter) == 0);
+
+		ldap_msgfree(tests[i].result);
+	}
+	CHECK(last_ld->outstanding == 0);
+	CHECK(last_ld->num_abandoned == 0);
+}
+
+/** Searches which take too long are abandoned, and late results are freed
+ *
+ */
+static void test_timeout(rlm_ldap_t *inst)
+{
+	mux_test_t	never, late, quick;
+	struct timeval	start, now;
+
+	search_send(inst, &never, "(never)");
+	search_send(inst, &late, "(delay=2500)");
+
+	gettimeofday(&start, NULL);
+	search_wait(&never);
+	gettimeofday(&now, NULL);
+
+	CHECK(never.status == LDAP_PROC_RETRY);
+	CHECK(never.search.lib_errno == LDAP_TIMEOUT);
+	CHECK(never.result == NULL);
+	CHECK(fake_abandoned(last_ld, never.search.msgid));
+	CHECK((now.tv_sec - start.tv_sec) >= (time_t) (inst->res_timeout - 1));
+	CHECK((now.tv_sec - start.tv_sec) <= (time_t) (inst->res_timeout + 1));
+
+	search_wait(&late);
+	CHECK(late.status == LDAP_PROC_RETRY);
+	CHECK(fake_abandoned(last_ld, late.search.msgid));
+
+	/*
+	 *	The result of the late search arrives while we're
+	 *	waiting for this one.  Nobody wants it, so it must
+	 *	be freed.
+	 */
+	usleep(600000);
+	search_send(inst, &quick, "(delay=0)");
+	search_wait(&quick);
+	CHECK(quick.status == LDAP_PROC_SUCCESS);
+	CHECK(ldap_msgid(quick.result) == quick.search.msgid);
+	ldap_msgfree(quick.result);
+
+	CHECK(last_ld->queued == NULL);
+	CHECK(messages == 0);
+}
+
+/** Searches abandoned by the caller are abandoned on the server
+ *
+ */
+static void test_abandon(rlm_ldap_t *inst)
+{
+	mux_test_t t;
+
+	search_send(inst, &t, "(never)");
+	rlm_ldap_mux_abandon(inst, &t.search);
+
+	CHECK(t.search.done);
+	CHECK(fake_abandoned(last_ld, t.search.msgid));
+}
+
+/** A failed connection is replaced once, and every search using it is retried
+ *
+ */
+static void test_reconnect(rlm_ldap_t *inst)
+{
+	mux_test_t	a, b, retry;
+	LDAP		*old_ld = last_ld;
+	int		old_connects = connects;
+
+	search_send(inst, &a, "(never)");
+	search_send(inst, &b, "(never)");
+
+	old_ld->down = true;
+
+	/*
+	 *	Both searches fail, as soon as the reader finds the
+	 *	connection is down.
+	 */
+	search_wait(&a);
+	CHECK(a.status == LDAP_PROC_RETRY);
+	CHECK(a.search.lib_errno == LDAP_SERVER_DOWN);
+	CHECK(b.search.done);
+	CHECK(b.search.lib_errno == LDAP_SERVER_DOWN);
+
+	CHECK(rlm_ldap_mux_reconnect(inst, &a.search) == 0);
+	CHECK(connects == (old_connects + 1));
+	CHECK(last_ld != old_ld);
+
+	/*
+	 *	b was sent on the old connection too, so it must not
+	 *	replace the new one.
+	 */
+	CHECK(rlm_ldap_mux_reconnect(inst, &b.search) == 0);
+	CHECK(connects == (old_connects + 1));
+
+	search_send(inst, &retry, "(delay=0)");
+	CHECK(retry.search.generation != a.search.generation);
+	search_wait(&retry);
+	CHECK(retry.status == LDAP_PROC_SUCCESS);
+	ldap_msgfree(retry.result);
+
+	/*
+	 *	Abandoning a search from the old connection mustn't
+	 *	touch the new one.
+	 */
+	rlm_ldap_mux_abandon(inst, &b.search);
+	CHECK(last_ld->num_abandoned == 0);
+}
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: ldap_mux [OPTS]\n");
+	fprintf(stderr, "  -D <dictdir>           Ignored.\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int		c;
+	rlm_ldap_t	*inst;
+	struct rlimit	limit;
+
+	while ((c = getopt(argc, argv, "D:xh")) != EOF) switch (c) {
+		case 'D':
+			break;
+		case 'x':
+			fr_debug_lvl++;
+			rad_debug_lvl = fr_debug_lvl;
+			break;
+		case 'h':
+		default:
+			usage();
+	}
+
+	/*
+	 *	So that the fake server's descriptors can be above
+	 *	FD_SETSIZE.
+	 */
+	if ((getrlimit(RLIMIT_NOFILE, &limit) == 0) && (limit.rlim_cur < (FD_SETSIZE + 16))) {
+		limit.rlim_cur = (limit.rlim_max < (FD_SETSIZE + 16)) ? limit.rlim_max : (FD_SETSIZE + 16);
+		(void) setrlimit(RLIMIT_NOFILE, &limit);
+	}
+
+	inst = talloc_zero(NULL, rlm_ldap_t);
+	inst->name = "ldap_mux";
+	inst->res_timeout = 1;
+	inst->mux_connections = 1;
+
+	if (rlm_ldap_mux_init(inst) < 0) {
+		fprintf(stderr, "ldap_mux: Failed initialising multiplexer\n");
+		return 1;
+	}
+	CHECK(connects == 1);
+
+	test_multiplex(inst);
+	test_timeout(inst);
+	test_abandon(inst);
+	test_reconnect(inst);
+
+	talloc_free(inst);
+	CHECK(messages == 0);
+
+	return 0;
+}
@@ -0,0 +1,7 @@
+TARGET		:= ldap_mux
+SOURCES		:= ldap_mux.c ../modules/rlm_ldap/mux.c
+
+SRC_CFLAGS	:= $(RLM_LDAP_CFLAGS)
+TGT_PREREQS	:= libfreeradius-server.a libfreeradius-radius.a
+TGT_LDLIBS	:= $(LIBS)
+TGT_INSTALLDIR	:=
@@ -0,0 +1,391 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file log_async.c
+ * @brief Check that messages logged asynchronously are written.
+ *
+ * Logs rounds of messages from a thread, both while the writer thread is
+ * idle and while it's busy writing earlier messages, and checks that every
+ * message arrives without anything else being logged to push it out.  Then
+ * checks that with "count", the number of messages dropped is logged once
+ * there's space again, and that threads can keep logging while the writer
+ * thread is stopped, and exit afterwards.
+ *
+ * @copyright 2015 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/radiusd.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+#include <poll.h>
+#include <sys/wait.h>
+
+#define NUM_ROUNDS	(500)
+#define ROUND_MESSAGES	(16)
+#define MESSAGE_SIZE	(8192)		//!< Large, so that copying a message takes a while.
+#define ROUND_TIMEOUT	(5000)		//!< How long to wait for a round's messages, in milliseconds.
+#define COUNT_MESSAGES	(40)		//!< Many more than fit in the pipe and the ring.
+#define IDLE_TIMEOUT	(500)		//!< How long to wait before deciding nothing else is queued.
+
+#ifdef HAVE_PTHREAD_H
+pid_t rad_fork(void)
+{
+	return fork();
+}
+
+pid_t rad_waitpid(pid_t pid, int *status)
+{
+	return waitpid(pid, status, 0);
+}
+#endif
+
+#if defined(HAVE_PTHREAD_H) && defined(HAVE_STDATOMIC_H)
+static pthread_mutex_t	round_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	round_cond = PTHREAD_COND_INITIALIZER;
+static int		round_started;	//!< Rounds the logging thread has been told to start.
+static int		step;		//!< How far through test_count() or test_stop() we are.
+
+#define CHECK(_x) do { \
+	if (!(_x)) { \
+		fprintf(stderr, "log_async: %s[%u]: Check \"%s\" failed\n", __FILE__, __LINE__, #_x); \
+		exit(1); \
+	} \
+} while (0)
+
+typedef struct line_reader_t {
+	int		fd;
+	char		buffer[MESSAGE_SIZE * 2];
+	size_t		len;
+	size_t		used;		//!< Length of the line returned last.
+} line_reader_t;
+
+/** Log a round of messages each time we're told to
+ *
+ * The thread only exits once every round has been checked, as
+ * a thread exiting also wakes the writer thread.
+ */
+static void *log_thread(UNUSED void *arg)
+{
+	int	i, j;
+	char	padding[MESSAGE_SIZE];
+
+	memset(padding, 'x', sizeof(padding) - 1);
+	padding[sizeof(padding) - 1] = '\0';
+
+	for (i = 0; i < NUM_ROUNDS; i++) {
+		pthread_mutex_lock(&round_mutex);
+		while (round_started <= i) pthread_cond_wait(&round_cond, &round_mutex);
+		pthread_mutex_unlock(&round_mutex);
+
+		for (j = 0; j < ROUND_MESSAGES; j++) INFO("log_async round %i message %i %s", i, j, padding);
+	}
+
+	return NULL;
+}
+
+/** Wait for the other thread to get to a step
+ *
+ */
+static void step_wait(int value)
+{
+	pthread_mutex_lock(&round_mutex);
+	while (step < value) pthread_cond_wait(&round_cond, &round_mutex);
+	pthread_mutex_unlock(&round_mutex);
+}
+
+/** Tell the other thread we've got to a step
+ *
+ */
+static void step_set(int value)
+{
+	pthread_mutex_lock(&round_mutex);
+	step = value;
+	pthread_cond_broadcast(&round_cond);
+	pthread_mutex_unlock(&round_mutex);
+}
+
+/** Log more messages than fit, then one more once we're told there's space
+ *
+ */
+static void *count_thread(UNUSED void *arg)
+{
+	int	i;
+	char	padding[MESSAGE_SIZE];
+
+	memset(padding, 'x', sizeof(padding) - 1);
+	padding[sizeof(padding) - 1] = '\0';
+
+	for (i = 0; i < COUNT_MESSAGES; i++) INFO("log_async count %i %s", i, padding);
+	step_set(1);
+
+	step_wait(2);
+	INFO("log_async count last");
+
+	return NULL;
+}
+
+/** Log a message before and after the writer thread is stopped
+ *
+ */
+static void *stop_thread(UNUSED void *arg)
+{
+	INFO("log_async stop before");
+
+	step_wait(3);
+	INFO("log_async stop after");
+
+	return NULL;
+}
+
+/** Read a line, or return NULL if none arrives in time
+ *
+ */
+static char *read_line(line_reader_t *reader, int timeout)
+{
+	char		*nl;
+	ssize_t		len;
+	struct pollfd	pfd;
+
+	memmove(reader->buffer, reader->buffer + reader->used, reader->len - reader->used);
+	reader->len -= reader->used;
+	reader->used = 0;
+
+	pfd.fd = reader->fd;
+	pfd.events = POLLIN;
+
+	while (!(nl = memchr(reader->buffer, '\n', reader->len))) {
+		CHECK(reader->len < sizeof(reader->buffer));
+
+		if (poll(&pfd, 1, timeout) <= 0) return NULL;
+
+		len = read(reader->fd, reader->buffer + reader->len, sizeof(reader->buffer) - reader->len);
+		if (len <= 0) return NULL;
+		reader->len += len;
+	}
+
+	*nl = '\0';
+	reader->used = (nl - reader->buffer) + 1;
+
+	return reader->buffer;
+}
+
+/** Read lines from the pipe until we have enough, or we give up waiting
+ *
+ */
+static int read_lines(int fd, int lines)
+{
+	char		buffer[4096];
+	ssize_t		len, i;
+	struct pollfd	pfd;
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+
+	while (lines > 0) {
+		if (poll(&pfd, 1, ROUND_TIMEOUT) <= 0) return lines;
+
+		len = read(fd, buffer, sizeof(buffer));
+		if (len <= 0) return lines;
+
+		for (i = 0; i < len; i++) if (buffer[i] == '\n') lines--;
+	}
+
+	return 0;
+}
+#endif
+
+#if defined(HAVE_PTHREAD_H) && defined(HAVE_STDATOMIC_H)
+/** Count a message, or return how many messages were dropped
+ *
+ */
+static int count_line(char const *line, int *written)
+{
+	char const *p;
+
+	if (strstr(line, "log_async count ")) {
+		(*written)++;
+		return 0;
+	}
+
+	p = strstr(line, "Warning: ");
+	CHECK(p != NULL);
+	CHECK(atoi(p + 9) > 0);
+
+	return atoi(p + 9);
+}
+
+/** Messages which don't fit are counted, and the count is logged
+ *
+ * Nothing reads the pipe until the thread has logged everything, so
+ * the writer thread blocks writing to it, and the thread's ring fills.
+ */
+static void test_count(int fd)
+{
+	pthread_t	thread;
+	line_reader_t	reader;
+	char		*line;
+	int		written = 0, dropped = 0;
+	uint64_t	queued, total_dropped, writes;
+
+	memset(&reader, 0, sizeof(reader));
+	reader.fd = fd;
+
+	default_log.async_overflow = L_ASYNC_COUNT;
+	default_log.async_buffer_size = 16384;
+
+	CHECK(pthread_create(&thread, NULL, count_thread, NULL) == 0);
+	step_wait(1);
+
+	/*
+	 *	Read everything which was queued.  Whenever the
+	 *	writer made space, the next message was preceded
+	 *	by the number dropped before it.
+	 */
+	while ((line = read_line(&reader, IDLE_TIMEOUT))) dropped += count_line(line, &written);
+
+	/*
+	 *	There's space now, so the last message is queued,
+	 *	after the number of messages dropped since the
+	 *	last one which wasn't.
+	 */
+	step_set(2);
+	while ((line = read_line(&reader, ROUND_TIMEOUT))) {
+		if (strstr(line, "log_async count last")) break;
+
+		dropped += count_line(line, &written);
+	}
+	CHECK(line != NULL);
+	pthread_join(thread, NULL);
+
+	CHECK(dropped > 0);
+	CHECK(written + dropped == COUNT_MESSAGES);
+
+	radlog_async_stats(&queued, &total_dropped, &writes);
+	CHECK(total_dropped == (uint64_t) dropped);
+}
+
+/** Threads can keep logging after the writer thread has stopped
+ *
+ */
+static void test_stop(int fd)
+{
+	pthread_t	thread;
+	line_reader_t	reader;
+	char		*line;
+
+	memset(&reader, 0, sizeof(reader));
+	reader.fd = fd;
+
+	CHECK(pthread_create(&thread, NULL, stop_thread, NULL) == 0);
+
+	line = read_line(&reader, ROUND_TIMEOUT);
+	CHECK(line && strstr(line, "log_async stop before"));
+
+	radlog_async_stop();
+
+	step_set(3);
+	line = read_line(&reader, ROUND_TIMEOUT);
+	CHECK(line && strstr(line, "log_async stop after"));
+
+	/*
+	 *	The thread frees its own ring as it exits.
+	 */
+	pthread_join(thread, NULL);
+}
+#endif
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: log_async [OPTS]\n");
+	fprintf(stderr, "  -D <dictdir>           Ignored.\n");
+
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int		c;
+
+	while ((c = getopt(argc, argv, "D:h")) != EOF) switch (c) {
+		case 'D':
+			break;
+		case 'h':
+		default:
+			usage();
+	}
+
+#if defined(HAVE_PTHREAD_H) && defined(HAVE_STDATOMIC_H)
+	{
+		int		i, fd[2], missing;
+		pthread_t	thread;
+
+		if (pipe(fd) < 0) {
+			fprintf(stderr, "log_async: Failed creating pipe: %s\n", fr_syserror(errno));
+			return 1;
+		}
+
+		default_log.fd = fd[1];
+		default_log.dst = L_DST_FILES;
+		default_log.async = true;
+		default_log.async_overflow = L_ASYNC_BLOCK;
+
+		if (radlog_async_start() < 0) {
+			fprintf(stderr, "log_async: Failed starting the writer thread\n");
+			return 1;
+		}
+
+		if (pthread_create(&thread, NULL, log_thread, NULL) != 0) {
+			fprintf(stderr, "log_async: Failed creating thread\n");
+			return 1;
+		}
+
+		for (i = 0; i < NUM_ROUNDS; i++) {
+			/*
+			 *	Every other round, give the writer
+			 *	time to go to sleep first.
+			 */
+			if (i & 0x01) usleep(1000);
+
+			pthread_mutex_lock(&round_mutex);
+			round_started++;
+			pthread_cond_signal(&round_cond);
+			pthread_mutex_unlock(&round_mutex);
+
+			/*
+			 *	Read while the thread is logging, so the
+			 *	writer thread never blocks on a full pipe.
+			 */
+			missing = read_lines(fd[0], ROUND_MESSAGES);
+			if (missing) {
+				fprintf(stderr, "log_async: Round %i, %i message(s) were not written\n", i, missing);
+				return 1;
+			}
+		}
+		pthread_join(thread, NULL);
+
+		test_count(fd[0]);
+		test_stop(fd[0]);
+	}
+#endif
+
+	return 0;
+}
@@ -0,0 +1,6 @@
+TARGET		:= log_async
+SOURCES		:= log_async.c
+
+TGT_PREREQS	:= libfreeradius-server.a libfreeradius-radius.a
+TGT_LDLIBS	:= $(LIBS)
+TGT_INSTALLDIR	:=
@@ -0,0 +1,29 @@
+use strict;
+use warnings;
+
+use vars qw(%RAD_REQUEST %RAD_REPLY %RAD_CHECK);
+
+use constant {
+	RLM_MODULE_REJECT	=> 0,
+	RLM_MODULE_OK		=> 2,
+};
+
+#
+#  Counts the calls made to each interpreter
+#
+our $calls = 0;
+
+sub authorize {
+	$calls++;
+
+	return RLM_MODULE_REJECT if ($RAD_REQUEST{'User-Name'} eq 'reject');
+
+	$RAD_REPLY{'Reply-Message'} = "Hello $RAD_REQUEST{'User-Name'}";
+	$RAD_REPLY{'Filter-Id'} = "calls $calls";
+
+	return RLM_MODULE_OK;
+}
+
+sub xlat {
+	return join(' ', reverse(@_));
+}
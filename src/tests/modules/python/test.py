@@ -0,0 +1,8 @@
+import radiusd
+
+def authorize(p):
+  d = dict(p)
+  if d['User-Name'] == 'reject':
+    return radiusd.RLM_MODULE_REJECT
+
+  return (radiusd.RLM_MODULE_OK, (('Reply-Message', 'Hello ' + d['User-Name']),), ())
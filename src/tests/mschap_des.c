@@ -0,0 +1,386 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file mschap_des.c
+ * @brief Check the DES used by MS-CHAP.
+ *
+ * Checks smbhash() against the FIPS 81 example and the NIST SP 800-17
+ * variable plaintext and variable key known answer tests, and
+ * smbdes_lmpwdhash() and smbdes_mschap() against known answers.  Then
+ * checks all three give the same answers as the bitwise DES, built from
+ * the same source by mschap_des_bitwise.c, for random keys, blocks and
+ * passwords.  With -b, also times MS-CHAP responses with both.
+ *
+ * @copyright 2015 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+#include "smbdes.h"
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+#define CHECK(_x) do { \
+	if (!(_x)) { \
+		fprintf(stderr, "mschap_des: %s[%u]: Check \"%s\" failed\n", __FILE__, __LINE__, #_x); \
+		exit(1); \
+	} \
+} while (0)
+
+/*
+ *	In mschap_des_bitwise.c
+ */
+void bitwise_smbhash(unsigned char *out, unsigned char const *in, unsigned char *key);
+void bitwise_smbdes_lmpwdhash(char const *password, uint8_t *lmhash);
+void bitwise_smbdes_mschap(uint8_t const win_password[16],
+			   uint8_t const *challenge, uint8_t *response);
+
+/*
+ *	FIPS 81 / "The DES Illustrated" key and block, with the
+ *	parity bits removed from the key, as smbhash() expects.
+ */
+static uint8_t const des_key[7] = { 0x12, 0x69, 0x5b, 0xc9, 0xb7, 0xb7, 0xf8 };
+static uint8_t const des_plain[8] = { 0x01, 0x23, 0x45, 0x67, 0x89, 0xab, 0xcd, 0xef };
+static uint8_t const des_cipher[8] = { 0x85, 0xe8, 0x13, 0x54, 0x0f, 0x0a, 0xb4, 0x05 };
+
+/*
+ *	NIST SP 800-17 variable plaintext known answers.  The key is
+ *	0x0101010101010101, i.e. zero without the parity bits, and
+ *	plaintext i has only bit i set.
+ */
+static uint8_t const des_vp[64][8] = {
+	{ 0x95, 0xf8, 0xa5, 0xe5, 0xdd, 0x31, 0xd9, 0x00 },
+	{ 0xdd, 0x7f, 0x12, 0x1c, 0xa5, 0x01, 0x56, 0x19 },
+	{ 0x2e, 0x86, 0x53, 0x10, 0x4f, 0x38, 0x34, 0xea },
+	{ 0x4b, 0xd3, 0x88, 0xff, 0x6c, 0xd8, 0x1d, 0x4f },
+	{ 0x20, 0xb9, 0xe7, 0x67, 0xb2, 0xfb, 0x14, 0x56 },
+	{ 0x55, 0x57, 0x93, 0x80, 0xd7, 0x71, 0x38, 0xef },
+	{ 0x6c, 0xc5, 0xde, 0xfa, 0xaf, 0x04, 0x51, 0x2f },
+	{ 0x0d, 0x9f, 0x27, 0x9b, 0xa5, 0xd8, 0x72, 0x60 },
+	{ 0xd9, 0x03, 0x1b, 0x02, 0x71, 0xbd, 0x5a, 0x0a },
+	{ 0x42, 0x42, 0x50, 0xb3, 0x7c, 0x3d, 0xd9, 0x51 },
+	{ 0xb8, 0x06, 0x1b, 0x7e, 0xcd, 0x9a, 0x21, 0xe5 },
+	{ 0xf1, 0x5d, 0x0f, 0x28, 0x6b, 0x65, 0xbd, 0x28 },
+	{ 0xad, 0xd0, 0xcc, 0x8d, 0x6e, 0x5d, 0xeb, 0xa1 },
+	{ 0xe6, 0xd5, 0xf8, 0x27, 0x52, 0xad, 0x63, 0xd1 },
+	{ 0xec, 0xbf, 0xe3, 0xbd, 0x3f, 0x59, 0x1a, 0x5e },
+	{ 0xf3, 0x56, 0x83, 0x43, 0x79, 0xd1, 0x65, 0xcd },
+	{ 0x2b, 0x9f, 0x98, 0x2f, 0x20, 0x03, 0x7f, 0xa9 },
+	{ 0x88, 0x9d, 0xe0, 0x68, 0xa1, 0x6f, 0x0b, 0xe6 },
+	{ 0xe1, 0x9e, 0x27, 0x5d, 0x84, 0x6a, 0x12, 0x98 },
+	{ 0x32, 0x9a, 0x8e, 0xd5, 0x23, 0xd7, 0x1a, 0xec },
+	{ 0xe7, 0xfc, 0xe2, 0x25, 0x57, 0xd2, 0x3c, 0x97 },
+	{ 0x12, 0xa9, 0xf5, 0x81, 0x7f, 0xf2, 0xd6, 0x5d },
+	{ 0xa4, 0x84, 0xc3, 0xad, 0x38, 0xdc, 0x9c, 0x19 },
+	{ 0xfb, 0xe0, 0x0a, 0x8a, 0x1e, 0xf8, 0xad, 0x72 },
+	{ 0x75, 0x0d, 0x07, 0x94, 0x07, 0x52, 0x13, 0x63 },
+	{ 0x64, 0xfe, 0xed, 0x9c, 0x72, 0x4c, 0x2f, 0xaf },
+	{ 0xf0, 0x2b, 0x26, 0x3b, 0x32, 0x8e, 0x2b, 0x60 },
+	{ 0x9d, 0x64, 0x55, 0x5a, 0x9a, 0x10, 0xb8, 0x52 },
+	{ 0xd1, 0x06, 0xff, 0x0b, 0xed, 0x52, 0x55, 0xd7 },
+	{ 0xe1, 0x65, 0x2c, 0x6b, 0x13, 0x8c, 0x64, 0xa5 },
+	{ 0xe4, 0x28, 0x58, 0x11, 0x86, 0xec, 0x8f, 0x46 },
+	{ 0xae, 0xb5, 0xf5, 0xed, 0xe2, 0x2d, 0x1a, 0x36 },
+	{ 0xe9, 0x43, 0xd7, 0x56, 0x8a, 0xec, 0x0c, 0x5c },
+	{ 0xdf, 0x98, 0xc8, 0x27, 0x6f, 0x54, 0xb0, 0x4b },
+	{ 0xb1, 0x60, 0xe4, 0x68, 0x0f, 0x6c, 0x69, 0x6f },
+	{ 0xfa, 0x07, 0x52, 0xb0, 0x7d, 0x9c, 0x4a, 0xb8 },
+	{ 0xca, 0x3a, 0x2b, 0x03, 0x6d, 0xbc, 0x85, 0x02 },
+	{ 0x5e, 0x09, 0x05, 0x51, 0x7b, 0xb5, 0x9b, 0xcf },
+	{ 0x81, 0x4e, 0xeb, 0x3b, 0x91, 0xd9, 0x07, 0x26 },
+	{ 0x4d, 0x49, 0xdb, 0x15, 0x32, 0x91, 0x9c, 0x9f },
+	{ 0x25, 0xeb, 0x5f, 0xc3, 0xf8, 0xcf, 0x06, 0x21 },
+	{ 0xab, 0x6a, 0x20, 0xc0, 0x62, 0x0d, 0x1c, 0x6f },
+	{ 0x79, 0xe9, 0x0d, 0xbc, 0x98, 0xf9, 0x2c, 0xca },
+	{ 0x86, 0x6e, 0xce, 0xdd, 0x80, 0x72, 0xbb, 0x0e },
+	{ 0x8b, 0x54, 0x53, 0x6f, 0x2f, 0x3e, 0x64, 0xa8 },
+	{ 0xea, 0x51, 0xd3, 0x97, 0x55, 0x95, 0xb8, 0x6b },
+	{ 0xca, 0xff, 0xc6, 0xac, 0x45, 0x42, 0xde, 0x31 },
+	{ 0x8d, 0xd4, 0x5a, 0x2d, 0xdf, 0x90, 0x79, 0x6c },
+	{ 0x10, 0x29, 0xd5, 0x5e, 0x88, 0x0e, 0xc2, 0xd0 },
+	{ 0x5d, 0x86, 0xcb, 0x23, 0x63, 0x9d, 0xbe, 0xa9 },
+	{ 0x1d, 0x1c, 0xa8, 0x53, 0xae, 0x7c, 0x0c, 0x5f },
+	{ 0xce, 0x33, 0x23, 0x29, 0x24, 0x8f, 0x32, 0x28 },
+	{ 0x84, 0x05, 0xd1, 0xab, 0xe2, 0x4f, 0xb9, 0x42 },
+	{ 0xe6, 0x43, 0xd7, 0x80, 0x90, 0xca, 0x42, 0x07 },
+	{ 0x48, 0x22, 0x1b, 0x99, 0x37, 0x74, 0x8a, 0x23 },
+	{ 0xdd, 0x7c, 0x0b, 0xbd, 0x61, 0xfa, 0xfd, 0x54 },
+	{ 0x2f, 0xbc, 0x29, 0x1a, 0x57, 0x0d, 0xb5, 0xc4 },
+	{ 0xe0, 0x7c, 0x30, 0xd7, 0xe4, 0xe2, 0x6e, 0x12 },
+	{ 0x09, 0x53, 0xe2, 0x25, 0x8e, 0x8e, 0x90, 0xa1 },
+	{ 0x5b, 0x71, 0x1b, 0xc4, 0xce, 0xeb, 0xf2, 0xee },
+	{ 0xcc, 0x08, 0x3f, 0x1e, 0x6d, 0x9e, 0x85, 0xf6 },
+	{ 0xd2, 0xfd, 0x88, 0x67, 0xd5, 0x0d, 0x2d, 0xfe },
+	{ 0x06, 0xe7, 0xea, 0x22, 0xce, 0x92, 0x70, 0x8f },
+	{ 0x16, 0x6b, 0x40, 0xb4, 0x4a, 0xba, 0x4b, 0xd6 }
+};
+
+/*
+ *	NIST SP 800-17 variable key known answers.  The plaintext is
+ *	zero, and key i has only bit i of the 56 set.
+ */
+static uint8_t const des_vk[56][8] = {
+	{ 0x95, 0xa8, 0xd7, 0x28, 0x13, 0xda, 0xa9, 0x4d },
+	{ 0x0e, 0xec, 0x14, 0x87, 0xdd, 0x8c, 0x26, 0xd5 },
+	{ 0x7a, 0xd1, 0x6f, 0xfb, 0x79, 0xc4, 0x59, 0x26 },
+	{ 0xd3, 0x74, 0x62, 0x94, 0xca, 0x6a, 0x6c, 0xf3 },
+	{ 0x80, 0x9f, 0x5f, 0x87, 0x3c, 0x1f, 0xd7, 0x61 },
+	{ 0xc0, 0x2f, 0xaf, 0xfe, 0xc9, 0x89, 0xd1, 0xfc },
+	{ 0x46, 0x15, 0xaa, 0x1d, 0x33, 0xe7, 0x2f, 0x10 },
+	{ 0x20, 0x55, 0x12, 0x33, 0x50, 0xc0, 0x08, 0x58 },
+	{ 0xdf, 0x3b, 0x99, 0xd6, 0x57, 0x73, 0x97, 0xc8 },
+	{ 0x31, 0xfe, 0x17, 0x36, 0x9b, 0x52, 0x88, 0xc9 },
+	{ 0xdf, 0xdd, 0x3c, 0xc6, 0x4d, 0xae, 0x16, 0x42 },
+	{ 0x17, 0x8c, 0x83, 0xce, 0x2b, 0x39, 0x9d, 0x94 },
+	{ 0x50, 0xf6, 0x36, 0x32, 0x4a, 0x9b, 0x7f, 0x80 },
+	{ 0xa8, 0x46, 0x8e, 0xe3, 0xbc, 0x18, 0xf0, 0x6d },
+	{ 0xa2, 0xdc, 0x9e, 0x92, 0xfd, 0x3c, 0xde, 0x92 },
+	{ 0xca, 0xc0, 0x9f, 0x79, 0x7d, 0x03, 0x12, 0x87 },
+	{ 0x90, 0xba, 0x68, 0x0b, 0x22, 0xae, 0xb5, 0x25 },
+	{ 0xce, 0x7a, 0x24, 0xf3, 0x50, 0xe2, 0x80, 0xb6 },
+	{ 0x88, 0x2b, 0xff, 0x0a, 0xa0, 0x1a, 0x0b, 0x87 },
+	{ 0x25, 0x61, 0x02, 0x88, 0x92, 0x45, 0x11, 0xc2 },
+	{ 0xc7, 0x15, 0x16, 0xc2, 0x9c, 0x75, 0xd1, 0x70 },
+	{ 0x51, 0x99, 0xc2, 0x9a, 0x52, 0xc9, 0xf0, 0x59 },
+	{ 0xc2, 0x2f, 0x0a, 0x29, 0x4a, 0x71, 0xf2, 0x9f },
+	{ 0xee, 0x37, 0x14, 0x83, 0x71, 0x4c, 0x02, 0xea },
+	{ 0xa8, 0x1f, 0xbd, 0x44, 0x8f, 0x9e, 0x52, 0x2f },
+	{ 0x4f, 0x64, 0x4c, 0x92, 0xe1, 0x92, 0xdf, 0xed },
+	{ 0x1a, 0xfa, 0x9a, 0x66, 0xa6, 0xdf, 0x92, 0xae },
+	{ 0xb3, 0xc1, 0xcc, 0x71, 0x5c, 0xb8, 0x79, 0xd8 },
+	{ 0x19, 0xd0, 0x32, 0xe6, 0x4a, 0xb0, 0xbd, 0x8b },
+	{ 0x3c, 0xfa, 0xa7, 0xa7, 0xdc, 0x87, 0x20, 0xdc },
+	{ 0xb7, 0x26, 0x5f, 0x7f, 0x44, 0x7a, 0xc6, 0xf3 },
+	{ 0x9d, 0xb7, 0x3b, 0x3c, 0x0d, 0x16, 0x3f, 0x54 },
+	{ 0x81, 0x81, 0xb6, 0x5b, 0xab, 0xf4, 0xa9, 0x75 },
+	{ 0x93, 0xc9, 0xb6, 0x40, 0x42, 0xea, 0xa2, 0x40 },
+	{ 0x55, 0x70, 0x53, 0x08, 0x29, 0x70, 0x55, 0x92 },
+	{ 0x86, 0x38, 0x80, 0x9e, 0x87, 0x87, 0x87, 0xa0 },
+	{ 0x41, 0xb9, 0xa7, 0x9a, 0xf7, 0x9a, 0xc2, 0x08 },
+	{ 0x7a, 0x9b, 0xe4, 0x2f, 0x20, 0x09, 0xa8, 0x92 },
+	{ 0x29, 0x03, 0x8d, 0x56, 0xba, 0x6d, 0x27, 0x45 },
+	{ 0x54, 0x95, 0xc6, 0xab, 0xf1, 0xe5, 0xdf, 0x51 },
+	{ 0xae, 0x13, 0xdb, 0xd5, 0x61, 0x48, 0x89, 0x33 },
+	{ 0x02, 0x4d, 0x1f, 0xfa, 0x89, 0x04, 0xe3, 0x89 },
+	{ 0xd1, 0x39, 0x97, 0x12, 0xf9, 0x9b, 0xf0, 0x2e },
+	{ 0x14, 0xc1, 0xd7, 0xc1, 0xcf, 0xfe, 0xc7, 0x9e },
+	{ 0x1d, 0xe5, 0x27, 0x9d, 0xae, 0x3b, 0xed, 0x6f },
+	{ 0xe9, 0x41, 0xa3, 0x3f, 0x85, 0x50, 0x13, 0x03 },
+	{ 0xda, 0x99, 0xdb, 0xbc, 0x9a, 0x03, 0xf3, 0x79 },
+	{ 0xb7, 0xfc, 0x92, 0xf9, 0x1d, 0x8e, 0x92, 0xe9 },
+	{ 0xae, 0x8e, 0x5c, 0xaa, 0x3c, 0xa0, 0x4e, 0x85 },
+	{ 0x9c, 0xc6, 0x2d, 0xf4, 0x3b, 0x6e, 0xed, 0x74 },
+	{ 0xd8, 0x63, 0xdb, 0xb5, 0xc5, 0x9a, 0x91, 0xa0 },
+	{ 0xa1, 0xab, 0x21, 0x90, 0x54, 0x5b, 0x91, 0xd7 },
+	{ 0x08, 0x75, 0x04, 0x1e, 0x64, 0xc5, 0x70, 0xf7 },
+	{ 0x5a, 0x59, 0x45, 0x28, 0xbe, 0xbe, 0xf1, 0xcc },
+	{ 0xfc, 0xdb, 0x32, 0x91, 0xde, 0x21, 0xf0, 0xc0 },
+	{ 0x86, 0x9e, 0xfd, 0x7f, 0x9f, 0x26, 0x5a, 0x09 }
+};
+
+/*
+ *	LM hash of "SecREt01"
+ */
+static uint8_t const lm_hash[16] = {
+	0xff, 0x37, 0x50, 0xbc, 0xc2, 0xb2, 0x24, 0x12,
+	0xc2, 0x26, 0x5b, 0x23, 0x73, 0x4e, 0x0d, 0xac
+};
+
+/*
+ *	RFC 2759 section 9.2, the NT hash of "clientPass", and the
+ *	NT-Response to the challenge.
+ */
+static uint8_t const nt_hash[16] = {
+	0x44, 0xeb, 0xba, 0x8d, 0x53, 0x12, 0xb8, 0xd6,
+	0x11, 0x47, 0x44, 0x11, 0xf5, 0x69, 0x89, 0xae
+};
+static uint8_t const nt_challenge[8] = { 0xd0, 0x2e, 0x43, 0x86, 0xbc, 0xe9, 0x12, 0x26 };
+static uint8_t const nt_response[24] = {
+	0x82, 0x30, 0x9e, 0xcd, 0x8d, 0x70, 0x8b, 0x5e,
+	0xa0, 0x8f, 0xaa, 0x39, 0x81, 0xcd, 0x83, 0x54,
+	0x42, 0x33, 0x11, 0x4a, 0x3d, 0x85, 0xd6, 0xdf
+};
+
+/*
+ *	Random inputs, the same on every run.
+ */
+static void fill(uint8_t *out, size_t len, uint32_t *seed)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		*seed = (*seed * 1103515245) + 12345;
+		out[i] = *seed >> 16;
+	}
+}
+
+/** Check the table driven DES gives the same answers as the bitwise one
+ *
+ */
+static void check_bitwise(int iterations)
+{
+	int		i;
+	size_t		j, len;
+	uint32_t	seed = 0x5eed;
+	uint8_t		key[7], block[8], hash[16], challenge[8];
+	uint8_t		out[24], expected[24];
+	char		password[15];
+
+	for (i = 0; i < iterations; i++) {
+		fill(key, sizeof(key), &seed);
+		fill(block, sizeof(block), &seed);
+
+		smbhash(out, block, key);
+		bitwise_smbhash(expected, block, key);
+		CHECK(memcmp(out, expected, 8) == 0);
+
+		fill(hash, sizeof(hash), &seed);
+		fill(challenge, sizeof(challenge), &seed);
+
+		smbdes_mschap(hash, challenge, out);
+		bitwise_smbdes_mschap(hash, challenge, expected);
+		CHECK(memcmp(out, expected, 24) == 0);
+
+		/*
+		 *	Printable passwords of every length up to 14,
+		 *	which is all the LM hash uses.
+		 */
+		len = i % sizeof(password);
+		fill((uint8_t *) password, len, &seed);
+		for (j = 0; j < len; j++) password[j] = 0x21 + ((uint8_t) password[j] % 0x5e);
+		password[len] = '\0';
+
+		smbdes_lmpwdhash(password, out);
+		bitwise_smbdes_lmpwdhash(password, expected);
+		CHECK(memcmp(out, expected, 16) == 0);
+	}
+}
+
+static double elapsed(struct timeval *start)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+
+	return (now.tv_sec - start->tv_sec) + ((now.tv_usec - start->tv_usec) / 1000000.0);
+}
+
+/*
+ *	Chain the responses, so the work can't be skipped.
+ */
+static double bench_mschap(void (*mschap)(uint8_t const *, uint8_t const *, uint8_t *), int iterations)
+{
+	int		i;
+	uint8_t		out[24], challenge[8];
+	struct timeval	start;
+
+	memcpy(challenge, nt_challenge, sizeof(challenge));
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++) {
+		mschap(nt_hash, challenge, out);
+		memcpy(challenge, out + 16, sizeof(challenge));
+	}
+
+	return iterations / elapsed(&start);
+}
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: mschap_des [OPTS]\n");
+	fprintf(stderr, "  -b                     Time MS-CHAP responses with the table driven and bitwise DES.\n");
+	fprintf(stderr, "  -D <dictdir>           Ignored.\n");
+	fprintf(stderr, "  -n <iterations>        Number of MS-CHAP responses to calculate with -b.\n");
+
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int		c, i, iterations = 20000;
+	bool		do_bench = false;
+	uint8_t		key[7], block[8], out[24];
+
+	while ((c = getopt(argc, argv, "bD:n:h")) != EOF) switch (c) {
+		case 'b':
+			do_bench = true;
+			break;
+		case 'D':
+			break;
+		case 'n':
+			iterations = atoi(optarg);
+			if (iterations <= 0) usage();
+			break;
+		case 'h':
+		default:
+			usage();
+	}
+
+	memcpy(key, des_key, sizeof(key));
+	smbhash(out, des_plain, key);
+	if (memcmp(out, des_cipher, sizeof(des_cipher)) != 0) {
+		fprintf(stderr, "mschap_des: smbhash() failed known answer test\n");
+		return 1;
+	}
+
+	memset(key, 0, sizeof(key));
+	for (i = 0; i < 64; i++) {
+		memset(block, 0, sizeof(block));
+		block[i >> 3] = 0x80 >> (i & 0x07);
+
+		smbhash(out, block, key);
+		if (memcmp(out, des_vp[i], sizeof(des_vp[i])) != 0) {
+			fprintf(stderr, "mschap_des: smbhash() failed variable plaintext known answer test %i\n", i);
+			return 1;
+		}
+	}
+
+	memset(block, 0, sizeof(block));
+	for (i = 0; i < 56; i++) {
+		memset(key, 0, sizeof(key));
+		key[i >> 3] = 0x80 >> (i & 0x07);
+
+		smbhash(out, block, key);
+		if (memcmp(out, des_vk[i], sizeof(des_vk[i])) != 0) {
+			fprintf(stderr, "mschap_des: smbhash() failed variable key known answer test %i\n", i);
+			return 1;
+		}
+	}
+
+	smbdes_lmpwdhash("SecREt01", out);
+	if (memcmp(out, lm_hash, sizeof(lm_hash)) != 0) {
+		fprintf(stderr, "mschap_des: smbdes_lmpwdhash() failed known answer test\n");
+		return 1;
+	}
+
+	smbdes_mschap(nt_hash, nt_challenge, out);
+	if (memcmp(out, nt_response, sizeof(nt_response)) != 0) {
+		fprintf(stderr, "mschap_des: smbdes_mschap() failed known answer test\n");
+		return 1;
+	}
+
+	check_bitwise(1000);
+
+	if (do_bench) {
+		printf("table    %10.0f responses/s\n", bench_mschap(smbdes_mschap, iterations));
+		printf("bitwise  %10.0f responses/s\n", bench_mschap(bitwise_smbdes_mschap, iterations));
+	}
+
+	return 0;
+}
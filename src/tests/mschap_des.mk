@@ -0,0 +1,8 @@
+TARGET		:= mschap_des
+SOURCES		:= mschap_des.c mschap_des_bitwise.c ${top_srcdir}/src/modules/rlm_mschap/smbdes.c
+
+TGT_PREREQS	:= libfreeradius-radius.a
+
+SRC_CFLAGS	:= -I${top_srcdir}/src/modules/rlm_mschap
+TGT_LDLIBS	:= $(LIBS)
+TGT_INSTALLDIR	:=
@@ -0,0 +1,32 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file mschap_des_bitwise.c
+ * @brief The bitwise DES from smbdes.c, for mschap_des to check the table driven one against.
+ *
+ * Includes smbdes.c with WITH_SMBDES_BITWISE defined, and its functions
+ * renamed, so both implementations can be linked into one program.
+ *
+ * @copyright 2015 The FreeRADIUS server project
+ */
+#define WITH_SMBDES_BITWISE
+#define smbhash			bitwise_smbhash
+#define smbdes_lmpwdhash	bitwise_smbdes_lmpwdhash
+#define smbdes_mschap		bitwise_smbdes_mschap
+
+#include "smbdes.c"
@@ -0,0 +1,392 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file pair_index.c
+ * @brief Check indexed VALUE_PAIR lists.
+ *
+ * Checks that fr_pair_add() indexes lists once they're long enough, then applies
+ * random edits to an indexed list with the fr_pair_* and fr_cursor_* functions,
+ * checking after every edit that lookups return the same VALUE_PAIR as a walk of
+ * the list.  With -b, also times looking up the attributes of a large
+ * Accounting-Request with and without the index.
+ *
+ * @copyright 2015 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+#include <freeradius-devel/conf.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+typedef struct pool_attr {
+	char const	*name;
+	char const	*value;
+	DICT_ATTR const	*da;
+} pool_attr_t;
+
+/*
+ *	Roughly what a NAS sends in an Interim-Update.
+ */
+static pool_attr_t pool[] = {
+	{ "User-Name",			"bob@example.com", NULL },
+	{ "NAS-IP-Address",		"192.0.2.1", NULL },
+	{ "NAS-Port",			"5", NULL },
+	{ "Service-Type",		"Framed-User", NULL },
+	{ "Framed-Protocol",		"PPP", NULL },
+	{ "Framed-IP-Address",		"10.0.0.1", NULL },
+	{ "Framed-IP-Netmask",		"255.255.255.255", NULL },
+	{ "Filter-Id",			"std.acl", NULL },
+	{ "Framed-MTU",			"1500", NULL },
+	{ "Class",			"0x00112233", NULL },
+	{ "Session-Timeout",		"86400", NULL },
+	{ "Idle-Timeout",		"600", NULL },
+	{ "Called-Station-Id",		"00-11-22-33-44-55:corp", NULL },
+	{ "Calling-Station-Id",		"66-77-88-99-AA-BB", NULL },
+	{ "NAS-Identifier",		"ap1.example.com", NULL },
+	{ "Acct-Status-Type",		"Interim-Update", NULL },
+	{ "Acct-Delay-Time",		"0", NULL },
+	{ "Acct-Input-Octets",		"123456", NULL },
+	{ "Acct-Output-Octets",		"654321", NULL },
+	{ "Acct-Session-Id",		"4D2BB8AC-00000098", NULL },
+	{ "Acct-Authentic",		"RADIUS", NULL },
+	{ "Acct-Session-Time",		"3600", NULL },
+	{ "Acct-Input-Packets",		"1234", NULL },
+	{ "Acct-Output-Packets",	"4321", NULL },
+	{ "Acct-Multi-Session-Id",	"6c0cf8dd5d8e5e3e", NULL },
+	{ "Acct-Link-Count",		"1", NULL },
+	{ "Acct-Input-Gigawords",	"0", NULL },
+	{ "Acct-Output-Gigawords",	"0", NULL },
+	{ "Event-Timestamp",		"1420070400", NULL },
+	{ "NAS-Port-Type",		"Wireless-802.11", NULL },
+	{ "Connect-Info",		"CONNECT 54Mbps 802.11g", NULL },
+	{ "NAS-Port-Id",		"wlan0", NULL },
+	{ "Framed-Interface-Id",	"0:0:0:1", NULL },
+	{ "Framed-IPv6-Prefix",		"2001:db8::/64", NULL },
+	{ "Delegated-IPv6-Prefix",	"2001:db8:1::/56", NULL },
+	{ "Acct-Interim-Interval",	"300", NULL },
+	{ "Chargeable-User-Identity",	"0x0102", NULL },
+	{ "Reply-Message",		"Hello", NULL },
+	{ "Proxy-State",		"0x01", NULL },
+	{ "Cisco-AVPair",		"ip:addr-pool=corp", NULL },
+	{ "Cisco-NAS-Port",		"Wi0/1", NULL },
+	{ "WISPr-Location-Name",	"example", NULL },
+	{ "Tunnel-Type",		"VLAN", NULL },
+	{ "Tunnel-Private-Group-Id",	"10", NULL },
+};
+
+#define POOL_SIZE (sizeof(pool) / sizeof(*pool))
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: pair_index [OPTS]\n");
+	fprintf(stderr, "  -b                     Time lookups with and without the index.\n");
+	fprintf(stderr, "  -D <dictdir>           Set main dictionary directory (defaults to " DICTDIR ").\n");
+	fprintf(stderr, "  -e <edits>             Number of random edits to check.\n");
+	fprintf(stderr, "  -n <iterations>        Number of times to look up each attribute with -b.\n");
+	fprintf(stderr, "  -s <seed>              Random seed.\n");
+
+	exit(1);
+}
+
+static VALUE_PAIR *pool_vp(TALLOC_CTX *ctx, unsigned int i)
+{
+	VALUE_PAIR *vp;
+
+	vp = fr_pair_afrom_da(ctx, pool[i].da);
+	if (!vp || (fr_pair_value_from_str(vp, pool[i].value, -1) < 0)) {
+		fr_perror("pair_index");
+		exit(1);
+	}
+
+	return vp;
+}
+
+/*
+ *	What the lookups should return.
+ */
+static VALUE_PAIR *walk_by_num(VALUE_PAIR *head, unsigned int attr, unsigned int vendor)
+{
+	VALUE_PAIR *vp;
+
+	for (vp = head; vp; vp = vp->next) {
+		if ((vp->da->attr == attr) && (vp->da->vendor == vendor)) break;
+	}
+
+	return vp;
+}
+
+static VALUE_PAIR *walk_by_da(VALUE_PAIR *head, DICT_ATTR const *da)
+{
+	VALUE_PAIR *vp;
+
+	for (vp = head; vp; vp = vp->next) {
+		if (vp->da == da) break;
+	}
+
+	return vp;
+}
+
+static int check(VALUE_PAIR *head, int edit, char const *what)
+{
+	unsigned int	i;
+	VALUE_PAIR	*vp;
+
+	for (vp = head ? head->next : NULL; vp; vp = vp->next) {
+		if (vp->index) {
+			fprintf(stderr, "pair_index: Edit %i (%s) left an index on %s, which isn't the head\n",
+				edit, what, vp->da->name);
+			return -1;
+		}
+	}
+
+	for (i = 0; i < POOL_SIZE; i++) {
+		DICT_ATTR const *da = pool[i].da;
+
+		if (fr_pair_find_by_num(head, da->attr, da->vendor, TAG_ANY) != walk_by_num(head, da->attr, da->vendor)) {
+			fprintf(stderr, "pair_index: Edit %i (%s) broke fr_pair_find_by_num() for %s\n",
+				edit, what, da->name);
+			return -1;
+		}
+
+		if (fr_pair_find_by_da(head, da, TAG_ANY) != walk_by_da(head, da)) {
+			fprintf(stderr, "pair_index: Edit %i (%s) broke fr_pair_find_by_da() for %s\n",
+				edit, what, da->name);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ *	Position a cursor on a random attribute in the list.
+ */
+static VALUE_PAIR *cursor_random(vp_cursor_t *cursor, VALUE_PAIR **head)
+{
+	VALUE_PAIR	*vp;
+	int		skip;
+
+	vp = fr_cursor_init(cursor, head);
+	for (skip = random() % 64; vp && (skip > 0); skip--) vp = fr_cursor_next(cursor);
+
+	return vp;
+}
+
+static int edits(TALLOC_CTX *ctx, int count)
+{
+	VALUE_PAIR	*head = NULL, *other = NULL, *vp;
+	vp_cursor_t	cursor;
+	unsigned int	i;
+	int		edit;
+	char const	*what = NULL;
+
+	/*
+	 *	fr_pair_add() indexes the list once it's long enough.
+	 */
+	for (i = 0; i < POOL_SIZE; i++) {
+		fr_pair_add(&head, pool_vp(ctx, i));
+		if (!head->index != ((i + 1) < FR_PAIR_INDEX_MIN)) {
+			fprintf(stderr, "pair_index: List of %u attributes was%s indexed\n",
+				i + 1, head->index ? "" : "n't");
+			return -1;
+		}
+	}
+
+	if (check(head, 0, "index") < 0) return -1;
+
+	for (edit = 1; edit <= count; edit++) {
+		vp = pool_vp(ctx, random() % POOL_SIZE);
+
+		switch (random() % 10) {
+		case 0:
+		case 1:
+			what = "fr_pair_add";
+			fr_pair_add(&head, vp);
+			vp = NULL;
+			break;
+
+		case 2:
+			what = "fr_pair_delete_by_num";
+			fr_pair_delete_by_num(&head, vp->da->attr, vp->da->vendor, TAG_ANY);
+			break;
+
+		case 3:
+			what = "fr_pair_replace";
+			fr_pair_replace(&head, vp);
+			vp = NULL;
+			break;
+
+		case 4:
+			what = "fr_cursor_insert";
+			fr_cursor_init(&cursor, &head);
+			fr_cursor_insert(&cursor, vp);
+			vp = NULL;
+			break;
+
+		case 5:
+			what = "fr_cursor_remove";
+			if (cursor_random(&cursor, &head)) talloc_free(fr_cursor_remove(&cursor));
+			break;
+
+		case 6:
+			what = "fr_cursor_replace";
+			if (cursor_random(&cursor, &head)) {
+				talloc_free(fr_cursor_replace(&cursor, vp));
+				vp = NULL;
+			}
+			break;
+
+		case 7:
+			what = "fr_pair_list_move_by_num";
+			fr_pair_list_move_by_num(ctx, &other, &head, vp->da->attr, vp->da->vendor, TAG_ANY);
+			break;
+
+		case 8:
+			what = "fr_pair_list_move_by_num";
+			fr_pair_list_move_by_num(ctx, &head, &other, vp->da->attr, vp->da->vendor, TAG_ANY);
+			break;
+
+		case 9:
+			what = "fr_pair_list_sort";
+			if ((random() % 8) == 0) fr_pair_list_sort(&head, fr_pair_cmp_by_da_tag);
+			break;
+		}
+		talloc_free(vp);
+
+		if (check(head, edit, what) < 0) return -1;
+
+		/*
+		 *	Sorting, and emptying the list drop the index.
+		 */
+		if (head && !head->index && (fr_pair_list_index(head) < 0)) return -1;
+		if (check(head, edit, "index") < 0) return -1;
+	}
+
+	fr_pair_list_free(&head);
+	fr_pair_list_free(&other);
+
+	return 0;
+}
+
+static double lookups(VALUE_PAIR *head, DICT_ATTR const **das, int num, int iterations)
+{
+	struct timeval	start, now;
+	int		i, j;
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++) {
+		for (j = 0; j < num; j++) (void) fr_pair_find_by_da(head, das[j], TAG_ANY);
+	}
+	gettimeofday(&now, NULL);
+
+	return (now.tv_sec - start.tv_sec) + ((now.tv_usec - start.tv_usec) / 1000000.0);
+}
+
+/** Time looking up attributes in a large list, with and without the index
+ *
+ */
+static int bench(TALLOC_CTX *ctx, int iterations)
+{
+	VALUE_PAIR	*head = NULL;
+	DICT_ATTR const	*das[POOL_SIZE + 2];
+	unsigned int	i;
+	int		num = 0;
+	double		walked, indexed;
+
+	for (i = 0; i < POOL_SIZE; i++) das[num++] = pool[i].da;
+
+	/*
+	 *	An 88 attribute Accounting-Request, with some attributes
+	 *	it doesn't contain (which are the worst case for a walk).
+	 */
+	for (i = 0; i < (POOL_SIZE * 2); i++) fr_pair_add(&head, pool_vp(ctx, i % POOL_SIZE));
+	das[num] = dict_attrbyname("Acct-Tunnel-Connection");
+	if (das[num]) num++;
+	das[num] = dict_attrbyname("Huntgroup-Name");
+	if (das[num]) num++;
+
+	fr_pair_list_unindex(head);
+	walked = lookups(head, das, num, iterations);
+	if (fr_pair_list_index(head) < 0) return -1;
+	indexed = lookups(head, das, num, iterations);
+
+	printf("walked   %10.0f lookups/s\n", (num * (double) iterations) / walked);
+	printf("indexed  %10.0f lookups/s\n", (num * (double) iterations) / indexed);
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int		c, count = 10000, iterations = 100000;
+	bool		do_bench = false;
+	unsigned int	i, seed = 0;
+	char const	*dict_dir = DICTDIR;
+
+	TALLOC_CTX	*ctx;
+
+	while ((c = getopt(argc, argv, "bD:e:n:s:h")) != EOF) switch (c) {
+		case 'b':
+			do_bench = true;
+			break;
+		case 'D':
+			dict_dir = optarg;
+			break;
+		case 'e':
+			count = atoi(optarg);
+			if (count < 0) usage();
+			break;
+		case 'n':
+			iterations = atoi(optarg);
+			if (iterations <= 0) usage();
+			break;
+		case 's':
+			seed = atoi(optarg);
+			break;
+		case 'h':
+		default:
+			usage();
+	}
+	srandom(seed);
+
+	if (dict_init(dict_dir, RADIUS_DICTIONARY) < 0) {
+		fr_perror("pair_index");
+		return 1;
+	}
+
+	for (i = 0; i < POOL_SIZE; i++) {
+		pool[i].da = dict_attrbyname(pool[i].name);
+		if (!pool[i].da) {
+			fprintf(stderr, "pair_index: Unknown attribute %s\n", pool[i].name);
+			return 1;
+		}
+	}
+
+	ctx = talloc_init("pair_index");
+
+	if (edits(ctx, count) < 0) return 1;
+	if (do_bench && (bench(ctx, iterations) < 0)) return 1;
+
+	talloc_free(ctx);
+	dict_free();
+
+	return 0;
+}
@@ -0,0 +1,6 @@
+TARGET		:= pair_index
+SOURCES		:= pair_index.c
+
+TGT_PREREQS	:= libfreeradius-radius.a
+TGT_LDLIBS	:= $(LIBS)
+TGT_INSTALLDIR	:=
@@ -0,0 +1,339 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file rad_verify.c
+ * @brief Check authenticating packets with rad_verify() and rad_sign().
+ *
+ * Checks fr_hmac_md5_calc() and fr_hmac_md5() against the RFC 2104 and
+ * RFC 2202 test vectors, then signs and verifies a corpus of packets with
+ * more shared secrets than rad_sign() and rad_verify() cache key schedules
+ * for.  Each packet must verify with its own secret, and no other.  With -b,
+ * also times HMAC-MD5 with and without the key schedule done in advance,
+ * and rad_verify() and rad_sign() over the corpus.
+ *
+ * @copyright 2015 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+#include <freeradius-devel/conf.h>
+#include <freeradius-devel/md5.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+typedef struct corpus_packet {
+	unsigned int	code;
+	char const	*vps;
+} corpus_packet_t;
+
+static corpus_packet_t corpus[] = {
+	/*
+	 *	802.1X from a wireless controller
+	 */
+	{ PW_CODE_ACCESS_REQUEST,
+	  "User-Name = 'bob@example.com', NAS-IP-Address = 192.0.2.1, NAS-Port = 5, "
+	  "Called-Station-Id = '00-11-22-33-44-55:corp', Calling-Station-Id = '66-77-88-99-AA-BB', "
+	  "NAS-Identifier = 'ap1.example.com', Framed-MTU = 1400, NAS-Port-Type = Wireless-802.11, "
+	  "Service-Type = Framed-User, Connect-Info = 'CONNECT 54Mbps 802.11g', "
+	  "EAP-Message = 0x0201001401626f62406578616d706c652e636f6d, State = 0x00112233445566778899aabbccddeeff, "
+	  "Message-Authenticator = 0x00" },
+
+	/*
+	 *	PAP
+	 */
+	{ PW_CODE_ACCESS_REQUEST,
+	  "User-Name = 'bob', User-Password = 'hello', NAS-IP-Address = 192.0.2.2, NAS-Port = 17, "
+	  "Message-Authenticator = 0x00" },
+
+	/*
+	 *	Broadband accounting from a BNG
+	 */
+	{ PW_CODE_ACCOUNTING_REQUEST,
+	  "Acct-Status-Type = Interim-Update, User-Name = 'bob@example.com', NAS-IP-Address = 192.0.2.1, "
+	  "NAS-Port = 5, NAS-Port-Type = Ethernet, NAS-Port-Id = 'ge-0/0/1.100:100-200', "
+	  "Service-Type = Framed-User, Framed-Protocol = PPP, Framed-IP-Address = 10.0.0.1, "
+	  "Acct-Session-Id = '4D2BB8AC-00000098', Acct-Session-Time = 3600, Acct-Delay-Time = 0, "
+	  "Acct-Input-Octets = 123456, Acct-Output-Octets = 654321" },
+
+	/*
+	 *	CoA from a policy server
+	 */
+	{ PW_CODE_COA_REQUEST,
+	  "User-Name = 'bob@example.com', Acct-Session-Id = '4D2BB8AC-00000098', "
+	  "Filter-Id = 'throttled', Message-Authenticator = 0x00" },
+};
+
+#define CORPUS_SIZE (sizeof(corpus) / sizeof(*corpus))
+
+/*
+ *	RFC 2104 test vectors, and the RFC 2202 one with a key
+ *	longer than a block.
+ */
+static struct {
+	char const	*key;
+	size_t		key_len;
+	char const	*text;
+	size_t		text_len;
+	char const	*digest;
+} vectors[] = {
+	{ "\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b", 16,
+	  "Hi There", 8,
+	  "\x92\x94\x72\x7a\x36\x38\xbb\x1c\x13\xf4\x8e\xf8\x15\x8b\xfc\x9d" },
+	{ "Jefe", 4,
+	  "what do ya want for nothing?", 28,
+	  "\x75\x0c\x78\x3e\x6a\xb0\xb5\x03\xea\xa8\x6e\x31\x0a\x5d\xb7\x38" },
+	{ "\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa", 16,
+	  "\xdd\xdd\xdd\xdd\xdd\xdd\xdd\xdd\xdd\xdd\xdd\xdd\xdd\xdd\xdd\xdd\xdd\xdd\xdd\xdd"
+	  "\xdd\xdd\xdd\xdd\xdd\xdd\xdd\xdd\xdd\xdd\xdd\xdd\xdd\xdd\xdd\xdd\xdd\xdd\xdd\xdd"
+	  "\xdd\xdd\xdd\xdd\xdd\xdd\xdd\xdd\xdd\xdd", 50,
+	  "\x56\xbe\x34\x52\x1d\x14\x4c\x88\xdb\xb8\xc7\x33\xf0\xe8\xb3\xf6" },
+	{ "\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa"
+	  "\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa"
+	  "\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa"
+	  "\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa", 80,
+	  "Test Using Larger Than Block-Size Key - Hash Key First", 54,
+	  "\x6b\x1a\xb7\xfe\x4b\xd7\xbf\x8f\x0b\x62\xe6\xce\x61\xb9\xd0\xcd" },
+};
+
+#define NUM_VECTORS (sizeof(vectors) / sizeof(*vectors))
+
+/*
+ *	More than the number of key schedules rad_sign() and
+ *	rad_verify() cache, so that entries are replaced.
+ */
+#define NUM_SECRETS (100)
+
+/*
+ *	rad_verify() leaves the packet modified when it fails, so
+ *	start from a copy of the signed packet every time.
+ */
+static int verify(RADIUS_PACKET *packet, uint8_t const *data, char const *secret)
+{
+	memcpy(packet->data, data, packet->data_len);
+
+	return rad_verify(packet, NULL, secret);
+}
+
+static double elapsed(struct timeval *start)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+
+	return (now.tv_sec - start->tv_sec) + ((now.tv_usec - start->tv_usec) / 1000000.0);
+}
+
+/** Time HMAC-MD5, and signing and verifying the corpus with one secret
+ *
+ */
+static int bench(RADIUS_PACKET **packets, int iterations)
+{
+	int		i;
+	unsigned int	j;
+	char const	*secret = "testing123";
+	FR_HMAC_MD5_CTX	hmac;
+	uint8_t		digest[MD5_DIGEST_LENGTH];
+	struct timeval	start;
+	double		uncached, cached, verifying, signing;
+
+	for (j = 0; j < CORPUS_SIZE; j++) {
+		TALLOC_FREE(packets[j]->data);
+		packets[j]->data_len = 0;
+
+		if ((rad_encode(packets[j], NULL, secret) < 0) || (rad_sign(packets[j], NULL, secret) < 0)) {
+			fr_perror("rad_verify");
+			return -1;
+		}
+	}
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++) {
+		fr_hmac_md5(digest, packets[0]->data, packets[0]->data_len,
+			    (uint8_t const *) secret, strlen(secret));
+	}
+	uncached = elapsed(&start);
+
+	gettimeofday(&start, NULL);
+	fr_hmac_md5_init(&hmac, (uint8_t const *) secret, strlen(secret));
+	for (i = 0; i < iterations; i++) {
+		fr_hmac_md5_calc(digest, &hmac, packets[0]->data, packets[0]->data_len);
+	}
+	cached = elapsed(&start);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++) {
+		for (j = 0; j < CORPUS_SIZE; j++) {
+			if (rad_verify(packets[j], NULL, secret) < 0) {
+				fr_perror("rad_verify");
+				return -1;
+			}
+		}
+	}
+	verifying = elapsed(&start);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++) {
+		for (j = 0; j < CORPUS_SIZE; j++) {
+			if (rad_sign(packets[j], NULL, secret) < 0) {
+				fr_perror("rad_verify");
+				return -1;
+			}
+		}
+	}
+	signing = elapsed(&start);
+
+	printf("hmac-md5 %10.0f/s with the key schedule done every time\n", iterations / uncached);
+	printf("hmac-md5 %10.0f/s with the key schedule done once\n", iterations / cached);
+	printf("verified %10.0f packets/s\n", (CORPUS_SIZE * (double) iterations) / verifying);
+	printf("signed   %10.0f packets/s\n", (CORPUS_SIZE * (double) iterations) / signing);
+
+	return 0;
+}
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: rad_verify [OPTS]\n");
+	fprintf(stderr, "  -b                     Time signing and verifying the corpus.\n");
+	fprintf(stderr, "  -D <dictdir>           Set main dictionary directory (defaults to " DICTDIR ").\n");
+	fprintf(stderr, "  -n <iterations>        Number of times to authenticate the corpus with -b.\n");
+
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int			c, iterations = 100000;
+	unsigned int		i, j, k;
+	bool			do_bench = false;
+	char const		*dict_dir = DICTDIR;
+	char			secrets[NUM_SECRETS][32];
+
+	TALLOC_CTX		*ctx;
+	RADIUS_PACKET		*packets[CORPUS_SIZE];
+	uint8_t			*signed_data[CORPUS_SIZE];
+	FR_HMAC_MD5_CTX		hmac;
+	uint8_t			digest[MD5_DIGEST_LENGTH];
+
+	while ((c = getopt(argc, argv, "bD:n:h")) != EOF) switch (c) {
+		case 'b':
+			do_bench = true;
+			break;
+		case 'D':
+			dict_dir = optarg;
+			break;
+		case 'n':
+			iterations = atoi(optarg);
+			if (iterations <= 0) usage();
+			break;
+		case 'h':
+		default:
+			usage();
+	}
+
+	/*
+	 *	Check that continuing from the key schedule gives
+	 *	the same answer as doing it every time.
+	 */
+	for (j = 0; j < NUM_VECTORS; j++) {
+		fr_hmac_md5_init(&hmac, (uint8_t const *) vectors[j].key, vectors[j].key_len);
+		fr_hmac_md5_calc(digest, &hmac, (uint8_t const *) vectors[j].text, vectors[j].text_len);
+		if (memcmp(digest, vectors[j].digest, sizeof(digest)) != 0) {
+			fprintf(stderr, "rad_verify: fr_hmac_md5_calc() failed test vector %u\n", j);
+			return 1;
+		}
+
+		fr_hmac_md5(digest, (uint8_t const *) vectors[j].text, vectors[j].text_len,
+			    (uint8_t const *) vectors[j].key, vectors[j].key_len);
+		if (memcmp(digest, vectors[j].digest, sizeof(digest)) != 0) {
+			fprintf(stderr, "rad_verify: fr_hmac_md5() failed test vector %u\n", j);
+			return 1;
+		}
+	}
+
+	if (dict_init(dict_dir, RADIUS_DICTIONARY) < 0) {
+		fr_perror("rad_verify");
+		return 1;
+	}
+
+	ctx = talloc_init("rad_verify");
+
+	for (j = 0; j < CORPUS_SIZE; j++) {
+		signed_data[j] = NULL;
+		packets[j] = rad_alloc(ctx, true);
+		packets[j]->code = corpus[j].code;
+		packets[j]->id = j;
+		if (fr_pair_list_afrom_str(packets[j], corpus[j].vps, &packets[j]->vps) == T_INVALID) {
+			fr_perror("rad_verify");
+			return 1;
+		}
+	}
+
+	for (i = 0; i < NUM_SECRETS; i++) snprintf(secrets[i], sizeof(secrets[i]), "testing%u", i);
+
+	/*
+	 *	Sign the packets with each secret in turn, and check
+	 *	they don't verify with any of the others.  That fills
+	 *	the cache of key schedules with other secrets, so
+	 *	checking they do verify with their own secret shows
+	 *	the schedule used to sign them was the right one.
+	 */
+	for (i = 0; i < NUM_SECRETS; i++) {
+		for (j = 0; j < CORPUS_SIZE; j++) {
+			TALLOC_FREE(packets[j]->data);
+			talloc_free(signed_data[j]);
+			packets[j]->data_len = 0;
+
+			if ((rad_encode(packets[j], NULL, secrets[i]) < 0) ||
+			    (rad_sign(packets[j], NULL, secrets[i]) < 0)) {
+				fr_perror("rad_verify");
+				return 1;
+			}
+
+			signed_data[j] = talloc_memdup(packets[j], packets[j]->data, packets[j]->data_len);
+		}
+
+		for (k = 0; k < NUM_SECRETS; k++) {
+			if (k == i) continue;
+
+			for (j = 0; j < CORPUS_SIZE; j++) {
+				if (verify(packets[j], signed_data[j], secrets[k]) == 0) {
+					fprintf(stderr, "rad_verify: Packet %u signed with \"%s\" verified with \"%s\"\n",
+						j, secrets[i], secrets[k]);
+					return 1;
+				}
+			}
+		}
+
+		for (j = 0; j < CORPUS_SIZE; j++) {
+			if (verify(packets[j], signed_data[j], secrets[i]) < 0) {
+				fprintf(stderr, "rad_verify: Packet %u signed with \"%s\" didn't verify: %s\n",
+					j, secrets[i], fr_strerror());
+				return 1;
+			}
+		}
+	}
+
+	if (do_bench && (bench(packets, iterations) < 0)) return 1;
+
+	talloc_free(ctx);
+	dict_free();
+
+	return 0;
+}
@@ -0,0 +1,6 @@
+TARGET		:= rad_verify
+SOURCES		:= rad_verify.c
+
+TGT_PREREQS	:= libfreeradius-radius.a
+TGT_LDLIBS	:= $(LIBS)
+TGT_INSTALLDIR	:=
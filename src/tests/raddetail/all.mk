@@ -0,0 +1,55 @@
+#
+#  Round trip tests for converting detail files with raddetail.
+#
+#  Each text file is converted to binary, and back to text, which
+#  must be the same as the original.  The text is converted to binary
+#  again, which must be the same as the first binary file.  The date
+#  at the start of each entry is written in local time, so the tests
+#  are run in UTC.
+#
+RADDETAIL_FILES := $(subst $(DIR)/,,$(wildcard $(DIR)/*.txt))
+
+#
+#  Create the output directory
+#
+.PHONY: $(BUILD_DIR)/tests/raddetail
+$(BUILD_DIR)/tests/raddetail:
+	@mkdir -p $@
+
+#
+#	src/tests/raddetail/FOO		input file
+#	build/tests/raddetail/FOO	updated if the test succeeds
+#	build/tests/raddetail/FOO.bin	the input converted to binary
+#	build/tests/raddetail/FOO.out	the binary file converted back to text
+#
+$(BUILD_DIR)/tests/raddetail/%: $(DIR)/% $(TESTBINDIR)/raddetail | $(BUILD_DIR)/tests/raddetail
+	@echo RADDETAIL-TEST $(notdir $@)
+	@if ! TZ=UTC $(TESTBIN)/raddetail -D share -b $< $@.bin || \
+	    ! TZ=UTC $(TESTBIN)/raddetail -D share -t $@.bin $@.out || \
+	    ! TZ=UTC $(TESTBIN)/raddetail -D share -b $@.out $@.bin2; then \
+		echo "TZ=UTC $(TESTBIN)/raddetail -D share -b $< $@.bin"; \
+		exit 1; \
+	fi
+	@if ! diff $< $@.out; then \
+		echo "Text differs after conversion: diff $< $@.out"; \
+		exit 1; \
+	fi
+	@if ! cmp $@.bin $@.bin2; then \
+		echo "Binary differs after conversion: cmp $@.bin $@.bin2"; \
+		exit 1; \
+	fi
+	@touch $@
+
+#
+#  Get all of the test output files
+#
+TESTS.RADDETAIL_FILES := $(addprefix $(BUILD_DIR)/tests/raddetail/,$(RADDETAIL_FILES))
+
+#
+#  Depend on the output files, and create the directory first.
+#
+tests.raddetail: $(TESTS.RADDETAIL_FILES)
+
+.PHONY: clean.tests.raddetail
+clean.tests.raddetail:
+	@rm -rf $(BUILD_DIR)/tests/raddetail/
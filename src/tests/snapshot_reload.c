@@ -0,0 +1,325 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file snapshot_reload.c
+ * @brief Check that snapshots can be reloaded while they're being used.
+ *
+ * Threads acquire and release the data while it's reloaded over and over,
+ * and check they never see a version which has been freed, or an older
+ * version than one they've already seen.  Then checks that every replaced
+ * version is freed, that changed files are noticed, and that snapshots
+ * can be reloaded by name, and freed while their data is still in use.
+ *
+ * @copyright 2015 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/snapshot.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+#include <sys/wait.h>
+#include <utime.h>
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/stdatomic.h>
+#endif
+
+#define NUM_THREADS	(8)
+#define MAGIC		(0x5a5a5a5a)
+
+#ifdef HAVE_PTHREAD_H
+pid_t rad_fork(void)
+{
+	return fork();
+}
+
+pid_t rad_waitpid(pid_t pid, int *status)
+{
+	return waitpid(pid, status, 0);
+}
+#endif
+
+#define CHECK(_x) do { \
+	if (!(_x)) { \
+		fprintf(stderr, "snapshot_reload: %s[%u]: Check \"%s\" failed\n", __FILE__, __LINE__, #_x); \
+		exit(1); \
+	} \
+} while (0)
+
+typedef struct test_data_t {
+	uint32_t	magic;		//!< Cleared when the data is freed.
+	uint64_t	number;		//!< Incremented every time the data is built.
+} test_data_t;
+
+typedef _Atomic(uint64_t) atomic_count_t;
+
+static uint64_t		built;		//!< Only modified by the thread building the data.
+static atomic_count_t	freed;		//!< Versions may be freed by any thread.
+
+static int _test_data_free(test_data_t *data)
+{
+	data->magic = 0;
+	atomic_fetch_add(&freed, 1);
+
+	return 0;
+}
+
+static void *test_build(TALLOC_CTX *ctx, UNUSED void *uctx)
+{
+	test_data_t *data;
+
+	data = talloc_zero(ctx, test_data_t);
+	data->magic = MAGIC;
+	data->number = ++built;
+	talloc_set_destructor(data, _test_data_free);
+
+	return data;
+}
+
+#ifdef HAVE_PTHREAD_H
+typedef _Atomic(bool) atomic_done_t;
+
+static atomic_done_t done;
+
+/** Use the data until we're told to stop
+ *
+ */
+static void *use_thread(void *arg)
+{
+	fr_snapshot_t	*snap = arg;
+	test_data_t	*data;
+	uint64_t	seen = 0;
+	int		i;
+
+	while (!atomic_load(&done)) {
+		data = fr_snapshot_acquire(snap);
+		CHECK(data != NULL);
+		CHECK(data->magic == MAGIC);
+		CHECK(data->number >= seen);
+		seen = data->number;
+
+		/*
+		 *	Hold on to it for a while, so reloads
+		 *	happen while it's in use.
+		 */
+		for (i = 0; i < 100; i++) CHECK(data->magic == MAGIC);
+
+		fr_snapshot_release(snap, data);
+	}
+
+	return NULL;
+}
+
+/** Reload the data while threads are using it
+ *
+ */
+static void test_concurrent(int reloads)
+{
+	fr_snapshot_t	*snap;
+	pthread_t	threads[NUM_THREADS];
+	int		i;
+
+	built = 0;
+	atomic_store(&freed, 0);
+
+	snap = fr_snapshot_init(NULL, "concurrent", test_build, NULL, 0);
+	CHECK(snap != NULL);
+	CHECK(fr_snapshot_load(snap) == 0);
+
+	for (i = 0; i < NUM_THREADS; i++) CHECK(pthread_create(&threads[i], NULL, use_thread, snap) == 0);
+
+	for (i = 0; i < reloads; i++) CHECK(fr_snapshot_load(snap) == 0);
+
+	atomic_store(&done, true);
+	for (i = 0; i < NUM_THREADS; i++) pthread_join(threads[i], NULL);
+
+	/*
+	 *	Every version but the current one has been freed.
+	 */
+	CHECK(built == (uint64_t) reloads + 1);
+	CHECK(atomic_load(&freed) == built - 1);
+	CHECK(fr_snapshot_version(snap) == built);
+
+	talloc_free(snap);
+	CHECK(atomic_load(&freed) == built);
+}
+#endif
+
+/** Versions which are in use aren't freed until they're released
+ *
+ */
+static void test_release(void)
+{
+	fr_snapshot_t	*snap;
+	test_data_t	*first, *second;
+
+	built = 0;
+	atomic_store(&freed, 0);
+
+	snap = fr_snapshot_init(NULL, "release", test_build, NULL, 0);
+	CHECK(snap != NULL);
+	CHECK(fr_snapshot_acquire(snap) == NULL);
+	CHECK(fr_snapshot_version(snap) == 0);
+
+	CHECK(fr_snapshot_load(snap) == 0);
+	first = fr_snapshot_acquire(snap);
+	CHECK(first && (first->number == 1));
+
+	CHECK(fr_snapshot_load(snap) == 0);
+	CHECK(fr_snapshot_version(snap) == 2);
+	CHECK(atomic_load(&freed) == 0);
+
+	second = fr_snapshot_acquire(snap);
+	CHECK(second && (second->number == 2));
+
+	fr_snapshot_release(snap, first);
+	CHECK(atomic_load(&freed) == 1);
+
+	/*
+	 *	The snapshot can go away before its data.
+	 */
+	talloc_free(snap);
+	CHECK(atomic_load(&freed) == 1);
+	CHECK(second->magic == MAGIC);
+
+	fr_snapshot_release(NULL, second);
+	CHECK(atomic_load(&freed) == 2);
+}
+
+/** Reloading by name only finds snapshots which still exist
+ *
+ */
+static void test_by_name(void)
+{
+	fr_snapshot_t	*snap;
+
+	built = 0;
+	atomic_store(&freed, 0);
+
+	snap = fr_snapshot_init(NULL, "by_name", test_build, NULL, 0);
+	CHECK(snap != NULL);
+	CHECK(fr_snapshot_load(snap) == 0);
+
+	CHECK(fr_snapshot_reload_by_name("no_such_module") == -2);
+	CHECK(fr_snapshot_reload_by_name("by_name") == 0);
+
+	/*
+	 *	Freeing the snapshot waits for the reload.
+	 */
+	talloc_free(snap);
+	CHECK(built == 2);
+	CHECK(atomic_load(&freed) == 2);
+
+	CHECK(fr_snapshot_reload_by_name("by_name") == -2);
+}
+
+/** Changed files are reloaded by the next acquire after the check interval
+ *
+ */
+static void test_check(void)
+{
+	fr_snapshot_t	*snap;
+	test_data_t	*data;
+	char		filename[] = "/tmp/snapshot_reload.XXXXXX";
+	struct utimbuf	times;
+	int		fd, i;
+
+	built = 0;
+	atomic_store(&freed, 0);
+
+	fd = mkstemp(filename);
+	CHECK(fd >= 0);
+	close(fd);
+
+	snap = fr_snapshot_init(NULL, "check", test_build, NULL, 1);
+	CHECK(snap != NULL);
+	CHECK(fr_snapshot_watch(snap, filename) == 0);
+	CHECK(fr_snapshot_load(snap) == 0);
+
+	/*
+	 *	Unchanged, so nothing is reloaded.
+	 */
+	sleep(2);
+	data = fr_snapshot_acquire(snap);
+	fr_snapshot_release(snap, data);
+	CHECK(fr_snapshot_version(snap) == 1);
+
+	times.actime = times.modtime = time(NULL) + 10;
+	CHECK(utime(filename, &times) == 0);
+
+	/*
+	 *	The reload runs in the background, so
+	 *	keep acquiring until it's done.
+	 */
+	sleep(2);
+	for (i = 0; (i < 500) && (fr_snapshot_version(snap) == 1); i++) {
+		data = fr_snapshot_acquire(snap);
+		CHECK(data && (data->magic == MAGIC));
+		fr_snapshot_release(snap, data);
+		usleep(10000);
+	}
+	CHECK(fr_snapshot_version(snap) == 2);
+
+	talloc_free(snap);
+	CHECK(atomic_load(&freed) == 2);
+
+	unlink(filename);
+}
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: snapshot_reload [OPTS]\n");
+	fprintf(stderr, "  -D <dictdir>           Ignored.\n");
+	fprintf(stderr, "  -r <reloads>           Number of reloads while threads use the data.\n");
+
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int c, reloads = 2000;
+
+	while ((c = getopt(argc, argv, "D:r:h")) != EOF) switch (c) {
+		case 'D':
+			break;
+		case 'r':
+			reloads = atoi(optarg);
+			if (reloads <= 0) usage();
+			break;
+		case 'h':
+		default:
+			usage();
+	}
+
+	default_log.dst = L_DST_NULL;
+
+#ifdef HAVE_PTHREAD_H
+	test_concurrent(reloads);
+#endif
+	test_release();
+	test_by_name();
+	test_check();
+
+	return 0;
+}
@@ -0,0 +1,6 @@
+TARGET		:= snapshot_reload
+SOURCES		:= snapshot_reload.c
+
+TGT_PREREQS	:= libfreeradius-server.a libfreeradius-radius.a
+TGT_LDLIBS	:= $(LIBS)
+TGT_INSTALLDIR	:=
@@ -7,7 +7,7 @@
 #  functionality from earlier tests.
 #
 FILES  := rfc.txt errors.txt extended.txt lucent.txt wimax.txt \
-	escape.txt condition.txt xlat.txt vendor.txt dhcp.txt
+	escape.txt condition.txt xlat.txt vendor.txt lookup.txt dhcp.txt
 
 #
 #  Create the output directory
@@ -0,0 +1,320 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file xlat_expand.c
+ * @brief Check expanding run time format strings with cached tokens.
+ *
+ * Expands format strings, including the default SQL accounting start query,
+ * against a representative Accounting-Request, both by tokenizing the format
+ * string (as radius_xlat() did before format strings were cached), and with
+ * radius_axlat(), and checks both produce the same output, including after
+ * the request has changed.  With -b, also times both methods.
+ *
+ * @copyright 2015 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/radiusd.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+#include <sys/wait.h>
+#ifdef HAVE_PTHREAD_H
+pid_t rad_fork(void)
+{
+	return fork();
+}
+
+pid_t rad_waitpid(pid_t pid, int *status)
+{
+	return waitpid(pid, status, 0);
+}
+#endif
+
+/*
+ *	From raddb/mods-config/sql/main/mysql/queries.conf
+ */
+static char const *query = "INSERT INTO radacct (acctsessionid, acctuniqueid, username, realm, "
+			   "nasipaddress, nasportid, nasporttype, acctstarttime, acctupdatetime, "
+			   "acctstoptime, acctsessiontime, acctauthentic, connectinfo_start, "
+			   "connectinfo_stop, acctinputoctets, acctoutputoctets, calledstationid, "
+			   "callingstationid, acctterminatecause, servicetype, framedprotocol, "
+			   "framedipaddress, framedipv6address, framedipv6prefix, framedinterfaceid, "
+			   "delegatedipv6prefix) VALUES "
+			   "('%{Acct-Session-Id}', '%{Acct-Unique-Session-Id}', '%{User-Name}', "
+			   "'%{Realm}', '%{NAS-IP-Address}', '%{%{NAS-Port-ID}:-%{NAS-Port}}', "
+			   "'%{NAS-Port-Type}', FROM_UNIXTIME(%{integer:Event-Timestamp}), "
+			   "FROM_UNIXTIME(%{integer:Event-Timestamp}), NULL, '0', '%{Acct-Authentic}', "
+			   "'%{Connect-Info}', '', '0', '0', '%{Called-Station-Id}', "
+			   "'%{Calling-Station-Id}', '', '%{Service-Type}', '%{Framed-Protocol}', "
+			   "'%{Framed-IP-Address}', '%{Framed-IPv6-Address}', '%{Framed-IPv6-Prefix}', "
+			   "'%{Framed-Interface-Id}', '%{Delegated-IPv6-Prefix}')";
+
+static char const *packet_vps = "Acct-Status-Type = Start, Acct-Session-Id = '4D2BB8AC-00000098', "
+				"Acct-Unique-Session-Id = '6c0cf8dd5d8e5e3e', User-Name = 'bob@example.com', "
+				"Realm = 'example.com', NAS-IP-Address = 192.0.2.1, NAS-Port = 5, "
+				"NAS-Port-Type = Wireless-802.11, Event-Timestamp = 'Jan  1 2015 00:00:00 UTC', "
+				"Acct-Authentic = RADIUS, Connect-Info = 'CONNECT 54Mbps 802.11g', "
+				"Called-Station-Id = '00-11-22-33-44-55:corp', "
+				"Calling-Station-Id = '66-77-88-99-AA-BB', Service-Type = Framed-User, "
+				"Framed-Protocol = PPP, Framed-IP-Address = 10.0.0.1";
+
+/*
+ *	Other format strings to check, with the query.
+ */
+static char const *formats[] = {
+	"%{User-Name}",
+	"%{%{Stripped-User-Name}:-%{User-Name}}",
+	"%{strlen:%{Calling-Station-Id}} on %{NAS-IP-Address}:%{NAS-Port}",
+	"%{length:User-Name} %{integer:NAS-Port-Type} %{Acct-Status-Type}",
+	"%{Vendor-Specific} %%{User-Name} literal \\ text",
+	"%{Framed-IP-Address}/%{Class[#]} %{hex:Class} %{User-Name[*]}",
+	NULL
+};
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: xlat_expand [OPTS]\n");
+	fprintf(stderr, "  -b                     Time tokenizing on every call against cached expansion.\n");
+	fprintf(stderr, "  -D <dictdir>           Set main dictionary directory (defaults to " DICTDIR ").\n");
+	fprintf(stderr, "  -n <iterations>        Number of times to expand the query with -b.\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(1);
+}
+
+static ssize_t xlat_bench(UNUSED void *instance, UNUSED REQUEST *request,
+			  UNUSED char const *fmt, char *out, UNUSED size_t outlen)
+{
+	*out = '\0';
+	return 0;
+}
+
+/*
+ *	Similar to the escaping rlm_sql does.
+ */
+static size_t escape_quotes(UNUSED REQUEST *request, char *out, size_t outlen, char const *in, UNUSED void *arg)
+{
+	char *p = out, *end = out + outlen - 1;
+
+	while (*in && (p < end)) {
+		if ((*in == '\'') || (*in == '\\')) {
+			if ((end - p) < 2) break;
+			*p++ = '\\';
+		}
+		*p++ = *in++;
+	}
+	*p = '\0';
+
+	return p - out;
+}
+
+static double elapsed(struct timeval *start)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+
+	return (now.tv_sec - start->tv_sec) + ((now.tv_usec - start->tv_usec) / 1000000.0);
+}
+
+/** Check a cached expansion matches one from freshly tokenized format string
+ *
+ */
+static int check_format(REQUEST *request, char const *query_fmt)
+{
+	char		*expected, *out, *fmt;
+	char const	*error;
+	xlat_exp_t	*head;
+	int		i;
+
+	fmt = talloc_typed_strdup(request, query_fmt);
+	if (xlat_tokenize(fmt, fmt, &head, &error) < 0) {
+		fprintf(stderr, "xlat_expand: \"%s\": %s\n", query_fmt, error);
+		return -1;
+	}
+	if (radius_axlat_struct(&expected, request, head, escape_quotes, NULL) < 0) {
+		fprintf(stderr, "xlat_expand: Failed expanding \"%s\"\n", query_fmt);
+		return -1;
+	}
+	talloc_free(fmt);
+
+	/*
+	 *	The first call tokenizes and caches, the second uses
+	 *	the cached tokens.
+	 */
+	for (i = 0; i < 2; i++) {
+		if (radius_axlat(&out, request, query_fmt, escape_quotes, NULL) < 0) {
+			fprintf(stderr, "xlat_expand: Failed expanding \"%s\" with radius_axlat\n", query_fmt);
+			return -1;
+		}
+
+		if (strcmp(out, expected) != 0) {
+			fprintf(stderr, "xlat_expand: Cached expansion of \"%s\" does not match\n", query_fmt);
+			fprintf(stderr, "  expected: %s\n", expected);
+			fprintf(stderr, "  got     : %s\n", out);
+			return -1;
+		}
+		talloc_free(out);
+	}
+
+	if (rad_debug_lvl) printf("%s\n", expected);
+	talloc_free(expected);
+
+	return 0;
+}
+
+/** Check every format string
+ *
+ */
+static int check_formats(REQUEST *request)
+{
+	int i;
+
+	if (check_format(request, query) < 0) return -1;
+
+	for (i = 0; formats[i]; i++) if (check_format(request, formats[i]) < 0) return -1;
+
+	return 0;
+}
+
+/** Time tokenizing the query on every call against using the cached tokens
+ *
+ */
+static int bench(REQUEST *request, int iterations)
+{
+	int		i;
+	struct timeval	start;
+	double		uncached, cached;
+	char		*out, *fmt;
+	char const	*error;
+	xlat_exp_t	*head;
+
+	/*
+	 *	Tokenize on every expansion.
+	 */
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++) {
+		fmt = talloc_typed_strdup(request, query);
+		if (xlat_tokenize(fmt, fmt, &head, &error) < 0) return -1;
+		if (radius_axlat_struct(&out, request, head, escape_quotes, NULL) < 0) return -1;
+		talloc_free(out);
+		talloc_free(fmt);
+	}
+	uncached = elapsed(&start);
+
+	/*
+	 *	Tokenized format strings are cached.
+	 */
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++) {
+		if (radius_axlat(&out, request, query, escape_quotes, NULL) < 0) return -1;
+		talloc_free(out);
+	}
+	cached = elapsed(&start);
+
+	printf("tokenized per call  %10.0f expansions/s\n", iterations / uncached);
+	printf("cached              %10.0f expansions/s\n", iterations / cached);
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int			c, iterations = 100000;
+	bool			do_bench = false;
+	char const		*dict_dir = DICTDIR;
+
+	REQUEST			*request;
+	VALUE_PAIR		*vp;
+
+	while ((c = getopt(argc, argv, "bD:n:xh")) != EOF) switch (c) {
+		case 'b':
+			do_bench = true;
+			break;
+		case 'D':
+			dict_dir = optarg;
+			break;
+		case 'n':
+			iterations = atoi(optarg);
+			if (iterations <= 0) usage();
+			break;
+		case 'x':
+			fr_debug_lvl++;
+			rad_debug_lvl = fr_debug_lvl;
+			break;
+		case 'h':
+		default:
+			usage();
+	}
+
+	if (fr_check_lib_magic(RADIUSD_MAGIC_NUMBER) < 0) {
+		fr_perror("xlat_expand");
+		return 1;
+	}
+
+	if (dict_init(dict_dir, RADIUS_DICTIONARY) < 0) {
+		fr_perror("xlat_expand");
+		return 1;
+	}
+
+	/*
+	 *	Registers the built in expansions too.
+	 */
+	if (xlat_register("bench", xlat_bench, NULL, NULL) < 0) {
+		fprintf(stderr, "xlat_expand: Failed registering xlat\n");
+		return 1;
+	}
+
+	request = request_alloc(NULL);
+	request->packet = rad_alloc(request, false);
+	request->reply = rad_alloc(request, false);
+	if (fr_pair_list_afrom_str(request->packet, packet_vps, &request->packet->vps) == T_INVALID) {
+		fr_perror("xlat_expand");
+		return 1;
+	}
+
+	if (check_formats(request) < 0) return 1;
+
+	/*
+	 *	Only the tokens are cached, not the output, so
+	 *	expansions must follow changes to the request.
+	 */
+	vp = fr_pair_find_by_num(request->packet->vps, PW_USER_NAME, 0, TAG_ANY);
+	fr_pair_value_strcpy(vp, "o'brien@example.com");
+	if (fr_pair_list_afrom_str(request->packet, "Stripped-User-Name = \"o'brien\", Class = 0x01020304, "
+				   "Class = 0x05060708", &request->packet->vps) == T_INVALID) {
+		fr_perror("xlat_expand");
+		return 1;
+	}
+
+	if (check_formats(request) < 0) return 1;
+
+	if (do_bench && (bench(request, iterations) < 0)) {
+		fprintf(stderr, "xlat_expand: Failed expanding query\n");
+		return 1;
+	}
+
+	talloc_free(request);
+	xlat_free();
+	dict_free();
+
+	return 0;
+}
@@ -0,0 +1,6 @@
+TARGET		:= xlat_expand
+SOURCES		:= xlat_expand.c
+
+TGT_PREREQS	:= libfreeradius-server.a libfreeradius-radius.a
+TGT_LDLIBS	:= $(LIBS)
+TGT_INSTALLDIR	:=